@@ -0,0 +1,247 @@
+// CacheManager::read_file() under concurrent readers, once with every file
+// cached and once with a budget too small to hold any, so each read goes
+// to disk. Hits through read_shared() are also compared against the layout
+// the cache replaced: two std::string keyed maps, a std::list of filename
+// copies and contents returned by value, with allocations per hit.
+
+#include "common/file_operations.hpp"
+#include "common/logging.hpp"
+#include "server/cache_manager.hpp"
+
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <new>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// Per thread, so counting does not make the threads contend
+thread_local uint64_t t_allocations = 0;
+
+} // namespace
+
+// Not inlined, GCC would pair the malloc() and free() inside with the new
+// and delete expressions and report them as mismatched
+[[gnu::noinline]] void *operator new(size_t size)
+{
+    ++t_allocations;
+    if (void *ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+[[gnu::noinline]] void operator delete(void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+namespace {
+
+using namespace fenris;
+namespace fs = std::filesystem;
+
+constexpr size_t FILE_COUNT = 256;
+constexpr size_t FILE_BYTES = 4096;
+
+/**
+ * Files shared by every benchmark in this file, written on first use and
+ * removed at exit
+ */
+class FileSet {
+  public:
+    static const FileSet &get()
+    {
+        static const FileSet files;
+        return files;
+    }
+
+    ~FileSet()
+    {
+        std::error_code error;
+        fs::remove_all(m_dir, error);
+    }
+
+    const std::vector<std::string> &paths() const
+    {
+        return m_paths;
+    }
+
+  private:
+    FileSet()
+        : m_dir(fs::temp_directory_path() /
+                ("fenris_benchmarks_" + std::to_string(getpid())))
+    {
+        common::set_log_level(common::LogLevel::WARN);
+        fs::create_directories(m_dir);
+        for (size_t i = 0; i < FILE_COUNT; ++i) {
+            m_paths.push_back((m_dir / ("file" + std::to_string(i))).string());
+            common::write_file(m_paths.back(), std::string(FILE_BYTES, 'x'));
+        }
+    }
+
+    fs::path m_dir;
+    std::vector<std::string> m_paths;
+};
+
+server::CacheManager *g_cache = nullptr;
+
+void read_files(benchmark::State &state)
+{
+    const auto &paths = FileSet::get().paths();
+    size_t index = static_cast<size_t>(state.thread_index()) * 31;
+    for (auto _ : state) {
+        std::string content = g_cache->read_file(paths[index % paths.size()]);
+        benchmark::DoNotOptimize(content.data());
+        ++index;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_CacheReadHit(benchmark::State &state)
+{
+    if (state.thread_index() == 0) {
+        const auto &paths = FileSet::get().paths();
+        server::CacheConfig config;
+        config.max_bytes = 4 * FILE_COUNT * FILE_BYTES;
+        g_cache = new server::CacheManager(config, "CacheBenchmark");
+        for (const auto &path : paths) {
+            g_cache->read_file(path);
+        }
+    }
+    read_files(state);
+    if (state.thread_index() == 0) {
+        delete g_cache;
+        g_cache = nullptr;
+    }
+}
+BENCHMARK(BM_CacheReadHit)->ThreadRange(1, 8)->UseRealTime();
+
+void BM_CacheReadMiss(benchmark::State &state)
+{
+    if (state.thread_index() == 0) {
+        FileSet::get();
+        // Every shard's slice is smaller than one file, nothing is admitted
+        server::CacheConfig config;
+        config.max_bytes = FILE_BYTES;
+        g_cache = new server::CacheManager(config, "CacheBenchmark");
+    }
+    read_files(state);
+    if (state.thread_index() == 0) {
+        delete g_cache;
+        g_cache = nullptr;
+    }
+}
+BENCHMARK(BM_CacheReadMiss)->ThreadRange(1, 8)->UseRealTime();
+
+// The cache as it was before the byte budget and the intrusive table
+class LegacyLruCache {
+  public:
+    std::string read_file(const std::string &filename)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_cache.find(filename);
+            if (it != m_cache.end()) {
+                update_lru(filename);
+                return it->second;
+            }
+        }
+
+        auto [data, result] = common::read_file(filename);
+        if (result != common::FileOperationResult::SUCCESS) {
+            return "";
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cache[filename] = data;
+        update_lru(filename);
+        return data;
+    }
+
+  private:
+    void update_lru(const std::string &filename)
+    {
+        auto it = m_lru_map.find(filename);
+        if (it != m_lru_map.end()) {
+            m_lru_list.erase(it->second);
+        }
+        m_lru_list.push_front(filename);
+        m_lru_map[filename] = m_lru_list.begin();
+    }
+
+    std::unordered_map<std::string, std::string> m_cache;
+    std::unordered_map<std::string, std::list<std::string>::iterator> m_lru_map;
+    std::list<std::string> m_lru_list;
+    std::mutex m_mutex;
+};
+
+LegacyLruCache *g_legacy_cache = nullptr;
+
+// Time hits spread over every file, counting this thread's allocations
+template <typename Read> void hit_files(benchmark::State &state, Read read)
+{
+    const auto &paths = FileSet::get().paths();
+    size_t index = static_cast<size_t>(state.thread_index()) * 31;
+    const uint64_t allocations = t_allocations;
+    for (auto _ : state) {
+        auto content = read(paths[index % paths.size()]);
+        benchmark::DoNotOptimize(content);
+        ++index;
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["allocs_per_hit"] =
+        benchmark::Counter(static_cast<double>(t_allocations - allocations),
+                           benchmark::Counter::kAvgIterations);
+}
+
+void BM_LegacyCacheHit(benchmark::State &state)
+{
+    if (state.thread_index() == 0) {
+        g_legacy_cache = new LegacyLruCache();
+        for (const auto &path : FileSet::get().paths()) {
+            g_legacy_cache->read_file(path);
+        }
+    }
+    hit_files(state, [](const std::string &path) {
+        return g_legacy_cache->read_file(path);
+    });
+    if (state.thread_index() == 0) {
+        delete g_legacy_cache;
+        g_legacy_cache = nullptr;
+    }
+}
+BENCHMARK(BM_LegacyCacheHit)->ThreadRange(1, 8)->UseRealTime();
+
+void BM_CacheReadSharedHit(benchmark::State &state)
+{
+    if (state.thread_index() == 0) {
+        server::CacheConfig config;
+        config.max_bytes = 4 * FILE_COUNT * FILE_BYTES;
+        g_cache = new server::CacheManager(config, "CacheBenchmark");
+        for (const auto &path : FileSet::get().paths()) {
+            g_cache->read_shared(path);
+        }
+    }
+    hit_files(state, [](const std::string &path) {
+        return g_cache->read_shared(path);
+    });
+    if (state.thread_index() == 0) {
+        delete g_cache;
+        g_cache = nullptr;
+    }
+}
+BENCHMARK(BM_CacheReadSharedHit)->ThreadRange(1, 8)->UseRealTime();
+
+} // namespace
@@ -0,0 +1,170 @@
+// Every codec on payloads shaped like what crosses the wire: source-like
+// text, a serialized directory listing, JSON-ish records and random bytes
+// standing in for compressed media. Each iteration is one message, as the
+// connection layer sends them.
+
+#include "common/codec.hpp"
+#include "fenris.pb.h"
+
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using namespace fenris;
+using namespace fenris::common::compress;
+
+constexpr size_t PAYLOAD_BYTES = 256 * 1024;
+
+enum Payload { TEXT, LISTING, RECORDS, RANDOM };
+
+std::vector<uint8_t> make_text(size_t size, std::mt19937 &gen)
+{
+    static const char *words[] = {"static", "const", "return", "server",
+                                  "client", "request", "buffer", "size_t",
+                                  "if",     "for",   "{",      "}",
+                                  "(",      ")",     ";\n",    "    "};
+    std::vector<uint8_t> text;
+    text.reserve(size);
+    while (text.size() < size) {
+        const std::string word = words[gen() % 16];
+        text.insert(text.end(), word.begin(), word.end());
+        text.push_back(' ');
+    }
+    text.resize(size);
+    return text;
+}
+
+std::vector<uint8_t> make_listing(size_t size, std::mt19937 &gen)
+{
+    fenris::DirectoryListing listing;
+    for (size_t i = 0; listing.ByteSizeLong() < size; ++i) {
+        fenris::FileInfo *entry = listing.add_entries();
+        entry->set_name("file_" + std::to_string(i) + ".dat");
+        entry->set_size(gen() % (1 << 20));
+        entry->set_modified_time(1700000000 + gen() % 100000);
+        entry->set_permissions(0644);
+    }
+    const std::string bytes = listing.SerializeAsString();
+    return {bytes.begin(), bytes.end()};
+}
+
+std::vector<uint8_t> make_records(size_t size, std::mt19937 &gen)
+{
+    std::string records;
+    for (size_t i = 0; records.size() < size; ++i) {
+        records += "{\"id\":" + std::to_string(i) +
+                   ",\"user\":\"user" + std::to_string(gen() % 500) +
+                   "\",\"bytes\":" + std::to_string(gen() % 100000) +
+                   ",\"ok\":true}\n";
+    }
+    records.resize(size);
+    return {records.begin(), records.end()};
+}
+
+std::vector<uint8_t> make_random(size_t size, std::mt19937 &gen)
+{
+    std::vector<uint8_t> bytes(size);
+    for (auto &byte : bytes) {
+        byte = static_cast<uint8_t>(gen());
+    }
+    return bytes;
+}
+
+std::vector<uint8_t> make_payload(int64_t payload)
+{
+    std::mt19937 gen(42);
+    switch (payload) {
+    case TEXT:
+        return make_text(PAYLOAD_BYTES, gen);
+    case LISTING:
+        return make_listing(PAYLOAD_BYTES, gen);
+    case RECORDS:
+        return make_records(PAYLOAD_BYTES, gen);
+    default:
+        return make_random(PAYLOAD_BYTES, gen);
+    }
+}
+
+// Arguments are the codec, its level and the payload
+void codec_args(benchmark::internal::Benchmark *benchmark)
+{
+    benchmark->ArgNames({"codec", "level", "payload"});
+    for (int64_t payload : {TEXT, LISTING, RECORDS, RANDOM}) {
+        benchmark->Args({static_cast<int64_t>(CodecId::NONE), 0, payload});
+        benchmark->Args({static_cast<int64_t>(CodecId::LZ4), 0, payload});
+        benchmark->Args({static_cast<int64_t>(CodecId::DEFLATE), 1, payload});
+        benchmark->Args({static_cast<int64_t>(CodecId::DEFLATE), 6, payload});
+    }
+}
+
+std::unique_ptr<Codec> codec_for(const benchmark::State &state)
+{
+    CodecOptions options;
+    options.level = static_cast<int>(state.range(1));
+    return make_codec(static_cast<CodecId>(state.range(0)), options);
+}
+
+void BM_CodecCompress(benchmark::State &state)
+{
+    const std::vector<uint8_t> input = make_payload(state.range(2));
+    auto encoder = codec_for(state);
+    if (!encoder) {
+        state.SkipWithError("codec not available");
+        return;
+    }
+
+    std::vector<uint8_t> message;
+    for (auto _ : state) {
+        message.clear();
+        if (encoder->compress(input, message) != CompressionResult::SUCCESS) {
+            state.SkipWithError("compression failed");
+            break;
+        }
+        benchmark::DoNotOptimize(message.data());
+    }
+    state.SetBytesProcessed(state.iterations() * input.size());
+    state.counters["ratio"] =
+        message.empty() ? 0.0
+                        : static_cast<double>(input.size()) /
+                              static_cast<double>(message.size());
+}
+BENCHMARK(BM_CodecCompress)->Apply(codec_args);
+
+void BM_CodecDecompress(benchmark::State &state)
+{
+    const std::vector<uint8_t> input = make_payload(state.range(2));
+    auto encoder = codec_for(state);
+    auto decoder = codec_for(state);
+    if (!encoder || !decoder) {
+        state.SkipWithError("codec not available");
+        return;
+    }
+
+    // Codecs carrying history restore messages in the order they were
+    // compressed, so each one is compressed right before it is timed
+    std::vector<uint8_t> message;
+    std::vector<uint8_t> restored;
+    for (auto _ : state) {
+        state.PauseTiming();
+        message.clear();
+        restored.clear();
+        const CompressionResult compressed = encoder->compress(input, message);
+        state.ResumeTiming();
+        if (compressed != CompressionResult::SUCCESS ||
+            decoder->decompress(message, 0, restored) !=
+                CompressionResult::SUCCESS ||
+            restored.size() != input.size()) {
+            state.SkipWithError("round trip failed");
+            break;
+        }
+        benchmark::DoNotOptimize(restored.data());
+    }
+    state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_CodecDecompress)->Apply(codec_args);
+
+} // namespace
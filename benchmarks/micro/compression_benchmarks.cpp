@@ -0,0 +1,81 @@
+// zlib through CompressionManager at the levels a deployment would pick,
+// on text-like input that compresses about as well as source code.
+
+#include "common/compression_manager.hpp"
+
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+using namespace fenris::common::compress;
+
+std::vector<uint8_t> text_like(size_t size)
+{
+    static const std::string words[] = {
+        "fenris ", "request ", "response ", "buffer ", "cache ",
+        "file ",   "server ",  "client ",   "\n",      "{ }; "};
+    std::vector<uint8_t> data;
+    data.reserve(size);
+    uint32_t state = 12345;
+    while (data.size() < size) {
+        state = state * 1103515245 + 12345;
+        const std::string &word = words[(state >> 16) % 10];
+        data.insert(data.end(), word.begin(), word.end());
+    }
+    data.resize(size);
+    return data;
+}
+
+void BM_Compress(benchmark::State &state)
+{
+    CompressionManager compression_manager;
+    const int level = static_cast<int>(state.range(0));
+    const std::vector<uint8_t> input = text_like(state.range(1));
+
+    size_t compressed_size = 0;
+    for (auto _ : state) {
+        auto [compressed, result] = compression_manager.compress(input, level);
+        if (result != CompressionResult::SUCCESS) {
+            state.SkipWithError("compression failed");
+            break;
+        }
+        compressed_size = compressed.size();
+        benchmark::DoNotOptimize(compressed.data());
+    }
+    state.SetBytesProcessed(state.iterations() * input.size());
+    state.counters["ratio"] =
+        compressed_size == 0 ? 0.0
+                             : static_cast<double>(input.size()) /
+                                   static_cast<double>(compressed_size);
+}
+BENCHMARK(BM_Compress)
+    ->ArgNames({"level", "bytes"})
+    ->ArgsProduct({{1, 6, 9}, {4 * 1024, 256 * 1024}});
+
+void BM_Decompress(benchmark::State &state)
+{
+    CompressionManager compression_manager;
+    const std::vector<uint8_t> input = text_like(state.range(0));
+    const auto [compressed, compress_result] =
+        compression_manager.compress(input, 6);
+    if (compress_result != CompressionResult::SUCCESS) {
+        state.SkipWithError("compression failed");
+        return;
+    }
+
+    for (auto _ : state) {
+        auto [restored, result] =
+            compression_manager.decompress(compressed, input.size());
+        if (result != CompressionResult::SUCCESS) {
+            state.SkipWithError("decompression failed");
+            break;
+        }
+        benchmark::DoNotOptimize(restored.data());
+    }
+    state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_Decompress)->Arg(4 * 1024)->Arg(256 * 1024);
+
+} // namespace
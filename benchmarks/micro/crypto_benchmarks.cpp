@@ -0,0 +1,108 @@
+// AES-GCM through CryptoManager::encrypt_data() and decrypt_data(), the
+// per-message keyed path, against a CryptoSession keyed once per connection,
+// from a PING sized message to a large file chunk.
+
+#include "common/crypto_manager.hpp"
+#include "common/crypto_session.hpp"
+
+#include <benchmark/benchmark.h>
+#include <vector>
+
+namespace {
+
+using namespace fenris::common;
+using namespace fenris::common::crypto;
+
+const std::vector<uint8_t> KEY(AES_GCM_KEY_SIZE, 0x11);
+const std::vector<uint8_t> IV(AES_GCM_IV_SIZE, 0x22);
+
+void BM_EncryptData(benchmark::State &state)
+{
+    CryptoManager crypto_manager;
+    const std::vector<uint8_t> plaintext(state.range(0), 0x5A);
+
+    for (auto _ : state) {
+        auto [ciphertext, result] =
+            crypto_manager.encrypt_data(plaintext, KEY, IV);
+        if (result != EncryptionResult::SUCCESS) {
+            state.SkipWithError("encryption failed");
+            break;
+        }
+        benchmark::DoNotOptimize(ciphertext.data());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_EncryptData)->RangeMultiplier(16)->Range(64, 1 << 20);
+
+void BM_DecryptData(benchmark::State &state)
+{
+    CryptoManager crypto_manager;
+    const std::vector<uint8_t> plaintext(state.range(0), 0x5A);
+    const auto [ciphertext, seal_result] =
+        crypto_manager.encrypt_data(plaintext, KEY, IV);
+    if (seal_result != EncryptionResult::SUCCESS) {
+        state.SkipWithError("encryption failed");
+        return;
+    }
+
+    for (auto _ : state) {
+        auto [restored, result] =
+            crypto_manager.decrypt_data(ciphertext, KEY, IV);
+        if (result != EncryptionResult::SUCCESS) {
+            state.SkipWithError("decryption failed");
+            break;
+        }
+        benchmark::DoNotOptimize(restored.data());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_DecryptData)->RangeMultiplier(16)->Range(64, 1 << 20);
+
+void BM_SessionEncrypt(benchmark::State &state)
+{
+    CryptoSession session;
+    if (session.set_key(KEY) != EncryptionResult::SUCCESS) {
+        state.SkipWithError("keying failed");
+        return;
+    }
+    const std::vector<uint8_t> plaintext(state.range(0), 0x5A);
+
+    for (auto _ : state) {
+        auto [ciphertext, result] = session.encrypt(plaintext, IV);
+        if (result != EncryptionResult::SUCCESS) {
+            state.SkipWithError("encryption failed");
+            break;
+        }
+        benchmark::DoNotOptimize(ciphertext.data());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SessionEncrypt)->RangeMultiplier(16)->Range(64, 1 << 20);
+
+void BM_SessionDecrypt(benchmark::State &state)
+{
+    CryptoSession session;
+    if (session.set_key(KEY) != EncryptionResult::SUCCESS) {
+        state.SkipWithError("keying failed");
+        return;
+    }
+    const std::vector<uint8_t> plaintext(state.range(0), 0x5A);
+    const auto [ciphertext, seal_result] = session.encrypt(plaintext, IV);
+    if (seal_result != EncryptionResult::SUCCESS) {
+        state.SkipWithError("encryption failed");
+        return;
+    }
+
+    for (auto _ : state) {
+        auto [restored, result] = session.decrypt(ciphertext, IV);
+        if (result != EncryptionResult::SUCCESS) {
+            state.SkipWithError("decryption failed");
+            break;
+        }
+        benchmark::DoNotOptimize(restored.data());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SessionDecrypt)->RangeMultiplier(16)->Range(64, 1 << 20);
+
+} // namespace
@@ -0,0 +1,126 @@
+// The delta sync steps on a file with a few scattered edits: the weak
+// checksum against a plain byte loop, signing the old file and computing the
+// delta of the new one, which also reports how much of the file it carries.
+
+#include "common/delta_sync.hpp"
+
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <random>
+#include <vector>
+
+namespace {
+
+using namespace fenris::common::delta;
+
+constexpr size_t FILE_BYTES = 16 * 1024 * 1024;
+constexpr size_t EDITS = 16;
+
+/**
+ * A random file and a copy with edits inserting, overwriting or dropping a
+ * few bytes each, made on first use
+ */
+struct Files {
+    static const Files &get()
+    {
+        static const Files files;
+        return files;
+    }
+
+    std::vector<uint8_t> base;
+    std::vector<uint8_t> target;
+
+  private:
+    Files() : base(FILE_BYTES)
+    {
+        std::mt19937 gen(42);
+        for (auto &byte : base) {
+            byte = static_cast<uint8_t>(gen());
+        }
+        target = base;
+        for (size_t i = 0; i < EDITS; ++i) {
+            const size_t offset = gen() % target.size();
+            switch (i % 3) {
+            case 0:
+                target.insert(target.begin() + offset, 32, 0x5a);
+                break;
+            case 1:
+                target[offset] ^= 0xff;
+                break;
+            default:
+                target.erase(target.begin() + offset,
+                             target.begin() +
+                                 std::min(offset + 32, target.size()));
+                break;
+            }
+        }
+    }
+};
+
+// The checksum as weak_checksum() computes it without vector code
+uint32_t scalar_checksum(const std::vector<uint8_t> &data)
+{
+    uint32_t a = 0;
+    uint32_t b = 0;
+    for (uint8_t x : data) {
+        a += x;
+        b += a;
+    }
+    return (a & 0xffff) | (b << 16);
+}
+
+void BM_ScalarChecksum(benchmark::State &state)
+{
+    const auto &base = Files::get().base;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(scalar_checksum(base));
+    }
+    state.SetBytesProcessed(state.iterations() * base.size());
+}
+BENCHMARK(BM_ScalarChecksum);
+
+void BM_WeakChecksum(benchmark::State &state)
+{
+    const auto &base = Files::get().base;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(weak_checksum(base));
+    }
+    state.SetBytesProcessed(state.iterations() * base.size());
+}
+BENCHMARK(BM_WeakChecksum);
+
+void BM_ComputeSignatures(benchmark::State &state)
+{
+    const auto &base = Files::get().base;
+    const size_t block_size = block_size_for(base.size());
+    for (auto _ : state) {
+        fenris::FileSignatures signatures =
+            compute_signatures(base, block_size);
+        benchmark::DoNotOptimize(signatures.blocks_size());
+    }
+    state.SetBytesProcessed(state.iterations() * base.size());
+}
+BENCHMARK(BM_ComputeSignatures)->Unit(benchmark::kMillisecond);
+
+void BM_ComputeDelta(benchmark::State &state)
+{
+    const auto &files = Files::get();
+    const fenris::FileSignatures signatures =
+        compute_signatures(files.base, block_size_for(files.base.size()));
+
+    size_t literal_bytes = 0;
+    for (auto _ : state) {
+        fenris::Delta delta = compute_delta(signatures, files.target);
+        literal_bytes = 0;
+        for (const auto &op : delta.ops()) {
+            literal_bytes += op.literal().size();
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * files.target.size());
+    state.counters["literal_ratio"] =
+        static_cast<double>(literal_bytes) /
+        static_cast<double>(files.target.size());
+}
+BENCHMARK(BM_ComputeDelta)->Unit(benchmark::kMillisecond);
+
+} // namespace
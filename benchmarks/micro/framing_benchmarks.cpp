@@ -0,0 +1,47 @@
+// Length-prefixed framing with send_prefixed_data() over a local socketpair,
+// drained by a receiver thread, so the numbers are the cost of the syscalls
+// and copies rather than of a network.
+
+#include "common/network_utils.hpp"
+
+#include <benchmark/benchmark.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+using namespace fenris::common;
+using namespace fenris::common::network;
+
+void BM_SendPrefixedData(benchmark::State &state)
+{
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+        state.SkipWithError("socketpair failed");
+        return;
+    }
+
+    std::thread receiver([fd = sockets[1]]() {
+        std::vector<uint8_t> message;
+        while (receive_prefixed_data(fd, message) == NetworkResult::SUCCESS) {
+        }
+    });
+
+    const std::vector<uint8_t> payload(state.range(0), 0x5A);
+    for (auto _ : state) {
+        if (send_prefixed_data(sockets[0], payload) != NetworkResult::SUCCESS) {
+            state.SkipWithError("send failed");
+            break;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+
+    close(sockets[0]);
+    receiver.join();
+    close(sockets[1]);
+}
+BENCHMARK(BM_SendPrefixedData)->RangeMultiplier(16)->Range(16, 1 << 20);
+
+} // namespace
@@ -0,0 +1,47 @@
+// Protobuf encoding of the messages on every round trip: a WRITE_FILE
+// request going out and a FILE_CONTENT response coming back.
+
+#include "common/request.hpp"
+#include "common/response.hpp"
+
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+using namespace fenris::common;
+
+void BM_SerializeRequest(benchmark::State &state)
+{
+    fenris::Request request;
+    request.set_command(fenris::RequestType::WRITE_FILE);
+    request.set_filename("/projects/fenris/src/server/request_manager.cpp");
+    request.set_data(std::string(state.range(0), 'x'));
+
+    for (auto _ : state) {
+        std::vector<uint8_t> serialized = serialize_request(request);
+        benchmark::DoNotOptimize(serialized.data());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SerializeRequest)->RangeMultiplier(16)->Range(16, 1 << 20);
+
+void BM_DeserializeResponse(benchmark::State &state)
+{
+    fenris::Response response;
+    response.set_type(fenris::ResponseType::FILE_CONTENT);
+    response.set_success(true);
+    response.mutable_file_info()->set_size(state.range(0));
+    response.set_data(std::string(state.range(0), 'x'));
+    const std::vector<uint8_t> serialized = serialize_response(response);
+
+    for (auto _ : state) {
+        fenris::Response parsed = deserialize_response(serialized);
+        benchmark::DoNotOptimize(parsed.data().data());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_DeserializeResponse)->RangeMultiplier(16)->Range(16, 1 << 20);
+
+} // namespace
@@ -0,0 +1,141 @@
+#ifndef FENRIS_CLIENT_ASYNC_CONNECTION_HPP
+#define FENRIS_CLIENT_ASYNC_CONNECTION_HPP
+
+#include "client/connection_manager.hpp"
+#include "common/logging.hpp"
+#include "fenris.pb.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+namespace fenris {
+namespace client {
+
+/**
+ * Future of one request sent through an AsyncConnection. It holds
+ * std::nullopt if the request could not be sent or the connection failed
+ * before the response arrived.
+ */
+using ResponseFuture = std::future<std::optional<fenris::Response>>;
+
+/**
+ * @class AsyncConnection
+ * @brief Lets many threads drive one connected session at the same time
+ *
+ * While started, the AsyncConnection owns the socket of a connected
+ * ConnectionManager: submit() may be called from any thread, and a reader
+ * thread receives the responses and fulfils the futures submit() returned.
+ * With CAPABILITY_PIPELINING negotiated, responses are matched by request
+ * ID and may complete in any order; without it the server answers in order
+ * and the futures complete in the order of submission.
+ *
+ * Rekeying is done here rather than by ConnectionManager::send_request(),
+ * since only the reader thread may receive: the submitting thread sends
+ * REKEY and waits until the reader has installed the new key.
+ *
+ * Nothing else may use the ConnectionManager between start() and stop().
+ */
+class AsyncConnection {
+  public:
+    /**
+     * @brief Constructor
+     * @param connection_manager Connected session, must outlive this object
+     * @param logger_name Name for this connection's logger
+     */
+    explicit AsyncConnection(
+        ConnectionManager &connection_manager,
+        const std::string &logger_name = "ClientAsyncConnection");
+
+    /**
+     * @brief Destructor, calls stop()
+     */
+    ~AsyncConnection();
+
+    AsyncConnection(const AsyncConnection &) = delete;
+    AsyncConnection &operator=(const AsyncConnection &) = delete;
+
+    /**
+     * @brief Start the reader thread
+     * @return true if running, false if the session is not connected
+     */
+    bool start();
+
+    /**
+     * @brief Wait for the outstanding responses and stop the reader thread
+     *
+     * Requests submitted after this fail right away. The ConnectionManager
+     * can be used directly again once stop() returns.
+     */
+    void stop();
+
+    /**
+     * @brief Send a request, tagged with a fresh request ID
+     * @param request The request to send, its request_id is overwritten
+     * @return Future of the response
+     */
+    ResponseFuture submit(fenris::Request request);
+
+    /**
+     * @brief Number of requests still waiting for their response
+     * @return The count
+     */
+    size_t outstanding() const;
+
+  private:
+    /**
+     * @brief Receive responses and complete their futures until stopped
+     */
+    void read_responses();
+
+    /**
+     * @brief Hand a response to whoever waits for it
+     * @param response The received response
+     * @return false if it answers no outstanding request
+     */
+    bool deliver(fenris::Response response);
+
+    /**
+     * @brief Complete every outstanding future with std::nullopt
+     */
+    void fail_outstanding();
+
+    /**
+     * @brief Replace the session key in the middle of submissions
+     * @return true once the reader has installed the new key
+     *
+     * Called with m_send_mutex held, so nothing is sent under the old key
+     * after REKEY.
+     */
+    bool rekey();
+
+    ConnectionManager &m_connection_manager;
+
+    // Held while a request is encrypted and sent
+    std::mutex m_send_mutex;
+
+    // Outstanding requests by ID, and the REKEY among them if any
+    mutable std::mutex m_pending_mutex;
+    std::condition_variable m_pending_cv;
+    std::map<uint64_t, std::promise<std::optional<fenris::Response>>>
+        m_pending;
+    std::optional<ConnectionManager::PendingRekey> m_rekey;
+    uint64_t m_rekey_id{0};
+    std::optional<bool> m_rekey_result;
+    bool m_accepting{false};
+    bool m_reader_done{true};
+
+    std::thread m_reader;
+    common::Logger m_logger;
+};
+
+} // namespace client
+} // namespace fenris
+
+#endif // FENRIS_CLIENT_ASYNC_CONNECTION_HPP
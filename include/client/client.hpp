@@ -3,11 +3,13 @@
 
 #include "client/connection_manager.hpp"
 #include "client/interface.hpp"
+#include "client/read_cache.hpp"
 #include "client/request_manager.hpp"
 #include "client/response_manager.hpp"
 #include "common/logging.hpp"
 #include <cstdint>
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -75,10 +77,50 @@ class Client {
      */
     bool process_command(const std::vector<std::string> &command_parts);
 
+    /**
+     * @brief Stream a file to or from the server in blocks
+     * @param command_parts "upload <local> [remote]" or
+     *                      "download <remote> [local]"
+     */
+    void process_transfer(const std::vector<std::string> &command_parts);
+
+    /**
+     * @brief Answer a READ_FILE from the read cache while its lease lasts
+     * @param request Request about to be sent, made conditional on the
+     * cached copy if that needs revalidating
+     * @return The cached content as a FILE_CONTENT response, nullopt if the
+     * request has to go to the server
+     */
+    std::optional<fenris::Response> read_cached(fenris::Request &request);
+
+    /**
+     * @brief Update the read cache and directory from a server response
+     * @param request Request that was sent
+     * @param response Response to it, a not_modified one gets the cached
+     * content filled in
+     * @param sent_at When the request was sent, where its lease starts
+     * @return false if the server confirmed a copy that is no longer cached
+     */
+    bool remember_response(const fenris::Request &request,
+                           fenris::Response &response,
+                           ReadCache::Clock::time_point sent_at);
+
+    /**
+     * @brief Drop cached files a request may have changed
+     * @param request Request that was answered, batches are walked
+     * @param response Response to it
+     * @param directory Working directory the request resolved against,
+     * moved by successful CHANGE_DIRs
+     */
+    void forget_changes(const fenris::Request &request,
+                        const fenris::Response &response,
+                        std::string &directory);
+
     std::unique_ptr<ConnectionManager> m_connection_manager;
     std::unique_ptr<ITUI> m_tui;
     RequestManager m_request_manager;
     ResponseManager m_response_manager;
+    ReadCache m_read_cache;
     common::Logger m_logger;
     bool m_exit_requested{false};
 };
@@ -1,8 +1,12 @@
 #ifndef FENRIS_CLIENT_CONNECTION_MANAGER_HPP
 #define FENRIS_CLIENT_CONNECTION_MANAGER_HPP
 
+#include "common/buffer.hpp"
 #include "common/crypto_manager.hpp"
+#include "common/crypto_session.hpp"
 #include "common/logging.hpp"
+#include "common/nonce_sequence.hpp"
+#include "common/wire_compression.hpp"
 #include "fenris.pb.h"
 
 #include <atomic>
@@ -10,7 +14,10 @@
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <span>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 namespace fenris {
@@ -23,6 +30,16 @@ struct ServerInfo {
     std::string port;
     std::string current_directory;
     std::vector<uint8_t> encryption_key;
+    // AES-GCM keyed with encryption_key once per connection
+    std::shared_ptr<common::crypto::CryptoSession> session;
+    // Capabilities accepted by the server, see fenris::Capability
+    uint32_t capabilities{0};
+    // Set when CAPABILITY_COMPRESSION was negotiated
+    std::shared_ptr<common::compress::WireCompression> compression;
+    // Set when CAPABILITY_SEQUENCED_NONCES was negotiated: the nonces this
+    // side seals with and the ones it expects from the server
+    std::shared_ptr<common::crypto::NonceSequence> send_nonces;
+    std::shared_ptr<common::crypto::NonceSequence> receive_nonces;
 };
 
 /**
@@ -33,6 +50,8 @@ struct ServerInfo {
  * and provides an interface for sending requests and receiving responses.
  */
 class ConnectionManager {
+    friend class AsyncConnection;
+
   public:
     /**
      * @brief Constructor without server information
@@ -66,6 +85,105 @@ class ConnectionManager {
      */
     void set_non_blocking_mode(bool enabled);
 
+    /**
+     * @brief Ask the server for CAPABILITY_PLAINTEXT_FILE_STREAM
+     * @param enabled Whether to request the capability on the next connect()
+     *
+     * If the server accepts, READ_FILE content arrives unencrypted as a
+     * separate frame after the response, which lets the server sendfile() it.
+     * Only the response header stays encrypted, so use this on trusted
+     * networks only.
+     */
+    void set_plaintext_file_streaming(bool enabled);
+
+    /**
+     * @brief Ask the server for CAPABILITY_SEALED_FILE_STREAM
+     * @param enabled Whether to request the capability on the next connect()
+     *
+     * If the server accepts, large READ_FILE content arrives after the
+     * response as chunks sealed under a key derived for that stream, which
+     * the server encrypts on all of its workers at once.
+     */
+    void set_sealed_file_streaming(bool enabled);
+
+    /**
+     * @brief Ask the server for CAPABILITY_SESSION_TICKET
+     * @param enabled Whether to request tickets and redeem them on reconnect
+     *
+     * With a ticket from the previous connection, connect() sends a
+     * resumption frame and derives the key from the ticket's secret and
+     * fresh nonces, skipping key generation and ECDH on both sides. If the
+     * server refuses the ticket, the connection falls back to a full key
+     * exchange. Each ticket is presented once and replaced by the next one.
+     */
+    void set_session_resumption(bool enabled);
+
+    /**
+     * @brief Check whether the next connect() can resume a session
+     * @return true if a session ticket is held
+     */
+    bool has_session_ticket() const;
+
+    /**
+     * @brief Ask the server for CAPABILITY_COMPRESSION
+     * @param enabled Whether to request the capability on the next connect()
+     * @param config Level and thresholds deciding which requests are
+     * compressed
+     */
+    void set_compression(bool enabled,
+                         const common::compress::WireCompressionConfig &config =
+                             common::compress::WireCompressionConfig{});
+
+    /**
+     * @brief Ask the server for CAPABILITY_SEQUENCED_NONCES
+     * @param enabled Whether to request the capability on the next connect()
+     * @param rekey_interval Requests sent under one key before send_request()
+     * replaces it with a REKEY exchange
+     *
+     * Counter nonces take the random number generator off the per-message
+     * path and let both sides reject replayed messages.
+     */
+    void set_sequenced_nonces(
+        bool enabled,
+        uint64_t rekey_interval = common::crypto::DEFAULT_REKEY_INTERVAL);
+
+    /**
+     * @brief Ask the server for CAPABILITY_PIPELINING
+     * @param enabled Whether to request the capability on the next connect()
+     *
+     * If the server accepts, several requests sent with submit_request() may
+     * be outstanding at once and the server answers read-only ones as soon as
+     * each is done, so responses can come back out of order.
+     */
+    void set_pipelining(bool enabled);
+
+    /**
+     * @brief Check whether requests may be pipelined on this connection
+     * @return true if the server accepted CAPABILITY_PIPELINING
+     */
+    bool is_pipelining() const;
+
+    /**
+     * @brief Ask the server for CAPABILITY_READ_LEASES
+     * @param enabled Whether to request the capability on the next connect()
+     *
+     * If the server accepts, successful READ_FILE responses carry the
+     * file's modification time and a lease for caching them.
+     */
+    void set_read_leases(bool enabled);
+
+    /**
+     * @brief Check whether the server grants read leases on this connection
+     * @return true if the server accepted CAPABILITY_READ_LEASES
+     */
+    bool has_read_leases() const;
+
+    /**
+     * @brief Capabilities negotiated with the server
+     * @return Bit mask of fenris::Capability values, 0 when not connected
+     */
+    uint32_t get_capabilities() const;
+
     /**
      * @brief Check if connection information (hostname/port) is set
      * @return true if connection information is set, false otherwise
@@ -97,7 +215,9 @@ class ConnectionManager {
      * @return true if send successful, false otherwise
      *
      * This method encrypts the request using the server's key
-     * and a randomly generated IV, prefixing the IV to the message
+     * and the next IV of the connection, prefixing the IV to the message.
+     * With sequenced nonces it rekeys first once the rekey interval is used
+     * up.
      */
     bool send_request(const fenris::Request &request);
 
@@ -111,6 +231,25 @@ class ConnectionManager {
      */
     std::optional<fenris::Response> receive_response();
 
+    /**
+     * @brief Send a request tagged with a fresh request ID
+     * @param request The request to send, its request_id is overwritten
+     * @return The ID to pass to receive_response_for(), std::nullopt if the
+     * request could not be sent
+     */
+    std::optional<uint64_t> submit_request(fenris::Request request);
+
+    /**
+     * @brief Receive the response to a request from submit_request()
+     * @param request_id ID returned by submit_request()
+     * @return Optional containing the response
+     *
+     * Responses to other outstanding requests that arrive first are kept
+     * until they are asked for. Without pipelining responses arrive in order
+     * and the next one is returned.
+     */
+    std::optional<fenris::Response> receive_response_for(uint64_t request_id);
+
     /**
      * @brief Check if currently connected to the server
      * @return true if connected, false otherwise
@@ -134,6 +273,15 @@ class ConnectionManager {
      */
     void reset_connection_info();
 
+    /**
+     * @brief Create an unconnected manager for the same server and with the
+     * same options
+     * @param logger_name Name for the new manager's logger
+     * @return The new manager; session tickets are not shared
+     */
+    std::unique_ptr<ConnectionManager>
+    clone_configuration(const std::string &logger_name) const;
+
   private:
     /**
      * @brief Perform key exchange with server and save the encryption key
@@ -141,7 +289,129 @@ class ConnectionManager {
      */
     bool perform_key_exchange();
 
+    /**
+     * @brief Build the handshake listing the capabilities we want
+     * @return The handshake, std::nullopt if we want none and send a bare key
+     */
+    std::optional<fenris::Handshake> make_handshake() const;
+
+    /**
+     * @brief Take on the capabilities the server accepted
+     * @param offer Handshake we sent, if any
+     * @param reply Handshake the server answered with, if any
+     */
+    void accept_capabilities(const std::optional<fenris::Handshake> &offer,
+                             const std::optional<fenris::Handshake> &reply);
+
+    /**
+     * @brief Keep the session ticket of a handshake reply for the next connect
+     * @param reply Handshake the server answered with, if any
+     * @param session_key Key of the session the ticket resumes
+     */
+    void keep_ticket(const std::optional<fenris::Handshake> &reply,
+                     const std::vector<uint8_t> &session_key);
+
+    /**
+     * @brief Key the connection by redeeming the held session ticket
+     * @return true if the session was resumed, false if the server refused
+     * the ticket and a full key exchange has to follow, std::nullopt if the
+     * connection failed
+     */
+    std::optional<bool> resume_session();
+
+    /**
+     * @brief Derive the session key from our private and the server's public
+     * key
+     * @param private_key Our ECDH private key
+     * @param server_public_key The server's ECDH public key
+     * @return The session key, std::nullopt on failure
+     */
+    std::optional<std::vector<uint8_t>>
+    derive_session_key(const std::vector<uint8_t> &private_key,
+                       const std::vector<uint8_t> &server_public_key);
+
+    /**
+     * @brief Switch the connection to a new session key
+     * @param key The derived session key
+     * @param epoch Number of rekeys before this key
+     * @return true if the session could be keyed
+     */
+    bool install_key(std::vector<uint8_t> key, uint32_t epoch);
+
+    // A REKEY request on its way, with what is needed to finish it
+    struct PendingRekey {
+        std::vector<uint8_t> private_key;
+        uint32_t epoch{0};
+        fenris::Request request;
+    };
+
+    /**
+     * @brief Check whether the key has to be replaced before a request
+     * @param request The request about to be sent
+     * @return true once the rekey interval is used up
+     */
+    bool rekey_due(const fenris::Request &request) const;
+
+    /**
+     * @brief Generate the key pair and REKEY request of the next epoch
+     * @return The pending rekey, std::nullopt if no epoch is left or key
+     * generation failed
+     */
+    std::optional<PendingRekey> prepare_rekey();
+
+    /**
+     * @brief Switch to the key agreed on in a REKEYED response
+     * @param pending The rekey the response answers
+     * @param response The server's response, if one arrived
+     * @return true if the new key is installed
+     */
+    bool complete_rekey(const PendingRekey &pending,
+                        const std::optional<fenris::Response> &response);
+
+    /**
+     * @brief Replace the session key with a REKEY exchange
+     * @return true if both sides switched to the new key
+     */
+    bool rekey();
+
+    /**
+     * @brief Receive the frames announced by a streamed response
+     * @param response Response with stream_length set, receives the content
+     * @param message_iv IV the response was encrypted with
+     * @return true if the content arrived, authenticated if it was sealed,
+     * and matched the announced length
+     */
+    bool receive_stream(fenris::Response &response,
+                        std::span<const uint8_t> message_iv);
+
+    /**
+     * @brief Receive and open the chunks of a sealed stream
+     * @param message_iv IV of the response announcing the stream
+     * @param length Announced plaintext length
+     * @return The plaintext, or std::nullopt if a chunk failed to arrive or
+     * to authenticate
+     */
+    std::optional<common::Buffer>
+    receive_sealed_stream(std::span<const uint8_t> message_iv,
+                          uint32_t length);
+
     bool m_non_blocking_mode;
+    bool m_plaintext_file_streaming{false};
+    bool m_sealed_file_streaming{false};
+    bool m_session_resumption{false};
+    std::vector<uint8_t> m_session_ticket;
+    std::vector<uint8_t> m_resumption_secret;
+    bool m_compression{false};
+    common::compress::WireCompressionConfig m_compression_config;
+    bool m_sequenced_nonces{false};
+    uint64_t m_rekey_interval{common::crypto::DEFAULT_REKEY_INTERVAL};
+    bool m_pipelining{false};
+    bool m_read_leases{false};
+    // Requests from submit_request() not yet handed out, and the responses
+    // among them that arrived before they were asked for
+    uint64_t m_next_request_id{1};
+    std::unordered_set<uint64_t> m_outstanding;
+    std::unordered_map<uint64_t, fenris::Response> m_early_responses;
     std::atomic<bool> m_connected{false};
     std::atomic<bool> m_has_connection_info{false};
     std::mutex m_socket_mutex;
@@ -0,0 +1,81 @@
+#ifndef FENRIS_CLIENT_CONNECTION_POOL_HPP
+#define FENRIS_CLIENT_CONNECTION_POOL_HPP
+
+#include "client/connection_manager.hpp"
+#include "common/logging.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fenris {
+namespace client {
+
+/**
+ * Sessions a single transfer may open, beyond which extra TCP flows stop
+ * adding bandwidth and only cost handshakes.
+ */
+constexpr size_t MAX_POOL_CONNECTIONS = 16;
+
+/**
+ * @class ConnectionPool
+ * @brief Several authenticated sessions to the same server
+ *
+ * Each session is a ConnectionManager of its own, with its own socket, key
+ * and nonces, created with the options of a prototype. Every connection
+ * carries its own TCP congestion window, so a transfer split across them is
+ * not capped by what a single flow gets on long fat links.
+ *
+ * A session must only be used by one thread at a time.
+ */
+class ConnectionPool {
+  public:
+    /**
+     * @brief Constructor
+     * @param prototype Manager whose server and options the sessions copy
+     * @param size Number of sessions, clamped to [1, MAX_POOL_CONNECTIONS]
+     * @param logger_name Name for the pool's logger
+     */
+    ConnectionPool(const ConnectionManager &prototype,
+                   size_t size,
+                   const std::string &logger_name = "ClientConnectionPool");
+
+    /**
+     * @brief Destructor, disconnects every session
+     */
+    ~ConnectionPool();
+
+    /**
+     * @brief Connect every session
+     * @return true if all of them connected; on failure none stays connected
+     */
+    bool connect();
+
+    /**
+     * @brief Disconnect every session
+     */
+    void disconnect();
+
+    /**
+     * @brief Number of sessions
+     * @return The pool size
+     */
+    size_t size() const;
+
+    /**
+     * @brief Access one session
+     * @param index Index below size()
+     * @return The session's ConnectionManager
+     */
+    ConnectionManager &at(size_t index);
+
+  private:
+    std::vector<std::unique_ptr<ConnectionManager>> m_connections;
+    common::Logger m_logger;
+};
+
+} // namespace client
+} // namespace fenris
+
+#endif // FENRIS_CLIENT_CONNECTION_POOL_HPP
@@ -0,0 +1,138 @@
+#ifndef FENRIS_CLIENT_FILE_TRANSFER_HPP
+#define FENRIS_CLIENT_FILE_TRANSFER_HPP
+
+#include "client/connection_manager.hpp"
+#include "common/logging.hpp"
+#include "common/request.hpp"
+#include "fenris.pb.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+
+namespace fenris {
+namespace client {
+
+/**
+ * READ_CHUNK requests a download keeps outstanding when the connection
+ * pipelines requests, enough to cover the round trip with a few blocks.
+ */
+constexpr size_t DEFAULT_PIPELINE_DEPTH = 8;
+
+enum class TransferResult {
+    SUCCESS,
+    LOCAL_FILE_ERROR,
+    SEND_ERROR,
+    RECEIVE_ERROR,
+    SERVER_ERROR,
+    PROTOCOL_ERROR
+};
+
+/**
+ * Convert TransferResult to string representation
+ *
+ * @param result The result to convert
+ * @return String representation of the result
+ */
+std::string transfer_result_to_string(TransferResult result);
+
+/**
+ * @class FileTransfer
+ * @brief Streams files between the local disk and the server in blocks
+ *
+ * Uploads and downloads go through WRITE_CHUNK / READ_CHUNK, one block per
+ * request, so only a single block is ever held in memory no matter how large
+ * the file is. On pipelining connections downloads keep up to
+ * DEFAULT_PIPELINE_DEPTH blocks requested ahead; uploads stay one block at a
+ * time so that a rejected block stops the ones behind it.
+ *
+ * delta_upload() sends only what changed in a file the server already has,
+ * see common::delta.
+ */
+class FileTransfer {
+  public:
+    /**
+     * @brief Constructor
+     * @param connection_manager Connected session used for all requests
+     * @param chunk_size Bytes per block, clamped to MAX_CHUNK_SIZE
+     * @param logger_name Name for this file transfer's logger
+     */
+    FileTransfer(ConnectionManager &connection_manager,
+                 size_t chunk_size = common::DEFAULT_CHUNK_SIZE,
+                 const std::string &logger_name = "ClientFileTransfer");
+
+    /**
+     * @brief Copy a local file to the server
+     * @param local_path File to read from
+     * @param remote_path Destination on the server, replaced if it exists
+     * @return Pair of (bytes sent, TransferResult)
+     */
+    std::pair<uint64_t, TransferResult> upload(const std::string &local_path,
+                                               const std::string &remote_path);
+
+    /**
+     * @brief Bring a file on the server up to date with a local one
+     *
+     * Asks for the signatures of the remote file and sends a delta against
+     * them, so blocks the server already has are not sent again. Uploads
+     * the whole file instead if there is nothing to compare with or the
+     * delta would be as large as the file.
+     *
+     * @param local_path File to read from
+     * @param remote_path Destination on the server, replaced if it exists
+     * @return Pair of (size of the file, TransferResult)
+     */
+    std::pair<uint64_t, TransferResult>
+    delta_upload(const std::string &local_path, const std::string &remote_path);
+
+    /**
+     * @brief Copy a file from the server to the local disk
+     * @param remote_path File on the server
+     * @param local_path Destination, replaced if it exists
+     * @return Pair of (bytes received, TransferResult)
+     */
+    std::pair<uint64_t, TransferResult>
+    download(const std::string &remote_path, const std::string &local_path);
+
+    /**
+     * @brief Error message of the last failed server response
+     * @return The message, empty if the server reported no error
+     */
+    const std::string &get_server_error() const;
+
+  private:
+    /**
+     * @brief Send one request and wait for its response
+     * @param request Request to send
+     * @param response Filled with the server's reply
+     * @return SUCCESS, or the stage that failed
+     */
+    TransferResult exchange(const fenris::Request &request,
+                            fenris::Response &response);
+
+    /**
+     * @brief Wait for the response to a submitted request
+     * @param request_id ID from ConnectionManager::submit_request()
+     * @param response Filled with the server's reply
+     * @return SUCCESS, or the stage that failed
+     */
+    TransferResult collect(uint64_t request_id, fenris::Response &response);
+
+    /**
+     * @brief Receive and drop the responses to blocks no longer wanted
+     * @param in_flight Request IDs and offsets of the blocks, emptied
+     */
+    void abandon(std::deque<std::pair<uint64_t, uint64_t>> &in_flight);
+
+    ConnectionManager &m_connection_manager;
+    size_t m_chunk_size;
+    std::string m_server_error;
+    common::Logger m_logger;
+};
+
+} // namespace client
+} // namespace fenris
+
+#endif // FENRIS_CLIENT_FILE_TRANSFER_HPP
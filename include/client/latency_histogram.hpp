@@ -0,0 +1,80 @@
+#ifndef FENRIS_CLIENT_LATENCY_HISTOGRAM_HPP
+#define FENRIS_CLIENT_LATENCY_HISTOGRAM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace fenris {
+namespace client {
+
+/**
+ * @class LatencyHistogram
+ * @brief Fixed-precision histogram of latencies for reading off percentiles
+ *
+ * Buckets are laid out the way an HDR histogram lays them out: every power of
+ * two is split into 2^SUB_BUCKET_BITS linear sub-buckets, so a recorded value
+ * lands in a bucket no wider than 1/2^SUB_BUCKET_BITS of it, from single
+ * nanoseconds up to the full 64-bit range. Recording is an index computation
+ * and an increment, cheap enough to do on every request, and histograms kept
+ * per thread are merged once the run is over.
+ *
+ * Not thread-safe.
+ */
+class LatencyHistogram {
+  public:
+    // 128 sub-buckets, percentiles are off by less than 1%
+    static constexpr unsigned SUB_BUCKET_BITS = 7;
+
+    LatencyHistogram();
+
+    /**
+     * @brief Count one value
+     */
+    void record(uint64_t value);
+
+    /**
+     * @brief Add the values counted by another histogram
+     */
+    void merge(const LatencyHistogram &other);
+
+    /**
+     * @brief Value below or at which the given share of the values fall
+     * @param percentile Share in percent, 0 to 100
+     * @return Highest value of the bucket holding that share, never above
+     *         max(), 0 when the histogram is empty
+     */
+    uint64_t percentile(double percentile) const;
+
+    uint64_t count() const
+    {
+        return m_count;
+    }
+
+    uint64_t min() const
+    {
+        return m_count == 0 ? 0 : m_min;
+    }
+
+    uint64_t max() const
+    {
+        return m_max;
+    }
+
+    double mean() const;
+
+  private:
+    static size_t bucket_index(uint64_t value);
+    static uint64_t bucket_highest(size_t index);
+
+    std::vector<uint64_t> m_buckets;
+    uint64_t m_count{0};
+    uint64_t m_min{UINT64_MAX};
+    uint64_t m_max{0};
+    long double m_sum{0};
+};
+
+} // namespace client
+} // namespace fenris
+
+#endif // FENRIS_CLIENT_LATENCY_HISTOGRAM_HPP
@@ -0,0 +1,90 @@
+#ifndef FENRIS_CLIENT_LOAD_PROFILE_HPP
+#define FENRIS_CLIENT_LOAD_PROFILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fenris {
+namespace client {
+
+/**
+ * Operations a load generator replays against a server
+ */
+enum class LoadOp { PING, INFO, READ, WRITE, LIST };
+
+constexpr size_t LOAD_OP_COUNT = 5;
+
+std::string_view load_op_name(LoadOp op);
+
+/**
+ * @class OpMix
+ * @brief Weighted choice between operations
+ *
+ * Parsed from a list like "ping:10,read:70,write:20". Weights are relative,
+ * operations left out are never picked.
+ */
+class OpMix {
+  public:
+    /**
+     * @brief Parse a mix
+     * @return The mix, nullopt if the list names an unknown operation, has a
+     *         malformed or negative weight, or weighs nothing at all
+     */
+    static std::optional<OpMix> parse(const std::string &spec);
+
+    LoadOp pick(std::mt19937_64 &rng) const;
+
+    /**
+     * @brief Share of the picks going to an operation, 0 to 1
+     */
+    double share(LoadOp op) const;
+
+  private:
+    std::vector<LoadOp> m_ops;
+    // Running totals of the weights, in the order of m_ops
+    std::vector<double> m_cumulative;
+};
+
+/**
+ * @class SizeDistribution
+ * @brief Weighted choice between payload sizes
+ *
+ * Parsed from a list like "4k:80,64k:15,1m:5", sizes take an optional k, m
+ * or g suffix for powers of 1024. A size without weight stands alone, so
+ * "16k" always picks 16 KiB.
+ */
+class SizeDistribution {
+  public:
+    /**
+     * @brief Parse a distribution
+     * @return The distribution, nullopt if an entry is malformed or nothing
+     *         has any weight
+     */
+    static std::optional<SizeDistribution> parse(const std::string &spec);
+
+    size_t pick(std::mt19937_64 &rng) const;
+
+    /**
+     * @brief Largest size the distribution can pick
+     */
+    size_t max() const;
+
+    const std::vector<size_t> &sizes() const
+    {
+        return m_sizes;
+    }
+
+  private:
+    std::vector<size_t> m_sizes;
+    std::vector<double> m_cumulative;
+};
+
+} // namespace client
+} // namespace fenris
+
+#endif // FENRIS_CLIENT_LOAD_PROFILE_HPP
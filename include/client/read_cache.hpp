@@ -0,0 +1,180 @@
+#ifndef FENRIS_CLIENT_READ_CACHE_HPP
+#define FENRIS_CLIENT_READ_CACHE_HPP
+
+#include "common/logging.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace fenris {
+namespace client {
+
+/**
+ * Limits of a ReadCache
+ */
+struct ReadCacheConfig {
+    // Total bytes of file content held, least recently read files go first
+    size_t max_bytes = 16 * 1024 * 1024;
+
+    // Files larger than this are never cached
+    size_t max_entry_bytes = 1024 * 1024;
+};
+
+/**
+ * Counters for judging how many reads stay off the network
+ */
+struct ReadCacheStats {
+    // Reads answered from the cache while their lease lasted
+    uint64_t hits = 0;
+    // Reads answered from the cache after the server confirmed the file is
+    // unchanged
+    uint64_t revalidations = 0;
+    // Reads whose content came from the server
+    uint64_t misses = 0;
+    // Entries dropped to make room for others
+    uint64_t evictions = 0;
+};
+
+/**
+ * Content the cache holds for a path
+ */
+struct CachedRead {
+    std::string content;
+    // FileInfo::modified_time the server reported with the content
+    uint64_t modified_time = 0;
+    // The lease still runs, so the content may be used without asking
+    bool leased = false;
+};
+
+/**
+ * @class ReadCache
+ * @brief Client-side copy of files read with READ_FILE
+ *
+ * The client-side counterpart of the server's CacheManager, kept coherent
+ * by server-granted leases instead of a watcher. While an entry's lease
+ * runs it is used without asking the server; afterwards it is revalidated
+ * with a READ_FILE carrying its modification time, which the server
+ * answers with not_modified and a new lease if the file did not change.
+ *
+ * Keys are absolute paths on the server, see common::normalize_client_path().
+ * The client drops entries of files it changes itself; changes by other
+ * clients are seen once the lease ran out.
+ */
+class ReadCache {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief Constructor
+     * @param config Byte budget and largest cached file
+     * @param logger_name Name for the logger instance
+     */
+    explicit ReadCache(const ReadCacheConfig &config = ReadCacheConfig{},
+                       const std::string &logger_name = "ClientReadCache");
+
+    ReadCache(const ReadCache &) = delete;
+    ReadCache &operator=(const ReadCache &) = delete;
+
+    /**
+     * @brief Look up the content of a file
+     * @param path Absolute path on the server
+     * @return The cached content, leased or in need of revalidation,
+     * nullopt on a miss
+     */
+    std::optional<CachedRead> lookup(const std::string &path);
+
+    /**
+     * @brief Remember content the server sent
+     * @param path Absolute path on the server
+     * @param content Content of the file
+     * @param modified_time FileInfo::modified_time sent with it
+     * @param expires End of the lease, measured from when the request was
+     * sent so that it never outlasts the server's
+     */
+    void store(const std::string &path,
+               std::string content,
+               uint64_t modified_time,
+               Clock::time_point expires);
+
+    /**
+     * @brief Extend the lease of content the server reported unchanged
+     * @param path Absolute path on the server
+     * @param modified_time FileInfo::modified_time the server reported
+     * @param expires End of the new lease
+     * @return The cached content, nullopt if it was dropped meanwhile or is
+     * of another modification time, then the file has to be read again
+     */
+    std::optional<std::string> renew(const std::string &path,
+                                     uint64_t modified_time,
+                                     Clock::time_point expires);
+
+    /**
+     * @brief Drop the entry of one file
+     * @param path Absolute path on the server
+     */
+    void invalidate(const std::string &path);
+
+    /**
+     * @brief Drop a directory's files and everything below it
+     * @param directory Absolute path of the directory on the server
+     */
+    void invalidate_prefix(const std::string &directory);
+
+    /**
+     * @brief Drop all entries
+     */
+    void clear();
+
+    /**
+     * @brief Get the number of cached files
+     * @return Number of entries, expired ones included
+     */
+    size_t get_entry_count() const;
+
+    /**
+     * @brief Get the bytes of file content currently cached
+     * @return Sum of the sizes of all cached files
+     */
+    size_t get_cache_bytes() const;
+
+    /**
+     * @brief Get hit, revalidation, miss and eviction counts
+     * @return Counters since construction
+     */
+    ReadCacheStats get_stats() const;
+
+  private:
+    struct Entry {
+        std::string content;
+        uint64_t modified_time = 0;
+        Clock::time_point expires;
+        // Position in m_recency
+        std::list<std::string>::iterator recency;
+    };
+
+    // Drop an entry; caller holds the lock
+    void erase(std::unordered_map<std::string, Entry>::iterator entry);
+
+    // Move an entry to the front of m_recency; caller holds the lock
+    void touch(Entry &entry);
+
+    ReadCacheConfig m_config;
+    std::unordered_map<std::string, Entry> m_entries;
+    // Paths from most to least recently read
+    std::list<std::string> m_recency;
+    size_t m_bytes{0};
+    ReadCacheStats m_stats;
+    mutable std::mutex m_mutex;
+    common::Logger m_logger;
+};
+
+} // namespace client
+} // namespace fenris
+
+#endif // FENRIS_CLIENT_READ_CACHE_HPP
@@ -3,6 +3,7 @@
 
 #include "common/logging.hpp"
 #include "fenris.pb.h"
+#include <cstdint>
 #include <memory>
 #include <optional>
 #include <string>
@@ -12,6 +13,11 @@
 namespace fenris {
 namespace client {
 
+/**
+ * How often du, cptree, rmtree and find ask the server for progress
+ */
+constexpr uint32_t TREE_PROGRESS_INTERVAL_MS = 500;
+
 /**
  * @class RequestManager
  * @brief Handles creation of client requests based on command line arguments
@@ -46,6 +52,13 @@ class RequestManager {
         {"ls", fenris::RequestType::LIST_DIR},
         {"cd", fenris::RequestType::CHANGE_DIR},
         {"rmdir", fenris::RequestType::DELETE_DIR},
+        {"readat", fenris::RequestType::READ_RANGE},
+        {"writeat", fenris::RequestType::WRITE_AT},
+        {"batch", fenris::RequestType::BATCH},
+        {"du", fenris::RequestType::DU},
+        {"cptree", fenris::RequestType::COPY_TREE},
+        {"rmtree", fenris::RequestType::DELETE_TREE},
+        {"find", fenris::RequestType::FIND},
         {"terminate", fenris::RequestType::TERMINATE}};
 
     // Helper functions for specific request types
@@ -57,6 +70,14 @@ class RequestManager {
                                        size_t start_idx);
     fenris::Request append_file_request(const std::vector<std::string> &args,
                                         size_t start_idx);
+    std::optional<fenris::Request>
+    range_request(fenris::RequestType type,
+                  const std::vector<std::string> &args,
+                  size_t start_idx);
+    // One command per line of a script, blank lines and lines starting
+    // with '#' are skipped
+    std::optional<fenris::Request>
+    batch_request(const std::vector<std::string> &args, size_t start_idx);
 };
 
 } // namespace client
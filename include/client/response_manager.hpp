@@ -87,6 +87,30 @@ class ResponseManager {
     void handle_terminated_response(const fenris::Response &response,
                                     std::vector<std::string> &result);
 
+    /**
+     * @brief Format a FILE_CHUNK response
+     * @param response The response object
+     * @param result Vector to add formatted strings to
+     */
+    void handle_file_chunk_response(const fenris::Response &response,
+                                    std::vector<std::string> &result);
+
+    /**
+     * @brief Format a BATCH_RESULTS response, one block per sub-request
+     * @param response The response object
+     * @param result Vector to add formatted strings to
+     */
+    void handle_batch_results_response(const fenris::Response &response,
+                                       std::vector<std::string> &result);
+
+    /**
+     * @brief Format a TREE_PROGRESS or TREE_RESULT response
+     * @param response The response object
+     * @param result Vector to add formatted strings to
+     */
+    void handle_tree_response(const fenris::Response &response,
+                              std::vector<std::string> &result);
+
     /**
      * @brief Format file size with appropriate units (B, KB, MB, etc.)
      * @param size_bytes Size in bytes
@@ -0,0 +1,119 @@
+#ifndef FENRIS_CLIENT_STRIPED_TRANSFER_HPP
+#define FENRIS_CLIENT_STRIPED_TRANSFER_HPP
+
+#include "client/connection_pool.hpp"
+#include "client/file_transfer.hpp"
+#include "common/logging.hpp"
+#include "common/request.hpp"
+#include "fenris.pb.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace fenris {
+namespace client {
+
+/**
+ * @class StripedTransfer
+ * @brief Moves one file over all sessions of a ConnectionPool at once
+ *
+ * The file is cut into blocks that the sessions claim in order, one thread
+ * per session, each writing its blocks where they belong with pwrite():
+ * downloads use READ_RANGE, uploads WRITE_AT. The first block goes alone,
+ * over the first session, since it tells a download the file size and
+ * replaces the remote file for an upload. After a failure no new blocks are
+ * claimed, and the blocks in flight still complete.
+ */
+class StripedTransfer {
+  public:
+    /**
+     * @brief Constructor
+     * @param pool Connected sessions used for all requests
+     * @param chunk_size Bytes per block, clamped to MAX_CHUNK_SIZE
+     * @param logger_name Name for this transfer's logger
+     */
+    StripedTransfer(ConnectionPool &pool,
+                    size_t chunk_size = common::DEFAULT_CHUNK_SIZE,
+                    const std::string &logger_name = "ClientStripedTransfer");
+
+    /**
+     * @brief Copy a local file to the server
+     * @param local_path File to read from
+     * @param remote_path Destination on the server, replaced if it exists
+     * @return Pair of (bytes sent, TransferResult); on failure the bytes
+     * sent ahead of the first missing block
+     */
+    std::pair<uint64_t, TransferResult> upload(const std::string &local_path,
+                                               const std::string &remote_path);
+
+    /**
+     * @brief Copy a file from the server to the local disk
+     * @param remote_path File on the server
+     * @param local_path Destination, replaced if it exists
+     * @return Pair of (bytes received, TransferResult), counted like upload()
+     */
+    std::pair<uint64_t, TransferResult>
+    download(const std::string &remote_path, const std::string &local_path);
+
+    /**
+     * @brief Error message of the first failed server response
+     * @return The message, empty if the server reported no error
+     */
+    const std::string &get_server_error() const;
+
+  private:
+    // One block of the file, and the session that moves it
+    using BlockHandler = TransferResult (StripedTransfer::*)(
+        ConnectionManager &, int, const std::string &, uint64_t, uint64_t);
+
+    /**
+     * @brief Move every block after the first over all sessions
+     * @param handler Moves one block
+     * @param fd Local file
+     * @param remote_path File on the server
+     * @param total_size Size of the file
+     * @return Pair of (bytes moved before the first failed block, result)
+     */
+    std::pair<uint64_t, TransferResult> stripe(BlockHandler handler,
+                                               int fd,
+                                               const std::string &remote_path,
+                                               uint64_t total_size);
+
+    TransferResult download_block(ConnectionManager &connection,
+                                  int fd,
+                                  const std::string &remote_path,
+                                  uint64_t offset,
+                                  uint64_t total_size);
+
+    TransferResult upload_block(ConnectionManager &connection,
+                                int fd,
+                                const std::string &remote_path,
+                                uint64_t offset,
+                                uint64_t total_size);
+
+    /**
+     * @brief Send one request over a session and wait for its response
+     * @param connection Session to use
+     * @param request Request to send
+     * @param response Filled with the server's reply
+     * @return SUCCESS, or the stage that failed
+     */
+    TransferResult exchange(ConnectionManager &connection,
+                            const fenris::Request &request,
+                            fenris::Response &response);
+
+    ConnectionPool &m_pool;
+    size_t m_chunk_size;
+    std::mutex m_error_mutex;
+    std::string m_server_error;
+    common::Logger m_logger;
+};
+
+} // namespace client
+} // namespace fenris
+
+#endif // FENRIS_CLIENT_STRIPED_TRANSFER_HPP
@@ -0,0 +1,179 @@
+#ifndef FENRIS_COMMON_BUFFER_HPP
+#define FENRIS_COMMON_BUFFER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fenris {
+namespace common {
+
+/**
+ * @class Buffer
+ * @brief Reference-counted view into a shared byte slab
+ *
+ * Copying a Buffer or taking a slice() never copies the bytes, every view
+ * keeps the underlying slab alive through a shared owner. This lets a
+ * payload travel from the socket through decryption and parsing (and back)
+ * without being duplicated at every layer.
+ *
+ * Buffers are not synchronized: views of the same slab may be read from
+ * several threads but must not be written concurrently.
+ */
+class Buffer {
+  public:
+    /**
+     * @brief Create an empty buffer
+     */
+    Buffer() = default;
+
+    /**
+     * @brief Allocate an uninitialized slab
+     * @param size Number of bytes
+     * @return Buffer viewing the whole slab
+     */
+    static Buffer allocate(size_t size);
+
+    /**
+     * @brief Allocate a slab holding a copy of the given bytes
+     * @param data Bytes to copy
+     * @return Buffer viewing the copy
+     */
+    static Buffer copy_of(std::span<const uint8_t> data);
+
+    /**
+     * @brief Adopt a vector without copying its contents
+     * @param data Vector whose storage becomes the slab
+     * @return Buffer viewing the vector's bytes
+     */
+    static Buffer wrap(std::vector<uint8_t> &&data);
+
+    /**
+     * @brief Adopt a string without copying its contents
+     * @param data String whose storage becomes the slab
+     * @return Buffer viewing the string's bytes
+     */
+    static Buffer wrap(std::string &&data);
+
+    /**
+     * @brief View memory kept alive by some other owner
+     *
+     * Used for memory that is not a heap slab, such as a file mapping that
+     * the owner's deleter unmaps.
+     *
+     * @param owner Released once the last view goes away
+     * @param data First byte of the memory
+     * @param size Number of bytes
+     * @return Buffer viewing the memory
+     */
+    static Buffer
+    adopt(std::shared_ptr<void> owner, uint8_t *data, size_t size);
+
+    uint8_t *data()
+    {
+        return m_data;
+    }
+
+    const uint8_t *data() const
+    {
+        return m_data;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    uint8_t *begin()
+    {
+        return m_data;
+    }
+
+    uint8_t *end()
+    {
+        return m_data + m_size;
+    }
+
+    const uint8_t *begin() const
+    {
+        return m_data;
+    }
+
+    const uint8_t *end() const
+    {
+        return m_data + m_size;
+    }
+
+    /**
+     * @brief Create a view sharing this buffer's slab
+     * @param offset Start of the view relative to this buffer
+     * @param length Number of bytes, clamped to the end of this buffer
+     * @return The sub-view, empty if offset is out of range
+     */
+    Buffer slice(size_t offset, size_t length = SIZE_MAX) const;
+
+    /**
+     * @brief Shorten the view without touching the slab
+     * @param size New size, ignored if larger than the current one
+     */
+    void truncate(size_t size);
+
+    std::span<const uint8_t> span() const
+    {
+        return {m_data, m_size};
+    }
+
+    std::span<uint8_t> mutable_span()
+    {
+        return {m_data, m_size};
+    }
+
+    operator std::span<const uint8_t>() const
+    {
+        return span();
+    }
+
+    std::string_view view() const
+    {
+        return {reinterpret_cast<const char *>(m_data), m_size};
+    }
+
+    /**
+     * @brief Copy the viewed bytes out into a vector
+     * @return Vector holding a copy of the bytes
+     */
+    std::vector<uint8_t> to_vector() const;
+
+    /**
+     * @brief Number of views sharing the slab
+     * @return Reference count, 0 for an empty buffer
+     */
+    long use_count() const
+    {
+        return m_owner.use_count();
+    }
+
+  private:
+    Buffer(std::shared_ptr<void> owner, uint8_t *data, size_t size)
+        : m_owner(std::move(owner)), m_data(data), m_size(size)
+    {
+    }
+
+    std::shared_ptr<void> m_owner;
+    uint8_t *m_data{nullptr};
+    size_t m_size{0};
+};
+
+} // namespace common
+} // namespace fenris
+
+#endif // FENRIS_COMMON_BUFFER_HPP
@@ -0,0 +1,115 @@
+#ifndef FENRIS_COMMON_BUFFER_POOL_HPP
+#define FENRIS_COMMON_BUFFER_POOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace fenris {
+namespace common {
+
+/**
+ * Counters for judging how much of the buffer traffic the pool absorbs
+ */
+struct BufferPoolStats {
+    // Allocations served from a cached slab
+    uint64_t hits = 0;
+    // Allocations that had to go to the heap
+    uint64_t misses = 0;
+    // Allocations too large to be pooled at all
+    uint64_t oversized = 0;
+    // Bytes cached across all threads and the shared depot
+    uint64_t cached_bytes = 0;
+};
+
+/**
+ * @class BufferPool
+ * @brief Process-wide cache of byte slabs in power-of-two size classes
+ *
+ * Every request allocates a receive buffer, a decrypted copy, a serialized
+ * response and its ciphertext, and frees them again moments later. The pool
+ * keeps those slabs around instead: each thread caches freed slabs per size
+ * class and serves the next allocation of that class from its cache without
+ * taking a lock. Slabs often die on another thread than they were born on
+ * (a reactor receives, a worker answers), so a thread whose cache is full
+ * hands the slab to a shared depot, where a thread whose cache is empty
+ * finds it.
+ *
+ * Sizes from MIN_CLASS_SIZE to MAX_CLASS_SIZE are rounded up to the next
+ * power of two, anything larger goes straight to the heap. Both the thread
+ * caches and the depot are bounded, so a burst of large requests does not
+ * pin its memory forever.
+ */
+class BufferPool {
+  public:
+    static constexpr size_t MIN_CLASS_SIZE = 64;
+    static constexpr size_t MAX_CLASS_SIZE = 4 * 1024 * 1024;
+
+    // Bytes one thread keeps cached across all classes
+    static constexpr size_t THREAD_CACHE_BYTES = 8 * 1024 * 1024;
+
+    // Bytes the shared depot keeps across all classes
+    static constexpr size_t DEPOT_BYTES = 64 * 1024 * 1024;
+
+    BufferPool() = delete;
+
+    /**
+     * @brief Allocate uninitialized memory, from the pool when it fits a class
+     * @param bytes Number of bytes, must be passed to deallocate() as well
+     * @return The memory, throws std::bad_alloc on failure
+     */
+    static void *allocate(size_t bytes);
+
+    /**
+     * @brief Return memory obtained from allocate()
+     * @param memory The memory
+     * @param bytes The size it was allocated with
+     */
+    static void deallocate(void *memory, size_t bytes);
+
+    /**
+     * @brief Size of the slab serving an allocation
+     * @return The class size, 0 for sizes that are not pooled
+     */
+    static size_t class_size(size_t bytes);
+
+    /**
+     * @brief Free the calling thread's cached slabs and the depot
+     */
+    static void trim();
+
+    static BufferPoolStats get_stats();
+};
+
+/**
+ * @brief Standard allocator drawing from the BufferPool
+ *
+ * Lets std::allocate_shared put a slab and its reference count into one
+ * pooled allocation.
+ */
+template <typename T> struct PoolAllocator {
+    using value_type = T;
+
+    PoolAllocator() = default;
+
+    template <typename U> PoolAllocator(const PoolAllocator<U> &) {}
+
+    T *allocate(size_t count)
+    {
+        return static_cast<T *>(BufferPool::allocate(count * sizeof(T)));
+    }
+
+    void deallocate(T *memory, size_t count)
+    {
+        BufferPool::deallocate(memory, count * sizeof(T));
+    }
+
+    template <typename U> bool operator==(const PoolAllocator<U> &) const
+    {
+        return true;
+    }
+};
+
+} // namespace common
+} // namespace fenris
+
+#endif // FENRIS_COMMON_BUFFER_POOL_HPP
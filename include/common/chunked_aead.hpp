@@ -0,0 +1,95 @@
+#ifndef FENRIS_COMMON_CHUNKED_AEAD_HPP
+#define FENRIS_COMMON_CHUNKED_AEAD_HPP
+
+#include "common/crypto_manager.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace fenris {
+namespace common {
+namespace crypto {
+
+/**
+ * Plaintext bytes per sealed chunk. Large enough that the per-chunk key
+ * setup and frame header vanish next to the AES work, small enough that the
+ * first chunk leaves quickly and a few of them keep every core busy.
+ */
+constexpr size_t DEFAULT_AEAD_CHUNK_SIZE = 256 * 1024;
+
+/**
+ * Derive the key of one chunked stream from the session key
+ *
+ * Chunk nonces restart at zero for every stream, so each stream needs a key
+ * of its own. It is derived with HKDF from the session key and the IV of the
+ * message announcing the stream, which is never reused under one session key.
+ *
+ * @param session_key The connection's AES-GCM key
+ * @param message_iv IV of the encrypted response that announced the stream
+ * @return The stream key and ECDHResult::SUCCESS, or KEY_DERIVATION_FAILED
+ */
+std::pair<std::vector<uint8_t>, ECDHResult>
+derive_stream_key(const std::vector<uint8_t> &session_key,
+                  std::span<const uint8_t> message_iv);
+
+/**
+ * @class ChunkedAead
+ *
+ * AES-GCM over a payload cut into chunks that are sealed independently, in
+ * the style of the STREAM construction: chunk i is sealed under the stream
+ * key with a nonce holding i, and its index and whether it is the last chunk
+ * are authenticated as associated data. A receiver opening chunks in order
+ * therefore notices chunks that were dropped, reordered, duplicated or cut
+ * off at the end, while the sender is free to seal them on any thread.
+ *
+ * A chunk is sealed in place in a buffer holding its plaintext followed by
+ * AES_GCM_TAG_SIZE spare bytes, the layout of
+ * CryptoManager::encrypt_in_place().
+ *
+ * seal() and open() build their cipher per call and are safe to call from
+ * several threads at once.
+ */
+class ChunkedAead {
+  public:
+    /**
+     * @brief Constructor
+     * @param stream_key Key from derive_stream_key() (16, 24, or 32 bytes)
+     */
+    explicit ChunkedAead(std::vector<uint8_t> stream_key);
+
+    /**
+     * @brief Seal one chunk where it lies
+     * @param index Position of the chunk in the stream, from 0
+     * @param last Whether no chunk follows this one
+     * @param buffer The plaintext followed by AES_GCM_TAG_SIZE spare bytes,
+     * overwritten with the ciphertext and the tag
+     * @return An EncryptionResult
+     */
+    EncryptionResult
+    seal(uint64_t index, bool last, std::span<uint8_t> buffer) const;
+
+    /**
+     * @brief Open one chunk where it lies
+     * @param index Position the chunk is expected at
+     * @param last Whether the chunk is expected to end the stream
+     * @param buffer The ciphertext including the tag. On success its first
+     * buffer.size() - AES_GCM_TAG_SIZE bytes hold the plaintext, on failure
+     * they are zeroed.
+     * @return An EncryptionResult, DECRYPTION_FAILED if the chunk was not
+     * sealed at this position
+     */
+    EncryptionResult
+    open(uint64_t index, bool last, std::span<uint8_t> buffer) const;
+
+  private:
+    std::vector<uint8_t> m_key;
+};
+
+} // namespace crypto
+} // namespace common
+} // namespace fenris
+
+#endif // FENRIS_COMMON_CHUNKED_AEAD_HPP
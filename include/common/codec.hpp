@@ -0,0 +1,128 @@
+#ifndef FENRIS_COMMON_CODEC_HPP
+#define FENRIS_COMMON_CODEC_HPP
+
+#include "common/compression_manager.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace fenris {
+namespace common {
+namespace compress {
+
+/**
+ * Compression algorithms, the values are sent on the wire
+ */
+enum class CodecId : uint8_t {
+    // Stored as is
+    NONE = 0,
+    // zlib deflate, best ratio
+    DEFLATE = 1,
+    // LZ4 block format, several times faster than deflate at a lower ratio
+    LZ4 = 2
+};
+
+/**
+ * Convert CodecId to string representation
+ *
+ * @param id CodecId to convert
+ * @return Name of the codec
+ */
+std::string codec_id_to_string(CodecId id);
+
+/**
+ * Bit for a codec in a mask of codecs
+ *
+ * @param id The codec
+ * @return 1 << id
+ */
+constexpr uint32_t codec_mask(CodecId id)
+{
+    return 1u << static_cast<uint8_t>(id);
+}
+
+/**
+ * Codecs make_codec() can build
+ *
+ * @return Mask of codec_mask() bits
+ */
+uint32_t available_codecs();
+
+/**
+ * Settings a codec is built with, ignored where they do not apply
+ */
+struct CodecOptions {
+    // Compression level, 0-9 for deflate
+    int level = 6;
+
+    // Preset dictionary for deflate, both peers must use the same one
+    std::vector<uint8_t> dictionary;
+};
+
+/**
+ * @class Codec
+ *
+ * Compresses and restores whole messages. A codec keeps its working state,
+ * e.g. a deflate stream or a match table, across calls so only the first
+ * message pays for setting it up. Codecs that carry history from message to
+ * message have to decompress messages in the order they were compressed.
+ * One instance must not be used from several threads at once.
+ */
+class Codec {
+  public:
+    virtual ~Codec() = default;
+
+    /**
+     * @return The algorithm, as sent on the wire
+     */
+    virtual CodecId id() const = 0;
+
+    /**
+     * Compresses one message
+     *
+     * @param input The message
+     * @param output Compressed bytes are appended to this
+     * @return CompressionResult of the operation, the codec must be reset
+     * after a failure
+     */
+    virtual CompressionResult compress(std::span<const uint8_t> input,
+                                       std::vector<uint8_t> &output) = 0;
+
+    /**
+     * Restores one message
+     *
+     * @param input A message from compress()
+     * @param max_output Largest message to accept, 0 for no limit
+     * @param output Restored bytes are appended to this
+     * @return CompressionResult of the operation, BUFFER_TOO_SMALL past
+     * max_output. The codec must be reset after a failure.
+     */
+    virtual CompressionResult decompress(std::span<const uint8_t> input,
+                                         size_t max_output,
+                                         std::vector<uint8_t> &output) = 0;
+
+    /**
+     * Drop any history, as if no message had been seen yet
+     */
+    virtual void reset() = 0;
+};
+
+/**
+ * Build a codec
+ *
+ * @param id The algorithm
+ * @param options Level and dictionary
+ * @return The codec, nullptr if id is not in available_codecs()
+ */
+std::unique_ptr<Codec> make_codec(CodecId id,
+                                  const CodecOptions &options = CodecOptions{});
+
+} // namespace compress
+} // namespace common
+} // namespace fenris
+
+#endif // FENRIS_COMMON_CODEC_HPP
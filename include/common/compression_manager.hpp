@@ -3,10 +3,14 @@
 
 #include <cstdint>
 #include <memory>
+#include <span>
 #include <string>
 #include <utility>
 #include <vector>
 
+// zlib's stream state, kept out of this header
+struct z_stream_s;
+
 namespace fenris {
 namespace common {
 namespace compress {
@@ -62,6 +66,157 @@ class CompressionManager {
     decompress(const std::vector<uint8_t> &input, size_t original_size);
 };
 
+/**
+ * How much of the input a stream call has to emit
+ */
+enum class StreamFlush {
+    // Output may lag behind the input, best ratio
+    NONE = 0,
+    // Everything so far can be decompressed by the peer, the stream goes on
+    // and later data can still refer back to earlier data
+    SYNC,
+    // End the stream, the next call starts a new one
+    FINISH
+};
+
+/**
+ * @class StreamCompressor
+ *
+ * Deflates a sequence of chunks or messages with one zlib stream. The stream
+ * state is allocated once and kept across calls, so messages on the same
+ * connection neither pay for deflateInit() each time nor lose the window of
+ * data that came before them. Output grows as it is produced rather than
+ * being reserved for the worst case up front.
+ */
+class StreamCompressor {
+  public:
+    /**
+     * @param level Compression level (0-9), checked on the first call
+     */
+    explicit StreamCompressor(int level = 6);
+    ~StreamCompressor();
+
+    StreamCompressor(StreamCompressor &&other) noexcept;
+    StreamCompressor &operator=(StreamCompressor &&other) noexcept;
+    StreamCompressor(const StreamCompressor &) = delete;
+    StreamCompressor &operator=(const StreamCompressor &) = delete;
+
+    /**
+     * Compresses the next chunk of the stream
+     *
+     * @param data Start of the chunk
+     * @param size Length of the chunk, may be 0 to only flush
+     * @param flush How much output must be produced
+     * @param output Compressed bytes are appended to this
+     * @return CompressionResult of the operation, the stream must be reset
+     * after a failure
+     */
+    CompressionResult compress(const uint8_t *data,
+                               size_t size,
+                               StreamFlush flush,
+                               std::vector<uint8_t> &output);
+
+    /**
+     * Start a new stream, dropping any pending input and the window
+     */
+    void reset();
+
+    /**
+     * Prime every stream from now on with a preset dictionary
+     *
+     * Data resembling the dictionary compresses well from the first byte,
+     * which matters for short messages that have no window of their own.
+     * The current stream is reset. The peer needs the same dictionary.
+     *
+     * @param dictionary Sample content, at most the last 32 KiB are used
+     * @return CompressionResult of priming the stream
+     */
+    CompressionResult set_dictionary(std::span<const uint8_t> dictionary);
+
+  private:
+    // Allocate the stream on first use
+    CompressionResult ensure_initialized();
+
+    // Load the dictionary into a fresh stream
+    CompressionResult apply_dictionary();
+
+    int m_level;
+    std::unique_ptr<z_stream_s> m_stream;
+    std::vector<uint8_t> m_dictionary;
+    bool m_initialized{false};
+};
+
+/**
+ * @class StreamDecompressor
+ *
+ * Inflates what a StreamCompressor produced, in pieces of any size. The size
+ * of the original data need not be known. When a stream ends the next one
+ * may follow right away in the same or a later call.
+ */
+class StreamDecompressor {
+  public:
+    /**
+     * @param max_output Most bytes one call may produce, 0 for no limit.
+     * Guards against small inputs that expand without bound.
+     */
+    explicit StreamDecompressor(size_t max_output = 0);
+    ~StreamDecompressor();
+
+    StreamDecompressor(StreamDecompressor &&other) noexcept;
+    StreamDecompressor &operator=(StreamDecompressor &&other) noexcept;
+    StreamDecompressor(const StreamDecompressor &) = delete;
+    StreamDecompressor &operator=(const StreamDecompressor &) = delete;
+
+    /**
+     * Decompresses the next piece of the stream
+     *
+     * @param data Start of the compressed bytes
+     * @param size Number of compressed bytes
+     * @param output Decompressed bytes are appended to this
+     * @return CompressionResult of the operation, BUFFER_TOO_SMALL once
+     * max_output is exceeded. The stream must be reset after a failure.
+     */
+    CompressionResult
+    decompress(const uint8_t *data, size_t size, std::vector<uint8_t> &output);
+
+    /**
+     * Whether the last call ended exactly at the end of a stream
+     *
+     * @return true if no stream is partially decoded
+     */
+    bool at_stream_end() const;
+
+    /**
+     * Start over, dropping a partially decoded stream
+     */
+    void reset();
+
+    /**
+     * Set the dictionary streams primed by StreamCompressor::set_dictionary()
+     * ask for. Without it such streams fail with INVALID_DATA.
+     *
+     * @param dictionary The compressor's dictionary
+     */
+    void set_dictionary(std::span<const uint8_t> dictionary);
+
+    /**
+     * Change the limit given to the constructor
+     *
+     * @param max_output Most bytes one call may produce, 0 for no limit
+     */
+    void set_max_output(size_t max_output);
+
+  private:
+    // Allocate the stream on first use
+    CompressionResult ensure_initialized();
+
+    size_t m_max_output;
+    std::unique_ptr<z_stream_s> m_stream;
+    std::vector<uint8_t> m_dictionary;
+    bool m_initialized{false};
+    bool m_at_stream_end{true};
+};
+
 } // namespace compress
 } // namespace common
 } // namespace fenris
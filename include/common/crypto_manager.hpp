@@ -1,7 +1,10 @@
 #ifndef FENRIS_COMMON_ENCRYPTION_HPP
 #define FENRIS_COMMON_ENCRYPTION_HPP
 
+#include "common/buffer.hpp"
+
 #include <cstdint>
+#include <span>
 #include <string>
 #include <tuple>
 #include <utility>
@@ -22,6 +25,7 @@ enum class EncryptionResult {
     ENCRYPTION_FAILED,
     DECRYPTION_FAILED,
     IV_GENERATION_FAILED,
+    REPLAYED_NONCE,
 };
 
 enum class ECDHResult {
@@ -55,6 +59,20 @@ std::string encryption_result_to_string(EncryptionResult result);
  */
 std::string ecdh_result_to_string(ECDHResult result);
 
+/**
+ * Direction of an AES-GCM pass, the op label of the crypto metrics
+ */
+enum class CipherOp { ENCRYPT, DECRYPT };
+
+/**
+ * @brief Count an AES-GCM pass in the exported metrics
+ *
+ * @param op Direction of the pass
+ * @param bytes Plaintext bytes covered
+ * @param result Outcome, anything but SUCCESS counts as a failure
+ */
+void record_cipher(CipherOp op, size_t bytes, EncryptionResult result);
+
 /**
  * @class CryptoManager
  *
@@ -89,6 +107,63 @@ class CryptoManager {
                  const std::vector<uint8_t> &key,
                  const std::vector<uint8_t> &iv);
 
+    /**
+     * @brief Encrypts data using AES-GCM straight into a shared buffer.
+     * @param plaintext The data to encrypt.
+     * @param key The encryption key (16, 24, or 32 bytes).
+     * @param iv The initialization vector (must be AES_GCM_IV_SIZE bytes).
+     * @return A pair containing the ciphertext (including tag) and an
+     * EncryptionResult.
+     *
+     * Unlike encrypt_data() the ciphertext is written once into its final
+     * buffer, with no intermediate copies.
+     */
+    std::pair<Buffer, EncryptionResult>
+    encrypt_buffer(std::span<const uint8_t> plaintext,
+                   const std::vector<uint8_t> &key,
+                   const std::vector<uint8_t> &iv);
+
+    /**
+     * @brief Decrypts data using AES-GCM straight into a shared buffer.
+     * @param ciphertext The data to decrypt (including tag).
+     * @param key The decryption key (16, 24, or 32 bytes).
+     * @param iv The initialization vector (must be AES_GCM_IV_SIZE bytes).
+     * @return A pair containing the plaintext and a EncryptionResult.
+     */
+    std::pair<Buffer, EncryptionResult>
+    decrypt_buffer(std::span<const uint8_t> ciphertext,
+                   const std::vector<uint8_t> &key,
+                   const std::vector<uint8_t> &iv);
+
+    /**
+     * @brief Encrypts data using AES-GCM where it lies.
+     * @param buffer The plaintext followed by AES_GCM_TAG_SIZE spare bytes,
+     * overwritten with the ciphertext and the tag.
+     * @param key The encryption key (16, 24, or 32 bytes).
+     * @param iv The initialization vector (must be AES_GCM_IV_SIZE bytes).
+     * @return An EncryptionResult, INVALID_DATA if there is no room for the
+     * tag.
+     *
+     * The result has the layout of encrypt_buffer(), so a message serialized
+     * with room for the tag goes out without a second allocation.
+     */
+    EncryptionResult encrypt_in_place(std::span<uint8_t> buffer,
+                                      const std::vector<uint8_t> &key,
+                                      const std::vector<uint8_t> &iv);
+
+    /**
+     * @brief Decrypts and verifies data using AES-GCM where it lies.
+     * @param buffer The ciphertext including the tag. On success its first
+     * buffer.size() - AES_GCM_TAG_SIZE bytes hold the plaintext, on failure
+     * they are zeroed.
+     * @param key The decryption key (16, 24, or 32 bytes).
+     * @param iv The initialization vector (must be AES_GCM_IV_SIZE bytes).
+     * @return An EncryptionResult.
+     */
+    EncryptionResult decrypt_in_place(std::span<uint8_t> buffer,
+                                      const std::vector<uint8_t> &key,
+                                      const std::vector<uint8_t> &iv);
+
     /**
      * @brief Generates an ECDH key pair using the NIST P-256 (secp256r1) curve.
      * @return A tuple containing the private key, public key, and an error
@@ -125,6 +200,15 @@ class CryptoManager {
      * EncryptionResult.
      */
     std::pair<std::vector<uint8_t>, EncryptionResult> generate_random_iv();
+
+    /**
+     * @brief Generates cryptographically secure random bytes.
+     * @param size Number of bytes to generate.
+     * @return A pair containing the bytes and an EncryptionResult,
+     * IV_GENERATION_FAILED if the generator failed.
+     */
+    std::pair<std::vector<uint8_t>, EncryptionResult>
+    generate_random_bytes(size_t size);
 };
 
 } // namespace crypto
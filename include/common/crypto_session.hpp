@@ -0,0 +1,107 @@
+#ifndef FENRIS_COMMON_CRYPTO_SESSION_HPP
+#define FENRIS_COMMON_CRYPTO_SESSION_HPP
+
+#include "common/buffer.hpp"
+#include "common/crypto_manager.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace fenris {
+namespace common {
+namespace crypto {
+
+/**
+ * @class CryptoSession
+ *
+ * AES-GCM keyed once for the lifetime of a connection. CryptoManager's
+ * encrypt and decrypt functions take the key with every call and so expand
+ * the AES key schedule and build the GCM multiplication tables per message,
+ * which costs more than sealing a small request like PING. A session does
+ * that work in set_key() and each message only loads its IV.
+ *
+ * The output has the same layout as CryptoManager::encrypt_buffer(), the
+ * ciphertext followed by the tag, so either side may use either API.
+ *
+ * encrypt() and decrypt() have cipher objects of their own and may run
+ * concurrently with each other, but neither may run on two threads at once.
+ */
+class CryptoSession {
+  public:
+    CryptoSession();
+    ~CryptoSession();
+
+    CryptoSession(CryptoSession &&other) noexcept;
+    CryptoSession &operator=(CryptoSession &&other) noexcept;
+    CryptoSession(const CryptoSession &) = delete;
+    CryptoSession &operator=(const CryptoSession &) = delete;
+
+    /**
+     * @brief Key both directions of the session
+     * @param key The session key (16, 24, or 32 bytes).
+     * @return EncryptionResult::SUCCESS, or INVALID_KEY_SIZE
+     */
+    EncryptionResult set_key(std::span<const uint8_t> key);
+
+    /**
+     * @brief Whether set_key() succeeded
+     * @return true if messages can be sealed and opened
+     */
+    bool has_key() const;
+
+    /**
+     * @brief Encrypts one message into a shared buffer.
+     * @param plaintext The data to encrypt.
+     * @param iv The initialization vector (must be AES_GCM_IV_SIZE bytes).
+     * @return A pair containing the ciphertext (including tag) and an
+     * EncryptionResult.
+     */
+    std::pair<Buffer, EncryptionResult>
+    encrypt(std::span<const uint8_t> plaintext, std::span<const uint8_t> iv);
+
+    /**
+     * @brief Decrypts and verifies one message into a shared buffer.
+     * @param ciphertext The data to decrypt (including tag).
+     * @param iv The initialization vector (must be AES_GCM_IV_SIZE bytes).
+     * @return A pair containing the plaintext and a EncryptionResult.
+     */
+    std::pair<Buffer, EncryptionResult>
+    decrypt(std::span<const uint8_t> ciphertext, std::span<const uint8_t> iv);
+
+    /**
+     * @brief Encrypts one message where it lies.
+     * @param buffer The plaintext followed by AES_GCM_TAG_SIZE spare bytes,
+     * overwritten with the ciphertext and the tag.
+     * @param iv The initialization vector (must be AES_GCM_IV_SIZE bytes).
+     * @return An EncryptionResult, INVALID_DATA if there is no room for the
+     * tag.
+     */
+    EncryptionResult encrypt_in_place(std::span<uint8_t> buffer,
+                                      std::span<const uint8_t> iv);
+
+    /**
+     * @brief Decrypts and verifies one message where it lies.
+     * @param buffer The ciphertext including the tag. On success its first
+     * buffer.size() - AES_GCM_TAG_SIZE bytes hold the plaintext, on failure
+     * they are zeroed.
+     * @param iv The initialization vector (must be AES_GCM_IV_SIZE bytes).
+     * @return An EncryptionResult.
+     */
+    EncryptionResult decrypt_in_place(std::span<uint8_t> buffer,
+                                      std::span<const uint8_t> iv);
+
+  private:
+    // Crypto++ cipher objects, kept out of this header
+    struct Ciphers;
+
+    std::unique_ptr<Ciphers> m_ciphers;
+};
+
+} // namespace crypto
+} // namespace common
+} // namespace fenris
+
+#endif // FENRIS_COMMON_CRYPTO_SESSION_HPP
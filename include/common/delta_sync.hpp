@@ -0,0 +1,152 @@
+#ifndef FENRIS_COMMON_DELTA_SYNC_HPP
+#define FENRIS_COMMON_DELTA_SYNC_HPP
+
+#include "fenris.pb.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+namespace fenris {
+namespace common {
+namespace delta {
+
+/**
+ * Bounds of the block size chosen by block_size_for(). Smaller blocks find
+ * more matches in a changed file but cost more signatures to send.
+ */
+constexpr size_t MIN_DELTA_BLOCK_SIZE = 2 * 1024;
+constexpr size_t MAX_DELTA_BLOCK_SIZE = 256 * 1024;
+
+/**
+ * Bytes of SHA-256 kept as a block's strong hash, it only has to confirm a
+ * match of the weak checksum
+ */
+constexpr size_t STRONG_HASH_SIZE = 16;
+
+/**
+ * Result of applying a delta
+ */
+enum class DeltaResult {
+    SUCCESS,
+    // The delta refers to blocks the base file does not have
+    INVALID_DELTA,
+    // The rebuilt file is not the one the delta was computed from
+    HASH_MISMATCH,
+    IO_ERROR
+};
+
+/**
+ * Convert DeltaResult to string representation
+ *
+ * @param result DeltaResult to convert
+ * @return String representation of the result
+ */
+std::string delta_result_to_string(DeltaResult result);
+
+/**
+ * Block size for the signatures of a file, about the square root of its size
+ * rounded to a power of two, so a file of a few megabytes gets a few thousand
+ * signatures at most
+ *
+ * @param file_size Size of the file
+ * @return Block size between MIN_DELTA_BLOCK_SIZE and MAX_DELTA_BLOCK_SIZE
+ */
+size_t block_size_for(uint64_t file_size);
+
+/**
+ * Weak checksum of a block, the one used by rsync
+ *
+ * With sums taken modulo 2^16, a = sum(x[i]) and b = sum((n - i) * x[i]),
+ * the checksum is a | (b << 16). Runs AVX2 code when the CPU has it.
+ *
+ * @param data Bytes of the block
+ * @return Checksum that RollingChecksum can slide along a file
+ */
+uint32_t weak_checksum(std::span<const uint8_t> data);
+
+/**
+ * @class RollingChecksum
+ * @brief weak_checksum() of a window moving over a file one byte at a time
+ */
+class RollingChecksum {
+  public:
+    /**
+     * @brief Start at a window
+     * @param window Bytes currently in the window, its size stays fixed
+     */
+    explicit RollingChecksum(std::span<const uint8_t> window);
+
+    /**
+     * @brief Move the window on by one byte
+     * @param out Byte leaving the window at its start
+     * @param in Byte entering it at its end
+     */
+    void roll(uint8_t out, uint8_t in)
+    {
+        m_a += static_cast<uint32_t>(in) - out;
+        m_b += m_a - m_length * out;
+    }
+
+    /**
+     * @brief Checksum of the current window
+     * @return Same value as weak_checksum() of the window
+     */
+    uint32_t value() const
+    {
+        return (m_a & 0xffff) | (m_b << 16);
+    }
+
+  private:
+    uint32_t m_a{0};
+    uint32_t m_b{0};
+    uint32_t m_length{0};
+};
+
+/**
+ * Signatures of a file for a peer to compute a delta against
+ *
+ * @param data Content of the file
+ * @param block_size Bytes per block, the last block may be shorter
+ * @return Block size, file size and one signature per block; the caller
+ * fills in the modification time
+ */
+fenris::FileSignatures compute_signatures(std::span<const uint8_t> data,
+                                          size_t block_size);
+
+/**
+ * Delta that turns the file behind signatures into target
+ *
+ * Blocks of target that match a signature, wherever they lie, become copies
+ * of the old block; runs of consecutive blocks share one copy. Everything
+ * else is sent literally.
+ *
+ * @param signatures Signatures of the old file
+ * @param target Content the old file has to be turned into
+ * @return Delta carrying the old file's size and time from signatures
+ */
+fenris::Delta compute_delta(const fenris::FileSignatures &signatures,
+                            std::span<const uint8_t> target);
+
+/**
+ * Write the file a delta describes
+ *
+ * The output is checked against the delta's target_size and target_hash,
+ * on failure whatever was written to fd must be discarded.
+ *
+ * @param base Content of the old file
+ * @param delta Delta computed against the signatures of base
+ * @param fd Descriptor the new content is written to, from its current
+ * position on
+ * @return SUCCESS if fd holds exactly the sender's file
+ */
+DeltaResult apply_delta(std::span<const uint8_t> base,
+                        const fenris::Delta &delta,
+                        int fd);
+
+} // namespace delta
+} // namespace common
+} // namespace fenris
+
+#endif // FENRIS_COMMON_DELTA_SYNC_HPP
@@ -1,11 +1,15 @@
 #ifndef FENRIS_COMMON_FILE_OPERATIONS_HPP
 #define FENRIS_COMMON_FILE_OPERATIONS_HPP
 
+#include "common/buffer.hpp"
 #include "fenris.pb.h"
+#include <cstddef>
 #include <cstdint>
+#include <ctime>
 #include <filesystem>
 #include <fstream>
 #include <string>
+#include <string_view>
 #include <system_error>
 #include <utility>
 #include <vector>
@@ -46,6 +50,60 @@ std::string file_operation_result_to_string(FileOperationResult result);
 std::pair<std::string, FileOperationResult>
 read_file(const std::string &filepath);
 
+/**
+ * How a mapped file is going to be read, passed on to madvise()
+ */
+enum class AccessPattern {
+    // Front to back, read ahead aggressively
+    SEQUENTIAL,
+    // Scattered offsets, do not read ahead
+    RANDOM
+};
+
+/**
+ * Bytes of a file the kernel is asked to read into the page cache in the
+ * background, with posix_fadvise(POSIX_FADV_WILLNEED)
+ */
+struct Prefetch {
+    uint64_t offset = 0;
+    // 0 for nothing to prefetch
+    uint64_t length = 0;
+};
+
+// Smallest file read_file_buffer() maps instead of reading
+constexpr size_t MAP_THRESHOLD = 1024 * 1024;
+
+/**
+ * Map a file read-only into memory
+ *
+ * The buffer views a private mapping that is unmapped with its last view. Its
+ * bytes must not be written, and the file must not be truncated while the
+ * buffer is alive: touching pages past the new end raises SIGBUS.
+ *
+ * @param filepath Path to the file to map
+ * @param pattern Expected access pattern
+ * @return Pair of (mapped content, FileOperationResult), an empty file maps
+ * to an empty buffer
+ */
+std::pair<Buffer, FileOperationResult>
+map_file(const std::string &filepath,
+         AccessPattern pattern = AccessPattern::SEQUENTIAL);
+
+/**
+ * Read a file into a shared buffer, mapping it if it is large
+ *
+ * Unlike read_file() the content is neither zero-filled first nor copied into
+ * a string. Files of at least map_threshold bytes are mapped as by
+ * map_file(), with the same caveats.
+ *
+ * @param filepath Path to the file to read
+ * @param map_threshold Smallest file size to map, 0 to never map
+ * @return Pair of (file content, FileOperationResult)
+ */
+std::pair<Buffer, FileOperationResult>
+read_file_buffer(const std::string &filepath,
+                 size_t map_threshold = MAP_THRESHOLD);
+
 /**
  * Write data to a file (creates the file if it doesn't exist, otherwise
  * overwrites)
@@ -67,6 +125,62 @@ FileOperationResult write_file(const std::string &filepath,
 FileOperationResult append_file(const std::string &filepath,
                                 const std::string &data);
 
+/**
+ * Read one block of a file
+ *
+ * @param filepath Path to the file to read
+ * @param offset Byte offset of the first byte to read
+ * @param length Maximum number of bytes to read
+ * @return Pair of (block content, FileOperationResult). The block is shorter
+ * than length when it reaches the end of the file and empty past it.
+ */
+std::pair<std::string, FileOperationResult>
+read_file_chunk(const std::string &filepath, uint64_t offset, size_t length);
+
+/**
+ * Write one block of a file
+ *
+ * @param filepath Path to the file to write
+ * @param offset Byte offset the block starts at. Offset 0 creates or truncates
+ * the file, any other offset requires the file to exist.
+ * @param data Block content
+ * @return FileOperationResult indicating success or failure
+ */
+FileOperationResult write_file_chunk(const std::string &filepath,
+                                     uint64_t offset,
+                                     const std::string &data);
+
+/**
+ * Read a byte range of a file with a single pread() loop
+ *
+ * Unlike read_file_chunk() the block is read into an uninitialized buffer
+ * without seeking a stream, so concurrent readers of one file do not share a
+ * file position.
+ *
+ * @param filepath Path to the file to read
+ * @param offset Byte offset of the first byte to read
+ * @param length Maximum number of bytes to read
+ * @return Pair of (range content, FileOperationResult). The range is shorter
+ * than length when it reaches the end of the file and empty past it.
+ */
+std::pair<Buffer, FileOperationResult>
+read_file_range(const std::string &filepath, uint64_t offset, size_t length);
+
+/**
+ * Overwrite a byte range of an existing file with pwrite()
+ *
+ * The file is never truncated. Bytes past the current end extend it, and a
+ * gap between the end and offset reads back as zeros.
+ *
+ * @param filepath Path to the file to write, which must exist
+ * @param offset Byte offset the data starts at
+ * @param data Bytes to write
+ * @return FileOperationResult indicating success or failure
+ */
+FileOperationResult write_file_at(const std::string &filepath,
+                                  uint64_t offset,
+                                  std::string_view data);
+
 /**
  * Create a new empty file
  *
@@ -92,6 +206,14 @@ FileOperationResult delete_file(const std::string &filepath);
 std::pair<fenris::FileInfo, FileOperationResult>
 get_file_info(const std::string &filepath);
 
+/**
+ * Convert a stat() timestamp to FileInfo::modified_time
+ *
+ * @param timestamp Timestamp such as stat::st_mtim
+ * @return Nanoseconds on the clock of std::filesystem::last_write_time()
+ */
+uint64_t to_modified_time(const struct timespec &timestamp);
+
 /**
  * Check if a file exists
  *
@@ -136,6 +258,39 @@ FileOperationResult delete_directory(const std::string &dirpath,
 std::pair<std::vector<fenris::FileInfo>, FileOperationResult>
 list_directory(const std::string &dirpath);
 
+/**
+ * One page of a directory listing
+ */
+struct DirectoryPage {
+    // Entries named relative to the directory, in directory order
+    std::vector<fenris::FileInfo> entries;
+
+    // Position after the last entry, pass it back as cursor to continue. 0
+    // once the end of the directory was reached.
+    uint64_t next_cursor = 0;
+};
+
+/**
+ * List part of a directory, reading it with getdents64()
+ *
+ * Entries are returned in the order the file system keeps them. The cursor
+ * is the file system's own directory offset, so a listing can be resumed
+ * without the server keeping any state, and entries added or removed
+ * meanwhile do not shift the rest.
+ *
+ * @param dirpath Path of the directory to list
+ * @param cursor next_cursor of the previous page, 0 to start at the top
+ * @param page_size Maximum number of entries to return
+ * @param names_only Only fill in name and is_directory, which skips the
+ * stat() per entry on file systems that report entry types
+ * @return Pair of (page, FileOperationResult)
+ */
+std::pair<DirectoryPage, FileOperationResult>
+list_directory_page(const std::string &dirpath,
+                    uint64_t cursor,
+                    size_t page_size,
+                    bool names_only = false);
+
 /**
  * Change the current working directory
  *
@@ -180,6 +335,166 @@ FileOperationResult copy_file(const std::string &source,
 std::pair<uintmax_t, FileOperationResult>
 get_file_size(const std::string &filepath);
 
+/**
+ * Create a hidden file next to a path that rename() can move over it
+ *
+ * @param filepath File the temporary file is going to replace
+ * @param temp_path Set to the path of the created file
+ * @return Pair of (descriptor open for writing, FileOperationResult), the
+ * caller closes the descriptor and renames or unlinks the file
+ */
+std::pair<int, FileOperationResult>
+create_temp_file(const std::string &filepath, std::string &temp_path);
+
+/**
+ * Replace the content of a file by a hole, creating the file if needed
+ *
+ * The file reports the given size but takes no disk blocks on file systems
+ * with sparse files, and every byte reads back as zero.
+ *
+ * @param filepath Path to the file
+ * @param size Size of the hole
+ * @return Pair of (FileInfo::modified_time of the file afterwards,
+ * FileOperationResult)
+ */
+std::pair<uint64_t, FileOperationResult>
+write_sparse_file(const std::string &filepath, uint64_t size);
+
+/**
+ * @class DirectoryHandle
+ * @brief Open directory that file operations resolve paths against
+ *
+ * Relative paths given to the member functions are looked up with openat()
+ * and friends starting at the held descriptor, so the directory's own path
+ * is not walked again on every call. Absolute paths ignore the directory. A
+ * default constructed handle stands for the current working directory, and
+ * the free functions above are thin wrappers around one.
+ *
+ * Existence and permission errors come from the errno of the call that does
+ * the work, no operation looks before it leaps. Results match the free
+ * functions of the same name.
+ */
+class DirectoryHandle {
+  public:
+    DirectoryHandle() = default;
+    ~DirectoryHandle();
+
+    DirectoryHandle(DirectoryHandle &&other) noexcept;
+    DirectoryHandle &operator=(DirectoryHandle &&other) noexcept;
+    DirectoryHandle(const DirectoryHandle &) = delete;
+    DirectoryHandle &operator=(const DirectoryHandle &) = delete;
+
+    /**
+     * Open a directory
+     *
+     * @param dirpath Path of the directory
+     * @return Pair of (handle, FileOperationResult), INVALID_PATH if the path
+     * is not a directory
+     */
+    static std::pair<DirectoryHandle, FileOperationResult>
+    open(const std::string &dirpath);
+
+    /**
+     * Open a directory relative to this one
+     *
+     * @param path Path of the directory
+     * @return Pair of (handle, FileOperationResult), INVALID_PATH if the path
+     * is not a directory
+     */
+    std::pair<DirectoryHandle, FileOperationResult>
+    open_directory(const std::string &path) const;
+
+    /**
+     * Whether the handle holds a descriptor rather than standing for the
+     * current working directory
+     */
+    bool is_open() const
+    {
+        return m_fd >= 0;
+    }
+
+    /**
+     * Descriptor paths are resolved against, AT_FDCWD when none is held
+     */
+    int dirfd() const;
+
+    std::pair<std::string, FileOperationResult>
+    read_file(const std::string &path) const;
+
+    std::pair<Buffer, FileOperationResult>
+    read_file_buffer(const std::string &path,
+                     size_t map_threshold = MAP_THRESHOLD) const;
+
+    /**
+     * Read a byte range of a file, see read_file_range()
+     *
+     * @param file_size If not null, receives the size of the whole file
+     * @param prefetch Bytes to prefetch once the range was read, with the
+     * same descriptor
+     */
+    std::pair<Buffer, FileOperationResult>
+    read_file_range(const std::string &path,
+                    uint64_t offset,
+                    size_t length,
+                    uint64_t *file_size = nullptr,
+                    const Prefetch &prefetch = {}) const;
+
+    FileOperationResult write_file(const std::string &path,
+                                   std::string_view data) const;
+
+    FileOperationResult append_file(const std::string &path,
+                                    std::string_view data) const;
+
+    FileOperationResult write_file_at(const std::string &path,
+                                      uint64_t offset,
+                                      std::string_view data) const;
+
+    FileOperationResult create_file(const std::string &path) const;
+
+    FileOperationResult delete_file(const std::string &path) const;
+
+    /**
+     * Create a temporary file next to path, see create_temp_file()
+     *
+     * @param temp_path Set to the path of the created file, relative to this
+     * directory when path is
+     */
+    std::pair<int, FileOperationResult>
+    create_temp_file(const std::string &path, std::string &temp_path) const;
+
+    /**
+     * Move a file over another with renameat(), replacing it atomically
+     *
+     * @param temp_path File to move, as filled in by create_temp_file()
+     * @param path File to replace
+     * @param sync Flush the directory afterwards so the rename survives a
+     * crash, IO_ERROR if that fails
+     */
+    FileOperationResult replace_file(const std::string &temp_path,
+                                     const std::string &path,
+                                     bool sync) const;
+
+    /**
+     * Get file information with a single fstatat()
+     *
+     * @return Pair of (information named after path, FileOperationResult)
+     */
+    std::pair<fenris::FileInfo, FileOperationResult>
+    get_file_info(const std::string &path) const;
+
+    std::pair<uintmax_t, FileOperationResult>
+    get_file_size(const std::string &path) const;
+
+    std::pair<DirectoryPage, FileOperationResult>
+    list_directory_page(const std::string &path,
+                        uint64_t cursor,
+                        size_t page_size,
+                        bool names_only = false) const;
+
+  private:
+    int m_fd{-1};
+};
+
 /**
  * Convert system_error to FileOperationResult
  *
@@ -0,0 +1,82 @@
+#ifndef FENRIS_COMMON_HANDSHAKE_HPP
+#define FENRIS_COMMON_HANDSHAKE_HPP
+
+#include "fenris.pb.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace fenris {
+namespace common {
+
+/**
+ * Size of an uncompressed NIST P-256 public key, the fixed part of the key
+ * exchange frame
+ */
+constexpr size_t ECDH_PUBLIC_KEY_SIZE = 65;
+
+/**
+ * First byte of a resumption frame, which carries a handshake with a session
+ * ticket instead of a public key. Uncompressed points start with 0x04, and
+ * 0x00 would encode the point at infinity, so no real key starts with it.
+ */
+constexpr uint8_t RESUMPTION_FRAME_MARKER = 0x00;
+
+/**
+ * Contents of one key exchange frame
+ */
+struct KeyExchange {
+    std::vector<uint8_t> public_key;
+    // Missing when the peer sent a bare key and negotiates no capabilities
+    std::optional<fenris::Handshake> handshake;
+    // Set for resumption frames, which have no public key and always carry a
+    // handshake
+    bool resumption{false};
+};
+
+/**
+ * Build a key exchange frame: the public key followed by the serialized
+ * handshake, if any
+ *
+ * @param public_key Our ECDH public key
+ * @param handshake Capabilities to offer or accept, std::nullopt to send the
+ * bare key
+ * @return The frame to send with a size prefix
+ */
+std::vector<uint8_t>
+encode_key_exchange(const std::vector<uint8_t> &public_key,
+                    const std::optional<fenris::Handshake> &handshake);
+
+/**
+ * Build a resumption frame: the marker followed by the serialized handshake
+ *
+ * @param handshake Ticket and nonce from the client, or the server's answer
+ * @return The frame to send with a size prefix
+ */
+std::vector<uint8_t> encode_resumption(const fenris::Handshake &handshake);
+
+/**
+ * Split a received key exchange frame into the public key and handshake
+ *
+ * @param frame The frame as received, without its size prefix, either a key
+ * exchange or a resumption frame
+ * @return The decoded frame, std::nullopt if the trailing handshake is
+ * malformed
+ */
+std::optional<KeyExchange> decode_key_exchange(std::span<const uint8_t> frame);
+
+/**
+ * Check a negotiated capability mask
+ *
+ * @param capabilities Mask from a Handshake
+ * @param capability Capability to test for
+ * @return True if the capability is set
+ */
+bool has_capability(uint32_t capabilities, fenris::Capability capability);
+
+} // namespace common
+} // namespace fenris
+
+#endif // FENRIS_COMMON_HANDSHAKE_HPP
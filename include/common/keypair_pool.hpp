@@ -0,0 +1,102 @@
+#ifndef FENRIS_COMMON_KEYPAIR_POOL_HPP
+#define FENRIS_COMMON_KEYPAIR_POOL_HPP
+
+#include "common/crypto_manager.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace fenris {
+namespace common {
+namespace crypto {
+
+/**
+ * Key pairs a KeyPairPool keeps ready. Enough to absorb a burst of
+ * reconnects after a failover, at a little over 100 bytes per pair.
+ */
+constexpr size_t DEFAULT_KEYPAIR_POOL_SIZE = 64;
+
+/**
+ * @class KeyPairPool
+ * @brief Ephemeral P-256 key pairs generated ahead of the handshakes using
+ * them
+ *
+ * Key generation is the part of a key exchange that does not depend on the
+ * peer, so a background thread does it in advance and take() hands out a
+ * finished pair. That leaves only the shared secret for the accept path.
+ * The thread runs under SCHED_IDLE, so it refills the pool from cores that
+ * have nothing else to do and never competes with requests.
+ *
+ * Each pair is handed out once. When a burst drains the pool, take() falls
+ * back to generating the pair inline, as if there were no pool.
+ *
+ * take() is safe to call from several threads at once.
+ */
+class KeyPairPool {
+  public:
+    /**
+     * @brief Constructor
+     * @param capacity Number of pairs to keep ready, 0 generates every pair
+     * inline
+     */
+    explicit KeyPairPool(size_t capacity = DEFAULT_KEYPAIR_POOL_SIZE);
+
+    /**
+     * @brief Destructor, stops the refill thread
+     */
+    ~KeyPairPool();
+
+    KeyPairPool(const KeyPairPool &) = delete;
+    KeyPairPool &operator=(const KeyPairPool &) = delete;
+
+    /**
+     * @brief Start filling the pool in the background
+     */
+    void start();
+
+    /**
+     * @brief Stop the refill thread, pairs already generated stay available
+     */
+    void stop();
+
+    /**
+     * @brief Take a key pair out of the pool
+     * @return The private key, public key, and ECDHResult, in the shape of
+     * CryptoManager::generate_ecdh_keypair()
+     */
+    std::tuple<std::vector<uint8_t>, std::vector<uint8_t>, ECDHResult> take();
+
+    /**
+     * @brief Get the number of pairs ready to be taken
+     * @return Number of pooled pairs
+     */
+    size_t available() const;
+
+  private:
+    struct KeyPair {
+        std::vector<uint8_t> private_key;
+        std::vector<uint8_t> public_key;
+    };
+
+    void run();
+
+    size_t m_capacity;
+    CryptoManager m_crypto_manager;
+    std::deque<KeyPair> m_pairs;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_drained;
+    bool m_running{false};
+    std::thread m_thread;
+};
+
+} // namespace crypto
+} // namespace common
+} // namespace fenris
+
+#endif // FENRIS_COMMON_KEYPAIR_POOL_HPP
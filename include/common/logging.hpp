@@ -2,7 +2,10 @@
 #define FENRIS_COMMON_LOGGING_HPP
 
 #include <argparse/argparse.hpp>
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <spdlog/async.h>
 #include <spdlog/sinks/rotating_file_sink.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
@@ -27,6 +30,14 @@ enum class LogLevel {
     OFF = spdlog::level::off
 };
 
+/**
+ * What an asynchronous logger does when its queue is full
+ */
+enum class AsyncOverflow {
+    BLOCK,      // Wait for the queue to drain, nothing is lost
+    DROP_OLDEST // Overwrite the oldest queued message, never wait
+};
+
 /**
  * Logging configuration for the application
  */
@@ -38,6 +49,11 @@ struct LoggingConfig {
         "fenris.log"; // Path to log file (only used if file_logging is true)
     size_t max_file_size = 1048576; // Maximum size of log file in bytes (1 MB)
     size_t max_files = 3;           // Maximum number of log files to keep
+    bool async = false;             // Format and write on a background thread
+    size_t async_queue_size = 8192; // Messages the background queue holds
+    AsyncOverflow async_overflow =
+        AsyncOverflow::BLOCK;  // What a full queue does to the logging thread
+    uint32_t sample_rate = 1; // Keep one in this many sampled log lines
 };
 
 /**
@@ -54,9 +70,13 @@ bool initialize_logging(const LoggingConfig &config,
  * Configure and initialize logging based on command line arguments
  *
  * @param program Argument parser with command line arguments
+ * @param logger_name Name of the logger to initialize
+ * @param base Settings not taken from the command line
  * @return Whether configuration succeeded
  */
-bool configure_logging(const argparse::ArgumentParser &program);
+bool configure_logging(const argparse::ArgumentParser &program,
+                       const std::string &logger_name = "fenris_client",
+                       const LoggingConfig &base = LoggingConfig());
 
 /**
  * Get the logger instance
@@ -73,6 +93,18 @@ Logger get_logger(const std::string &logger_name = "fenris");
  */
 void set_log_level(LogLevel level);
 
+/**
+ * Set how many sampled log lines pass for each one written
+ *
+ * @param rate Keep one line in rate, 0 and 1 keep every line
+ */
+void set_log_sample_rate(uint32_t rate);
+
+/**
+ * Drain asynchronous loggers and flush every sink, call before exiting
+ */
+void shutdown_logging();
+
 /**
  * Convert a LogLevel to string representation
  *
@@ -81,7 +113,62 @@ void set_log_level(LogLevel level);
  */
 std::string log_level_to_string(LogLevel level);
 
+namespace detail {
+
+inline std::atomic<uint32_t> log_sample_rate{1};
+
+/**
+ * Whether a sampled call site logs this time, tick is the site's own count
+ */
+inline bool sample_log_line(uint32_t &tick)
+{
+    const uint32_t rate = log_sample_rate.load(std::memory_order_relaxed);
+    return rate <= 1 || tick++ % rate == 0;
+}
+
+} // namespace detail
+
 } // namespace common
 } // namespace fenris
 
+/*
+ * Hot path logging. Levels below FENRIS_LOG_ACTIVE_LEVEL (an spdlog level
+ * number, trace by default) are discarded at compile time, and levels the
+ * logger filters at run time are checked before any argument is formatted.
+ * The _SAMPLED forms also keep only one line in the sample rate per call
+ * site and thread, for lines written once per request.
+ */
+#ifndef FENRIS_LOG_ACTIVE_LEVEL
+#define FENRIS_LOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#endif
+
+#define FENRIS_LOG(logger, level, ...)                                         \
+    do {                                                                       \
+        if constexpr (static_cast<int>(level) >= FENRIS_LOG_ACTIVE_LEVEL) {    \
+            if ((logger)->should_log(level)) {                                 \
+                (logger)->log(level, __VA_ARGS__);                             \
+            }                                                                  \
+        }                                                                      \
+    } while (0)
+
+#define FENRIS_LOG_SAMPLED(logger, level, ...)                                 \
+    do {                                                                       \
+        if constexpr (static_cast<int>(level) >= FENRIS_LOG_ACTIVE_LEVEL) {    \
+            static thread_local uint32_t fenris_log_tick = 0;                  \
+            if ((logger)->should_log(level) &&                                 \
+                ::fenris::common::detail::sample_log_line(fenris_log_tick)) {  \
+                (logger)->log(level, __VA_ARGS__);                             \
+            }                                                                  \
+        }                                                                      \
+    } while (0)
+
+#define FENRIS_LOG_TRACE(logger, ...)                                          \
+    FENRIS_LOG(logger, spdlog::level::trace, __VA_ARGS__)
+#define FENRIS_LOG_DEBUG(logger, ...)                                          \
+    FENRIS_LOG(logger, spdlog::level::debug, __VA_ARGS__)
+#define FENRIS_LOG_DEBUG_SAMPLED(logger, ...)                                  \
+    FENRIS_LOG_SAMPLED(logger, spdlog::level::debug, __VA_ARGS__)
+#define FENRIS_LOG_INFO_SAMPLED(logger, ...)                                   \
+    FENRIS_LOG_SAMPLED(logger, spdlog::level::info, __VA_ARGS__)
+
 #endif // FENRIS_COMMON_LOGGING_HPP
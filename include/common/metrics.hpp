@@ -0,0 +1,268 @@
+#ifndef FENRIS_COMMON_METRICS_HPP
+#define FENRIS_COMMON_METRICS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fenris {
+namespace common {
+
+/**
+ * Label names and values telling apart the metrics of one family, such as
+ * {{"op", "read"}}
+ */
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+namespace detail {
+
+// Cache lines a metric's values are spread over, each thread updates the
+// copy in its own line so threads never contend on a line
+constexpr size_t METRIC_SHARDS = 16;
+
+struct alignas(64) MetricLine {
+    static constexpr size_t VALUES = 64 / sizeof(std::atomic<uint64_t>);
+    std::atomic<uint64_t> values[VALUES] = {};
+};
+
+/**
+ * @brief Shard the calling thread writes to, threads are dealt out to the
+ *        shards in turn
+ */
+inline size_t metric_shard()
+{
+    static std::atomic<size_t> next{0};
+    thread_local const size_t shard =
+        next.fetch_add(1, std::memory_order_relaxed) % METRIC_SHARDS;
+    return shard;
+}
+
+} // namespace detail
+
+/**
+ * @class Counter
+ * @brief Monotonic count, updated with a relaxed add on a per-thread shard
+ */
+class Counter {
+  public:
+    Counter() : m_lines(detail::METRIC_SHARDS) {}
+
+    Counter(const Counter &) = delete;
+    Counter &operator=(const Counter &) = delete;
+
+    void add(uint64_t amount = 1)
+    {
+        m_lines[detail::metric_shard()].values[0].fetch_add(
+            amount, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Sum over all shards, racing updates may or may not be in it
+     */
+    uint64_t value() const;
+
+  private:
+    std::vector<detail::MetricLine> m_lines;
+};
+
+/**
+ * @class Gauge
+ * @brief Value that goes up and down, such as open connections
+ *
+ * Kept in a single atomic rather than sharded, since set() needs one place
+ * to write to.
+ */
+class Gauge {
+  public:
+    Gauge() = default;
+
+    Gauge(const Gauge &) = delete;
+    Gauge &operator=(const Gauge &) = delete;
+
+    void add(int64_t amount = 1)
+    {
+        m_value.fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    void subtract(int64_t amount = 1)
+    {
+        m_value.fetch_sub(amount, std::memory_order_relaxed);
+    }
+
+    void set(int64_t value)
+    {
+        m_value.store(value, std::memory_order_relaxed);
+    }
+
+    int64_t value() const
+    {
+        return m_value.load(std::memory_order_relaxed);
+    }
+
+  private:
+    alignas(64) std::atomic<int64_t> m_value{0};
+};
+
+/**
+ * @class Histogram
+ * @brief Distribution of integer values over fixed buckets
+ *
+ * Values are recorded in an integer unit, nanoseconds for latencies, and
+ * scaled to the exported unit only when rendered. Observing a value is a
+ * search through the bounds and two relaxed adds on the thread's shard, one
+ * for the bucket and one for the sum.
+ */
+class Histogram {
+  public:
+    /**
+     * @param bounds Inclusive upper bounds of the buckets, ascending. Values
+     *               above the last bound are only counted in +Inf.
+     * @param scale Factor turning recorded values into the exported unit
+     */
+    Histogram(std::vector<uint64_t> bounds, double scale);
+
+    Histogram(const Histogram &) = delete;
+    Histogram &operator=(const Histogram &) = delete;
+
+    void observe(uint64_t value);
+
+    void observe(std::chrono::nanoseconds elapsed)
+    {
+        observe(static_cast<uint64_t>(std::max<int64_t>(elapsed.count(), 0)));
+    }
+
+    const std::vector<uint64_t> &bounds() const
+    {
+        return m_bounds;
+    }
+
+    double scale() const
+    {
+        return m_scale;
+    }
+
+    /**
+     * @brief Values counted per bucket, not cumulative, the last entry
+     *        counting values above every bound
+     */
+    std::vector<uint64_t> bucket_counts() const;
+
+    uint64_t sum() const;
+
+  private:
+    std::atomic<uint64_t> &cell(size_t shard, size_t index);
+    const std::atomic<uint64_t> &cell(size_t shard, size_t index) const;
+
+    std::vector<uint64_t> m_bounds;
+    double m_scale;
+    // Lines per shard, holding a count per bucket, one for +Inf and the sum
+    size_t m_stride;
+    std::vector<detail::MetricLine> m_lines;
+};
+
+/**
+ * @brief Bucket bounds in nanoseconds from 10 microseconds to 10 seconds,
+ *        for histograms exported in seconds
+ */
+std::vector<uint64_t> latency_buckets();
+
+/**
+ * @brief Scale of histograms recording nanoseconds and exporting seconds
+ */
+constexpr double NANOSECONDS = 1e-9;
+
+/**
+ * @class ScopedTimer
+ * @brief Observes the time from construction to destruction
+ */
+class ScopedTimer {
+  public:
+    explicit ScopedTimer(Histogram &histogram)
+        : m_histogram(histogram), m_started(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~ScopedTimer()
+    {
+        m_histogram.observe(std::chrono::steady_clock::now() - m_started);
+    }
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+  private:
+    Histogram &m_histogram;
+    std::chrono::steady_clock::time_point m_started;
+};
+
+/**
+ * @class MetricsRegistry
+ * @brief Process-wide set of metrics, rendered for Prometheus to scrape
+ *
+ * Components look their metrics up once, usually into a function-local
+ * static, and keep the reference: metrics are never removed, so references
+ * stay valid for the life of the process. Looking up a name and labels that
+ * are already registered returns the existing metric, so instances of a
+ * component share their counters. Only registration and rendering take the
+ * registry's lock, updates never do.
+ */
+class MetricsRegistry {
+  public:
+    static MetricsRegistry &global();
+
+    MetricsRegistry() = default;
+    MetricsRegistry(const MetricsRegistry &) = delete;
+    MetricsRegistry &operator=(const MetricsRegistry &) = delete;
+
+    Counter &counter(const std::string &name,
+                     const std::string &help,
+                     const MetricLabels &labels = {});
+
+    Gauge &gauge(const std::string &name,
+                 const std::string &help,
+                 const MetricLabels &labels = {});
+
+    /**
+     * @brief Look up a histogram, bounds and scale only apply when it is
+     *        created
+     */
+    Histogram &histogram(const std::string &name,
+                         const std::string &help,
+                         const MetricLabels &labels = {},
+                         std::vector<uint64_t> bounds = latency_buckets(),
+                         double scale = NANOSECONDS);
+
+    /**
+     * @brief All metrics in the Prometheus text exposition format 0.0.4
+     */
+    std::string render() const;
+
+  private:
+    enum class Type { COUNTER, GAUGE, HISTOGRAM };
+
+    struct Family {
+        std::string help;
+        Type type;
+        std::map<MetricLabels, std::unique_ptr<Counter>> counters;
+        std::map<MetricLabels, std::unique_ptr<Gauge>> gauges;
+        std::map<MetricLabels, std::unique_ptr<Histogram>> histograms;
+    };
+
+    Family &family(const std::string &name, const std::string &help, Type type);
+
+    mutable std::mutex m_mutex;
+    std::map<std::string, Family> m_families;
+};
+
+} // namespace common
+} // namespace fenris
+
+#endif // FENRIS_COMMON_METRICS_HPP
@@ -1,8 +1,11 @@
 #ifndef FENRIS_COMMON_NETWORK_UTILS_HPP
 #define FENRIS_COMMON_NETWORK_UTILS_HPP
 
+#include "common/buffer.hpp"
+
 #include <cstdint>
 #include <cstring>
+#include <span>
 #include <string>
 #include <unistd.h>
 #include <vector>
@@ -11,7 +14,22 @@ namespace fenris {
 namespace common {
 namespace network {
 
-static const uint32_t DELAY = 100;
+/**
+ * Timeout value meaning "wait as long as it takes"
+ */
+static const int NO_TIMEOUT = -1;
+
+/**
+ * Size limit value meaning "accept whatever the length prefix announces"
+ */
+static const size_t NO_SIZE_LIMIT = SIZE_MAX;
+
+/**
+ * Bytes allocated for a message before any of it arrived. Larger messages
+ * grow their buffer as their bytes come in, so a length prefix alone cannot
+ * make the receiver allocate the size it announces.
+ */
+constexpr size_t INITIAL_RECEIVE_BUFFER_SIZE = 64 * 1024;
 
 /**
  * @enum NetworkResult
@@ -25,6 +43,8 @@ enum class NetworkResult {
     SEND_ERROR,         // Error occurred during send operation
     RECEIVE_ERROR,      // Error occurred during receive operation
     ALLOCATION_ERROR,   // Error allocating memory
+    TIMEOUT,            // Deadline expired before the transfer completed
+    MESSAGE_TOO_LARGE,  // Length prefix exceeds the receiver's limit
 };
 
 /**
@@ -40,20 +60,30 @@ std::string network_result_to_string(NetworkResult result);
  * @param socket The socket to send the data to.
  * @param size The size of the data to be sent.
  * @param non_blocking_mode True if the socket is in non-blocking mode, false
+ * otherwise.
+ * @param timeout_ms Time budget for the whole call in milliseconds, NO_TIMEOUT
+ * to wait indefinitely
  * @return NetworkResult indicating success or failure type
  */
-NetworkResult
-send_size(uint32_t socket, uint32_t size, bool non_blocking_mode = false);
+NetworkResult send_size(uint32_t socket,
+                        uint32_t size,
+                        bool non_blocking_mode = false,
+                        int timeout_ms = NO_TIMEOUT);
 
 /**
  * @brief Receives size of the data to be sent over the socket.
  * @param socket The socket to receive the data from.
  * @param size The size of the data to be received.
  * @param non_blocking_mode True if the socket is in non-blocking mode, false
+ * otherwise.
+ * @param timeout_ms Time budget for the whole call in milliseconds, NO_TIMEOUT
+ * to wait indefinitely
  * @return NetworkResult indicating success or failure type
  */
-NetworkResult
-receive_size(uint32_t socket, uint32_t &size, bool non_blocking_mode = false);
+NetworkResult receive_size(uint32_t socket,
+                           uint32_t &size,
+                           bool non_blocking_mode = false,
+                           int timeout_ms = NO_TIMEOUT);
 
 /**
  * @brief Sends data over the socket.
@@ -61,12 +91,16 @@ receive_size(uint32_t socket, uint32_t &size, bool non_blocking_mode = false);
  * @param data The data to be sent.
  * @param size The size of the data to be sent.
  * @param non_blocking_mode True if the socket is in non-blocking mode, false
+ * otherwise.
+ * @param timeout_ms Time budget for the whole call in milliseconds, NO_TIMEOUT
+ * to wait indefinitely
  * @return NetworkResult indicating success or failure type
  */
 NetworkResult send_data(uint32_t socket,
                         const std::vector<uint8_t> &data,
                         uint32_t size,
-                        bool non_blocking_mode = false);
+                        bool non_blocking_mode = false,
+                        int timeout_ms = NO_TIMEOUT);
 
 /**
  * @brief Receives data over the socket.
@@ -75,34 +109,222 @@ NetworkResult send_data(uint32_t socket,
  * @param size The size of the data to be received.
  * @param non_blocking_mode True if the socket is in non-blocking mode, false
  * otherwise.
+ * @param timeout_ms Time budget for the whole call in milliseconds, NO_TIMEOUT
+ * to wait indefinitely
  * @return NetworkResult indicating success or failure type
  */
 NetworkResult receive_data(uint32_t socket,
                            std::vector<uint8_t> &data,
                            uint32_t size,
-                           bool non_blocking_mode = false);
+                           bool non_blocking_mode = false,
+                           int timeout_ms = NO_TIMEOUT);
 
 /**
  * @brief Sends data with size prefix over socket.
  * @param socket The socket to send the data to.
  * @param data The data to be sent.
  * @param non_blocking_mode True if the socket is in non-blocking mode, false
+ * otherwise.
+ * @param timeout_ms Time budget for the whole call in milliseconds, NO_TIMEOUT
+ * to wait indefinitely
  * @return NetworkResult indicating success or failure type
+ *
+ * Sent with send_prefixed_segments(), in a single sendmsg() call unless the
+ * socket takes less.
  */
 NetworkResult send_prefixed_data(uint32_t socket,
                                  const std::vector<uint8_t> &data,
-                                 bool non_blocking_mode = false);
+                                 bool non_blocking_mode = false,
+                                 int timeout_ms = NO_TIMEOUT);
 
 /**
  * @brief Receives data with size prefix from socket.
  * @param socket The socket to receive the data from.
  * @param data The data to be received.
  * @param non_blocking_mode True if the socket is in non-blocking mode, false
- * @return NetworkResult indicating success or failure type
+ * otherwise.
+ * @param timeout_ms Time budget for the whole call in milliseconds, NO_TIMEOUT
+ * to wait indefinitely
+ * @param max_size Largest message accepted
+ * @return NetworkResult indicating success or failure type, MESSAGE_TOO_LARGE
+ * if the prefix announces more than max_size bytes
  */
 NetworkResult receive_prefixed_data(uint32_t socket,
                                     std::vector<uint8_t> &data,
-                                    bool non_blocking_mode = false);
+                                    bool non_blocking_mode = false,
+                                    int timeout_ms = NO_TIMEOUT,
+                                    size_t max_size = NO_SIZE_LIMIT);
+
+/**
+ * @brief Sends several buffers as one size-prefixed message.
+ * @param socket The socket to send the data to.
+ * @param segments Buffers sent back to back after the size prefix.
+ * @param non_blocking_mode True if the socket is in non-blocking mode, false
+ * otherwise.
+ * @param timeout_ms Time budget for the whole call in milliseconds, NO_TIMEOUT
+ * to wait indefinitely
+ * @return NetworkResult indicating success or failure type
+ *
+ * The prefix and every segment go out through a single sendmsg() call (more
+ * only on partial writes), so callers do not have to concatenate them first.
+ */
+NetworkResult
+send_prefixed_segments(uint32_t socket,
+                       std::span<const std::span<const uint8_t>> segments,
+                       bool non_blocking_mode = false,
+                       int timeout_ms = NO_TIMEOUT);
+
+/**
+ * @brief Receives a size-prefixed message into a fixed header and a body.
+ * @param socket The socket to receive the data from.
+ * @param header Preallocated buffer filled with the first header.size() bytes
+ * of the message.
+ * @param body Receives the rest of the message, resized as needed.
+ * @param non_blocking_mode True if the socket is in non-blocking mode, false
+ * otherwise.
+ * @param timeout_ms Time budget for the whole call in milliseconds, NO_TIMEOUT
+ * to wait indefinitely
+ * @param max_size Largest message accepted, header included
+ * @return NetworkResult indicating success or failure type, RECEIVE_ERROR if
+ * the message is shorter than the header, MESSAGE_TOO_LARGE if it is longer
+ * than max_size
+ *
+ * The size prefix and the header are read with one recvmsg() call, the body
+ * is then received straight into its final buffer.
+ */
+NetworkResult receive_prefixed_segments(uint32_t socket,
+                                        std::span<uint8_t> header,
+                                        std::vector<uint8_t> &body,
+                                        bool non_blocking_mode = false,
+                                        int timeout_ms = NO_TIMEOUT,
+                                        size_t max_size = NO_SIZE_LIMIT);
+
+/**
+ * @brief Receives data with size prefix into a freshly allocated buffer.
+ * @param socket The socket to receive the data from.
+ * @param data Receives the message. The slab is allocated uninitialized and
+ * filled directly by recv(), so no zeroing takes place.
+ * @param non_blocking_mode True if the socket is in non-blocking mode, false
+ * otherwise.
+ * @param timeout_ms Time budget for the whole call in milliseconds, NO_TIMEOUT
+ * to wait indefinitely
+ * @param max_size Largest message accepted
+ * @return NetworkResult indicating success or failure type, MESSAGE_TOO_LARGE
+ * if the prefix announces more than max_size bytes
+ */
+NetworkResult receive_prefixed_data(uint32_t socket,
+                                    Buffer &data,
+                                    bool non_blocking_mode = false,
+                                    int timeout_ms = NO_TIMEOUT,
+                                    size_t max_size = NO_SIZE_LIMIT);
+
+/**
+ * @brief Receives a size-prefixed message into a fixed header and a buffer.
+ * @param socket The socket to receive the data from.
+ * @param header Preallocated buffer filled with the first header.size() bytes
+ * of the message.
+ * @param body Receives the rest of the message in a freshly allocated slab.
+ * @param non_blocking_mode True if the socket is in non-blocking mode, false
+ * otherwise.
+ * @param timeout_ms Time budget for the whole call in milliseconds, NO_TIMEOUT
+ * to wait indefinitely
+ * @param max_size Largest message accepted, header included
+ * @return NetworkResult indicating success or failure type, RECEIVE_ERROR if
+ * the message is shorter than the header, MESSAGE_TOO_LARGE if it is longer
+ * than max_size
+ */
+NetworkResult receive_prefixed_segments(uint32_t socket,
+                                        std::span<uint8_t> header,
+                                        Buffer &body,
+                                        bool non_blocking_mode = false,
+                                        int timeout_ms = NO_TIMEOUT,
+                                        size_t max_size = NO_SIZE_LIMIT);
+
+/**
+ * @brief Receives the size prefix and the fixed header of a message.
+ * @param socket The socket to receive the data from.
+ * @param header Preallocated buffer filled with the first header.size() bytes
+ * of the message.
+ * @param body_size Set to the number of bytes following the header.
+ * @param non_blocking_mode True if the socket is in non-blocking mode, false
+ * otherwise.
+ * @param timeout_ms Time budget for the call in milliseconds, NO_TIMEOUT to
+ * wait indefinitely
+ * @param max_size Largest message accepted, header included
+ * @return NetworkResult indicating success or failure type, RECEIVE_ERROR if
+ * the message is shorter than the header, MESSAGE_TOO_LARGE if it is longer
+ * than max_size
+ *
+ * Together with receive_body() this lets a caller decide whether it can take
+ * the body before any memory is spent on it.
+ */
+NetworkResult receive_preamble(uint32_t socket,
+                               std::span<uint8_t> header,
+                               size_t &body_size,
+                               bool non_blocking_mode = false,
+                               int timeout_ms = NO_TIMEOUT,
+                               size_t max_size = NO_SIZE_LIMIT);
+
+/**
+ * @brief Receives the body announced by receive_preamble().
+ * @param socket The socket to receive the data from.
+ * @param body Receives the body in a freshly allocated slab.
+ * @param size Number of bytes to receive.
+ * @param non_blocking_mode True if the socket is in non-blocking mode, false
+ * otherwise.
+ * @param timeout_ms Time budget for the call in milliseconds, NO_TIMEOUT to
+ * wait indefinitely
+ * @param reserved Memory for size bytes was already set aside, e.g. leased
+ * from a budget, so the slab is allocated whole rather than grown
+ * @return NetworkResult indicating success or failure type
+ */
+NetworkResult receive_body(uint32_t socket,
+                           Buffer &body,
+                           size_t size,
+                           bool non_blocking_mode = false,
+                           int timeout_ms = NO_TIMEOUT,
+                           bool reserved = false);
+
+/**
+ * @brief Make room for the next bytes of a message being received.
+ * @param buffer Holds the bytes received so far, replaced by a larger slab
+ * with the same leading bytes
+ * @param received Bytes of buffer already filled
+ * @param size Size of the whole message
+ * @param reserved Memory for size bytes was already set aside
+ *
+ * The slab starts at INITIAL_RECEIVE_BUFFER_SIZE and doubles up to size, so
+ * memory follows the bytes that actually arrived. A reserved message gets
+ * its whole slab at once, and no byte is copied. Throws std::bad_alloc.
+ */
+void grow_receive_buffer(Buffer &buffer,
+                         size_t received,
+                         size_t size,
+                         bool reserved = false);
+
+/**
+ * @brief Sends a region of a file as one size-prefixed message.
+ * @param socket The socket to send the data to.
+ * @param file_fd Open file to read from, its file offset is left untouched.
+ * @param offset Position of the region in the file.
+ * @param length Number of bytes to send.
+ * @param non_blocking_mode True if the socket is in non-blocking mode, false
+ * otherwise.
+ * @param timeout_ms Time budget for the whole call in milliseconds, NO_TIMEOUT
+ * to wait indefinitely
+ * @return NetworkResult indicating success or failure type, SEND_ERROR if the
+ * file ends before the region does
+ *
+ * The bytes move from the page cache to the socket with sendfile() and never
+ * pass through user space. File systems without sendfile() support fall back
+ * to a small bounce buffer.
+ */
+NetworkResult send_prefixed_file(uint32_t socket,
+                                 int file_fd,
+                                 uint64_t offset,
+                                 uint32_t length,
+                                 bool non_blocking_mode = false,
+                                 int timeout_ms = NO_TIMEOUT);
 
 } // namespace network
 } // namespace common
@@ -0,0 +1,109 @@
+#ifndef FENRIS_COMMON_NONCE_SEQUENCE_HPP
+#define FENRIS_COMMON_NONCE_SEQUENCE_HPP
+
+#include "common/crypto_manager.hpp"
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace fenris {
+namespace common {
+namespace crypto {
+
+/**
+ * Which way the messages sealed with a nonce travel. Both directions share
+ * the session key, so they must never produce the same nonce.
+ */
+enum class NonceDirection : uint8_t {
+    CLIENT_TO_SERVER = 1,
+    SERVER_TO_CLIENT = 2,
+};
+
+/**
+ * Messages sent under one key before the client asks for a new one. Far
+ * below the 64 bit counter, and within the 2^32 invocations NIST SP 800-38D
+ * allows per GCM key.
+ */
+constexpr uint64_t DEFAULT_REKEY_INTERVAL = uint64_t{1} << 32;
+
+/**
+ * Highest key epoch, the epoch takes the three bytes after the direction
+ */
+constexpr uint32_t MAX_NONCE_EPOCH = 0xFFFFFF;
+
+/**
+ * @class NonceSequence
+ *
+ * Deterministic AES-GCM nonces for one direction of a connection, negotiated
+ * with CAPABILITY_SEQUENCED_NONCES. A nonce is the direction byte, the key
+ * epoch in three bytes and a 64 bit message counter, all big endian:
+ *
+ *     | direction | epoch (24) | counter (64) |
+ *
+ * The sender takes nonces from next() instead of drawing random IVs. The
+ * receiver keeps its own sequence for the other direction and rejects any
+ * nonce that does not carry the expected prefix or does not count up, which
+ * catches replayed and reordered messages before they are decrypted. The
+ * epoch goes up with every rekey, so nonces from an old key are refused too.
+ */
+class NonceSequence {
+  public:
+    /**
+     * @brief Start a sequence at counter 0
+     * @param direction Direction of the messages using these nonces
+     * @param epoch Number of rekeys this connection went through
+     */
+    explicit NonceSequence(NonceDirection direction, uint32_t epoch = 0);
+
+    /**
+     * @brief Nonce for the next message sent
+     * @return The nonce and EncryptionResult::SUCCESS, or
+     * IV_GENERATION_FAILED once the counter is used up
+     */
+    std::pair<std::vector<uint8_t>, EncryptionResult> next();
+
+    /**
+     * @brief Check a received nonce without consuming it
+     * @param iv Nonce received in front of a message
+     * @return EncryptionResult::SUCCESS if the message may be decrypted,
+     * INVALID_IV_SIZE or REPLAYED_NONCE otherwise
+     */
+    EncryptionResult verify(std::span<const uint8_t> iv) const;
+
+    /**
+     * @brief Record a received nonce once its message authenticated
+     * @param iv Nonce that passed verify()
+     *
+     * Later messages have to count up from here.
+     */
+    void accept(std::span<const uint8_t> iv);
+
+    /**
+     * @brief Messages sent or accepted so far under this epoch
+     * @return The next expected counter value
+     */
+    uint64_t count() const;
+
+    /**
+     * @brief Key epoch of this sequence
+     * @return Number of rekeys before the current key
+     */
+    uint32_t epoch() const;
+
+  private:
+    static constexpr size_t PREFIX_SIZE = 4;
+
+    std::array<uint8_t, PREFIX_SIZE> m_prefix;
+    uint32_t m_epoch;
+    // Counter of the next nonce sent, or the lowest one still accepted
+    uint64_t m_next{0};
+};
+
+} // namespace crypto
+} // namespace common
+} // namespace fenris
+
+#endif // FENRIS_COMMON_NONCE_SEQUENCE_HPP
@@ -1,18 +1,76 @@
 #ifndef FENRIS_COMMON_REQUEST_HPP
 #define FENRIS_COMMON_REQUEST_HPP
 
+#include "common/buffer.hpp"
 #include "fenris.pb.h"
+#include <cstddef>
+#include <cstdint>
+#include <span>
 #include <string>
+#include <vector>
 
 namespace fenris {
 namespace common {
 
+/**
+ * Block size used by READ_CHUNK / WRITE_CHUNK when the request leaves the
+ * length unset. Transfers are bounded in memory by this, not the file size.
+ */
+constexpr size_t DEFAULT_CHUNK_SIZE = 1024 * 1024;
+
+/**
+ * Largest block a peer may ask for in one READ_CHUNK / WRITE_CHUNK, keeps a
+ * single message well below the 32-bit length prefix
+ */
+constexpr size_t MAX_CHUNK_SIZE = 16 * 1024 * 1024;
+
+/**
+ * Entries per LIST_DIR page when the request leaves the page size unset
+ */
+constexpr size_t DEFAULT_LIST_PAGE_SIZE = 1024;
+
+/**
+ * Largest LIST_DIR page a peer may ask for, bounds the size of one listing
+ * however large the directory
+ */
+constexpr size_t MAX_LIST_PAGE_SIZE = 65536;
+
 std::vector<uint8_t> serialize_request(const fenris::Request &request);
 
-fenris::Request deserialize_request(const std::vector<uint8_t> &data);
+/**
+ * Serialize a request straight into a shared buffer
+ *
+ * @param request The request to serialize
+ * @param tail_room Uninitialized bytes to leave behind the message, such as
+ * room for an authentication tag
+ * @return Buffer holding the wire format followed by tail_room bytes, empty
+ * on failure
+ */
+Buffer serialize_request_to_buffer(const fenris::Request &request,
+                                   size_t tail_room = 0);
+
+/**
+ * Parse a request from its wire format without an intermediate copy
+ *
+ * @param data Serialized request
+ * @return The parsed request, a default request if parsing failed
+ */
+fenris::Request deserialize_request(std::span<const uint8_t> data);
 
 std::string request_to_json(const fenris::Request &request);
 
+/**
+ * Resolve a client path against its working directory without touching the
+ * file system, the way the server resolves request filenames
+ *
+ * @param current_directory Absolute working directory of the client
+ * @param path Path from a request, absolute or relative
+ * @return Absolute path without ".", ".." or repeated slashes. ".." at the
+ * top stays at "/", so the result never escapes.
+ */
+std::string normalize_client_path(const std::string &current_directory,
+                                  const std::string &path);
+
 } // namespace common
 } // namespace fenris
 
@@ -1,15 +1,54 @@
 #ifndef FENRIS_COMMON_RESPONSE_HPP
 #define FENRIS_COMMON_RESPONSE_HPP
 
+#include "common/buffer.hpp"
 #include "fenris.pb.h"
+#include <cstdint>
+#include <span>
 #include <string>
+#include <vector>
 
 namespace fenris {
 namespace common {
 
 std::vector<uint8_t> serialize_response(const fenris::Response &response);
 
-fenris::Response deserialize_response(const std::vector<uint8_t> &data);
+/**
+ * Serialize a response straight into a shared buffer
+ *
+ * @param response The response to serialize
+ * @param tail_room Uninitialized bytes to leave behind the message, such as
+ * room for an authentication tag
+ * @return Buffer holding the wire format followed by tail_room bytes, empty
+ * on failure
+ */
+Buffer serialize_response_to_buffer(const fenris::Response &response,
+                                    size_t tail_room = 0);
+
+/**
+ * Serialize a response with its data field taken from a separate buffer
+ *
+ * The payload is written into the output once, straight from the given
+ * bytes, so a mapped or cached file never needs to be copied into the
+ * response's own data string first.
+ *
+ * @param response The response to serialize, its data field must be empty
+ * @param data Bytes to send as the data field
+ * @param tail_room Uninitialized bytes to leave behind the message
+ * @return Buffer holding the wire format followed by tail_room bytes, empty
+ * on failure
+ */
+Buffer serialize_response_to_buffer(const fenris::Response &response,
+                                    std::span<const uint8_t> data,
+                                    size_t tail_room = 0);
+
+/**
+ * Parse a response from its wire format without an intermediate copy
+ *
+ * @param data Serialized response
+ * @return The parsed response, a default response if parsing failed
+ */
+fenris::Response deserialize_response(std::span<const uint8_t> data);
 
 std::string response_to_json(const fenris::Response &response);
 
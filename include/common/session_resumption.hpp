@@ -0,0 +1,55 @@
+#ifndef FENRIS_COMMON_SESSION_RESUMPTION_HPP
+#define FENRIS_COMMON_SESSION_RESUMPTION_HPP
+
+#include "common/crypto_manager.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace fenris {
+namespace common {
+namespace crypto {
+
+/**
+ * Size of the random nonce each side contributes to a resumed key
+ */
+constexpr size_t RESUMPTION_NONCE_SIZE = 16;
+
+/**
+ * Derive the secret a session ticket carries from the session key
+ *
+ * Both sides derive it on their own once the key is agreed on, so the
+ * secret itself never crosses the wire. The session key cannot be recovered
+ * from it.
+ *
+ * @param session_key The agreed AES-GCM key of the session
+ * @return The secret and ECDHResult::SUCCESS, or KEY_DERIVATION_FAILED
+ */
+std::pair<std::vector<uint8_t>, ECDHResult>
+derive_resumption_secret(const std::vector<uint8_t> &session_key);
+
+/**
+ * Derive the key of a resumed session with HKDF over the ticket's secret
+ *
+ * The nonces of both sides go into the derivation, so every resumption with
+ * the same ticket gets a key of its own.
+ *
+ * @param resumption_secret Secret from derive_resumption_secret()
+ * @param client_nonce RESUMPTION_NONCE_SIZE bytes from the client
+ * @param server_nonce RESUMPTION_NONCE_SIZE bytes from the server
+ * @return The AES_GCM_KEY_SIZE key and ECDHResult::SUCCESS, or
+ * KEY_DERIVATION_FAILED
+ */
+std::pair<std::vector<uint8_t>, ECDHResult>
+derive_resumed_key(const std::vector<uint8_t> &resumption_secret,
+                   std::span<const uint8_t> client_nonce,
+                   std::span<const uint8_t> server_nonce);
+
+} // namespace crypto
+} // namespace common
+} // namespace fenris
+
+#endif // FENRIS_COMMON_SESSION_RESUMPTION_HPP
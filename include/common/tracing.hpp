@@ -0,0 +1,249 @@
+#ifndef FENRIS_COMMON_TRACING_HPP
+#define FENRIS_COMMON_TRACING_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace fenris {
+namespace common {
+
+/**
+ * Stages a request passes through, each becomes a span of its trace
+ */
+enum class TraceStage : uint8_t {
+    RECEIVE,   // Reading the message off the socket
+    DECRYPT,   // Authenticating and decrypting it
+    PARSE,     // Decompressing and deserializing it
+    QUEUE,     // Waiting for a worker
+    HANDLE,    // Running the handler, cache and disk included
+    CACHE,     // Looking the content up in the cache
+    DISK,      // File system calls
+    SERIALIZE, // Serializing and compressing the reply
+    ENCRYPT,   // Encrypting it
+    SEND       // Writing it to the socket
+};
+
+/**
+ * Name a stage is shown under in a trace viewer
+ */
+const char *trace_stage_name(TraceStage stage);
+
+/**
+ * @class RequestTrace
+ * @brief Monotonic timestamps of the stages of one request
+ *
+ * A trace starts out recording when tracing is on and stamps every stage,
+ * since on the server the sampling decision can only be made once the
+ * request was parsed. Sampled traces are then written by Tracer::finish(),
+ * the others are discarded. A default constructed trace records nothing and
+ * costs nothing.
+ */
+class RequestTrace {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Span {
+        TraceStage stage;
+        Clock::time_point start;
+        Clock::time_point end;
+    };
+
+    RequestTrace() = default;
+
+    bool recording() const
+    {
+        return m_recording;
+    }
+
+    /**
+     * @brief ID shared by the client and server spans, 0 if not sampled
+     */
+    uint64_t id() const
+    {
+        return m_id;
+    }
+
+    const std::string &name() const
+    {
+        return m_name;
+    }
+
+    const std::vector<Span> &spans() const
+    {
+        return m_spans;
+    }
+
+    /**
+     * @brief Current time while recording, a zero time point otherwise so
+     *        untraced requests do not read the clock
+     */
+    Clock::time_point now() const
+    {
+        return m_recording ? Clock::now() : Clock::time_point{};
+    }
+
+    void
+    record(TraceStage stage, Clock::time_point start, Clock::time_point end)
+    {
+        if (m_recording) {
+            m_spans.push_back({stage, start, end});
+        }
+    }
+
+    /**
+     * @brief Keep the spans and write them under this ID and name
+     */
+    void sample(uint64_t id, std::string name);
+
+    /**
+     * @brief Stop recording and drop what was recorded
+     */
+    void discard();
+
+  private:
+    friend class Tracer;
+
+    bool m_recording{false};
+    uint64_t m_id{0};
+    std::string m_name;
+    std::vector<Span> m_spans;
+};
+
+/**
+ * @brief Trace the calling thread is working on, nullptr if none
+ */
+RequestTrace *current_trace();
+
+/**
+ * @class TraceContext
+ * @brief Makes a trace the calling thread's current one for its lifetime
+ *
+ * Code deep in a request, such as cache lookups and disk reads, stamps its
+ * stage through current_trace() rather than being handed the trace.
+ */
+class TraceContext {
+  public:
+    explicit TraceContext(RequestTrace *trace);
+    ~TraceContext();
+
+    TraceContext(const TraceContext &) = delete;
+    TraceContext &operator=(const TraceContext &) = delete;
+
+  private:
+    RequestTrace *m_previous;
+};
+
+/**
+ * @class TraceScope
+ * @brief Stamps a stage from construction to destruction onto the calling
+ *        thread's current trace, a thread local read when nothing records
+ */
+class TraceScope {
+  public:
+    explicit TraceScope(TraceStage stage)
+        : m_trace(current_trace()), m_stage(stage)
+    {
+        if (m_trace != nullptr && m_trace->recording()) {
+            m_start = RequestTrace::Clock::now();
+        } else {
+            m_trace = nullptr;
+        }
+    }
+
+    ~TraceScope()
+    {
+        if (m_trace != nullptr) {
+            m_trace->record(m_stage, m_start, RequestTrace::Clock::now());
+        }
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+  private:
+    RequestTrace *m_trace;
+    TraceStage m_stage;
+    RequestTrace::Clock::time_point m_start;
+};
+
+/**
+ * @class Tracer
+ * @brief Samples request traces and writes them as Chrome trace events
+ *
+ * The output is the JSON array form of the Trace Event Format, one complete
+ * ("ph":"X") event per line, which chrome://tracing and Perfetto open as
+ * is. Each sampled request gets a track of its own, with a span named after
+ * the request enclosing its stages, and carries its trace ID in args so the
+ * client's and the server's spans of a request can be joined. Timestamps
+ * are steady clock microseconds, so traces taken on one host line up.
+ */
+class Tracer {
+  public:
+    static Tracer &global();
+
+    Tracer();
+    ~Tracer();
+
+    Tracer(const Tracer &) = delete;
+    Tracer &operator=(const Tracer &) = delete;
+
+    /**
+     * @brief Start writing traces to a file
+     *
+     * @param path File the events are written to, truncated
+     * @param sample_rate Trace one request in this many, 0 and 1 trace all
+     * @param process_name Name the process is shown under
+     * @return false if the file could not be opened
+     */
+    bool open(const std::string &path,
+              uint32_t sample_rate,
+              const std::string &process_name);
+
+    /**
+     * @brief Flush and close the file, later traces are not recorded
+     */
+    void close();
+
+    bool enabled() const
+    {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief A trace recording if tracing is on, an idle one otherwise
+     */
+    RequestTrace begin() const;
+
+    /**
+     * @brief Decide whether a recording trace is sampled
+     *
+     * @param trace Trace to decide on
+     * @param requested_id ID the peer traces the request under, which is
+     *        always sampled, or 0 to sample by the rate under a new ID
+     * @param name Name of the request
+     */
+    void adopt(RequestTrace &trace, uint64_t requested_id, std::string name);
+
+    /**
+     * @brief Write a sampled trace, anything else is ignored
+     */
+    void finish(const RequestTrace &trace);
+
+  private:
+    std::atomic<bool> m_enabled{false};
+    std::atomic<uint32_t> m_sample_rate{1};
+    std::atomic<uint64_t> m_requests{0};
+    std::mutex m_mutex;
+    FILE *m_file{nullptr};
+    const int m_pid;
+};
+
+} // namespace common
+} // namespace fenris
+
+#endif // FENRIS_COMMON_TRACING_HPP
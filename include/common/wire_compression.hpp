@@ -0,0 +1,131 @@
+#ifndef FENRIS_COMMON_WIRE_COMPRESSION_HPP
+#define FENRIS_COMMON_WIRE_COMPRESSION_HPP
+
+#include "common/buffer.hpp"
+#include "common/codec.hpp"
+#include "common/compression_manager.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <utility>
+
+namespace fenris {
+namespace common {
+namespace compress {
+
+/**
+ * Which messages are worth compressing on the wire
+ */
+struct WireCompressionConfig {
+    // zlib level (0-9) of the deflate stream
+    int level = 6;
+
+    // Codecs offered in the handshake on top of deflate, which every peer
+    // supporting compression has
+    uint32_t codecs = codec_mask(CodecId::DEFLATE) | codec_mask(CodecId::LZ4);
+
+    // Messages this large go through LZ4 when it was negotiated. Bulk data
+    // would make deflate the bottleneck on fast links, while smaller
+    // messages cost little CPU either way and gain from deflate's ratio and
+    // its window reaching back into earlier messages.
+    size_t fast_codec_min_size = 64 * 1024;
+
+    // Messages shorter than this are sent as they are, the header fields of
+    // small requests and replies gain next to nothing
+    size_t min_size = 256;
+
+    // Bytes sampled from a message to estimate its entropy
+    size_t sample_size = 4096;
+
+    // Messages whose sample carries more bits per byte than this are taken
+    // to be compressed or encrypted already and are sent as they are
+    double max_entropy = 7.5;
+
+    // Largest message a peer may send, a compressed message expanding past
+    // this is rejected
+    size_t max_message_size = UINT32_MAX;
+};
+
+/**
+ * Shannon entropy of a sample of a message
+ *
+ * @param data The message
+ * @param sample_size Bytes to look at, taken from evenly spaced windows
+ * @return Estimated bits per byte, from 0 to 8
+ */
+double estimate_entropy(std::span<const uint8_t> data, size_t sample_size);
+
+/**
+ * Codecs two peers have in common
+ *
+ * @param offered Mask of codec_mask() bits sent by the peer, 0 from peers
+ * that predate codec negotiation
+ * @param supported Mask of codecs this side is willing to use
+ * @return The codecs both may use, deflate always among them
+ */
+uint32_t negotiate_codecs(uint32_t offered, uint32_t supported);
+
+/**
+ * @class WireCompression
+ *
+ * Compresses the messages of one connection before they are encrypted. Each
+ * message is prefixed by the CodecId it was compressed with, so the sender
+ * decides per message: small ones and ones that look compressed already are
+ * sent as they are, large ones use the fast codec if there is one. Deflated
+ * messages share one stream per direction, synced at every message, so each
+ * can be decoded on arrival while later messages still refer back to
+ * earlier ones.
+ *
+ * encode() and decode() keep separate state and may run concurrently, but
+ * each must be called for the messages of its direction in order.
+ */
+class WireCompression {
+  public:
+    /**
+     * @param config Level and thresholds
+     * @param codecs Codecs negotiated with the peer, see negotiate_codecs()
+     */
+    explicit WireCompression(
+        const WireCompressionConfig &config = WireCompressionConfig{},
+        uint32_t codecs = codec_mask(CodecId::DEFLATE));
+
+    /**
+     * Frame an outgoing message
+     *
+     * @param message Serialized request or response
+     * @param tail_room Uninitialized bytes to leave behind the frame, such as
+     * room for an authentication tag
+     * @return The frame to encrypt followed by tail_room bytes and a
+     * CompressionResult, after a failure the connection has to be dropped
+     */
+    std::pair<Buffer, CompressionResult>
+    encode(std::span<const uint8_t> message, size_t tail_room = 0);
+
+    /**
+     * Recover a message framed by the peer's encode()
+     *
+     * @param frame Decrypted frame
+     * @return The serialized message, sharing the frame's memory if it was
+     * not compressed, and a CompressionResult. After a failure the
+     * connection has to be dropped
+     */
+    std::pair<Buffer, CompressionResult> decode(const Buffer &frame);
+
+  private:
+    static constexpr size_t CODEC_COUNT = 3;
+
+    WireCompressionConfig m_config;
+    // Indexed by CodecId, empty for codecs that were not negotiated. Each
+    // direction has its own so encode() and decode() share no state.
+    std::array<std::unique_ptr<Codec>, CODEC_COUNT> m_encoders;
+    std::array<std::unique_ptr<Codec>, CODEC_COUNT> m_decoders;
+};
+
+} // namespace compress
+} // namespace common
+} // namespace fenris
+
+#endif // FENRIS_COMMON_WIRE_COMPRESSION_HPP
@@ -0,0 +1,276 @@
+#ifndef FENRIS_SERVER_ASYNC_FILE_IO_HPP
+#define FENRIS_SERVER_ASYNC_FILE_IO_HPP
+
+#include "common/buffer.hpp"
+#include "common/file_operations.hpp"
+#include "common/logging.hpp"
+#include "common/request.hpp"
+#include "fenris.pb.h"
+#include "server/io_uring.hpp"
+#include "server/thread_pool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fenris {
+namespace server {
+
+/**
+ * Mechanism an AsyncFileIo uses to run file operations
+ */
+enum class AsyncIoBackend {
+    IO_URING, // Submitted to the kernel from a single ring thread
+    BLOCKING  // Blocking file_operations calls on a small thread pool
+};
+
+/**
+ * Convert AsyncIoBackend to string representation
+ *
+ * @param backend The backend to convert
+ * @return String representation of the backend
+ */
+std::string async_io_backend_to_string(AsyncIoBackend backend);
+
+/**
+ * Sizing of an AsyncFileIo
+ */
+struct AsyncIoConfig {
+    // Backend to try first, io_uring falls back to BLOCKING if unavailable
+    AsyncIoBackend backend = AsyncIoBackend::IO_URING;
+
+    // Submission queue depth, also the number of operations in flight
+    unsigned queue_depth = 256;
+
+    // Buffers registered with the ring for read_chunk(), 0 for none
+    size_t registered_buffers = 8;
+    size_t registered_buffer_size = common::DEFAULT_CHUNK_SIZE;
+
+    // Direct descriptor slots registered with the ring, 0 for none
+    unsigned registered_files = 64;
+
+    // Workers of the blocking backend, which also lists directories
+    size_t blocking_threads = 4;
+};
+
+/**
+ * @class AsyncFileIo
+ * @brief Asynchronous file operations with completion callbacks
+ *
+ * Operations are queued by any thread and picked up by a ring thread, which
+ * submits everything queued since its last pass with a single io_uring_enter
+ * no matter how many clients it came from. Each operation steps through
+ * statx, openat, read or write and close, one submission per completion.
+ * Paths are resolved against an open directory when one is given, which the
+ * operation keeps open until it completes. Block reads land directly in
+ * registered buffers when one is free, and descriptors live in registered
+ * slots so the kernel skips the file table.
+ *
+ * Without io_uring, and for directory listings which it cannot do, the
+ * blocking file_operations calls run on a thread pool instead. While the
+ * instance is not started operations run synchronously on the caller.
+ *
+ * Callbacks run on the ring thread or a pool worker and must not block.
+ */
+class AsyncFileIo {
+  public:
+    using ReadCallback =
+        std::function<void(common::Buffer, common::FileOperationResult)>;
+    // Also receives the size of the whole file
+    using ChunkCallback = std::function<void(
+        common::Buffer, uint64_t, common::FileOperationResult)>;
+    using WriteCallback = std::function<void(common::FileOperationResult)>;
+    using InfoCallback =
+        std::function<void(fenris::FileInfo, common::FileOperationResult)>;
+    using ListCallback = std::function<void(std::vector<fenris::FileInfo>,
+                                            common::FileOperationResult)>;
+
+    // Directory relative paths are resolved against, null for the working
+    // directory
+    using Directory = std::shared_ptr<const common::DirectoryHandle>;
+
+    /**
+     * @brief Constructor
+     * @param config Backend and ring sizing
+     * @param logger_name Name for the logger instance
+     */
+    explicit AsyncFileIo(const AsyncIoConfig &config = AsyncIoConfig{},
+                         const std::string &logger_name = "ServerAsyncFileIo");
+
+    /**
+     * @brief Destructor, completes every queued operation
+     */
+    ~AsyncFileIo();
+
+    AsyncFileIo(const AsyncFileIo &) = delete;
+    AsyncFileIo &operator=(const AsyncFileIo &) = delete;
+
+    /**
+     * @brief Set up the configured backend, or the blocking one if that fails
+     */
+    void start();
+
+    /**
+     * @brief Complete every queued operation and stop the backend
+     */
+    void stop();
+
+    /**
+     * @brief Get the backend chosen by start()
+     * @return The backend in use
+     */
+    AsyncIoBackend get_backend() const;
+
+    /**
+     * @brief Read a whole file
+     * @param directory Directory path is relative to
+     * @param path Path to the file
+     * @param callback Receives the content
+     */
+    void read_file(const Directory &directory,
+                   const std::string &path,
+                   ReadCallback callback);
+
+    void read_file(const std::string &path, ReadCallback callback);
+
+    /**
+     * @brief Read one block of a file
+     * @param directory Directory path is relative to
+     * @param path Path to the file
+     * @param offset Byte offset of the first byte to read
+     * @param length Maximum number of bytes to read
+     * @param prefetch Bytes to prefetch once the block was read, with the
+     * same descriptor
+     * @param callback Receives the block, shorter at the end of the file and
+     * empty past it
+     */
+    void read_chunk(const Directory &directory,
+                    const std::string &path,
+                    uint64_t offset,
+                    size_t length,
+                    const common::Prefetch &prefetch,
+                    ChunkCallback callback);
+
+    void read_chunk(const std::string &path,
+                    uint64_t offset,
+                    size_t length,
+                    ReadCallback callback);
+
+    /**
+     * @brief Create or replace a file
+     * @param directory Directory path is relative to
+     * @param path Path to the file
+     * @param data Content to write
+     * @param callback Receives the result
+     */
+    void write_file(const Directory &directory,
+                    const std::string &path,
+                    std::string data,
+                    WriteCallback callback);
+
+    void write_file(const std::string &path,
+                    std::string data,
+                    WriteCallback callback);
+
+    /**
+     * @brief Append to an existing file
+     * @param directory Directory path is relative to
+     * @param path Path to the file
+     * @param data Content to append
+     * @param callback Receives the result
+     */
+    void append_file(const Directory &directory,
+                     const std::string &path,
+                     std::string data,
+                     WriteCallback callback);
+
+    void append_file(const std::string &path,
+                     std::string data,
+                     WriteCallback callback);
+
+    /**
+     * @brief Get size, type, modification time and permissions of a path
+     * @param directory Directory path is relative to
+     * @param path Path to the file or directory
+     * @param callback Receives the information, named after path
+     */
+    void get_file_info(const Directory &directory,
+                       const std::string &path,
+                       InfoCallback callback);
+
+    void get_file_info(const std::string &path, InfoCallback callback);
+
+    /**
+     * @brief List a directory
+     * @param path Path to the directory
+     * @param callback Receives the entries
+     */
+    void list_directory(const std::string &path, ListCallback callback);
+
+  private:
+    struct Operation;
+    class FixedBuffers;
+
+    // Queue an operation for the running backend, or run it right away
+    void submit(std::unique_ptr<Operation> operation);
+
+    // Run an operation with the blocking file_operations calls
+    void run_blocking(Operation &operation);
+
+    // Set up the ring and its registered resources
+    bool start_ring();
+
+    // Ring thread: submit queued operations and dispatch completions
+    void run_ring();
+
+    // Prepare the first submission of a freshly dequeued operation
+    void begin(Operation *operation);
+
+    // Move an operation on after its last submission completed
+    void advance(Operation *operation, int32_t res);
+
+    // Prepare the submission of an operation's current step
+    void prepare(Operation *operation);
+
+    // Report an operation's result and free it
+    void finish(Operation *operation);
+
+    // Keep a read of the wake descriptor queued on the ring
+    void arm_wake();
+
+    // Free submission entry, submitting queued ones to make room if needed
+    io_uring_sqe *next_sqe();
+
+    AsyncIoConfig m_config;
+    AsyncIoBackend m_backend;
+    common::Logger m_logger;
+
+    std::unique_ptr<ThreadPool> m_pool;
+
+    // Declared before the ring, which must unregister the memory first
+    std::shared_ptr<FixedBuffers> m_fixed_buffers;
+    std::unique_ptr<IoUring> m_ring;
+
+    // Direct descriptor slots not in use, touched by the ring thread only
+    std::vector<unsigned> m_free_slots;
+    size_t m_in_flight{0};
+
+    int m_wake_fd{-1};
+    uint64_t m_wake_value{0};
+    std::thread m_thread;
+
+    std::vector<std::unique_ptr<Operation>> m_queue;
+    bool m_running{false};
+    bool m_stopping{false};
+    std::mutex m_queue_mutex;
+};
+
+} // namespace server
+} // namespace fenris
+
+#endif // FENRIS_SERVER_ASYNC_FILE_IO_HPP
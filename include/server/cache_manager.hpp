@@ -3,35 +3,96 @@
 
 #include "common/file_operations.hpp"
 #include "common/logging.hpp"
+#include "common/metrics.hpp"
+#include "server/cache_table.hpp"
+#include "server/eviction_policy.hpp"
+#include "server/file_watcher.hpp"
 
+#include <cstddef>
 #include <cstdint>
-#include <list>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 namespace fenris {
 namespace server {
 
+/**
+ * Limits and layout of a CacheManager
+ */
+struct CacheConfig {
+    // Total bytes of file content held across all shards
+    size_t max_bytes = 64 * 1024 * 1024;
+
+    // Total number of entries across all shards, 0 for no limit
+    size_t max_entries = 0;
+
+    // Number of independently locked shards, rounded up to a power of two
+    size_t shard_count = 16;
+
+    // Policy choosing what to evict, one instance per shard
+    EvictionPolicyType eviction_policy = EvictionPolicyType::LRU;
+
+    // Compare size and modification time with the file on every hit
+    bool validate_on_hit = false;
+
+    // Map files of at least this many bytes instead of reading them, 0 to
+    // always read. Mapped files must not be truncated while they are cached
+    // or being served, see common::map_file().
+    size_t map_threshold = 0;
+};
+
+/**
+ * Counters for comparing eviction policies, summed over all shards
+ */
+struct CacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    // Entries dropped to make room for others
+    uint64_t evictions = 0;
+    // Entries the policy refused to admit
+    uint64_t rejections = 0;
+    // Hits dropped because the file changed, also counted as misses
+    uint64_t stale_hits = 0;
+};
+
 /**
  * @class CacheManager
  * @brief Manages file content caching with LRU invalidation strategy
  *
  * This class provides caching for file contents to reduce disk I/O operations.
- * It implements an LRU (Least Recently Used) cache eviction policy when
- * the maximum cache size is reached.
+ * Entries are spread over shards by filename hash, each with its own lock and
+ * an equal slice of the byte and entry budgets, so readers of different files
+ * rarely contend. Each shard asks its eviction policy for victims once its
+ * slice is exceeded, and files larger than a slice are never cached.
+ *
+ * Changes made by other processes are picked up by watch(), which invalidates
+ * entries as the kernel reports them, and optionally by validating every hit
+ * against the file's current size and modification time. Keys must then be
+ * spelled the way the watcher reports them, i.e. below the watched root.
  */
 class CacheManager {
   public:
     /**
      * @brief Constructor
+     * @param config Byte budget, entry limit and shard count
+     * @param logger_name Name for the logger instance
+     */
+    explicit CacheManager(const CacheConfig &config,
+                          const std::string &logger_name = "CacheManager");
+
+    /**
+     * @brief Constructor for a single shard limited by entry count only
      * @param max_cache_size Maximum number of files to cache
      * @param logger_name Name for the logger instance
      */
     explicit CacheManager(size_t max_cache_size = 100,
                           const std::string &logger_name = "CacheManager");
 
+    ~CacheManager();
+
     /**
      * @brief Read file content, using cache if available
      * @param filename Path to the file
@@ -39,6 +100,42 @@ class CacheManager {
      */
     std::string read_file(const std::string &filename);
 
+    /**
+     * @brief Read file content without copying it out of the cache
+     * @param filename Path to the file
+     * @return Shared file content, nullopt if the file could not be read
+     */
+    std::optional<CachedFile> read_shared(const std::string &filename);
+
+    /**
+     * @brief Slice a byte range out of a cached file without touching disk
+     * @param filename Path to the file
+     * @param offset Byte offset of the first byte to read
+     * @param length Maximum number of bytes to read
+     * @param file_size Set to the size of the file on a hit
+     * @return The range, shorter at the end of the file and empty past it,
+     * nullopt if the file is not cached
+     */
+    std::optional<CachedFile> cached_range(const std::string &filename,
+                                           uint64_t offset,
+                                           size_t length,
+                                           uint64_t *file_size = nullptr);
+
+    /**
+     * @brief Read a byte range of a file, sliced out of the cache on a hit
+     *
+     * A miss reads only the range and leaves the cache untouched, so random
+     * access into a large file does not pull all of it into memory.
+     *
+     * @param filename Path to the file
+     * @param offset Byte offset of the first byte to read
+     * @param length Maximum number of bytes to read
+     * @return The range, shorter at the end of the file and empty past it,
+     * nullopt if the file could not be read
+     */
+    std::optional<CachedFile>
+    read_range(const std::string &filename, uint64_t offset, size_t length);
+
     /**
      * @brief Write content to file and update cache
      * @param filename Path to the file
@@ -53,40 +150,132 @@ class CacheManager {
      */
     void invalidate(const std::string &filename);
 
+    /**
+     * @brief Invalidate a directory and every file below it
+     * @param directory Path of the directory, without a trailing slash
+     */
+    void invalidate_prefix(const std::string &directory);
+
     /**
      * @brief Clear all cached entries
      */
     void clear_cache();
 
+    /**
+     * @brief Invalidate entries whenever files below root change
+     * @param root Directory to watch, replaces any previous one
+     * @return true if the watch was set up, false otherwise
+     */
+    bool watch(const std::string &root);
+
+    /**
+     * @brief Stop the watcher started by watch()
+     */
+    void stop_watching();
+
     /**
      * @brief Get current number of cached files
      * @return Number of files in cache
      */
     size_t get_cache_size() const;
 
+    /**
+     * @brief Get the bytes of file content currently cached
+     * @return Sum of the sizes of all cached files
+     */
+    size_t get_cache_bytes() const;
+
+    /**
+     * @brief Get hit, miss, eviction and rejection counts
+     * @return Counters since construction or the last reset_stats()
+     */
+    CacheStats get_stats() const;
+
+    /**
+     * @brief Zero all counters
+     */
+    void reset_stats();
+
+    /**
+     * @brief Get the number of shards
+     * @return Shard count after rounding
+     */
+    size_t get_shard_count() const;
+
   private:
-    // Key: filename, Value: file content
-    std::unordered_map<std::string, std::string> m_cache;
+    // Exported metrics, shared by every cache with the same logger name
+    struct Metrics {
+        common::Counter &hits;
+        common::Counter &misses;
+        common::Counter &evictions;
+        common::Gauge &resident_bytes;
+    };
+
+    static Metrics make_metrics(const std::string &cache_name);
+
+    struct Shard {
+        // Filenames and contents, linked into the policy's lists
+        CacheTable table;
+
+        // Bound to this shard's table
+        std::unique_ptr<EvictionPolicy> policy;
+
+        size_t bytes = 0;
+
+        // Bumped by every invalidation, a miss only caches what it read if
+        // nothing was invalidated meanwhile
+        uint64_t invalidations = 0;
+
+        CacheStats stats;
 
-    std::unordered_map<std::string, std::list<std::string>::iterator> m_lru_map;
+        mutable std::mutex mutex;
+    };
 
-    // For LRU tracking - list of filenames ordered by most recently used
-    std::list<std::string> m_lru_list;
+    // Pick the shard owning a filename hash
+    Shard &shard_for(uint64_t hash);
 
-    // Maximum number of files to cache
-    size_t m_max_cache_size;
+    // Insert or replace an entry, evicting as needed; caller holds the lock
+    void store(Shard &shard,
+               const std::string &filename,
+               uint64_t hash,
+               CachedFile data,
+               uint64_t modified_time);
+
+    // Whether cached content still matches the file on disk
+    bool is_current(const std::string &filename,
+                    size_t size,
+                    uint64_t modified_time) const;
+
+    // Whether a shard would exceed its budgets after adding to it
+    bool over_budget(const Shard &shard,
+                     size_t extra_bytes,
+                     size_t extra_entries) const;
+
+    // Evict the policy's next victim, false if it has none; caller holds the
+    // lock
+    bool evict(Shard &shard);
+
+    // Drop an entry; caller holds the lock
+    void erase(Shard &shard, uint32_t slot, bool evicted);
+
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    size_t m_shard_mask;
+
+    // Budgets of a single shard, 0 entries for no limit
+    size_t m_shard_max_bytes;
+    size_t m_shard_max_entries;
+
+    bool m_validate_on_hit;
+    size_t m_map_threshold;
 
     // Logger
     common::Logger m_logger;
 
-    // Mutex for thread safety
-    mutable std::mutex m_mutex;
-
-    // Helper method to update LRU information when a file is accessed
-    void update_lru(const std::string &filename);
+    Metrics m_metrics;
 
-    // Helper method to remove least recently used entry when cache is full
-    void remove_lru_entry();
+    // Declared last so its thread stops before the shards go away
+    std::unique_ptr<FileWatcher> m_watcher;
+    std::mutex m_watcher_mutex;
 };
 
 } // namespace server
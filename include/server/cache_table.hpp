@@ -0,0 +1,216 @@
+#ifndef FENRIS_SERVER_CACHE_TABLE_HPP
+#define FENRIS_SERVER_CACHE_TABLE_HPP
+
+#include "common/buffer.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fenris {
+namespace server {
+
+/**
+ * Cached file contents, shared between the cache and every reader. The bytes
+ * are never modified once cached; a write replaces the whole entry. They are
+ * either a heap slab or a read-only file mapping.
+ */
+using CachedFile = common::Buffer;
+
+// Marks the absence of a slot, both in lookups and in list links
+constexpr uint32_t NO_SLOT = std::numeric_limits<uint32_t>::max();
+
+/**
+ * A cached file together with the links of the eviction list it is on
+ */
+struct CacheEntry {
+    std::string key;
+    CachedFile data;
+    uint64_t hash = 0;
+
+    // FileInfo::modified_time of the file when data was read, 0 if unknown
+    uint64_t modified_time = 0;
+
+    // Neighbours in the owning SlotList, towards the front and the back
+    uint32_t prev = NO_SLOT;
+    uint32_t next = NO_SLOT;
+
+    // Id of the SlotList holding the entry, 0 when unlinked
+    uint8_t list = 0;
+
+    // false while the slot is on the free list
+    bool occupied = false;
+};
+
+/**
+ * @class CacheTable
+ * @brief Open-addressing hash table of cache entries
+ *
+ * Entries live in a slab and keep their slot number for as long as they are
+ * resident, so eviction policies can link them together by slot instead of
+ * keeping their own copies of the key. The probe array only holds the slot
+ * and 32 bits of the hash, a lookup compares keys only on a hash match.
+ * Linear probing with backward-shift deletion keeps probe runs short without
+ * tombstones. Growing the table never allocates per entry.
+ *
+ * Not synchronized, each cache shard guards its table with its own lock.
+ */
+class CacheTable {
+  public:
+    /**
+     * @brief Constructor
+     * @param capacity Number of entries to reserve room for
+     */
+    explicit CacheTable(size_t capacity = 0);
+
+    /**
+     * @brief Hash used for lookups, shard selection and admission
+     * @param key The key
+     * @return 64-bit hash of the key
+     */
+    static uint64_t hash_key(std::string_view key);
+
+    /**
+     * @brief Look up a key
+     * @param key The key
+     * @param hash hash_key(key)
+     * @return Slot of the entry, NO_SLOT if absent
+     */
+    uint32_t find(std::string_view key, uint64_t hash) const;
+
+    /**
+     * @brief Add an entry for a key that is not present
+     * @param key The key, stored once in the entry
+     * @param hash hash_key(key)
+     * @param data Content to cache
+     * @return Slot of the new entry
+     */
+    uint32_t insert(std::string key, uint64_t hash, CachedFile data);
+
+    /**
+     * @brief Remove an entry, its slot may be reused by a later insert
+     * @param slot Slot returned by find() or insert()
+     */
+    void erase(uint32_t slot);
+
+    /**
+     * @brief Remove every entry
+     */
+    void clear();
+
+    CacheEntry &entry(uint32_t slot)
+    {
+        return m_entries[slot];
+    }
+
+    const CacheEntry &entry(uint32_t slot) const
+    {
+        return m_entries[slot];
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    /**
+     * @brief Call visit(slot, entry) for every entry
+     * @param visit Callable, must not insert or erase
+     */
+    template <typename Visitor>
+    void for_each(Visitor &&visit) const
+    {
+        for (size_t slot = 0; slot < m_entries.size(); ++slot) {
+            if (m_entries[slot].occupied) {
+                visit(static_cast<uint32_t>(slot), m_entries[slot]);
+            }
+        }
+    }
+
+  private:
+    struct Bucket {
+        uint32_t slot = NO_SLOT;
+        // Low 32 bits of the hash, also locates the bucket's home position
+        uint32_t tag = 0;
+    };
+
+    // Position of the bucket holding a slot
+    size_t bucket_of(uint32_t slot) const;
+
+    // Double the probe array and reinsert every bucket
+    void grow();
+
+    std::vector<CacheEntry> m_entries;
+    std::vector<uint32_t> m_free_slots;
+    std::vector<Bucket> m_buckets;
+    size_t m_mask;
+    size_t m_size{0};
+};
+
+/**
+ * @class SlotList
+ * @brief Doubly linked list threaded through CacheTable entries
+ *
+ * Linking, unlinking and moving an entry only rewrite slot numbers in the
+ * entries themselves, so none of them allocate. An entry is on at most one
+ * list at a time, identified by the list's id.
+ */
+class SlotList {
+  public:
+    /**
+     * @brief Constructor
+     * @param table Table owning the linked entries
+     * @param id Non-zero id stored in linked entries
+     */
+    SlotList(CacheTable &table, uint8_t id);
+
+    void push_front(uint32_t slot);
+    void unlink(uint32_t slot);
+    void move_to_front(uint32_t slot);
+
+    /**
+     * @brief Forget every entry without touching them
+     */
+    void reset();
+
+    bool contains(uint32_t slot) const
+    {
+        return m_table.entry(slot).list == m_id;
+    }
+
+    uint32_t front() const
+    {
+        return m_head;
+    }
+
+    uint32_t back() const
+    {
+        return m_tail;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    bool empty() const
+    {
+        return m_size == 0;
+    }
+
+  private:
+    CacheTable &m_table;
+    uint8_t m_id;
+    uint32_t m_head{NO_SLOT};
+    uint32_t m_tail{NO_SLOT};
+    size_t m_size{0};
+};
+
+} // namespace server
+} // namespace fenris
+
+#endif // FENRIS_SERVER_CACHE_TABLE_HPP
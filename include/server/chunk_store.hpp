@@ -0,0 +1,285 @@
+#ifndef FENRIS_SERVER_CHUNK_STORE_HPP
+#define FENRIS_SERVER_CHUNK_STORE_HPP
+
+#include "common/buffer.hpp"
+#include "common/file_operations.hpp"
+#include "common/logging.hpp"
+#include "fenris.pb.h"
+#include "server/cache_manager.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace fenris {
+namespace server {
+
+/**
+ * Chunking and caching of a ChunkStore
+ */
+struct ChunkStoreConfig {
+    // Bounds of a content-defined chunk. Cuts fall around the average, which
+    // is rounded down to a power of two.
+    size_t min_chunk_size = 16 * 1024;
+    size_t avg_chunk_size = 64 * 1024;
+    size_t max_chunk_size = 256 * 1024;
+
+    // Smaller files are not worth a manifest and stay plain files
+    size_t min_file_size = 64 * 1024;
+
+    // Flush chunks and manifests to disk before they are referenced
+    bool sync = false;
+
+    // Memory for chunk content, keyed by chunk so each is held once no
+    // matter how many files contain it
+    CacheConfig cache;
+};
+
+/**
+ * Counters for judging how much content is shared
+ */
+struct ChunkStoreStats {
+    // Files kept as manifests
+    uint64_t files = 0;
+    // Distinct chunks on disk and their bytes
+    uint64_t chunks = 0;
+    uint64_t stored_bytes = 0;
+    // Bytes the files would take as plain copies
+    uint64_t logical_bytes = 0;
+};
+
+/**
+ * Cut data into content-defined chunks
+ *
+ * Boundaries come from a gear hash over the bytes themselves, so an insert or
+ * delete only moves the cuts next to it and the chunks further on are found
+ * again unchanged. Cuts are normalized towards the average size as in
+ * FastCDC: a stricter mask is used before it and a looser one after.
+ *
+ * @param data Bytes to cut
+ * @param config Minimum, average and maximum chunk size
+ * @return Length of every chunk in order, summing up to data.size()
+ */
+std::vector<size_t> chunk_lengths(std::span<const uint8_t> data,
+                                  const ChunkStoreConfig &config);
+
+/**
+ * @class ChunkStore
+ * @brief Content-addressed store of file chunks shared between paths
+ *
+ * Files are cut into content-defined chunks, each stored once under the
+ * SHA-256 of its bytes, and described by a manifest listing the chunks of
+ * the file in order. Identical files, or files sharing long runs of bytes,
+ * take their common chunks' disk space only once, and chunks are cached by
+ * hash so a hot chunk sits in memory once for every path it appears in.
+ *
+ * Layout below the store directory:
+ * - chunks/ab/abcdef...: a chunk, named by the hex digits of its hash
+ * - manifests/0123...: a ChunkManifest, named by the hash of its path
+ *
+ * The store does not know the served tree. Every manifest records the
+ * modification time of a placeholder the caller keeps in the tree for the
+ * file, and find() only accepts a manifest while the placeholder matches,
+ * so a file changed by another process reads as what it now holds. The
+ * manifest of such a file keeps its chunks until the path is put or removed
+ * again.
+ *
+ * Chunk reference counts are kept in memory and rebuilt from the manifests
+ * on construction, which also deletes chunks no manifest refers to, e.g.
+ * those left behind by a crash.
+ */
+class ChunkStore {
+  public:
+    /**
+     * @brief Open or create a store
+     * @param directory Directory holding chunks and manifests, which should
+     * lie outside any tree served to clients
+     * @param config Chunk sizes and cache budget
+     * @param logger_name Name for the logger instance
+     */
+    explicit ChunkStore(const std::string &directory,
+                        const ChunkStoreConfig &config = ChunkStoreConfig{},
+                        const std::string &logger_name = "ServerChunkStore");
+
+    ChunkStore(const ChunkStore &) = delete;
+    ChunkStore &operator=(const ChunkStore &) = delete;
+
+    /**
+     * @brief Whether the store directory could be set up
+     */
+    bool is_open() const;
+
+    /**
+     * @brief Store a file's content under a path
+     *
+     * Chunks already in the store are only referenced again. Replaces any
+     * earlier manifest of the path, whose chunks are released.
+     *
+     * @param path Path of the file below the served root
+     * @param content Content of the file
+     * @param modified_time FileInfo::modified_time of the file's placeholder
+     * @return FileOperationResult indicating success or failure
+     */
+    common::FileOperationResult put(const std::string &path,
+                                    std::span<const uint8_t> content,
+                                    uint64_t modified_time);
+
+    /**
+     * @brief Store a file under a path with the chunks of another
+     *
+     * Only references the chunks again, nothing is written but the manifest.
+     * Replaces any earlier manifest of the path.
+     *
+     * @param manifest Manifest of the file holding the content
+     * @param path Path of the new file below the served root
+     * @param modified_time FileInfo::modified_time of the new file's
+     * placeholder
+     * @return FileOperationResult indicating success or failure,
+     * FILE_NOT_FOUND if the chunks were released in the meantime
+     */
+    common::FileOperationResult link(const fenris::ChunkManifest &manifest,
+                                     const std::string &path,
+                                     uint64_t modified_time);
+
+    /**
+     * @brief Look up the manifest of a file
+     * @param path Path of the file below the served root
+     * @param size Size of the file's placeholder
+     * @param modified_time FileInfo::modified_time of the placeholder
+     * @return The manifest, nullopt if the path has none or the placeholder
+     * changed since it was put
+     */
+    std::optional<fenris::ChunkManifest> find(const std::string &path,
+                                              uint64_t size,
+                                              uint64_t modified_time) const;
+
+    /**
+     * @brief Manifests of every file below a directory
+     * @param directory Path of the directory, without a trailing slash
+     * @return Copies of the manifests, whether or not their placeholders
+     * still match
+     */
+    std::vector<fenris::ChunkManifest>
+    find_prefix(const std::string &directory) const;
+
+    /**
+     * @brief Read the whole content of a file
+     *
+     * A file of a single chunk is served straight from the cache, larger
+     * ones are assembled into a new buffer.
+     *
+     * @param manifest Result of find()
+     * @return Pair of (content, FileOperationResult)
+     */
+    std::pair<common::Buffer, common::FileOperationResult>
+    read(const fenris::ChunkManifest &manifest);
+
+    /**
+     * @brief Read a byte range of a file, touching only the chunks it spans
+     * @param manifest Result of find()
+     * @param offset Byte offset of the first byte to read
+     * @param length Maximum number of bytes to read
+     * @return Pair of (range content, FileOperationResult), shorter at the
+     * end of the file and empty past it
+     */
+    std::pair<common::Buffer, common::FileOperationResult>
+    read_range(const fenris::ChunkManifest &manifest,
+               uint64_t offset,
+               size_t length);
+
+    /**
+     * @brief Drop the manifest of a file, releasing its chunks
+     * @param path Path of the file below the served root
+     * @return true if the path had a manifest
+     */
+    bool remove(const std::string &path);
+
+    /**
+     * @brief Drop the manifests of every file below a directory
+     * @param directory Path of the directory, without a trailing slash
+     */
+    void remove_prefix(const std::string &directory);
+
+    /**
+     * @brief Get file, chunk and byte counts
+     */
+    ChunkStoreStats get_stats() const;
+
+    /**
+     * @brief Get hit and miss counts of the chunk cache
+     */
+    CacheStats get_cache_stats() const;
+
+    const ChunkStoreConfig &config() const
+    {
+        return m_config;
+    }
+
+  private:
+    struct ChunkEntry {
+        uint32_t references = 0;
+        uint32_t length = 0;
+    };
+
+    // Path of a chunk file from its raw hash
+    std::string chunk_path(const std::string &hash) const;
+
+    // Path of the manifest file of a served path
+    std::string manifest_path(const std::string &path) const;
+
+    // Write a file through a temporary sibling, so readers never see it half
+    // written
+    common::FileOperationResult write_atomically(const std::string &path,
+                                                 std::span<const uint8_t> data);
+
+    // Write a chunk unless its file is already there
+    common::FileOperationResult write_chunk(const std::string &hash,
+                                            std::span<const uint8_t> data);
+
+    // Take a reference on each chunk of a manifest; caller holds the lock
+    void reference(const fenris::ChunkManifest &manifest);
+
+    // Drop a reference on each chunk, deleting those left unreferenced;
+    // caller holds the lock
+    void release(const fenris::ChunkManifest &manifest);
+
+    // Take the place of the path's earlier manifest, releasing its chunks;
+    // caller holds the lock and referenced the new manifest's chunks
+    void install(fenris::ChunkManifest manifest);
+
+    // Drop a manifest and its file; caller holds the lock
+    void erase_manifest(
+        std::map<std::string, fenris::ChunkManifest>::iterator it);
+
+    // Load manifests and count references, delete unreferenced chunks
+    void load();
+
+    std::string m_directory;
+    ChunkStoreConfig m_config;
+    bool m_open{false};
+
+    // Manifests by served path, ordered so a directory's files are adjacent
+    std::map<std::string, fenris::ChunkManifest> m_manifests;
+    std::unordered_map<std::string, ChunkEntry> m_chunks;
+    uint64_t m_stored_bytes{0};
+    uint64_t m_logical_bytes{0};
+    mutable std::mutex m_mutex;
+
+    // Chunk content by chunk path, which is unique per hash
+    std::unique_ptr<CacheManager> m_cache;
+
+    common::Logger m_logger;
+};
+
+} // namespace server
+} // namespace fenris
+
+#endif // FENRIS_SERVER_CHUNK_STORE_HPP
@@ -1,16 +1,32 @@
 #ifndef FENRIS_SERVER_CONNECTION_MANAGER_HPP
 #define FENRIS_SERVER_CONNECTION_MANAGER_HPP
 
+#include "common/buffer.hpp"
+#include "common/chunked_aead.hpp"
 #include "common/crypto_manager.hpp"
+#include "common/crypto_session.hpp"
+#include "common/keypair_pool.hpp"
 #include "common/logging.hpp"
+#include "common/nonce_sequence.hpp"
+#include "common/tracing.hpp"
+#include "common/wire_compression.hpp"
 #include "fenris.pb.h"
+#include "server/memory_budget.hpp"
+#include "server/rate_limiter.hpp"
+#include "server/session_tickets.hpp"
+#include "server/thread_pool.hpp"
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
+#include <netdb.h>
 #include <optional>
+#include <span>
 #include <string>
 #include <thread>
 #include <unordered_map>
@@ -26,9 +42,76 @@ struct ClientInfo {
     std::string port;
     std::string current_directory;
     std::vector<uint8_t> encryption_key;
+    // AES-GCM keyed with encryption_key once per connection, set by the key
+    // exchange
+    std::shared_ptr<common::crypto::CryptoSession> session;
+    // Capabilities accepted during the key exchange, see fenris::Capability
+    uint32_t capabilities{0};
+    // Set when CAPABILITY_COMPRESSION was negotiated
+    std::shared_ptr<common::compress::WireCompression> compression;
+    // Set when CAPABILITY_SEQUENCED_NONCES was negotiated: the nonces this
+    // side seals with and the ones it expects from the other side
+    std::shared_ptr<common::crypto::NonceSequence> send_nonces;
+    std::shared_ptr<common::crypto::NonceSequence> receive_nonces;
+    // Set when rate limits are configured, charged with every request and
+    // the bytes it moved
+    std::shared_ptr<ClientQuota> quota;
 };
 
+/**
+ * Encrypted message split into the parts that follow the length prefix on the
+ * wire, so they can be sent without concatenating them first
+ */
+struct EncryptedMessage {
+    std::vector<uint8_t> iv;
+    common::Buffer ciphertext;
+};
+
+/**
+ * Pipelined requests of one connection that may run at the same time. Past
+ * this the connection stops reading until the oldest one is answered, so a
+ * single client cannot take over the worker pool.
+ */
+constexpr size_t MAX_PIPELINED_REQUESTS = 16;
+
+/**
+ * Sub-requests one BATCH may carry. Keeps a single request from holding the
+ * connection, and the compound response, unbounded.
+ */
+constexpr size_t MAX_BATCH_REQUESTS = 4096;
+
+/**
+ * How long a client may serve READ_FILE content from its cache before it
+ * has to revalidate, and so how stale a read of a file another client
+ * changed can be
+ */
+constexpr std::chrono::milliseconds DEFAULT_READ_LEASE{2000};
+
+/**
+ * Connections the kernel queues for accept() before it starts dropping SYNs
+ */
+constexpr int DEFAULT_LISTEN_BACKLOG = 1024;
+
+/**
+ * Largest request a client may send. Bulk transfers go through READ_CHUNK /
+ * WRITE_CHUNK, whose blocks stay below common::MAX_CHUNK_SIZE.
+ */
+constexpr size_t DEFAULT_MAX_MESSAGE_SIZE = 64 * 1024 * 1024;
+
+/**
+ * Largest key exchange or resumption frame, which only carries a public key,
+ * a Handshake and a session ticket
+ */
+constexpr size_t MAX_HANDSHAKE_FRAME_SIZE = 64 * 1024;
+
+/**
+ * Bytes of work a request is charged in fair queueing on top of its own
+ * size, so many small requests weigh as much as the syscalls they cost
+ */
+constexpr uint64_t FAIR_REQUEST_COST = 4096;
+
 class ClientHandler;
+class Reactor;
 
 /**
  * @class ConnectionManager
@@ -61,16 +144,254 @@ class ConnectionManager {
      */
     void set_non_blocking_mode(bool enabled);
 
+    /**
+     * @brief Multiplex clients on an epoll reactor instead of one thread each
+     * @param enabled Whether to use the reactor (must be set before start())
+     */
+    void set_reactor_mode(bool enabled);
+
+    /**
+     * @brief Offer CAPABILITY_SESSION_TICKET to clients that ask for it
+     * @param enabled Whether to issue and redeem tickets (must be set before
+     * start())
+     * @param lifetime How long a ticket can be redeemed after it was issued
+     *
+     * Clients holding a ticket reconnect with a resumption frame, and both
+     * sides derive the new key from the ticket's secret and fresh nonces
+     * instead of generating a key pair and running ECDH. Tickets outlive
+     * neither the server nor their lifetime; when one is refused the client
+     * falls back to a full key exchange on the same connection.
+     */
+    void set_session_tickets(
+        bool enabled, std::chrono::seconds lifetime = DEFAULT_TICKET_LIFETIME);
+
+    /**
+     * @brief Set the number of reactor I/O threads
+     * @param count Number of epoll loops, 0 selects the number of cores
+     */
+    void set_io_threads(size_t count);
+
+    /**
+     * @brief Set the number of threads running the client handler
+     * @param count Number of worker threads, 0 selects the number of cores
+     *
+     * Requests from every connection are dispatched to one shared pool of
+     * this size, which caps CPU concurrency independently of the number of
+     * connected clients.
+     */
+    void set_worker_threads(size_t count);
+
+    /**
+     * @brief Set how many connections may wait to be accepted
+     * @param backlog Length of the accept queue (must be set before start()),
+     * capped by the kernel at net.core.somaxconn
+     */
+    void set_listen_backlog(int backlog);
+
+    /**
+     * @brief Bind the listening socket with SO_REUSEPORT
+     * @param enabled Whether to share the port (must be set before start())
+     *
+     * Several server processes started on the same address and port then
+     * each get their own accept queue, and the kernel spreads incoming
+     * connections across them.
+     */
+    void set_reuse_port(bool enabled);
+
+    /**
+     * @brief Pin worker and reactor I/O threads to cores
+     * @param enabled Whether to pin threads (must be set before start())
+     *
+     * Workers take the cores in order, reactor loops likewise, so a thread
+     * keeps its caches warm instead of being moved around by the scheduler.
+     * Best with at most as many threads of each kind as there are cores.
+     */
+    void set_cpu_affinity(bool enabled);
+
+    /**
+     * @brief Set the number of listening sockets and accept threads
+     * @param count Number of acceptors (must be set before start()), 0 for
+     * one per core
+     *
+     * With more than one, every acceptor binds its own socket with
+     * SO_REUSEPORT and the kernel spreads incoming connections across their
+     * accept queues, so a burst of connects is neither serialized behind one
+     * accept() loop nor dropped by one full queue. Acceptor i hands its
+     * connections to reactor loop i, or with CPU affinity pins their client
+     * threads to core i, so a session is served by the core that accepted
+     * it. Best with as many acceptors as I/O threads.
+     */
+    void set_acceptors(size_t count);
+
+    /**
+     * @brief Set the largest request a client may send
+     * @param bytes Limit on the length prefix of a request frame (must be set
+     * before start()), also bounds what a compressed request may expand to
+     *
+     * A client announcing more is disconnected before anything is allocated
+     * for the frame. Buffers of accepted frames grow as their bytes arrive.
+     */
+    void set_max_message_size(size_t bytes);
+
+    /**
+     * @brief Cap the bytes of requests held in memory across all clients
+     * @param bytes Budget (must be set before start()), 0 for no limit
+     *
+     * Every request leases its frame size from a MemoryBudget before its
+     * body is read, and returns it once it was answered. While the budget is
+     * used up, connections stop reading: client threads wait for a lease,
+     * reactor loops leave the socket unarmed and retry. Senders are then
+     * held back by TCP flow control instead of the server running out of
+     * memory.
+     */
+    void set_memory_budget(size_t bytes);
+
+    /**
+     * @brief Get how often the memory budget paused readers
+     */
+    MemoryBudgetStats get_memory_budget_stats() const;
+
+    /**
+     * @brief Limit the requests and bytes of each client and tenant
+     * @param per_client Limits of every connection (must be set before
+     * start())
+     * @param per_tenant Limits shared by all connections from one address
+     *
+     * Every request is charged an op plus the bytes received and sent for
+     * it. A request that overdraws a limit is still answered, but its
+     * connection is not read again until the limit refilled: client threads
+     * sleep, reactor loops leave the socket unarmed. Requests of all clients
+     * are also fairly queued for the workers by their size, whether limits
+     * are set or not.
+     */
+    void set_rate_limits(const RateLimit &per_client,
+                         const RateLimit &per_tenant);
+
+    /**
+     * @brief Get how long the rate limits held back each connected client
+     */
+    std::unordered_map<uint32_t, ThrottleStats> get_throttle_stats();
+
+    /**
+     * @brief Get how long the rate limits held back the connections of each
+     * tenant that is still connected, by address
+     */
+    std::unordered_map<std::string, ThrottleStats> get_tenant_throttle_stats();
+
+    /**
+     * @brief Set the number of ECDH key pairs generated ahead of handshakes
+     * @param count Pairs to keep ready (must be set before start()), 0
+     * generates each pair during its handshake
+     *
+     * A background thread refills the pool from otherwise idle cores, so a
+     * burst of reconnects only pays for the shared secret of each key
+     * exchange until the pool runs dry.
+     */
+    void set_keypair_pool_size(size_t count);
+
+    /**
+     * @brief Offer CAPABILITY_PIPELINING to clients that ask for it
+     * @param enabled Whether to accept the capability (must be set before
+     * start())
+     *
+     * Read-only requests (PING, INFO_FILE, LIST_DIR, READ_CHUNK, READ_RANGE
+     * and unstreamed READ_FILE) of such clients go to the worker pool as soon
+     * as they arrive, up to MAX_PIPELINED_REQUESTS per connection, and each
+     * worker sends its response when done. Any other request waits for those
+     * to be answered first, and is answered before the next one is read. The
+     * reactor handles one request per connection at a time and never accepts
+     * the capability.
+     */
+    void set_pipelining(bool enabled);
+
+    /**
+     * @brief Offer CAPABILITY_READ_LEASES to clients that ask for it
+     * @param enabled Whether to accept the capability (must be set before
+     * start())
+     * @param duration Lease granted with every successful READ_FILE
+     *
+     * Such clients cache what they read and answer repeated reads from the
+     * cache while the lease lasts, then revalidate with a conditional
+     * READ_FILE that costs a stat() when the file is unchanged. They drop
+     * entries for files they change themselves, changes by others become
+     * visible once the lease ran out.
+     */
+    void set_read_leases(
+        bool enabled, std::chrono::milliseconds duration = DEFAULT_READ_LEASE);
+
+    /**
+     * @brief Offer CAPABILITY_PLAINTEXT_FILE_STREAM to clients that ask for it
+     * @param enabled Whether to accept the capability (must be set before
+     * start())
+     *
+     * READ_FILE content for such clients is sent with sendfile() straight
+     * from the page cache, in the clear. Only the response header stays
+     * encrypted, so enable this on trusted networks only. The reactor does
+     * not implement the stream path and never accepts the capability.
+     */
+    void set_plaintext_file_streaming(bool enabled);
+
+    /**
+     * @brief Offer CAPABILITY_SEALED_FILE_STREAM to clients that ask for it
+     * @param enabled Whether to accept the capability (must be set before
+     * start())
+     * @param chunk_size Plaintext bytes per sealed chunk, files of one chunk
+     * or less are answered with a plain response
+     *
+     * READ_FILE content for such clients follows the response as chunks
+     * that the worker pool seals in parallel, each sent as soon as it and
+     * its predecessors are done. A client that negotiated both streaming
+     * capabilities gets the plaintext stream. The reactor does not
+     * implement the stream path and never accepts the capability.
+     */
+    void set_sealed_file_streaming(
+        bool enabled,
+        size_t chunk_size = common::crypto::DEFAULT_AEAD_CHUNK_SIZE);
+
+    /**
+     * @brief Offer CAPABILITY_COMPRESSION to clients that ask for it
+     * @param enabled Whether to accept the capability (must be set before
+     * start())
+     * @param config Level and thresholds deciding which messages are
+     * compressed
+     */
+    void set_compression(bool enabled,
+                         const common::compress::WireCompressionConfig &config =
+                             common::compress::WireCompressionConfig{});
+
     /**
      * @brief Start listening for connections
      */
     void start();
 
+    /**
+     * @brief Whether start() succeeded and stop() was not called yet
+     */
+    bool is_running() const;
+
     /**
      * @brief Stop listening for connections and clean up resources
+     *
+     * Requests being handled are finished, but their responses may not
+     * reach clients whose sockets were shut down in the meantime. drain()
+     * first waits for them.
      */
     void stop();
 
+    /**
+     * @brief Stop accepting, let every connection finish its request, then
+     * stop()
+     * @param deadline Longest wait for the connections to finish
+     * @return true if every connection closed before the deadline
+     *
+     * Each connection is shut down for reading, so a client waiting between
+     * requests is disconnected at once. Requests that were already received
+     * are answered before their connection closes. Clients reconnect to
+     * another instance, which lets a rolling restart proceed as soon as the
+     * slowest request was answered.
+     */
+    bool drain(std::chrono::milliseconds deadline);
+
     /**
      * @brief Set handler for client connections
      * @param handler Function that processes client requests
@@ -88,18 +409,23 @@ class ConnectionManager {
      * @param client_info ClientInfo struct containing client connection
      * information
      * @param response The response to send
+     * @param payload Bytes serialized as the response's data field, which
+     * must then be empty
      * @return true if send successful, false otherwise
      *
      * This method encrypts the response using the client's key
-     * and a randomly generated IV, prefixing the IV to the message
+     * and the next IV of the connection, prefixing the IV to the message
      */
     bool send_response(const ClientInfo &client_info,
-                       const fenris::Response &response);
+                       const fenris::Response &response,
+                       std::span<const uint8_t> payload = {});
 
     /**
      * @brief Receive a request from a client
      * @param client_info ClientInfo struct containing client connection
      * information
+     * @param lease Receives the request's share of the memory budget, to be
+     * held until it was answered
      * @return Optional containing the request if successfully received and
      * decrypted
      *
@@ -107,20 +433,69 @@ class ConnectionManager {
      * and uses it to decrypt the request data
      */
     std::optional<fenris::Request>
-    receive_request(const ClientInfo &client_info);
+    receive_request(const ClientInfo &client_info,
+                    MemoryBudget::Lease &lease);
 
   private:
+    friend class Reactor;
+
+    /**
+     * A handler's answer to one request. File content the handler shares
+     * stays out of the response until it is serialized behind it.
+     */
+    struct Reply {
+        fenris::Response response;
+        bool keep_connection = true;
+        common::Buffer payload;
+    };
+
     /**
      * @brief Listen for incoming connections
      */
-    void listen_for_connection();
+    void listen_for_connection(size_t index);
+
+    /**
+     * @brief Create, bind and listen on one socket
+     * @param address Address to bind to
+     * @param reuse_port Set SO_REUSEPORT even if set_reuse_port() did not
+     * @return The listening socket, -1 on failure
+     */
+    int open_listener(const struct addrinfo *address, bool reuse_port);
+
+    /**
+     * @brief Close every listening socket
+     */
+    void close_listeners();
+
+    /**
+     * @brief Wake the accept threads, join them and close their sockets
+     */
+    void stop_accepting();
 
     /**
      * @brief Handle client connection in its own thread
      * @param client_socket Socket descriptor for the client connection
      * @param client_id Unique identifier for the client
      */
-    void handle_client(uint32_t client_socket, uint32_t client_id);
+    void handle_client(uint32_t client_socket,
+                       uint32_t client_id,
+                       std::string address);
+
+    /**
+     * @brief Join the threads of clients that returned; caller holds
+     * m_client_mutex
+     */
+    void reap_client_threads();
+
+    /**
+     * @brief Give a connection its quota if rate limits are configured
+     */
+    void open_quota(ClientInfo &client_info);
+
+    /**
+     * @brief Sleep until a client's quota allows reading its next request
+     */
+    void wait_for_quota(const ClientInfo &client_info);
 
     /**
      * @brief Generate a unique client ID
@@ -129,7 +504,8 @@ class ConnectionManager {
     uint32_t generate_client_id();
 
     /**
-     * @brief Remove a client from the active clients list
+     * @brief Remove a client from the active clients list and tell the
+     * client handler it disconnected
      * @param client_id ID of the client to remove
      */
     void remove_client(uint32_t client_id);
@@ -142,12 +518,290 @@ class ConnectionManager {
      */
     bool perform_key_exchange(ClientInfo &client_info);
 
+    /**
+     * @brief Derive the session key from the client's public key
+     * @param client_info ClientInfo struct receiving the encryption key and
+     * the negotiated capabilities
+     * @param client_frame Public key received from the client, optionally
+     * followed by a Handshake, or a resumption frame
+     * @return Frame to send back (our public key, plus the accepted
+     * capabilities if the client asked for any), or std::nullopt on failure.
+     * A refused resumption is answered without keying client_info, which
+     * then expects another key exchange frame.
+     */
+    std::optional<std::vector<uint8_t>>
+    complete_key_exchange(ClientInfo &client_info,
+                          std::span<const uint8_t> client_frame);
+
+    /**
+     * @brief Accept the capabilities a client asked for
+     * @param client_info ClientInfo struct receiving the capabilities
+     * @param offer Handshake sent by the client
+     * @return The Handshake to answer with
+     */
+    fenris::Handshake negotiate_capabilities(ClientInfo &client_info,
+                                             const fenris::Handshake &offer);
+
+    /**
+     * @brief Key a connection from a session ticket instead of ECDH
+     * @param client_info ClientInfo struct receiving the encryption key
+     * @param offer Resumption handshake with the ticket and client nonce
+     * @return Resumption frame to send back, refusing the ticket if it did not
+     * redeem, or std::nullopt on failure
+     */
+    std::optional<std::vector<uint8_t>>
+    resume_session(ClientInfo &client_info, const fenris::Handshake &offer);
+
+    /**
+     * @brief Attach a fresh ticket for a session key to a handshake reply
+     * @param client_info ClientInfo struct of a client that negotiated
+     * CAPABILITY_SESSION_TICKET, nothing is attached for others
+     * @param session_key Key the ticket resumes
+     * @param reply Handshake to attach the ticket to
+     */
+    void attach_ticket(const ClientInfo &client_info,
+                       const std::vector<uint8_t> &session_key,
+                       fenris::Handshake &reply) const;
+
+    /**
+     * @brief Run ECDH against a peer's public key
+     * @param peer_public_key The peer's NIST P-256 public key
+     * @return Our public key and the derived session key, std::nullopt on
+     * failure
+     */
+    std::optional<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
+    agree_on_key(const std::vector<uint8_t> &peer_public_key);
+
+    /**
+     * @brief Switch a connection to a new session key
+     * @param client_info ClientInfo struct receiving the key, with the
+     * capabilities already negotiated
+     * @param key The derived session key
+     * @param epoch Number of rekeys before this key
+     * @return true if the session could be keyed
+     *
+     * Restarts both nonce sequences at the given epoch when
+     * CAPABILITY_SEQUENCED_NONCES was negotiated.
+     */
+    bool install_key(ClientInfo &client_info,
+                     std::vector<uint8_t> key,
+                     uint32_t epoch);
+
+    /**
+     * @brief Answer a REKEY request and switch to the new key
+     * @param client_info ClientInfo struct of a client with
+     * CAPABILITY_SEQUENCED_NONCES
+     * @param request The decoded REKEY request
+     * @return The REKEYED response, sealed with the old key, or std::nullopt
+     * if the connection has to be closed
+     */
+    std::optional<EncryptedMessage> rekey(ClientInfo &client_info,
+                                          const fenris::Request &request);
+
+    /**
+     * @brief Whether a request is a REKEY this server has to answer itself
+     * @param client_info ClientInfo struct of the sender
+     * @param request The decoded request
+     * @return true if rekey() handles the request
+     */
+    static bool is_rekey(const ClientInfo &client_info,
+                         const fenris::Request &request);
+
+    /**
+     * @brief Send an encrypted message with its length prefix
+     * @param client_info ClientInfo struct of the receiver
+     * @param message The IV and ciphertext to send
+     * @return true if send successful, false otherwise
+     */
+    bool send_message(const ClientInfo &client_info,
+                      const EncryptedMessage &message);
+
+    /**
+     * @brief Capabilities this server accepts from clients
+     * @return Bit mask of fenris::Capability values
+     */
+    uint32_t supported_capabilities() const;
+
+    /**
+     * @brief Answer a READ_FILE by sending the file after the response
+     * @param client_info ClientInfo struct of a client with
+     * CAPABILITY_PLAINTEXT_FILE_STREAM or CAPABILITY_SEALED_FILE_STREAM
+     * @param request The decoded request
+     * @return std::nullopt if the request has to go through the client
+     * handler instead, otherwise whether sending succeeded
+     */
+    std::optional<bool> stream_file(const ClientInfo &client_info,
+                                    const fenris::Request &request);
+
+    /**
+     * @brief Send a file as chunks sealed on the worker pool
+     * @param client_info ClientInfo struct of the receiver
+     * @param message_iv IV of the response announcing the stream
+     * @param file_fd Open file to read from
+     * @param length Number of bytes to send
+     * @return true if every chunk was sealed and sent
+     */
+    bool send_sealed_file(const ClientInfo &client_info,
+                          std::span<const uint8_t> message_iv,
+                          int file_fd,
+                          uint32_t length);
+
+    /**
+     * @brief Decrypt, decompress and deserialize a received request frame
+     * @param client_info ClientInfo struct holding the client's key and
+     * compression state
+     * @param iv IV received in front of the ciphertext
+     * @param ciphertext The encrypted request including the tag, decrypted
+     * in place
+     * @return Optional containing the request if decryption succeeded
+     */
+    std::optional<fenris::Request>
+    decrypt_request(const ClientInfo &client_info,
+                    const std::vector<uint8_t> &iv,
+                    common::Buffer ciphertext);
+
+    /**
+     * @brief Serialize, compress and encrypt a response with the next IV of
+     * the connection
+     * @param client_info ClientInfo struct holding the client's key and
+     * compression state
+     * @param response The response to encode
+     * @param payload Bytes serialized as the response's data field, which
+     * must then be empty
+     * @return The IV and the encrypted response, std::nullopt on failure
+     */
+    std::optional<EncryptedMessage>
+    encrypt_response(const ClientInfo &client_info,
+                     const fenris::Response &response,
+                     std::span<const uint8_t> payload = {});
+
+    /**
+     * @brief Run a request through the client handler
+     * @param client_socket Socket descriptor passed on to the client handler
+     * @param request The decoded request
+     * @return The handler's reply, with the content of a READ_FILE the
+     * handler can share kept out of the response
+     */
+    Reply answer(uint32_t client_socket, const fenris::Request &request);
+
+    /**
+     * @brief Put a reply's payload into its response, for responses nested
+     * into another message
+     */
+    static fenris::Response inline_payload(Reply reply);
+
+    /**
+     * @brief Queue a request on the worker pool
+     * @param client_socket Socket descriptor passed on to the client handler
+     * @param request The decoded request
+     * @param trace Trace the worker stamps its stages onto, must outlive the
+     * returned future
+     * @param share Flow the request is fairly queued under, nullopt for
+     * requests spawned by one already on a worker
+     * @return Future for the handler's reply, invalid if the pool is shutting
+     * down
+     */
+    std::future<Reply>
+    dispatch_request(uint32_t client_socket,
+                     fenris::Request request,
+                     common::RequestTrace *trace = nullptr,
+                     std::optional<FairShare> share = std::nullopt);
+
+    /**
+     * @brief Queue a pipelined request that answers itself from the pool
+     * @param client_info ClientInfo struct of the sender, must outlive the
+     * returned future
+     * @param send_mutex Serializes the connection's responses
+     * @param request The decoded request
+     * @param lease Memory budget share of the request, returned once the
+     * response was sent
+     * @param trace Trace of the request, finished once the response was sent
+     * @return Future telling whether the response was sent and the
+     * connection stays open, invalid if the pool is shutting down
+     */
+    std::future<bool> dispatch_pipelined(const ClientInfo &client_info,
+                                         std::mutex &send_mutex,
+                                         fenris::Request request,
+                                         MemoryBudget::Lease lease,
+                                         common::RequestTrace trace);
+
+    /**
+     * @brief Decide whether a received request's trace is sampled, always
+     * when the client traces it
+     */
+    static void adopt_trace(common::RequestTrace &trace,
+                            const fenris::Request &request);
+
+    /**
+     * @brief Queue a request whose progress reports are sent as they come
+     * @param client_info ClientInfo struct of the sender, must outlive the
+     * returned future
+     * @param send_mutex Serializes the connection's responses
+     * @param request The decoded request
+     * @return Future for the handler's final reply, invalid if the pool is
+     * shutting down
+     */
+    std::future<Reply>
+    dispatch_with_progress(const ClientInfo &client_info,
+                           std::mutex &send_mutex,
+                           fenris::Request request);
+
+    /**
+     * @brief Check whether a pipelined request may overlap its neighbours
+     * @param client_info ClientInfo struct of the sender
+     * @param request The decoded request
+     * @return true for requests that change nothing and are answered with a
+     * single response
+     */
+    static bool runs_concurrently(const ClientInfo &client_info,
+                                  const fenris::Request &request);
+
+    /**
+     * @brief Run the sub-requests of a BATCH and collect their responses
+     * @param client_socket Socket of the sender, for the client handler
+     * @param request The BATCH request
+     * @param use_pool Whether a parallel batch may fan out to the worker
+     * pool; false when already running on a worker
+     * @return BATCH_RESULTS response and keep_connection (always true)
+     *
+     * Sequential batches run in order on the calling thread, so later
+     * requests see the effects of earlier ones. Sub-requests that cannot be
+     * batched (BATCH, REKEY, TERMINATE, and CHANGE_DIR in a parallel batch)
+     * get an error response of their own without running.
+     */
+    std::pair<fenris::Response, bool> run_batch(uint32_t client_socket,
+                                                const fenris::Request &request,
+                                                bool use_pool);
+
+    /**
+     * @brief Pick the scheduling class for a request
+     * @param request The decoded request
+     * @return TaskPriority::HIGH for cheap metadata requests
+     */
+    static TaskPriority request_priority(const fenris::Request &request);
+
+    /**
+     * @brief Flow and cost a request is fairly queued for the workers under
+     * @param client_id ID of the sender, each client is a flow of its own
+     * @param request The decoded request
+     */
+    static FairShare fair_share(uint32_t client_id,
+                                const fenris::Request &request);
+
+    /**
+     * @brief Attach a read lease to a READ_FILE response
+     * @param client_info ClientInfo struct of the receiver
+     * @param response Response to the client, leased if it is successful
+     * FILE_CONTENT and the client negotiated CAPABILITY_READ_LEASES
+     */
+    void grant_lease(const ClientInfo &client_info,
+                     fenris::Response &response) const;
+
     std::string m_hostname;
     std::string m_port;
     std::unique_ptr<ClientHandler> m_client_handler;
-    int32_t m_server_socket{-1};
     std::atomic<bool> m_running{false};
-    std::thread m_listen_thread;
+    std::atomic<bool> m_draining{false};
     bool m_non_blocking_mode;
     common::crypto::CryptoManager m_crypto_manager;
     common::Logger m_logger;
@@ -155,9 +809,52 @@ class ConnectionManager {
     // Client management
     std::unordered_map<uint32_t, uint32_t>
         m_client_sockets; // (client_id -> client socket)
-    std::vector<std::thread> m_client_threads;
+    // Threads of connected clients by client_id, and the ids of those that
+    // returned, which the next accept joins
+    std::unordered_map<uint32_t, std::thread> m_client_threads;
+    std::vector<uint32_t> m_finished_clients;
     mutable std::mutex m_client_mutex;
+    // Notified whenever a client was removed
+    std::condition_variable m_client_removed;
     std::atomic<uint32_t> m_next_client_id{1};
+
+    // Listening sockets, one accept thread each
+    std::vector<int> m_listen_sockets;
+    std::vector<std::thread> m_listen_threads;
+    size_t m_acceptors{1};
+    int m_listen_backlog{DEFAULT_LISTEN_BACKLOG};
+    bool m_reuse_port{false};
+    bool m_cpu_affinity{false};
+
+    // Request intake
+    size_t m_max_message_size{DEFAULT_MAX_MESSAGE_SIZE};
+    size_t m_memory_budget_bytes{0};
+    std::unique_ptr<MemoryBudget> m_memory_budget;
+    RateLimit m_client_limit;
+    RateLimit m_tenant_limit;
+    std::unique_ptr<RateLimiter> m_rate_limiter;
+
+    // Request dispatch
+    size_t m_worker_threads{0};
+    std::unique_ptr<ThreadPool> m_thread_pool;
+
+    // Handshakes
+    size_t m_keypair_pool_size{common::crypto::DEFAULT_KEYPAIR_POOL_SIZE};
+    std::unique_ptr<common::crypto::KeyPairPool> m_keypair_pool;
+
+    bool m_plaintext_file_streaming{false};
+    bool m_sealed_file_streaming{false};
+    bool m_pipelining{false};
+    std::chrono::milliseconds m_read_lease{0};
+    std::unique_ptr<TicketKeeper> m_ticket_keeper;
+    size_t m_sealed_chunk_size{common::crypto::DEFAULT_AEAD_CHUNK_SIZE};
+    bool m_compression{false};
+    common::compress::WireCompressionConfig m_compression_config;
+
+    // Reactor mode
+    bool m_reactor_mode{false};
+    size_t m_io_threads{0};
+    std::unique_ptr<Reactor> m_reactor;
 };
 
 /**
@@ -181,6 +878,69 @@ class ClientHandler {
      */
     virtual std::pair<fenris::Response, bool>
     handle_request(uint32_t client_socket, const fenris::Request &request) = 0;
+
+    /**
+     * Sends an intermediate response to the client, false once it is gone
+     */
+    using ProgressSink = std::function<bool(const fenris::Response &)>;
+
+    /**
+     * @brief Process a request that may report progress before it finishes
+     * @param client_socket Socket descriptor for the client connection.
+     * @param request The deserialized client request, asking for progress
+     *        in tree.progress_interval_ms.
+     * @param progress Sends intermediate responses; the connection manager
+     *        stamps them with the request's request_id.
+     * @return The final response, as for handle_request().
+     */
+    virtual std::pair<fenris::Response, bool>
+    handle_request_with_progress(uint32_t client_socket,
+                                 const fenris::Request &request,
+                                 const ProgressSink &progress)
+    {
+        return handle_request(client_socket, request);
+    }
+
+    /**
+     * @brief Local file to stream for a READ_FILE request
+     * @param client_socket Socket descriptor for the client connection.
+     * @param request The deserialized READ_FILE request.
+     * @return Path the connection manager may sendfile() from, std::nullopt
+     *         to answer the request through handle_request() instead.
+     */
+    virtual std::optional<std::string>
+    stream_path(uint32_t client_socket, const fenris::Request &request)
+    {
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Answer a READ_FILE with content the handler holds in memory
+     * @param client_socket Socket descriptor for the client connection.
+     * @param request The deserialized READ_FILE request.
+     * @return The response with its data field left empty and the file
+     *         content to send as that field, serialized straight from the
+     *         handler's buffer. std::nullopt to answer the request through
+     *         handle_request() instead.
+     */
+    virtual std::optional<std::pair<fenris::Response, common::Buffer>>
+    file_content(uint32_t client_socket, const fenris::Request &request)
+    {
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Drop what the handler keeps for a connection that closed
+     *
+     * Called once per connection, whether or not the client sent TERMINATE,
+     * after its last request was answered and before its socket is closed,
+     * so a later connection reusing the descriptor starts afresh.
+     *
+     * @param client_socket Socket descriptor for the client connection.
+     */
+    virtual void client_disconnected(uint32_t client_socket)
+    {
+    }
 };
 
 } // namespace server
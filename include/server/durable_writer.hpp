@@ -0,0 +1,129 @@
+#ifndef FENRIS_SERVER_DURABLE_WRITER_HPP
+#define FENRIS_SERVER_DURABLE_WRITER_HPP
+
+#include "common/file_operations.hpp"
+#include "common/logging.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fenris {
+namespace server {
+
+/**
+ * Batching of a DurableWriter
+ */
+struct DurableWriteConfig {
+    // How long the first writer of a batch waits for others to join it, 0 to
+    // only batch writers that queued up during the previous flush
+    std::chrono::microseconds commit_window{1000};
+
+    // Writers per batch, a full batch is flushed without waiting
+    size_t max_batch = 64;
+};
+
+/**
+ * Counters for judging how well writes are coalesced
+ */
+struct DurableWriteStats {
+    // Writes and appends that reached the flush
+    uint64_t writes = 0;
+    // Flushes, each covering one or more writes
+    uint64_t batches = 0;
+    // Directory flushes, one per directory per batch
+    uint64_t directory_syncs = 0;
+};
+
+/**
+ * @class DurableWriter
+ * @brief Crash-safe writes that share their disk flushes
+ *
+ * write_file() fills a temporary file next to the target and renames it over
+ * the target once its data is on disk, so after a crash the file holds either
+ * the old or the new content, never a mix. append_file() appends in place: a
+ * crash can only lose a suffix of the appended bytes.
+ *
+ * Flushing is done by group commit. The first writer to arrive leads a batch,
+ * waits up to the commit window for others, then starts writeback of every
+ * file in the batch before waiting for any of them, renames the temporary
+ * files and flushes each touched directory once. Writers return only after
+ * the batch holding their write is durable.
+ */
+class DurableWriter {
+  public:
+    /**
+     * @brief Constructor
+     * @param config Commit window and batch size
+     * @param logger_name Name for the logger instance
+     */
+    explicit DurableWriter(
+        const DurableWriteConfig &config = DurableWriteConfig{},
+        const std::string &logger_name = "ServerDurableWriter");
+
+    DurableWriter(const DurableWriter &) = delete;
+    DurableWriter &operator=(const DurableWriter &) = delete;
+
+    /**
+     * @brief Atomically create or replace a file
+     * @param filepath Path to the file, an existing file keeps its permissions
+     * @param data Content to write
+     * @return FileOperationResult indicating success or failure
+     */
+    common::FileOperationResult write_file(const std::string &filepath,
+                                           std::string_view data);
+
+    /**
+     * @brief Append to an existing file and flush it
+     * @param filepath Path to the file
+     * @param data Content to append
+     * @return FileOperationResult indicating success or failure
+     */
+    common::FileOperationResult append_file(const std::string &filepath,
+                                            std::string_view data);
+
+    /**
+     * @brief Get write, batch and directory flush counts
+     * @return Counters since construction
+     */
+    DurableWriteStats get_stats() const;
+
+  private:
+    // One write waiting for its batch to be flushed
+    struct Pending {
+        int fd;
+        // Temporary file renamed over path, empty for appends
+        std::string temp_path;
+        std::string path;
+        common::FileOperationResult result{
+            common::FileOperationResult::SUCCESS};
+        bool done{false};
+    };
+
+    // Queue a written descriptor and wait until its batch is durable
+    common::FileOperationResult commit(Pending &pending);
+
+    // Flush, rename and close a batch, called without the lock
+    void flush(const std::vector<Pending *> &batch);
+
+    DurableWriteConfig m_config;
+    common::Logger m_logger;
+
+    std::vector<Pending *> m_queue;
+    bool m_flushing{false};
+    DurableWriteStats m_stats;
+    mutable std::mutex m_mutex;
+    // Signalled when a batch is done, and to the leader when one is full
+    std::condition_variable m_batch_done;
+    std::condition_variable m_batch_full;
+};
+
+} // namespace server
+} // namespace fenris
+
+#endif // FENRIS_SERVER_DURABLE_WRITER_HPP
@@ -0,0 +1,261 @@
+#ifndef FENRIS_SERVER_EVICTION_POLICY_HPP
+#define FENRIS_SERVER_EVICTION_POLICY_HPP
+
+#include "server/cache_table.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fenris {
+namespace server {
+
+enum class EvictionPolicyType {
+    LRU,      // Least recently used
+    TINY_LFU, // LRU order behind a TinyLFU frequency admission filter
+    ARC       // Adaptive replacement cache
+};
+
+/**
+ * Convert EvictionPolicyType to string representation
+ *
+ * @param type The policy type to convert
+ * @return String representation of the policy type
+ */
+std::string eviction_policy_type_to_string(EvictionPolicyType type);
+
+/**
+ * @class EvictionPolicy
+ * @brief Decides which cache entries to keep and which to drop
+ *
+ * A policy works on the slots of the CacheTable it was created for and keeps
+ * its ordering in the entries' intrusive links, so tracking a hit never
+ * allocates. The cache reports every lookup and membership change, asks for a
+ * victim while it is over budget and may consult admit() before displacing
+ * one. Policies are not synchronized, the cache calls them under the owning
+ * shard's lock.
+ */
+class EvictionPolicy {
+  public:
+    virtual ~EvictionPolicy() = default;
+
+    /**
+     * @brief A resident entry was read or rewritten
+     * @param slot The entry's slot
+     */
+    virtual void record_hit(uint32_t slot) = 0;
+
+    /**
+     * @brief A key that is not resident was looked up
+     * @param hash CacheTable::hash_key() of the key
+     */
+    virtual void record_miss(uint64_t hash)
+    {
+        (void)hash;
+    }
+
+    /**
+     * @brief Decide whether a new key is worth evicting a resident one
+     * @param hash CacheTable::hash_key() of the key waiting to be inserted
+     * @param victim Slot of the entry that would be evicted for it
+     * @return true if the key should be inserted
+     */
+    virtual bool admit(uint64_t hash, uint32_t victim)
+    {
+        (void)hash;
+        (void)victim;
+        return true;
+    }
+
+    /**
+     * @brief An entry became resident
+     * @param slot The entry's slot
+     */
+    virtual void insert(uint32_t slot) = 0;
+
+    /**
+     * @brief An entry is about to leave the table
+     * @param slot The entry's slot, still valid during the call
+     * @param evicted true if it was chosen by victim(), false if invalidated
+     */
+    virtual void remove(uint32_t slot, bool evicted) = 0;
+
+    /**
+     * @brief Forget every resident entry, the table is being cleared
+     */
+    virtual void clear() = 0;
+
+    /**
+     * @brief The resident entry to evict next
+     * @return Its slot, NO_SLOT if nothing is resident
+     */
+    virtual uint32_t victim() const = 0;
+};
+
+/**
+ * @class LruPolicy
+ * @brief Evicts the least recently used entry
+ */
+class LruPolicy : public EvictionPolicy {
+  public:
+    /**
+     * @brief Constructor
+     * @param table Table holding the tracked entries
+     */
+    explicit LruPolicy(CacheTable &table);
+
+    void record_hit(uint32_t slot) override;
+    void insert(uint32_t slot) override;
+    void remove(uint32_t slot, bool evicted) override;
+    void clear() override;
+    uint32_t victim() const override;
+
+  private:
+    // Most recently used at the front
+    SlotList m_order;
+};
+
+/**
+ * @class FrequencySketch
+ * @brief Count-min sketch of approximate access frequencies
+ *
+ * Four rows of saturating 4-bit counters. After a sample of ten times the
+ * width has been recorded every counter is halved, so old popularity fades
+ * and the sketch follows changes in the working set.
+ */
+class FrequencySketch {
+  public:
+    /**
+     * @brief Constructor
+     * @param capacity Expected number of distinct resident keys
+     */
+    explicit FrequencySketch(size_t capacity);
+
+    /**
+     * @brief Count one access
+     * @param hash CacheTable::hash_key() of the accessed key
+     */
+    void increment(uint64_t hash);
+
+    /**
+     * @brief Estimated accesses since the counters were last aged
+     * @param hash CacheTable::hash_key() of the key
+     * @return Estimate between 0 and 15
+     */
+    uint8_t estimate(uint64_t hash) const;
+
+  private:
+    static constexpr size_t ROWS = 4;
+    static constexpr uint8_t MAX_COUNT = 15;
+
+    size_t index(uint64_t hash, size_t row) const;
+    void age();
+
+    std::vector<uint8_t> m_counters;
+    size_t m_mask;
+    size_t m_sample_size;
+    size_t m_additions{0};
+};
+
+/**
+ * @class TinyLfuPolicy
+ * @brief LRU eviction with frequency based admission
+ *
+ * A newcomer only displaces the LRU victim if the sketch has seen it more
+ * often than the victim, so a one-pass scan cannot flush a hot working set.
+ */
+class TinyLfuPolicy : public EvictionPolicy {
+  public:
+    /**
+     * @brief Constructor
+     * @param table Table holding the tracked entries
+     * @param capacity Expected number of resident keys
+     */
+    TinyLfuPolicy(CacheTable &table, size_t capacity);
+
+    void record_hit(uint32_t slot) override;
+    void record_miss(uint64_t hash) override;
+    bool admit(uint64_t hash, uint32_t victim) override;
+    void insert(uint32_t slot) override;
+    void remove(uint32_t slot, bool evicted) override;
+    void clear() override;
+    uint32_t victim() const override;
+
+  private:
+    CacheTable &m_table;
+    FrequencySketch m_sketch;
+    LruPolicy m_lru;
+};
+
+/**
+ * @class ArcPolicy
+ * @brief Adaptive replacement cache (Megiddo and Modha)
+ *
+ * Resident entries are split between T1 (seen once) and T2 (seen again).
+ * Ghost lists B1 and B2 remember the hashes of keys recently evicted from
+ * each; a returning key that hits a ghost shifts the target size of T1
+ * toward the list that would have kept it. Scanned keys stay in T1 and are
+ * evicted before the frequent set in T2.
+ */
+class ArcPolicy : public EvictionPolicy {
+  public:
+    /**
+     * @brief Constructor
+     * @param table Table holding the tracked entries
+     * @param capacity Expected number of resident keys, bounds the ghosts
+     */
+    ArcPolicy(CacheTable &table, size_t capacity);
+
+    void record_hit(uint32_t slot) override;
+    void insert(uint32_t slot) override;
+    void remove(uint32_t slot, bool evicted) override;
+    void clear() override;
+    uint32_t victim() const override;
+
+  private:
+    // Ids of the resident lists in the entries, 0 means unlinked
+    static constexpr uint8_t T1_ID = 1;
+    static constexpr uint8_t T2_ID = 2;
+
+    struct Ghost {
+        // true for B2, false for B1
+        bool frequent;
+        std::list<uint64_t>::iterator it;
+    };
+
+    void add_ghost(uint64_t hash, bool frequent);
+    void drop_ghost(uint64_t hash);
+    void trim_ghosts();
+
+    CacheTable &m_table;
+    size_t m_capacity;
+    // Target size of T1
+    size_t m_target{0};
+
+    // Most recently used at the front of every list
+    SlotList m_t1;
+    SlotList m_t2;
+    std::list<uint64_t> m_b1;
+    std::list<uint64_t> m_b2;
+    std::unordered_map<uint64_t, Ghost> m_ghosts;
+};
+
+/**
+ * @brief Create a policy of the given type
+ * @param type Policy to create
+ * @param table Table holding the tracked entries
+ * @param capacity Expected number of resident keys
+ * @return The policy
+ */
+std::unique_ptr<EvictionPolicy> make_eviction_policy(EvictionPolicyType type,
+                                                     CacheTable &table,
+                                                     size_t capacity);
+
+} // namespace server
+} // namespace fenris
+
+#endif // FENRIS_SERVER_EVICTION_POLICY_HPP
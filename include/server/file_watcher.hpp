@@ -0,0 +1,101 @@
+#ifndef FENRIS_SERVER_FILE_WATCHER_HPP
+#define FENRIS_SERVER_FILE_WATCHER_HPP
+
+#include "common/logging.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace fenris {
+namespace server {
+
+/**
+ * Called from the watcher thread for every path that changed. is_directory
+ * is true when everything below path may have changed as well, e.g. after a
+ * directory was renamed or the kernel dropped events.
+ */
+using ChangeCallback =
+    std::function<void(const std::string &path, bool is_directory)>;
+
+/**
+ * @class FileWatcher
+ * @brief Reports changes below a directory tree using inotify
+ *
+ * Every directory of the tree gets its own watch, directories created or
+ * moved in later are picked up as they appear. Modifications, attribute
+ * changes, deletions and both ends of a rename are reported, so changes made
+ * by other processes reach the callback just like our own. If the kernel
+ * event queue overflows the root itself is reported as a changed directory.
+ */
+class FileWatcher {
+  public:
+    /**
+     * @brief Constructor
+     * @param root Directory to watch recursively
+     * @param callback Receives the changed paths, prefixed by root
+     * @param logger_name Name for the watcher's logger
+     */
+    FileWatcher(const std::string &root,
+                ChangeCallback callback,
+                const std::string &logger_name = "ServerFileWatcher");
+
+    /**
+     * @brief Destructor, stops the watcher thread
+     */
+    ~FileWatcher();
+
+    FileWatcher(const FileWatcher &) = delete;
+    FileWatcher &operator=(const FileWatcher &) = delete;
+
+    /**
+     * @brief Watch the tree and start delivering events
+     * @return true if the root is watched, false otherwise
+     */
+    bool start();
+
+    /**
+     * @brief Stop delivering events and release every watch
+     */
+    void stop();
+
+    /**
+     * @brief Get the number of directories currently watched
+     * @return Number of inotify watches
+     */
+    size_t get_watch_count() const;
+
+  private:
+    void run();
+
+    // Handle one batch of events read from the inotify descriptor
+    void process_events(const char *buffer, size_t length);
+
+    // Watch a directory and every directory below it
+    void add_watch_tree(const std::string &directory);
+
+    // Drop the watches of a directory and everything below it
+    void remove_watch_tree(const std::string &directory);
+
+    std::string m_root;
+    ChangeCallback m_callback;
+    common::Logger m_logger;
+
+    int m_inotify_fd{-1};
+    int m_wake_fd{-1};
+    std::thread m_thread;
+    std::atomic<bool> m_running{false};
+
+    // Watch descriptor to watched directory
+    std::unordered_map<int, std::string> m_watches;
+    mutable std::mutex m_watches_mutex;
+};
+
+} // namespace server
+} // namespace fenris
+
+#endif // FENRIS_SERVER_FILE_WATCHER_HPP
@@ -0,0 +1,142 @@
+#ifndef FENRIS_SERVER_IO_URING_HPP
+#define FENRIS_SERVER_IO_URING_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <sys/uio.h>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace fenris {
+namespace server {
+
+/**
+ * @class IoUring
+ * @brief Minimal io_uring submission and completion rings
+ *
+ * Talks to the kernel through the raw system calls, so the only requirement
+ * is a kernel new enough for the opcodes asked for in init(). The rings are
+ * not synchronized, a single thread must own all calls.
+ */
+class IoUring {
+  public:
+    IoUring() = default;
+
+    /**
+     * @brief Destructor, unmaps the rings and releases registered resources
+     */
+    ~IoUring();
+
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    /**
+     * @brief Create the rings
+     * @param entries Submission queue depth, rounded up by the kernel
+     * @param opcodes io_uring opcodes that must be supported
+     * @return 0 on success, otherwise -errno explaining why io_uring is
+     * unavailable
+     */
+    int init(unsigned entries, std::initializer_list<uint8_t> opcodes);
+
+    /**
+     * @brief Whether init() succeeded
+     */
+    bool is_open() const
+    {
+        return m_ring_fd >= 0;
+    }
+
+    /**
+     * @brief Take the next free submission entry, zeroed
+     * @return The entry, nullptr if the submission queue is full
+     */
+    io_uring_sqe *get_sqe();
+
+    /**
+     * @brief Hand queued entries to the kernel, optionally waiting
+     * @param wait_for Completions to wait for, 0 to return immediately
+     * @return Number of entries submitted, or -errno
+     */
+    int submit(unsigned wait_for = 0);
+
+    /**
+     * @brief Pass every available completion to a visitor and consume it
+     * @param visit Called as visit(user_data, res, flags)
+     * @return Number of completions visited
+     */
+    template <typename Visit>
+    unsigned for_each_completion(Visit visit)
+    {
+        unsigned count = 0;
+        uint64_t user_data;
+        int32_t res;
+        uint32_t flags;
+        while (peek_completion(user_data, res, flags)) {
+            visit(user_data, res, flags);
+            ++count;
+        }
+        return count;
+    }
+
+    /**
+     * @brief Number of prepared entries not yet submitted
+     */
+    unsigned pending() const
+    {
+        return m_sqe_tail - m_sqe_head;
+    }
+
+    /**
+     * @brief Register memory for READ_FIXED / WRITE_FIXED
+     * @param buffers Regions indexed by buf_index in the order given
+     * @return 0 on success, otherwise -errno
+     */
+    int register_buffers(const std::vector<iovec> &buffers);
+
+    /**
+     * @brief Register an empty table of direct descriptors
+     * @param count Number of slots, filled by OPENAT with file_index set
+     * @return 0 on success, otherwise -errno
+     */
+    int register_file_slots(unsigned count);
+
+  private:
+    // Unmap the rings and close the ring descriptor
+    void release();
+
+    // Read and consume the completion at the head of the queue
+    bool peek_completion(uint64_t &user_data, int32_t &res, uint32_t &flags);
+
+    int m_ring_fd{-1};
+
+    void *m_sq_ring{nullptr};
+    size_t m_sq_ring_size{0};
+    void *m_cq_ring{nullptr};
+    size_t m_cq_ring_size{0};
+    io_uring_sqe *m_sqes{nullptr};
+    size_t m_sqes_size{0};
+
+    // Pointers into the mapped rings
+    unsigned *m_sq_head{nullptr};
+    unsigned *m_sq_tail{nullptr};
+    unsigned *m_sq_array{nullptr};
+    unsigned m_sq_mask{0};
+    unsigned m_sq_entries{0};
+    unsigned *m_cq_head{nullptr};
+    unsigned *m_cq_tail{nullptr};
+    io_uring_cqe *m_cqes{nullptr};
+    unsigned m_cq_mask{0};
+
+    // Entries handed out by get_sqe() and those already published
+    unsigned m_sqe_head{0};
+    unsigned m_sqe_tail{0};
+};
+
+} // namespace server
+} // namespace fenris
+
+#endif // FENRIS_SERVER_IO_URING_HPP
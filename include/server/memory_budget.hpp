@@ -0,0 +1,132 @@
+#ifndef FENRIS_SERVER_MEMORY_BUDGET_HPP
+#define FENRIS_SERVER_MEMORY_BUDGET_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+namespace fenris {
+namespace server {
+
+/**
+ * Counters for judging whether the budget holds readers back
+ */
+struct MemoryBudgetStats {
+    // Leases handed out
+    uint64_t leases = 0;
+    // Times a lease could not be granted at once and the reader paused,
+    // every refused try_acquire() counting
+    uint64_t waits = 0;
+    // Most bytes leased at the same time
+    uint64_t peak_bytes = 0;
+};
+
+/**
+ * @class MemoryBudget
+ * @brief Caps the request bytes held in memory across all connections
+ *
+ * A connection leases the size of a request once its length prefix arrived
+ * and before any memory is spent on the body, and returns the lease once the
+ * request was answered. While the budget is used up readers wait instead of
+ * allocating, the socket buffers fill and TCP flow control slows the senders
+ * down. A request larger than the whole budget is let in when nothing else
+ * is leased, so it is delayed but never starved.
+ */
+class MemoryBudget {
+  public:
+    /**
+     * Bytes taken from a budget, given back when the lease is destroyed or
+     * released. The budget must outlive its leases.
+     */
+    class Lease {
+      public:
+        Lease() = default;
+        ~Lease();
+
+        Lease(Lease &&other) noexcept;
+        Lease &operator=(Lease &&other) noexcept;
+        Lease(const Lease &) = delete;
+        Lease &operator=(const Lease &) = delete;
+
+        /**
+         * @brief Give the bytes back early
+         */
+        void release();
+
+        size_t size() const
+        {
+            return m_size;
+        }
+
+        explicit operator bool() const
+        {
+            return m_budget != nullptr;
+        }
+
+      private:
+        friend class MemoryBudget;
+        Lease(MemoryBudget *budget, size_t size)
+            : m_budget(budget), m_size(size)
+        {
+        }
+
+        MemoryBudget *m_budget{nullptr};
+        size_t m_size{0};
+    };
+
+    /**
+     * @param limit Bytes that may be leased at the same time
+     */
+    explicit MemoryBudget(size_t limit);
+
+    MemoryBudget(const MemoryBudget &) = delete;
+    MemoryBudget &operator=(const MemoryBudget &) = delete;
+
+    /**
+     * @brief Lease bytes, waiting until they fit
+     * @return The lease, nullopt once close() was called
+     */
+    std::optional<Lease> acquire(size_t bytes);
+
+    /**
+     * @brief Lease bytes if they fit right now
+     * @return The lease, nullopt if the caller has to try again later
+     */
+    std::optional<Lease> try_acquire(size_t bytes);
+
+    /**
+     * @brief Refuse further leases and wake every waiting reader
+     */
+    void close();
+
+    size_t limit() const
+    {
+        return m_limit;
+    }
+
+    /**
+     * @brief Bytes currently leased
+     */
+    size_t in_use() const;
+
+    MemoryBudgetStats get_stats() const;
+
+  private:
+    bool fits(size_t bytes) const;
+    Lease grant(size_t bytes);
+    void give_back(size_t bytes);
+
+    const size_t m_limit;
+    size_t m_in_use{0};
+    bool m_closed{false};
+    MemoryBudgetStats m_stats;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_released;
+};
+
+} // namespace server
+} // namespace fenris
+
+#endif // FENRIS_SERVER_MEMORY_BUDGET_HPP
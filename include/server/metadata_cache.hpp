@@ -0,0 +1,220 @@
+#ifndef FENRIS_SERVER_METADATA_CACHE_HPP
+#define FENRIS_SERVER_METADATA_CACHE_HPP
+
+#include "common/logging.hpp"
+#include "fenris.pb.h"
+#include "server/file_watcher.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace fenris {
+namespace server {
+
+/**
+ * Limits of a MetadataCache
+ */
+struct MetadataCacheConfig {
+    // How long an entry is served before it is looked up again. Bounds how
+    // late changes the watcher misses are noticed.
+    std::chrono::milliseconds ttl{1000};
+
+    // File infos and listing pages held at once, further entries are not
+    // cached until expired ones make room
+    size_t max_entries = 65536;
+};
+
+/**
+ * Counters for judging how well metadata lookups are absorbed
+ */
+struct MetadataCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    // Entries found past their TTL, also counted as misses
+    uint64_t expirations = 0;
+    // Entries dropped because their file or directory changed
+    uint64_t invalidations = 0;
+};
+
+/**
+ * @class MetadataCache
+ * @brief Caches file infos and directory listing pages for a short time
+ *
+ * Entries are kept as serialized FileInfo and DirectoryListing messages, so
+ * a hit only has to merge the bytes into the reply instead of building it
+ * from a stat() per entry again.
+ *
+ * Keys are paths below the served root spelled the way clients see them,
+ * with a leading "/" and the root itself as "/". Listing pages are kept per
+ * directory under a key chosen by the caller, e.g. cursor and page size.
+ * Changes are dropped as they are reported by the invalidate functions or by
+ * watch(), and every entry expires after the TTL regardless.
+ */
+class MetadataCache {
+  public:
+    /**
+     * @brief Constructor
+     * @param config TTL and entry limit
+     * @param logger_name Name for the logger instance
+     */
+    explicit MetadataCache(
+        const MetadataCacheConfig &config = MetadataCacheConfig{},
+        const std::string &logger_name = "ServerMetadataCache");
+
+    MetadataCache(const MetadataCache &) = delete;
+    MetadataCache &operator=(const MetadataCache &) = delete;
+
+    /**
+     * @brief Look up the info of a file or directory
+     * @param path Path below the root
+     * @return Serialized FileInfo, nullopt on a miss
+     */
+    std::optional<std::string> get_file_info(const std::string &path);
+
+    /**
+     * @brief Look up one page of a directory listing
+     * @param directory Path of the directory below the root
+     * @param page Key of the page within the directory
+     * @return Serialized DirectoryListing, nullopt on a miss
+     */
+    std::optional<std::string> get_listing(const std::string &directory,
+                                           const std::string &page);
+
+    /**
+     * @brief Get the current generation, to be taken before a lookup on disk
+     *
+     * Every invalidation starts a new generation. An entry read from disk is
+     * only stored if its generation is still current, so a change invalidated
+     * while it was being read is not cached with the old content.
+     *
+     * @return Generation to pass to put_file_info() or put_listing()
+     */
+    uint64_t generation() const;
+
+    /**
+     * @brief Store the info of a file or directory
+     * @param path Path below the root
+     * @param file_info Info as read from disk
+     * @param generation Result of generation() taken before reading it
+     */
+    void put_file_info(const std::string &path,
+                       const fenris::FileInfo &file_info,
+                       uint64_t generation);
+
+    /**
+     * @brief Store one page of a directory listing
+     * @param directory Path of the directory below the root
+     * @param page Key of the page within the directory
+     * @param listing Page as read from disk
+     * @param generation Result of generation() taken before reading it
+     */
+    void put_listing(const std::string &directory,
+                     const std::string &page,
+                     const fenris::DirectoryListing &listing,
+                     uint64_t generation);
+
+    /**
+     * @brief Drop what a change to the content or attributes of path affects
+     *
+     * That is the info of path and the listings of its parent, which show
+     * its size and modification time.
+     *
+     * @param path Path below the root
+     */
+    void invalidate(const std::string &path);
+
+    /**
+     * @brief Drop what creating, removing or renaming path affects
+     *
+     * On top of invalidate(), the info of the parent is dropped as its
+     * modification time changed, and so are the listings of path itself.
+     *
+     * @param path Path below the root
+     */
+    void invalidate_entry(const std::string &path);
+
+    /**
+     * @brief Drop a directory, everything below it and its parent's entries
+     * @param directory Path of the directory below the root
+     */
+    void invalidate_prefix(const std::string &directory);
+
+    /**
+     * @brief Drop all entries
+     */
+    void clear();
+
+    /**
+     * @brief Invalidate entries whenever files below root change
+     * @param root Local directory the keys are relative to
+     * @return true if the watch was set up, false otherwise
+     */
+    bool watch(const std::string &root);
+
+    /**
+     * @brief Stop the watcher started by watch()
+     */
+    void stop_watching();
+
+    /**
+     * @brief Get the number of file infos and listing pages cached
+     * @return Number of entries, expired ones included
+     */
+    size_t get_entry_count() const;
+
+    /**
+     * @brief Get hit, miss, expiration and invalidation counts
+     * @return Counters since construction
+     */
+    MetadataCacheStats get_stats() const;
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        std::string bytes;
+        Clock::time_point expires;
+    };
+
+    // Entries by path, or the listing pages of one directory by page key
+    using Entries = std::unordered_map<std::string, Entry>;
+
+    // Return a live entry's bytes, dropping it once expired; caller holds
+    // the lock
+    std::optional<std::string> lookup(Entries &entries, const std::string &key);
+
+    // Whether another entry fits, dropping expired ones to make room; caller
+    // holds the lock
+    bool make_room();
+
+    // Drop entries of one path; caller holds the lock
+    void erase_file_info(const std::string &path);
+    void erase_listings(const std::string &directory);
+
+    MetadataCacheConfig m_config;
+    common::Logger m_logger;
+
+    Entries m_file_infos;
+    std::unordered_map<std::string, Entries> m_listings;
+    size_t m_entry_count{0};
+    // Earliest expiry left by the last sweep of a full cache
+    Clock::time_point m_next_sweep{};
+    uint64_t m_generation{0};
+    MetadataCacheStats m_stats;
+    mutable std::mutex m_mutex;
+
+    // Declared last so its thread stops before the entries go away
+    std::unique_ptr<FileWatcher> m_watcher;
+    std::mutex m_watcher_mutex;
+};
+
+} // namespace server
+} // namespace fenris
+
+#endif // FENRIS_SERVER_METADATA_CACHE_HPP
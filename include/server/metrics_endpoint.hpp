@@ -0,0 +1,77 @@
+#ifndef FENRIS_SERVER_METRICS_ENDPOINT_HPP
+#define FENRIS_SERVER_METRICS_ENDPOINT_HPP
+
+#include "common/logging.hpp"
+#include "common/metrics.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+namespace fenris {
+namespace server {
+
+/**
+ * @class MetricsEndpoint
+ * @brief Plain HTTP listener answering GET /metrics for Prometheus
+ *
+ * Scrapes are rare and small, so one thread accepts and answers them in
+ * turn, each on a connection of its own that is closed after the response.
+ * Nothing here touches the request path: rendering only reads the
+ * registry's counters.
+ */
+class MetricsEndpoint {
+  public:
+    /**
+     * @param host Address to listen on
+     * @param port Port to listen on, "0" to let the kernel pick one
+     * @param registry Metrics served
+     * @param logger_name Name for the logger instance
+     */
+    MetricsEndpoint(const std::string &host,
+                    const std::string &port,
+                    common::MetricsRegistry &registry =
+                        common::MetricsRegistry::global(),
+                    const std::string &logger_name = "fenris_server");
+
+    ~MetricsEndpoint();
+
+    MetricsEndpoint(const MetricsEndpoint &) = delete;
+    MetricsEndpoint &operator=(const MetricsEndpoint &) = delete;
+
+    /**
+     * @brief Bind the port and start answering scrapes
+     * @return false if the address could not be bound
+     */
+    bool start();
+
+    void stop();
+
+    bool is_running() const;
+
+    /**
+     * @brief Port the endpoint listens on, 0 while stopped
+     */
+    uint16_t port() const;
+
+  private:
+    void serve();
+
+    // Read one request from a scraper and answer it
+    void answer(int client_fd);
+
+    std::string m_host;
+    std::string m_port;
+    common::MetricsRegistry &m_registry;
+    int m_listen_socket{-1};
+    uint16_t m_bound_port{0};
+    std::atomic<bool> m_running{false};
+    std::thread m_thread;
+    common::Logger m_logger;
+};
+
+} // namespace server
+} // namespace fenris
+
+#endif // FENRIS_SERVER_METRICS_ENDPOINT_HPP
@@ -0,0 +1,114 @@
+#ifndef FENRIS_SERVER_OBJECT_STORE_HPP
+#define FENRIS_SERVER_OBJECT_STORE_HPP
+
+#include "common/buffer.hpp"
+#include "common/file_operations.hpp"
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fenris {
+namespace server {
+
+/**
+ * @class ObjectStore
+ * @brief Flat store of whole objects under string keys
+ *
+ * What a storage tier needs from a bucket: objects are written whole and
+ * replace any earlier one atomically, read whole or by range, and listed by
+ * key prefix. Keys are '/' separated names without "." or ".." components.
+ * Implementations must be thread safe.
+ */
+class ObjectStore {
+  public:
+    virtual ~ObjectStore() = default;
+
+    /**
+     * @brief Write an object, replacing one under the same key
+     */
+    virtual common::FileOperationResult
+    put(const std::string &key, std::span<const uint8_t> data) = 0;
+
+    /**
+     * @brief Read a whole object
+     * @return Pair of (content, FileOperationResult), FILE_NOT_FOUND if
+     * there is no object under the key
+     */
+    virtual std::pair<common::Buffer, common::FileOperationResult>
+    get(const std::string &key) = 0;
+
+    /**
+     * @brief Read a byte range of an object
+     * @return Pair of (range content, FileOperationResult), shorter at the
+     * end of the object and empty past it
+     */
+    virtual std::pair<common::Buffer, common::FileOperationResult>
+    get_range(const std::string &key, uint64_t offset, size_t length) = 0;
+
+    /**
+     * @brief Delete an object
+     * @return FileOperationResult, FILE_NOT_FOUND if there was none
+     */
+    virtual common::FileOperationResult remove(const std::string &key) = 0;
+
+    /**
+     * @brief Keys of every object starting with a prefix
+     */
+    virtual std::pair<std::vector<std::string>, common::FileOperationResult>
+    list(const std::string &prefix) = 0;
+};
+
+/**
+ * @class DirectoryObjectStore
+ * @brief Object store kept as files below a directory
+ *
+ * Each object is the file at its key below the directory, written through a
+ * temporary sibling and renamed into place. The directory may be a mount of
+ * a bucket or a slower, larger disk than the one the served tree is on.
+ */
+class DirectoryObjectStore : public ObjectStore {
+  public:
+    /**
+     * @param directory Directory holding the objects, created if missing
+     * @param sync Flush objects to disk before they replace earlier ones
+     */
+    explicit DirectoryObjectStore(const std::string &directory,
+                                  bool sync = false);
+
+    /**
+     * @brief Whether the directory could be set up
+     */
+    bool is_open() const;
+
+    common::FileOperationResult put(const std::string &key,
+                                    std::span<const uint8_t> data) override;
+
+    std::pair<common::Buffer, common::FileOperationResult>
+    get(const std::string &key) override;
+
+    std::pair<common::Buffer, common::FileOperationResult>
+    get_range(const std::string &key,
+              uint64_t offset,
+              size_t length) override;
+
+    common::FileOperationResult remove(const std::string &key) override;
+
+    std::pair<std::vector<std::string>, common::FileOperationResult>
+    list(const std::string &prefix) override;
+
+  private:
+    // Path of an object's file, empty for keys climbing out of the directory
+    std::string object_path(const std::string &key) const;
+
+    std::string m_directory;
+    bool m_sync;
+    bool m_open{false};
+};
+
+} // namespace server
+} // namespace fenris
+
+#endif // FENRIS_SERVER_OBJECT_STORE_HPP
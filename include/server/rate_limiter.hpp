@@ -0,0 +1,215 @@
+#ifndef FENRIS_SERVER_RATE_LIMITER_HPP
+#define FENRIS_SERVER_RATE_LIMITER_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace fenris {
+namespace common {
+class Histogram;
+}
+
+namespace server {
+
+/**
+ * Sustained rates one client or tenant may use, 0 leaves a rate unlimited
+ */
+struct RateLimit {
+    double ops_per_second = 0;
+    double bytes_per_second = 0;
+    // Seconds of each rate that may be spent at once after being idle
+    double burst_seconds = 1.0;
+
+    bool limited() const
+    {
+        return ops_per_second > 0 || bytes_per_second > 0;
+    }
+};
+
+/**
+ * @class TokenBucket
+ * @brief Tokens refilled at a fixed rate up to a capacity
+ *
+ * Taking more tokens than the bucket holds is never refused, the bucket goes
+ * into debt instead. A large request is served at once and its sender then
+ * waits until the debt is repaid, so requests larger than the capacity are
+ * throttled but never starved. Not thread safe.
+ */
+class TokenBucket {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @param rate Tokens added per second, 0 for a bucket that never runs dry
+     * @param capacity Most tokens the bucket holds, it starts out full
+     */
+    TokenBucket(double rate, double capacity);
+
+    /**
+     * @brief Take tokens, going into debt if there are not enough
+     */
+    void take(double tokens, Clock::time_point now);
+
+    /**
+     * @brief When the bucket is out of debt, now if it is not in debt
+     */
+    Clock::time_point ready_at(Clock::time_point now);
+
+  private:
+    void refill(Clock::time_point now);
+
+    double m_rate;
+    double m_capacity;
+    double m_tokens;
+    Clock::time_point m_updated;
+};
+
+/**
+ * Throttling one client, or the connections of one tenant, went through
+ */
+struct ThrottleStats {
+    // Times the client's next request was held back
+    uint64_t throttles = 0;
+    // Time its requests were held back in total
+    std::chrono::nanoseconds throttled{0};
+};
+
+/**
+ * @class ClientQuota
+ * @brief Buckets charged with the requests and bytes of one connection
+ *
+ * Every request takes an op and the bytes received and sent for it from the
+ * client's buckets and from those of its tenant, which its other
+ * connections share. Once any of them is in debt the connection is not read
+ * until it is repaid, so TCP flow control holds the sender back while other
+ * clients keep their share of workers and disk. Charging is thread safe.
+ */
+class ClientQuota {
+  public:
+    using Clock = TokenBucket::Clock;
+
+    /**
+     * @brief Charge a request or its bytes
+     * @param ops Requests to charge, 0 for bytes of one already counted
+     * @param bytes Bytes received or sent for it
+     */
+    void charge(uint64_t ops, uint64_t bytes);
+
+    /**
+     * @brief When the next request of the client may be read, now if it may
+     *        be read right away
+     */
+    Clock::time_point ready_at();
+
+    /**
+     * @brief Record that reading the client's next request was held back
+     */
+    void record_throttle(Clock::duration waited);
+
+    ThrottleStats get_stats() const;
+
+    uint32_t client_id() const
+    {
+        return m_client_id;
+    }
+
+    const std::string &tenant() const
+    {
+        return m_tenant->name;
+    }
+
+  private:
+    friend class RateLimiter;
+
+    struct Buckets {
+        explicit Buckets(const RateLimit &limit);
+
+        TokenBucket ops;
+        TokenBucket bytes;
+    };
+
+    // Buckets of every connection from one tenant
+    struct Tenant {
+        Tenant(std::string tenant_name, const RateLimit &limit)
+            : name(std::move(tenant_name)), buckets(limit)
+        {
+        }
+
+        std::string name;
+        std::mutex mutex;
+        Buckets buckets;
+        ThrottleStats stats;
+    };
+
+    ClientQuota(uint32_t client_id,
+                const RateLimit &limit,
+                std::shared_ptr<Tenant> tenant,
+                common::Histogram &throttle_seconds);
+
+    const uint32_t m_client_id;
+    mutable std::mutex m_mutex;
+    Buckets m_buckets;
+    ThrottleStats m_stats;
+    std::shared_ptr<Tenant> m_tenant;
+    common::Histogram *m_throttle_seconds;
+};
+
+/**
+ * @class RateLimiter
+ * @brief Hands out the quotas of connections and their tenants
+ *
+ * A tenant is whoever connects from one address, its buckets live as long
+ * as one of its connections does. Throttling is exported as one histogram
+ * over all clients, per-tenant numbers stay in get_tenant_stats() as
+ * addresses are too many to label metrics with.
+ */
+class RateLimiter {
+  public:
+    /**
+     * @param per_client Limits of every connection
+     * @param per_tenant Limits shared by the connections of a tenant
+     */
+    RateLimiter(const RateLimit &per_client, const RateLimit &per_tenant);
+
+    RateLimiter(const RateLimiter &) = delete;
+    RateLimiter &operator=(const RateLimiter &) = delete;
+
+    /**
+     * @brief Quota of a new connection
+     * @param client_id ID of the connection
+     * @param tenant Tenant it belongs to, its remote address
+     */
+    std::shared_ptr<ClientQuota> open(uint32_t client_id,
+                                      const std::string &tenant);
+
+    /**
+     * @brief Throttling of the connections that are still open
+     */
+    std::unordered_map<uint32_t, ThrottleStats> get_stats();
+
+    /**
+     * @brief Throttling of the tenants with a connection still open, by
+     *        address
+     */
+    std::unordered_map<std::string, ThrottleStats> get_tenant_stats();
+
+  private:
+    const RateLimit m_per_client;
+    const RateLimit m_per_tenant;
+    common::Histogram *m_throttle_seconds;
+    std::mutex m_mutex;
+    std::unordered_map<std::string, std::weak_ptr<ClientQuota::Tenant>>
+        m_tenants;
+    std::unordered_map<uint32_t, std::weak_ptr<ClientQuota>> m_clients;
+    size_t m_sweep_at{64};
+};
+
+} // namespace server
+} // namespace fenris
+
+#endif // FENRIS_SERVER_RATE_LIMITER_HPP
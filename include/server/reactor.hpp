@@ -0,0 +1,273 @@
+#ifndef FENRIS_SERVER_REACTOR_HPP
+#define FENRIS_SERVER_REACTOR_HPP
+
+#include "common/buffer.hpp"
+#include "common/logging.hpp"
+#include "server/connection_manager.hpp"
+#include "server/thread_pool.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace fenris {
+namespace server {
+
+/**
+ * Stages a client connection goes through inside the reactor
+ */
+enum class ConnectionState {
+    RECV_PUBLIC_KEY, // Waiting for the client's ECDH public key
+    SEND_PUBLIC_KEY, // Writing our public key back to the client
+    RECV_REQUEST,    // Waiting for an encrypted request frame
+    PROCESSING,      // Request handed to a worker thread
+    SEND_RESPONSE,   // Writing the encrypted response frame
+    CLOSED           // Connection is finished and awaiting cleanup
+};
+
+/**
+ * Result of pumping a non-blocking socket
+ */
+enum class IoStatus {
+    COMPLETE,  // The whole frame was read or written
+    PENDING,   // The socket would block, wait for the next readiness event
+    FAILED,    // Peer disconnected or the socket reported an error
+    PAUSED     // The memory budget has no room for the frame yet
+};
+
+/**
+ * @struct Connection
+ * @brief Per-socket state machine driven by the reactor
+ *
+ * Buffers are only allocated while a frame is in flight and are released as
+ * soon as it completes, so an idle connection costs a few hundred bytes.
+ */
+struct Connection {
+    ClientInfo info;
+    ConnectionState state{ConnectionState::RECV_PUBLIC_KEY};
+    int epoll_fd{-1};
+    bool keep_connection{true};
+
+    // Incoming frame: 4-byte length prefix, the IV (requests only) and the
+    // payload, each received straight into its own buffer
+    uint8_t header[sizeof(uint32_t)]{};
+    std::vector<uint8_t> in_iv;
+    size_t header_received{0}; // Counts the prefix and the IV
+    common::Buffer in_buffer;
+    size_t in_received{0};
+    // Memory budget share of the incoming request, taken before its body is
+    // read and returned once it was answered
+    MemoryBudget::Lease lease;
+
+    // Outgoing frame: length prefix, IV and payload written with one sendmsg
+    uint8_t out_header[sizeof(uint32_t)]{};
+    std::vector<uint8_t> out_iv;
+    common::Buffer out_buffer;
+    size_t out_sent{0};
+};
+
+/**
+ * @class Reactor
+ * @brief epoll based event loop multiplexing every client socket
+ *
+ * A fixed number of I/O threads each own an epoll instance. Accepted sockets
+ * are spread across them round-robin and drive the key exchange and request
+ * framing without blocking. Fully decoded requests are handed to the shared
+ * ThreadPool that runs the ClientHandler, so slow requests never stall an I/O
+ * thread. Every socket is registered with EPOLLONESHOT which guarantees that
+ * only one thread touches a connection at any time.
+ */
+class Reactor {
+  public:
+    /**
+     * @brief Constructor
+     * @param manager Connection manager providing crypto and request handling
+     * @param io_threads Number of epoll loops to run
+     * @param thread_pool Pool running the client handler, must outlive stop()
+     * @param logger_name Name for the reactor's logger
+     */
+    Reactor(ConnectionManager &manager,
+            size_t io_threads,
+            ThreadPool &thread_pool,
+            const std::string &logger_name = "ServerReactor");
+
+    /**
+     * @brief Destructor, stops all threads and closes remaining connections
+     */
+    ~Reactor();
+
+    Reactor(const Reactor &) = delete;
+    Reactor &operator=(const Reactor &) = delete;
+
+    /**
+     * @brief Start the I/O threads
+     * @return true if every epoll loop was created, false otherwise
+     */
+    bool start();
+
+    /**
+     * @brief Stop all threads and close every connection still registered
+     */
+    void stop();
+
+    /**
+     * @brief Stop holding connections back for their quota
+     *
+     * Wakes every loop through its eventfd so throttled connections are read
+     * right away and see the end of file ConnectionManager::drain() shut
+     * them down with.
+     */
+    void drain();
+
+    /**
+     * @brief Pin each I/O thread to a core of its own, call after start()
+     * @param first_core Core of the first loop, the others follow in order
+     * and wrap around
+     * @return true if every loop was pinned
+     */
+    bool pin_to_cores(size_t first_core = 0);
+
+    /**
+     * @brief Take ownership of an accepted client socket
+     * @param client_socket Socket descriptor returned by accept()
+     * @param client_id Unique identifier for the client
+     * @param address Remote address of the client
+     * @param loop_index Loop to serve it, taken modulo the number of loops,
+     * or nullopt to take turns
+     * @return true if the socket was registered, false otherwise
+     */
+    bool add_connection(int client_socket,
+                        uint32_t client_id,
+                        const std::string &address,
+                        std::optional<size_t> loop_index = std::nullopt);
+
+    /**
+     * @brief Get number of connections currently owned by the reactor
+     * @return Number of registered connections
+     */
+    size_t get_connection_count() const;
+
+  private:
+    struct Throttled {
+        Connection *connection;
+        ClientQuota::Clock::time_point since;
+        ClientQuota::Clock::time_point until;
+    };
+
+    struct EventLoop {
+        int epoll_fd{-1};
+        int wake_fd{-1};
+        std::thread thread;
+        // Connections waiting for the memory budget, left unarmed so the
+        // loop stops reading them. Only touched by the loop's thread.
+        std::vector<Connection *> paused;
+        // Connections whose quota is overdrawn, left unarmed until they may
+        // be read again. Only touched by the loop's thread.
+        std::vector<Throttled> throttled;
+    };
+
+    /**
+     * @brief Read the frames of paused connections the budget now has room
+     * for
+     */
+    void resume_paused(EventLoop &loop);
+
+    /**
+     * @brief Interrupt a loop's epoll_wait through its eventfd
+     */
+    void wake(EventLoop &loop);
+
+    /**
+     * @brief Read the connections whose quota refilled
+     */
+    void resume_throttled(EventLoop &loop);
+
+    /**
+     * @brief epoll_wait timeout in milliseconds that wakes the loop for its
+     * paused and throttled connections, -1 if it has none
+     */
+    int wait_timeout(const EventLoop &loop) const;
+
+    void run_event_loop(EventLoop &loop);
+
+    /**
+     * @brief Advance a connection after epoll reported it ready
+     * @param loop Loop the connection belongs to
+     * @param connection Connection the event belongs to
+     * @param events Event mask returned by epoll_wait
+     */
+    void
+    handle_event(EventLoop &loop, Connection &connection, uint32_t events);
+
+    /**
+     * @brief Handle a fully received frame according to connection state
+     */
+    void handle_frame(Connection &connection);
+
+    /**
+     * @brief Run the client handler for a decoded request on a worker thread
+     */
+    void process_request(Connection &connection,
+                         fenris::Request request,
+                         common::RequestTrace &trace);
+
+    /**
+     * @brief Try to flush the outgoing frame, arming EPOLLOUT if it blocks
+     */
+    void flush(Connection &connection);
+
+    /**
+     * @brief Stage an outgoing frame made of an optional IV and a payload
+     */
+    void queue_frame(Connection &connection,
+                     std::vector<uint8_t> iv,
+                     common::Buffer payload);
+
+    IoStatus read_frame(Connection &connection);
+    IoStatus write_frame(Connection &connection);
+
+    /**
+     * @brief Re-arm the one-shot registration for the given events
+     */
+    bool arm(Connection &connection, uint32_t events);
+
+    void close_connection(Connection &connection);
+
+    /**
+     * @brief Queue a decoded request on the thread pool
+     * @return false if the pool refused the task
+     */
+    bool submit(Connection &connection,
+                fenris::Request request,
+                common::RequestTrace trace);
+
+    ConnectionManager &m_manager;
+    size_t m_io_thread_count;
+    ThreadPool &m_thread_pool;
+    common::Logger m_logger;
+    std::atomic<bool> m_running{false};
+    std::atomic<bool> m_draining{false};
+
+    std::vector<std::unique_ptr<EventLoop>> m_loops;
+    std::atomic<size_t> m_next_loop{0};
+
+    // Requests handed to the pool that have not finished yet
+    size_t m_in_flight{0};
+    std::mutex m_in_flight_mutex;
+    std::condition_variable m_in_flight_cv;
+
+    std::unordered_map<uint32_t, std::unique_ptr<Connection>> m_connections;
+    mutable std::mutex m_connection_mutex;
+};
+
+} // namespace server
+} // namespace fenris
+
+#endif // FENRIS_SERVER_REACTOR_HPP
@@ -0,0 +1,138 @@
+#ifndef FENRIS_SERVER_READAHEAD_HPP
+#define FENRIS_SERVER_READAHEAD_HPP
+
+#include "common/file_operations.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace fenris {
+namespace common {
+class Counter;
+}
+
+namespace server {
+
+/**
+ * When and how far a ReadaheadTracker reads ahead
+ */
+struct ReadaheadConfig {
+    // Reads in a row at the head of a stream before it is read ahead
+    uint32_t trigger_reads = 2;
+
+    // Bounds of the window read ahead of a stream
+    uint64_t min_window = 1024 * 1024;
+    uint64_t max_window = 64 * 1024 * 1024;
+
+    // The window covers this long at the rate the client reads, so slow
+    // disks stay ahead of fast clients
+    std::chrono::milliseconds lead_time{500};
+
+    // Streams tracked at once, the one read least recently is forgotten
+    size_t max_streams = 4096;
+};
+
+/**
+ * Counters of a ReadaheadTracker
+ */
+struct ReadaheadStats {
+    // Reads continuing a stream and reads elsewhere in a file
+    uint64_t sequential_reads = 0;
+    uint64_t random_reads = 0;
+    // Prefetches asked for and their bytes
+    uint64_t prefetches = 0;
+    uint64_t prefetched_bytes = 0;
+};
+
+/**
+ * @class ReadaheadTracker
+ * @brief Spots clients reading a file front to back and says what to
+ *        prefetch for them
+ *
+ * Each connection's reads of each file form a stream. A read near the head of
+ * its stream, where the last one ended give or take a window so pipelined
+ * requests finishing out of order still count, continues it; any other
+ * read starts the stream over. Once trigger_reads reads continued a stream,
+ * a window past its head is prefetched into the page cache, and prefetched
+ * again whenever less than half of it is left, so one read in several asks
+ * the disk for more.
+ *
+ * The window follows the client: it is sized to cover lead_time at the rate
+ * the stream was read so far, averaged over its reads, within min_window
+ * and max_window. Thread safe.
+ */
+class ReadaheadTracker {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit ReadaheadTracker(const ReadaheadConfig &config = {});
+
+    ReadaheadTracker(const ReadaheadTracker &) = delete;
+    ReadaheadTracker &operator=(const ReadaheadTracker &) = delete;
+
+    /**
+     * @brief Note a read and decide what to prefetch with it
+     * @param client Connection reading, its streams last until forget()
+     * @param path Path of the file read
+     * @param offset Byte offset of the read
+     * @param length Bytes asked for
+     * @param now Time of the read
+     * @return Range to prefetch, of length 0 for none
+     */
+    common::Prefetch on_read(uint32_t client,
+                             const std::string &path,
+                             uint64_t offset,
+                             uint64_t length,
+                             Clock::time_point now = Clock::now());
+
+    /**
+     * @brief Drop the streams of a connection that closed, before its key
+     * can name another one
+     */
+    void forget(uint32_t client);
+
+    ReadaheadStats get_stats() const;
+
+    const ReadaheadConfig &config() const
+    {
+        return m_config;
+    }
+
+  private:
+    struct Stream {
+        // Where the next read is expected
+        uint64_t head = 0;
+        // Reads continuing the stream
+        uint32_t reads = 0;
+        uint64_t window = 0;
+        // End of what was prefetched so far
+        uint64_t prefetched = 0;
+        // Bytes per second the stream was read at
+        double rate = 0;
+        Clock::time_point last_read;
+    };
+
+    using Key = std::pair<uint32_t, std::string>;
+
+    // Make room for a new stream; caller holds the lock
+    void evict();
+
+    const ReadaheadConfig m_config;
+    // Ordered by client, so its streams are adjacent
+    std::map<Key, Stream> m_streams;
+    ReadaheadStats m_stats;
+    mutable std::mutex m_mutex;
+
+    common::Counter *m_prefetches_total;
+    common::Counter *m_prefetched_bytes_total;
+};
+
+} // namespace server
+} // namespace fenris
+
+#endif // FENRIS_SERVER_READAHEAD_HPP
@@ -1,9 +1,489 @@
 #ifndef FENRIS_SERVER_REQUEST_MANAGER_HPP
 #define FENRIS_SERVER_REQUEST_MANAGER_HPP
 
+#include "common/file_operations.hpp"
+#include "common/logging.hpp"
+#include "fenris.pb.h"
+#include "server/async_file_io.hpp"
+#include "server/cache_manager.hpp"
+#include "server/chunk_store.hpp"
+#include "server/connection_manager.hpp"
+#include "server/durable_writer.hpp"
+#include "server/metadata_cache.hpp"
+#include "server/readahead.hpp"
+#include "server/thread_pool.hpp"
+#include "server/tiering.hpp"
+#include "server/tree_walker.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
 namespace fenris {
 namespace server {
 
+/**
+ * @class RequestManager
+ * @brief Serves client requests from a directory on the local file system
+ *
+ * Every client sees the root directory as "/" and has its own working
+ * directory, paths are resolved lexically and can never climb above the root.
+ * Large files are served through READ_CHUNK / WRITE_CHUNK so that neither side
+ * has to hold more than one block of a file in memory, and READ_RANGE /
+ * WRITE_AT give random access to parts of a file.
+ */
+class RequestManager : public ClientHandler {
+  public:
+    /**
+     * @brief Constructor
+     * @param root_directory Directory exposed to clients as "/"
+     * @param logger_name Name for this request manager's logger
+     */
+    explicit RequestManager(
+        const std::string &root_directory,
+        const std::string &logger_name = "ServerRequestManager");
+
+    std::pair<fenris::Response, bool>
+    handle_request(uint32_t client_socket,
+                   const fenris::Request &request) override;
+
+    std::pair<fenris::Response, bool>
+    handle_request_with_progress(uint32_t client_socket,
+                                 const fenris::Request &request,
+                                 const ProgressSink &progress) override;
+
+    std::optional<std::string>
+    stream_path(uint32_t client_socket,
+                const fenris::Request &request) override;
+
+    std::optional<std::pair<fenris::Response, common::Buffer>>
+    file_content(uint32_t client_socket,
+                 const fenris::Request &request) override;
+
+    /**
+     * @brief Forget the working directory and read streams of a client that
+     * went away, closing the directory's handle
+     */
+    void client_disconnected(uint32_t client_socket) override;
+
+    /**
+     * @brief Make WRITE_FILE and APPEND_FILE durable before replying
+     *
+     * Writes then replace files atomically and share their disk flushes, see
+     * DurableWriter. Must be called before requests are handled.
+     *
+     * @param enabled Whether to flush writes, off by default
+     * @param config Commit window and batch size
+     */
+    void set_durable_writes(bool enabled,
+                            const DurableWriteConfig &config = {});
+
+    /**
+     * @brief Serve INFO_FILE and LIST_DIR from a MetadataCache
+     *
+     * Requests that change files drop the entries they affect, changes made
+     * by other processes are picked up by watching the root. Must be called
+     * before requests are handled.
+     *
+     * @param enabled Whether to cache metadata, off by default
+     * @param config TTL and entry limit
+     */
+    void set_metadata_cache(bool enabled,
+                            const MetadataCacheConfig &config = {});
+
+    /**
+     * @brief Serve READ_FILE content from a CacheManager
+     *
+     * READ_CHUNK and READ_RANGE are sliced out of files the cache holds,
+     * other ranges are read from disk without loading the whole file.
+     * Requests that change files drop the entries they affect, changes made
+     * by other processes are picked up by watching the root. Streamed reads
+     * bypass the cache, sendfile() already serves them from the page cache.
+     * Must be called before requests are handled.
+     *
+     * @param enabled Whether to cache content, off by default
+     * @param config Byte budget, shards and eviction policy
+     */
+    void set_content_cache(bool enabled, const CacheConfig &config = {});
+
+    /**
+     * @brief Load the files below a directory into the content cache
+     *
+     * Files are read by a TreeWalker until the cache's byte budget is used
+     * up, so the first clients after a restart do not all miss. Does nothing
+     * without a content cache.
+     *
+     * @param directory Client path of the directory, "/" for the whole root
+     * @return Number of files loaded
+     */
+    size_t warm_content_cache(const std::string &directory = "/");
+
+    /**
+     * @brief Get hit and miss counts of the content cache
+     */
+    CacheStats get_content_cache_stats() const;
+
+    /**
+     * @brief Keep the content of written files in a ChunkStore
+     *
+     * WRITE_FILE content of at least ChunkStoreConfig::min_file_size bytes is
+     * stored as chunks shared with every other file holding the same bytes.
+     * The tree keeps a sparse placeholder of the same size in its place, so
+     * listings and file infos are unchanged, and reads of the file are served
+     * from the store. Requests that change part of a file first write its
+     * content back into the tree. Must be called before requests are
+     * handled.
+     *
+     * @param enabled Whether to deduplicate, off by default
+     * @param directory Directory of the store, outside the root
+     * @param config Chunk sizes and cache budget
+     * @return false if the store could not be opened, writes then stay plain
+     */
+    bool set_chunk_store(bool enabled,
+                         const std::string &directory = "",
+                         const ChunkStoreConfig &config = {});
+
+    /**
+     * @brief Move rarely read files to a cold tier
+     *
+     * Files are moved to a DirectoryObjectStore and back by a TieringEngine,
+     * which leaves placeholders in the tree the way the chunk store does.
+     * Reads of a moved file are served from the store and bring it back,
+     * requests that change part of it first restore it. Must be called
+     * before requests are handled.
+     *
+     * @param enabled Whether to tier, off by default
+     * @param directory Directory of the cold tier, outside the root
+     * @param config Thresholds and scan interval
+     * @return false if the directory could not be set up, files then stay
+     * in the tree
+     */
+    bool set_storage_tiering(bool enabled,
+                             const std::string &directory = "",
+                             const TieringConfig &config = {});
+
+    /**
+     * @brief Move cold files now rather than at the next scan
+     * @return Number of files moved, 0 without tiering
+     */
+    size_t demote_cold_files();
+
+    /**
+     * @brief Get file counts and moves of the cold tier
+     */
+    TieringStats get_tiering_stats() const;
+
+    /**
+     * @brief Prefetch ahead of clients reading files chunk by chunk
+     *
+     * A ReadaheadTracker watches READ_CHUNK requests, and once a client
+     * reads a file in order the next window of it is prefetched into the
+     * page cache along with each read. Chunks served from the chunk store
+     * or the cold tier are not prefetched. Must be called before requests
+     * are handled.
+     *
+     * @param enabled Whether to read ahead, off by default
+     * @param config Trigger and window bounds
+     */
+    void set_readahead(bool enabled, const ReadaheadConfig &config = {});
+
+    /**
+     * @brief Get sequential and random chunk reads and prefetches
+     */
+    ReadaheadStats get_readahead_stats() const;
+
+    /**
+     * @brief Read and write file content through an AsyncFileIo
+     *
+     * READ_FILE and READ_CHUNK / READ_RANGE reads that reach the disk, and
+     * plain WRITE_FILE and APPEND_FILE writes, are queued on one io_uring
+     * shared by every worker, which submits the operations of all of them
+     * with one system call. Paths are resolved against the client's open
+     * directory as usual. The worker handling a request still waits for its
+     * operation, replies are unchanged. Durable writes and the chunk store
+     * and cold tier keep their own I/O. Must be called before requests are
+     * handled.
+     *
+     * @param enabled Whether to use the ring, off by default
+     * @param config Backend and ring sizing
+     */
+    void set_async_io(bool enabled, const AsyncIoConfig &config = {});
+
+    /**
+     * @brief Set the threads DU, COPY_TREE, DELETE_TREE and FIND walk trees
+     * with
+     *
+     * The threads form one pool shared by every client, a walk borrows all
+     * of them and waits for its turn while others hold them. Call before
+     * requests are served.
+     *
+     * @param threads Number of threads, 0 selects the number of cores
+     */
+    void set_tree_threads(size_t threads);
+
+    /**
+     * @brief Map a client path onto the local file system
+     * @param client_socket Socket of the client, selects its working directory
+     * @param path Absolute or relative path as sent by the client
+     * @return Local path below the root directory
+     */
+    std::filesystem::path resolve_path(uint32_t client_socket,
+                                       const std::string &path);
+
+  private:
+    fenris::Response handle_ping(const fenris::Request &request);
+    fenris::Response handle_create_file(uint32_t client_socket,
+                                        const fenris::Request &request);
+
+    /**
+     * @brief Read a file for READ_FILE without copying it into the response
+     * @return The response with an empty data field, and the file content
+     * (empty for errors and unchanged files)
+     */
+    std::pair<fenris::Response, common::Buffer>
+    handle_read_file(uint32_t client_socket, const fenris::Request &request);
+
+    fenris::Response handle_write_file(uint32_t client_socket,
+                                       const fenris::Request &request);
+    fenris::Response handle_append_file(uint32_t client_socket,
+                                        const fenris::Request &request);
+    fenris::Response handle_delete_file(uint32_t client_socket,
+                                        const fenris::Request &request);
+    fenris::Response handle_info_file(uint32_t client_socket,
+                                      const fenris::Request &request);
+    fenris::Response handle_create_dir(uint32_t client_socket,
+                                       const fenris::Request &request);
+    fenris::Response handle_list_dir(uint32_t client_socket,
+                                     const fenris::Request &request);
+    fenris::Response handle_change_dir(uint32_t client_socket,
+                                       const fenris::Request &request);
+    fenris::Response handle_delete_dir(uint32_t client_socket,
+                                       const fenris::Request &request);
+
+    /**
+     * @brief Serve one block of a file, for READ_CHUNK and READ_RANGE alike
+     *
+     * The block starts at chunk().offset and is at most chunk().length bytes
+     * long (DEFAULT_CHUNK_SIZE if unset, clamped to MAX_CHUNK_SIZE). The reply
+     * carries the bytes in data and the file's total size in chunk_info, the
+     * final flag is set once the block reaches the end of the file.
+     */
+    fenris::Response handle_read_chunk(uint32_t client_socket,
+                                       const fenris::Request &request);
+
+    /**
+     * @brief Store one block of a file at chunk().offset
+     *
+     * A block at offset 0 creates or truncates the file, later blocks must
+     * follow an earlier one.
+     */
+    fenris::Response handle_write_chunk(uint32_t client_socket,
+                                        const fenris::Request &request);
+
+    /**
+     * @brief Overwrite bytes of an existing file at chunk().offset
+     *
+     * Unlike WRITE_CHUNK the file is never created or truncated, so a few
+     * bytes can be patched in place without rewriting the rest.
+     */
+    fenris::Response handle_write_at(uint32_t client_socket,
+                                     const fenris::Request &request);
+
+    /**
+     * @brief Describe a file by the signatures of its blocks
+     *
+     * chunk().length picks the block size, clamped to the bounds of
+     * common::delta::block_size_for(), which chooses it when unset.
+     */
+    fenris::Response handle_signatures(uint32_t client_socket,
+                                       const fenris::Request &request);
+
+    /**
+     * @brief Rebuild a file from a delta against its signatures
+     *
+     * The new content is written next to the file and renamed over it once
+     * it matches the delta's hash, so a failed patch leaves the old file as
+     * it was. A file that changed since the signatures were taken is not
+     * touched.
+     */
+    fenris::Response handle_patch_file(uint32_t client_socket,
+                                       const fenris::Request &request);
+
+    /**
+     * @brief Run DU, COPY_TREE, DELETE_TREE or FIND
+     *
+     * The tree is walked on the shared tree pool, see TreeWalker. Files may
+     * move between tiers during the walk, the tiers are only held while
+     * chunks and cold files are accounted for afterwards. With a progress
+     * sink, TREE_PROGRESS responses with the totals so far are sent every
+     * tree().progress_interval_ms, and a failed send stops the walk.
+     *
+     * @param progress Sink for TREE_PROGRESS responses, null for none
+     */
+    fenris::Response handle_tree(uint32_t client_socket,
+                                 const fenris::Request &request,
+                                 const ProgressSink *progress);
+
+    /**
+     * @brief Give the copies of stored files their own manifests
+     *
+     * A COPY_TREE copies only the placeholders of files in the chunk store,
+     * their manifests are linked to the copied paths here.
+     *
+     * @param from Client path of the copied directory
+     * @param to Client path of the copy
+     */
+    void link_copied_chunks(const std::string &from, const std::string &to);
+
+    /**
+     * @brief Fill in the copies of files in the cold tier
+     *
+     * A COPY_TREE copies only the placeholders of cold files, their content
+     * is written into the copies here, which start out hot.
+     *
+     * @param from Client path of the copied directory
+     * @param to Client path of the copy
+     */
+    void copy_cold_files(const std::string &from, const std::string &to);
+
+    /**
+     * @brief Keep files from moving between tiers for the rest of a request
+     */
+    std::shared_lock<std::shared_mutex> hold_tiers();
+
+    fenris::Response make_success(fenris::ResponseType type,
+                                  const std::string &data = "");
+    fenris::Response make_error(const std::string &message);
+    fenris::Response make_error(common::FileOperationResult result);
+
+    // Client path resolved against an open directory
+    struct ResolvedPath {
+        std::shared_ptr<const common::DirectoryHandle> directory;
+        // Relative to directory, "." for the directory itself
+        std::string path;
+    };
+
+    // Working directory of a client, kept open while the client is in it
+    struct ClientDirectory {
+        std::string path = "/";
+        // Null for the root, which has its own handle
+        std::shared_ptr<const common::DirectoryHandle> handle;
+    };
+
+    /**
+     * @brief Resolve a client path relative to the deepest open directory
+     *
+     * Paths below the client's working directory are looked up from its
+     * handle, everything else from the root's, so the kernel only walks the
+     * components the client actually named.
+     */
+    ResolvedPath resolve_at(uint32_t client_socket, const std::string &path);
+
+    /**
+     * @brief Read a whole file, through the AsyncFileIo if there is one
+     */
+    std::pair<common::Buffer, common::FileOperationResult>
+    read_content(const ResolvedPath &resolved);
+
+    /**
+     * @brief Read a byte range of a file, through the AsyncFileIo if there is
+     * one, see DirectoryHandle::read_file_range()
+     */
+    std::pair<common::Buffer, common::FileOperationResult>
+    read_range(const ResolvedPath &resolved,
+               uint64_t offset,
+               size_t length,
+               uint64_t &file_size,
+               const common::Prefetch &prefetch);
+
+    /**
+     * @brief Write or append to a file, through the AsyncFileIo if there is
+     * one
+     */
+    common::FileOperationResult write_content(const ResolvedPath &resolved,
+                                              const std::string &data,
+                                              bool append);
+
+    /**
+     * @brief Drop the cached metadata and content a successful request made
+     * stale
+     */
+    void invalidate_caches(uint32_t client_socket,
+                           const fenris::Request &request);
+
+    /**
+     * @brief Drop the cached content of the files a request changed
+     */
+    void invalidate_content(uint32_t client_socket,
+                            const fenris::Request &request);
+
+    /**
+     * @brief Manifest of a file whose content is in the chunk store
+     * @param key Path of the file as normalize_client_path() spells it
+     * @param file_info Info of the file's placeholder in the tree
+     */
+    std::optional<fenris::ChunkManifest>
+    find_manifest(const std::string &key, const fenris::FileInfo &file_info);
+
+    /**
+     * @brief Record of a file whose content is in the cold tier
+     * @param key Path of the file as normalize_client_path() spells it
+     * @param file_info Info of the file's placeholder in the tree
+     */
+    std::optional<fenris::TieredFile>
+    find_tiered(const std::string &key, const fenris::FileInfo &file_info);
+
+    /**
+     * @brief Store WRITE_FILE content as chunks behind a placeholder
+     */
+    common::FileOperationResult store_chunked(uint32_t client_socket,
+                                              const fenris::Request &request);
+
+    /**
+     * @brief Write a file kept in the chunk store or the cold tier back into
+     * the tree
+     *
+     * Called before a request changes part of a file or reads it directly.
+     * Plain files are left alone.
+     */
+    common::FileOperationResult materialize(uint32_t client_socket,
+                                            const std::string &filename);
+
+    /**
+     * @brief Drop the manifests and cold copies a successful request made
+     * stale
+     */
+    void release_chunks(uint32_t client_socket,
+                        const fenris::Request &request);
+
+    /**
+     * @brief Working directory of a client, "/" until it changes directory
+     */
+    ClientDirectory current_directory(uint32_t client_socket);
+
+    std::filesystem::path m_root;
+    std::shared_ptr<const common::DirectoryHandle> m_root_handle;
+    std::unique_ptr<DurableWriter> m_durable_writer;
+    std::unique_ptr<MetadataCache> m_metadata_cache;
+    std::unique_ptr<CacheManager> m_content_cache;
+    size_t m_content_cache_bytes{0};
+    std::unique_ptr<ChunkStore> m_chunk_store;
+    std::unique_ptr<TieringEngine> m_tiering;
+    std::unique_ptr<ReadaheadTracker> m_readahead;
+    std::unique_ptr<AsyncFileIo> m_async_io;
+    // Threads every tree walk runs on, see set_tree_threads()
+    std::unique_ptr<ThreadPool> m_tree_pool;
+    std::unordered_map<uint32_t, ClientDirectory> m_directories;
+    std::mutex m_directories_mutex;
+    common::Logger m_logger;
+};
+
 } // namespace server
 } // namespace fenris
 
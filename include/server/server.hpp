@@ -1,13 +1,171 @@
 #ifndef FENRIS_SERVER_HPP
 #define FENRIS_SERVER_HPP
 
+#include "common/logging.hpp"
+#include "server/cache_manager.hpp"
+#include "server/connection_manager.hpp"
+#include "server/metrics_endpoint.hpp"
+
+#include <chrono>
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace fenris {
 namespace server {
 
+class RequestManager;
+
+/**
+ * Runtime settings of a Server, filled in from the command line
+ */
+struct ServerConfig {
+    std::string host = "0.0.0.0";
+    std::string port = "5555";
+
+    // Directory exposed to clients as "/"
+    std::string root = ".";
+
+    // Multiplex clients on the epoll reactor instead of a thread each
+    bool reactor = false;
+
+    // Reactor event loops and request workers, 0 for the number of cores
+    size_t io_threads = 0;
+    size_t worker_threads = 0;
+
+    // Listening sockets sharing the port, each with its own accept thread,
+    // 0 for one per core. See ConnectionManager::set_acceptors().
+    size_t acceptors = 1;
+
+    // Length of each accept queue
+    int listen_backlog = DEFAULT_LISTEN_BACKLOG;
+
+    // Share the port with other server processes, see
+    // ConnectionManager::set_reuse_port()
+    bool reuse_port = false;
+
+    // Pin workers and event loops to cores
+    bool cpu_affinity = false;
+
+    // Largest request a client may send, larger ones close the connection
+    size_t max_message_size = DEFAULT_MAX_MESSAGE_SIZE;
+
+    // Request bytes held in memory across all clients before reading pauses,
+    // 0 for no limit
+    size_t memory_budget = 1024 * 1024 * 1024;
+
+    // Requests and bytes per second each connection, and all connections
+    // from one address, may use. See ConnectionManager::set_rate_limits().
+    RateLimit client_limit;
+    RateLimit tenant_limit;
+
+    // Bytes of file content cached for READ_FILE, 0 to read every time
+    size_t cache_bytes = 256 * 1024 * 1024;
+
+    // Client paths of directories loaded into the content cache on start
+    std::vector<std::string> preload;
+
+    // Cache file infos and listings
+    bool metadata_cache = true;
+
+    // Directory of a ChunkStore deduplicating written files, empty for none
+    std::string chunk_store;
+
+    // Directory of the cold tier rarely read files move to, empty to keep
+    // every file in the tree. See RequestManager::set_storage_tiering().
+    std::string cold_tier;
+
+    // How long a file goes unread before it moves to the cold tier
+    std::chrono::seconds cold_after{std::chrono::hours(24)};
+
+    // Bytes of files kept in the tree, the least read move out beyond it, 0
+    // for no limit
+    uint64_t hot_tier_bytes = 0;
+
+    // Prefetch ahead of clients reading files chunk by chunk in order
+    bool readahead = true;
+
+    // Threads walking trees for DU, COPY_TREE, DELETE_TREE and FIND, shared
+    // by all clients, 0 for the number of cores
+    size_t tree_threads = 0;
+
+    // Read and write file content through io_uring, see
+    // RequestManager::set_async_io()
+    bool async_io = false;
+
+    // Flush writes to disk before replying
+    bool durable_writes = false;
+
+    // Offer CAPABILITY_PLAINTEXT_FILE_STREAM, trusted networks only
+    bool plaintext_file_streaming = false;
+
+    // Port of the HTTP endpoint serving Prometheus metrics on host, empty
+    // to serve none
+    std::string metrics_port;
+
+    // File sampled request traces are written to in the Chrome trace event
+    // format, empty to trace nothing
+    std::string trace_file;
+
+    // Trace one request in this many, requests a client traces always are
+    uint32_t trace_sample_rate = 100;
+
+    // How long stop() lets requests in flight finish before it disconnects
+    // their clients, 0 to disconnect them right away
+    std::chrono::milliseconds drain_timeout{10000};
+};
+
+/**
+ * @class Server
+ * @brief A file server on one address, put together from a ServerConfig
+ *
+ * Serves the root directory through a RequestManager behind a
+ * ConnectionManager, with the protocol features that cost clients nothing
+ * unless they ask for them switched on: session tickets, pipelining, read
+ * leases, sealed file streams and compression.
+ */
+class Server {
+  public:
+    /**
+     * @brief Constructor
+     * @param config Runtime settings
+     * @param logger_name Name for the server's logger
+     */
+    explicit Server(const ServerConfig &config,
+                    const std::string &logger_name = "fenris_server");
+
+    ~Server();
+
+    /**
+     * @brief Warm the caches and start accepting clients
+     * @return false if the server could not listen on its address
+     */
+    bool start();
+
+    /**
+     * @brief Stop listening and disconnect every client, once its request
+     *        in flight was answered or the drain timeout ran out
+     */
+    void stop();
+
+    bool is_running() const;
+
+    size_t get_active_client_count() const;
+
+    /**
+     * @brief Get hit and miss counts of the content cache
+     */
+    CacheStats get_content_cache_stats() const;
+
+  private:
+    ServerConfig m_config;
+    std::unique_ptr<ConnectionManager> m_connection_manager;
+    std::unique_ptr<MetricsEndpoint> m_metrics_endpoint;
+    // Owned by m_connection_manager
+    RequestManager *m_request_manager{nullptr};
+    common::Logger m_logger;
+};
 
 } // namespace server
 } // namespace fenris
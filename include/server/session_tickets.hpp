@@ -0,0 +1,69 @@
+#ifndef FENRIS_SERVER_SESSION_TICKETS_HPP
+#define FENRIS_SERVER_SESSION_TICKETS_HPP
+
+#include "common/crypto_manager.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace fenris {
+namespace server {
+
+/**
+ * How long a session ticket can be redeemed after it was issued. Past
+ * sessions can be decrypted by whoever learns a ticket's secret while it is
+ * valid, so this bounds how long a resumed connection goes without forward
+ * secrecy.
+ */
+constexpr std::chrono::seconds DEFAULT_TICKET_LIFETIME{3600};
+
+/**
+ * @class TicketKeeper
+ * @brief Issues and redeems the session tickets of CAPABILITY_SESSION_TICKET
+ *
+ * A ticket is a fenris::SessionTicket sealed with AES-GCM under a key the
+ * keeper draws when it is created, preceded by its IV. The server keeps no
+ * per-ticket state: anything that opens under the key and has not expired is
+ * redeemed. Tickets do not survive the keeper, so a restarted server sends
+ * its clients back to a full key exchange.
+ *
+ * issue() and redeem() are safe to call from several threads at once.
+ */
+class TicketKeeper {
+  public:
+    /**
+     * @brief Constructor
+     * @param lifetime How long each ticket stays valid
+     */
+    explicit TicketKeeper(
+        std::chrono::seconds lifetime = DEFAULT_TICKET_LIFETIME);
+
+    /**
+     * @brief Seal a resumption secret into a ticket
+     * @param resumption_secret Secret from derive_resumption_secret()
+     * @return The ticket, or std::nullopt if it could not be sealed
+     */
+    std::optional<std::vector<uint8_t>>
+    issue(const std::vector<uint8_t> &resumption_secret) const;
+
+    /**
+     * @brief Open a ticket presented by a client
+     * @param ticket The ticket as received
+     * @return The resumption secret, or std::nullopt if the ticket was not
+     * issued by this keeper or has expired
+     */
+    std::optional<std::vector<uint8_t>>
+    redeem(std::span<const uint8_t> ticket) const;
+
+  private:
+    std::chrono::seconds m_lifetime;
+    std::vector<uint8_t> m_key;
+};
+
+} // namespace server
+} // namespace fenris
+
+#endif // FENRIS_SERVER_SESSION_TICKETS_HPP
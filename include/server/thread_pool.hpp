@@ -0,0 +1,211 @@
+#ifndef FENRIS_SERVER_THREAD_POOL_HPP
+#define FENRIS_SERVER_THREAD_POOL_HPP
+
+#include "common/logging.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace fenris {
+namespace server {
+
+/**
+ * Scheduling class of a task submitted to the thread pool
+ */
+enum class TaskPriority {
+    HIGH,  // Short requests (PING, INFO_FILE) that must not queue behind I/O
+    NORMAL // Everything else
+};
+
+/**
+ * Flow a NORMAL task is fairly queued under, see ThreadPool
+ */
+struct FairShare {
+    // Tasks with the same flow compete with each other, not with other flows
+    uint64_t flow;
+    // Estimated work of the task, in bytes
+    uint64_t cost;
+    // Flows of weight 2 get twice the work of flows of weight 1 done
+    uint32_t weight = 1;
+};
+
+/**
+ * Pin a thread to one CPU core
+ *
+ * @param thread Thread to pin
+ * @param core Index of the core, taken modulo the number of cores
+ * @return true if the affinity was set
+ */
+bool pin_thread_to_core(std::thread &thread, size_t core);
+
+/**
+ * @class ThreadPool
+ * @brief Bounded work-stealing executor for client request dispatch
+ *
+ * Every worker owns a deque. Tasks submitted from outside the pool are spread
+ * round-robin across the deques, tasks submitted by a worker go to its own
+ * deque. An idle worker first drains the shared high priority lane, then its
+ * own deque, and finally steals from the back of its siblings' deques.
+ *
+ * NORMAL tasks submitted with a FairShare skip the deques and go to a fair
+ * lane instead, which workers drain before stealing. The lane runs
+ * start-time fair queueing: a task's start tag is the later of the lane's
+ * virtual time and the finish tag of its flow's previous task, and tasks
+ * run in order of their start tags. A flow that just ran a large task is
+ * thereby pushed back by the cost of that task, so bulk transfers get their
+ * share of the workers without delaying small requests of other flows.
+ */
+class ThreadPool {
+  public:
+    /**
+     * @brief Constructor, starts the worker threads
+     * @param thread_count Number of workers, 0 selects the number of cores
+     * @param logger_name Name for the pool's logger
+     */
+    explicit ThreadPool(size_t thread_count,
+                        const std::string &logger_name = "ServerThreadPool");
+
+    /**
+     * @brief Destructor, runs every queued task and joins the workers
+     */
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /**
+     * @brief Queue a callable for execution on a worker
+     * @param task Callable taking no arguments
+     * @param priority Scheduling class of the task
+     * @param share Flow a NORMAL task is fairly queued under, ignored for
+     * HIGH tasks
+     * @return Future for the callable's result, or an invalid future
+     * (valid() == false) if the pool has been shut down
+     */
+    template <typename F>
+    std::future<std::invoke_result_t<std::decay_t<F>>>
+    submit(F &&task,
+           TaskPriority priority = TaskPriority::NORMAL,
+           std::optional<FairShare> share = std::nullopt)
+    {
+        using Result = std::invoke_result_t<std::decay_t<F>>;
+
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(
+            std::forward<F>(task));
+        std::future<Result> future = packaged->get_future();
+
+        if (!enqueue([packaged]() { (*packaged)(); }, priority, share)) {
+            return {};
+        }
+        return future;
+    }
+
+    /**
+     * @brief Stop accepting tasks, run the queued ones and join the workers
+     */
+    void shutdown();
+
+    /**
+     * @brief Pin each worker to a core of its own
+     * @param first_core Core of the first worker, the others follow in order
+     * and wrap around
+     * @return true if every worker was pinned
+     */
+    bool pin_to_cores(size_t first_core = 0);
+
+    /**
+     * @brief Get number of worker threads
+     * @return Number of workers
+     */
+    size_t get_thread_count() const;
+
+    /**
+     * @brief Get number of tasks queued but not yet started
+     * @return Number of pending tasks
+     */
+    size_t get_pending_count() const;
+
+  private:
+    using Task = std::function<void()>;
+
+    struct WorkQueue {
+        std::deque<Task> tasks;
+        std::mutex mutex;
+    };
+
+    struct FairLane {
+        // Tasks by start tag, ties broken by arrival
+        std::map<std::pair<uint64_t, uint64_t>, Task> tasks;
+        // Finish tag of the last task of every flow not yet behind the
+        // virtual time
+        std::unordered_map<uint64_t, uint64_t> finish_tags;
+        // Start tag of the task started last
+        uint64_t virtual_time{0};
+        uint64_t arrivals{0};
+        // Size of finish_tags at which flows behind the virtual time are
+        // dropped
+        size_t sweep_at{64};
+        std::mutex mutex;
+    };
+
+    /**
+     * @brief Push a type-erased task onto the right queue and wake a worker
+     * @return false if the pool is shutting down
+     */
+    bool enqueue(Task task,
+                 TaskPriority priority,
+                 const std::optional<FairShare> &share);
+
+    /**
+     * @brief Tag a task and queue it on the fair lane
+     */
+    void push_fair(Task task, const FairShare &share);
+
+    /**
+     * @brief Take the task with the earliest start tag off the fair lane
+     */
+    bool pop_fair(Task &task);
+
+    /**
+     * @brief Find the next task for a worker
+     * @param index Index of the calling worker
+     * @param task Receives the task
+     * @return true if a task was found
+     */
+    bool try_pop(size_t index, Task &task);
+
+    void run_worker(size_t index);
+
+    common::Logger m_logger;
+
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+    WorkQueue m_priority_queue;
+    FairLane m_fair_lane;
+    std::atomic<size_t> m_next_queue{0};
+
+    std::vector<std::thread> m_workers;
+    std::atomic<size_t> m_pending{0};
+    bool m_stopping{false};
+    std::mutex m_sleep_mutex;
+    std::condition_variable m_sleep_cv;
+};
+
+} // namespace server
+} // namespace fenris
+
+#endif // FENRIS_SERVER_THREAD_POOL_HPP
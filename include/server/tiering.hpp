@@ -0,0 +1,281 @@
+#ifndef FENRIS_SERVER_TIERING_HPP
+#define FENRIS_SERVER_TIERING_HPP
+
+#include "common/buffer.hpp"
+#include "common/file_operations.hpp"
+#include "common/logging.hpp"
+#include "fenris.pb.h"
+#include "server/object_store.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace fenris {
+namespace common {
+class Counter;
+}
+
+namespace server {
+
+/**
+ * When files move between the local tree and the cold tier
+ */
+struct TieringConfig {
+    // Files neither read nor written for this long move to the cold tier.
+    // Reads are counted with the same half-life.
+    std::chrono::seconds cold_after{std::chrono::hours(24)};
+
+    // Bytes of files the local tree may hold, the least read files beyond
+    // it move early. 0 for no limit.
+    uint64_t hot_bytes = 0;
+
+    // Smaller files are not worth a round trip to the cold tier
+    uint64_t min_file_size = 1024 * 1024;
+
+    // How often the tree is scanned for cold files, 0 to scan only on
+    // demote_cold()
+    std::chrono::seconds scan_interval{std::chrono::minutes(10)};
+
+    // Reads of a cold file, counted with the half-life, after which it moves
+    // back into the tree
+    double promote_reads = 1.0;
+};
+
+/**
+ * Counters of a TieringEngine
+ */
+struct TieringStats {
+    // Files in the cold tier and their bytes
+    uint64_t cold_files = 0;
+    uint64_t cold_bytes = 0;
+    // Files moved to the cold tier and back since start
+    uint64_t demotions = 0;
+    uint64_t promotions = 0;
+    // Reads served from the cold tier
+    uint64_t cold_reads = 0;
+};
+
+/**
+ * @class TieringEngine
+ * @brief Moves rarely read files of a tree to an ObjectStore and back
+ *
+ * The hot tier is the tree itself, on local disk and in the content cache.
+ * A background thread scans it every scan_interval and moves files that
+ * went unread for cold_after, and beyond hot_bytes the least read ones, to
+ * the cold tier: the content is uploaded and the file is replaced by a
+ * sparse placeholder of the same size and modification time, so listings
+ * and file infos do not change. Reads of a placeholder are served from the
+ * store, and once a file was read promote_reads times it is fetched back in
+ * the background, so the reads that follow hit local disk again.
+ *
+ * Below the store, "data/<path>" holds a file's content and "index/<path>"
+ * its TieredFile record. Records are only accepted while the placeholder
+ * has the recorded size and time, a file changed by another process reads
+ * as what it now holds. Records whose placeholder changed are dropped when
+ * the engine starts.
+ *
+ * Requests hold lock_tree() while they touch files, the engine swaps a file
+ * and its placeholder only under the exclusive lock and only if the file was
+ * not accessed since it was picked. Sparse files, among them the
+ * placeholders of a ChunkStore, stay where they are.
+ */
+class TieringEngine {
+  public:
+    /**
+     * @brief Load the records of a store and start the background threads
+     * @param root Local path of the served tree
+     * @param store Cold tier
+     * @param config Thresholds and scan interval
+     * @param logger_name Name for the logger instance
+     */
+    TieringEngine(const std::string &root,
+                  std::unique_ptr<ObjectStore> store,
+                  const TieringConfig &config = TieringConfig{},
+                  const std::string &logger_name = "ServerTiering");
+
+    ~TieringEngine();
+
+    TieringEngine(const TieringEngine &) = delete;
+    TieringEngine &operator=(const TieringEngine &) = delete;
+
+    /**
+     * @brief Keep files from moving between tiers while the lock is held
+     */
+    std::shared_lock<std::shared_mutex> lock_tree();
+
+    /**
+     * @brief Count a read of a file
+     * @param path Path of the file below the root, as clients spell it
+     */
+    void record_access(const std::string &path);
+
+    /**
+     * @brief Look up the record of a file in the cold tier
+     * @param path Path of the file below the root
+     * @param size Size of the file in the tree
+     * @param modified_time FileInfo::modified_time of the file in the tree
+     * @return The record, nullopt if the file is not in the cold tier
+     */
+    std::optional<fenris::TieredFile>
+    find(const std::string &path, uint64_t size, uint64_t modified_time) const;
+
+    /**
+     * @brief Records of every file below a directory
+     * @param directory Path of the directory, without a trailing slash
+     */
+    std::vector<fenris::TieredFile>
+    find_prefix(const std::string &directory) const;
+
+    /**
+     * @brief Read the whole content of a cold file, which may queue it to
+     *        move back
+     * @param file Result of find()
+     * @return Pair of (content, FileOperationResult)
+     */
+    std::pair<common::Buffer, common::FileOperationResult>
+    read(const fenris::TieredFile &file);
+
+    /**
+     * @brief Read a byte range of a cold file, which may queue it to move
+     *        back
+     * @param file Result of find()
+     * @param offset Byte offset of the first byte to read
+     * @param length Maximum number of bytes to read
+     * @return Pair of (range content, FileOperationResult)
+     */
+    std::pair<common::Buffer, common::FileOperationResult>
+    read_range(const fenris::TieredFile &file, uint64_t offset, size_t length);
+
+    /**
+     * @brief Move a cold file back into the tree right away
+     *
+     * Called under lock_tree() before a request changes part of the file.
+     *
+     * @param file Result of find()
+     * @return FileOperationResult indicating success or failure
+     */
+    common::FileOperationResult restore(const fenris::TieredFile &file);
+
+    /**
+     * @brief Write the content of a cold file to another local path
+     * @param file Result of find()
+     * @param path Local path to write, replaced if it exists
+     * @return FileOperationResult indicating success or failure
+     */
+    common::FileOperationResult copy_out(const fenris::TieredFile &file,
+                                         const std::string &path);
+
+    /**
+     * @brief Drop a file from the cold tier, after it was deleted or
+     *        replaced in the tree
+     * @return true if the file was in the cold tier
+     */
+    bool remove(const std::string &path);
+
+    /**
+     * @brief Drop every file below a directory from the cold tier
+     * @param directory Path of the directory, without a trailing slash
+     */
+    void remove_prefix(const std::string &directory);
+
+    /**
+     * @brief Scan the tree and move cold files now
+     * @return Number of files moved to the cold tier
+     */
+    size_t demote_cold();
+
+    /**
+     * @brief Wait until the files queued to move back have moved
+     */
+    void flush();
+
+    TieringStats get_stats() const;
+
+    const TieringConfig &config() const
+    {
+        return m_config;
+    }
+
+  private:
+    // Reads of a file, decayed with the half-life cold_after
+    struct Access {
+        double reads = 0;
+        // FileInfo::modified_time clock
+        uint64_t last = 0;
+    };
+
+    // Reads as of now, for an Access last updated at access.last
+    double decayed_reads(const Access &access, uint64_t now) const;
+
+    // Local path of a client path
+    std::string local_path(const std::string &path) const;
+
+    // Count a cold read and queue the file to move back if it is read often
+    // enough
+    void cold_read(const fenris::TieredFile &file);
+
+    // Move one file to the cold tier if it is unchanged since it was picked
+    bool demote(const std::string &path, uint64_t picked_at);
+
+    // Move a queued file back into the tree
+    void promote(const std::string &path);
+
+    // Drop a record and its objects; caller holds m_mutex
+    void erase(std::map<std::string, fenris::TieredFile>::iterator it);
+
+    // Load the records, drop those whose placeholder changed
+    void load();
+
+    // Background threads: one moves queued files back, one scans
+    void run_promotions();
+    void run_scans();
+
+    std::string m_root;
+    std::unique_ptr<ObjectStore> m_store;
+    TieringConfig m_config;
+
+    // Held shared by requests, exclusively while swapping a file
+    std::shared_mutex m_tree_mutex;
+
+    // Records by client path, ordered so a directory's files are adjacent
+    std::map<std::string, fenris::TieredFile> m_files;
+    std::unordered_map<std::string, Access> m_accesses;
+    TieringStats m_stats;
+    mutable std::mutex m_mutex;
+
+    uint64_t m_cold_bytes{0};
+
+    // Files queued to move back
+    std::deque<std::string> m_promotions;
+    std::unordered_set<std::string> m_queued;
+    bool m_promoting{false};
+    bool m_stopping{false};
+    std::condition_variable m_wakeup;
+    std::condition_variable m_promoted;
+    std::thread m_promoter;
+    std::thread m_scanner;
+
+    common::Counter *m_demotions_total;
+    common::Counter *m_promotions_total;
+    common::Counter *m_cold_reads_total;
+
+    common::Logger m_logger;
+};
+
+} // namespace server
+} // namespace fenris
+
+#endif // FENRIS_SERVER_TIERING_HPP
@@ -0,0 +1,259 @@
+#ifndef FENRIS_SERVER_TREE_WALKER_HPP
+#define FENRIS_SERVER_TREE_WALKER_HPP
+
+#include "common/file_operations.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace fenris {
+namespace server {
+
+/**
+ * Matches a FIND returns when the request sets no limit of its own
+ */
+constexpr size_t MAX_FIND_RESULTS = 100000;
+
+/**
+ * One entry met by a TreeWalker
+ */
+struct TreeEntry {
+    // Directory holding the entry, open for the duration of the visit
+    int parent_fd = -1;
+    // Relative to the root of the walk, the name included
+    std::string path;
+    std::string name;
+    bool is_directory = false;
+    // Size and st_mode from lstat(). Without stat_entries the size is 0 and
+    // the mode only holds the file type.
+    uint64_t size = 0;
+    uint32_t mode = 0;
+    // 1 for the entries of the root itself
+    uint32_t depth = 0;
+};
+
+class ThreadPool;
+
+/**
+ * Options of a TreeWalker
+ */
+struct TreeWalkOptions {
+    // Threads reading directories, 0 for the number of cores or the size of
+    // pool
+    size_t threads = 0;
+
+    // Pool the walk borrows its threads from. Walks sharing a pool queue for
+    // its threads rather than starting their own, so together they never
+    // use more than it has. Without one each walk starts its own threads.
+    ThreadPool *pool = nullptr;
+
+    // lstat() every entry for its size and mode. Otherwise only entries the
+    // directory gives no type for are looked at.
+    bool stat_entries = true;
+
+    // How often walk() calls its tick while it waits, 0 for never
+    std::chrono::milliseconds tick_interval{0};
+};
+
+/**
+ * @class TreeWalker
+ * @brief Walks a directory tree with several threads at once
+ *
+ * Directories waiting to be read sit on a shared stack, and each thread
+ * reads one with getdents64() and pushes the subdirectories it finds. The
+ * threads come from options().pool when one is set.
+ * Taking the newest directory first keeps the stack about as deep as the
+ * tree rather than as wide. Symbolic links are reported as entries but
+ * never followed, so a walk cannot leave the tree or loop.
+ */
+class TreeWalker {
+  public:
+    /**
+     * Called for every entry, from any of the walker's threads at once.
+     * Returning false for a directory skips what is below it.
+     */
+    using Visitor = std::function<bool(const TreeEntry &entry)>;
+
+    /**
+     * Called on the thread running walk() every tick_interval, returning
+     * false cancels the walk
+     */
+    using Tick = std::function<bool()>;
+
+    explicit TreeWalker(const TreeWalkOptions &options = TreeWalkOptions{});
+
+    /**
+     * @brief Visit every entry below a directory
+     *
+     * The root itself is not visited. Blocks until the whole tree was
+     * visited or the walk was cancelled.
+     *
+     * @param root Local path of the directory
+     * @param visitor Called for every entry below root
+     * @param tick Called every tick_interval while waiting
+     * @return FileOperationResult of opening root, INVALID_PATH if it is no
+     * directory. Directories below it that cannot be read are counted in
+     * errors() instead.
+     */
+    common::FileOperationResult walk(const std::string &root,
+                                     const Visitor &visitor,
+                                     const Tick &tick = {});
+
+    /**
+     * @brief Stop the running walk, callable from a visitor
+     */
+    void cancel();
+
+    /**
+     * @brief Whether the last walk was cancelled
+     */
+    bool cancelled() const;
+
+    /**
+     * @brief Directories the last walk could not read
+     */
+    uint64_t errors() const;
+
+    const TreeWalkOptions &options() const
+    {
+        return m_options;
+    }
+
+  private:
+    TreeWalkOptions m_options;
+    std::atomic<bool> m_cancelled{false};
+    std::atomic<uint64_t> m_errors{0};
+};
+
+/**
+ * Running totals of a tree operation, read by progress reports while it runs
+ */
+struct TreeCounters {
+    std::atomic<uint64_t> files{0};
+    std::atomic<uint64_t> directories{0};
+    std::atomic<uint64_t> bytes{0};
+    // Entries that could not be read, copied or deleted
+    std::atomic<uint64_t> errors{0};
+};
+
+/**
+ * Paths found by find_in_tree(), drained by progress reports as they come
+ */
+class TreeMatches {
+  public:
+    /**
+     * @param limit Matches to accept before the search stops
+     */
+    explicit TreeMatches(size_t limit) : m_limit(limit) {}
+
+    /**
+     * @brief Record a match
+     * @return false once the limit was reached and the match dropped
+     */
+    bool add(std::string path);
+
+    /**
+     * @brief Take the matches recorded since the last call
+     */
+    std::vector<std::string> take();
+
+    /**
+     * @brief Whether a match was dropped for the limit
+     */
+    bool truncated() const;
+
+  private:
+    size_t m_limit;
+    size_t m_count{0};
+    bool m_truncated{false};
+    std::vector<std::string> m_pending;
+    mutable std::mutex m_mutex;
+};
+
+/**
+ * Count the files, directories and file bytes below a directory
+ *
+ * @param walker Walker to use
+ * @param root Local path of the directory
+ * @param counters Totals, updated as the walk goes
+ * @param tick Passed on to TreeWalker::walk()
+ * @return FileOperationResult of opening root
+ */
+common::FileOperationResult tree_usage(TreeWalker &walker,
+                                       const std::string &root,
+                                       TreeCounters &counters,
+                                       const TreeWalker::Tick &tick = {});
+
+/**
+ * Find the entries below a directory whose names match a pattern
+ *
+ * @param walker Walker to use
+ * @param root Local path of the directory
+ * @param pattern Shell wildcard pattern, see fnmatch(3)
+ * @param prefix Put in front of the relative paths of matches, e.g. the
+ * client path of root with a trailing slash
+ * @param counters Entries looked at so far
+ * @param matches Receives the prefixed paths of matches, the walk stops
+ * once it is full
+ * @param tick Passed on to TreeWalker::walk()
+ * @return FileOperationResult of opening root
+ */
+common::FileOperationResult find_in_tree(TreeWalker &walker,
+                                         const std::string &root,
+                                         const std::string &pattern,
+                                         const std::string &prefix,
+                                         TreeCounters &counters,
+                                         TreeMatches &matches,
+                                         const TreeWalker::Tick &tick = {});
+
+/**
+ * Copy a directory and everything below it
+ *
+ * Directories are created before anything is copied into them, files are
+ * copied with copy_file_range() so the kernel moves the bytes, and symbolic
+ * links are recreated rather than followed. Other special files are counted
+ * as errors and skipped.
+ *
+ * @param walker Walker to use
+ * @param source Local path of the directory to copy
+ * @param destination Local path of the copy, which must not exist and must
+ * not lie below source
+ * @param counters Entries and bytes copied so far
+ * @param tick Passed on to TreeWalker::walk()
+ * @return FileOperationResult of setting up the copy, errors on single
+ * entries are only counted
+ */
+common::FileOperationResult copy_tree(TreeWalker &walker,
+                                      const std::string &source,
+                                      const std::string &destination,
+                                      TreeCounters &counters,
+                                      const TreeWalker::Tick &tick = {});
+
+/**
+ * Delete a directory and everything below it
+ *
+ * Files are unlinked by the walker threads as they are found, the emptied
+ * directories are removed afterwards, deepest first.
+ *
+ * @param walker Walker to use
+ * @param root Local path of the directory
+ * @param counters Entries and bytes deleted so far
+ * @param tick Passed on to TreeWalker::walk()
+ * @return FileOperationResult of opening root, DIRECTORY_NOT_EMPTY if some
+ * entries could not be deleted or the walk was cancelled
+ */
+common::FileOperationResult delete_tree(TreeWalker &walker,
+                                        const std::string &root,
+                                        TreeCounters &counters,
+                                        const TreeWalker::Tick &tick = {});
+
+} // namespace server
+} // namespace fenris
+
+#endif // FENRIS_SERVER_TREE_WALKER_HPP
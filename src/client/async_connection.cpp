@@ -0,0 +1,226 @@
+#include "client/async_connection.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+
+namespace fenris {
+namespace client {
+
+using namespace common;
+
+namespace {
+
+// How often an idle reader looks up from the socket to see whether it was
+// stopped
+constexpr int READER_POLL_INTERVAL_MS = 50;
+
+ResponseFuture failed_future()
+{
+    std::promise<std::optional<fenris::Response>> promise;
+    promise.set_value(std::nullopt);
+    return promise.get_future();
+}
+
+} // namespace
+
+AsyncConnection::AsyncConnection(ConnectionManager &connection_manager,
+                                 const std::string &logger_name)
+    : m_connection_manager(connection_manager),
+      m_logger(get_logger(logger_name))
+{
+}
+
+AsyncConnection::~AsyncConnection()
+{
+    stop();
+}
+
+bool AsyncConnection::start()
+{
+    if (m_reader.joinable()) {
+        return true;
+    }
+    if (!m_connection_manager.is_connected()) {
+        m_logger->error("cannot start: not connected to server");
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_pending_mutex);
+        m_accepting = true;
+        m_reader_done = false;
+    }
+    m_reader = std::thread(&AsyncConnection::read_responses, this);
+    return true;
+}
+
+void AsyncConnection::stop()
+{
+    {
+        std::lock_guard<std::mutex> send_lock(m_send_mutex);
+        std::lock_guard<std::mutex> lock(m_pending_mutex);
+        m_accepting = false;
+    }
+    if (m_reader.joinable()) {
+        m_reader.join();
+    }
+}
+
+ResponseFuture AsyncConnection::submit(fenris::Request request)
+{
+    std::lock_guard<std::mutex> send_lock(m_send_mutex);
+    {
+        std::lock_guard<std::mutex> lock(m_pending_mutex);
+        if (!m_accepting || m_reader_done) {
+            return failed_future();
+        }
+    }
+
+    if (m_connection_manager.rekey_due(request) && !rekey()) {
+        m_logger->error("failed to rekey before sending request");
+        return failed_future();
+    }
+
+    // Registered first, the response may arrive before send_request returns
+    const uint64_t request_id = m_connection_manager.m_next_request_id++;
+    request.set_request_id(request_id);
+    ResponseFuture future;
+    {
+        std::lock_guard<std::mutex> lock(m_pending_mutex);
+        future = m_pending[request_id].get_future();
+    }
+
+    if (!m_connection_manager.send_request(request)) {
+        std::lock_guard<std::mutex> lock(m_pending_mutex);
+        auto pending = m_pending.find(request_id);
+        if (pending != m_pending.end()) {
+            pending->second.set_value(std::nullopt);
+            m_pending.erase(pending);
+        }
+    }
+    return future;
+}
+
+size_t AsyncConnection::outstanding() const
+{
+    std::lock_guard<std::mutex> lock(m_pending_mutex);
+    return m_pending.size() + (m_rekey.has_value() ? 1 : 0);
+}
+
+bool AsyncConnection::rekey()
+{
+    auto pending = m_connection_manager.prepare_rekey();
+    if (!pending.has_value()) {
+        return false;
+    }
+
+    const uint64_t request_id = m_connection_manager.m_next_request_id++;
+    pending->request.set_request_id(request_id);
+    const fenris::Request request = pending->request;
+    {
+        std::lock_guard<std::mutex> lock(m_pending_mutex);
+        m_rekey = std::move(pending);
+        m_rekey_id = request_id;
+        m_rekey_result.reset();
+    }
+
+    const bool sent = m_connection_manager.send_request(request);
+
+    std::unique_lock<std::mutex> lock(m_pending_mutex);
+    if (!sent) {
+        m_rekey.reset();
+        return false;
+    }
+    m_pending_cv.wait(lock, [this] {
+        return m_rekey_result.has_value() || m_reader_done;
+    });
+    const bool rekeyed = m_rekey_result.value_or(false);
+    m_rekey.reset();
+    m_rekey_result.reset();
+    return rekeyed;
+}
+
+void AsyncConnection::read_responses()
+{
+    const int socket = m_connection_manager.get_server_info().socket;
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(m_pending_mutex);
+            if (!m_accepting && m_pending.empty() && !m_rekey.has_value()) {
+                break;
+            }
+        }
+
+        struct pollfd pfd {};
+        pfd.fd = socket;
+        pfd.events = POLLIN;
+        int ready = poll(&pfd, 1, READER_POLL_INTERVAL_MS);
+        if (ready == 0 || (ready < 0 && errno == EINTR)) {
+            continue;
+        }
+        if (ready < 0) {
+            m_logger->error("failed to wait for responses: {}",
+                            std::strerror(errno));
+            break;
+        }
+
+        auto response = m_connection_manager.receive_response();
+        if (!response.has_value() || !deliver(std::move(response.value()))) {
+            break;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_pending_mutex);
+    m_reader_done = true;
+    fail_outstanding();
+    m_pending_cv.notify_all();
+}
+
+bool AsyncConnection::deliver(fenris::Response response)
+{
+    // Futures resolve with the final answer of a tree request only
+    if (response.type() == fenris::ResponseType::TREE_PROGRESS) {
+        return true;
+    }
+
+    std::lock_guard<std::mutex> lock(m_pending_mutex);
+
+    // Without pipelining the server answers in order, and may not echo IDs
+    uint64_t request_id = response.request_id();
+    if (!m_connection_manager.is_pipelining()) {
+        request_id = m_pending.empty() ? 0 : m_pending.begin()->first;
+        if (m_rekey.has_value() &&
+            (m_pending.empty() || m_rekey_id < request_id)) {
+            request_id = m_rekey_id;
+        }
+    }
+
+    if (m_rekey.has_value() && request_id == m_rekey_id) {
+        // Installed before the next frame is read, which is sealed with it
+        m_rekey_result = m_connection_manager.complete_rekey(*m_rekey,
+                                                             response);
+        m_pending_cv.notify_all();
+        return *m_rekey_result;
+    }
+
+    auto pending = m_pending.find(request_id);
+    if (pending == m_pending.end()) {
+        m_logger->error("response to unknown request {}", request_id);
+        return false;
+    }
+    pending->second.set_value(std::move(response));
+    m_pending.erase(pending);
+    return true;
+}
+
+void AsyncConnection::fail_outstanding()
+{
+    for (auto &pending : m_pending) {
+        pending.second.set_value(std::nullopt);
+    }
+    m_pending.clear();
+}
+
+} // namespace client
+} // namespace fenris
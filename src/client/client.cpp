@@ -1,9 +1,17 @@
 #include "client/client.hpp"
+#include "client/connection_pool.hpp"
+#include "client/file_transfer.hpp"
 #include "client/response_manager.hpp"
+#include "client/striped_transfer.hpp"
 #include "common/logging.hpp"
+#include "common/request.hpp"
+#include "common/tracing.hpp"
+#include <charconv>
 #include <chrono>
+#include <filesystem>
 #include <iostream>
 #include <thread>
+#include <tuple>
 
 namespace fenris {
 namespace client {
@@ -68,6 +76,8 @@ bool Client::connect_to_server()
                        server_ip,
                        server_port);
         m_tui->display_result(true, "connected to server");
+        // A new session starts at the root again
+        m_tui->update_current_directory("/");
     } else {
         m_logger->error("failed to connect to server at {}:{}",
                         server_ip,
@@ -101,6 +111,12 @@ bool Client::process_command(const std::vector<std::string> &command_parts)
         return true;
     }
 
+    if (command_parts[0] == "upload" || command_parts[0] == "download") {
+        process_transfer(command_parts);
+
+        return true;
+    }
+
     auto request_opt = m_request_manager.generate_request(command_parts);
     if (!request_opt.has_value()) {
         m_tui->display_result(false, "Invalid command or arguments");
@@ -108,48 +124,309 @@ bool Client::process_command(const std::vector<std::string> &command_parts)
         return true;
     }
 
-    if (!m_connection_manager->send_request(request_opt.value())) {
-        m_logger->error("failed to send request to server");
-        m_tui->display_result(false, "Failed to send request to server");
+    // Large directories arrive in pages, each is shown as it comes in
+    fenris::Request request = request_opt.value();
+    bool success = false;
+    for (bool first_page = true;; first_page = false) {
+        // Leased content is shown without asking the server
+        auto response_opt = read_cached(request);
+        if (!response_opt.has_value()) {
+            // A traced request carries its trace ID, so the server traces
+            // it too and both sides' spans can be joined
+            RequestTrace trace = Tracer::global().begin();
+            Tracer::global().adopt(
+                trace, 0, fenris::RequestType_Name(request.command()));
+            request.set_trace_id(trace.id());
+            TraceContext trace_context(&trace);
+
+            const auto sent_at = ReadCache::Clock::now();
+            if (!m_connection_manager->send_request(request)) {
+                m_logger->error("failed to send request to server");
+                m_tui->display_result(false,
+                                      "Failed to send request to server");
+
+                return true;
+            }
+
+            response_opt = m_connection_manager->receive_response();
+            // Tree requests report progress until their result comes in
+            while (response_opt.has_value() &&
+                   response_opt->type() == ResponseType::TREE_PROGRESS) {
+                auto lines = m_response_manager.handle_response(*response_opt);
+                for (size_t i = 1; i < lines.size(); ++i) {
+                    m_tui->display_result(true, lines[i]);
+                }
+                response_opt = m_connection_manager->receive_response();
+            }
+            Tracer::global().finish(trace);
+            if (!response_opt.has_value()) {
+                m_logger->error("failed to receive response from server");
+                m_tui->display_result(false,
+                                      "Failed to receive response from server");
+
+                return true;
+            }
+
+            if (!remember_response(request, *response_opt, sent_at)) {
+                // The copy the server confirmed is gone, read it again
+                request.clear_if_modified_since();
+                continue;
+            }
+        }
+
+        const auto &response = response_opt.value();
+        const bool is_listing = response.type() == ResponseType::DIR_LISTING;
+        const bool has_more =
+            is_listing && response.directory_listing().next_cursor() != 0;
+        if (!first_page && is_listing && !has_more &&
+            response.directory_listing().entries_size() == 0) {
+            // The previous page ended exactly at the last entry
+            break;
+        }
 
+        std::vector<std::string> formatted_response =
+            m_response_manager.handle_response(response);
+
+        // Extract success status from the first element (following
+        // ResponseManager convention)
+        success = (formatted_response.size() > 0 &&
+                   formatted_response[0] == "Success");
+
+        // Display formatted results to user
+        for (size_t i = 1; i < formatted_response.size(); ++i) {
+            m_tui->display_result(success, formatted_response[i]);
+        }
+
+        // If no results were returned beyond the status, show a generic
+        // message
+        if (formatted_response.size() <= 1) {
+            m_tui->display_result(success,
+                                  success ? "Operation completed successfully"
+                                          : "Operation failed");
+        }
+
+        if (!has_more) {
+            break;
+        }
+        request.mutable_list()->set_cursor(
+            response.directory_listing().next_cursor());
+    }
+
+    return true;
+}
+
+std::optional<fenris::Response> Client::read_cached(fenris::Request &request)
+{
+    if (request.command() != RequestType::READ_FILE ||
+        !m_connection_manager->has_read_leases()) {
+        return std::nullopt;
+    }
+
+    const std::string path = normalize_client_path(
+        m_tui->get_current_directory(), request.filename());
+    auto cached = m_read_cache.lookup(path);
+    if (!cached.has_value()) {
+        return std::nullopt;
+    }
+    if (!cached->leased) {
+        request.set_if_modified_since(cached->modified_time);
+        return std::nullopt;
+    }
+
+    fenris::Response response;
+    response.set_type(ResponseType::FILE_CONTENT);
+    response.set_success(true);
+    response.set_data(std::move(cached->content));
+    return response;
+}
+
+bool Client::remember_response(const fenris::Request &request,
+                               fenris::Response &response,
+                               ReadCache::Clock::time_point sent_at)
+{
+    std::string directory = m_tui->get_current_directory();
+    if (request.command() != RequestType::READ_FILE) {
+        forget_changes(request, response, directory);
+        if (directory != m_tui->get_current_directory()) {
+            m_tui->update_current_directory(directory);
+        }
         return true;
     }
 
-    auto response_opt = m_connection_manager->receive_response();
-    if (!response_opt.has_value()) {
-        m_logger->error("failed to receive response from server");
-        m_tui->display_result(false, "Failed to receive response from server");
+    const std::string path =
+        normalize_client_path(directory, request.filename());
+    if (!response.success()) {
+        m_read_cache.invalidate(path);
+        return true;
+    }
+    if (response.lease_ms() == 0 || !response.has_file_info()) {
+        return true;
+    }
 
+    const auto expires =
+        sent_at + std::chrono::milliseconds(response.lease_ms());
+    const uint64_t modified_time = response.file_info().modified_time();
+    if (response.not_modified()) {
+        auto content = m_read_cache.renew(path, modified_time, expires);
+        if (!content.has_value()) {
+            return false;
+        }
+        response.set_data(std::move(*content));
         return true;
     }
+    m_read_cache.store(path, response.data(), modified_time, expires);
+    return true;
+}
 
-    const auto &response = response_opt.value();
-    std::vector<std::string> formatted_response =
-        m_response_manager.handle_response(response);
+void Client::forget_changes(const fenris::Request &request,
+                            const fenris::Response &response,
+                            std::string &directory)
+{
+    const std::string path =
+        normalize_client_path(directory, request.filename());
+    switch (request.command()) {
+    case RequestType::PING:
+    case RequestType::READ_FILE:
+    case RequestType::INFO_FILE:
+    case RequestType::LIST_DIR:
+    case RequestType::READ_CHUNK:
+    case RequestType::READ_RANGE:
+    case RequestType::DU:
+    case RequestType::FIND:
+    case RequestType::TERMINATE:
+        return;
+    case RequestType::CHANGE_DIR:
+        if (response.success()) {
+            directory = path;
+        }
+        return;
+    case RequestType::DELETE_DIR:
+    case RequestType::DELETE_TREE:
+        m_read_cache.invalidate_prefix(path);
+        return;
+    case RequestType::COPY_TREE:
+        m_read_cache.invalidate_prefix(
+            normalize_client_path(directory, request.tree().destination()));
+        return;
+    case RequestType::BATCH: {
+        // Later requests of a batch resolve against its cd's
+        const auto &results = response.batch_results().responses();
+        for (int i = 0; i < request.batch().requests_size(); ++i) {
+            forget_changes(request.batch().requests(i),
+                           i < results.size() ? results[i]
+                                              : fenris::Response(),
+                           directory);
+        }
+        return;
+    }
+    default:
+        m_read_cache.invalidate(path);
+        return;
+    }
+}
 
-    // Extract success status from the first element (following ResponseManager
-    // convention)
-    bool success =
-        (formatted_response.size() > 0 && formatted_response[0] == "Success");
+void Client::process_transfer(const std::vector<std::string> &command_parts)
+{
+    if (command_parts.size() < 2) {
+        m_tui->display_result(false, "Invalid command or arguments");
+        return;
+    }
 
-    // Display formatted results to user
-    for (size_t i = 1; i < formatted_response.size(); ++i) {
-        m_tui->display_result(success, formatted_response[i]);
+    // Options come before the source: "--streams N" spreads the transfer
+    // over N sessions of its own, "--delta" sends only what changed in a file
+    // the server already has
+    const bool upload = command_parts[0] == "upload";
+    std::vector<std::string> arguments(command_parts.begin() + 1,
+                                       command_parts.end());
+    size_t streams = 1;
+    bool delta = false;
+    while (!arguments.empty()) {
+        if (upload && arguments[0] == "--delta") {
+            delta = true;
+            arguments.erase(arguments.begin());
+            continue;
+        }
+        if (arguments[0] != "--streams") {
+            break;
+        }
+        const std::string count = arguments.size() > 1 ? arguments[1] : "";
+        auto [end, ec] = std::from_chars(
+            count.data(), count.data() + count.size(), streams);
+        if (ec != std::errc() || end != count.data() + count.size() ||
+            streams == 0 ||
+            streams > MAX_POOL_CONNECTIONS) {
+            m_tui->display_result(false,
+                                  "Streams must be between 1 and " +
+                                      std::to_string(MAX_POOL_CONNECTIONS));
+            return;
+        }
+        arguments.erase(arguments.begin(), arguments.begin() + 2);
+    }
+    if (arguments.empty() || arguments.size() > 2) {
+        m_tui->display_result(false, "Invalid command or arguments");
+        return;
+    }
+    if (delta && streams > 1) {
+        m_tui->display_result(false,
+                              "--delta cannot be combined with --streams");
+        return;
     }
 
-    // If no results were returned beyond the status, show a generic message
-    if (formatted_response.size() <= 1) {
-        m_tui->display_result(success,
-                              success ? "Operation completed successfully"
-                                      : "Operation failed");
+    const std::string &source = arguments[0];
+    // Without an explicit destination keep the file name of the source
+    const std::string destination =
+        arguments.size() > 1
+            ? arguments[1]
+            : std::filesystem::path(source).filename().string();
+
+    auto run = [&](auto &transfer) {
+        auto outcome = upload ? transfer.upload(source, destination)
+                              : transfer.download(source, destination);
+        std::string server_error = transfer.get_server_error();
+        return std::make_tuple(outcome.first, outcome.second, server_error);
+    };
+
+    // Whatever part of it was uploaded, the cached copy is out of date
+    if (upload) {
+        m_read_cache.invalidate(normalize_client_path(
+            m_tui->get_current_directory(), destination));
     }
 
-    // Update current directory if it was a cd command that succeeded
-    if (command_parts[0] == "cd" && success && command_parts.size() > 1) {
-        m_tui->update_current_directory(command_parts[1]);
+    uint64_t bytes = 0;
+    TransferResult result = TransferResult::SUCCESS;
+    std::string server_error;
+    if (streams > 1) {
+        ConnectionPool pool(*m_connection_manager, streams);
+        if (!pool.connect()) {
+            m_tui->display_result(false,
+                                  "Transfer failed: could not open " +
+                                      std::to_string(streams) + " sessions");
+            return;
+        }
+        StripedTransfer transfer(pool);
+        std::tie(bytes, result, server_error) = run(transfer);
+    } else if (delta) {
+        FileTransfer transfer(*m_connection_manager);
+        std::tie(bytes, result) = transfer.delta_upload(source, destination);
+        server_error = transfer.get_server_error();
+    } else {
+        FileTransfer transfer(*m_connection_manager);
+        std::tie(bytes, result, server_error) = run(transfer);
     }
 
-    return true;
+    if (result != TransferResult::SUCCESS) {
+        std::string message = transfer_result_to_string(result);
+        if (!server_error.empty()) {
+            message += ": " + server_error;
+        }
+        m_tui->display_result(false, "Transfer failed: " + message);
+        return;
+    }
+
+    m_tui->display_result(true,
+                          (upload ? "Uploaded " : "Downloaded ") + source +
+                              " to " + destination + " (" +
+                              std::to_string(bytes) + " bytes)");
 }
 
 void Client::run()
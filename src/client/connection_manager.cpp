@@ -1,8 +1,12 @@
 #include "client/connection_manager.hpp"
+#include "common/chunked_aead.hpp"
+#include "common/handshake.hpp"
 #include "common/logging.hpp"
 #include "common/network_utils.hpp"
 #include "common/request.hpp"
 #include "common/response.hpp"
+#include "common/session_resumption.hpp"
+#include "common/tracing.hpp"
 #include "fenris.pb.h"
 
 #include <algorithm>
@@ -11,6 +15,7 @@
 #include <fcntl.h>
 #include <iostream>
 #include <netdb.h>
+#include <span>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -56,6 +61,71 @@ void ConnectionManager::set_non_blocking_mode(bool enabled)
     m_non_blocking_mode = enabled;
 }
 
+void ConnectionManager::set_plaintext_file_streaming(bool enabled)
+{
+    m_plaintext_file_streaming = enabled;
+}
+
+void ConnectionManager::set_sealed_file_streaming(bool enabled)
+{
+    m_sealed_file_streaming = enabled;
+}
+
+void ConnectionManager::set_session_resumption(bool enabled)
+{
+    m_session_resumption = enabled;
+    if (!enabled) {
+        m_session_ticket.clear();
+        m_resumption_secret.clear();
+    }
+}
+
+bool ConnectionManager::has_session_ticket() const
+{
+    return !m_session_ticket.empty();
+}
+
+void ConnectionManager::set_compression(
+    bool enabled, const compress::WireCompressionConfig &config)
+{
+    m_compression = enabled;
+    m_compression_config = config;
+}
+
+void ConnectionManager::set_sequenced_nonces(bool enabled,
+                                             uint64_t rekey_interval)
+{
+    m_sequenced_nonces = enabled;
+    m_rekey_interval = std::max<uint64_t>(rekey_interval, 1);
+}
+
+void ConnectionManager::set_pipelining(bool enabled)
+{
+    m_pipelining = enabled;
+}
+
+bool ConnectionManager::is_pipelining() const
+{
+    return has_capability(m_server_info.capabilities,
+                          fenris::CAPABILITY_PIPELINING);
+}
+
+void ConnectionManager::set_read_leases(bool enabled)
+{
+    m_read_leases = enabled;
+}
+
+bool ConnectionManager::has_read_leases() const
+{
+    return has_capability(m_server_info.capabilities,
+                          fenris::CAPABILITY_READ_LEASES);
+}
+
+uint32_t ConnectionManager::get_capabilities() const
+{
+    return m_server_info.capabilities;
+}
+
 bool ConnectionManager::has_connection_info() const
 {
     return m_has_connection_info;
@@ -64,6 +134,11 @@ bool ConnectionManager::has_connection_info() const
 void ConnectionManager::set_connection_info(const std::string &hostname,
                                             const std::string &port)
 {
+    // Tickets only redeem with the server that issued them
+    if (hostname != m_server_info.address || port != m_server_info.port) {
+        m_session_ticket.clear();
+        m_resumption_secret.clear();
+    }
     m_server_info.address = hostname;
     m_server_info.port = port;
     m_has_connection_info = true;
@@ -160,8 +235,38 @@ void ConnectionManager::reset_connection_info()
     m_has_connection_info = false;
 }
 
+std::unique_ptr<ConnectionManager>
+ConnectionManager::clone_configuration(const std::string &logger_name) const
+{
+    auto clone = std::make_unique<ConnectionManager>(logger_name);
+    if (m_has_connection_info) {
+        clone->set_connection_info(m_server_info.address, m_server_info.port);
+    }
+    clone->m_non_blocking_mode = m_non_blocking_mode;
+    clone->m_plaintext_file_streaming = m_plaintext_file_streaming;
+    clone->m_sealed_file_streaming = m_sealed_file_streaming;
+    clone->m_session_resumption = m_session_resumption;
+    clone->m_compression = m_compression;
+    clone->m_compression_config = m_compression_config;
+    clone->m_sequenced_nonces = m_sequenced_nonces;
+    clone->m_rekey_interval = m_rekey_interval;
+    clone->m_pipelining = m_pipelining;
+    clone->m_read_leases = m_read_leases;
+    return clone;
+}
+
 bool ConnectionManager::perform_key_exchange()
 {
+    if (m_session_resumption && !m_session_ticket.empty()) {
+        auto resumed = resume_session();
+        if (!resumed.has_value()) {
+            return false;
+        }
+        if (*resumed) {
+            return true;
+        }
+    }
+
     auto [private_key, public_key, keygen_result] =
         m_crypto_manager.generate_ecdh_keypair();
     if (keygen_result != ECDHResult::SUCCESS) {
@@ -170,10 +275,12 @@ bool ConnectionManager::perform_key_exchange()
         return false;
     }
 
-    // Send public key to server
-    NetworkResult send_result = send_prefixed_data(m_server_info.socket,
-                                                   public_key,
-                                                   m_non_blocking_mode);
+    // Send public key to server, followed by the capabilities we want
+    const std::optional<fenris::Handshake> handshake = make_handshake();
+    NetworkResult send_result =
+        send_prefixed_data(m_server_info.socket,
+                           encode_key_exchange(public_key, handshake),
+                           m_non_blocking_mode);
     if (send_result != NetworkResult::SUCCESS) {
         m_logger->error("failed to send public key: {}",
                         network_result_to_string(send_result));
@@ -181,10 +288,10 @@ bool ConnectionManager::perform_key_exchange()
     }
 
     // Receive server's public key
-    std::vector<uint8_t> server_public_key;
+    std::vector<uint8_t> server_frame;
 
     NetworkResult recv_result = receive_prefixed_data(m_server_info.socket,
-                                                      server_public_key,
+                                                      server_frame,
                                                       m_non_blocking_mode);
     if (recv_result != NetworkResult::SUCCESS) {
         m_logger->error("failed to receive server public key: {}",
@@ -192,6 +299,185 @@ bool ConnectionManager::perform_key_exchange()
         return false;
     }
 
+    auto key_exchange = decode_key_exchange(server_frame);
+    if (!key_exchange.has_value() || key_exchange->resumption) {
+        m_logger->error("received malformed handshake from server");
+        return false;
+    }
+    const std::vector<uint8_t> &server_public_key = key_exchange->public_key;
+    accept_capabilities(handshake, key_exchange->handshake);
+
+    auto derived_key = derive_session_key(private_key, server_public_key);
+    if (!derived_key.has_value()) {
+        return false;
+    }
+    keep_ticket(key_exchange->handshake, *derived_key);
+    m_server_info.send_nonces.reset();
+    m_server_info.receive_nonces.reset();
+    return install_key(std::move(*derived_key), 0);
+}
+
+std::optional<fenris::Handshake> ConnectionManager::make_handshake() const
+{
+    uint32_t wanted = fenris::CAPABILITY_NONE;
+    if (m_plaintext_file_streaming) {
+        wanted |= fenris::CAPABILITY_PLAINTEXT_FILE_STREAM;
+    }
+    if (m_sealed_file_streaming) {
+        wanted |= fenris::CAPABILITY_SEALED_FILE_STREAM;
+    }
+    if (m_compression) {
+        wanted |= fenris::CAPABILITY_COMPRESSION;
+    }
+    if (m_sequenced_nonces) {
+        wanted |= fenris::CAPABILITY_SEQUENCED_NONCES;
+    }
+    if (m_session_resumption) {
+        wanted |= fenris::CAPABILITY_SESSION_TICKET;
+    }
+    if (m_pipelining) {
+        wanted |= fenris::CAPABILITY_PIPELINING;
+    }
+    if (m_read_leases) {
+        wanted |= fenris::CAPABILITY_READ_LEASES;
+    }
+    if (wanted == fenris::CAPABILITY_NONE) {
+        return std::nullopt;
+    }
+
+    fenris::Handshake handshake;
+    handshake.set_capabilities(wanted);
+    if (m_compression) {
+        handshake.set_codecs(m_compression_config.codecs);
+    }
+    return handshake;
+}
+
+void ConnectionManager::accept_capabilities(
+    const std::optional<fenris::Handshake> &offer,
+    const std::optional<fenris::Handshake> &reply)
+{
+    // Never trust the server with more than we asked for
+    m_server_info.capabilities = 0;
+    if (offer.has_value() && reply.has_value()) {
+        m_server_info.capabilities =
+            reply->capabilities() & offer->capabilities();
+    }
+    m_logger->debug("negotiated capabilities {:#x}",
+                    m_server_info.capabilities);
+    m_server_info.compression.reset();
+    if (has_capability(m_server_info.capabilities,
+                       fenris::CAPABILITY_COMPRESSION)) {
+        const uint32_t codecs = compress::negotiate_codecs(
+            reply->codecs(), m_compression_config.codecs);
+        m_logger->debug("negotiated codecs {:#x}", codecs);
+        m_server_info.compression =
+            std::make_shared<compress::WireCompression>(m_compression_config,
+                                                        codecs);
+    }
+}
+
+void ConnectionManager::keep_ticket(
+    const std::optional<fenris::Handshake> &reply,
+    const std::vector<uint8_t> &session_key)
+{
+    m_session_ticket.clear();
+    m_resumption_secret.clear();
+    if (!has_capability(m_server_info.capabilities,
+                        fenris::CAPABILITY_SESSION_TICKET) ||
+        !reply.has_value() || reply->ticket().empty()) {
+        return;
+    }
+
+    auto [secret, secret_result] = derive_resumption_secret(session_key);
+    if (secret_result != ECDHResult::SUCCESS) {
+        m_logger->warn("failed to derive resumption secret: {}",
+                       ecdh_result_to_string(secret_result));
+        return;
+    }
+    m_session_ticket.assign(reply->ticket().begin(), reply->ticket().end());
+    m_resumption_secret = std::move(secret);
+}
+
+std::optional<bool> ConnectionManager::resume_session()
+{
+    // A ticket is presented once, the server hands out a new one with it
+    const std::vector<uint8_t> ticket = std::move(m_session_ticket);
+    const std::vector<uint8_t> secret = std::move(m_resumption_secret);
+    m_session_ticket.clear();
+    m_resumption_secret.clear();
+
+    auto [client_nonce, nonce_result] =
+        m_crypto_manager.generate_random_bytes(RESUMPTION_NONCE_SIZE);
+    if (nonce_result != EncryptionResult::SUCCESS) {
+        m_logger->warn("failed to generate resumption nonce: {}",
+                       encryption_result_to_string(nonce_result));
+        return false;
+    }
+
+    // Resuming implies asking for the next ticket, so there is a handshake
+    const std::optional<fenris::Handshake> offer = make_handshake();
+    fenris::Handshake frame_handshake = *offer;
+    frame_handshake.set_ticket(ticket.data(), ticket.size());
+    frame_handshake.set_resumption_nonce(client_nonce.data(),
+                                         client_nonce.size());
+    NetworkResult send_result =
+        send_prefixed_data(m_server_info.socket,
+                           encode_resumption(frame_handshake),
+                           m_non_blocking_mode);
+    if (send_result != NetworkResult::SUCCESS) {
+        m_logger->error("failed to send session ticket: {}",
+                        network_result_to_string(send_result));
+        return std::nullopt;
+    }
+
+    std::vector<uint8_t> server_frame;
+    NetworkResult recv_result = receive_prefixed_data(m_server_info.socket,
+                                                      server_frame,
+                                                      m_non_blocking_mode);
+    if (recv_result != NetworkResult::SUCCESS) {
+        m_logger->error("failed to receive resumption reply: {}",
+                        network_result_to_string(recv_result));
+        return std::nullopt;
+    }
+
+    auto reply = decode_key_exchange(server_frame);
+    if (!reply.has_value() || !reply->resumption) {
+        m_logger->error("received malformed resumption reply from server");
+        return std::nullopt;
+    }
+    if (reply->handshake->resumption_nonce().empty()) {
+        m_logger->debug("server refused session ticket");
+        return false;
+    }
+
+    const auto &server_nonce = reply->handshake->resumption_nonce();
+    auto [key, key_result] = derive_resumed_key(
+        secret,
+        client_nonce,
+        {reinterpret_cast<const uint8_t *>(server_nonce.data()),
+         server_nonce.size()});
+    if (key_result != ECDHResult::SUCCESS) {
+        m_logger->error("failed to derive resumed key: {}",
+                        ecdh_result_to_string(key_result));
+        return std::nullopt;
+    }
+
+    accept_capabilities(offer, reply->handshake);
+    keep_ticket(reply->handshake, key);
+    m_server_info.send_nonces.reset();
+    m_server_info.receive_nonces.reset();
+    if (!install_key(std::move(key), 0)) {
+        return std::nullopt;
+    }
+    m_logger->debug("resumed session");
+    return true;
+}
+
+std::optional<std::vector<uint8_t>> ConnectionManager::derive_session_key(
+    const std::vector<uint8_t> &private_key,
+    const std::vector<uint8_t> &server_public_key)
+{
     // Compute shared secret
     auto [shared_secret, ss_result] =
         m_crypto_manager.compute_ecdh_shared_secret(private_key,
@@ -199,7 +485,7 @@ bool ConnectionManager::perform_key_exchange()
     if (ss_result != ECDHResult::SUCCESS) {
         m_logger->error("failed to compute ECDH shared secret: {}",
                         ecdh_result_to_string(ss_result));
-        return false;
+        return std::nullopt;
     }
 
     // Derive encryption key from shared secret
@@ -209,16 +495,108 @@ bool ConnectionManager::perform_key_exchange()
     if (key_derive_result != crypto::ECDHResult::SUCCESS) {
         m_logger->error("Failed to derive encryption key: {}",
                         ecdh_result_to_string(key_derive_result));
+        return std::nullopt;
+    }
+    return std::move(derived_key);
+}
+
+bool ConnectionManager::install_key(std::vector<uint8_t> key, uint32_t epoch)
+{
+    // Key the session once, messages only load their IV from here on
+    auto session = std::make_shared<CryptoSession>();
+    EncryptionResult key_result = session->set_key(key);
+    if (key_result != EncryptionResult::SUCCESS) {
+        m_logger->error("failed to key session: {}",
+                        encryption_result_to_string(key_result));
+        return false;
+    }
+    m_server_info.encryption_key = std::move(key);
+    m_server_info.session = std::move(session);
+
+    if (has_capability(m_server_info.capabilities,
+                       fenris::CAPABILITY_SEQUENCED_NONCES)) {
+        m_server_info.send_nonces = std::make_shared<NonceSequence>(
+            NonceDirection::CLIENT_TO_SERVER, epoch);
+        m_server_info.receive_nonces = std::make_shared<NonceSequence>(
+            NonceDirection::SERVER_TO_CLIENT, epoch);
+    }
+    return true;
+}
+
+bool ConnectionManager::rekey_due(const fenris::Request &request) const
+{
+    return m_server_info.send_nonces &&
+           m_server_info.send_nonces->count() >= m_rekey_interval &&
+           request.command() != fenris::RequestType::REKEY;
+}
+
+std::optional<ConnectionManager::PendingRekey>
+ConnectionManager::prepare_rekey()
+{
+    const uint32_t epoch = m_server_info.send_nonces->epoch() + 1;
+    if (epoch > MAX_NONCE_EPOCH) {
+        m_logger->error("out of key epochs, reconnect to continue");
+        return std::nullopt;
+    }
+
+    auto [private_key, public_key, keygen_result] =
+        m_crypto_manager.generate_ecdh_keypair();
+    if (keygen_result != ECDHResult::SUCCESS) {
+        m_logger->error("failed to generate ECDH key pair: {}",
+                        ecdh_result_to_string(keygen_result));
+        return std::nullopt;
+    }
+
+    // Sent and answered under the old key, like any other request
+    PendingRekey pending;
+    pending.private_key = std::move(private_key);
+    pending.epoch = epoch;
+    pending.request.set_command(fenris::RequestType::REKEY);
+    pending.request.set_data(public_key.data(), public_key.size());
+    return pending;
+}
+
+bool ConnectionManager::complete_rekey(
+    const PendingRekey &pending,
+    const std::optional<fenris::Response> &response)
+{
+    if (!response.has_value() ||
+        response->type() != fenris::ResponseType::REKEYED) {
+        m_logger->error("server did not accept the new key");
         return false;
     }
 
-    // Set the derived key in the crypto manager
-    m_server_info.encryption_key = std::move(derived_key);
+    const std::vector<uint8_t> server_public_key(response->data().begin(),
+                                                 response->data().end());
+    auto derived_key =
+        derive_session_key(pending.private_key, server_public_key);
+    if (!derived_key.has_value() ||
+        !install_key(std::move(*derived_key), pending.epoch)) {
+        return false;
+    }
+    m_logger->debug("rekeyed to epoch {}", pending.epoch);
     return true;
 }
 
+bool ConnectionManager::rekey()
+{
+    auto pending = prepare_rekey();
+    if (!pending.has_value()) {
+        return false;
+    }
+    auto request_id = submit_request(pending->request);
+    if (!request_id.has_value()) {
+        return false;
+    }
+    // The server answers pipelined requests before it switches keys, those
+    // responses are kept for later
+    return complete_rekey(*pending, receive_response_for(*request_id));
+}
+
 void ConnectionManager::disconnect()
 {
+    m_outstanding.clear();
+    m_early_responses.clear();
 
     if (m_server_info.socket != -1) {
         close(m_server_info.socket);
@@ -247,10 +625,41 @@ bool ConnectionManager::send_request(const fenris::Request &request)
         return false;
     }
 
-    std::vector<uint8_t> serialized_request = serialize_request(request);
+    if (rekey_due(request) && !rekey()) {
+        m_logger->error("failed to rekey before sending request");
+        return false;
+    }
 
-    // Generate a random IV
-    auto [iv, iv_gen_result] = m_crypto_manager.generate_random_iv();
+    // Room for the tag behind the request lets it be encrypted where it was
+    // serialized
+    Buffer frame;
+    {
+        TraceScope trace(TraceStage::SERIALIZE);
+        frame = serialize_request_to_buffer(request, AES_GCM_TAG_SIZE);
+        if (frame.size() < AES_GCM_TAG_SIZE) {
+            m_logger->error("failed to serialize request");
+            return false;
+        }
+        if (m_server_info.compression) {
+            auto [compressed, compress_result] =
+                m_server_info.compression->encode(
+                    frame.span().first(frame.size() - AES_GCM_TAG_SIZE),
+                    AES_GCM_TAG_SIZE);
+            if (compress_result != compress::CompressionResult::SUCCESS) {
+                m_logger->error(
+                    "failed to compress request: {}",
+                    compress::compression_result_to_string(compress_result));
+                return false;
+            }
+            frame = std::move(compressed);
+        }
+    }
+
+    // Take the next nonce of the connection, or a random IV from servers
+    // that did not negotiate sequenced nonces
+    auto [iv, iv_gen_result] = m_server_info.send_nonces
+                                   ? m_server_info.send_nonces->next()
+                                   : m_crypto_manager.generate_random_iv();
     if (iv_gen_result != crypto::EncryptionResult::SUCCESS) {
         m_logger->error("failed to generate IV: {}",
                         crypto::encryption_result_to_string(iv_gen_result));
@@ -258,28 +667,24 @@ bool ConnectionManager::send_request(const fenris::Request &request)
     }
 
     // Encrypt the serialized request
-    auto [encrypted_request, encrypt_result] =
-        m_crypto_manager.encrypt_data(serialized_request,
-                                      m_server_info.encryption_key,
-                                      iv);
+    EncryptionResult encrypt_result;
+    {
+        TraceScope trace(TraceStage::ENCRYPT);
+        encrypt_result =
+            m_server_info.session->encrypt_in_place(frame.mutable_span(), iv);
+    }
     if (encrypt_result != crypto::EncryptionResult::SUCCESS) {
         m_logger->error("failed to encrypt request: {}",
                         crypto::encryption_result_to_string(encrypt_result));
         return false;
     }
 
-    // Create the final message with IV prefixed to encrypted data
-    std::vector<uint8_t> message_with_iv;
-    message_with_iv.reserve(iv.size() + encrypted_request.size());
-    message_with_iv.insert(message_with_iv.end(), iv.begin(), iv.end());
-    message_with_iv.insert(message_with_iv.end(),
-                           encrypted_request.begin(),
-                           encrypted_request.end());
-
-    // Send the IV-prefixed encrypted request
-    NetworkResult send_result = send_prefixed_data(m_server_info.socket,
-                                                   message_with_iv,
-                                                   m_non_blocking_mode);
+    // Send the length prefix, IV and encrypted request in one go
+    TraceScope trace(TraceStage::SEND);
+    const std::span<const uint8_t> segments[] = {iv, frame};
+    NetworkResult send_result = send_prefixed_segments(m_server_info.socket,
+                                                       segments,
+                                                       m_non_blocking_mode);
     if (send_result != NetworkResult::SUCCESS) {
         m_logger->error("failed to send encrypted request: {}",
                         network_result_to_string(send_result));
@@ -296,45 +701,218 @@ std::optional<fenris::Response> ConnectionManager::receive_response()
         return std::nullopt;
     }
 
-    // Receive encrypted data (includes IV + encrypted response)
-    std::vector<uint8_t> encrypted_data;
-    NetworkResult recv_result = receive_prefixed_data(m_server_info.socket,
-                                                      encrypted_data,
-                                                      m_non_blocking_mode);
+    // Receive the IV and the encrypted response into separate buffers,
+    // which includes waiting for the server
+    std::vector<uint8_t> iv(AES_GCM_IV_SIZE);
+    Buffer encrypted_response;
+    NetworkResult recv_result;
+    {
+        TraceScope trace(TraceStage::RECEIVE);
+        recv_result = receive_prefixed_segments(m_server_info.socket,
+                                                iv,
+                                                encrypted_response,
+                                                m_non_blocking_mode);
+    }
     if (recv_result != NetworkResult::SUCCESS) {
         m_logger->error("failed to receive response: {}",
                         network_result_to_string(recv_result));
         return std::nullopt;
     }
 
-    if (encrypted_data.size() < AES_GCM_IV_SIZE) {
-        m_logger->error("received data too small to contain IV");
-        return std::nullopt;
+    // Replays are refused before spending time on the ciphertext
+    if (m_server_info.receive_nonces) {
+        EncryptionResult nonce_result =
+            m_server_info.receive_nonces->verify(iv);
+        if (nonce_result != EncryptionResult::SUCCESS) {
+            m_logger->error("rejected IV from server: {}",
+                            encryption_result_to_string(nonce_result));
+            return std::nullopt;
+        }
     }
 
-    // Extract IV from the beginning of the message
-    std::vector<uint8_t> iv(encrypted_data.begin(),
-                            encrypted_data.begin() + AES_GCM_IV_SIZE);
-
-    // Extract the encrypted response data (after the IV)
-    std::vector<uint8_t> encrypted_response(encrypted_data.begin() +
-                                                AES_GCM_IV_SIZE,
-                                            encrypted_data.end());
-
-    // Decrypt the response using the extracted IV
-    auto [decrypted_data, decrypt_result] =
-        m_crypto_manager.decrypt_data(encrypted_response,
-                                      m_server_info.encryption_key,
-                                      iv);
+    // Decrypt the response in the buffer it was received into
+    EncryptionResult decrypt_result;
+    {
+        TraceScope trace(TraceStage::DECRYPT);
+        decrypt_result = m_server_info.session->decrypt_in_place(
+            encrypted_response.mutable_span(), iv);
+    }
 
     if (decrypt_result != crypto::EncryptionResult::SUCCESS) {
         m_logger->error("failed to decrypt response: {}",
                         crypto::encryption_result_to_string(decrypt_result));
         return std::nullopt;
     }
+    if (m_server_info.receive_nonces) {
+        m_server_info.receive_nonces->accept(iv);
+    }
+    Buffer decrypted_data = encrypted_response.slice(
+        0, encrypted_response.size() - AES_GCM_TAG_SIZE);
+
+    fenris::Response response;
+    {
+        TraceScope trace(TraceStage::PARSE);
+        if (m_server_info.compression) {
+            auto [message, decompress_result] =
+                m_server_info.compression->decode(decrypted_data);
+            if (decompress_result != compress::CompressionResult::SUCCESS) {
+                m_logger->error(
+                    "failed to decompress response: {}",
+                    compress::compression_result_to_string(decompress_result));
+                return std::nullopt;
+            }
+            decrypted_data = std::move(message);
+        }
+
+        // Deserialize the response
+        response = deserialize_response(decrypted_data);
+    }
+    if (response.stream_length() > 0 && !receive_stream(response, iv)) {
+        return std::nullopt;
+    }
+
+    return response;
+}
+
+std::optional<uint64_t>
+ConnectionManager::submit_request(fenris::Request request)
+{
+    const uint64_t request_id = m_next_request_id++;
+    request.set_request_id(request_id);
+    if (!send_request(request)) {
+        return std::nullopt;
+    }
+    m_outstanding.insert(request_id);
+    return request_id;
+}
+
+std::optional<fenris::Response>
+ConnectionManager::receive_response_for(uint64_t request_id)
+{
+    m_outstanding.erase(request_id);
+    if (!is_pipelining()) {
+        return receive_response();
+    }
+
+    auto early = m_early_responses.find(request_id);
+    if (early != m_early_responses.end()) {
+        fenris::Response response = std::move(early->second);
+        m_early_responses.erase(early);
+        return response;
+    }
+
+    while (true) {
+        auto response = receive_response();
+        if (!response.has_value() || response->request_id() == request_id) {
+            return response;
+        }
+        if (m_outstanding.erase(response->request_id()) == 0) {
+            m_logger->error("response to unknown request {}",
+                            response->request_id());
+            return std::nullopt;
+        }
+        m_early_responses.emplace(response->request_id(),
+                                  std::move(response.value()));
+    }
+}
+
+bool ConnectionManager::receive_stream(fenris::Response &response,
+                                       std::span<const uint8_t> message_iv)
+{
+    const auto capability = response.stream_sealed()
+                                ? fenris::CAPABILITY_SEALED_FILE_STREAM
+                                : fenris::CAPABILITY_PLAINTEXT_FILE_STREAM;
+    if (!has_capability(m_server_info.capabilities, capability)) {
+        m_logger->error("server streamed content without negotiating it");
+        return false;
+    }
+
+    if (response.stream_sealed()) {
+        auto content =
+            receive_sealed_stream(message_iv, response.stream_length());
+        if (!content.has_value()) {
+            return false;
+        }
+        response.set_data(reinterpret_cast<const char *>(content->data()),
+                          content->size());
+        response.clear_stream_length();
+        response.clear_stream_sealed();
+        return true;
+    }
+
+    Buffer content;
+    NetworkResult recv_result = receive_prefixed_data(m_server_info.socket,
+                                                      content,
+                                                      m_non_blocking_mode);
+    if (recv_result != NetworkResult::SUCCESS) {
+        m_logger->error("failed to receive streamed content: {}",
+                        network_result_to_string(recv_result));
+        return false;
+    }
+
+    if (content.size() != response.stream_length()) {
+        m_logger->error("streamed content is {} bytes, expected {}",
+                        content.size(),
+                        response.stream_length());
+        return false;
+    }
+
+    response.set_data(reinterpret_cast<const char *>(content.data()),
+                      content.size());
+    response.clear_stream_length();
+    return true;
+}
+
+std::optional<Buffer>
+ConnectionManager::receive_sealed_stream(std::span<const uint8_t> message_iv,
+                                         uint32_t length)
+{
+    auto [stream_key, key_result] =
+        derive_stream_key(m_server_info.encryption_key, message_iv);
+    if (key_result != ECDHResult::SUCCESS) {
+        m_logger->error("failed to derive stream key: {}",
+                        ecdh_result_to_string(key_result));
+        return std::nullopt;
+    }
+    const ChunkedAead aead(std::move(stream_key));
+
+    // Chunks are opened in order as they arrive, each one where it was
+    // received; the server does the parallel part
+    Buffer content = Buffer::allocate(length);
+    size_t received = 0;
+    for (uint64_t index = 0; received < length; ++index) {
+        Buffer chunk;
+        NetworkResult recv_result = receive_prefixed_data(
+            m_server_info.socket, chunk, m_non_blocking_mode);
+        if (recv_result != NetworkResult::SUCCESS) {
+            m_logger->error("failed to receive sealed chunk: {}",
+                            network_result_to_string(recv_result));
+            return std::nullopt;
+        }
+        if (chunk.size() <= AES_GCM_TAG_SIZE ||
+            chunk.size() - AES_GCM_TAG_SIZE > length - received) {
+            m_logger->error("sealed chunk {} has invalid size {}",
+                            index,
+                            chunk.size());
+            return std::nullopt;
+        }
+
+        const size_t size = chunk.size() - AES_GCM_TAG_SIZE;
+        const bool last = received + size == length;
+        EncryptionResult open_result =
+            aead.open(index, last, chunk.mutable_span());
+        if (open_result != EncryptionResult::SUCCESS) {
+            m_logger->error("failed to open sealed chunk {}: {}",
+                            index,
+                            encryption_result_to_string(open_result));
+            return std::nullopt;
+        }
+        std::copy_n(
+            chunk.data(), size, content.mutable_span().begin() + received);
+        received += size;
+    }
 
-    // Deserialize the response
-    return deserialize_response(decrypted_data);
+    return content;
 }
 
 } // namespace client
@@ -0,0 +1,71 @@
+#include "client/connection_pool.hpp"
+
+#include <algorithm>
+#include <thread>
+
+namespace fenris {
+namespace client {
+
+using namespace common;
+
+ConnectionPool::ConnectionPool(const ConnectionManager &prototype,
+                               size_t size,
+                               const std::string &logger_name)
+    : m_logger(get_logger(logger_name))
+{
+    size = std::clamp<size_t>(size, 1, MAX_POOL_CONNECTIONS);
+    m_connections.reserve(size);
+    for (size_t i = 0; i < size; ++i) {
+        m_connections.push_back(prototype.clone_configuration(logger_name));
+    }
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    disconnect();
+}
+
+bool ConnectionPool::connect()
+{
+    // Handshakes are round trips, so they overlap rather than queue up
+    std::vector<char> connected(m_connections.size(), 0);
+    std::vector<std::thread> threads;
+    threads.reserve(m_connections.size());
+    for (size_t i = 0; i < m_connections.size(); ++i) {
+        threads.emplace_back([this, &connected, i]() {
+            connected[i] = m_connections[i]->connect() ? 1 : 0;
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    if (std::find(connected.begin(), connected.end(), 0) != connected.end()) {
+        m_logger->error("failed to open {} sessions to the server",
+                        m_connections.size());
+        disconnect();
+        return false;
+    }
+    m_logger->debug("opened {} sessions to the server", m_connections.size());
+    return true;
+}
+
+void ConnectionPool::disconnect()
+{
+    for (auto &connection : m_connections) {
+        connection->disconnect();
+    }
+}
+
+size_t ConnectionPool::size() const
+{
+    return m_connections.size();
+}
+
+ConnectionManager &ConnectionPool::at(size_t index)
+{
+    return *m_connections.at(index);
+}
+
+} // namespace client
+} // namespace fenris
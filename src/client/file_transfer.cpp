@@ -0,0 +1,306 @@
+#include "client/file_transfer.hpp"
+#include "common/delta_sync.hpp"
+#include "common/file_operations.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+namespace fenris {
+namespace client {
+
+using namespace common;
+
+std::string transfer_result_to_string(TransferResult result)
+{
+    switch (result) {
+    case TransferResult::SUCCESS:
+        return "success";
+    case TransferResult::LOCAL_FILE_ERROR:
+        return "local file error";
+    case TransferResult::SEND_ERROR:
+        return "failed to send request";
+    case TransferResult::RECEIVE_ERROR:
+        return "failed to receive response";
+    case TransferResult::SERVER_ERROR:
+        return "server error";
+    case TransferResult::PROTOCOL_ERROR:
+        return "unexpected response from server";
+    default:
+        return "unrecognized error";
+    }
+}
+
+FileTransfer::FileTransfer(ConnectionManager &connection_manager,
+                           size_t chunk_size,
+                           const std::string &logger_name)
+    : m_connection_manager(connection_manager),
+      m_chunk_size(std::clamp<size_t>(chunk_size, 1, MAX_CHUNK_SIZE)),
+      m_logger(get_logger(logger_name))
+{
+}
+
+std::pair<uint64_t, TransferResult>
+FileTransfer::upload(const std::string &local_path,
+                     const std::string &remote_path)
+{
+    m_server_error.clear();
+
+    std::ifstream file(local_path, std::ios::binary);
+    if (!file) {
+        m_logger->error("could not open '{}' for upload", local_path);
+        return {0, TransferResult::LOCAL_FILE_ERROR};
+    }
+
+    // One request is reused for every block, the file is read straight into
+    // its data field
+    fenris::Request request;
+    request.set_command(fenris::RequestType::WRITE_CHUNK);
+    request.set_filename(remote_path);
+    std::string *block = request.mutable_data();
+
+    uint64_t offset = 0;
+    bool final = false;
+    while (!final) {
+        block->resize(m_chunk_size);
+        file.read(block->data(), static_cast<std::streamsize>(m_chunk_size));
+        block->resize(static_cast<size_t>(file.gcount()));
+        if (file.bad()) {
+            m_logger->error("failed reading '{}' at offset {}",
+                            local_path,
+                            offset);
+            return {offset, TransferResult::LOCAL_FILE_ERROR};
+        }
+        final = file.peek() == std::ifstream::traits_type::eof();
+
+        request.mutable_chunk()->set_offset(offset);
+        request.mutable_chunk()->set_length(block->size());
+        request.mutable_chunk()->set_final(final);
+
+        fenris::Response response;
+        TransferResult result = exchange(request, response);
+        if (result != TransferResult::SUCCESS) {
+            return {offset, result};
+        }
+
+        offset += block->size();
+        m_logger->debug("uploaded {} bytes of '{}'", offset, local_path);
+    }
+
+    m_logger->info("uploaded '{}' to '{}' ({} bytes)",
+                   local_path,
+                   remote_path,
+                   offset);
+    return {offset, TransferResult::SUCCESS};
+}
+
+std::pair<uint64_t, TransferResult>
+FileTransfer::delta_upload(const std::string &local_path,
+                           const std::string &remote_path)
+{
+    m_server_error.clear();
+
+    auto [content, read_result] = map_file(local_path);
+    if (read_result != FileOperationResult::SUCCESS) {
+        m_logger->error("could not open '{}' for upload", local_path);
+        return {0, TransferResult::LOCAL_FILE_ERROR};
+    }
+
+    fenris::Request request;
+    request.set_command(fenris::RequestType::SIGNATURES);
+    request.set_filename(remote_path);
+    auto request_id = m_connection_manager.submit_request(request);
+    if (!request_id.has_value()) {
+        m_logger->error("failed to send signatures request");
+        return {0, TransferResult::SEND_ERROR};
+    }
+    auto signatures = m_connection_manager.receive_response_for(*request_id);
+    if (!signatures.has_value()) {
+        m_logger->error("failed to receive signatures");
+        return {0, TransferResult::RECEIVE_ERROR};
+    }
+    // Most likely the file does not exist yet
+    if (!signatures->success() ||
+        signatures->type() != fenris::ResponseType::FILE_SIGNATURES) {
+        m_logger->debug("no signatures of '{}', uploading it whole",
+                        remote_path);
+        return upload(local_path, remote_path);
+    }
+
+    request.Clear();
+    request.set_command(fenris::RequestType::PATCH_FILE);
+    request.set_filename(remote_path);
+    fenris::Delta *delta = request.mutable_delta();
+    *delta = delta::compute_delta(signatures->signatures(), content.span());
+    size_t literal_bytes = 0;
+    for (const auto &op : delta->ops()) {
+        literal_bytes += op.literal().size();
+    }
+    // With this much to send the delta saves nothing, and as one message it
+    // would not be streamed like an upload is
+    if (literal_bytes > MAX_CHUNK_SIZE || literal_bytes >= content.size()) {
+        m_logger->debug("'{}' changed too much for a delta", local_path);
+        return upload(local_path, remote_path);
+    }
+
+    fenris::Response response;
+    TransferResult result = exchange(request, response);
+    if (result == TransferResult::SERVER_ERROR) {
+        // The remote file changed since its signatures were taken
+        m_logger->warn("patching '{}' failed, uploading it whole",
+                       remote_path);
+        return upload(local_path, remote_path);
+    }
+    if (result != TransferResult::SUCCESS) {
+        return {0, result};
+    }
+
+    m_logger->info("patched '{}' from '{}' ({} of {} bytes sent)",
+                   remote_path,
+                   local_path,
+                   literal_bytes,
+                   content.size());
+    return {content.size(), TransferResult::SUCCESS};
+}
+
+std::pair<uint64_t, TransferResult>
+FileTransfer::download(const std::string &remote_path,
+                       const std::string &local_path)
+{
+    m_server_error.clear();
+
+    std::ofstream file(local_path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        m_logger->error("could not open '{}' for download", local_path);
+        return {0, TransferResult::LOCAL_FILE_ERROR};
+    }
+
+    fenris::Request request;
+    request.set_command(fenris::RequestType::READ_CHUNK);
+    request.set_filename(remote_path);
+    request.mutable_chunk()->set_length(m_chunk_size);
+
+    // A single block goes out until the first response tells the file size,
+    // then the window fills up with the blocks after it
+    const size_t depth =
+        m_connection_manager.is_pipelining() ? DEFAULT_PIPELINE_DEPTH : 1;
+    std::deque<std::pair<uint64_t, uint64_t>> in_flight;
+    uint64_t requested = 0;
+    uint64_t total_size = 0;
+    uint64_t offset = 0;
+    bool final = false;
+    while (!final) {
+        while (in_flight.empty() ||
+               (in_flight.size() < depth && requested < total_size)) {
+            request.mutable_chunk()->set_offset(requested);
+            auto request_id = m_connection_manager.submit_request(request);
+            if (!request_id.has_value()) {
+                m_logger->error("failed to send chunk request");
+                abandon(in_flight);
+                return {offset, TransferResult::SEND_ERROR};
+            }
+            in_flight.emplace_back(*request_id, requested);
+            requested += m_chunk_size;
+        }
+
+        const uint64_t request_id = in_flight.front().first;
+        in_flight.pop_front();
+
+        fenris::Response response;
+        TransferResult result = collect(request_id, response);
+        if (result != TransferResult::SUCCESS) {
+            abandon(in_flight);
+            return {offset, result};
+        }
+
+        if (response.type() != fenris::ResponseType::FILE_CHUNK ||
+            !response.has_chunk_info() ||
+            response.chunk_info().offset() != offset) {
+            m_logger->error("unexpected chunk response for '{}'", remote_path);
+            abandon(in_flight);
+            return {offset, TransferResult::PROTOCOL_ERROR};
+        }
+
+        final = response.chunk_info().final();
+        // An empty block that is not final would never make progress
+        if (response.data().empty() && !final) {
+            m_logger->error("empty non-final chunk for '{}'", remote_path);
+            abandon(in_flight);
+            return {offset, TransferResult::PROTOCOL_ERROR};
+        }
+
+        file.write(response.data().data(),
+                   static_cast<std::streamsize>(response.data().size()));
+        if (!file) {
+            m_logger->error("failed writing '{}' at offset {}",
+                            local_path,
+                            offset);
+            abandon(in_flight);
+            return {offset, TransferResult::LOCAL_FILE_ERROR};
+        }
+
+        offset += response.data().size();
+        total_size = response.chunk_info().total_size();
+        // A short block moves every block after it, so those are asked for
+        // again; the same goes for anything past the end
+        if (final || offset != requested - m_chunk_size * in_flight.size()) {
+            abandon(in_flight);
+            requested = offset;
+        }
+        m_logger->debug("downloaded {} of {} bytes of '{}'",
+                        offset,
+                        response.chunk_info().total_size(),
+                        remote_path);
+    }
+
+    m_logger->info("downloaded '{}' to '{}' ({} bytes)",
+                   remote_path,
+                   local_path,
+                   offset);
+    return {offset, TransferResult::SUCCESS};
+}
+
+const std::string &FileTransfer::get_server_error() const
+{
+    return m_server_error;
+}
+
+TransferResult FileTransfer::exchange(const fenris::Request &request,
+                                      fenris::Response &response)
+{
+    auto request_id = m_connection_manager.submit_request(request);
+    if (!request_id.has_value()) {
+        m_logger->error("failed to send chunk request");
+        return TransferResult::SEND_ERROR;
+    }
+    return collect(*request_id, response);
+}
+
+TransferResult FileTransfer::collect(uint64_t request_id,
+                                     fenris::Response &response)
+{
+    auto response_opt = m_connection_manager.receive_response_for(request_id);
+    if (!response_opt.has_value()) {
+        m_logger->error("failed to receive chunk response");
+        return TransferResult::RECEIVE_ERROR;
+    }
+
+    response = std::move(response_opt.value());
+    if (!response.success()) {
+        m_server_error = response.error_message();
+        m_logger->error("server rejected chunk: {}", m_server_error);
+        return TransferResult::SERVER_ERROR;
+    }
+
+    return TransferResult::SUCCESS;
+}
+
+void FileTransfer::abandon(std::deque<std::pair<uint64_t, uint64_t>> &in_flight)
+{
+    for (const auto &pending : in_flight) {
+        m_connection_manager.receive_response_for(pending.first);
+    }
+    in_flight.clear();
+}
+
+} // namespace client
+} // namespace fenris
@@ -13,35 +13,65 @@ TUI::TUI() : curr_dir("/")
 {
     // Initialize valid command prefixes
     valid_commands = {
-        "cd",     // Change directory
-        "ls",     // List directory
-        "cat",    // Display file contents
-        "upload", // Upload file
-        "ping",   // Ping server
-        "write",  // Write to file
-        "append", // Append to file
-        "rm",     // Remove file
-        "info",   // Get file info
-        "mkdir",  // Create directory
-        "rmdir",  // Remove directory
-        "help",   // Display help information
-        "exit"    // Exit client
+        "cd",       // Change directory
+        "ls",       // List directory
+        "cat",      // Display file contents
+        "upload",   // Upload file
+        "download", // Download file
+        "ping",     // Ping server
+        "write",    // Write to file
+        "append",   // Append to file
+        "readat",   // Read part of a file
+        "writeat",  // Overwrite part of a file
+        "rm",       // Remove file
+        "info",     // Get file info
+        "mkdir",    // Create directory
+        "rmdir",    // Remove directory
+        "batch",    // Run a script of commands in one request
+        "du",       // Disk usage of a directory tree
+        "cptree",   // Copy a directory tree
+        "rmtree",   // Remove a directory tree
+        "find",     // Find entries by name
+        "help",     // Display help information
+        "exit"      // Exit client
     };
 
     // Initialize command descriptions for help
     command_descriptions = {
         {"cd", "Change the current directory (cd <directory>)"},
-        {"ls", "List contents of a directory (ls [directory])"},
+        {"ls", "List contents of a directory (ls [-n] [directory])"},
         {"cat", "Display contents of a file (cat <file>)"},
-        {"upload", "Upload a file to the server (upload <local_file>)"},
+        {"upload",
+         "Upload a file to the server (upload [--streams <n> | --delta] "
+         "<local_file> [remote_file])"},
+        {"download",
+         "Download a file from the server (download [--streams <n>] "
+         "<remote_file> [local_file])"},
         {"ping", "Check if server is responsive (ping)"},
         {"write", "Create a new file with content (write <file> <content>)"},
         {"append", "Append content to existing file (append <file> <content>)"},
+        {"readat",
+         "Display part of a file (readat <file> <offset> <length>)"},
+        {"writeat",
+         "Overwrite part of an existing file (writeat <file> <offset> "
+         "<content>)"},
         {"rm", "Remove a file (rm <file>)"},
         {"info", "Display file information (info <file>)"},
         {"mkdir", "Create a new directory (mkdir <directory>)"},
         {"cd", "Change the current directory (cd <directory>)"},
         {"rmdir", "Remove a directory (rmdir <directory>)"},
+        {"batch",
+         "Run the commands of a script file in one round trip, -p lets them "
+         "run in parallel (batch [-p] <script>)"},
+        {"du", "Count the files and bytes below a directory (du <directory>)"},
+        {"cptree",
+         "Copy a directory and everything below it (cptree <source> "
+         "<destination>)"},
+        {"rmtree",
+         "Remove a directory and everything below it (rmtree <directory>)"},
+        {"find",
+         "Find entries below a directory by name, wildcards allowed (find "
+         "<directory> <pattern>)"},
         {"help", "Display available commands (help)"},
         {"exit", "Exit the client (exit)"}};
 }
@@ -152,17 +182,25 @@ bool TUI::validate_command(const std::vector<std::string> &command_parts)
     static const std::unordered_map<std::string, std::pair<size_t, size_t>>
         command_args = {// command -> {min_args, max_args}
                         {"cd", {1, 1}},
-                        {"ls", {0, 1}},
+                        {"ls", {0, 2}},
                         {"cat", {1, 1}},
-                        {"upload", {1, 1}},
+                        {"upload", {1, 4}},
+                        {"download", {1, 4}},
                         {"ping", {0, 0}},
                         {"write", {2, 2}},
                         {"append", {2, 2}},
+                        {"readat", {3, 3}},
+                        {"writeat", {3, 3}},
                         {"rm", {1, 1}},
                         {"info", {1, 1}},
                         {"mkdir", {1, 1}},
                         {"cd", {1, 1}},
                         {"rmdir", {1, 1}},
+                        {"batch", {1, 2}},
+                        {"du", {1, 1}},
+                        {"cptree", {2, 2}},
+                        {"rmtree", {1, 1}},
+                        {"find", {2, 2}},
                         {"help", {0, 0}},
                         {"exit", {0, 0}}};
 
@@ -0,0 +1,94 @@
+#include "client/latency_histogram.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+namespace fenris {
+namespace client {
+
+namespace {
+
+constexpr uint64_t SUB_BUCKETS = uint64_t{1}
+                                 << LatencyHistogram::SUB_BUCKET_BITS;
+
+// Values below 2 * SUB_BUCKETS are counted exactly, every power of two above
+// adds SUB_BUCKETS buckets
+constexpr size_t BUCKET_COUNT =
+    SUB_BUCKETS * (64 - LatencyHistogram::SUB_BUCKET_BITS + 1);
+
+} // namespace
+
+LatencyHistogram::LatencyHistogram() : m_buckets(BUCKET_COUNT, 0) {}
+
+size_t LatencyHistogram::bucket_index(uint64_t value)
+{
+    if (value < 2 * SUB_BUCKETS) {
+        return value;
+    }
+    // Keep the SUB_BUCKET_BITS + 1 highest bits, the leading one picks the
+    // power of two and the rest the sub-bucket
+    const unsigned shift = std::bit_width(value) - (SUB_BUCKET_BITS + 1);
+    const uint64_t mantissa = value >> shift;
+    return SUB_BUCKETS * (shift + 1) + (mantissa - SUB_BUCKETS);
+}
+
+uint64_t LatencyHistogram::bucket_highest(size_t index)
+{
+    if (index < 2 * SUB_BUCKETS) {
+        return index;
+    }
+    const unsigned shift = index / SUB_BUCKETS - 1;
+    const uint64_t mantissa = index % SUB_BUCKETS + SUB_BUCKETS;
+    // For the last bucket the shift overflows to 0 and the subtraction wraps
+    // back to UINT64_MAX
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value)
+{
+    ++m_buckets[bucket_index(value)];
+    ++m_count;
+    m_min = std::min(m_min, value);
+    m_max = std::max(m_max, value);
+    m_sum += value;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    for (size_t index = 0; index < m_buckets.size(); ++index) {
+        m_buckets[index] += other.m_buckets[index];
+    }
+    m_count += other.m_count;
+    m_min = std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+    m_sum += other.m_sum;
+}
+
+uint64_t LatencyHistogram::percentile(double percentile) const
+{
+    if (m_count == 0) {
+        return 0;
+    }
+    percentile = std::clamp(percentile, 0.0, 100.0);
+    const uint64_t rank = std::max<uint64_t>(
+        1,
+        static_cast<uint64_t>(std::ceil(percentile / 100.0 * m_count)));
+
+    uint64_t seen = 0;
+    for (size_t index = 0; index < m_buckets.size(); ++index) {
+        seen += m_buckets[index];
+        if (seen >= rank) {
+            return std::clamp(bucket_highest(index), m_min, m_max);
+        }
+    }
+    return m_max;
+}
+
+double LatencyHistogram::mean() const
+{
+    return m_count == 0 ? 0.0 : static_cast<double>(m_sum / m_count);
+}
+
+} // namespace client
+} // namespace fenris
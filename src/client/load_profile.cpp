@@ -0,0 +1,211 @@
+#include "client/load_profile.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <limits>
+#include <utility>
+
+namespace fenris {
+namespace client {
+
+namespace {
+
+constexpr std::array<LoadOp, LOAD_OP_COUNT> ALL_OPS = {
+    LoadOp::PING, LoadOp::INFO, LoadOp::READ, LoadOp::WRITE, LoadOp::LIST};
+
+std::string_view trim(std::string_view text)
+{
+    while (!text.empty() && std::isspace(static_cast<unsigned char>(text[0]))) {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() &&
+           std::isspace(static_cast<unsigned char>(text.back()))) {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+/**
+ * Split "key:weight,key:weight" into its entries, a missing weight counts
+ * as 1
+ */
+std::optional<std::vector<std::pair<std::string_view, double>>>
+parse_weighted(std::string_view spec)
+{
+    std::vector<std::pair<std::string_view, double>> entries;
+    while (!spec.empty()) {
+        const size_t comma = spec.find(',');
+        std::string_view entry = trim(spec.substr(0, comma));
+        spec = comma == std::string_view::npos ? std::string_view{}
+                                               : spec.substr(comma + 1);
+
+        std::string_view key = entry;
+        double weight = 1.0;
+        const size_t colon = entry.find(':');
+        if (colon != std::string_view::npos) {
+            key = trim(entry.substr(0, colon));
+            std::string_view text = trim(entry.substr(colon + 1));
+            auto [end, error] =
+                std::from_chars(text.data(), text.data() + text.size(), weight);
+            if (error != std::errc() || end != text.data() + text.size() ||
+                !(weight >= 0.0)) {
+                return std::nullopt;
+            }
+        }
+        if (key.empty()) {
+            return std::nullopt;
+        }
+        entries.emplace_back(key, weight);
+    }
+    return entries;
+}
+
+std::optional<size_t> parse_size(std::string_view text)
+{
+    size_t scale = 1;
+    if (!text.empty()) {
+        switch (std::tolower(static_cast<unsigned char>(text.back()))) {
+        case 'k':
+            scale = size_t{1} << 10;
+            break;
+        case 'm':
+            scale = size_t{1} << 20;
+            break;
+        case 'g':
+            scale = size_t{1} << 30;
+            break;
+        }
+        if (scale != 1) {
+            text.remove_suffix(1);
+        }
+    }
+
+    size_t size = 0;
+    auto [end, error] =
+        std::from_chars(text.data(), text.data() + text.size(), size);
+    if (text.empty() || error != std::errc() ||
+        end != text.data() + text.size() ||
+        size > std::numeric_limits<size_t>::max() / scale) {
+        return std::nullopt;
+    }
+    return size * scale;
+}
+
+/**
+ * Index of the entry a uniform draw over the running totals lands on
+ */
+size_t pick_index(const std::vector<double> &cumulative, std::mt19937_64 &rng)
+{
+    std::uniform_real_distribution<double> draw(0.0, cumulative.back());
+    const double point = draw(rng);
+    auto it = std::upper_bound(cumulative.begin(), cumulative.end(), point);
+    return std::min<size_t>(it - cumulative.begin(), cumulative.size() - 1);
+}
+
+} // namespace
+
+std::string_view load_op_name(LoadOp op)
+{
+    switch (op) {
+    case LoadOp::PING:
+        return "ping";
+    case LoadOp::INFO:
+        return "info";
+    case LoadOp::READ:
+        return "read";
+    case LoadOp::WRITE:
+        return "write";
+    case LoadOp::LIST:
+        return "list";
+    }
+    return "unknown";
+}
+
+std::optional<OpMix> OpMix::parse(const std::string &spec)
+{
+    auto entries = parse_weighted(spec);
+    if (!entries) {
+        return std::nullopt;
+    }
+
+    OpMix mix;
+    double total = 0.0;
+    for (const auto &[name, weight] : *entries) {
+        auto op = std::find_if(ALL_OPS.begin(), ALL_OPS.end(), [&](LoadOp op) {
+            return load_op_name(op) == name;
+        });
+        if (op == ALL_OPS.end()) {
+            return std::nullopt;
+        }
+        if (weight == 0.0) {
+            continue;
+        }
+        total += weight;
+        mix.m_ops.push_back(*op);
+        mix.m_cumulative.push_back(total);
+    }
+    if (mix.m_ops.empty()) {
+        return std::nullopt;
+    }
+    return mix;
+}
+
+LoadOp OpMix::pick(std::mt19937_64 &rng) const
+{
+    return m_ops[pick_index(m_cumulative, rng)];
+}
+
+double OpMix::share(LoadOp op) const
+{
+    double weight = 0.0;
+    for (size_t index = 0; index < m_ops.size(); ++index) {
+        if (m_ops[index] == op) {
+            weight += m_cumulative[index] -
+                      (index == 0 ? 0.0 : m_cumulative[index - 1]);
+        }
+    }
+    return weight / m_cumulative.back();
+}
+
+std::optional<SizeDistribution>
+SizeDistribution::parse(const std::string &spec)
+{
+    auto entries = parse_weighted(spec);
+    if (!entries) {
+        return std::nullopt;
+    }
+
+    SizeDistribution distribution;
+    double total = 0.0;
+    for (const auto &[text, weight] : *entries) {
+        auto size = parse_size(text);
+        if (!size) {
+            return std::nullopt;
+        }
+        if (weight == 0.0) {
+            continue;
+        }
+        total += weight;
+        distribution.m_sizes.push_back(*size);
+        distribution.m_cumulative.push_back(total);
+    }
+    if (distribution.m_sizes.empty()) {
+        return std::nullopt;
+    }
+    return distribution;
+}
+
+size_t SizeDistribution::pick(std::mt19937_64 &rng) const
+{
+    return m_sizes[pick_index(m_cumulative, rng)];
+}
+
+size_t SizeDistribution::max() const
+{
+    return *std::max_element(m_sizes.begin(), m_sizes.end());
+}
+
+} // namespace client
+} // namespace fenris
@@ -0,0 +1,607 @@
+#include "client/connection_manager.hpp"
+#include "client/latency_histogram.hpp"
+#include "client/load_profile.hpp"
+#include "common/logging.hpp"
+#include "fenris.pb.h"
+
+#include <algorithm>
+#include <argparse/argparse.hpp>
+#include <array>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <iostream>
+#include <latch>
+#include <memory>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
+
+using fenris::client::ConnectionManager;
+using fenris::client::LatencyHistogram;
+using fenris::client::LOAD_OP_COUNT;
+using fenris::client::LoadOp;
+using fenris::client::OpMix;
+using fenris::client::SizeDistribution;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr const char *LOGGER_NAME = "fenris_loadgen";
+
+struct LoadConfig {
+    std::string host;
+    std::string port;
+    size_t sessions;
+    size_t workers;
+    // Requests per second across all workers, 0 to send as fast as answers
+    // come back
+    double rate;
+    bool poisson;
+    std::chrono::seconds duration;
+    OpMix mix;
+    // Sizes of the files READ and INFO pick from
+    SizeDistribution read_sizes;
+    SizeDistribution write_sizes;
+    size_t files;
+    std::string directory;
+    bool session_resumption;
+};
+
+/**
+ * What one worker measured, merged into the report once all are done
+ */
+struct WorkerResult {
+    LatencyHistogram handshakes;
+    std::array<LatencyHistogram, LOAD_OP_COUNT> requests;
+    std::array<uint64_t, LOAD_OP_COUNT> errors{};
+    uint64_t failed_handshakes = 0;
+    uint64_t bytes_sent = 0;
+    uint64_t bytes_received = 0;
+};
+
+struct Session {
+    std::unique_ptr<ConnectionManager> connection;
+    // File this session's writes go to, so sessions do not contend on one
+    std::string write_path;
+};
+
+uint64_t nanoseconds(Clock::duration duration)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+        .count();
+}
+
+void setup_argument_parser(argparse::ArgumentParser &program)
+{
+    program.add_argument("--host", "-H")
+        .help("Server hostname or IP address")
+        .default_value(std::string("127.0.0.1"));
+
+    program.add_argument("--port", "-p")
+        .help("Server port")
+        .default_value(std::string("5555"));
+
+    program.add_argument("--sessions", "-s")
+        .help("Connections held open for the whole run")
+        .default_value(size_t{1000})
+        .scan<'u', size_t>();
+
+    program.add_argument("--workers", "-w")
+        .help("Threads sending requests, each owning a share of the sessions "
+              "and keeping one request in flight")
+        .default_value(size_t{64})
+        .scan<'u', size_t>();
+
+    program.add_argument("--rate", "-r")
+        .help("Requests per second to start regardless of how fast answers "
+              "come back, 0 for a closed loop")
+        .default_value(1000.0)
+        .scan<'g', double>();
+
+    program.add_argument("--poisson")
+        .help("Space requests at exponentially distributed intervals instead "
+              "of evenly")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--duration", "-d")
+        .help("Seconds to send requests for")
+        .default_value(size_t{30})
+        .scan<'u', size_t>();
+
+    program.add_argument("--mix")
+        .help("Relative weights of ping, info, read, write and list")
+        .default_value(
+            std::string("ping:10,info:20,read:50,write:10,list:10"));
+
+    program.add_argument("--read-sizes")
+        .help("Sizes of the files read, with relative weights")
+        .default_value(std::string("4k:70,64k:25,1m:5"));
+
+    program.add_argument("--write-sizes")
+        .help("Sizes of the files written, with relative weights")
+        .default_value(std::string("4k:80,64k:20"));
+
+    program.add_argument("--files")
+        .help("Files created for reading before the run")
+        .default_value(size_t{64})
+        .scan<'u', size_t>();
+
+    program.add_argument("--dir")
+        .help("Server directory holding the files of the run")
+        .default_value(std::string("loadgen"));
+
+    program.add_argument("--session-resumption")
+        .help("Resume sessions with tickets when reconnecting")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--log-level")
+        .help("Logging level (trace, debug, info, warn, error, critical)")
+        .default_value(std::string("warn"));
+
+    program.add_argument("--log-file")
+        .help("Path to log file")
+        .default_value(std::string("fenris_loadgen.log"));
+
+    program.add_argument("--no-console-log")
+        .help("Disable logging to console")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--file-log")
+        .help("Enable logging to file")
+        .default_value(false)
+        .implicit_value(true);
+}
+
+/**
+ * Parse arguments and handle parsing errors
+ */
+bool parse_arguments(argparse::ArgumentParser &program, int argc, char *argv[])
+{
+    try {
+        program.parse_args(argc, argv);
+        return true;
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << program;
+        return false;
+    }
+}
+
+std::optional<LoadConfig> create_config(const argparse::ArgumentParser &program)
+{
+    auto mix = OpMix::parse(program.get("--mix"));
+    if (!mix) {
+        std::cerr << "Invalid operation mix: " << program.get("--mix")
+                  << std::endl;
+        return std::nullopt;
+    }
+    auto read_sizes = SizeDistribution::parse(program.get("--read-sizes"));
+    auto write_sizes = SizeDistribution::parse(program.get("--write-sizes"));
+    if (!read_sizes || !write_sizes) {
+        std::cerr << "Invalid size distribution" << std::endl;
+        return std::nullopt;
+    }
+
+    LoadConfig config{
+        .host = program.get("--host"),
+        .port = program.get("--port"),
+        .sessions = program.get<size_t>("--sessions"),
+        .workers = program.get<size_t>("--workers"),
+        .rate = program.get<double>("--rate"),
+        .poisson = program.get<bool>("--poisson"),
+        .duration = std::chrono::seconds(program.get<size_t>("--duration")),
+        .mix = std::move(*mix),
+        .read_sizes = std::move(*read_sizes),
+        .write_sizes = std::move(*write_sizes),
+        .files = program.get<size_t>("--files"),
+        .directory = program.get("--dir"),
+        .session_resumption = program.get<bool>("--session-resumption"),
+    };
+    if (config.sessions == 0 || config.workers == 0 || config.files == 0 ||
+        config.rate < 0.0) {
+        std::cerr << "Sessions, workers and files must be positive, the rate "
+                     "must not be negative"
+                  << std::endl;
+        return std::nullopt;
+    }
+    // A worker with no session of its own would have nothing to send on
+    config.workers = std::min(config.workers, config.sessions);
+    return config;
+}
+
+/**
+ * Every session is a socket, allow as many as the hard limit does
+ */
+void raise_descriptor_limit(size_t sessions)
+{
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return;
+    }
+    if (limit.rlim_cur != limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+            getrlimit(RLIMIT_NOFILE, &limit);
+        }
+    }
+    if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < sessions + 64) {
+        std::cerr << "Warning: descriptor limit " << limit.rlim_cur
+                  << " is too low for " << sessions << " sessions"
+                  << std::endl;
+    }
+}
+
+std::unique_ptr<ConnectionManager> make_connection(const LoadConfig &config)
+{
+    auto connection = std::make_unique<ConnectionManager>(
+        config.host, config.port, LOGGER_NAME);
+    connection->set_session_resumption(config.session_resumption);
+    return connection;
+}
+
+std::string file_path(const LoadConfig &config, size_t index)
+{
+    return config.directory + "/f" + std::to_string(index);
+}
+
+std::string random_bytes(size_t size, std::mt19937_64 &rng)
+{
+    std::string bytes(size, '\0');
+    std::uniform_int_distribution<int> byte(0, 255);
+    for (char &c : bytes) {
+        c = static_cast<char>(byte(rng));
+    }
+    return bytes;
+}
+
+bool exchange(ConnectionManager &connection, const fenris::Request &request)
+{
+    if (!connection.send_request(request)) {
+        return false;
+    }
+    auto response = connection.receive_response();
+    return response && response->success();
+}
+
+/**
+ * Create the directory of the run and the files it reads, untimed
+ */
+bool prepare_files(const LoadConfig &config)
+{
+    auto connection = make_connection(config);
+    if (!connection->connect()) {
+        std::cerr << "Could not connect to " << config.host << ":"
+                  << config.port << std::endl;
+        return false;
+    }
+
+    fenris::Request request;
+    request.set_command(fenris::RequestType::CREATE_DIR);
+    request.set_filename(config.directory);
+    // Left over from an earlier run is fine
+    exchange(*connection, request);
+
+    std::mt19937_64 rng(0);
+    const std::string content = random_bytes(config.read_sizes.max(), rng);
+    for (size_t index = 0; index < config.files; ++index) {
+        request.Clear();
+        request.set_command(fenris::RequestType::WRITE_FILE);
+        request.set_filename(file_path(config, index));
+        request.set_data(content.data(), config.read_sizes.pick(rng));
+        if (!exchange(*connection, request)) {
+            std::cerr << "Could not write " << request.filename() << std::endl;
+            return false;
+        }
+    }
+
+    connection->disconnect();
+    return true;
+}
+
+bool connect_session(Session &session, WorkerResult &result)
+{
+    const auto started = Clock::now();
+    if (!session.connection->connect()) {
+        ++result.failed_handshakes;
+        return false;
+    }
+    result.handshakes.record(nanoseconds(Clock::now() - started));
+    return true;
+}
+
+fenris::Request make_request(LoadOp op,
+                             const Session &session,
+                             const std::string &payload,
+                             const LoadConfig &config,
+                             std::mt19937_64 &rng)
+{
+    std::uniform_int_distribution<size_t> file(0, config.files - 1);
+
+    fenris::Request request;
+    switch (op) {
+    case LoadOp::PING:
+        request.set_command(fenris::RequestType::PING);
+        break;
+    case LoadOp::INFO:
+        request.set_command(fenris::RequestType::INFO_FILE);
+        request.set_filename(file_path(config, file(rng)));
+        break;
+    case LoadOp::READ:
+        request.set_command(fenris::RequestType::READ_FILE);
+        request.set_filename(file_path(config, file(rng)));
+        break;
+    case LoadOp::WRITE:
+        request.set_command(fenris::RequestType::WRITE_FILE);
+        request.set_filename(session.write_path);
+        request.set_data(payload.data(), config.write_sizes.pick(rng));
+        break;
+    case LoadOp::LIST:
+        request.set_command(fenris::RequestType::LIST_DIR);
+        request.set_filename(config.directory);
+        break;
+    }
+    return request;
+}
+
+/**
+ * Send one request on a session and time it from when it was due
+ */
+void run_request(Session &session,
+                 Clock::time_point due,
+                 const std::string &payload,
+                 const LoadConfig &config,
+                 std::mt19937_64 &rng,
+                 WorkerResult &result)
+{
+    const LoadOp op = config.mix.pick(rng);
+    const auto slot = static_cast<size_t>(op);
+
+    // A session dropped by an earlier failure gets a fresh handshake, which
+    // counts towards the handshakes and not towards the request
+    if (!session.connection->is_connected() &&
+        !connect_session(session, result)) {
+        ++result.errors[slot];
+        return;
+    }
+
+    const fenris::Request request =
+        make_request(op, session, payload, config, rng);
+    if (!session.connection->send_request(request)) {
+        ++result.errors[slot];
+        session.connection->disconnect();
+        return;
+    }
+    auto response = session.connection->receive_response();
+    const auto finished = Clock::now();
+
+    if (!response) {
+        ++result.errors[slot];
+        session.connection->disconnect();
+        return;
+    }
+    if (!response->success()) {
+        ++result.errors[slot];
+        return;
+    }
+    result.requests[slot].record(nanoseconds(finished - due));
+    result.bytes_sent += request.data().size();
+    result.bytes_received += response->data().size();
+}
+
+/**
+ * Connect a worker's sessions, then send requests on them in turn until the
+ * run is over
+ *
+ * Requests are due on a fixed schedule derived from the rate, not when the
+ * previous answer arrived. A worker that falls behind sends the overdue
+ * requests back to back and their latency includes the time they waited,
+ * so a stalled server shows in the percentiles instead of quietly lowering
+ * the load.
+ */
+void run_worker(size_t worker,
+                std::vector<Session> &sessions,
+                const LoadConfig &config,
+                std::latch &connected,
+                std::latch &go,
+                const Clock::time_point &start,
+                WorkerResult &result)
+{
+    for (Session &session : sessions) {
+        connect_session(session, result);
+    }
+    connected.count_down();
+    go.wait();
+
+    std::mt19937_64 rng(worker + 1);
+    const std::string payload = random_bytes(config.write_sizes.max(), rng);
+    const auto end = start + config.duration;
+    const double worker_rate =
+        config.rate / static_cast<double>(config.workers);
+    std::exponential_distribution<double> gap(worker_rate > 0 ? worker_rate
+                                                              : 1.0);
+
+    // Workers start at different offsets into their first interval, so they
+    // do not all fire at the same instant
+    double due_seconds = 0.0;
+    if (worker_rate > 0) {
+        due_seconds = static_cast<double>(worker) /
+                      static_cast<double>(config.workers) / worker_rate;
+    }
+
+    size_t next_session = 0;
+    for (;;) {
+        Clock::time_point due = Clock::now();
+        if (worker_rate > 0) {
+            due = start + std::chrono::duration_cast<Clock::duration>(
+                              std::chrono::duration<double>(due_seconds));
+            due_seconds += config.poisson ? gap(rng) : 1.0 / worker_rate;
+        }
+        if (due >= end) {
+            break;
+        }
+        std::this_thread::sleep_until(due);
+
+        run_request(sessions[next_session], due, payload, config, rng, result);
+        next_session = (next_session + 1) % sessions.size();
+    }
+
+    for (Session &session : sessions) {
+        session.connection->disconnect();
+    }
+}
+
+void print_row(const std::string &name, const LatencyHistogram &histogram)
+{
+    auto ms = [](uint64_t nanoseconds) { return nanoseconds / 1e6; };
+    std::printf("%-10s %10llu %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+                name.c_str(),
+                static_cast<unsigned long long>(histogram.count()),
+                histogram.mean() / 1e6,
+                ms(histogram.percentile(50)),
+                ms(histogram.percentile(90)),
+                ms(histogram.percentile(99)),
+                ms(histogram.percentile(99.9)),
+                ms(histogram.max()));
+}
+
+void print_report(const LoadConfig &config,
+                  const WorkerResult &total,
+                  std::chrono::duration<double> elapsed)
+{
+    LatencyHistogram all_requests;
+    uint64_t errors = 0;
+    for (size_t slot = 0; slot < LOAD_OP_COUNT; ++slot) {
+        all_requests.merge(total.requests[slot]);
+        errors += total.errors[slot];
+    }
+
+    const double seconds = elapsed.count();
+    std::printf("%zu sessions on %zu workers for %.1f s\n",
+                config.sessions,
+                config.workers,
+                seconds);
+    if (config.rate > 0) {
+        std::printf("target %.1f req/s (%s arrivals)\n",
+                    config.rate,
+                    config.poisson ? "poisson" : "constant");
+    } else {
+        std::printf("closed loop\n");
+    }
+    std::printf("completed %llu requests, %.1f req/s, %llu errors, "
+                "%llu failed handshakes\n",
+                static_cast<unsigned long long>(all_requests.count()),
+                all_requests.count() / seconds,
+                static_cast<unsigned long long>(errors),
+                static_cast<unsigned long long>(total.failed_handshakes));
+    std::printf("sent %.2f MiB/s, received %.2f MiB/s\n\n",
+                total.bytes_sent / seconds / (1024.0 * 1024.0),
+                total.bytes_received / seconds / (1024.0 * 1024.0));
+
+    std::printf("%-10s %10s %9s %9s %9s %9s %9s %9s\n",
+                "latency ms",
+                "count",
+                "mean",
+                "p50",
+                "p90",
+                "p99",
+                "p99.9",
+                "max");
+    print_row("handshake", total.handshakes);
+    print_row("request", all_requests);
+    for (size_t slot = 0; slot < LOAD_OP_COUNT; ++slot) {
+        if (total.requests[slot].count() > 0 || total.errors[slot] > 0) {
+            print_row("  " + std::string(fenris::client::load_op_name(
+                                 static_cast<LoadOp>(slot))),
+                      total.requests[slot]);
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    argparse::ArgumentParser program("fenris_loadgen");
+    setup_argument_parser(program);
+
+    if (!parse_arguments(program, argc, argv)) {
+        return 1;
+    }
+
+    if (!fenris::common::configure_logging(program, LOGGER_NAME)) {
+        std::cerr << "Failed to initialize logging system" << std::endl;
+        return 1;
+    }
+
+    auto config = create_config(program);
+    if (!config) {
+        return 1;
+    }
+
+    // A server closing a connection mid-request must fail the send, not end
+    // the run
+    signal(SIGPIPE, SIG_IGN);
+    raise_descriptor_limit(config->sessions);
+
+    if (!prepare_files(*config)) {
+        return 1;
+    }
+
+    // Sessions are dealt out to the workers up front, each worker only ever
+    // touches its own
+    std::vector<std::vector<Session>> sessions(config->workers);
+    for (size_t index = 0; index < config->sessions; ++index) {
+        sessions[index % config->workers].push_back(
+            {make_connection(*config),
+             config->directory + "/w" + std::to_string(index)});
+    }
+
+    std::vector<WorkerResult> results(config->workers);
+    std::latch connected(static_cast<ptrdiff_t>(config->workers));
+    std::latch go(1);
+    Clock::time_point start;
+
+    std::vector<std::thread> workers;
+    workers.reserve(config->workers);
+    for (size_t worker = 0; worker < config->workers; ++worker) {
+        workers.emplace_back(run_worker,
+                             worker,
+                             std::ref(sessions[worker]),
+                             std::cref(*config),
+                             std::ref(connected),
+                             std::ref(go),
+                             std::cref(start),
+                             std::ref(results[worker]));
+    }
+
+    connected.wait();
+    start = Clock::now();
+    go.count_down();
+
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    const auto elapsed = Clock::now() - start;
+
+    WorkerResult total;
+    for (const WorkerResult &result : results) {
+        total.handshakes.merge(result.handshakes);
+        for (size_t slot = 0; slot < LOAD_OP_COUNT; ++slot) {
+            total.requests[slot].merge(result.requests[slot]);
+            total.errors[slot] += result.errors[slot];
+        }
+        total.failed_handshakes += result.failed_handshakes;
+        total.bytes_sent += result.bytes_sent;
+        total.bytes_received += result.bytes_received;
+    }
+    print_report(*config, total, elapsed);
+    return 0;
+}
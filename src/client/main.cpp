@@ -1,5 +1,6 @@
 #include "client/client.hpp"
 #include "common/logging.hpp"
+#include "common/tracing.hpp"
 #include <argparse/argparse.hpp>
 #include <iostream>
 #include <stdexcept>
@@ -17,6 +18,22 @@ void setup_argument_parser(argparse::ArgumentParser &program)
         .help("Server port")
         .default_value(std::string("5555"));
 
+    program.add_argument("--plaintext-file-stream")
+        .help("Receive file contents unencrypted if the server allows it "
+              "(trusted networks only)")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--trace-file")
+        .help("Write request traces to this file in Chrome trace format, "
+              "the server traces the same requests under the same IDs")
+        .default_value(std::string(""));
+
+    program.add_argument("--trace-sample-rate")
+        .help("Trace one request in this many")
+        .default_value(uint32_t{1})
+        .scan<'u', uint32_t>();
+
     program.add_argument("--log-level")
         .help("Logging level (trace, debug, info, warn, error, critical)")
         .default_value(std::string("info"));
@@ -84,6 +101,14 @@ create_client(const argparse::ArgumentParser &program)
                 "fenris_client_connection");
     }
 
+    connection_manager->set_plaintext_file_streaming(
+        program.get<bool>("--plaintext-file-stream"));
+    connection_manager->set_sealed_file_streaming(true);
+    connection_manager->set_session_resumption(true);
+    connection_manager->set_sequenced_nonces(true);
+    connection_manager->set_pipelining(true);
+    connection_manager->set_read_leases(true);
+
     client->set_connection_manager(std::move(connection_manager));
 
     return client;
@@ -105,6 +130,16 @@ int main(int argc, char *argv[])
 
     auto logger = fenris::common::get_logger("fenris_client");
 
+    const std::string trace_file = program.get("--trace-file");
+    if (!trace_file.empty() &&
+        !fenris::common::Tracer::global().open(
+            trace_file,
+            program.get<uint32_t>("--trace-sample-rate"),
+            "fenris_client")) {
+        std::cerr << "Failed to open trace file " << trace_file << std::endl;
+        return 1;
+    }
+
     try {
         auto client = create_client(program);
         client->run();
@@ -0,0 +1,162 @@
+#include "client/read_cache.hpp"
+
+#include <iterator>
+
+namespace fenris {
+namespace client {
+
+using namespace common;
+
+namespace {
+
+// Whether path is directory or lies below it
+bool is_below(const std::string &path, const std::string &directory)
+{
+    if (directory == "/") {
+        return true;
+    }
+    return path.starts_with(directory) &&
+           (path.size() == directory.size() || path[directory.size()] == '/');
+}
+
+} // namespace
+
+ReadCache::ReadCache(const ReadCacheConfig &config,
+                     const std::string &logger_name)
+    : m_config(config), m_logger(get_logger(logger_name))
+{
+}
+
+std::optional<CachedRead> ReadCache::lookup(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto entry = m_entries.find(path);
+    if (entry == m_entries.end()) {
+        return std::nullopt;
+    }
+
+    touch(entry->second);
+    CachedRead cached;
+    cached.content = entry->second.content;
+    cached.modified_time = entry->second.modified_time;
+    cached.leased = Clock::now() < entry->second.expires;
+    if (cached.leased) {
+        ++m_stats.hits;
+    }
+    return cached;
+}
+
+void ReadCache::store(const std::string &path,
+                      std::string content,
+                      uint64_t modified_time,
+                      Clock::time_point expires)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_stats.misses;
+
+    auto existing = m_entries.find(path);
+    if (existing != m_entries.end()) {
+        erase(existing);
+    }
+    if (content.size() > m_config.max_entry_bytes ||
+        content.size() > m_config.max_bytes) {
+        m_logger->debug("not caching {}, {} bytes", path, content.size());
+        return;
+    }
+
+    while (m_bytes + content.size() > m_config.max_bytes &&
+           !m_recency.empty()) {
+        erase(m_entries.find(m_recency.back()));
+        ++m_stats.evictions;
+    }
+
+    m_recency.push_front(path);
+    Entry &entry = m_entries[path];
+    m_bytes += content.size();
+    entry.content = std::move(content);
+    entry.modified_time = modified_time;
+    entry.expires = expires;
+    entry.recency = m_recency.begin();
+}
+
+std::optional<std::string> ReadCache::renew(const std::string &path,
+                                            uint64_t modified_time,
+                                            Clock::time_point expires)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto entry = m_entries.find(path);
+    if (entry == m_entries.end()) {
+        return std::nullopt;
+    }
+    if (entry->second.modified_time != modified_time) {
+        erase(entry);
+        return std::nullopt;
+    }
+
+    ++m_stats.revalidations;
+    entry->second.expires = expires;
+    touch(entry->second);
+    return entry->second.content;
+}
+
+void ReadCache::invalidate(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto entry = m_entries.find(path);
+    if (entry != m_entries.end()) {
+        erase(entry);
+    }
+}
+
+void ReadCache::invalidate_prefix(const std::string &directory)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto entry = m_entries.begin(); entry != m_entries.end();) {
+        auto next = std::next(entry);
+        if (is_below(entry->first, directory)) {
+            erase(entry);
+        }
+        entry = next;
+    }
+}
+
+void ReadCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+    m_recency.clear();
+    m_bytes = 0;
+}
+
+size_t ReadCache::get_entry_count() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+}
+
+size_t ReadCache::get_cache_bytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_bytes;
+}
+
+ReadCacheStats ReadCache::get_stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void ReadCache::erase(std::unordered_map<std::string, Entry>::iterator entry)
+{
+    m_bytes -= entry->second.content.size();
+    m_recency.erase(entry->second.recency);
+    m_entries.erase(entry);
+}
+
+void ReadCache::touch(Entry &entry)
+{
+    m_recency.splice(m_recency.begin(), m_recency, entry.recency);
+}
+
+} // namespace client
+} // namespace fenris
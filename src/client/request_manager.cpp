@@ -1,5 +1,6 @@
 #include "client/request_manager.hpp"
 #include "common/request.hpp"
+#include <charconv>
 #include <fstream>
 #include <sstream>
 
@@ -87,14 +88,19 @@ RequestManager::generate_request(const std::vector<std::string> &args)
         request.set_filename(args[1]);
         break;
 
-    case fenris::RequestType::LIST_DIR:
-        if (args.size() < 2) {
+    case fenris::RequestType::LIST_DIR: {
+        // "-n" lists names only, skipping the per-entry details
+        const bool names_only = args.size() > 1 && args[1] == "-n";
+        const size_t dir_idx = names_only ? 2 : 1;
+        if (args.size() <= dir_idx) {
             // Default to current directory if none specified
             request.set_filename(".");
         } else {
-            request.set_filename(args[1]);
+            request.set_filename(args[dir_idx]);
         }
+        request.mutable_list()->set_names_only(names_only);
         break;
+    }
     case fenris::RequestType::CHANGE_DIR:
         if (args.size() < 2) {
             m_logger->error("cd command requires a directory name");
@@ -111,10 +117,68 @@ RequestManager::generate_request(const std::vector<std::string> &args)
         request.set_filename(args[1]);
         break;
 
+    case fenris::RequestType::READ_RANGE:
+        if (args.size() < 4) {
+            m_logger->error(
+                "readat command requires a filename, offset and length");
+            return std::nullopt;
+        }
+        return range_request(cmd_iter->second, args, 1);
+
+    case fenris::RequestType::WRITE_AT:
+        if (args.size() < 4) {
+            m_logger->error(
+                "writeat command requires a filename, offset and content");
+            return std::nullopt;
+        }
+        return range_request(cmd_iter->second, args, 1);
+
+    case fenris::RequestType::DU:
+    case fenris::RequestType::DELETE_TREE:
+        if (args.size() < 2) {
+            m_logger->error("{} command requires a directory name", cmd);
+            return std::nullopt;
+        }
+        request.set_filename(args[1]);
+        request.mutable_tree()->set_progress_interval_ms(
+            TREE_PROGRESS_INTERVAL_MS);
+        break;
+
+    case fenris::RequestType::COPY_TREE:
+        if (args.size() < 3) {
+            m_logger->error(
+                "cptree command requires a source and a destination");
+            return std::nullopt;
+        }
+        request.set_filename(args[1]);
+        request.mutable_tree()->set_destination(args[2]);
+        request.mutable_tree()->set_progress_interval_ms(
+            TREE_PROGRESS_INTERVAL_MS);
+        break;
+
+    case fenris::RequestType::FIND:
+        if (args.size() < 3) {
+            m_logger->error("find command requires a directory and a pattern");
+            return std::nullopt;
+        }
+        request.set_filename(args[1]);
+        request.mutable_tree()->set_pattern(args[2]);
+        request.mutable_tree()->set_progress_interval_ms(
+            TREE_PROGRESS_INTERVAL_MS);
+        break;
+
     case fenris::RequestType::TERMINATE:
         // No additional arguments needed for terminate
         break;
 
+    case fenris::RequestType::BATCH:
+        // "-p" lets the server run the commands in parallel
+        if (args.size() < 2 || (args[1] == "-p" && args.size() < 3)) {
+            m_logger->error("batch command requires a script file");
+            return std::nullopt;
+        }
+        return batch_request(args, 1);
+
     default:
         m_logger->error("unhandled command type");
         return std::nullopt;
@@ -247,5 +311,101 @@ RequestManager::append_file_request(const std::vector<std::string> &args,
     return request;
 }
 
+std::optional<fenris::Request>
+RequestManager::range_request(fenris::RequestType type,
+                              const std::vector<std::string> &args,
+                              size_t start_idx)
+{
+    const std::string &offset_arg = args[start_idx + 1];
+    uint64_t offset = 0;
+    auto [end, ec] = std::from_chars(
+        offset_arg.data(), offset_arg.data() + offset_arg.size(), offset);
+    if (ec != std::errc() || end != offset_arg.data() + offset_arg.size()) {
+        m_logger->error("invalid offset '{}'", offset_arg);
+        return std::nullopt;
+    }
+
+    fenris::Request request;
+    request.set_command(type);
+    request.set_filename(args[start_idx]);
+    request.mutable_chunk()->set_offset(offset);
+
+    if (type == fenris::RequestType::READ_RANGE) {
+        const std::string &length_arg = args[start_idx + 2];
+        uint64_t length = 0;
+        auto [length_end, length_ec] =
+            std::from_chars(length_arg.data(),
+                            length_arg.data() + length_arg.size(),
+                            length);
+        if (length_ec != std::errc() ||
+            length_end != length_arg.data() + length_arg.size()) {
+            m_logger->error("invalid length '{}'", length_arg);
+            return std::nullopt;
+        }
+        request.mutable_chunk()->set_length(length);
+        return request;
+    }
+
+    // Use argument as content (concatenate remaining args)
+    std::stringstream content;
+    for (size_t i = start_idx + 2; i < args.size(); i++) {
+        if (i > start_idx + 2)
+            content << " ";
+        content << args[i];
+    }
+    request.set_data(content.str());
+    request.mutable_chunk()->set_length(request.data().size());
+    return request;
+}
+
+std::optional<fenris::Request>
+RequestManager::batch_request(const std::vector<std::string> &args,
+                              size_t start_idx)
+{
+    const bool parallel = args[start_idx] == "-p";
+    const std::string &script_path = args[parallel ? start_idx + 1 : start_idx];
+    std::ifstream script(script_path);
+    if (!script) {
+        m_logger->error("could not open batch script '{}'", script_path);
+        return std::nullopt;
+    }
+
+    fenris::Request request;
+    request.set_command(fenris::RequestType::BATCH);
+    request.mutable_batch()->set_parallel(parallel);
+
+    std::string line;
+    for (size_t line_number = 1; std::getline(script, line); ++line_number) {
+        std::istringstream words(line);
+        std::vector<std::string> command_parts;
+        for (std::string word; words >> word;) {
+            command_parts.push_back(std::move(word));
+        }
+        if (command_parts.empty() || command_parts[0][0] == '#') {
+            continue;
+        }
+        if (command_parts[0] == "batch") {
+            m_logger->error("{}:{}: batches cannot be nested",
+                            script_path,
+                            line_number);
+            return std::nullopt;
+        }
+
+        auto sub_request = generate_request(command_parts);
+        if (!sub_request.has_value()) {
+            m_logger->error("{}:{}: invalid command", script_path, line_number);
+            return std::nullopt;
+        }
+        *request.mutable_batch()->add_requests() =
+            std::move(sub_request.value());
+    }
+
+    if (request.batch().requests_size() == 0) {
+        m_logger->error("batch script '{}' has no commands", script_path);
+        return std::nullopt;
+    }
+    return request;
+}
+
 } // namespace client
 } // namespace fenris
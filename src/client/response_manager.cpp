@@ -49,6 +49,19 @@ ResponseManager::handle_response(const fenris::Response &response)
         handle_terminated_response(response, result);
         break;
 
+    case ResponseType::FILE_CHUNK:
+        handle_file_chunk_response(response, result);
+        break;
+
+    case ResponseType::BATCH_RESULTS:
+        handle_batch_results_response(response, result);
+        break;
+
+    case ResponseType::TREE_PROGRESS:
+    case ResponseType::TREE_RESULT:
+        handle_tree_response(response, result);
+        break;
+
     default:
         // Unknown response type
         result.push_back("Unknown response type");
@@ -162,6 +175,26 @@ void ResponseManager::handle_directory_listing_response(
     size_t name_width = 0;
     size_t size_width = 0;
 
+    if (listing.names_only()) {
+        // Only names and types were sent
+        for (const auto &entry : listing.entries()) {
+            name_width = std::max(name_width, entry.name().length());
+        }
+
+        std::ostringstream header;
+        header << std::left << std::setw(name_width + 2) << "Name" << "Type";
+        result.push_back(header.str());
+        result.push_back(std::string(header.str().length(), '-'));
+
+        for (const auto &entry : listing.entries()) {
+            std::ostringstream line;
+            line << std::left << std::setw(name_width + 2) << entry.name()
+                 << (entry.is_directory() ? "Directory" : "File");
+            result.push_back(line.str());
+        }
+        return;
+    }
+
     for (const auto &entry : listing.entries()) {
         name_width = std::max(name_width, entry.name().length());
         std::string size_str = format_file_size(entry.size());
@@ -218,6 +251,68 @@ void ResponseManager::handle_terminated_response(
     }
 }
 
+void ResponseManager::handle_file_chunk_response(
+    const fenris::Response &response,
+    std::vector<std::string> &result)
+{
+    if (!response.has_chunk_info()) {
+        result.push_back("Error: Chunk info missing in response");
+        return;
+    }
+
+    const auto &chunk_info = response.chunk_info();
+    result.push_back("Chunk at offset " + std::to_string(chunk_info.offset()) +
+                     " (" + format_file_size(response.data().size()) + " of " +
+                     format_file_size(chunk_info.total_size()) + ")");
+    if (chunk_info.final()) {
+        result.push_back("Last chunk of file");
+    }
+}
+
+void ResponseManager::handle_batch_results_response(
+    const fenris::Response &response,
+    std::vector<std::string> &result)
+{
+    const auto &responses = response.batch_results().responses();
+    size_t failed = 0;
+    for (int i = 0; i < responses.size(); ++i) {
+        std::vector<std::string> lines = handle_response(responses[i]);
+        if (!responses[i].success()) {
+            ++failed;
+        }
+        // Each block is headed by the command's number and status
+        result.push_back("[" + std::to_string(i + 1) + "] " + lines[0]);
+        result.insert(result.end(), lines.begin() + 1, lines.end());
+    }
+    result.push_back(std::to_string(responses.size()) + " commands, " +
+                     std::to_string(failed) + " failed");
+}
+
+void ResponseManager::handle_tree_response(const fenris::Response &response,
+                                           std::vector<std::string> &result)
+{
+    const bool final = response.type() == ResponseType::TREE_RESULT;
+    if (final && !response.data().empty()) {
+        result.push_back(response.data());
+    }
+
+    // Matches of a FIND arrive spread over the progress reports
+    const auto &summary = response.tree_summary();
+    result.insert(
+        result.end(), summary.matches().begin(), summary.matches().end());
+
+    std::string totals = std::to_string(summary.files()) + " files, " +
+                         std::to_string(summary.directories()) +
+                         " directories, " + format_file_size(summary.bytes());
+    if (summary.errors() != 0) {
+        totals += ", " + std::to_string(summary.errors()) + " errors";
+    }
+    result.push_back(final ? totals : totals + " so far...");
+    if (final && summary.truncated()) {
+        result.push_back("Stopped at the server's limit of matches");
+    }
+}
+
 std::string ResponseManager::format_file_size(uint64_t size_bytes)
 {
     constexpr double KB = 1024.0;
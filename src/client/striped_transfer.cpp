@@ -0,0 +1,327 @@
+#include "client/striped_transfer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fenris {
+namespace client {
+
+using namespace common;
+
+namespace {
+
+bool pread_all(int fd, char *data, size_t size, uint64_t offset)
+{
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = ::pread(fd,
+                            data + done,
+                            size - done,
+                            static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool pwrite_all(int fd, const char *data, size_t size, uint64_t offset)
+{
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = ::pwrite(fd,
+                             data + done,
+                             size - done,
+                             static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+} // namespace
+
+StripedTransfer::StripedTransfer(ConnectionPool &pool,
+                                 size_t chunk_size,
+                                 const std::string &logger_name)
+    : m_pool(pool),
+      m_chunk_size(std::clamp<size_t>(chunk_size, 1, MAX_CHUNK_SIZE)),
+      m_logger(get_logger(logger_name))
+{
+}
+
+std::pair<uint64_t, TransferResult>
+StripedTransfer::upload(const std::string &local_path,
+                        const std::string &remote_path)
+{
+    m_server_error.clear();
+
+    int fd = ::open(local_path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat status {};
+    if (fd < 0 || ::fstat(fd, &status) != 0) {
+        m_logger->error("could not open '{}' for upload", local_path);
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return {0, TransferResult::LOCAL_FILE_ERROR};
+    }
+    const uint64_t total_size = static_cast<uint64_t>(status.st_size);
+
+    // WRITE_CHUNK at offset 0 replaces the remote file, so it has to land
+    // before any WRITE_AT
+    const size_t first_size =
+        static_cast<size_t>(std::min<uint64_t>(m_chunk_size, total_size));
+    fenris::Request request;
+    request.set_command(fenris::RequestType::WRITE_CHUNK);
+    request.set_filename(remote_path);
+    request.mutable_data()->resize(first_size);
+    if (!pread_all(fd, request.mutable_data()->data(), first_size, 0)) {
+        m_logger->error("failed reading '{}' at offset 0", local_path);
+        ::close(fd);
+        return {0, TransferResult::LOCAL_FILE_ERROR};
+    }
+    request.mutable_chunk()->set_offset(0);
+    request.mutable_chunk()->set_length(first_size);
+    request.mutable_chunk()->set_final(first_size == total_size);
+
+    fenris::Response response;
+    TransferResult result = exchange(m_pool.at(0), request, response);
+    if (result != TransferResult::SUCCESS) {
+        ::close(fd);
+        return {0, result};
+    }
+
+    auto striped =
+        stripe(&StripedTransfer::upload_block, fd, remote_path, total_size);
+    ::close(fd);
+    if (striped.second == TransferResult::SUCCESS) {
+        m_logger->info("uploaded '{}' to '{}' over {} sessions ({} bytes)",
+                       local_path,
+                       remote_path,
+                       m_pool.size(),
+                       total_size);
+    }
+    return striped;
+}
+
+std::pair<uint64_t, TransferResult>
+StripedTransfer::download(const std::string &remote_path,
+                          const std::string &local_path)
+{
+    m_server_error.clear();
+
+    int fd = ::open(local_path.c_str(),
+                    O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+    if (fd < 0) {
+        m_logger->error("could not open '{}' for download", local_path);
+        return {0, TransferResult::LOCAL_FILE_ERROR};
+    }
+
+    // The first block tells the size, and with it how to split the rest
+    fenris::Request request;
+    request.set_command(fenris::RequestType::READ_RANGE);
+    request.set_filename(remote_path);
+    request.mutable_chunk()->set_offset(0);
+    request.mutable_chunk()->set_length(m_chunk_size);
+
+    fenris::Response response;
+    TransferResult result = exchange(m_pool.at(0), request, response);
+    if (result != TransferResult::SUCCESS) {
+        ::close(fd);
+        return {0, result};
+    }
+    if (response.type() != fenris::ResponseType::FILE_CHUNK ||
+        !response.has_chunk_info() || response.chunk_info().offset() != 0 ||
+        (response.data().size() < m_chunk_size &&
+         !response.chunk_info().final())) {
+        m_logger->error("unexpected chunk response for '{}'", remote_path);
+        ::close(fd);
+        return {0, TransferResult::PROTOCOL_ERROR};
+    }
+    if (!pwrite_all(fd, response.data().data(), response.data().size(), 0)) {
+        m_logger->error("failed writing '{}' at offset 0", local_path);
+        ::close(fd);
+        return {0, TransferResult::LOCAL_FILE_ERROR};
+    }
+
+    const uint64_t total_size =
+        response.chunk_info().final() ? response.data().size()
+                                      : response.chunk_info().total_size();
+    auto striped =
+        stripe(&StripedTransfer::download_block, fd, remote_path, total_size);
+    if (::close(fd) != 0 && striped.second == TransferResult::SUCCESS) {
+        m_logger->error("failed writing '{}'", local_path);
+        return {0, TransferResult::LOCAL_FILE_ERROR};
+    }
+    if (striped.second == TransferResult::SUCCESS) {
+        m_logger->info("downloaded '{}' to '{}' over {} sessions ({} bytes)",
+                       remote_path,
+                       local_path,
+                       m_pool.size(),
+                       total_size);
+    }
+    return striped;
+}
+
+const std::string &StripedTransfer::get_server_error() const
+{
+    return m_server_error;
+}
+
+std::pair<uint64_t, TransferResult>
+StripedTransfer::stripe(BlockHandler handler,
+                        int fd,
+                        const std::string &remote_path,
+                        uint64_t total_size)
+{
+    std::atomic<uint64_t> next_offset{m_chunk_size};
+    std::atomic<bool> failed{false};
+    std::mutex failure_mutex;
+    uint64_t failed_offset = total_size;
+    TransferResult failure = TransferResult::SUCCESS;
+
+    // Blocks are claimed in order, so every block below the lowest failed
+    // one was moved
+    auto worker = [&](ConnectionManager &connection) {
+        while (!failed) {
+            const uint64_t offset = next_offset.fetch_add(m_chunk_size);
+            if (offset >= total_size) {
+                return;
+            }
+            TransferResult result = (this->*handler)(
+                connection, fd, remote_path, offset, total_size);
+            if (result != TransferResult::SUCCESS) {
+                std::lock_guard<std::mutex> lock(failure_mutex);
+                if (offset < failed_offset) {
+                    failed_offset = offset;
+                    failure = result;
+                }
+                failed = true;
+                return;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(m_pool.size());
+    for (size_t i = 0; i < m_pool.size(); ++i) {
+        threads.emplace_back(worker, std::ref(m_pool.at(i)));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    if (failure != TransferResult::SUCCESS) {
+        return {failed_offset, failure};
+    }
+    return {total_size, TransferResult::SUCCESS};
+}
+
+TransferResult StripedTransfer::download_block(ConnectionManager &connection,
+                                               int fd,
+                                               const std::string &remote_path,
+                                               uint64_t offset,
+                                               uint64_t total_size)
+{
+    const size_t length =
+        static_cast<size_t>(std::min<uint64_t>(m_chunk_size,
+                                               total_size - offset));
+    fenris::Request request;
+    request.set_command(fenris::RequestType::READ_RANGE);
+    request.set_filename(remote_path);
+    request.mutable_chunk()->set_offset(offset);
+    request.mutable_chunk()->set_length(length);
+
+    fenris::Response response;
+    TransferResult result = exchange(connection, request, response);
+    if (result != TransferResult::SUCCESS) {
+        return result;
+    }
+
+    // A block of another size means the file changed under the transfer
+    if (response.type() != fenris::ResponseType::FILE_CHUNK ||
+        !response.has_chunk_info() ||
+        response.chunk_info().offset() != offset ||
+        response.data().size() != length) {
+        m_logger->error("unexpected chunk response for '{}' at offset {}",
+                        remote_path,
+                        offset);
+        return TransferResult::PROTOCOL_ERROR;
+    }
+    if (!pwrite_all(fd, response.data().data(), length, offset)) {
+        m_logger->error("failed writing download at offset {}", offset);
+        return TransferResult::LOCAL_FILE_ERROR;
+    }
+    return TransferResult::SUCCESS;
+}
+
+TransferResult StripedTransfer::upload_block(ConnectionManager &connection,
+                                             int fd,
+                                             const std::string &remote_path,
+                                             uint64_t offset,
+                                             uint64_t total_size)
+{
+    const size_t length =
+        static_cast<size_t>(std::min<uint64_t>(m_chunk_size,
+                                               total_size - offset));
+    fenris::Request request;
+    request.set_command(fenris::RequestType::WRITE_AT);
+    request.set_filename(remote_path);
+    request.mutable_chunk()->set_offset(offset);
+    request.mutable_chunk()->set_length(length);
+    request.mutable_data()->resize(length);
+    if (!pread_all(fd, request.mutable_data()->data(), length, offset)) {
+        m_logger->error("failed reading upload at offset {}", offset);
+        return TransferResult::LOCAL_FILE_ERROR;
+    }
+
+    fenris::Response response;
+    return exchange(connection, request, response);
+}
+
+TransferResult StripedTransfer::exchange(ConnectionManager &connection,
+                                         const fenris::Request &request,
+                                         fenris::Response &response)
+{
+    auto request_id = connection.submit_request(request);
+    if (!request_id.has_value()) {
+        m_logger->error("failed to send chunk request");
+        return TransferResult::SEND_ERROR;
+    }
+
+    auto response_opt = connection.receive_response_for(*request_id);
+    if (!response_opt.has_value()) {
+        m_logger->error("failed to receive chunk response");
+        return TransferResult::RECEIVE_ERROR;
+    }
+
+    response = std::move(response_opt.value());
+    if (!response.success()) {
+        std::lock_guard<std::mutex> lock(m_error_mutex);
+        if (m_server_error.empty()) {
+            m_server_error = response.error_message();
+        }
+        m_logger->error("server rejected chunk: {}", response.error_message());
+        return TransferResult::SERVER_ERROR;
+    }
+
+    return TransferResult::SUCCESS;
+}
+
+} // namespace client
+} // namespace fenris
@@ -0,0 +1,107 @@
+#include "common/buffer.hpp"
+#include "common/buffer_pool.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace fenris {
+namespace common {
+
+namespace {
+
+/**
+ * Hands a slab back to the pool it came from
+ */
+struct SlabDeleter {
+    size_t size;
+
+    void operator()(uint8_t *data) const
+    {
+        BufferPool::deallocate(data, size);
+    }
+};
+
+} // namespace
+
+Buffer Buffer::allocate(size_t size)
+{
+    if (size == 0) {
+        return {};
+    }
+
+    // The bytes stay uninitialized, the payload is about to be overwritten
+    // by recv() or a cipher anyway. Slab and reference count come from the
+    // pool separately, so exact powers of two keep their size class.
+    uint8_t *data = static_cast<uint8_t *>(BufferPool::allocate(size));
+    std::shared_ptr<uint8_t[]> slab;
+    try {
+        slab = std::shared_ptr<uint8_t[]>(
+            data, SlabDeleter{size}, PoolAllocator<uint8_t>());
+    } catch (...) {
+        BufferPool::deallocate(data, size);
+        throw;
+    }
+    return Buffer(std::move(slab), data, size);
+}
+
+Buffer Buffer::copy_of(std::span<const uint8_t> data)
+{
+    Buffer buffer = allocate(data.size());
+    if (!data.empty()) {
+        std::memcpy(buffer.data(), data.data(), data.size());
+    }
+    return buffer;
+}
+
+Buffer Buffer::wrap(std::vector<uint8_t> &&data)
+{
+    if (data.empty()) {
+        return {};
+    }
+
+    auto owner = std::make_shared<std::vector<uint8_t>>(std::move(data));
+    uint8_t *bytes = owner->data();
+    const size_t size = owner->size();
+    return Buffer(std::move(owner), bytes, size);
+}
+
+Buffer Buffer::wrap(std::string &&data)
+{
+    if (data.empty()) {
+        return {};
+    }
+
+    auto owner = std::make_shared<std::string>(std::move(data));
+    auto *bytes = reinterpret_cast<uint8_t *>(owner->data());
+    const size_t size = owner->size();
+    return Buffer(std::move(owner), bytes, size);
+}
+
+Buffer Buffer::adopt(std::shared_ptr<void> owner, uint8_t *data, size_t size)
+{
+    if (size == 0) {
+        return {};
+    }
+    return Buffer(std::move(owner), data, size);
+}
+
+Buffer Buffer::slice(size_t offset, size_t length) const
+{
+    if (offset >= m_size) {
+        return {};
+    }
+    return Buffer(m_owner, m_data + offset, std::min(length, m_size - offset));
+}
+
+void Buffer::truncate(size_t size)
+{
+    m_size = std::min(m_size, size);
+}
+
+std::vector<uint8_t> Buffer::to_vector() const
+{
+    return std::vector<uint8_t>(begin(), end());
+}
+
+} // namespace common
+} // namespace fenris
@@ -0,0 +1,287 @@
+#include "common/buffer_pool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace fenris {
+namespace common {
+
+namespace {
+
+constexpr size_t CLASS_COUNT =
+    std::countr_zero(BufferPool::MAX_CLASS_SIZE) -
+    std::countr_zero(BufferPool::MIN_CLASS_SIZE) + 1;
+
+size_t class_index(size_t class_size)
+{
+    return std::countr_zero(class_size) -
+           std::countr_zero(BufferPool::MIN_CLASS_SIZE);
+}
+
+using FreeLists = std::array<std::vector<void *>, CLASS_COUNT>;
+
+/**
+ * Counters written by their own thread only and summed by get_stats(), so
+ * the allocation path never shares a cache line with other threads
+ */
+struct Counters {
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> oversized{0};
+    std::atomic<uint64_t> cached_bytes{0};
+};
+
+void add(std::atomic<uint64_t> &counter, uint64_t amount)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + amount,
+                  std::memory_order_relaxed);
+}
+
+void subtract(std::atomic<uint64_t> &counter, uint64_t amount)
+{
+    counter.store(counter.load(std::memory_order_relaxed) - amount,
+                  std::memory_order_relaxed);
+}
+
+struct ThreadCache {
+    FreeLists free;
+    Counters counters;
+
+    ThreadCache();
+    ~ThreadCache();
+};
+
+/**
+ * State shared by all threads: the depot of slabs handed over between
+ * threads, and the thread caches whose counters make up the stats
+ */
+struct Shared {
+    std::mutex depot_mutex;
+    FreeLists depot;
+    size_t depot_bytes = 0;
+
+    std::mutex registry_mutex;
+    std::vector<ThreadCache *> caches;
+    // Counts of threads that exited, and of allocations made while a thread
+    // was exiting
+    BufferPoolStats retired;
+};
+
+Shared &shared()
+{
+    // Never destroyed, threads may still return slabs while statics are torn
+    // down
+    static Shared *instance = new Shared;
+    return *instance;
+}
+
+// Checked before touching t_cache, which slabs freed by later thread-local
+// destructors must not bring back to life
+thread_local bool t_cache_gone = false;
+thread_local ThreadCache t_cache;
+
+/**
+ * Push a slab onto a free list, false if the list could not grow
+ */
+bool push(std::vector<void *> &list, void *memory)
+{
+    try {
+        list.push_back(memory);
+        return true;
+    } catch (const std::bad_alloc &) {
+        return false;
+    }
+}
+
+/**
+ * Free every slab on the lists
+ * @return Bytes released
+ */
+size_t release_all(FreeLists &free)
+{
+    size_t released = 0;
+    for (size_t index = 0; index < free.size(); ++index) {
+        const size_t size = BufferPool::MIN_CLASS_SIZE << index;
+        released += free[index].size() * size;
+        for (void *memory : free[index]) {
+            ::operator delete(memory);
+        }
+        free[index].clear();
+        free[index].shrink_to_fit();
+    }
+    return released;
+}
+
+/**
+ * Count an allocation on the calling thread, or as retired once its cache
+ * is gone
+ */
+void count(std::atomic<uint64_t> Counters::*field,
+           uint64_t BufferPoolStats::*late)
+{
+    if (!t_cache_gone) {
+        add(t_cache.counters.*field, 1);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(shared().registry_mutex);
+    ++(shared().retired.*late);
+}
+
+ThreadCache::ThreadCache()
+{
+    std::lock_guard<std::mutex> lock(shared().registry_mutex);
+    shared().caches.push_back(this);
+}
+
+ThreadCache::~ThreadCache()
+{
+    t_cache_gone = true;
+
+    // Whatever the depot has room for stays available to the other threads
+    {
+        Shared &state = shared();
+        std::lock_guard<std::mutex> lock(state.depot_mutex);
+        for (size_t index = 0; index < free.size(); ++index) {
+            const size_t size = BufferPool::MIN_CLASS_SIZE << index;
+            while (!free[index].empty() &&
+                   state.depot_bytes + size <= BufferPool::DEPOT_BYTES &&
+                   push(state.depot[index], free[index].back())) {
+                free[index].pop_back();
+                state.depot_bytes += size;
+            }
+        }
+    }
+    release_all(free);
+
+    std::lock_guard<std::mutex> lock(shared().registry_mutex);
+    auto &caches = shared().caches;
+    caches.erase(std::find(caches.begin(), caches.end(), this));
+    BufferPoolStats &retired = shared().retired;
+    retired.hits += counters.hits.load(std::memory_order_relaxed);
+    retired.misses += counters.misses.load(std::memory_order_relaxed);
+    retired.oversized += counters.oversized.load(std::memory_order_relaxed);
+}
+
+} // namespace
+
+void *BufferPool::allocate(size_t bytes)
+{
+    const size_t size = class_size(bytes);
+    if (size == 0) {
+        count(&Counters::oversized, &BufferPoolStats::oversized);
+        return ::operator new(bytes);
+    }
+    const size_t index = class_index(size);
+
+    if (!t_cache_gone && !t_cache.free[index].empty()) {
+        void *memory = t_cache.free[index].back();
+        t_cache.free[index].pop_back();
+        subtract(t_cache.counters.cached_bytes, size);
+        add(t_cache.counters.hits, 1);
+        return memory;
+    }
+
+    void *memory = nullptr;
+    {
+        Shared &state = shared();
+        std::lock_guard<std::mutex> lock(state.depot_mutex);
+        if (!state.depot[index].empty()) {
+            memory = state.depot[index].back();
+            state.depot[index].pop_back();
+            state.depot_bytes -= size;
+        }
+    }
+    if (memory != nullptr) {
+        count(&Counters::hits, &BufferPoolStats::hits);
+        return memory;
+    }
+
+    count(&Counters::misses, &BufferPoolStats::misses);
+    return ::operator new(size);
+}
+
+void BufferPool::deallocate(void *memory, size_t bytes)
+{
+    if (memory == nullptr) {
+        return;
+    }
+    const size_t size = class_size(bytes);
+    if (size == 0) {
+        ::operator delete(memory);
+        return;
+    }
+    const size_t index = class_index(size);
+
+    if (!t_cache_gone) {
+        auto &cached = t_cache.counters.cached_bytes;
+        if (cached.load(std::memory_order_relaxed) + size <=
+                THREAD_CACHE_BYTES &&
+            push(t_cache.free[index], memory)) {
+            add(cached, size);
+            return;
+        }
+    }
+
+    {
+        Shared &state = shared();
+        std::lock_guard<std::mutex> lock(state.depot_mutex);
+        if (state.depot_bytes + size <= DEPOT_BYTES &&
+            push(state.depot[index], memory)) {
+            state.depot_bytes += size;
+            return;
+        }
+    }
+
+    ::operator delete(memory);
+}
+
+size_t BufferPool::class_size(size_t bytes)
+{
+    if (bytes > MAX_CLASS_SIZE) {
+        return 0;
+    }
+    return std::bit_ceil(std::max(bytes, MIN_CLASS_SIZE));
+}
+
+void BufferPool::trim()
+{
+    if (!t_cache_gone) {
+        subtract(t_cache.counters.cached_bytes, release_all(t_cache.free));
+    }
+
+    Shared &state = shared();
+    std::lock_guard<std::mutex> lock(state.depot_mutex);
+    release_all(state.depot);
+    state.depot_bytes = 0;
+}
+
+BufferPoolStats BufferPool::get_stats()
+{
+    Shared &state = shared();
+    BufferPoolStats stats;
+    {
+        std::lock_guard<std::mutex> lock(state.registry_mutex);
+        stats = state.retired;
+        for (const ThreadCache *cache : state.caches) {
+            const Counters &counters = cache->counters;
+            stats.hits += counters.hits.load(std::memory_order_relaxed);
+            stats.misses += counters.misses.load(std::memory_order_relaxed);
+            stats.oversized +=
+                counters.oversized.load(std::memory_order_relaxed);
+            stats.cached_bytes +=
+                counters.cached_bytes.load(std::memory_order_relaxed);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(state.depot_mutex);
+    stats.cached_bytes += state.depot_bytes;
+    return stats;
+}
+
+} // namespace common
+} // namespace fenris
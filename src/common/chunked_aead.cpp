@@ -0,0 +1,137 @@
+#include "common/chunked_aead.hpp"
+
+#include <cryptopp/aes.h>
+#include <cryptopp/gcm.h>
+
+#include <algorithm>
+#include <array>
+#include <string_view>
+
+namespace fenris {
+namespace common {
+namespace crypto {
+
+using namespace CryptoPP;
+
+namespace {
+
+// HKDF info prefix, followed by the announcing message's IV
+constexpr std::string_view STREAM_KEY_LABEL = "fenris chunked stream";
+
+// Nonce and associated data of chunk index: the index in the last 8 bytes
+// of the nonce, and the index followed by the last-chunk flag as AAD
+struct ChunkParameters {
+    std::array<uint8_t, AES_GCM_IV_SIZE> nonce{};
+    std::array<uint8_t, sizeof(uint64_t) + 1> aad{};
+
+    ChunkParameters(uint64_t index, bool last)
+    {
+        for (size_t i = 0; i < sizeof(uint64_t); ++i) {
+            const auto byte = static_cast<uint8_t>(index >> (8 * i));
+            nonce[AES_GCM_IV_SIZE - 1 - i] = byte;
+            aad[sizeof(uint64_t) - 1 - i] = byte;
+        }
+        aad[sizeof(uint64_t)] = last ? 1 : 0;
+    }
+};
+
+bool valid_key_size(size_t size)
+{
+    return size == 16 || size == 24 || size == 32;
+}
+
+} // namespace
+
+std::pair<std::vector<uint8_t>, ECDHResult>
+derive_stream_key(const std::vector<uint8_t> &session_key,
+                  std::span<const uint8_t> message_iv)
+{
+    std::vector<uint8_t> context(STREAM_KEY_LABEL.begin(),
+                                 STREAM_KEY_LABEL.end());
+    context.insert(context.end(), message_iv.begin(), message_iv.end());
+
+    CryptoManager crypto_manager;
+    return crypto_manager.derive_key_from_shared_secret(
+        session_key, session_key.size(), context);
+}
+
+ChunkedAead::ChunkedAead(std::vector<uint8_t> stream_key)
+    : m_key(std::move(stream_key))
+{
+}
+
+EncryptionResult
+ChunkedAead::seal(uint64_t index, bool last, std::span<uint8_t> buffer) const
+{
+    if (!valid_key_size(m_key.size())) {
+        return EncryptionResult::INVALID_KEY_SIZE;
+    }
+    if (buffer.size() < AES_GCM_TAG_SIZE) {
+        return EncryptionResult::INVALID_DATA;
+    }
+
+    const ChunkParameters parameters(index, last);
+    const size_t plaintext_size = buffer.size() - AES_GCM_TAG_SIZE;
+    try {
+        GCM<AES>::Encryption encryptor;
+        encryptor.SetKeyWithIV(m_key.data(),
+                               m_key.size(),
+                               parameters.nonce.data(),
+                               parameters.nonce.size());
+        encryptor.EncryptAndAuthenticate(buffer.data(),
+                                         buffer.data() + plaintext_size,
+                                         AES_GCM_TAG_SIZE,
+                                         parameters.nonce.data(),
+                                         parameters.nonce.size(),
+                                         parameters.aad.data(),
+                                         parameters.aad.size(),
+                                         buffer.data(),
+                                         plaintext_size);
+        return EncryptionResult::SUCCESS;
+    } catch (...) {
+        return EncryptionResult::ENCRYPTION_FAILED;
+    }
+}
+
+EncryptionResult
+ChunkedAead::open(uint64_t index, bool last, std::span<uint8_t> buffer) const
+{
+    if (!valid_key_size(m_key.size())) {
+        return EncryptionResult::INVALID_KEY_SIZE;
+    }
+    if (buffer.size() < AES_GCM_TAG_SIZE) {
+        return EncryptionResult::INVALID_DATA;
+    }
+
+    const ChunkParameters parameters(index, last);
+    const size_t plaintext_size = buffer.size() - AES_GCM_TAG_SIZE;
+    bool verified = false;
+    try {
+        GCM<AES>::Decryption decryptor;
+        decryptor.SetKeyWithIV(m_key.data(),
+                               m_key.size(),
+                               parameters.nonce.data(),
+                               parameters.nonce.size());
+        verified = decryptor.DecryptAndVerify(buffer.data(),
+                                              buffer.data() + plaintext_size,
+                                              AES_GCM_TAG_SIZE,
+                                              parameters.nonce.data(),
+                                              parameters.nonce.size(),
+                                              parameters.aad.data(),
+                                              parameters.aad.size(),
+                                              buffer.data(),
+                                              plaintext_size);
+    } catch (...) {
+    }
+
+    // Unauthenticated plaintext never stays behind
+    if (!verified) {
+        std::fill(buffer.begin(), buffer.begin() + plaintext_size, 0);
+        return EncryptionResult::DECRYPTION_FAILED;
+    }
+    return EncryptionResult::SUCCESS;
+}
+
+} // namespace crypto
+} // namespace common
+} // namespace fenris
@@ -0,0 +1,397 @@
+#include "common/codec.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <climits>
+#include <cstring>
+
+namespace fenris {
+namespace common {
+namespace compress {
+
+std::string codec_id_to_string(CodecId id)
+{
+    switch (id) {
+    case CodecId::NONE:
+        return "none";
+    case CodecId::DEFLATE:
+        return "deflate";
+    case CodecId::LZ4:
+        return "lz4";
+    default:
+        return "unknown codec";
+    }
+}
+
+uint32_t available_codecs()
+{
+    return codec_mask(CodecId::NONE) | codec_mask(CodecId::DEFLATE) |
+           codec_mask(CodecId::LZ4);
+}
+
+namespace {
+
+// Every sync flush ends in this empty stored block. It is left out of the
+// compressed message and put back before decoding, as permessage-deflate
+// does.
+constexpr std::array<uint8_t, 4> SYNC_TRAILER = {0x00, 0x00, 0xFF, 0xFF};
+
+// LZ4 block format limits, see lz4_Block_format.md
+constexpr size_t LZ4_MIN_MATCH = 4;
+// The last 5 bytes are always literals
+constexpr size_t LZ4_LAST_LITERALS = 5;
+// No match starts in the last 12 bytes
+constexpr size_t LZ4_MATCH_FINDER_LIMIT = 12;
+constexpr size_t LZ4_MAX_OFFSET = 65535;
+// Token nibbles saturate at this and continue in extra bytes
+constexpr size_t LZ4_RUN_MASK = 15;
+
+// 16K entries of match candidates, 64 KiB that stay in L2
+constexpr int LZ4_HASH_LOG = 14;
+
+// Bytes stored as they are
+class StoreCodec : public Codec {
+  public:
+    CodecId id() const override
+    {
+        return CodecId::NONE;
+    }
+
+    CompressionResult compress(std::span<const uint8_t> input,
+                               std::vector<uint8_t> &output) override
+    {
+        output.insert(output.end(), input.begin(), input.end());
+        return CompressionResult::SUCCESS;
+    }
+
+    CompressionResult decompress(std::span<const uint8_t> input,
+                                 size_t max_output,
+                                 std::vector<uint8_t> &output) override
+    {
+        if (max_output != 0 && input.size() > max_output) {
+            return CompressionResult::BUFFER_TOO_SMALL;
+        }
+        output.insert(output.end(), input.begin(), input.end());
+        return CompressionResult::SUCCESS;
+    }
+
+    void reset() override
+    {
+    }
+};
+
+// One deflate stream per direction, synced after every message
+class DeflateCodec : public Codec {
+  public:
+    explicit DeflateCodec(const CodecOptions &options)
+        : m_compressor(options.level)
+    {
+        if (!options.dictionary.empty()) {
+            m_compressor.set_dictionary(options.dictionary);
+            m_decompressor.set_dictionary(options.dictionary);
+        }
+    }
+
+    CodecId id() const override
+    {
+        return CodecId::DEFLATE;
+    }
+
+    CompressionResult compress(std::span<const uint8_t> input,
+                               std::vector<uint8_t> &output) override
+    {
+        const size_t start = output.size();
+        CompressionResult result = m_compressor.compress(
+            input.data(), input.size(), StreamFlush::SYNC, output);
+        if (result != CompressionResult::SUCCESS) {
+            return result;
+        }
+
+        if (output.size() - start > SYNC_TRAILER.size() &&
+            std::equal(SYNC_TRAILER.begin(),
+                       SYNC_TRAILER.end(),
+                       output.end() - SYNC_TRAILER.size())) {
+            output.resize(output.size() - SYNC_TRAILER.size());
+        }
+        return CompressionResult::SUCCESS;
+    }
+
+    CompressionResult decompress(std::span<const uint8_t> input,
+                                 size_t max_output,
+                                 std::vector<uint8_t> &output) override
+    {
+        const size_t start = output.size();
+        m_decompressor.set_max_output(max_output);
+        CompressionResult result =
+            m_decompressor.decompress(input.data(), input.size(), output);
+        if (result == CompressionResult::SUCCESS) {
+            result = m_decompressor.decompress(
+                SYNC_TRAILER.data(), SYNC_TRAILER.size(), output);
+        }
+        if (result == CompressionResult::SUCCESS && max_output != 0 &&
+            output.size() - start > max_output) {
+            result = CompressionResult::BUFFER_TOO_SMALL;
+        }
+        return result;
+    }
+
+    void reset() override
+    {
+        m_compressor.reset();
+        m_decompressor.reset();
+    }
+
+  private:
+    StreamCompressor m_compressor;
+    StreamDecompressor m_decompressor;
+};
+
+uint32_t read32(const uint8_t *data)
+{
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+uint32_t lz4_hash(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+// Length of the common prefix of a and b, at most limit bytes
+size_t common_length(const uint8_t *a, const uint8_t *b, size_t limit)
+{
+    size_t length = 0;
+    if constexpr (std::endian::native == std::endian::little) {
+        while (length + sizeof(uint64_t) <= limit) {
+            uint64_t x;
+            uint64_t y;
+            std::memcpy(&x, a + length, sizeof(x));
+            std::memcpy(&y, b + length, sizeof(y));
+            if (x != y) {
+                return length + std::countr_zero(x ^ y) / CHAR_BIT;
+            }
+            length += sizeof(uint64_t);
+        }
+    }
+    while (length < limit && a[length] == b[length]) {
+        ++length;
+    }
+    return length;
+}
+
+// Rest of a length whose token nibble saturated
+void write_length(std::vector<uint8_t> &output, size_t length)
+{
+    length -= LZ4_RUN_MASK;
+    while (length >= 255) {
+        output.push_back(255);
+        length -= 255;
+    }
+    output.push_back(static_cast<uint8_t>(length));
+}
+
+bool read_length(const uint8_t *&in, const uint8_t *end, size_t &length)
+{
+    uint8_t byte;
+    do {
+        if (in == end) {
+            return false;
+        }
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Literals, then a match unless this is the last sequence of the block
+void write_sequence(std::vector<uint8_t> &output,
+                    const uint8_t *literals,
+                    size_t literal_length,
+                    size_t offset,
+                    size_t match_length)
+{
+    const size_t match_code =
+        match_length == 0 ? 0 : match_length - LZ4_MIN_MATCH;
+    output.push_back(
+        static_cast<uint8_t>((std::min(literal_length, LZ4_RUN_MASK) << 4) |
+                             std::min(match_code, LZ4_RUN_MASK)));
+    if (literal_length >= LZ4_RUN_MASK) {
+        write_length(output, literal_length);
+    }
+    output.insert(output.end(), literals, literals + literal_length);
+
+    if (match_length == 0) {
+        return;
+    }
+    output.push_back(static_cast<uint8_t>(offset));
+    output.push_back(static_cast<uint8_t>(offset >> 8));
+    if (match_code >= LZ4_RUN_MASK) {
+        write_length(output, match_code);
+    }
+}
+
+// Blocks of the LZ4 block format, each message on its own. The match table
+// is kept across messages and invalidated by moving its base instead of
+// clearing it, so small messages do not pay for 64 KiB of memset.
+class Lz4Codec : public Codec {
+  public:
+    Lz4Codec() : m_table(size_t{1} << LZ4_HASH_LOG, 0)
+    {
+    }
+
+    CodecId id() const override
+    {
+        return CodecId::LZ4;
+    }
+
+    CompressionResult compress(std::span<const uint8_t> input,
+                               std::vector<uint8_t> &output) override
+    {
+        const uint8_t *src = input.data();
+        const size_t size = input.size();
+        if (uint64_t{m_base} + size >= UINT32_MAX) {
+            reset();
+            if (uint64_t{m_base} + size >= UINT32_MAX) {
+                return CompressionResult::COMPRESSION_FAILED;
+            }
+        }
+        output.reserve(output.size() + size + size / 255 + 16);
+
+        size_t anchor = 0;
+        if (size > LZ4_MATCH_FINDER_LIMIT) {
+            const size_t match_limit = size - LZ4_MATCH_FINDER_LIMIT;
+            const size_t extend_limit = size - LZ4_LAST_LITERALS;
+            size_t pos = 0;
+            while (pos < match_limit) {
+                const uint32_t sequence = read32(src + pos);
+                uint32_t &slot = m_table[lz4_hash(sequence)];
+                const uint32_t candidate = slot;
+                slot = m_base + static_cast<uint32_t>(pos);
+
+                // Entries below the base are from earlier messages
+                if (candidate >= m_base) {
+                    const size_t ref = candidate - m_base;
+                    if (pos - ref <= LZ4_MAX_OFFSET &&
+                        read32(src + ref) == sequence) {
+                        const size_t length =
+                            LZ4_MIN_MATCH +
+                            common_length(src + ref + LZ4_MIN_MATCH,
+                                          src + pos + LZ4_MIN_MATCH,
+                                          extend_limit - pos - LZ4_MIN_MATCH);
+                        write_sequence(output,
+                                       src + anchor,
+                                       pos - anchor,
+                                       pos - ref,
+                                       length);
+                        pos += length;
+                        anchor = pos;
+                        continue;
+                    }
+                }
+                // Skip ahead faster the longer nothing matched
+                pos += 1 + ((pos - anchor) >> 6);
+            }
+        }
+
+        write_sequence(output, src + anchor, size - anchor, 0, 0);
+        m_base += static_cast<uint32_t>(size) + 1;
+        return CompressionResult::SUCCESS;
+    }
+
+    CompressionResult decompress(std::span<const uint8_t> input,
+                                 size_t max_output,
+                                 std::vector<uint8_t> &output) override
+    {
+        const uint8_t *in = input.data();
+        const uint8_t *end = in + input.size();
+        const size_t start = output.size();
+        const size_t limit = max_output == 0 ? SIZE_MAX : max_output;
+
+        // Every block ends with a sequence of literals only
+        while (in != end) {
+            const uint8_t token = *in++;
+            size_t literal_length = token >> 4;
+            if (literal_length == LZ4_RUN_MASK &&
+                !read_length(in, end, literal_length)) {
+                return CompressionResult::INVALID_DATA;
+            }
+            if (literal_length > static_cast<size_t>(end - in)) {
+                return CompressionResult::INVALID_DATA;
+            }
+            if (literal_length > limit - (output.size() - start)) {
+                return CompressionResult::BUFFER_TOO_SMALL;
+            }
+            output.insert(output.end(), in, in + literal_length);
+            in += literal_length;
+            if (in == end) {
+                return CompressionResult::SUCCESS;
+            }
+
+            if (end - in < 2) {
+                return CompressionResult::INVALID_DATA;
+            }
+            const size_t offset = in[0] | (static_cast<size_t>(in[1]) << 8);
+            in += 2;
+            if (offset == 0 || offset > output.size() - start) {
+                return CompressionResult::INVALID_DATA;
+            }
+
+            size_t match_length = token & LZ4_RUN_MASK;
+            if (match_length == LZ4_RUN_MASK &&
+                !read_length(in, end, match_length)) {
+                return CompressionResult::INVALID_DATA;
+            }
+            match_length += LZ4_MIN_MATCH;
+            if (match_length > limit - (output.size() - start)) {
+                return CompressionResult::BUFFER_TOO_SMALL;
+            }
+
+            const size_t to = output.size();
+            output.resize(to + match_length);
+            uint8_t *out = output.data();
+            if (offset >= match_length) {
+                std::memcpy(out + to, out + to - offset, match_length);
+            } else {
+                // Overlapping matches repeat the last offset bytes
+                for (size_t i = 0; i < match_length; ++i) {
+                    out[to + i] = out[to - offset + i];
+                }
+            }
+        }
+
+        return CompressionResult::INVALID_DATA;
+    }
+
+    void reset() override
+    {
+        std::fill(m_table.begin(), m_table.end(), 0);
+        m_base = 1;
+    }
+
+  private:
+    std::vector<uint32_t> m_table;
+    // Added to positions in the current message, entries below it are stale
+    uint32_t m_base{1};
+};
+
+} // namespace
+
+std::unique_ptr<Codec> make_codec(CodecId id, const CodecOptions &options)
+{
+    switch (id) {
+    case CodecId::NONE:
+        return std::make_unique<StoreCodec>();
+    case CodecId::DEFLATE:
+        return std::make_unique<DeflateCodec>(options);
+    case CodecId::LZ4:
+        return std::make_unique<Lz4Codec>();
+    default:
+        return nullptr;
+    }
+}
+
+} // namespace compress
+} // namespace common
+} // namespace fenris
@@ -1,5 +1,8 @@
 #include "common/compression_manager.hpp"
+#include <algorithm>
+#include <climits>
 #include <stdexcept>
+#include <utility>
 #include <vector>
 #include <zlib.h>
 
@@ -7,7 +10,7 @@ namespace fenris {
 namespace common {
 namespace compress {
 
-std::string compression_error_to_string(CompressionResult result)
+std::string compression_result_to_string(CompressionResult result)
 {
     switch (result) {
     case CompressionResult::SUCCESS:
@@ -101,6 +104,321 @@ CompressionManager::decompress(const std::vector<uint8_t> &input,
     return {decompressed_data, CompressionResult::SUCCESS};
 }
 
+namespace {
+
+// Output is grown by this much whenever zlib fills what it was given
+constexpr size_t STREAM_OUTPUT_STEP = 16 * 1024;
+
+// Largest input zlib takes in one go, avail_in is 32 bits wide
+constexpr size_t MAX_STREAM_INPUT = UINT_MAX;
+
+// zlib only looks back 32 KiB, more of a dictionary is dead weight
+constexpr size_t MAX_DICTIONARY_SIZE = 32 * 1024;
+
+// Make room for the next step of output and point the stream at it
+void grow_output(z_stream &stream, std::vector<uint8_t> &output)
+{
+    const size_t used = output.size();
+    output.resize(used + STREAM_OUTPUT_STEP);
+    stream.next_out = output.data() + used;
+    stream.avail_out = static_cast<uInt>(STREAM_OUTPUT_STEP);
+}
+
+// Drop the part of the last step zlib did not fill
+void trim_output(const z_stream &stream, std::vector<uint8_t> &output)
+{
+    output.resize(output.size() - stream.avail_out);
+}
+
+} // namespace
+
+// StreamCompressor implementation
+
+StreamCompressor::StreamCompressor(int level)
+    : m_level(level), m_stream(std::make_unique<z_stream>())
+{
+}
+
+StreamCompressor::~StreamCompressor()
+{
+    if (m_initialized) {
+        deflateEnd(m_stream.get());
+    }
+}
+
+StreamCompressor::StreamCompressor(StreamCompressor &&other) noexcept
+    : m_level(other.m_level), m_stream(std::move(other.m_stream)),
+      m_dictionary(std::move(other.m_dictionary)),
+      m_initialized(std::exchange(other.m_initialized, false))
+{
+}
+
+StreamCompressor &
+StreamCompressor::operator=(StreamCompressor &&other) noexcept
+{
+    if (this != &other) {
+        if (m_initialized) {
+            deflateEnd(m_stream.get());
+        }
+        m_level = other.m_level;
+        m_stream = std::move(other.m_stream);
+        m_dictionary = std::move(other.m_dictionary);
+        m_initialized = std::exchange(other.m_initialized, false);
+    }
+    return *this;
+}
+
+CompressionResult StreamCompressor::ensure_initialized()
+{
+    if (m_initialized) {
+        return CompressionResult::SUCCESS;
+    }
+    if (m_level < 0 || m_level > 9) {
+        return CompressionResult::INVALID_LEVEL;
+    }
+    if (!m_stream) {
+        // Moved from, give it a stream of its own again
+        m_stream = std::make_unique<z_stream>();
+    }
+
+    *m_stream = z_stream{};
+    const int zlib_result = deflateInit(m_stream.get(), m_level);
+    if (zlib_result != Z_OK) {
+        return zlib_error_to_compression_result(zlib_result);
+    }
+    m_initialized = true;
+    return apply_dictionary();
+}
+
+CompressionResult StreamCompressor::apply_dictionary()
+{
+    if (m_dictionary.empty()) {
+        return CompressionResult::SUCCESS;
+    }
+    const int zlib_result =
+        deflateSetDictionary(m_stream.get(),
+                             m_dictionary.data(),
+                             static_cast<uInt>(m_dictionary.size()));
+    return zlib_error_to_compression_result(zlib_result);
+}
+
+CompressionResult StreamCompressor::compress(const uint8_t *data,
+                                             size_t size,
+                                             StreamFlush flush,
+                                             std::vector<uint8_t> &output)
+{
+    CompressionResult result = ensure_initialized();
+    if (result != CompressionResult::SUCCESS) {
+        return result;
+    }
+
+    const int mode = flush == StreamFlush::FINISH ? Z_FINISH
+                     : flush == StreamFlush::SYNC ? Z_SYNC_FLUSH
+                                                  : Z_NO_FLUSH;
+    z_stream &stream = *m_stream;
+    size_t remaining = size;
+    do {
+        const size_t slice = std::min(remaining, MAX_STREAM_INPUT);
+        stream.next_in = const_cast<Bytef *>(data);
+        stream.avail_in = static_cast<uInt>(slice);
+        data += slice;
+        remaining -= slice;
+
+        // Only the last slice flushes
+        const int slice_mode = remaining == 0 ? mode : Z_NO_FLUSH;
+        int zlib_result;
+        do {
+            grow_output(stream, output);
+            zlib_result = deflate(&stream, slice_mode);
+            trim_output(stream, output);
+            if (zlib_result == Z_STREAM_ERROR) {
+                return CompressionResult::COMPRESSION_FAILED;
+            }
+            // Z_BUF_ERROR only means there was nothing left to do
+        } while (zlib_result != Z_BUF_ERROR &&
+                 (stream.avail_out == 0 ||
+                  (slice_mode == Z_FINISH && zlib_result != Z_STREAM_END)));
+    } while (remaining > 0);
+
+    if (flush == StreamFlush::FINISH) {
+        // Keeps the allocated state for the next stream
+        deflateReset(&stream);
+        return apply_dictionary();
+    }
+    return CompressionResult::SUCCESS;
+}
+
+void StreamCompressor::reset()
+{
+    if (m_initialized) {
+        deflateReset(m_stream.get());
+        apply_dictionary();
+    }
+}
+
+CompressionResult
+StreamCompressor::set_dictionary(std::span<const uint8_t> dictionary)
+{
+    if (dictionary.size() > MAX_DICTIONARY_SIZE) {
+        dictionary = dictionary.last(MAX_DICTIONARY_SIZE);
+    }
+    m_dictionary.assign(dictionary.begin(), dictionary.end());
+
+    if (!m_initialized) {
+        return CompressionResult::SUCCESS;
+    }
+    deflateReset(m_stream.get());
+    return apply_dictionary();
+}
+
+// StreamDecompressor implementation
+
+StreamDecompressor::StreamDecompressor(size_t max_output)
+    : m_max_output(max_output), m_stream(std::make_unique<z_stream>())
+{
+}
+
+StreamDecompressor::~StreamDecompressor()
+{
+    if (m_initialized) {
+        inflateEnd(m_stream.get());
+    }
+}
+
+StreamDecompressor::StreamDecompressor(StreamDecompressor &&other) noexcept
+    : m_max_output(other.m_max_output), m_stream(std::move(other.m_stream)),
+      m_dictionary(std::move(other.m_dictionary)),
+      m_initialized(std::exchange(other.m_initialized, false)),
+      m_at_stream_end(std::exchange(other.m_at_stream_end, true))
+{
+}
+
+StreamDecompressor &
+StreamDecompressor::operator=(StreamDecompressor &&other) noexcept
+{
+    if (this != &other) {
+        if (m_initialized) {
+            inflateEnd(m_stream.get());
+        }
+        m_max_output = other.m_max_output;
+        m_stream = std::move(other.m_stream);
+        m_dictionary = std::move(other.m_dictionary);
+        m_initialized = std::exchange(other.m_initialized, false);
+        m_at_stream_end = std::exchange(other.m_at_stream_end, true);
+    }
+    return *this;
+}
+
+CompressionResult StreamDecompressor::ensure_initialized()
+{
+    if (m_initialized) {
+        return CompressionResult::SUCCESS;
+    }
+    if (!m_stream) {
+        // Moved from, give it a stream of its own again
+        m_stream = std::make_unique<z_stream>();
+    }
+
+    *m_stream = z_stream{};
+    const int zlib_result = inflateInit(m_stream.get());
+    if (zlib_result != Z_OK) {
+        return CompressionResult::DECOMPRESSION_FAILED;
+    }
+    m_initialized = true;
+    return CompressionResult::SUCCESS;
+}
+
+CompressionResult StreamDecompressor::decompress(const uint8_t *data,
+                                                 size_t size,
+                                                 std::vector<uint8_t> &output)
+{
+    CompressionResult result = ensure_initialized();
+    if (result != CompressionResult::SUCCESS) {
+        return result;
+    }
+
+    z_stream &stream = *m_stream;
+    const size_t start = output.size();
+    size_t remaining = size;
+    while (remaining > 0) {
+        const size_t slice = std::min(remaining, MAX_STREAM_INPUT);
+        stream.next_in = const_cast<Bytef *>(data);
+        stream.avail_in = static_cast<uInt>(slice);
+        data += slice;
+        remaining -= slice;
+
+        do {
+            grow_output(stream, output);
+            const int zlib_result = inflate(&stream, Z_NO_FLUSH);
+            trim_output(stream, output);
+
+            switch (zlib_result) {
+            case Z_STREAM_END:
+                // Another stream may follow in the same input
+                m_at_stream_end = true;
+                inflateReset(&stream);
+                break;
+            case Z_OK:
+                m_at_stream_end = false;
+                break;
+            case Z_BUF_ERROR:
+                // Needs more input than this call has
+                break;
+            case Z_NEED_DICT:
+                // The stream names the dictionary by its checksum, zlib
+                // rejects any other
+                if (m_dictionary.empty() ||
+                    inflateSetDictionary(
+                        &stream,
+                        m_dictionary.data(),
+                        static_cast<uInt>(m_dictionary.size())) != Z_OK) {
+                    return CompressionResult::INVALID_DATA;
+                }
+                break;
+            case Z_DATA_ERROR:
+                return CompressionResult::INVALID_DATA;
+            default:
+                return CompressionResult::DECOMPRESSION_FAILED;
+            }
+
+            if (m_max_output != 0 && output.size() - start > m_max_output) {
+                return CompressionResult::BUFFER_TOO_SMALL;
+            }
+            if (zlib_result == Z_BUF_ERROR) {
+                break;
+            }
+        } while (stream.avail_in > 0 || stream.avail_out == 0);
+    }
+
+    return CompressionResult::SUCCESS;
+}
+
+bool StreamDecompressor::at_stream_end() const
+{
+    return m_at_stream_end;
+}
+
+void StreamDecompressor::reset()
+{
+    if (m_initialized) {
+        inflateReset(m_stream.get());
+    }
+    m_at_stream_end = true;
+}
+
+void StreamDecompressor::set_dictionary(std::span<const uint8_t> dictionary)
+{
+    if (dictionary.size() > MAX_DICTIONARY_SIZE) {
+        dictionary = dictionary.last(MAX_DICTIONARY_SIZE);
+    }
+    m_dictionary.assign(dictionary.begin(), dictionary.end());
+}
+
+void StreamDecompressor::set_max_output(size_t max_output)
+{
+    m_max_output = max_output;
+}
+
 } // namespace compress
 } // namespace common
 } // namespace fenris
@@ -1,4 +1,5 @@
 #include "common/crypto_manager.hpp"
+#include "common/metrics.hpp"
 
 #include <cryptopp/aes.h>
 #include <cryptopp/eccrypto.h>
@@ -10,6 +11,8 @@
 #include <cryptopp/secblock.h>
 #include <cryptopp/sha.h>
 
+#include <algorithm>
+#include <array>
 #include <stdexcept>
 #include <vector>
 
@@ -19,6 +22,52 @@ namespace crypto {
 
 using namespace CryptoPP;
 
+namespace {
+
+struct CipherMetrics {
+    Counter &operations;
+    Counter &bytes;
+    Counter &failures;
+};
+
+CipherMetrics make_cipher_metrics(const std::string &op)
+{
+    MetricsRegistry &registry = MetricsRegistry::global();
+    const MetricLabels labels = {{"op", op}};
+    return CipherMetrics{
+        registry.counter(
+            "fenris_crypto_operations_total", "AES-GCM passes", labels),
+        registry.counter("fenris_crypto_bytes_total",
+                         "Plaintext bytes passed through AES-GCM",
+                         labels),
+        registry.counter("fenris_crypto_failures_total",
+                         "AES-GCM passes that failed, decryptions that did "
+                         "not authenticate included",
+                         labels),
+    };
+}
+
+Histogram &key_agreement_latency()
+{
+    static Histogram &histogram = MetricsRegistry::global().histogram(
+        "fenris_key_agreement_seconds", "Time spent computing ECDH secrets");
+    return histogram;
+}
+
+} // namespace
+
+void record_cipher(CipherOp op, size_t bytes, EncryptionResult result)
+{
+    static std::array<CipherMetrics, 2> metrics = {
+        make_cipher_metrics("encrypt"), make_cipher_metrics("decrypt")};
+    CipherMetrics &cipher = metrics[static_cast<size_t>(op)];
+    cipher.operations.add();
+    cipher.bytes.add(bytes);
+    if (result != EncryptionResult::SUCCESS) {
+        cipher.failures.add();
+    }
+}
+
 std::string encryption_result_to_string(EncryptionResult result)
 {
     switch (result) {
@@ -36,6 +85,8 @@ std::string encryption_result_to_string(EncryptionResult result)
         return "decryption operation failed";
     case EncryptionResult::IV_GENERATION_FAILED:
         return "IV generation failed";
+    case EncryptionResult::REPLAYED_NONCE:
+        return "nonce replayed or out of sequence";
     default:
         return "unrecognized encryption result";
     }
@@ -91,7 +142,7 @@ CryptoManager::encrypt_data(const std::vector<uint8_t> &plaintext,
                     true,
                     new Redirector(encrypt_filter));
 
-        return {cipher, EncryptionResult::SUCCESS};
+        return {std::move(cipher), EncryptionResult::SUCCESS};
     } catch (...) {
         return {std::vector<uint8_t>(), EncryptionResult::ENCRYPTION_FAILED};
     }
@@ -131,12 +182,176 @@ CryptoManager::decrypt_data(const std::vector<uint8_t> &ciphertext,
                     true,
                     new Redirector(decrypt_filter));
 
-        return {plaintext, EncryptionResult::SUCCESS};
+        return {std::move(plaintext), EncryptionResult::SUCCESS};
     } catch (...) {
         return {std::vector<uint8_t>(), EncryptionResult::DECRYPTION_FAILED};
     }
 }
 
+std::pair<Buffer, EncryptionResult>
+CryptoManager::encrypt_buffer(std::span<const uint8_t> plaintext,
+                              const std::vector<uint8_t> &key,
+                              const std::vector<uint8_t> &iv)
+{
+    if (key.size() != 16 && key.size() != 24 && key.size() != 32) {
+        return {Buffer(), EncryptionResult::INVALID_KEY_SIZE};
+    }
+
+    if (iv.size() != AES_GCM_IV_SIZE) {
+        return {Buffer(), EncryptionResult::INVALID_IV_SIZE};
+    }
+
+    // Same layout the authenticated encryption filter produces: the
+    // ciphertext immediately followed by the tag
+    Buffer cipher = Buffer::allocate(plaintext.size() + AES_GCM_TAG_SIZE);
+    try {
+        GCM<AES>::Encryption encryptor;
+        encryptor.SetKeyWithIV(key.data(), key.size(), iv.data(), iv.size());
+        encryptor.EncryptAndAuthenticate(cipher.data(),
+                                         cipher.data() + plaintext.size(),
+                                         AES_GCM_TAG_SIZE,
+                                         iv.data(),
+                                         static_cast<int>(iv.size()),
+                                         nullptr,
+                                         0,
+                                         plaintext.data(),
+                                         plaintext.size());
+
+        return {std::move(cipher), EncryptionResult::SUCCESS};
+    } catch (...) {
+        return {Buffer(), EncryptionResult::ENCRYPTION_FAILED};
+    }
+}
+
+std::pair<Buffer, EncryptionResult>
+CryptoManager::decrypt_buffer(std::span<const uint8_t> ciphertext,
+                              const std::vector<uint8_t> &key,
+                              const std::vector<uint8_t> &iv)
+{
+    if (key.size() != 16 && key.size() != 24 && key.size() != 32) {
+        return {Buffer(), EncryptionResult::INVALID_KEY_SIZE};
+    }
+
+    if (iv.size() != AES_GCM_IV_SIZE) {
+        return {Buffer(), EncryptionResult::INVALID_IV_SIZE};
+    }
+
+    if (ciphertext.size() < AES_GCM_TAG_SIZE) {
+        return {Buffer(), EncryptionResult::INVALID_DATA};
+    }
+
+    const size_t plaintext_size = ciphertext.size() - AES_GCM_TAG_SIZE;
+    Buffer plaintext = Buffer::allocate(plaintext_size);
+    try {
+        GCM<AES>::Decryption decryptor;
+        decryptor.SetKeyWithIV(key.data(), key.size(), iv.data(), iv.size());
+        bool verified =
+            decryptor.DecryptAndVerify(plaintext.data(),
+                                       ciphertext.data() + plaintext_size,
+                                       AES_GCM_TAG_SIZE,
+                                       iv.data(),
+                                       static_cast<int>(iv.size()),
+                                       nullptr,
+                                       0,
+                                       ciphertext.data(),
+                                       plaintext_size);
+        if (!verified) {
+            return {Buffer(), EncryptionResult::DECRYPTION_FAILED};
+        }
+
+        return {std::move(plaintext), EncryptionResult::SUCCESS};
+    } catch (...) {
+        return {Buffer(), EncryptionResult::DECRYPTION_FAILED};
+    }
+}
+
+EncryptionResult
+CryptoManager::encrypt_in_place(std::span<uint8_t> buffer,
+                                const std::vector<uint8_t> &key,
+                                const std::vector<uint8_t> &iv)
+{
+    if (key.size() != 16 && key.size() != 24 && key.size() != 32) {
+        return EncryptionResult::INVALID_KEY_SIZE;
+    }
+
+    if (iv.size() != AES_GCM_IV_SIZE) {
+        return EncryptionResult::INVALID_IV_SIZE;
+    }
+
+    if (buffer.size() < AES_GCM_TAG_SIZE) {
+        return EncryptionResult::INVALID_DATA;
+    }
+
+    const size_t plaintext_size = buffer.size() - AES_GCM_TAG_SIZE;
+    try {
+        GCM<AES>::Encryption encryptor;
+        encryptor.SetKeyWithIV(key.data(), key.size(), iv.data(), iv.size());
+        encryptor.EncryptAndAuthenticate(buffer.data(),
+                                         buffer.data() + plaintext_size,
+                                         AES_GCM_TAG_SIZE,
+                                         iv.data(),
+                                         static_cast<int>(iv.size()),
+                                         nullptr,
+                                         0,
+                                         buffer.data(),
+                                         plaintext_size);
+        record_cipher(
+            CipherOp::ENCRYPT, plaintext_size, EncryptionResult::SUCCESS);
+        return EncryptionResult::SUCCESS;
+    } catch (...) {
+        record_cipher(CipherOp::ENCRYPT,
+                      plaintext_size,
+                      EncryptionResult::ENCRYPTION_FAILED);
+        return EncryptionResult::ENCRYPTION_FAILED;
+    }
+}
+
+EncryptionResult
+CryptoManager::decrypt_in_place(std::span<uint8_t> buffer,
+                                const std::vector<uint8_t> &key,
+                                const std::vector<uint8_t> &iv)
+{
+    if (key.size() != 16 && key.size() != 24 && key.size() != 32) {
+        return EncryptionResult::INVALID_KEY_SIZE;
+    }
+
+    if (iv.size() != AES_GCM_IV_SIZE) {
+        return EncryptionResult::INVALID_IV_SIZE;
+    }
+
+    if (buffer.size() < AES_GCM_TAG_SIZE) {
+        return EncryptionResult::INVALID_DATA;
+    }
+
+    const size_t plaintext_size = buffer.size() - AES_GCM_TAG_SIZE;
+    bool verified = false;
+    try {
+        GCM<AES>::Decryption decryptor;
+        decryptor.SetKeyWithIV(key.data(), key.size(), iv.data(), iv.size());
+        verified = decryptor.DecryptAndVerify(buffer.data(),
+                                              buffer.data() + plaintext_size,
+                                              AES_GCM_TAG_SIZE,
+                                              iv.data(),
+                                              static_cast<int>(iv.size()),
+                                              nullptr,
+                                              0,
+                                              buffer.data(),
+                                              plaintext_size);
+    } catch (...) {
+    }
+
+    // Unauthenticated plaintext never stays behind
+    if (!verified) {
+        std::fill(buffer.begin(), buffer.begin() + plaintext_size, 0);
+        record_cipher(CipherOp::DECRYPT,
+                      plaintext_size,
+                      EncryptionResult::DECRYPTION_FAILED);
+        return EncryptionResult::DECRYPTION_FAILED;
+    }
+    record_cipher(CipherOp::DECRYPT, plaintext_size, EncryptionResult::SUCCESS);
+    return EncryptionResult::SUCCESS;
+}
+
 std::tuple<std::vector<uint8_t>, std::vector<uint8_t>, ECDHResult>
 CryptoManager::generate_ecdh_keypair()
 {
@@ -171,6 +386,7 @@ CryptoManager::compute_ecdh_shared_secret(
     const std::vector<uint8_t> &private_key,
     const std::vector<uint8_t> &peer_public_key)
 {
+    ScopedTimer timer(key_agreement_latency());
     try {
         // Use the NIST P-256 curve
         ECDH<ECP>::Domain domain(ASN1::secp256r1());
@@ -247,11 +463,17 @@ CryptoManager::derive_key_from_shared_secret(
 std::pair<std::vector<uint8_t>, EncryptionResult>
 CryptoManager::generate_random_iv()
 {
-    std::vector<uint8_t> iv(AES_GCM_IV_SIZE);
+    return generate_random_bytes(AES_GCM_IV_SIZE);
+}
+
+std::pair<std::vector<uint8_t>, EncryptionResult>
+CryptoManager::generate_random_bytes(size_t size)
+{
+    std::vector<uint8_t> bytes(size);
     try {
         AutoSeededRandomPool rng;
-        rng.GenerateBlock(iv.data(), iv.size());
-        return {iv, EncryptionResult::SUCCESS};
+        rng.GenerateBlock(bytes.data(), bytes.size());
+        return {bytes, EncryptionResult::SUCCESS};
     } catch (...) {
         return {std::vector<uint8_t>(), EncryptionResult::IV_GENERATION_FAILED};
     }
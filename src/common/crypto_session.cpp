@@ -0,0 +1,211 @@
+#include "common/crypto_session.hpp"
+
+#include <cryptopp/aes.h>
+#include <cryptopp/gcm.h>
+
+#include <algorithm>
+
+namespace fenris {
+namespace common {
+namespace crypto {
+
+using namespace CryptoPP;
+
+struct CryptoSession::Ciphers {
+    GCM<AES>::Encryption encryptor;
+    GCM<AES>::Decryption decryptor;
+};
+
+CryptoSession::CryptoSession() = default;
+
+CryptoSession::~CryptoSession() = default;
+
+CryptoSession::CryptoSession(CryptoSession &&other) noexcept = default;
+
+CryptoSession &
+CryptoSession::operator=(CryptoSession &&other) noexcept = default;
+
+EncryptionResult CryptoSession::set_key(std::span<const uint8_t> key)
+{
+    if (key.size() != 16 && key.size() != 24 && key.size() != 32) {
+        return EncryptionResult::INVALID_KEY_SIZE;
+    }
+
+    try {
+        auto ciphers = std::make_unique<Ciphers>();
+        // Expands the key schedule and GCM tables, each message only
+        // loads its IV
+        ciphers->encryptor.SetKey(key.data(), key.size());
+        ciphers->decryptor.SetKey(key.data(), key.size());
+        m_ciphers = std::move(ciphers);
+        return EncryptionResult::SUCCESS;
+    } catch (...) {
+        m_ciphers.reset();
+        return EncryptionResult::INVALID_KEY_SIZE;
+    }
+}
+
+bool CryptoSession::has_key() const
+{
+    return m_ciphers != nullptr;
+}
+
+std::pair<Buffer, EncryptionResult>
+CryptoSession::encrypt(std::span<const uint8_t> plaintext,
+                       std::span<const uint8_t> iv)
+{
+    if (!m_ciphers) {
+        return {Buffer(), EncryptionResult::INVALID_KEY_SIZE};
+    }
+    if (iv.size() != AES_GCM_IV_SIZE) {
+        return {Buffer(), EncryptionResult::INVALID_IV_SIZE};
+    }
+
+    Buffer cipher = Buffer::allocate(plaintext.size() + AES_GCM_TAG_SIZE);
+    try {
+        // Resynchronizes to iv, the key schedule and tables stay
+        m_ciphers->encryptor.EncryptAndAuthenticate(
+            cipher.data(),
+            cipher.data() + plaintext.size(),
+            AES_GCM_TAG_SIZE,
+            iv.data(),
+            static_cast<int>(iv.size()),
+            nullptr,
+            0,
+            plaintext.data(),
+            plaintext.size());
+        record_cipher(
+            CipherOp::ENCRYPT, plaintext.size(), EncryptionResult::SUCCESS);
+        return {std::move(cipher), EncryptionResult::SUCCESS};
+    } catch (...) {
+        record_cipher(CipherOp::ENCRYPT,
+                      plaintext.size(),
+                      EncryptionResult::ENCRYPTION_FAILED);
+        return {Buffer(), EncryptionResult::ENCRYPTION_FAILED};
+    }
+}
+
+std::pair<Buffer, EncryptionResult>
+CryptoSession::decrypt(std::span<const uint8_t> ciphertext,
+                       std::span<const uint8_t> iv)
+{
+    if (!m_ciphers) {
+        return {Buffer(), EncryptionResult::INVALID_KEY_SIZE};
+    }
+    if (iv.size() != AES_GCM_IV_SIZE) {
+        return {Buffer(), EncryptionResult::INVALID_IV_SIZE};
+    }
+    if (ciphertext.size() < AES_GCM_TAG_SIZE) {
+        return {Buffer(), EncryptionResult::INVALID_DATA};
+    }
+
+    const size_t plaintext_size = ciphertext.size() - AES_GCM_TAG_SIZE;
+    Buffer plaintext = Buffer::allocate(plaintext_size);
+    try {
+        const bool verified = m_ciphers->decryptor.DecryptAndVerify(
+            plaintext.data(),
+            ciphertext.data() + plaintext_size,
+            AES_GCM_TAG_SIZE,
+            iv.data(),
+            static_cast<int>(iv.size()),
+            nullptr,
+            0,
+            ciphertext.data(),
+            plaintext_size);
+        if (!verified) {
+            record_cipher(CipherOp::DECRYPT,
+                          plaintext_size,
+                          EncryptionResult::DECRYPTION_FAILED);
+            return {Buffer(), EncryptionResult::DECRYPTION_FAILED};
+        }
+        record_cipher(
+            CipherOp::DECRYPT, plaintext_size, EncryptionResult::SUCCESS);
+        return {std::move(plaintext), EncryptionResult::SUCCESS};
+    } catch (...) {
+        record_cipher(CipherOp::DECRYPT,
+                      plaintext_size,
+                      EncryptionResult::DECRYPTION_FAILED);
+        return {Buffer(), EncryptionResult::DECRYPTION_FAILED};
+    }
+}
+
+EncryptionResult CryptoSession::encrypt_in_place(std::span<uint8_t> buffer,
+                                                 std::span<const uint8_t> iv)
+{
+    if (!m_ciphers) {
+        return EncryptionResult::INVALID_KEY_SIZE;
+    }
+    if (iv.size() != AES_GCM_IV_SIZE) {
+        return EncryptionResult::INVALID_IV_SIZE;
+    }
+    if (buffer.size() < AES_GCM_TAG_SIZE) {
+        return EncryptionResult::INVALID_DATA;
+    }
+
+    const size_t plaintext_size = buffer.size() - AES_GCM_TAG_SIZE;
+    try {
+        m_ciphers->encryptor.EncryptAndAuthenticate(
+            buffer.data(),
+            buffer.data() + plaintext_size,
+            AES_GCM_TAG_SIZE,
+            iv.data(),
+            static_cast<int>(iv.size()),
+            nullptr,
+            0,
+            buffer.data(),
+            plaintext_size);
+        record_cipher(
+            CipherOp::ENCRYPT, plaintext_size, EncryptionResult::SUCCESS);
+        return EncryptionResult::SUCCESS;
+    } catch (...) {
+        record_cipher(CipherOp::ENCRYPT,
+                      plaintext_size,
+                      EncryptionResult::ENCRYPTION_FAILED);
+        return EncryptionResult::ENCRYPTION_FAILED;
+    }
+}
+
+EncryptionResult CryptoSession::decrypt_in_place(std::span<uint8_t> buffer,
+                                                 std::span<const uint8_t> iv)
+{
+    if (!m_ciphers) {
+        return EncryptionResult::INVALID_KEY_SIZE;
+    }
+    if (iv.size() != AES_GCM_IV_SIZE) {
+        return EncryptionResult::INVALID_IV_SIZE;
+    }
+    if (buffer.size() < AES_GCM_TAG_SIZE) {
+        return EncryptionResult::INVALID_DATA;
+    }
+
+    const size_t plaintext_size = buffer.size() - AES_GCM_TAG_SIZE;
+    bool verified = false;
+    try {
+        verified = m_ciphers->decryptor.DecryptAndVerify(
+            buffer.data(),
+            buffer.data() + plaintext_size,
+            AES_GCM_TAG_SIZE,
+            iv.data(),
+            static_cast<int>(iv.size()),
+            nullptr,
+            0,
+            buffer.data(),
+            plaintext_size);
+    } catch (...) {
+    }
+
+    // Unauthenticated plaintext never stays behind
+    if (!verified) {
+        std::fill(buffer.begin(), buffer.begin() + plaintext_size, 0);
+        record_cipher(CipherOp::DECRYPT,
+                      plaintext_size,
+                      EncryptionResult::DECRYPTION_FAILED);
+        return EncryptionResult::DECRYPTION_FAILED;
+    }
+    record_cipher(CipherOp::DECRYPT, plaintext_size, EncryptionResult::SUCCESS);
+    return EncryptionResult::SUCCESS;
+}
+
+} // namespace crypto
+} // namespace common
+} // namespace fenris
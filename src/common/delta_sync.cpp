@@ -0,0 +1,385 @@
+#include "common/delta_sync.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cryptopp/sha.h>
+#include <limits>
+#include <optional>
+#include <string_view>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define FENRIS_DELTA_AVX2 1
+#endif
+
+namespace fenris {
+namespace common {
+namespace delta {
+
+namespace {
+
+using Digest = std::array<CryptoPP::byte, CryptoPP::SHA256::DIGESTSIZE>;
+
+// Leading STRONG_HASH_SIZE bytes of the SHA-256 of a block
+std::string strong_hash(std::span<const uint8_t> data)
+{
+    Digest digest;
+    CryptoPP::SHA256().CalculateDigest(digest.data(), data.data(), data.size());
+    return std::string(reinterpret_cast<const char *>(digest.data()),
+                       STRONG_HASH_SIZE);
+}
+
+// Add bytes to the running sums of weak_checksum(), a byte at a time
+void checksum_scalar(std::span<const uint8_t> data, uint32_t &a, uint32_t &b)
+{
+    for (uint8_t x : data) {
+        a += x;
+        b += a;
+    }
+}
+
+#ifdef FENRIS_DELTA_AVX2
+
+uint32_t horizontal_sum(__m256i v) __attribute__((target("avx2")));
+uint32_t horizontal_sum(__m256i v)
+{
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v),
+                                _mm256_extracti128_si256(v, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(sum));
+}
+
+// Add bytes to the running sums 32 at a time. Over a block of 32 bytes b
+// grows by 32 times a before the block plus sum((32 - j) * x[j]); the first
+// part is collected in prefix and multiplied out once at the end.
+void checksum_avx2(std::span<const uint8_t> data, uint32_t &a, uint32_t &b)
+    __attribute__((target("avx2")));
+void checksum_avx2(std::span<const uint8_t> data, uint32_t &a, uint32_t &b)
+{
+    const size_t blocks = data.size() / 32;
+    const __m256i weights = _mm256_setr_epi8(
+        32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16,
+        15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i zero = _mm256_setzero_si256();
+
+    __m256i sum = zero;
+    __m256i prefix = zero;
+    __m256i weighted = zero;
+    for (size_t i = 0; i < blocks; ++i) {
+        const __m256i x = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(data.data() + i * 32));
+        prefix = _mm256_add_epi32(prefix, sum);
+        // Four 64 bit sums of eight bytes, their upper halves stay 0
+        sum = _mm256_add_epi32(sum, _mm256_sad_epu8(x, zero));
+        weighted = _mm256_add_epi32(
+            weighted,
+            _mm256_madd_epi16(_mm256_maddubs_epi16(x, weights), ones));
+    }
+
+    const uint32_t count = static_cast<uint32_t>(blocks);
+    b += 32 * count * a + 32 * horizontal_sum(prefix) +
+         horizontal_sum(weighted);
+    a += horizontal_sum(sum);
+    checksum_scalar(data.subspan(blocks * 32), a, b);
+}
+
+bool has_avx2()
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+#endif
+
+// Write all of data, retrying short writes
+bool write_all(int fd, std::span<const uint8_t> data)
+{
+    size_t total = 0;
+    while (total < data.size()) {
+        const ssize_t n =
+            ::write(fd, data.data() + total, data.size() - total);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        total += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+std::span<const uint8_t> as_bytes(const std::string &data)
+{
+    return {reinterpret_cast<const uint8_t *>(data.data()), data.size()};
+}
+
+// Appends literal bytes and block copies to a delta, merging neighbours
+class DeltaBuilder {
+  public:
+    explicit DeltaBuilder(fenris::Delta &delta) : m_delta(delta) {}
+
+    void literal(std::span<const uint8_t> data)
+    {
+        if (data.empty()) {
+            return;
+        }
+        if (m_last == nullptr || m_last->copy_count() != 0) {
+            m_last = m_delta.add_ops();
+        }
+        m_last->mutable_literal()->append(
+            reinterpret_cast<const char *>(data.data()), data.size());
+    }
+
+    void copy(uint64_t block)
+    {
+        if (m_last != nullptr && m_last->copy_count() != 0 &&
+            m_last->copy_block() + m_last->copy_count() == block) {
+            m_last->set_copy_count(m_last->copy_count() + 1);
+            return;
+        }
+        m_last = m_delta.add_ops();
+        m_last->set_copy_block(block);
+        m_last->set_copy_count(1);
+    }
+
+    // Block that would extend the last copy
+    uint64_t next_block() const
+    {
+        if (m_last == nullptr || m_last->copy_count() == 0) {
+            return std::numeric_limits<uint64_t>::max();
+        }
+        return m_last->copy_block() + m_last->copy_count();
+    }
+
+  private:
+    fenris::Delta &m_delta;
+    fenris::DeltaOp *m_last{nullptr};
+};
+
+} // namespace
+
+std::string delta_result_to_string(DeltaResult result)
+{
+    switch (result) {
+    case DeltaResult::SUCCESS:
+        return "success";
+    case DeltaResult::INVALID_DELTA:
+        return "invalid delta";
+    case DeltaResult::HASH_MISMATCH:
+        return "patched file does not match";
+    case DeltaResult::IO_ERROR:
+        return "I/O error";
+    default:
+        return "unrecognized error";
+    }
+}
+
+size_t block_size_for(uint64_t file_size)
+{
+    size_t block_size = MIN_DELTA_BLOCK_SIZE;
+    while (block_size < MAX_DELTA_BLOCK_SIZE &&
+           static_cast<uint64_t>(block_size) * block_size < file_size) {
+        block_size *= 2;
+    }
+    return block_size;
+}
+
+uint32_t weak_checksum(std::span<const uint8_t> data)
+{
+    uint32_t a = 0;
+    uint32_t b = 0;
+#ifdef FENRIS_DELTA_AVX2
+    if (has_avx2()) {
+        checksum_avx2(data, a, b);
+        return (a & 0xffff) | (b << 16);
+    }
+#endif
+    checksum_scalar(data, a, b);
+    return (a & 0xffff) | (b << 16);
+}
+
+RollingChecksum::RollingChecksum(std::span<const uint8_t> window)
+    : m_length(static_cast<uint32_t>(window.size()))
+{
+    const uint32_t checksum = weak_checksum(window);
+    // Only the low 16 bits of each sum take part in the checksum, so they
+    // are all that has to be right for rolling
+    m_a = checksum & 0xffff;
+    m_b = checksum >> 16;
+}
+
+fenris::FileSignatures compute_signatures(std::span<const uint8_t> data,
+                                          size_t block_size)
+{
+    fenris::FileSignatures signatures;
+    block_size = std::clamp<size_t>(block_size, 1, MAX_DELTA_BLOCK_SIZE);
+    signatures.set_block_size(static_cast<uint32_t>(block_size));
+    signatures.set_file_size(data.size());
+
+    for (size_t offset = 0; offset < data.size(); offset += block_size) {
+        const auto block =
+            data.subspan(offset, std::min(block_size, data.size() - offset));
+        auto *signature = signatures.add_blocks();
+        signature->set_weak(weak_checksum(block));
+        signature->set_strong(strong_hash(block));
+    }
+    return signatures;
+}
+
+fenris::Delta compute_delta(const fenris::FileSignatures &signatures,
+                            std::span<const uint8_t> target)
+{
+    fenris::Delta delta;
+    delta.set_block_size(signatures.block_size());
+    delta.set_base_size(signatures.file_size());
+    delta.set_base_modified_time(signatures.modified_time());
+    delta.set_target_size(target.size());
+
+    Digest digest;
+    CryptoPP::SHA256().CalculateDigest(
+        digest.data(), target.data(), target.size());
+    delta.set_target_hash(reinterpret_cast<const char *>(digest.data()),
+                          digest.size());
+
+    DeltaBuilder builder(delta);
+    const size_t block_size = signatures.block_size();
+    const uint64_t block_count =
+        block_size == 0
+            ? 0
+            : (signatures.file_size() + block_size - 1) / block_size;
+    if (block_count == 0 ||
+        static_cast<uint64_t>(signatures.blocks_size()) != block_count) {
+        builder.literal(target);
+        return delta;
+    }
+
+    // Full blocks are searched at every offset, a shorter last block is only
+    // looked for at the end of target
+    const size_t tail_size = signatures.file_size() % block_size;
+    const uint64_t full_blocks = tail_size == 0 ? block_count : block_count - 1;
+    std::unordered_map<uint32_t, std::vector<uint64_t>> by_weak;
+    by_weak.reserve(full_blocks);
+    for (uint64_t i = 0; i < full_blocks; ++i) {
+        by_weak[signatures.blocks(static_cast<int>(i)).weak()].push_back(i);
+    }
+
+    size_t literal_start = 0;
+    size_t pos = 0;
+    while (full_blocks != 0 && pos + block_size <= target.size()) {
+        RollingChecksum checksum(target.subspan(pos, block_size));
+        for (;;) {
+            auto candidates = by_weak.find(checksum.value());
+            std::optional<uint64_t> match;
+            if (candidates != by_weak.end()) {
+                const std::string strong =
+                    strong_hash(target.subspan(pos, block_size));
+                // Following the previous copy keeps the delta short
+                const uint64_t next = builder.next_block();
+                for (uint64_t block : candidates->second) {
+                    if (signatures.blocks(static_cast<int>(block)).strong() !=
+                        strong) {
+                        continue;
+                    }
+                    if (!match.has_value() || block == next) {
+                        match = block;
+                    }
+                    if (block == next) {
+                        break;
+                    }
+                }
+            }
+            if (match.has_value()) {
+                builder.literal(
+                    target.subspan(literal_start, pos - literal_start));
+                builder.copy(*match);
+                pos += block_size;
+                literal_start = pos;
+                break;
+            }
+            if (pos + block_size >= target.size()) {
+                pos = target.size();
+                break;
+            }
+            checksum.roll(target[pos], target[pos + block_size]);
+            ++pos;
+        }
+    }
+
+    size_t end = target.size();
+    if (tail_size != 0 && target.size() - literal_start >= tail_size) {
+        const auto tail = target.subspan(target.size() - tail_size);
+        const auto &signature =
+            signatures.blocks(static_cast<int>(block_count - 1));
+        if (weak_checksum(tail) == signature.weak() &&
+            strong_hash(tail) == signature.strong()) {
+            end -= tail_size;
+        }
+    }
+    builder.literal(target.subspan(literal_start, end - literal_start));
+    if (end != target.size()) {
+        builder.copy(block_count - 1);
+    }
+    return delta;
+}
+
+DeltaResult apply_delta(std::span<const uint8_t> base,
+                        const fenris::Delta &delta,
+                        int fd)
+{
+    if (delta.base_size() != base.size()) {
+        return DeltaResult::INVALID_DELTA;
+    }
+    const uint64_t block_size = delta.block_size();
+    const uint64_t block_count =
+        block_size == 0 ? 0 : (base.size() + block_size - 1) / block_size;
+
+    CryptoPP::SHA256 hash;
+    uint64_t written = 0;
+    for (const auto &op : delta.ops()) {
+        std::span<const uint8_t> data;
+        if (op.copy_count() != 0) {
+            if (!op.literal().empty() || op.copy_block() >= block_count ||
+                op.copy_count() > block_count - op.copy_block()) {
+                return DeltaResult::INVALID_DELTA;
+            }
+            const uint64_t start = op.copy_block() * block_size;
+            const uint64_t stop = std::min<uint64_t>(
+                (op.copy_block() + op.copy_count()) * block_size, base.size());
+            data = base.subspan(start, stop - start);
+        } else {
+            data = as_bytes(op.literal());
+        }
+
+        if (data.size() > delta.target_size() - written) {
+            return DeltaResult::INVALID_DELTA;
+        }
+        if (!write_all(fd, data)) {
+            return DeltaResult::IO_ERROR;
+        }
+        hash.Update(data.data(), data.size());
+        written += data.size();
+    }
+
+    if (written != delta.target_size()) {
+        return DeltaResult::INVALID_DELTA;
+    }
+    Digest digest;
+    hash.Final(digest.data());
+    if (delta.target_hash() !=
+        std::string_view(reinterpret_cast<const char *>(digest.data()),
+                         digest.size())) {
+        return DeltaResult::HASH_MISMATCH;
+    }
+    return DeltaResult::SUCCESS;
+}
+
+} // namespace delta
+} // namespace common
+} // namespace fenris
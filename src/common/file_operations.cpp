@@ -1,9 +1,23 @@
 #include "common/file_operations.hpp"
+#include "common/metrics.hpp"
+#include "common/tracing.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <cstdio>
+#include <dirent.h>
+#include <fcntl.h>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <system_error>
+#include <unistd.h>
 
 namespace fs = std::filesystem;
 
@@ -59,8 +73,14 @@ system_error_to_file_operation_result(const std::error_code &ec)
     case std::errc::directory_not_empty:
         return FileOperationResult::DIRECTORY_NOT_EMPTY;
 
+    case std::errc::operation_not_permitted:
+    case std::errc::read_only_file_system:
+        return FileOperationResult::PERMISSION_DENIED;
+
     case std::errc::invalid_argument:
     case std::errc::filename_too_long:
+    case std::errc::is_a_directory:
+    case std::errc::not_a_directory:
         return FileOperationResult::INVALID_PATH;
 
     case std::errc::io_error:
@@ -71,238 +91,673 @@ system_error_to_file_operation_result(const std::error_code &ec)
     }
 }
 
-std::pair<std::string, FileOperationResult>
-read_file(const std::string &filepath)
+namespace {
+
+FileOperationResult errno_to_file_operation_result(int error)
 {
-    std::string content;
-    std::error_code ec;
-    if (!fs::exists(filepath, ec)) {
-        return {content, FileOperationResult::FILE_NOT_FOUND};
+    return system_error_to_file_operation_result(
+        std::error_code(error, std::generic_category()));
+}
+
+// Attempts at finding an unused temporary name before giving up
+constexpr int TEMP_NAME_ATTEMPTS = 16;
+
+// Open a regular file for reading, the caller closes the descriptor
+std::pair<int, FileOperationResult>
+open_regular_file(int dirfd, const std::string &path, size_t &size)
+{
+    const int fd = ::openat(dirfd, path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return {-1, errno_to_file_operation_result(errno)};
     }
 
-    std::ifstream file(filepath, std::ios::binary);
-    if (!file) {
-        return {content, FileOperationResult::IO_ERROR};
+    struct stat status {};
+    if (::fstat(fd, &status) != 0) {
+        const int error = errno;
+        ::close(fd);
+        return {-1, errno_to_file_operation_result(error)};
+    }
+    if (!S_ISREG(status.st_mode)) {
+        ::close(fd);
+        return {-1, FileOperationResult::INVALID_PATH};
     }
 
-    // Get file size
-    file.seekg(0, std::ios::end);
-    const auto file_size = file.tellg();
-    file.seekg(0, std::ios::beg);
+    size = static_cast<size_t>(status.st_size);
+    return {fd, FileOperationResult::SUCCESS};
+}
 
-    content.resize(static_cast<size_t>(file_size));
+// Open a file for writing, the errno of open() tells why it failed
+std::pair<int, FileOperationResult>
+open_for_writing(int dirfd, const std::string &path, int flags)
+{
+    const int fd =
+        ::openat(dirfd, path.c_str(), O_WRONLY | O_CLOEXEC | flags, 0666);
+    if (fd < 0) {
+        return {-1, errno_to_file_operation_result(errno)};
+    }
+    return {fd, FileOperationResult::SUCCESS};
+}
 
-    if (!file.read(content.data(), file_size)) {
-        return {"", FileOperationResult::IO_ERROR};
+// Map the first size bytes of an open file, size must not be 0
+std::pair<Buffer, FileOperationResult>
+map_descriptor(int fd, size_t size, AccessPattern pattern)
+{
+    void *address = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (address == MAP_FAILED) {
+        return {Buffer(), errno_to_file_operation_result(errno)};
     }
 
-    return {content, FileOperationResult::SUCCESS};
+    // Only hints, the mapping works the same if the kernel ignores them
+    if (pattern == AccessPattern::SEQUENTIAL) {
+        ::madvise(address, size, MADV_SEQUENTIAL);
+        ::madvise(address, size, MADV_WILLNEED);
+    } else {
+        ::madvise(address, size, MADV_RANDOM);
+    }
+
+    std::shared_ptr<void> mapping(
+        address, [size](void *mapped) { ::munmap(mapped, size); });
+    return {Buffer::adopt(
+                std::move(mapping), static_cast<uint8_t *>(address), size),
+            FileOperationResult::SUCCESS};
 }
 
-FileOperationResult write_file(const std::string &filepath,
-                               const std::string &data)
+// Read up to length bytes at offset, false on error; total is cut short at
+// the end of the file
+bool read_at(int fd, char *data, size_t length, uint64_t offset, size_t &total)
 {
-    std::error_code ec;
-
-    // Check if file exists and is writable
-    if (fs::exists(filepath, ec)) {
-        fs::file_status file_status = fs::status(filepath, ec);
-        if (ec) {
-            return system_error_to_file_operation_result(ec);
+    total = 0;
+    while (total < length) {
+        const ssize_t n = ::pread(fd,
+                                  data + total,
+                                  length - total,
+                                  static_cast<off_t>(offset + total));
+        if (n < 0 && errno == EINTR) {
+            continue;
         }
-
-        if ((file_status.permissions() & fs::perms::owner_write) ==
-            fs::perms::none) {
-            return FileOperationResult::PERMISSION_DENIED;
+        if (n < 0) {
+            return false;
         }
-    } else {
-        // Check if parent directory exists and is writable
-        fs::path parent_path = fs::path(filepath).parent_path();
-        if (!parent_path.empty() && fs::exists(parent_path, ec)) {
-            fs::file_status parent_status = fs::status(parent_path, ec);
-            if (ec) {
-                return system_error_to_file_operation_result(ec);
-            }
-
-            if ((parent_status.permissions() & fs::perms::owner_write) ==
-                fs::perms::none) {
-                return FileOperationResult::PERMISSION_DENIED;
-            }
+        if (n == 0) {
+            // The file shrank since it was sized
+            break;
         }
+        total += static_cast<size_t>(n);
     }
+    return true;
+}
 
-    std::ofstream file(filepath, std::ios::binary | std::ios::trunc);
-    if (!file) {
-        if (errno == EACCES || errno == EPERM) {
-            return FileOperationResult::PERMISSION_DENIED;
+// Read up to size bytes of an open file into an uninitialized slab
+std::pair<Buffer, FileOperationResult>
+read_descriptor(int fd, size_t size, uint64_t offset = 0)
+{
+    Buffer content = Buffer::allocate(size);
+    size_t total = 0;
+    if (!read_at(fd,
+                 reinterpret_cast<char *>(content.data()),
+                 size,
+                 offset,
+                 total)) {
+        return {Buffer(), FileOperationResult::IO_ERROR};
+    }
+
+    content.truncate(total);
+    return {std::move(content), FileOperationResult::SUCCESS};
+}
+
+// Write all of data at the file position, or at offset if one is given
+FileOperationResult
+write_descriptor(int fd, std::string_view data, int64_t offset = -1)
+{
+    size_t total = 0;
+    while (total < data.size()) {
+        const ssize_t n =
+            offset < 0 ? ::write(fd, data.data() + total, data.size() - total)
+                       : ::pwrite(fd,
+                                  data.data() + total,
+                                  data.size() - total,
+                                  static_cast<off_t>(offset) +
+                                      static_cast<off_t>(total));
+        if (n < 0 && errno == EINTR) {
+            continue;
         }
-        return FileOperationResult::IO_ERROR;
+        if (n <= 0) {
+            const int error = n < 0 ? errno : EIO;
+            return error == EFBIG || error == EINVAL
+                       ? FileOperationResult::INVALID_PATH
+                       : FileOperationResult::IO_ERROR;
+        }
+        total += static_cast<size_t>(n);
     }
+    return FileOperationResult::SUCCESS;
+}
 
-    if (!file.write(data.data(), data.size())) {
+// Close a descriptor that was written to, close() can report write errors
+FileOperationResult close_written(int fd, FileOperationResult result)
+{
+    if (::close(fd) != 0 && result == FileOperationResult::SUCCESS) {
         return FileOperationResult::IO_ERROR;
     }
+    return result;
+}
 
-    return FileOperationResult::SUCCESS;
+void fill_file_info(FileInfo &file_info,
+                    const std::string &name,
+                    const struct stat &status)
+{
+    file_info.set_name(name);
+    // Directories and other non-regular files report size 0
+    file_info.set_size(
+        S_ISREG(status.st_mode) ? static_cast<uint64_t>(status.st_size) : 0);
+    file_info.set_is_directory(S_ISDIR(status.st_mode));
+    file_info.set_modified_time(to_modified_time(status.st_mtim));
+    file_info.set_permissions(status.st_mode & 0777);
 }
 
-FileOperationResult append_file(const std::string &filepath,
-                                const std::string &data)
+// Bytes of directory entries fetched per getdents64() call
+constexpr size_t DIRENT_BUFFER_SIZE = 32 * 1024;
+
+// Operations timed separately, the op label of fenris_file_operation_seconds
+enum class FileOp { READ, WRITE, APPEND, CREATE, DELETE, INFO, LIST, COUNT };
+
+Histogram &latency(FileOp op)
 {
-    std::error_code ec;
+    static const auto histograms = [] {
+        constexpr std::array<const char *, static_cast<size_t>(FileOp::COUNT)>
+            names = {
+                "read", "write", "append", "create", "delete", "info", "list"};
+        std::array<Histogram *, names.size()> histograms{};
+        for (size_t i = 0; i < names.size(); ++i) {
+            histograms[i] = &MetricsRegistry::global().histogram(
+                "fenris_file_operation_seconds",
+                "Time spent in file system calls, by operation",
+                {{"op", names[i]}});
+        }
+        return histograms;
+    }();
+    return *histograms[static_cast<size_t>(op)];
+}
 
-    // Check if file exists
-    if (!fs::exists(filepath, ec)) {
-        return FileOperationResult::FILE_NOT_FOUND;
-    }
+} // namespace
 
-    // Check file permissions
-    fs::file_status file_status = fs::status(filepath, ec);
-    if (ec) {
-        return system_error_to_file_operation_result(ec);
-    }
+uint64_t to_modified_time(const struct timespec &timestamp)
+{
+    const std::chrono::sys_time<std::chrono::nanoseconds> system_time(
+        std::chrono::seconds(timestamp.tv_sec) +
+        std::chrono::nanoseconds(timestamp.tv_nsec));
+    return static_cast<uint64_t>(std::chrono::file_clock::from_sys(system_time)
+                                     .time_since_epoch()
+                                     .count());
+}
 
-    // Check write permissions on the file
-    if ((file_status.permissions() & fs::perms::owner_write) ==
-        fs::perms::none) {
-        return FileOperationResult::PERMISSION_DENIED;
+DirectoryHandle::~DirectoryHandle()
+{
+    if (m_fd >= 0) {
+        ::close(m_fd);
     }
+}
+
+DirectoryHandle::DirectoryHandle(DirectoryHandle &&other) noexcept
+    : m_fd(std::exchange(other.m_fd, -1))
+{
+}
 
-    // Open file in binary mode with append flag
-    std::ofstream file(filepath, std::ios::binary | std::ios::app);
-    if (!file) {
-        // Check specifically for permission errors
-        if (errno == EACCES || errno == EPERM) {
-            return FileOperationResult::PERMISSION_DENIED;
+DirectoryHandle &DirectoryHandle::operator=(DirectoryHandle &&other) noexcept
+{
+    if (this != &other) {
+        if (m_fd >= 0) {
+            ::close(m_fd);
         }
-        return FileOperationResult::IO_ERROR;
+        m_fd = std::exchange(other.m_fd, -1);
     }
+    return *this;
+}
 
-    if (!file.write(data.data(), data.size())) {
-        return FileOperationResult::IO_ERROR;
-    }
+std::pair<DirectoryHandle, FileOperationResult>
+DirectoryHandle::open(const std::string &dirpath)
+{
+    return DirectoryHandle().open_directory(dirpath);
+}
 
-    return FileOperationResult::SUCCESS;
+std::pair<DirectoryHandle, FileOperationResult>
+DirectoryHandle::open_directory(const std::string &path) const
+{
+    DirectoryHandle directory;
+    directory.m_fd = ::openat(
+        dirfd(), path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directory.m_fd < 0) {
+        const int error = errno;
+        directory.m_fd = -1;
+        return {std::move(directory),
+                error == ENOTDIR ? FileOperationResult::INVALID_PATH
+                                 : errno_to_file_operation_result(error)};
+    }
+    return {std::move(directory), FileOperationResult::SUCCESS};
 }
 
-FileOperationResult create_file(const std::string &filepath)
+int DirectoryHandle::dirfd() const
 {
-    std::error_code ec;
+    return m_fd >= 0 ? m_fd : AT_FDCWD;
+}
 
-    if (fs::exists(filepath, ec)) {
-        return FileOperationResult::FILE_ALREADY_EXISTS;
+std::pair<std::string, FileOperationResult>
+DirectoryHandle::read_file(const std::string &path) const
+{
+    ScopedTimer timer(latency(FileOp::READ));
+    TraceScope trace(TraceStage::DISK);
+    size_t size = 0;
+    auto [fd, result] = open_regular_file(dirfd(), path, size);
+    if (result != FileOperationResult::SUCCESS) {
+        return {"", result};
+    }
+
+    std::string content(size, '\0');
+    size_t total = 0;
+    const bool read = read_at(fd, content.data(), size, 0, total);
+    ::close(fd);
+    if (!read) {
+        return {"", FileOperationResult::IO_ERROR};
     }
 
-    // Check if parent directory exists and is writable
-    fs::path parent_path = fs::path(filepath).parent_path();
-    if (!parent_path.empty()) {
-        if (!fs::exists(parent_path, ec)) {
-            return FileOperationResult::FILE_NOT_FOUND;
-        }
+    content.resize(total);
+    return {std::move(content), FileOperationResult::SUCCESS};
+}
 
-        // Check write permissions on parent directory
-        fs::file_status parent_status = fs::status(parent_path, ec);
-        if (ec) {
-            return system_error_to_file_operation_result(ec);
-        }
+std::pair<Buffer, FileOperationResult>
+DirectoryHandle::read_file_buffer(const std::string &path,
+                                  size_t map_threshold) const
+{
+    ScopedTimer timer(latency(FileOp::READ));
+    TraceScope trace(TraceStage::DISK);
+    size_t size = 0;
+    auto [fd, result] = open_regular_file(dirfd(), path, size);
+    if (result != FileOperationResult::SUCCESS) {
+        return {Buffer(), result};
+    }
 
-        // If we can't write to the directory, return permission denied
-        if ((parent_status.permissions() & fs::perms::owner_write) ==
-            fs::perms::none) {
-            return FileOperationResult::PERMISSION_DENIED;
-        }
+    std::pair<Buffer, FileOperationResult> content{
+        Buffer(), FileOperationResult::SUCCESS};
+    if (size != 0 && map_threshold != 0 && size >= map_threshold) {
+        content = map_descriptor(fd, size, AccessPattern::SEQUENTIAL);
+    } else if (size != 0) {
+        content = read_descriptor(fd, size);
     }
 
-    std::ofstream file(filepath);
-    if (!file) {
-        // Check specifically for permission errors
-        if (errno == EACCES || errno == EPERM) {
-            return FileOperationResult::PERMISSION_DENIED;
-        }
-        return FileOperationResult::IO_ERROR;
+    ::close(fd);
+    return content;
+}
+
+std::pair<Buffer, FileOperationResult>
+DirectoryHandle::read_file_range(const std::string &path,
+                                 uint64_t offset,
+                                 size_t length,
+                                 uint64_t *file_size,
+                                 const Prefetch &prefetch) const
+{
+    ScopedTimer timer(latency(FileOp::READ));
+    TraceScope trace(TraceStage::DISK);
+    size_t size = 0;
+    auto [fd, result] = open_regular_file(dirfd(), path, size);
+    if (result != FileOperationResult::SUCCESS) {
+        return {Buffer(), result};
+    }
+    if (file_size != nullptr) {
+        *file_size = size;
     }
-    file.close();
 
-    if (!fs::exists(filepath, ec)) {
-        return system_error_to_file_operation_result(ec);
+    std::pair<Buffer, FileOperationResult> range{
+        Buffer(), FileOperationResult::SUCCESS};
+    if (offset < size && length != 0) {
+        range = read_descriptor(
+            fd,
+            static_cast<size_t>(std::min<uint64_t>(length, size - offset)),
+            offset);
     }
 
-    return FileOperationResult::SUCCESS;
+    // Only queues the reads, advice past the end of the file is ignored
+    if (prefetch.length != 0 && prefetch.offset < size) {
+        ::posix_fadvise(fd,
+                        static_cast<off_t>(prefetch.offset),
+                        static_cast<off_t>(prefetch.length),
+                        POSIX_FADV_WILLNEED);
+    }
+
+    ::close(fd);
+    return range;
 }
 
-FileOperationResult delete_file(const std::string &filepath)
+FileOperationResult DirectoryHandle::write_file(const std::string &path,
+                                                std::string_view data) const
 {
-    std::error_code ec;
+    ScopedTimer timer(latency(FileOp::WRITE));
+    TraceScope trace(TraceStage::DISK);
+    auto [fd, result] = open_for_writing(dirfd(), path, O_CREAT | O_TRUNC);
+    if (result != FileOperationResult::SUCCESS) {
+        return result;
+    }
+    return close_written(fd, write_descriptor(fd, data));
+}
 
-    if (!fs::exists(filepath, ec)) {
-        return FileOperationResult::FILE_NOT_FOUND;
+FileOperationResult DirectoryHandle::append_file(const std::string &path,
+                                                 std::string_view data) const
+{
+    ScopedTimer timer(latency(FileOp::APPEND));
+    TraceScope trace(TraceStage::DISK);
+    auto [fd, result] = open_for_writing(dirfd(), path, O_APPEND);
+    if (result != FileOperationResult::SUCCESS) {
+        return result;
     }
+    return close_written(fd, write_descriptor(fd, data));
+}
 
-    if (!fs::is_regular_file(filepath, ec)) {
+FileOperationResult DirectoryHandle::write_file_at(const std::string &path,
+                                                   uint64_t offset,
+                                                   std::string_view data) const
+{
+    ScopedTimer timer(latency(FileOp::WRITE));
+    TraceScope trace(TraceStage::DISK);
+    // No O_CREAT, a range write into a missing file is a client error
+    auto [fd, result] = open_for_writing(dirfd(), path, 0);
+    if (result != FileOperationResult::SUCCESS) {
+        return result;
+    }
+    if (offset > static_cast<uint64_t>(std::numeric_limits<off_t>::max())) {
+        ::close(fd);
         return FileOperationResult::INVALID_PATH;
     }
+    return close_written(
+        fd, write_descriptor(fd, data, static_cast<int64_t>(offset)));
+}
 
-    if (!fs::remove(filepath, ec)) {
-        return system_error_to_file_operation_result(ec);
+FileOperationResult DirectoryHandle::create_file(const std::string &path) const
+{
+    ScopedTimer timer(latency(FileOp::CREATE));
+    TraceScope trace(TraceStage::DISK);
+    auto [fd, result] = open_for_writing(dirfd(), path, O_CREAT | O_EXCL);
+    if (result != FileOperationResult::SUCCESS) {
+        return result;
     }
+    return close_written(fd, FileOperationResult::SUCCESS);
+}
 
+FileOperationResult DirectoryHandle::delete_file(const std::string &path) const
+{
+    ScopedTimer timer(latency(FileOp::DELETE));
+    TraceScope trace(TraceStage::DISK);
+    // unlink() refuses directories itself, no need to look first
+    if (::unlinkat(dirfd(), path.c_str(), 0) != 0) {
+        return errno_to_file_operation_result(errno);
+    }
     return FileOperationResult::SUCCESS;
 }
 
+std::pair<int, FileOperationResult>
+DirectoryHandle::create_temp_file(const std::string &path,
+                                  std::string &temp_path) const
+{
+    static std::atomic<uint64_t> counter{0};
+
+    const fs::path file(path);
+    const fs::path parent =
+        file.has_parent_path() ? file.parent_path() : fs::path(".");
+    for (int attempt = 0; attempt < TEMP_NAME_ATTEMPTS; ++attempt) {
+        std::string name = ".";
+        name += file.filename().string();
+        name += ".tmp-";
+        name += std::to_string(::getpid());
+        name += '-';
+        name += std::to_string(counter++);
+        temp_path = (parent / name).string();
+        // 0666 lets the umask decide, as for any newly created file
+        const int fd = ::openat(dirfd(),
+                                temp_path.c_str(),
+                                O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                                0666);
+        if (fd >= 0) {
+            return {fd, FileOperationResult::SUCCESS};
+        }
+        if (errno != EEXIST) {
+            return {-1, errno_to_file_operation_result(errno)};
+        }
+    }
+    return {-1, FileOperationResult::FILE_ALREADY_EXISTS};
+}
+
+FileOperationResult DirectoryHandle::replace_file(const std::string &temp_path,
+                                                  const std::string &path,
+                                                  bool sync) const
+{
+    if (::renameat(dirfd(), temp_path.c_str(), dirfd(), path.c_str()) != 0) {
+        return errno_to_file_operation_result(errno);
+    }
+    if (!sync) {
+        return FileOperationResult::SUCCESS;
+    }
+
+    const fs::path parent = fs::path(path).parent_path();
+    const int fd = ::openat(dirfd(),
+                            parent.empty() ? "." : parent.c_str(),
+                            O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno_to_file_operation_result(errno);
+    }
+    const bool synced = ::fsync(fd) == 0;
+    ::close(fd);
+    return synced ? FileOperationResult::SUCCESS
+                  : FileOperationResult::IO_ERROR;
+}
+
 std::pair<fenris::FileInfo, FileOperationResult>
-get_file_info(const std::string &filepath)
+DirectoryHandle::get_file_info(const std::string &path) const
 {
-    std::error_code ec;
+    ScopedTimer timer(latency(FileOp::INFO));
+    TraceScope trace(TraceStage::DISK);
     FileInfo file_info;
+    struct stat status {};
+    if (::fstatat(dirfd(), path.c_str(), &status, 0) != 0) {
+        return {file_info, errno_to_file_operation_result(errno)};
+    }
 
-    // Check if file exists
-    if (!fs::exists(filepath, ec)) {
-        return {file_info, FileOperationResult::FILE_NOT_FOUND};
+    fill_file_info(file_info, path, status);
+    return {file_info, FileOperationResult::SUCCESS};
+}
+
+std::pair<DirectoryPage, FileOperationResult>
+DirectoryHandle::list_directory_page(const std::string &path,
+                                     uint64_t cursor,
+                                     size_t page_size,
+                                     bool names_only) const
+{
+    ScopedTimer timer(latency(FileOp::LIST));
+    TraceScope trace(TraceStage::DISK);
+    DirectoryPage page;
+    auto [directory, result] = open_directory(path);
+    if (result != FileOperationResult::SUCCESS) {
+        return {std::move(page), result};
     }
+    const int fd = directory.m_fd;
 
-    // Set file name
-    file_info.set_name(filepath);
+    if (cursor != 0 && ::lseek(fd, static_cast<off_t>(cursor), SEEK_SET) < 0) {
+        return {std::move(page), FileOperationResult::INVALID_PATH};
+    }
 
-    // Set file size (for regular files)
-    if (fs::is_regular_file(filepath, ec)) {
-        if (ec) {
-            return {file_info, system_error_to_file_operation_result(ec)};
+    alignas(struct dirent64) char buffer[DIRENT_BUFFER_SIZE];
+    while (page.entries.size() < page_size) {
+        const long bytes =
+            ::syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes < 0) {
+            return {DirectoryPage(), errno_to_file_operation_result(errno)};
+        }
+        if (bytes == 0) {
+            // End of the directory
+            page.next_cursor = 0;
+            return {std::move(page), FileOperationResult::SUCCESS};
         }
 
-        uintmax_t size = fs::file_size(filepath, ec);
-        if (ec) {
-            return {file_info, system_error_to_file_operation_result(ec)};
+        for (long position = 0;
+             position < bytes && page.entries.size() < page_size;) {
+            const auto *entry =
+                reinterpret_cast<const struct dirent64 *>(buffer + position);
+            position += entry->d_reclen;
+            // Resuming at d_off continues right after this entry
+            page.next_cursor = static_cast<uint64_t>(entry->d_off);
+
+            const std::string_view name(entry->d_name);
+            if (name == "." || name == "..") {
+                continue;
+            }
+
+            FileInfo file_info;
+            if (names_only && entry->d_type != DT_UNKNOWN) {
+                file_info.set_name(entry->d_name);
+                file_info.set_is_directory(entry->d_type == DT_DIR);
+                page.entries.push_back(std::move(file_info));
+                continue;
+            }
+
+            struct stat status {};
+            if (::fstatat(fd, entry->d_name, &status, 0) != 0) {
+                // Removed since it was read, or a dangling symlink
+                continue;
+            }
+            fill_file_info(file_info, entry->d_name, status);
+            if (names_only) {
+                file_info.clear_size();
+                file_info.clear_modified_time();
+                file_info.clear_permissions();
+            }
+            page.entries.push_back(std::move(file_info));
         }
-        file_info.set_size(size);
-    } else {
-        // For directories or other types, size is 0
-        file_info.set_size(0);
     }
 
-    // Check if it's a directory
-    file_info.set_is_directory(fs::is_directory(filepath, ec));
-    if (ec) {
-        return {file_info, system_error_to_file_operation_result(ec)};
+    return {std::move(page), FileOperationResult::SUCCESS};
+}
+
+std::pair<uintmax_t, FileOperationResult>
+DirectoryHandle::get_file_size(const std::string &path) const
+{
+    struct stat status {};
+    if (::fstatat(dirfd(), path.c_str(), &status, 0) != 0) {
+        return {0, errno_to_file_operation_result(errno)};
     }
+    if (!S_ISREG(status.st_mode)) {
+        return {0, FileOperationResult::INVALID_PATH};
+    }
+    return {static_cast<uintmax_t>(status.st_size),
+            FileOperationResult::SUCCESS};
+}
 
-    // Get last modified time
-    auto last_write = fs::last_write_time(filepath, ec);
-    if (ec) {
-        return {file_info, system_error_to_file_operation_result(ec)};
+std::pair<std::string, FileOperationResult>
+read_file(const std::string &filepath)
+{
+    return DirectoryHandle().read_file(filepath);
+}
+
+std::pair<Buffer, FileOperationResult> map_file(const std::string &filepath,
+                                                AccessPattern pattern)
+{
+    size_t size = 0;
+    auto [fd, result] = open_regular_file(AT_FDCWD, filepath, size);
+    if (result != FileOperationResult::SUCCESS) {
+        return {Buffer(), result};
     }
-    file_info.set_modified_time(last_write.time_since_epoch().count());
 
-    // Get permissions
-    fs::file_status status = fs::status(filepath, ec);
-    if (ec) {
-        return {file_info, system_error_to_file_operation_result(ec)};
+    // mmap() rejects empty mappings
+    std::pair<Buffer, FileOperationResult> mapped{
+        Buffer(), FileOperationResult::SUCCESS};
+    if (size != 0) {
+        mapped = map_descriptor(fd, size, pattern);
     }
-    auto perms = status.permissions();
-    file_info.set_permissions(static_cast<uint32_t>(
-        perms &
-        (fs::perms::owner_all | fs::perms::group_all | fs::perms::others_all)));
 
-    return {file_info, FileOperationResult::SUCCESS};
+    // The mapping stays valid once the descriptor is closed
+    ::close(fd);
+    return mapped;
+}
+
+std::pair<Buffer, FileOperationResult>
+read_file_buffer(const std::string &filepath, size_t map_threshold)
+{
+    return DirectoryHandle().read_file_buffer(filepath, map_threshold);
+}
+
+FileOperationResult write_file(const std::string &filepath,
+                               const std::string &data)
+{
+    return DirectoryHandle().write_file(filepath, data);
+}
+
+FileOperationResult append_file(const std::string &filepath,
+                                const std::string &data)
+{
+    return DirectoryHandle().append_file(filepath, data);
+}
+
+std::pair<std::string, FileOperationResult>
+read_file_chunk(const std::string &filepath, uint64_t offset, size_t length)
+{
+    size_t size = 0;
+    auto [fd, result] = open_regular_file(AT_FDCWD, filepath, size);
+    if (result != FileOperationResult::SUCCESS) {
+        return {"", result};
+    }
+    if (offset >= size) {
+        ::close(fd);
+        return {"", FileOperationResult::SUCCESS};
+    }
+
+    std::string content(
+        static_cast<size_t>(std::min<uint64_t>(length, size - offset)), '\0');
+    size_t total = 0;
+    const bool read =
+        read_at(fd, content.data(), content.size(), offset, total);
+    ::close(fd);
+    if (!read) {
+        return {"", FileOperationResult::IO_ERROR};
+    }
+
+    content.resize(total);
+    return {std::move(content), FileOperationResult::SUCCESS};
+}
+
+FileOperationResult write_file_chunk(const std::string &filepath,
+                                     uint64_t offset,
+                                     const std::string &data)
+{
+    // The first block (re)creates the file, later ones patch it in place
+    return offset == 0 ? write_file(filepath, data)
+                       : write_file_at(filepath, offset, data);
+}
+
+std::pair<Buffer, FileOperationResult>
+read_file_range(const std::string &filepath, uint64_t offset, size_t length)
+{
+    return DirectoryHandle().read_file_range(filepath, offset, length);
+}
+
+FileOperationResult write_file_at(const std::string &filepath,
+                                  uint64_t offset,
+                                  std::string_view data)
+{
+    return DirectoryHandle().write_file_at(filepath, offset, data);
+}
+
+FileOperationResult create_file(const std::string &filepath)
+{
+    return DirectoryHandle().create_file(filepath);
+}
+
+FileOperationResult delete_file(const std::string &filepath)
+{
+    return DirectoryHandle().delete_file(filepath);
+}
+
+std::pair<fenris::FileInfo, FileOperationResult>
+get_file_info(const std::string &filepath)
+{
+    return DirectoryHandle().get_file_info(filepath);
 }
 
 bool file_exists(const std::string &filepath)
@@ -380,32 +835,27 @@ FileOperationResult delete_directory(const std::string &dirpath, bool recursive)
 std::pair<std::vector<fenris::FileInfo>, FileOperationResult>
 list_directory(const std::string &dirpath)
 {
-    std::vector<std::string> entries;
-    std::error_code ec;
-    std::vector<fenris::FileInfo> file_info_list;
-
-    if (!fs::exists(dirpath, ec)) {
-        return {file_info_list, FileOperationResult::FILE_NOT_FOUND};
-    }
-
-    if (!fs::is_directory(dirpath, ec)) {
-        return {file_info_list, FileOperationResult::INVALID_PATH};
+    auto [page, result] = list_directory_page(
+        dirpath, 0, std::numeric_limits<size_t>::max(), false);
+    if (result != FileOperationResult::SUCCESS) {
+        return {std::vector<fenris::FileInfo>(), result};
     }
 
-    for (const auto &entry : fs::directory_iterator(dirpath, ec)) {
-        entries.push_back(entry.path().filename().string());
-    }
-
-    for (const auto &entry : entries) {
-        std::string full_path = (fs::path(dirpath) / entry).string();
-        auto [file_info, result] = get_file_info(full_path);
-        if (result != FileOperationResult::SUCCESS) {
-            return {file_info_list, result};
-        }
-        file_info_list.push_back(file_info);
+    // Entries are named by their full path here
+    for (auto &entry : page.entries) {
+        entry.set_name((fs::path(dirpath) / entry.name()).string());
     }
+    return {std::move(page.entries), FileOperationResult::SUCCESS};
+}
 
-    return {file_info_list, FileOperationResult::SUCCESS};
+std::pair<DirectoryPage, FileOperationResult>
+list_directory_page(const std::string &dirpath,
+                    uint64_t cursor,
+                    size_t page_size,
+                    bool names_only)
+{
+    return DirectoryHandle().list_directory_page(
+        dirpath, cursor, page_size, names_only);
 }
 
 FileOperationResult change_directory(const std::string &dirpath)
@@ -484,22 +934,33 @@ FileOperationResult copy_file(const std::string &source,
 std::pair<uintmax_t, FileOperationResult>
 get_file_size(const std::string &filepath)
 {
-    std::error_code ec;
+    return DirectoryHandle().get_file_size(filepath);
+}
 
-    if (!fs::exists(filepath, ec)) {
-        return {0, FileOperationResult::FILE_NOT_FOUND};
-    }
+std::pair<int, FileOperationResult>
+create_temp_file(const std::string &filepath, std::string &temp_path)
+{
+    return DirectoryHandle().create_temp_file(filepath, temp_path);
+}
 
-    if (!fs::is_regular_file(filepath, ec)) {
-        return {0, FileOperationResult::INVALID_PATH};
+std::pair<uint64_t, FileOperationResult>
+write_sparse_file(const std::string &filepath, uint64_t size)
+{
+    auto [fd, result] = open_for_writing(AT_FDCWD, filepath, O_CREAT | O_TRUNC);
+    if (result != FileOperationResult::SUCCESS) {
+        return {0, result};
     }
 
-    uintmax_t size = fs::file_size(filepath, ec);
-    if (ec) {
-        return {0, system_error_to_file_operation_result(ec)};
+    // Only the size moves, no byte is written
+    struct stat status {};
+    if (::ftruncate(fd, static_cast<off_t>(size)) != 0 ||
+        ::fstat(fd, &status) != 0) {
+        const int error = errno;
+        ::close(fd);
+        return {0, errno_to_file_operation_result(error)};
     }
-
-    return {size, FileOperationResult::SUCCESS};
+    return {to_modified_time(status.st_mtim),
+            close_written(fd, FileOperationResult::SUCCESS)};
 }
 
 } // namespace common
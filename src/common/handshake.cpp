@@ -0,0 +1,81 @@
+#include "common/handshake.hpp"
+
+namespace fenris {
+namespace common {
+
+std::vector<uint8_t>
+encode_key_exchange(const std::vector<uint8_t> &public_key,
+                    const std::optional<fenris::Handshake> &handshake)
+{
+    std::vector<uint8_t> frame(public_key);
+    if (!handshake.has_value()) {
+        return frame;
+    }
+
+    const size_t handshake_size = handshake->ByteSizeLong();
+    frame.resize(public_key.size() + handshake_size);
+    if (!handshake->SerializeToArray(frame.data() + public_key.size(),
+                                     static_cast<int>(handshake_size))) {
+        frame.resize(public_key.size());
+    }
+
+    return frame;
+}
+
+std::vector<uint8_t> encode_resumption(const fenris::Handshake &handshake)
+{
+    const size_t handshake_size = handshake.ByteSizeLong();
+    std::vector<uint8_t> frame(1 + handshake_size);
+    frame[0] = RESUMPTION_FRAME_MARKER;
+    if (!handshake.SerializeToArray(frame.data() + 1,
+                                    static_cast<int>(handshake_size))) {
+        frame.resize(1);
+    }
+
+    return frame;
+}
+
+std::optional<KeyExchange> decode_key_exchange(std::span<const uint8_t> frame)
+{
+    KeyExchange key_exchange;
+
+    if (!frame.empty() && frame[0] == RESUMPTION_FRAME_MARKER) {
+        const auto trailer = frame.subspan(1);
+        fenris::Handshake handshake;
+        if (!handshake.ParseFromArray(trailer.data(),
+                                      static_cast<int>(trailer.size()))) {
+            return std::nullopt;
+        }
+        key_exchange.handshake = std::move(handshake);
+        key_exchange.resumption = true;
+        return key_exchange;
+    }
+
+    // Anything up to the key size is a bare key, its length is checked when
+    // the shared secret is computed
+    if (frame.size() <= ECDH_PUBLIC_KEY_SIZE) {
+        key_exchange.public_key.assign(frame.begin(), frame.end());
+        return key_exchange;
+    }
+
+    key_exchange.public_key.assign(frame.begin(),
+                                   frame.begin() + ECDH_PUBLIC_KEY_SIZE);
+
+    const auto trailer = frame.subspan(ECDH_PUBLIC_KEY_SIZE);
+    fenris::Handshake handshake;
+    if (!handshake.ParseFromArray(trailer.data(),
+                                  static_cast<int>(trailer.size()))) {
+        return std::nullopt;
+    }
+    key_exchange.handshake = std::move(handshake);
+
+    return key_exchange;
+}
+
+bool has_capability(uint32_t capabilities, fenris::Capability capability)
+{
+    return (capabilities & static_cast<uint32_t>(capability)) != 0;
+}
+
+} // namespace common
+} // namespace fenris
@@ -0,0 +1,100 @@
+#include "common/keypair_pool.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace fenris {
+namespace common {
+namespace crypto {
+
+KeyPairPool::KeyPairPool(size_t capacity) : m_capacity(capacity) {}
+
+KeyPairPool::~KeyPairPool()
+{
+    stop();
+}
+
+void KeyPairPool::start()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_running || m_capacity == 0) {
+        return;
+    }
+    m_running = true;
+    m_thread = std::thread(&KeyPairPool::run, this);
+}
+
+void KeyPairPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) {
+            return;
+        }
+        m_running = false;
+    }
+    m_drained.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+std::tuple<std::vector<uint8_t>, std::vector<uint8_t>, ECDHResult>
+KeyPairPool::take()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_pairs.empty()) {
+            KeyPair pair = std::move(m_pairs.front());
+            m_pairs.pop_front();
+            m_drained.notify_one();
+            return {std::move(pair.private_key),
+                    std::move(pair.public_key),
+                    ECDHResult::SUCCESS};
+        }
+    }
+
+    // Drained by a burst, or never started
+    CryptoManager crypto_manager;
+    return crypto_manager.generate_ecdh_keypair();
+}
+
+size_t KeyPairPool::available() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_pairs.size();
+}
+
+void KeyPairPool::run()
+{
+    // Only use cores nothing else wants, failing that just run at normal
+    // priority
+    sched_param param{};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_drained.wait(lock, [this]() {
+            return !m_running || m_pairs.size() < m_capacity;
+        });
+        if (!m_running) {
+            return;
+        }
+
+        // Generated without the lock, take() never waits for the thread
+        lock.unlock();
+        auto [private_key, public_key, result] =
+            m_crypto_manager.generate_ecdh_keypair();
+        lock.lock();
+
+        // A failing generator fails inline too, where it gets reported
+        if (result != ECDHResult::SUCCESS) {
+            return;
+        }
+        m_pairs.push_back({std::move(private_key), std::move(public_key)});
+    }
+}
+
+} // namespace crypto
+} // namespace common
+} // namespace fenris
@@ -48,15 +48,35 @@ bool initialize_logging(const LoggingConfig &config,
             sinks.push_back(file_sink);
         }
 
-        // Create logger with all sinks
-        auto logger = std::make_shared<spdlog::logger>(logger_name,
-                                                       sinks.begin(),
-                                                       sinks.end());
+        // Create logger with all sinks. An asynchronous one only queues the
+        // message on the calling thread, the shared pool formats and writes
+        std::shared_ptr<spdlog::logger> logger;
+        if (config.async) {
+            if (!spdlog::thread_pool()) {
+                spdlog::init_thread_pool(config.async_queue_size, 1);
+            }
+            logger = std::make_shared<spdlog::async_logger>(
+                logger_name,
+                sinks.begin(),
+                sinks.end(),
+                spdlog::thread_pool(),
+                config.async_overflow == AsyncOverflow::DROP_OLDEST
+                    ? spdlog::async_overflow_policy::overrun_oldest
+                    : spdlog::async_overflow_policy::block);
+            // Problems reach the sinks without waiting for the queue
+            logger->flush_on(spdlog::level::warn);
+        } else {
+            logger = std::make_shared<spdlog::logger>(logger_name,
+                                                      sinks.begin(),
+                                                      sinks.end());
+        }
         logger->set_level(static_cast<spdlog::level::level_enum>(config.level));
 
         // Set pattern
         logger->set_pattern("[%Y-%m-%d %H:%M:%S.%e] [%n] [%l] %v");
 
+        set_log_sample_rate(config.sample_rate);
+
         // Register with spdlog and store in our map
         spdlog::register_logger(logger);
         loggers[logger_name] = logger;
@@ -77,9 +97,11 @@ bool initialize_logging(const LoggingConfig &config,
 /**
  * Configure and initialize logging system based on command line arguments
  */
-bool configure_logging(const argparse::ArgumentParser &program)
+bool configure_logging(const argparse::ArgumentParser &program,
+                       const std::string &logger_name,
+                       const LoggingConfig &base)
 {
-    LoggingConfig logging_config;
+    LoggingConfig logging_config = base;
     std::string log_level = program.get("--log-level");
 
     // Convert string log level to enum
@@ -106,7 +128,7 @@ bool configure_logging(const argparse::ArgumentParser &program)
     logging_config.file_logging = program.get<bool>("--file-log");
     logging_config.log_file_path = program.get("--log-file");
 
-    return initialize_logging(logging_config, "fenris_client");
+    return initialize_logging(logging_config, logger_name);
 }
 
 Logger get_logger(const std::string &logger_name)
@@ -131,6 +153,25 @@ void set_log_level(LogLevel level)
     spdlog::set_level(static_cast<spdlog::level::level_enum>(level));
 }
 
+void set_log_sample_rate(uint32_t rate)
+{
+    detail::log_sample_rate.store(rate, std::memory_order_relaxed);
+}
+
+void shutdown_logging()
+{
+    // Joins the async pool once it has written everything queued
+    spdlog::shutdown();
+
+    // The sinks outlive spdlog's registry in our map, flush what the pool
+    // wrote after the registry's own flush
+    for (auto &[name, logger] : loggers) {
+        for (auto &sink : logger->sinks()) {
+            sink->flush();
+        }
+    }
+}
+
 std::string log_level_to_string(LogLevel level)
 {
     auto it = level_to_string_map.find(level);
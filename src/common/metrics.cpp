@@ -0,0 +1,249 @@
+#include "common/metrics.hpp"
+
+#include <cstdio>
+#include <stdexcept>
+
+namespace fenris {
+namespace common {
+
+namespace {
+
+std::string format_number(double value)
+{
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.9g", value);
+    return text;
+}
+
+std::string escape(const std::string &text, bool quotes)
+{
+    std::string escaped;
+    escaped.reserve(text.size());
+    for (char c : text) {
+        if (c == '\\') {
+            escaped += "\\\\";
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else if (c == '"' && quotes) {
+            escaped += "\\\"";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+/**
+ * Render labels as {name="value",...}, with an optional extra label such as
+ * a histogram's le
+ */
+std::string format_labels(const MetricLabels &labels,
+                          const std::string &extra_name = "",
+                          const std::string &extra_value = "")
+{
+    std::string text;
+    auto append = [&](const std::string &name, const std::string &value) {
+        text += text.empty() ? "{" : ",";
+        text += name + "=\"" + escape(value, true) + "\"";
+    };
+    for (const auto &[name, value] : labels) {
+        append(name, value);
+    }
+    if (!extra_name.empty()) {
+        append(extra_name, extra_value);
+    }
+    return text.empty() ? text : text + "}";
+}
+
+} // namespace
+
+uint64_t Counter::value() const
+{
+    uint64_t total = 0;
+    for (const auto &line : m_lines) {
+        total += line.values[0].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+Histogram::Histogram(std::vector<uint64_t> bounds, double scale)
+    : m_bounds(std::move(bounds)), m_scale(scale),
+      m_stride((m_bounds.size() + 2 + detail::MetricLine::VALUES - 1) /
+               detail::MetricLine::VALUES),
+      m_lines(m_stride * detail::METRIC_SHARDS)
+{
+    std::sort(m_bounds.begin(), m_bounds.end());
+}
+
+std::atomic<uint64_t> &Histogram::cell(size_t shard, size_t index)
+{
+    return m_lines[shard * m_stride + index / detail::MetricLine::VALUES]
+        .values[index % detail::MetricLine::VALUES];
+}
+
+const std::atomic<uint64_t> &Histogram::cell(size_t shard, size_t index) const
+{
+    return m_lines[shard * m_stride + index / detail::MetricLine::VALUES]
+        .values[index % detail::MetricLine::VALUES];
+}
+
+void Histogram::observe(uint64_t value)
+{
+    const size_t shard = detail::metric_shard();
+    const size_t bucket =
+        std::lower_bound(m_bounds.begin(), m_bounds.end(), value) -
+        m_bounds.begin();
+    cell(shard, bucket).fetch_add(1, std::memory_order_relaxed);
+    cell(shard, m_bounds.size() + 1)
+        .fetch_add(value, std::memory_order_relaxed);
+}
+
+std::vector<uint64_t> Histogram::bucket_counts() const
+{
+    std::vector<uint64_t> counts(m_bounds.size() + 1, 0);
+    for (size_t shard = 0; shard < detail::METRIC_SHARDS; ++shard) {
+        for (size_t bucket = 0; bucket < counts.size(); ++bucket) {
+            counts[bucket] +=
+                cell(shard, bucket).load(std::memory_order_relaxed);
+        }
+    }
+    return counts;
+}
+
+uint64_t Histogram::sum() const
+{
+    uint64_t total = 0;
+    for (size_t shard = 0; shard < detail::METRIC_SHARDS; ++shard) {
+        total +=
+            cell(shard, m_bounds.size() + 1).load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+std::vector<uint64_t> latency_buckets()
+{
+    constexpr uint64_t US = 1000;
+    constexpr uint64_t MS = 1000 * US;
+    constexpr uint64_t S = 1000 * MS;
+    return {10 * US,  25 * US,   50 * US,
+            100 * US, 250 * US,  500 * US,
+            1 * MS,   2500 * US, 5 * MS,
+            10 * MS,  25 * MS,   50 * MS,
+            100 * MS, 250 * MS,  500 * MS,
+            1 * S,    2500 * MS, 5 * S,
+            10 * S};
+}
+
+MetricsRegistry &MetricsRegistry::global()
+{
+    // Never destroyed, threads may still update metrics while statics are
+    // torn down
+    static MetricsRegistry *instance = new MetricsRegistry;
+    return *instance;
+}
+
+MetricsRegistry::Family &
+MetricsRegistry::family(const std::string &name,
+                        const std::string &help,
+                        Type type)
+{
+    auto [it, inserted] = m_families.try_emplace(name);
+    if (inserted) {
+        it->second.help = help;
+        it->second.type = type;
+    } else if (it->second.type != type) {
+        throw std::logic_error("metric " + name +
+                               " registered with two different types");
+    }
+    return it->second;
+}
+
+Counter &MetricsRegistry::counter(const std::string &name,
+                                  const std::string &help,
+                                  const MetricLabels &labels)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto &metric = family(name, help, Type::COUNTER).counters[labels];
+    if (!metric) {
+        metric = std::make_unique<Counter>();
+    }
+    return *metric;
+}
+
+Gauge &MetricsRegistry::gauge(const std::string &name,
+                              const std::string &help,
+                              const MetricLabels &labels)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto &metric = family(name, help, Type::GAUGE).gauges[labels];
+    if (!metric) {
+        metric = std::make_unique<Gauge>();
+    }
+    return *metric;
+}
+
+Histogram &MetricsRegistry::histogram(const std::string &name,
+                                      const std::string &help,
+                                      const MetricLabels &labels,
+                                      std::vector<uint64_t> bounds,
+                                      double scale)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto &metric = family(name, help, Type::HISTOGRAM).histograms[labels];
+    if (!metric) {
+        metric = std::make_unique<Histogram>(std::move(bounds), scale);
+    }
+    return *metric;
+}
+
+std::string MetricsRegistry::render() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string text;
+    for (const auto &[name, family] : m_families) {
+        text += "# HELP " + name + " " + escape(family.help, false) + "\n";
+        switch (family.type) {
+        case Type::COUNTER:
+            text += "# TYPE " + name + " counter\n";
+            for (const auto &[labels, counter] : family.counters) {
+                text += name + format_labels(labels) + " " +
+                        std::to_string(counter->value()) + "\n";
+            }
+            break;
+        case Type::GAUGE:
+            text += "# TYPE " + name + " gauge\n";
+            for (const auto &[labels, gauge] : family.gauges) {
+                text += name + format_labels(labels) + " " +
+                        std::to_string(gauge->value()) + "\n";
+            }
+            break;
+        case Type::HISTOGRAM:
+            text += "# TYPE " + name + " histogram\n";
+            for (const auto &[labels, histogram] : family.histograms) {
+                const auto counts = histogram->bucket_counts();
+                const auto &bounds = histogram->bounds();
+                uint64_t cumulative = 0;
+                for (size_t bucket = 0; bucket < counts.size(); ++bucket) {
+                    cumulative += counts[bucket];
+                    const std::string le =
+                        bucket < bounds.size()
+                            ? format_number(bounds[bucket] *
+                                            histogram->scale())
+                            : "+Inf";
+                    text += name + "_bucket" + format_labels(labels, "le", le) +
+                            " " + std::to_string(cumulative) + "\n";
+                }
+                text += name + "_sum" + format_labels(labels) + " " +
+                        format_number(histogram->sum() * histogram->scale()) +
+                        "\n";
+                text += name + "_count" + format_labels(labels) + " " +
+                        std::to_string(cumulative) + "\n";
+            }
+            break;
+        }
+    }
+    return text;
+}
+
+} // namespace common
+} // namespace fenris
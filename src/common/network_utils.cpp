@@ -1,12 +1,17 @@
 #include "common/network_utils.hpp"
 
+#include <algorithm>
 #include <arpa/inet.h>
 #include <cerrno>
 #include <chrono>
+#include <climits>
 #include <cstring>
 #include <iostream>
+#include <optional>
+#include <poll.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
-#include <thread>
+#include <sys/uio.h>
 #include <unistd.h>
 
 namespace fenris {
@@ -30,170 +35,673 @@ std::string network_result_to_string(NetworkResult result)
         return "error during receive operation";
     case NetworkResult::ALLOCATION_ERROR:
         return "memory allocation error";
+    case NetworkResult::TIMEOUT:
+        return "operation timed out";
+    case NetworkResult::MESSAGE_TOO_LARGE:
+        return "message exceeds the size limit";
     default:
         return "unrecognized network error";
     }
 }
 
-NetworkResult send_data(uint32_t fd,
-                        const std::vector<uint8_t> &data,
-                        uint32_t len,
-                        bool non_blocking_mode)
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using Deadline = std::optional<Clock::time_point>;
+
+Deadline make_deadline(int timeout_ms)
+{
+    if (timeout_ms < 0) {
+        return std::nullopt;
+    }
+    return Clock::now() + std::chrono::milliseconds(timeout_ms);
+}
+
+/**
+ * Block until the socket is ready for the requested events or the deadline
+ * passes. Errors and hang-ups are reported as ready so that the following
+ * send/recv call surfaces them.
+ */
+NetworkResult wait_ready(uint32_t fd, short events, const Deadline &deadline)
+{
+    while (true) {
+        int wait_ms = -1;
+        if (deadline.has_value()) {
+            auto remaining = std::chrono::ceil<std::chrono::milliseconds>(
+                *deadline - Clock::now());
+            if (remaining.count() <= 0) {
+                return NetworkResult::TIMEOUT;
+            }
+            wait_ms = static_cast<int>(remaining.count());
+        }
+
+        struct pollfd pfd {};
+        pfd.fd = static_cast<int>(fd);
+        pfd.events = events;
+
+        int ready = poll(&pfd, 1, wait_ms);
+        if (ready > 0) {
+            return NetworkResult::SUCCESS;
+        }
+        if (ready == 0) {
+            return NetworkResult::TIMEOUT;
+        }
+        if (errno != EINTR) {
+            return NetworkResult::SOCKET_ERROR;
+        }
+    }
+}
+
+/**
+ * Whether a call has to avoid blocking inside send/recv. A socket in blocking
+ * mode is still driven through MSG_DONTWAIT when a deadline is set, so the
+ * wait happens in poll() where the timeout can be enforced.
+ */
+bool must_not_block(bool non_blocking_mode, const Deadline &deadline)
+{
+    return non_blocking_mode || deadline.has_value();
+}
+
+NetworkResult send_all(uint32_t fd,
+                       const uint8_t *data,
+                       size_t len,
+                       bool non_blocking_mode,
+                       const Deadline &deadline)
 {
+    const bool dont_wait = must_not_block(non_blocking_mode, deadline);
+    const int flags = dont_wait ? MSG_DONTWAIT : 0;
+
     size_t total_sent = 0;
     while (total_sent < len) {
-        ssize_t sent = send(fd, data.data() + total_sent, len - total_sent, 0);
-        if (sent <= 0) {
-            if (non_blocking_mode &&
-                (errno == EAGAIN || errno == EWOULDBLOCK)) {
-                // In non-blocking mode, EAGAIN/EWOULDBLOCK means try again
-                // later
-                std::this_thread::sleep_for(
-                    std::chrono::milliseconds(DELAY)); // Small delay
-                continue;
+        ssize_t sent = send(fd, data + total_sent, len - total_sent, flags);
+        if (sent > 0) {
+            total_sent += static_cast<size_t>(sent);
+            continue;
+        }
+        if (sent == -1 && errno == EINTR) {
+            continue;
+        }
+        if (sent == -1 && dont_wait &&
+            (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // Sleep until the kernel has room in the send buffer
+            NetworkResult result = wait_ready(fd, POLLOUT, deadline);
+            if (result != NetworkResult::SUCCESS) {
+                return result;
             }
-            // For blocking sockets or other errors, report failure
-            std::cerr << "Error sending data: " << strerror(errno) << std::endl;
-            return NetworkResult::SEND_ERROR;
+            continue;
         }
-        total_sent += static_cast<size_t>(sent);
+        return NetworkResult::SEND_ERROR;
     }
     return NetworkResult::SUCCESS;
 }
 
-NetworkResult receive_data(uint32_t fd,
-                           std::vector<uint8_t> &buf,
-                           uint32_t len,
-                           bool non_blocking_mode)
+NetworkResult receive_all(uint32_t fd,
+                          uint8_t *data,
+                          size_t len,
+                          bool non_blocking_mode,
+                          const Deadline &deadline)
 {
+    const bool dont_wait = must_not_block(non_blocking_mode, deadline);
+    const int flags = dont_wait ? MSG_DONTWAIT : 0;
+
     size_t total_received = 0;
     while (total_received < len) {
         ssize_t received =
-            recv(fd, buf.data() + total_received, len - total_received, 0);
-        if (received <= 0) {
-            if (non_blocking_mode &&
-                (errno == EAGAIN || errno == EWOULDBLOCK)) {
-                // In non-blocking mode, EAGAIN/EWOULDBLOCK means try again
-                // later
-                std::this_thread::sleep_for(
-                    std::chrono::milliseconds(DELAY)); // Small delay
-                continue;
+            recv(fd, data + total_received, len - total_received, flags);
+        if (received > 0) {
+            total_received += static_cast<size_t>(received);
+            continue;
+        }
+        if (received == 0) {
+            return NetworkResult::DISCONNECTED;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (dont_wait && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // Sleep until more bytes arrive instead of polling on a timer
+            NetworkResult result = wait_ready(fd, POLLIN, deadline);
+            if (result != NetworkResult::SUCCESS) {
+                return result;
+            }
+            continue;
+        }
+        return NetworkResult::RECEIVE_ERROR;
+    }
+    return NetworkResult::SUCCESS;
+}
+
+/**
+ * Drop the first `count` bytes from an iovec array, returning the index of
+ * the first iovec that still has data
+ */
+size_t
+advance_iovecs(std::vector<struct iovec> &iov, size_t index, size_t count)
+{
+    while (index < iov.size() && count >= iov[index].iov_len) {
+        count -= iov[index].iov_len;
+        ++index;
+    }
+    if (index < iov.size()) {
+        auto *base = static_cast<uint8_t *>(iov[index].iov_base);
+        iov[index].iov_base = base + count;
+        iov[index].iov_len -= count;
+    }
+    return index;
+}
+
+NetworkResult send_all_vectored(uint32_t fd,
+                                std::vector<struct iovec> &iov,
+                                bool non_blocking_mode,
+                                const Deadline &deadline)
+{
+    const bool dont_wait = must_not_block(non_blocking_mode, deadline);
+    const int flags = dont_wait ? MSG_DONTWAIT : 0;
+
+    size_t index = advance_iovecs(iov, 0, 0);
+    while (index < iov.size()) {
+        struct msghdr msg {};
+        msg.msg_iov = iov.data() + index;
+        msg.msg_iovlen = std::min<size_t>(iov.size() - index, IOV_MAX);
+
+        ssize_t sent = sendmsg(fd, &msg, flags);
+        if (sent > 0) {
+            index = advance_iovecs(iov, index, static_cast<size_t>(sent));
+            continue;
+        }
+        if (sent == -1 && errno == EINTR) {
+            continue;
+        }
+        if (sent == -1 && dont_wait &&
+            (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            NetworkResult result = wait_ready(fd, POLLOUT, deadline);
+            if (result != NetworkResult::SUCCESS) {
+                return result;
             }
-            // For blocking sockets, 0 means disconnected, -1 means error
-            if (received == 0) {
-                return NetworkResult::DISCONNECTED;
-            } else {
-                return NetworkResult::RECEIVE_ERROR;
+            continue;
+        }
+        return NetworkResult::SEND_ERROR;
+    }
+    return NetworkResult::SUCCESS;
+}
+
+NetworkResult receive_all_vectored(uint32_t fd,
+                                   std::vector<struct iovec> &iov,
+                                   bool non_blocking_mode,
+                                   const Deadline &deadline)
+{
+    const bool dont_wait = must_not_block(non_blocking_mode, deadline);
+    const int flags = dont_wait ? MSG_DONTWAIT : 0;
+
+    size_t index = advance_iovecs(iov, 0, 0);
+    while (index < iov.size()) {
+        struct msghdr msg {};
+        msg.msg_iov = iov.data() + index;
+        msg.msg_iovlen = std::min<size_t>(iov.size() - index, IOV_MAX);
+
+        ssize_t received = recvmsg(fd, &msg, flags);
+        if (received > 0) {
+            index = advance_iovecs(iov, index, static_cast<size_t>(received));
+            continue;
+        }
+        if (received == 0) {
+            return NetworkResult::DISCONNECTED;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (dont_wait && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            NetworkResult result = wait_ready(fd, POLLIN, deadline);
+            if (result != NetworkResult::SUCCESS) {
+                return result;
             }
+            continue;
         }
-        total_received += static_cast<size_t>(received);
+        return NetworkResult::RECEIVE_ERROR;
     }
     return NetworkResult::SUCCESS;
 }
 
-NetworkResult send_size(uint32_t fd, uint32_t size, bool non_blocking_mode)
+NetworkResult send_size_until(uint32_t fd,
+                              uint32_t size,
+                              bool non_blocking_mode,
+                              const Deadline &deadline)
 {
     uint32_t size_net = htonl(size);
-    size_t total_sent = 0;
-    while (total_sent < sizeof(size_net)) {
-        ssize_t sent = send(fd,
-                            reinterpret_cast<uint8_t *>(&size_net) + total_sent,
-                            sizeof(size_net) - total_sent,
-                            0);
-
-        if (sent <= 0) {
-            if (non_blocking_mode &&
-                (errno == EAGAIN || errno == EWOULDBLOCK)) {
-                // In non-blocking mode, EAGAIN/EWOULDBLOCK means try again
-                // later
-                std::this_thread::sleep_for(
-                    std::chrono::milliseconds(DELAY)); // Small delay
-                continue;
-            }
+    return send_all(fd,
+                    reinterpret_cast<const uint8_t *>(&size_net),
+                    sizeof(size_net),
+                    non_blocking_mode,
+                    deadline);
+}
+
+NetworkResult receive_size_until(uint32_t fd,
+                                 uint32_t &size,
+                                 bool non_blocking_mode,
+                                 const Deadline &deadline)
+{
+    uint32_t size_net;
+    NetworkResult result = receive_all(fd,
+                                       reinterpret_cast<uint8_t *>(&size_net),
+                                       sizeof(size_net),
+                                       non_blocking_mode,
+                                       deadline);
+    if (result != NetworkResult::SUCCESS) {
+        return result;
+    }
+    size = ntohl(size_net);
+    return NetworkResult::SUCCESS;
+}
+
+/**
+ * Copy a file region to the socket through a small bounce buffer, used when
+ * the file system does not support sendfile()
+ */
+NetworkResult copy_file_to_socket(uint32_t fd,
+                                  int file_fd,
+                                  uint64_t offset,
+                                  uint64_t length,
+                                  bool non_blocking_mode,
+                                  const Deadline &deadline)
+{
+    std::vector<uint8_t> block(std::min<uint64_t>(length, 64 * 1024));
+    while (length > 0) {
+        const size_t want = std::min<uint64_t>(length, block.size());
+        ssize_t got =
+            pread(file_fd, block.data(), want, static_cast<off_t>(offset));
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
             return NetworkResult::SEND_ERROR;
         }
-        total_sent += static_cast<size_t>(sent);
+
+        NetworkResult result = send_all(fd,
+                                        block.data(),
+                                        static_cast<size_t>(got),
+                                        non_blocking_mode,
+                                        deadline);
+        if (result != NetworkResult::SUCCESS) {
+            return result;
+        }
+        offset += static_cast<uint64_t>(got);
+        length -= static_cast<uint64_t>(got);
     }
     return NetworkResult::SUCCESS;
 }
 
-NetworkResult receive_size(uint32_t fd, uint32_t &size, bool non_blocking_mode)
+NetworkResult send_file_until(uint32_t fd,
+                              int file_fd,
+                              uint64_t offset,
+                              uint64_t length,
+                              bool non_blocking_mode,
+                              const Deadline &deadline)
 {
-    uint32_t size_net;
-    size_t total_received = 0;
-    while (total_received < sizeof(size_net)) {
-        ssize_t received =
-            recv(fd,
-                 reinterpret_cast<uint8_t *>(&size_net) + total_received,
-                 sizeof(size_net) - total_received,
-                 0);
-        if (received <= 0) {
-            if (non_blocking_mode &&
-                (errno == EAGAIN || errno == EWOULDBLOCK)) {
-                // In non-blocking mode, EAGAIN/EWOULDBLOCK means try again
-                // later
-                std::this_thread::sleep_for(
-                    std::chrono::milliseconds(DELAY)); // Small delay
-                continue;
+    // Bound each call so a blocking socket gets back to the deadline check
+    // between calls
+    constexpr size_t MAX_SENDFILE_BYTES = 1024 * 1024;
+
+    bool first_call = true;
+    off_t file_offset = static_cast<off_t>(offset);
+    while (length > 0) {
+        if (deadline.has_value() && Clock::now() >= *deadline) {
+            return NetworkResult::TIMEOUT;
+        }
+
+        const size_t want = std::min<uint64_t>(length, MAX_SENDFILE_BYTES);
+        ssize_t sent =
+            sendfile(static_cast<int>(fd), file_fd, &file_offset, want);
+        if (sent > 0) {
+            length -= static_cast<uint64_t>(sent);
+            first_call = false;
+            continue;
+        }
+        if (sent == 0) {
+            // The file shrank underneath us
+            return NetworkResult::SEND_ERROR;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            NetworkResult result = wait_ready(fd, POLLOUT, deadline);
+            if (result != NetworkResult::SUCCESS) {
+                return result;
+            }
+            continue;
+        }
+        if (first_call && (errno == EINVAL || errno == ENOSYS)) {
+            return copy_file_to_socket(fd,
+                                       file_fd,
+                                       static_cast<uint64_t>(file_offset),
+                                       length,
+                                       non_blocking_mode,
+                                       deadline);
+        }
+        return NetworkResult::SEND_ERROR;
+    }
+    return NetworkResult::SUCCESS;
+}
+
+/**
+ * Receive a message into a vector that grows as its bytes arrive
+ */
+NetworkResult receive_growing(uint32_t fd,
+                              std::vector<uint8_t> &data,
+                              size_t size,
+                              bool non_blocking_mode,
+                              const Deadline &deadline)
+{
+    size_t received = 0;
+    try {
+        data.resize(std::min(size, INITIAL_RECEIVE_BUFFER_SIZE));
+        while (true) {
+            NetworkResult result = receive_all(fd,
+                                               data.data() + received,
+                                               data.size() - received,
+                                               non_blocking_mode,
+                                               deadline);
+            if (result != NetworkResult::SUCCESS || data.size() == size) {
+                return result;
             }
-            if (received == 0) {
-                return NetworkResult::DISCONNECTED;
+            received = data.size();
+            data.resize(std::min(size, received * 2));
+        }
+    } catch (const std::bad_alloc &) {
+        return NetworkResult::ALLOCATION_ERROR;
+    }
+}
+
+/**
+ * Receive a message into a slab that grows as its bytes arrive, or that is
+ * allocated whole if its memory was reserved
+ */
+NetworkResult receive_growing(uint32_t fd,
+                              Buffer &data,
+                              size_t size,
+                              bool non_blocking_mode,
+                              const Deadline &deadline,
+                              bool reserved = false)
+{
+    data = Buffer();
+    size_t received = 0;
+    try {
+        while (received < size) {
+            grow_receive_buffer(data, received, size, reserved);
+            NetworkResult result = receive_all(fd,
+                                               data.data() + received,
+                                               data.size() - received,
+                                               non_blocking_mode,
+                                               deadline);
+            if (result != NetworkResult::SUCCESS) {
+                return result;
             }
-            return NetworkResult::RECEIVE_ERROR;
+            received = data.size();
         }
-        total_received += static_cast<size_t>(received);
+    } catch (const std::bad_alloc &) {
+        return NetworkResult::ALLOCATION_ERROR;
     }
-    size = ntohl(size_net);
     return NetworkResult::SUCCESS;
 }
 
-NetworkResult send_prefixed_data(uint32_t socket,
-                                 const std::vector<uint8_t> &data,
-                                 bool non_blocking_mode)
+/**
+ * Read the size prefix together with a fixed-size header and report how many
+ * body bytes follow
+ */
+NetworkResult receive_preamble_until(uint32_t fd,
+                                     std::span<uint8_t> header,
+                                     size_t &body_size,
+                                     bool non_blocking_mode,
+                                     const Deadline &deadline,
+                                     size_t max_size)
 {
-    NetworkResult result;
+    uint32_t size_net;
 
-    result = send_size(socket,
-                       static_cast<uint32_t>(data.size()),
-                       non_blocking_mode);
+    std::vector<struct iovec> iov = {{&size_net, sizeof(size_net)},
+                                     {header.data(), header.size()}};
+    NetworkResult result =
+        receive_all_vectored(fd, iov, non_blocking_mode, deadline);
     if (result != NetworkResult::SUCCESS) {
         return result;
     }
 
-    result = send_data(socket,
-                       data,
-                       static_cast<uint32_t>(data.size()),
-                       non_blocking_mode);
-    if (result != NetworkResult::SUCCESS) {
-        return result;
+    const uint32_t size = ntohl(size_net);
+    if (size < header.size()) {
+        return NetworkResult::RECEIVE_ERROR;
+    }
+    if (size > max_size) {
+        return NetworkResult::MESSAGE_TOO_LARGE;
     }
 
+    body_size = size - header.size();
     return NetworkResult::SUCCESS;
 }
 
+} // namespace
+
+NetworkResult send_data(uint32_t fd,
+                        const std::vector<uint8_t> &data,
+                        uint32_t len,
+                        bool non_blocking_mode,
+                        int timeout_ms)
+{
+    NetworkResult result = send_all(
+        fd, data.data(), len, non_blocking_mode, make_deadline(timeout_ms));
+    if (result == NetworkResult::SEND_ERROR) {
+        std::cerr << "Error sending data: " << strerror(errno) << std::endl;
+    }
+    return result;
+}
+
+NetworkResult receive_data(uint32_t fd,
+                           std::vector<uint8_t> &buf,
+                           uint32_t len,
+                           bool non_blocking_mode,
+                           int timeout_ms)
+{
+    return receive_all(
+        fd, buf.data(), len, non_blocking_mode, make_deadline(timeout_ms));
+}
+
+NetworkResult
+send_size(uint32_t fd, uint32_t size, bool non_blocking_mode, int timeout_ms)
+{
+    return send_size_until(
+        fd, size, non_blocking_mode, make_deadline(timeout_ms));
+}
+
+NetworkResult receive_size(uint32_t fd,
+                           uint32_t &size,
+                           bool non_blocking_mode,
+                           int timeout_ms)
+{
+    return receive_size_until(
+        fd, size, non_blocking_mode, make_deadline(timeout_ms));
+}
+
+NetworkResult send_prefixed_data(uint32_t socket,
+                                 const std::vector<uint8_t> &data,
+                                 bool non_blocking_mode,
+                                 int timeout_ms)
+{
+    // The prefix and the payload leave together, never as two segments
+    const std::span<const uint8_t> segment(data);
+    return send_prefixed_segments(socket,
+                                  std::span(&segment, 1),
+                                  non_blocking_mode,
+                                  timeout_ms);
+}
+
 NetworkResult receive_prefixed_data(uint32_t socket,
                                     std::vector<uint8_t> &data,
-                                    bool non_blocking_mode)
+                                    bool non_blocking_mode,
+                                    int timeout_ms,
+                                    size_t max_size)
 {
+    const Deadline deadline = make_deadline(timeout_ms);
     NetworkResult result;
     uint32_t size = 0;
 
-    result = receive_size(socket, size, non_blocking_mode);
+    result = receive_size_until(socket, size, non_blocking_mode, deadline);
+    if (result != NetworkResult::SUCCESS) {
+        return result;
+    }
+    if (size > max_size) {
+        return NetworkResult::MESSAGE_TOO_LARGE;
+    }
+
+    return receive_growing(socket, data, size, non_blocking_mode, deadline);
+}
+
+NetworkResult
+send_prefixed_segments(uint32_t socket,
+                       std::span<const std::span<const uint8_t>> segments,
+                       bool non_blocking_mode,
+                       int timeout_ms)
+{
+    size_t total = 0;
+    for (const auto &segment : segments) {
+        total += segment.size();
+    }
+    uint32_t size_net = htonl(static_cast<uint32_t>(total));
+
+    std::vector<struct iovec> iov;
+    iov.reserve(segments.size() + 1);
+    iov.push_back({&size_net, sizeof(size_net)});
+    for (const auto &segment : segments) {
+        if (!segment.empty()) {
+            // sendmsg never writes through iov_base
+            iov.push_back({const_cast<uint8_t *>(segment.data()),
+                           segment.size()});
+        }
+    }
+
+    return send_all_vectored(
+        socket, iov, non_blocking_mode, make_deadline(timeout_ms));
+}
+
+NetworkResult receive_prefixed_data(uint32_t socket,
+                                    Buffer &data,
+                                    bool non_blocking_mode,
+                                    int timeout_ms,
+                                    size_t max_size)
+{
+    return receive_prefixed_segments(socket,
+                                     std::span<uint8_t>(),
+                                     data,
+                                     non_blocking_mode,
+                                     timeout_ms,
+                                     max_size);
+}
+
+NetworkResult receive_prefixed_segments(uint32_t socket,
+                                        std::span<uint8_t> header,
+                                        std::vector<uint8_t> &body,
+                                        bool non_blocking_mode,
+                                        int timeout_ms,
+                                        size_t max_size)
+{
+    const Deadline deadline = make_deadline(timeout_ms);
+    size_t body_size = 0;
+
+    NetworkResult result = receive_preamble_until(
+        socket, header, body_size, non_blocking_mode, deadline, max_size);
     if (result != NetworkResult::SUCCESS) {
         return result;
     }
 
-    try {
-        data.resize(size);
-    } catch (const std::bad_alloc &) {
-        return NetworkResult::ALLOCATION_ERROR;
+    return receive_growing(
+        socket, body, body_size, non_blocking_mode, deadline);
+}
+
+NetworkResult receive_prefixed_segments(uint32_t socket,
+                                        std::span<uint8_t> header,
+                                        Buffer &body,
+                                        bool non_blocking_mode,
+                                        int timeout_ms,
+                                        size_t max_size)
+{
+    const Deadline deadline = make_deadline(timeout_ms);
+    size_t body_size = 0;
+
+    NetworkResult result = receive_preamble_until(
+        socket, header, body_size, non_blocking_mode, deadline, max_size);
+    if (result != NetworkResult::SUCCESS) {
+        return result;
     }
-    result = receive_data(socket, data, size, non_blocking_mode);
+
+    return receive_growing(
+        socket, body, body_size, non_blocking_mode, deadline);
+}
+
+NetworkResult receive_preamble(uint32_t socket,
+                               std::span<uint8_t> header,
+                               size_t &body_size,
+                               bool non_blocking_mode,
+                               int timeout_ms,
+                               size_t max_size)
+{
+    return receive_preamble_until(socket,
+                                  header,
+                                  body_size,
+                                  non_blocking_mode,
+                                  make_deadline(timeout_ms),
+                                  max_size);
+}
+
+NetworkResult receive_body(uint32_t socket,
+                           Buffer &body,
+                           size_t size,
+                           bool non_blocking_mode,
+                           int timeout_ms,
+                           bool reserved)
+{
+    return receive_growing(socket,
+                           body,
+                           size,
+                           non_blocking_mode,
+                           make_deadline(timeout_ms),
+                           reserved);
+}
+
+void grow_receive_buffer(Buffer &buffer,
+                         size_t received,
+                         size_t size,
+                         bool reserved)
+{
+    const size_t capacity =
+        reserved ? size
+                 : std::min(size,
+                            std::max(INITIAL_RECEIVE_BUFFER_SIZE,
+                                     received * 2));
+    if (capacity <= buffer.size()) {
+        return;
+    }
+
+    Buffer grown = Buffer::allocate(capacity);
+    if (received != 0) {
+        std::memcpy(grown.data(), buffer.data(), received);
+    }
+    buffer = std::move(grown);
+}
+
+NetworkResult send_prefixed_file(uint32_t socket,
+                                 int file_fd,
+                                 uint64_t offset,
+                                 uint32_t length,
+                                 bool non_blocking_mode,
+                                 int timeout_ms)
+{
+    const Deadline deadline = make_deadline(timeout_ms);
+
+    NetworkResult result =
+        send_size_until(socket, length, non_blocking_mode, deadline);
     if (result != NetworkResult::SUCCESS) {
         return result;
     }
 
-    return NetworkResult::SUCCESS;
+    return send_file_until(
+        socket, file_fd, offset, length, non_blocking_mode, deadline);
 }
 
 } // namespace network
@@ -0,0 +1,82 @@
+#include "common/nonce_sequence.hpp"
+
+#include <algorithm>
+
+namespace fenris {
+namespace common {
+namespace crypto {
+
+namespace {
+
+uint64_t read_counter(std::span<const uint8_t> iv)
+{
+    uint64_t counter = 0;
+    for (size_t i = AES_GCM_IV_SIZE - sizeof(uint64_t); i < AES_GCM_IV_SIZE;
+         ++i) {
+        counter = (counter << 8) | iv[i];
+    }
+    return counter;
+}
+
+} // namespace
+
+NonceSequence::NonceSequence(NonceDirection direction, uint32_t epoch)
+    : m_prefix{static_cast<uint8_t>(direction),
+               static_cast<uint8_t>(epoch >> 16),
+               static_cast<uint8_t>(epoch >> 8),
+               static_cast<uint8_t>(epoch)},
+      m_epoch(epoch & MAX_NONCE_EPOCH)
+{
+}
+
+std::pair<std::vector<uint8_t>, EncryptionResult> NonceSequence::next()
+{
+    // The last value stays unused so count() cannot wrap either
+    if (m_next == UINT64_MAX) {
+        return {{}, EncryptionResult::IV_GENERATION_FAILED};
+    }
+
+    std::vector<uint8_t> iv(AES_GCM_IV_SIZE);
+    std::copy(m_prefix.begin(), m_prefix.end(), iv.begin());
+    const uint64_t counter = m_next++;
+    for (size_t i = 0; i < sizeof(uint64_t); ++i) {
+        iv[AES_GCM_IV_SIZE - 1 - i] = static_cast<uint8_t>(counter >> (8 * i));
+    }
+    return {std::move(iv), EncryptionResult::SUCCESS};
+}
+
+EncryptionResult NonceSequence::verify(std::span<const uint8_t> iv) const
+{
+    if (iv.size() != AES_GCM_IV_SIZE) {
+        return EncryptionResult::INVALID_IV_SIZE;
+    }
+    if (!std::equal(m_prefix.begin(), m_prefix.end(), iv.begin())) {
+        return EncryptionResult::REPLAYED_NONCE;
+    }
+    const uint64_t counter = read_counter(iv);
+    if (counter < m_next || counter == UINT64_MAX) {
+        return EncryptionResult::REPLAYED_NONCE;
+    }
+    return EncryptionResult::SUCCESS;
+}
+
+void NonceSequence::accept(std::span<const uint8_t> iv)
+{
+    if (verify(iv) == EncryptionResult::SUCCESS) {
+        m_next = read_counter(iv) + 1;
+    }
+}
+
+uint64_t NonceSequence::count() const
+{
+    return m_next;
+}
+
+uint32_t NonceSequence::epoch() const
+{
+    return m_epoch;
+}
+
+} // namespace crypto
+} // namespace common
+} // namespace fenris
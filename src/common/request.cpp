@@ -1,5 +1,6 @@
 #include "common/request.hpp"
 #include "fenris.pb.h"
+#include <filesystem>
 #include <google/protobuf/util/json_util.h>
 #include <string>
 
@@ -10,24 +11,33 @@ using namespace google::protobuf::util;
 
 std::vector<uint8_t> serialize_request(const fenris::Request &request)
 {
-    std::string serialized;
-    if (!request.SerializeToString(&serialized)) {
+    std::vector<uint8_t> serialized(request.ByteSizeLong());
+    if (!request.SerializeToArray(serialized.data(),
+                                  static_cast<int>(serialized.size()))) {
         // Handle serialization error (return empty vector)
         return {};
     }
 
-    // Convert string to vector<uint8_t>
-    return std::vector<uint8_t>(serialized.begin(), serialized.end());
+    return serialized;
 }
 
-fenris::Request deserialize_request(const std::vector<uint8_t> &data)
+Buffer serialize_request_to_buffer(const fenris::Request &request,
+                                   size_t tail_room)
+{
+    const size_t size = request.ByteSizeLong();
+    Buffer serialized = Buffer::allocate(size + tail_room);
+    if (!request.SerializeToArray(serialized.data(), static_cast<int>(size))) {
+        return {};
+    }
+
+    return serialized;
+}
+
+fenris::Request deserialize_request(std::span<const uint8_t> data)
 {
     fenris::Request request;
-    
-    // Convert vector<uint8_t> to string
-    std::string serialized(data.begin(), data.end());
 
-    if (!request.ParseFromString(serialized)) {
+    if (!request.ParseFromArray(data.data(), static_cast<int>(data.size()))) {
         // Handle parse error (return empty request)
         return fenris::Request();
     }
@@ -46,5 +56,35 @@ std::string request_to_json(const fenris::Request &request)
     return json_output;
 }
 
+std::string normalize_client_path(const std::string &current_directory,
+                                  const std::string &path)
+{
+    namespace fs = std::filesystem;
+    fs::path combined = (!path.empty() && path.front() == '/')
+                            ? fs::path(path)
+                            : fs::path(current_directory) / path;
+
+    std::vector<std::string> parts;
+    for (const auto &component : combined) {
+        const std::string part = component.string();
+        if (part.empty() || part == "/" || part == ".") {
+            continue;
+        }
+        if (part == "..") {
+            if (!parts.empty()) {
+                parts.pop_back();
+            }
+            continue;
+        }
+        parts.push_back(part);
+    }
+
+    std::string normalized;
+    for (const auto &part : parts) {
+        normalized += "/" + part;
+    }
+    return normalized.empty() ? "/" : normalized;
+}
+
 } // namespace common
 } // namespace fenris
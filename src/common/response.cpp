@@ -1,6 +1,9 @@
 #include "common/response.hpp"
 #include "fenris.pb.h"
+#include <cstring>
+#include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/util/json_util.h>
+#include <google/protobuf/wire_format_lite.h>
 #include <string>
 
 namespace fenris {
@@ -10,24 +13,70 @@ using namespace google::protobuf::util;
 
 std::vector<uint8_t> serialize_response(const fenris::Response &response)
 {
-    std::string serialized;
-    if (!response.SerializeToString(&serialized)) {
+    std::vector<uint8_t> serialized(response.ByteSizeLong());
+    if (!response.SerializeToArray(serialized.data(),
+                                   static_cast<int>(serialized.size()))) {
         // Handle serialization error (return empty vector)
         return {};
     }
 
-    // Convert string to vector<uint8_t>
-    return std::vector<uint8_t>(serialized.begin(), serialized.end());
+    return serialized;
 }
 
-fenris::Response deserialize_response(const std::vector<uint8_t> &data)
+Buffer serialize_response_to_buffer(const fenris::Response &response,
+                                    size_t tail_room)
+{
+    const size_t size = response.ByteSizeLong();
+    Buffer serialized = Buffer::allocate(size + tail_room);
+    if (!response.SerializeToArray(serialized.data(), static_cast<int>(size))) {
+        return {};
+    }
+
+    return serialized;
+}
+
+Buffer serialize_response_to_buffer(const fenris::Response &response,
+                                    std::span<const uint8_t> data,
+                                    size_t tail_room)
+{
+    using google::protobuf::internal::WireFormatLite;
+    using google::protobuf::io::CodedOutputStream;
+
+    if (!response.data().empty()) {
+        return {};
+    }
+
+    // Fields may appear in any order on the wire, so the payload can simply
+    // follow the rest of the message as an explicit data field
+    const uint32_t tag =
+        WireFormatLite::MakeTag(fenris::Response::kDataFieldNumber,
+                                WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+    const size_t head_size = response.ByteSizeLong();
+    const size_t field_size = CodedOutputStream::VarintSize32(tag) +
+                              CodedOutputStream::VarintSize64(data.size());
+
+    Buffer serialized =
+        Buffer::allocate(head_size + field_size + data.size() + tail_room);
+    if (!response.SerializeToArray(serialized.data(),
+                                   static_cast<int>(head_size))) {
+        return {};
+    }
+
+    uint8_t *out = serialized.data() + head_size;
+    out = CodedOutputStream::WriteVarint32ToArray(tag, out);
+    out = CodedOutputStream::WriteVarint64ToArray(data.size(), out);
+    if (!data.empty()) {
+        std::memcpy(out, data.data(), data.size());
+    }
+
+    return serialized;
+}
+
+fenris::Response deserialize_response(std::span<const uint8_t> data)
 {
     fenris::Response response;
-    
-    // Convert vector<uint8_t> to string
-    std::string serialized(data.begin(), data.end());
 
-    if (!response.ParseFromString(serialized)) {
+    if (!response.ParseFromArray(data.data(), static_cast<int>(data.size()))) {
         // Handle parse error (return empty response)
         return fenris::Response();
     }
@@ -0,0 +1,51 @@
+#include "common/session_resumption.hpp"
+
+#include <string_view>
+
+namespace fenris {
+namespace common {
+namespace crypto {
+
+namespace {
+
+// HKDF info prefixes, kept apart from the labels of other derived keys
+constexpr std::string_view RESUMPTION_SECRET_LABEL = "fenris resumption";
+constexpr std::string_view RESUMED_KEY_LABEL = "fenris resumed session";
+
+} // namespace
+
+std::pair<std::vector<uint8_t>, ECDHResult>
+derive_resumption_secret(const std::vector<uint8_t> &session_key)
+{
+    const std::vector<uint8_t> context(RESUMPTION_SECRET_LABEL.begin(),
+                                       RESUMPTION_SECRET_LABEL.end());
+
+    CryptoManager crypto_manager;
+    return crypto_manager.derive_key_from_shared_secret(
+        session_key, AES_GCM_KEY_SIZE, context);
+}
+
+std::pair<std::vector<uint8_t>, ECDHResult>
+derive_resumed_key(const std::vector<uint8_t> &resumption_secret,
+                   std::span<const uint8_t> client_nonce,
+                   std::span<const uint8_t> server_nonce)
+{
+    if (resumption_secret.empty() ||
+        client_nonce.size() != RESUMPTION_NONCE_SIZE ||
+        server_nonce.size() != RESUMPTION_NONCE_SIZE) {
+        return {{}, ECDHResult::KEY_DERIVATION_FAILED};
+    }
+
+    std::vector<uint8_t> context(RESUMED_KEY_LABEL.begin(),
+                                 RESUMED_KEY_LABEL.end());
+    context.insert(context.end(), client_nonce.begin(), client_nonce.end());
+    context.insert(context.end(), server_nonce.begin(), server_nonce.end());
+
+    CryptoManager crypto_manager;
+    return crypto_manager.derive_key_from_shared_secret(
+        resumption_secret, AES_GCM_KEY_SIZE, context);
+}
+
+} // namespace crypto
+} // namespace common
+} // namespace fenris
@@ -0,0 +1,229 @@
+#include "common/tracing.hpp"
+
+#include <algorithm>
+#include <random>
+#include <unistd.h>
+
+namespace fenris {
+namespace common {
+
+namespace {
+
+thread_local RequestTrace *t_current_trace = nullptr;
+
+uint64_t new_trace_id()
+{
+    thread_local std::mt19937_64 generator{std::random_device{}()};
+    uint64_t id;
+    do {
+        id = generator();
+    } while (id == 0);
+    return id;
+}
+
+double microseconds(RequestTrace::Clock::time_point time)
+{
+    return std::chrono::duration<double, std::micro>(time.time_since_epoch())
+        .count();
+}
+
+std::string escape_json(const std::string &text)
+{
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        if (static_cast<unsigned char>(c) >= 0x20) {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+} // namespace
+
+const char *trace_stage_name(TraceStage stage)
+{
+    switch (stage) {
+    case TraceStage::RECEIVE:
+        return "receive";
+    case TraceStage::DECRYPT:
+        return "decrypt";
+    case TraceStage::PARSE:
+        return "parse";
+    case TraceStage::QUEUE:
+        return "queue";
+    case TraceStage::HANDLE:
+        return "handle";
+    case TraceStage::CACHE:
+        return "cache";
+    case TraceStage::DISK:
+        return "disk";
+    case TraceStage::SERIALIZE:
+        return "serialize";
+    case TraceStage::ENCRYPT:
+        return "encrypt";
+    case TraceStage::SEND:
+        return "send";
+    }
+    return "unknown";
+}
+
+void RequestTrace::sample(uint64_t id, std::string name)
+{
+    m_id = id;
+    m_name = std::move(name);
+}
+
+void RequestTrace::discard()
+{
+    m_recording = false;
+    m_id = 0;
+    m_spans.clear();
+}
+
+RequestTrace *current_trace()
+{
+    return t_current_trace;
+}
+
+TraceContext::TraceContext(RequestTrace *trace) : m_previous(t_current_trace)
+{
+    t_current_trace = trace;
+}
+
+TraceContext::~TraceContext()
+{
+    t_current_trace = m_previous;
+}
+
+Tracer &Tracer::global()
+{
+    static Tracer instance;
+    return instance;
+}
+
+Tracer::Tracer() : m_pid(static_cast<int>(getpid())) {}
+
+Tracer::~Tracer()
+{
+    close();
+}
+
+bool Tracer::open(const std::string &path,
+                  uint32_t sample_rate,
+                  const std::string &process_name)
+{
+    close();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_file = std::fopen(path.c_str(), "w");
+    if (m_file == nullptr) {
+        return false;
+    }
+    std::fprintf(m_file,
+                 "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                 "\"args\":{\"name\":\"%s\"}}",
+                 m_pid,
+                 escape_json(process_name).c_str());
+
+    m_sample_rate.store(std::max<uint32_t>(sample_rate, 1),
+                        std::memory_order_relaxed);
+    m_enabled.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+void Tracer::close()
+{
+    m_enabled.store(false, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_file != nullptr) {
+        std::fputs("\n]\n", m_file);
+        std::fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+RequestTrace Tracer::begin() const
+{
+    RequestTrace trace;
+    if (enabled()) {
+        trace.m_recording = true;
+        trace.m_spans.reserve(16);
+    }
+    return trace;
+}
+
+void Tracer::adopt(RequestTrace &trace, uint64_t requested_id, std::string name)
+{
+    if (!trace.recording()) {
+        return;
+    }
+    if (requested_id == 0) {
+        const uint32_t rate = m_sample_rate.load(std::memory_order_relaxed);
+        if (m_requests.fetch_add(1, std::memory_order_relaxed) % rate != 0) {
+            trace.discard();
+            return;
+        }
+        requested_id = new_trace_id();
+    }
+    trace.sample(requested_id, std::move(name));
+}
+
+void Tracer::finish(const RequestTrace &trace)
+{
+    if (trace.id() == 0 || trace.spans().empty() || !enabled()) {
+        return;
+    }
+
+    // Every request gets a track of its own, named after its trace ID
+    const uint32_t track =
+        static_cast<uint32_t>(trace.id() ^ (trace.id() >> 32));
+    char trace_id[17];
+    std::snprintf(trace_id,
+                  sizeof(trace_id),
+                  "%016llx",
+                  static_cast<unsigned long long>(trace.id()));
+
+    std::string events;
+    auto append = [&](const std::string &name,
+                      const char *category,
+                      RequestTrace::Clock::time_point start,
+                      RequestTrace::Clock::time_point end) {
+        char event[256];
+        std::snprintf(event,
+                      sizeof(event),
+                      ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+                      "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,"
+                      "\"args\":{\"trace_id\":\"%s\"}}",
+                      name.c_str(),
+                      category,
+                      microseconds(start),
+                      microseconds(end) - microseconds(start),
+                      m_pid,
+                      track,
+                      trace_id);
+        events += event;
+    };
+
+    auto first = trace.spans().front().start;
+    auto last = trace.spans().front().end;
+    for (const auto &span : trace.spans()) {
+        first = std::min(first, span.start);
+        last = std::max(last, span.end);
+    }
+    append(escape_json(trace.name()), "request", first, last);
+    for (const auto &span : trace.spans()) {
+        append(trace_stage_name(span.stage), "stage", span.start, span.end);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_file != nullptr) {
+        std::fputs(events.c_str(), m_file);
+    }
+}
+
+} // namespace common
+} // namespace fenris
@@ -0,0 +1,195 @@
+#include "common/wire_compression.hpp"
+#include "common/metrics.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace fenris {
+namespace common {
+namespace compress {
+
+namespace {
+
+// Number of windows the entropy sample is spread over
+constexpr size_t SAMPLE_WINDOWS = 4;
+
+struct CodecMetrics {
+    Counter &input_bytes;
+    Counter &output_bytes;
+    Histogram &latency;
+};
+
+CodecMetrics make_codec_metrics(const std::string &op)
+{
+    MetricsRegistry &registry = MetricsRegistry::global();
+    const MetricLabels labels = {{"op", op}};
+    return CodecMetrics{
+        registry.counter("fenris_compression_input_bytes_total",
+                         "Bytes handed to a codec",
+                         labels),
+        registry.counter("fenris_compression_output_bytes_total",
+                         "Bytes a codec produced",
+                         labels),
+        registry.histogram("fenris_compression_seconds",
+                           "Time spent in codecs",
+                           labels),
+    };
+}
+
+CodecMetrics &compress_metrics()
+{
+    static CodecMetrics metrics = make_codec_metrics("compress");
+    return metrics;
+}
+
+CodecMetrics &decompress_metrics()
+{
+    static CodecMetrics metrics = make_codec_metrics("decompress");
+    return metrics;
+}
+
+Counter &uncompressed_messages()
+{
+    static Counter &counter = MetricsRegistry::global().counter(
+        "fenris_compression_skipped_total",
+        "Messages sent as they are, too small or too random to compress");
+    return counter;
+}
+
+} // namespace
+
+uint32_t negotiate_codecs(uint32_t offered, uint32_t supported)
+{
+    return (offered & supported & available_codecs()) |
+           codec_mask(CodecId::DEFLATE);
+}
+
+double estimate_entropy(std::span<const uint8_t> data, size_t sample_size)
+{
+    std::array<size_t, 256> counts{};
+    size_t sampled = 0;
+    const auto count = [&](std::span<const uint8_t> window) {
+        for (uint8_t byte : window) {
+            ++counts[byte];
+        }
+        sampled += window.size();
+    };
+
+    if (data.size() <= sample_size) {
+        count(data);
+    } else {
+        // Headers at the start of a message say little about its payload
+        const size_t window = std::max<size_t>(sample_size / SAMPLE_WINDOWS, 1);
+        const size_t stride = (data.size() - window) / (SAMPLE_WINDOWS - 1);
+        for (size_t i = 0; i < SAMPLE_WINDOWS; ++i) {
+            count(data.subspan(i * stride, window));
+        }
+    }
+    if (sampled == 0) {
+        return 0.0;
+    }
+
+    double entropy = 0.0;
+    for (size_t n : counts) {
+        if (n != 0) {
+            const double p = static_cast<double>(n) / sampled;
+            entropy -= p * std::log2(p);
+        }
+    }
+    return entropy;
+}
+
+WireCompression::WireCompression(const WireCompressionConfig &config,
+                                 uint32_t codecs)
+    : m_config(config)
+{
+    CodecOptions options;
+    options.level = config.level;
+    for (size_t id = 1; id < CODEC_COUNT; ++id) {
+        const auto codec = static_cast<CodecId>(id);
+        if ((codecs & codec_mask(codec)) != 0) {
+            m_encoders[id] = make_codec(codec, options);
+            m_decoders[id] = make_codec(codec, options);
+        }
+    }
+}
+
+std::pair<Buffer, CompressionResult>
+WireCompression::encode(std::span<const uint8_t> message, size_t tail_room)
+{
+    CodecId id = CodecId::NONE;
+    if (message.size() >= m_config.min_size &&
+        estimate_entropy(message, m_config.sample_size) <=
+            m_config.max_entropy) {
+        const bool fast = message.size() >= m_config.fast_codec_min_size &&
+                          m_encoders[static_cast<size_t>(CodecId::LZ4)];
+        id = fast ? CodecId::LZ4 : CodecId::DEFLATE;
+    }
+    Codec *codec = m_encoders[static_cast<size_t>(id)].get();
+
+    if (codec == nullptr) {
+        uncompressed_messages().add();
+        Buffer frame = Buffer::allocate(message.size() + 1 + tail_room);
+        frame.data()[0] = static_cast<uint8_t>(CodecId::NONE);
+        if (!message.empty()) {
+            std::memcpy(frame.data() + 1, message.data(), message.size());
+        }
+        return {std::move(frame), CompressionResult::SUCCESS};
+    }
+
+    CodecMetrics &metrics = compress_metrics();
+    std::vector<uint8_t> frame;
+    frame.reserve(message.size() / 2 + 1 + tail_room);
+    frame.push_back(static_cast<uint8_t>(id));
+    CompressionResult result;
+    {
+        ScopedTimer timer(metrics.latency);
+        result = codec->compress(message, frame);
+    }
+    if (result != CompressionResult::SUCCESS) {
+        return {Buffer(), result};
+    }
+    metrics.input_bytes.add(message.size());
+    metrics.output_bytes.add(frame.size() - 1);
+    frame.resize(frame.size() + tail_room);
+    return {Buffer::wrap(std::move(frame)), CompressionResult::SUCCESS};
+}
+
+std::pair<Buffer, CompressionResult>
+WireCompression::decode(const Buffer &frame)
+{
+    if (frame.empty()) {
+        return {Buffer(), CompressionResult::INVALID_DATA};
+    }
+
+    const uint8_t id = frame.data()[0];
+    if (id == static_cast<uint8_t>(CodecId::NONE)) {
+        return {frame.slice(1), CompressionResult::SUCCESS};
+    }
+    // Codecs that were not negotiated are as invalid as unknown ones
+    if (id >= CODEC_COUNT || !m_decoders[id]) {
+        return {Buffer(), CompressionResult::INVALID_DATA};
+    }
+
+    CodecMetrics &metrics = decompress_metrics();
+    std::vector<uint8_t> message;
+    CompressionResult result;
+    {
+        ScopedTimer timer(metrics.latency);
+        result = m_decoders[id]->decompress(
+            frame.span().subspan(1), m_config.max_message_size, message);
+    }
+    if (result != CompressionResult::SUCCESS) {
+        return {Buffer(), result};
+    }
+    metrics.input_bytes.add(frame.size() - 1);
+    metrics.output_bytes.add(message.size());
+    return {Buffer::wrap(std::move(message)), CompressionResult::SUCCESS};
+}
+
+} // namespace compress
+} // namespace common
+} // namespace fenris
@@ -0,0 +1,862 @@
+#include "server/async_file_io.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace fenris {
+namespace server {
+
+using namespace common;
+
+namespace {
+
+enum class OperationKind {
+    READ_FILE,
+    READ_CHUNK,
+    WRITE_FILE,
+    APPEND_FILE,
+    FILE_INFO,
+    LIST_DIRECTORY
+};
+
+enum class Step { STAT, OPEN, TRANSFER, ADVISE, CLOSE };
+
+// user_data of the read keeping the wake descriptor armed
+constexpr uint64_t WAKE_TAG = 0;
+
+// Largest single read or write, the length field is 32 bits wide
+constexpr size_t MAX_TRANSFER = 1u << 30;
+
+constexpr unsigned STATX_MASK =
+    STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME;
+
+FileOperationResult errno_to_file_operation_result(int error)
+{
+    return system_error_to_file_operation_result(
+        std::error_code(error, std::generic_category()));
+}
+
+// Same clock and unit as std::filesystem::last_write_time()
+uint64_t to_modified_time(const struct statx_timestamp &timestamp)
+{
+    const std::chrono::sys_time<std::chrono::nanoseconds> system_time(
+        std::chrono::seconds(timestamp.tv_sec) +
+        std::chrono::nanoseconds(timestamp.tv_nsec));
+    return static_cast<uint64_t>(std::chrono::file_clock::from_sys(system_time)
+                                     .time_since_epoch()
+                                     .count());
+}
+
+void wake(int wake_fd)
+{
+    const uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) {
+        // The counter only saturates if the ring thread is long gone
+    }
+}
+
+} // namespace
+
+struct AsyncFileIo::Operation {
+    OperationKind kind;
+    Directory directory;
+    std::string path;
+    Step step = Step::STAT;
+
+    // Transfer window, length is clamped to the file once it is known
+    uint64_t offset = 0;
+    size_t length = 0;
+    size_t done = 0;
+
+    // Range to prefetch once a chunk was read
+    Prefetch prefetch;
+
+    // Write payload and read destination
+    std::string data;
+    Buffer buffer;
+    int fixed_buffer = -1;
+
+    // Regular descriptor, or slot index when direct is set
+    int fd = -1;
+    bool direct = false;
+
+    FileOperationResult result = FileOperationResult::SUCCESS;
+    struct statx status {};
+
+    ReadCallback on_read;
+    ChunkCallback on_chunk;
+    WriteCallback on_write;
+    InfoCallback on_info;
+    ListCallback on_list;
+};
+
+/**
+ * Page-aligned regions registered with the ring. A Buffer handed out by
+ * acquire() returns its region when its last view goes away, which may be
+ * after the ring itself is gone.
+ */
+class AsyncFileIo::FixedBuffers
+    : public std::enable_shared_from_this<FixedBuffers> {
+  public:
+    FixedBuffers(size_t count, size_t size) : m_count(count), m_size(size)
+    {
+        void *memory = mmap(nullptr,
+                            m_count * m_size,
+                            PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS,
+                            -1,
+                            0);
+        if (memory == MAP_FAILED) {
+            return;
+        }
+        m_memory = static_cast<uint8_t *>(memory);
+        for (size_t i = m_count; i > 0; --i) {
+            m_free.push_back(static_cast<int>(i - 1));
+        }
+    }
+
+    ~FixedBuffers()
+    {
+        if (m_memory != nullptr) {
+            munmap(m_memory, m_count * m_size);
+        }
+    }
+
+    bool valid() const
+    {
+        return m_memory != nullptr;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    std::vector<iovec> regions() const
+    {
+        std::vector<iovec> regions(m_count);
+        for (size_t i = 0; i < m_count; ++i) {
+            regions[i].iov_base = m_memory + i * m_size;
+            regions[i].iov_len = m_size;
+        }
+        return regions;
+    }
+
+    // View the first length bytes of a free region, empty if none is free
+    Buffer acquire(size_t length, int &index)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_free.empty()) {
+                return {};
+            }
+            index = m_free.back();
+            m_free.pop_back();
+        }
+
+        uint8_t *region = m_memory + static_cast<size_t>(index) * m_size;
+        std::shared_ptr<void> owner(
+            region, [self = shared_from_this(), index](void *) {
+                self->release(index);
+            });
+        return Buffer::adopt(std::move(owner), region, length);
+    }
+
+  private:
+    void release(int index)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_free.push_back(index);
+    }
+
+    size_t m_count;
+    size_t m_size;
+    uint8_t *m_memory{nullptr};
+    std::vector<int> m_free;
+    std::mutex m_mutex;
+};
+
+std::string async_io_backend_to_string(AsyncIoBackend backend)
+{
+    switch (backend) {
+    case AsyncIoBackend::IO_URING:
+        return "io_uring";
+    case AsyncIoBackend::BLOCKING:
+        return "blocking";
+    default:
+        return "unknown";
+    }
+}
+
+AsyncFileIo::AsyncFileIo(const AsyncIoConfig &config,
+                         const std::string &logger_name)
+    : m_config(config),
+      m_backend(AsyncIoBackend::BLOCKING),
+      m_logger(get_logger(logger_name))
+{
+    m_config.queue_depth = std::max(m_config.queue_depth, 2u);
+}
+
+AsyncFileIo::~AsyncFileIo()
+{
+    stop();
+}
+
+void AsyncFileIo::start()
+{
+    std::lock_guard<std::mutex> lock(m_queue_mutex);
+    if (m_running) {
+        return;
+    }
+
+    m_pool = std::make_unique<ThreadPool>(m_config.blocking_threads);
+    m_backend = AsyncIoBackend::BLOCKING;
+    if (m_config.backend == AsyncIoBackend::IO_URING && start_ring()) {
+        m_backend = AsyncIoBackend::IO_URING;
+    }
+
+    m_stopping = false;
+    m_running = true;
+    m_logger->info("async file i/o started with the {} backend",
+                   async_io_backend_to_string(m_backend));
+}
+
+void AsyncFileIo::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_queue_mutex);
+        if (!m_running) {
+            return;
+        }
+        // Later operations run on the caller, queued ones still complete
+        m_running = false;
+        m_stopping = true;
+    }
+
+    if (m_thread.joinable()) {
+        wake(m_wake_fd);
+        m_thread.join();
+    }
+    m_ring.reset();
+    m_fixed_buffers.reset();
+    m_free_slots.clear();
+    if (m_wake_fd >= 0) {
+        close(m_wake_fd);
+        m_wake_fd = -1;
+    }
+
+    // Runs the listings and blocking operations still queued
+    m_pool.reset();
+    m_logger->info("async file i/o stopped");
+}
+
+AsyncIoBackend AsyncFileIo::get_backend() const
+{
+    return m_backend;
+}
+
+void AsyncFileIo::read_file(const Directory &directory,
+                            const std::string &path,
+                            ReadCallback callback)
+{
+    auto operation = std::make_unique<Operation>();
+    operation->kind = OperationKind::READ_FILE;
+    operation->directory = directory;
+    operation->path = path;
+    operation->on_read = std::move(callback);
+    submit(std::move(operation));
+}
+
+void AsyncFileIo::read_file(const std::string &path, ReadCallback callback)
+{
+    read_file(nullptr, path, std::move(callback));
+}
+
+void AsyncFileIo::read_chunk(const Directory &directory,
+                             const std::string &path,
+                             uint64_t offset,
+                             size_t length,
+                             const Prefetch &prefetch,
+                             ChunkCallback callback)
+{
+    auto operation = std::make_unique<Operation>();
+    operation->kind = OperationKind::READ_CHUNK;
+    operation->directory = directory;
+    operation->path = path;
+    operation->offset = offset;
+    operation->length = length;
+    operation->prefetch = prefetch;
+    operation->on_chunk = std::move(callback);
+    submit(std::move(operation));
+}
+
+void AsyncFileIo::read_chunk(const std::string &path,
+                             uint64_t offset,
+                             size_t length,
+                             ReadCallback callback)
+{
+    read_chunk(nullptr,
+               path,
+               offset,
+               length,
+               {},
+               [callback = std::move(callback)](
+                   Buffer block, uint64_t, FileOperationResult result) {
+                   callback(std::move(block), result);
+               });
+}
+
+void AsyncFileIo::write_file(const Directory &directory,
+                             const std::string &path,
+                             std::string data,
+                             WriteCallback callback)
+{
+    auto operation = std::make_unique<Operation>();
+    operation->kind = OperationKind::WRITE_FILE;
+    operation->directory = directory;
+    operation->path = path;
+    operation->length = data.size();
+    operation->data = std::move(data);
+    operation->on_write = std::move(callback);
+    submit(std::move(operation));
+}
+
+void AsyncFileIo::write_file(const std::string &path,
+                             std::string data,
+                             WriteCallback callback)
+{
+    write_file(nullptr, path, std::move(data), std::move(callback));
+}
+
+void AsyncFileIo::append_file(const Directory &directory,
+                              const std::string &path,
+                              std::string data,
+                              WriteCallback callback)
+{
+    auto operation = std::make_unique<Operation>();
+    operation->kind = OperationKind::APPEND_FILE;
+    operation->directory = directory;
+    operation->path = path;
+    operation->length = data.size();
+    operation->data = std::move(data);
+    operation->on_write = std::move(callback);
+    submit(std::move(operation));
+}
+
+void AsyncFileIo::append_file(const std::string &path,
+                              std::string data,
+                              WriteCallback callback)
+{
+    append_file(nullptr, path, std::move(data), std::move(callback));
+}
+
+void AsyncFileIo::get_file_info(const Directory &directory,
+                                const std::string &path,
+                                InfoCallback callback)
+{
+    auto operation = std::make_unique<Operation>();
+    operation->kind = OperationKind::FILE_INFO;
+    operation->directory = directory;
+    operation->path = path;
+    operation->on_info = std::move(callback);
+    submit(std::move(operation));
+}
+
+void AsyncFileIo::get_file_info(const std::string &path, InfoCallback callback)
+{
+    get_file_info(nullptr, path, std::move(callback));
+}
+
+void AsyncFileIo::list_directory(const std::string &path,
+                                 ListCallback callback)
+{
+    auto operation = std::make_unique<Operation>();
+    operation->kind = OperationKind::LIST_DIRECTORY;
+    operation->path = path;
+    operation->on_list = std::move(callback);
+    submit(std::move(operation));
+}
+
+void AsyncFileIo::submit(std::unique_ptr<Operation> operation)
+{
+    std::unique_lock<std::mutex> lock(m_queue_mutex);
+    if (!m_running) {
+        lock.unlock();
+        run_blocking(*operation);
+        return;
+    }
+
+    // io_uring has no opcode for reading directories
+    if (m_backend == AsyncIoBackend::BLOCKING ||
+        operation->kind == OperationKind::LIST_DIRECTORY) {
+        // Queued under the lock so stop() cannot tear the pool down first
+        std::shared_ptr<Operation> shared(std::move(operation));
+        m_pool->submit([this, shared]() { run_blocking(*shared); });
+        return;
+    }
+
+    m_queue.push_back(std::move(operation));
+    const bool was_empty = m_queue.size() == 1;
+    lock.unlock();
+
+    // A non-empty queue has already woken the ring thread
+    if (was_empty) {
+        wake(m_wake_fd);
+    }
+}
+
+void AsyncFileIo::run_blocking(Operation &operation)
+{
+    const DirectoryHandle working_directory;
+    const DirectoryHandle &directory =
+        operation.directory ? *operation.directory : working_directory;
+
+    switch (operation.kind) {
+    case OperationKind::READ_FILE: {
+        // Never mapped, a file truncated while being sent would fault
+        auto [content, result] =
+            directory.read_file_buffer(operation.path, 0);
+        operation.on_read(std::move(content), result);
+        break;
+    }
+    case OperationKind::READ_CHUNK: {
+        uint64_t size = 0;
+        auto [block, result] = directory.read_file_range(operation.path,
+                                                         operation.offset,
+                                                         operation.length,
+                                                         &size,
+                                                         operation.prefetch);
+        operation.on_chunk(std::move(block), size, result);
+        break;
+    }
+    case OperationKind::WRITE_FILE:
+        operation.on_write(
+            directory.write_file(operation.path, operation.data));
+        break;
+    case OperationKind::APPEND_FILE:
+        operation.on_write(
+            directory.append_file(operation.path, operation.data));
+        break;
+    case OperationKind::FILE_INFO: {
+        auto [file_info, result] = directory.get_file_info(operation.path);
+        operation.on_info(std::move(file_info), result);
+        break;
+    }
+    case OperationKind::LIST_DIRECTORY: {
+        auto [entries, result] = common::list_directory(operation.path);
+        operation.on_list(std::move(entries), result);
+        break;
+    }
+    }
+}
+
+bool AsyncFileIo::start_ring()
+{
+    auto ring = std::make_unique<IoUring>();
+    const int error = ring->init(m_config.queue_depth,
+                                 {IORING_OP_STATX,
+                                  IORING_OP_OPENAT,
+                                  IORING_OP_READ,
+                                  IORING_OP_READ_FIXED,
+                                  IORING_OP_WRITE,
+                                  IORING_OP_FADVISE,
+                                  IORING_OP_CLOSE});
+    if (error != 0) {
+        m_logger->warn("io_uring unavailable, using blocking file i/o: {}",
+                       strerror(-error));
+        return false;
+    }
+
+    m_wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (m_wake_fd == -1) {
+        m_logger->error("eventfd failed: {}", strerror(errno));
+        return false;
+    }
+
+    // Both registrations are optimizations, the ring works without them
+    if (m_config.registered_buffers != 0) {
+        auto fixed = std::make_shared<FixedBuffers>(
+            m_config.registered_buffers, m_config.registered_buffer_size);
+        const int result =
+            fixed->valid() ? ring->register_buffers(fixed->regions()) : -ENOMEM;
+        if (result == 0) {
+            m_fixed_buffers = std::move(fixed);
+        } else {
+            m_logger->warn("could not register read buffers: {}",
+                           strerror(-result));
+        }
+    }
+
+    m_free_slots.clear();
+    if (m_config.registered_files != 0) {
+        const int result = ring->register_file_slots(m_config.registered_files);
+        if (result == 0) {
+            for (unsigned slot = m_config.registered_files; slot > 0; --slot) {
+                m_free_slots.push_back(slot - 1);
+            }
+        } else {
+            m_logger->warn("could not register descriptor slots: {}",
+                           strerror(-result));
+        }
+    }
+
+    m_ring = std::move(ring);
+    m_in_flight = 0;
+    m_thread = std::thread(&AsyncFileIo::run_ring, this);
+    return true;
+}
+
+void AsyncFileIo::run_ring()
+{
+    arm_wake();
+
+    std::vector<std::unique_ptr<Operation>> batch;
+    while (true) {
+        bool stopping;
+        {
+            std::lock_guard<std::mutex> lock(m_queue_mutex);
+            // The rest waits for completions to free up the queue depth
+            const size_t room = m_config.queue_depth - m_in_flight;
+            const size_t count = std::min(room, m_queue.size());
+            std::move(m_queue.begin(),
+                      m_queue.begin() + static_cast<std::ptrdiff_t>(count),
+                      std::back_inserter(batch));
+            m_queue.erase(m_queue.begin(),
+                          m_queue.begin() + static_cast<std::ptrdiff_t>(count));
+            stopping = m_stopping && m_queue.empty();
+        }
+
+        for (auto &operation : batch) {
+            ++m_in_flight;
+            begin(operation.release());
+        }
+        batch.clear();
+
+        if (stopping && m_in_flight == 0) {
+            break;
+        }
+
+        // Everything prepared above goes to the kernel in one call
+        const int result = m_ring->submit(1);
+        if (result < 0 && result != -EINTR && result != -EAGAIN &&
+            result != -EBUSY) {
+            m_logger->error("io_uring_enter failed: {}", strerror(-result));
+        }
+
+        m_ring->for_each_completion(
+            [this](uint64_t user_data, int32_t res, uint32_t) {
+                if (user_data == WAKE_TAG) {
+                    arm_wake();
+                    return;
+                }
+                advance(reinterpret_cast<Operation *>(user_data), res);
+            });
+    }
+}
+
+void AsyncFileIo::begin(Operation *operation)
+{
+    const bool writes = operation->kind == OperationKind::WRITE_FILE ||
+                        operation->kind == OperationKind::APPEND_FILE;
+    operation->step = writes ? Step::OPEN : Step::STAT;
+    prepare(operation);
+}
+
+void AsyncFileIo::advance(Operation *operation, int32_t res)
+{
+    const bool reads = operation->kind == OperationKind::READ_FILE ||
+                       operation->kind == OperationKind::READ_CHUNK;
+
+    switch (operation->step) {
+    case Step::STAT: {
+        if (res < 0) {
+            operation->result = errno_to_file_operation_result(-res);
+            finish(operation);
+            return;
+        }
+        if (operation->kind == OperationKind::FILE_INFO) {
+            finish(operation);
+            return;
+        }
+        if (!S_ISREG(operation->status.stx_mode)) {
+            operation->result = FileOperationResult::INVALID_PATH;
+            finish(operation);
+            return;
+        }
+
+        const uint64_t size = operation->status.stx_size;
+        if (operation->kind == OperationKind::READ_FILE) {
+            operation->length = static_cast<size_t>(size);
+        } else if (operation->offset >= size) {
+            operation->length = 0;
+        } else {
+            const uint64_t remaining = size - operation->offset;
+            operation->length = static_cast<size_t>(
+                std::min<uint64_t>(operation->length, remaining));
+        }
+        if (operation->length == 0) {
+            finish(operation);
+            return;
+        }
+
+        if (operation->kind == OperationKind::READ_CHUNK && m_fixed_buffers &&
+            operation->length <= m_fixed_buffers->size()) {
+            operation->buffer = m_fixed_buffers->acquire(
+                operation->length, operation->fixed_buffer);
+        }
+        if (operation->buffer.empty()) {
+            operation->fixed_buffer = -1;
+            operation->buffer = Buffer::allocate(operation->length);
+        }
+
+        operation->step = Step::OPEN;
+        prepare(operation);
+        return;
+    }
+
+    case Step::OPEN:
+        if (res < 0) {
+            if (operation->direct) {
+                m_free_slots.push_back(static_cast<unsigned>(operation->fd));
+                operation->direct = false;
+                operation->fd = -1;
+                if (res == -EINVAL) {
+                    // Kernels before 5.15 reject file_index on OPENAT
+                    if (m_config.registered_files != 0) {
+                        m_logger->warn("direct descriptors unsupported, "
+                                       "using regular ones");
+                    }
+                    m_config.registered_files = 0;
+                    m_free_slots.clear();
+                    prepare(operation);
+                    return;
+                }
+            }
+            operation->result = errno_to_file_operation_result(-res);
+            finish(operation);
+            return;
+        }
+        if (!operation->direct) {
+            operation->fd = res;
+        }
+        operation->step = operation->length == 0 ? Step::CLOSE : Step::TRANSFER;
+        prepare(operation);
+        return;
+
+    case Step::TRANSFER:
+        if (res == -EINTR || res == -EAGAIN) {
+            prepare(operation);
+            return;
+        }
+        if (res < 0 || (res == 0 && !reads)) {
+            operation->result = FileOperationResult::IO_ERROR;
+        } else if (res > 0) {
+            operation->done += static_cast<size_t>(res);
+            if (operation->done < operation->length) {
+                prepare(operation);
+                return;
+            }
+        }
+        // A read ending early means the file shrank since statx
+        if (reads) {
+            operation->buffer.truncate(operation->done);
+        }
+        operation->step = operation->prefetch.length != 0 &&
+                                  operation->prefetch.offset <
+                                      operation->status.stx_size
+                              ? Step::ADVISE
+                              : Step::CLOSE;
+        prepare(operation);
+        return;
+
+    case Step::ADVISE:
+        // Only a hint, the chunk was read either way
+        operation->step = Step::CLOSE;
+        prepare(operation);
+        return;
+
+    case Step::CLOSE:
+        if (operation->direct && m_config.registered_files != 0) {
+            m_free_slots.push_back(static_cast<unsigned>(operation->fd));
+        }
+        // Deferred write errors, e.g. on NFS, only show up here
+        if (res < 0 && !reads &&
+            operation->result == FileOperationResult::SUCCESS) {
+            operation->result = FileOperationResult::IO_ERROR;
+        }
+        finish(operation);
+        return;
+    }
+}
+
+void AsyncFileIo::prepare(Operation *operation)
+{
+    io_uring_sqe *sqe = next_sqe();
+    sqe->user_data = reinterpret_cast<uint64_t>(operation);
+
+    switch (operation->step) {
+    case Step::STAT:
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = operation->directory ? operation->directory->dirfd()
+                                       : AT_FDCWD;
+        sqe->addr = reinterpret_cast<uint64_t>(operation->path.c_str());
+        sqe->len = STATX_MASK;
+        sqe->off = reinterpret_cast<uint64_t>(&operation->status);
+        break;
+
+    case Step::OPEN: {
+        int flags = O_RDONLY;
+        if (operation->kind == OperationKind::WRITE_FILE) {
+            flags = O_WRONLY | O_CREAT | O_TRUNC;
+        } else if (operation->kind == OperationKind::APPEND_FILE) {
+            flags = O_WRONLY | O_APPEND;
+        }
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = operation->directory ? operation->directory->dirfd()
+                                       : AT_FDCWD;
+        sqe->addr = reinterpret_cast<uint64_t>(operation->path.c_str());
+        sqe->len = 0666;
+        if (!m_free_slots.empty()) {
+            operation->fd = static_cast<int>(m_free_slots.back());
+            operation->direct = true;
+            m_free_slots.pop_back();
+            sqe->file_index = static_cast<uint32_t>(operation->fd) + 1;
+        } else {
+            // Direct descriptors are never inherited and reject O_CLOEXEC
+            flags |= O_CLOEXEC;
+        }
+        sqe->open_flags = static_cast<uint32_t>(flags);
+        break;
+    }
+
+    case Step::TRANSFER: {
+        const size_t length =
+            std::min(operation->length - operation->done, MAX_TRANSFER);
+        sqe->fd = operation->fd;
+        if (operation->direct) {
+            sqe->flags |= IOSQE_FIXED_FILE;
+        }
+        sqe->len = static_cast<uint32_t>(length);
+
+        if (operation->kind == OperationKind::WRITE_FILE ||
+            operation->kind == OperationKind::APPEND_FILE) {
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->addr = reinterpret_cast<uint64_t>(operation->data.data() +
+                                                   operation->done);
+            // -1 writes at the file position, which O_APPEND keeps at the end
+            sqe->off = operation->kind == OperationKind::APPEND_FILE
+                           ? UINT64_MAX
+                           : operation->done;
+            break;
+        }
+
+        sqe->opcode = operation->fixed_buffer >= 0 ? IORING_OP_READ_FIXED
+                                                   : IORING_OP_READ;
+        sqe->addr = reinterpret_cast<uint64_t>(operation->buffer.data() +
+                                               operation->done);
+        sqe->off = operation->offset + operation->done;
+        if (operation->fixed_buffer >= 0) {
+            sqe->buf_index = static_cast<uint16_t>(operation->fixed_buffer);
+        }
+        break;
+    }
+
+    case Step::ADVISE:
+        sqe->opcode = IORING_OP_FADVISE;
+        sqe->fd = operation->fd;
+        if (operation->direct) {
+            sqe->flags |= IOSQE_FIXED_FILE;
+        }
+        sqe->off = operation->prefetch.offset;
+        sqe->len = static_cast<uint32_t>(
+            std::min<uint64_t>(operation->prefetch.length, UINT32_MAX));
+        sqe->fadvise_advice = POSIX_FADV_WILLNEED;
+        break;
+
+    case Step::CLOSE:
+        sqe->opcode = IORING_OP_CLOSE;
+        if (operation->direct) {
+            sqe->file_index = static_cast<uint32_t>(operation->fd) + 1;
+        } else {
+            sqe->fd = operation->fd;
+        }
+        break;
+    }
+}
+
+void AsyncFileIo::finish(Operation *operation)
+{
+    std::unique_ptr<Operation> owned(operation);
+    --m_in_flight;
+
+    const FileOperationResult result = owned->result;
+    if (result != FileOperationResult::SUCCESS) {
+        owned->buffer = Buffer();
+    }
+
+    switch (owned->kind) {
+    case OperationKind::READ_FILE:
+        owned->on_read(std::move(owned->buffer), result);
+        break;
+    case OperationKind::READ_CHUNK:
+        owned->on_chunk(std::move(owned->buffer),
+                        result == FileOperationResult::SUCCESS
+                            ? owned->status.stx_size
+                            : 0,
+                        result);
+        break;
+    case OperationKind::WRITE_FILE:
+    case OperationKind::APPEND_FILE:
+        owned->on_write(result);
+        break;
+    case OperationKind::FILE_INFO: {
+        fenris::FileInfo file_info;
+        if (result == FileOperationResult::SUCCESS) {
+            const struct statx &status = owned->status;
+            file_info.set_name(owned->path);
+            file_info.set_size(S_ISREG(status.stx_mode) ? status.stx_size : 0);
+            file_info.set_is_directory(S_ISDIR(status.stx_mode));
+            file_info.set_modified_time(to_modified_time(status.stx_mtime));
+            file_info.set_permissions(status.stx_mode & 0777);
+        }
+        owned->on_info(std::move(file_info), result);
+        break;
+    }
+    case OperationKind::LIST_DIRECTORY:
+        // Never submitted to the ring
+        break;
+    }
+}
+
+void AsyncFileIo::arm_wake()
+{
+    io_uring_sqe *sqe = next_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m_wake_fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&m_wake_value);
+    sqe->len = sizeof(m_wake_value);
+    sqe->user_data = WAKE_TAG;
+}
+
+io_uring_sqe *AsyncFileIo::next_sqe()
+{
+    io_uring_sqe *sqe = m_ring->get_sqe();
+    while (sqe == nullptr) {
+        // The queue is full of prepared entries, hand them over to make room
+        m_ring->submit();
+        sqe = m_ring->get_sqe();
+    }
+    return sqe;
+}
+
+} // namespace server
+} // namespace fenris
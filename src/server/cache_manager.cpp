@@ -1,67 +1,194 @@
 #include "server/cache_manager.hpp"
 #include "common/file_operations.hpp"
 #include "common/logging.hpp"
+#include "common/tracing.hpp"
 
 #include <algorithm>
+#include <bit>
+#include <limits>
 
 namespace fenris {
 namespace server {
 
 using namespace common;
 
+namespace {
+
+// Entry size assumed when sizing a policy for a byte budget alone
+constexpr size_t ASSUMED_ENTRY_BYTES = 64 * 1024;
+
+} // namespace
+
+CacheManager::CacheManager(const CacheConfig &config,
+                           const std::string &logger_name)
+    : m_validate_on_hit(config.validate_on_hit),
+      m_map_threshold(config.map_threshold),
+      m_logger(get_logger(logger_name)), m_metrics(make_metrics(logger_name))
+{
+    const size_t shard_count =
+        std::bit_ceil(std::max<size_t>(config.shard_count, 1));
+    m_shard_mask = shard_count - 1;
+
+    m_shard_max_bytes = config.max_bytes / shard_count;
+    m_shard_max_entries =
+        config.max_entries == 0
+            ? 0
+            : (config.max_entries + shard_count - 1) / shard_count;
+
+    // Sketches and ghost lists are sized in entries, not bytes
+    const size_t policy_capacity =
+        m_shard_max_entries != 0
+            ? m_shard_max_entries
+            : std::clamp<size_t>(
+                  m_shard_max_bytes / ASSUMED_ENTRY_BYTES, 16, 1 << 16);
+
+    m_shards.reserve(shard_count);
+    for (size_t i = 0; i < shard_count; ++i) {
+        auto shard = std::make_unique<Shard>();
+        shard->policy = make_eviction_policy(
+            config.eviction_policy, shard->table, policy_capacity);
+        m_shards.push_back(std::move(shard));
+    }
+
+    m_logger->info("cache manager initialized with {} bytes over {} shards, "
+                   "{} eviction",
+                   config.max_bytes,
+                   shard_count,
+                   eviction_policy_type_to_string(config.eviction_policy));
+}
+
 CacheManager::CacheManager(size_t max_cache_size,
                            const std::string &logger_name)
-    : m_max_cache_size(max_cache_size), m_logger(get_logger(logger_name))
+    : CacheManager(CacheConfig{std::numeric_limits<size_t>::max(),
+                               std::max<size_t>(max_cache_size, 1),
+                               1},
+                   logger_name)
+{
+}
+
+CacheManager::~CacheManager()
+{
+    for (auto &shard : m_shards) {
+        m_metrics.resident_bytes.subtract(shard->bytes);
+    }
+}
+
+CacheManager::Metrics CacheManager::make_metrics(const std::string &cache_name)
 {
-    m_logger->info("cache manager initialized with max size: {}",
-                   max_cache_size);
+    MetricsRegistry &registry = MetricsRegistry::global();
+    const MetricLabels labels = {{"cache", cache_name}};
+    return Metrics{
+        registry.counter(
+            "fenris_cache_hits_total", "Reads served from the cache", labels),
+        registry.counter("fenris_cache_misses_total",
+                         "Reads that had to go to disk, stale hits included",
+                         labels),
+        registry.counter("fenris_cache_evictions_total",
+                         "Entries dropped to make room for others",
+                         labels),
+        registry.gauge("fenris_cache_resident_bytes",
+                       "Bytes of file content held in the cache",
+                       labels),
+    };
 }
 
 std::string CacheManager::read_file(const std::string &filename)
 {
+    std::optional<CachedFile> data = read_shared(filename);
+    return data ? std::string(data->view()) : std::string();
+}
+
+std::optional<CachedFile> CacheManager::read_shared(const std::string &filename)
+{
+    const uint64_t hash = CacheTable::hash_key(filename);
+    Shard &shard = shard_for(hash);
 
     // Check if file is in cache
+    std::optional<CachedFile> cached;
+    uint64_t cached_time = 0;
+    uint64_t invalidations;
+    {
+        TraceScope trace(TraceStage::CACHE);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        const uint32_t slot = shard.table.find(filename, hash);
+        if (slot != NO_SLOT && !m_validate_on_hit) {
+            // Cache hit: tell the policy and hand out the shared content
+            FENRIS_LOG_DEBUG_SAMPLED(m_logger,
+                                     "cache hit for file: {}",
+                                     filename);
+            ++shard.stats.hits;
+            m_metrics.hits.add();
+            shard.policy->record_hit(slot);
+            return shard.table.entry(slot).data;
+        }
+        if (slot != NO_SLOT) {
+            cached = shard.table.entry(slot).data;
+            cached_time = shard.table.entry(slot).modified_time;
+        }
+        invalidations = shard.invalidations;
+    }
+
+    // Validate outside the lock, stat() must not serialize the shard
+    if (cached && is_current(filename, cached->size(), cached_time)) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        FENRIS_LOG_DEBUG_SAMPLED(m_logger, "cache hit for file: {}", filename);
+        ++shard.stats.hits;
+        m_metrics.hits.add();
+        const uint32_t slot = shard.table.find(filename, hash);
+        if (slot != NO_SLOT &&
+            shard.table.entry(slot).data.data() == cached->data()) {
+            shard.policy->record_hit(slot);
+        }
+        return cached;
+    }
+
     {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        auto it = m_cache.find(filename);
-        if (it != m_cache.end()) {
-            // Cache hit: update LRU and return content
-            m_logger->debug("cache hit for file: {}", filename);
-            update_lru(filename);
-            return it->second;
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (cached) {
+            FENRIS_LOG_DEBUG_SAMPLED(m_logger,
+                                     "cached file changed on disk: {}",
+                                     filename);
+            ++shard.stats.stale_hits;
+            const uint32_t slot = shard.table.find(filename, hash);
+            if (slot != NO_SLOT &&
+                shard.table.entry(slot).data.data() == cached->data()) {
+                erase(shard, slot, false);
+            }
+            invalidations = ++shard.invalidations;
         }
+        ++shard.stats.misses;
+        m_metrics.misses.add();
+        shard.policy->record_miss(hash);
     }
 
-    m_logger->debug("cache miss for file: {}", filename);
+    FENRIS_LOG_DEBUG_SAMPLED(m_logger, "cache miss for file: {}", filename);
+
+    // Take the timestamp first, a change while reading then fails validation
+    uint64_t modified_time = 0;
+    if (m_validate_on_hit) {
+        auto [file_info, info_result] = common::get_file_info(filename);
+        if (info_result == common::FileOperationResult::SUCCESS) {
+            modified_time = file_info.modified_time();
+        }
+    }
 
     // Cache miss: read from file system using existing file operations
-    auto [data, result] = common::read_file(filename);
+    auto [data, result] = common::read_file_buffer(filename, m_map_threshold);
     if (result != common::FileOperationResult::SUCCESS) {
         m_logger->warn("failed to read file: {}, error: {}",
                        filename,
                        common::file_operation_result_to_string(result));
-        return "";
+        return std::nullopt;
     }
 
-    // Add to cache if not empty
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
-
-        if (!data.empty()) {
-            if (m_cache.find(filename) == m_cache.end() &&
-                m_cache.size() >= m_max_cache_size) {
-                // Cache is full, remove least recently used entry
-                remove_lru_entry();
-            }
-
-            // Insert into cache and update LRU
-            m_cache[filename] = data;
-            update_lru(filename);
+    // Add to cache if not empty and nothing was invalidated while reading
+    if (!data.empty()) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.invalidations == invalidations) {
+            store(shard, filename, hash, data, modified_time);
         }
     }
 
-    m_logger->debug("file cached: {} ({} bytes)", filename, data.size());
-
     return data;
 }
 
@@ -78,99 +205,359 @@ bool CacheManager::write_file(const std::string &filename,
     }
 
     // Update cache with new content
-    m_logger->debug("updating cache for file: {}", filename);
+    FENRIS_LOG_DEBUG_SAMPLED(m_logger, "updating cache for file: {}", filename);
 
-    // If adding this would exceed cache size, remove LRU entry
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        if (m_cache.find(filename) == m_cache.end() &&
-            m_cache.size() >= m_max_cache_size) {
-            remove_lru_entry();
+    uint64_t modified_time = 0;
+    if (m_validate_on_hit) {
+        auto [file_info, info_result] = common::get_file_info(filename);
+        if (info_result == common::FileOperationResult::SUCCESS) {
+            modified_time = file_info.modified_time();
         }
+    }
 
-        // Add/update in cache
-        m_cache[filename] = content;
-        update_lru(filename);
+    CachedFile data = Buffer::copy_of(
+        {reinterpret_cast<const uint8_t *>(content.data()), content.size()});
+    const uint64_t hash = CacheTable::hash_key(filename);
+    Shard &shard = shard_for(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.table.find(filename, hash) == NO_SLOT) {
+        // Writing a file is an access the admission filter should see
+        shard.policy->record_miss(hash);
     }
+    store(shard, filename, hash, std::move(data), modified_time);
 
     return true;
 }
 
-void CacheManager::invalidate(const std::string &filename)
+std::optional<CachedFile>
+CacheManager::cached_range(const std::string &filename,
+                           uint64_t offset,
+                           size_t length,
+                           uint64_t *file_size)
 {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    const uint64_t hash = CacheTable::hash_key(filename);
+    Shard &shard = shard_for(hash);
 
-    auto cache_it = m_cache.find(filename);
-    if (cache_it != m_cache.end()) {
-        // Remove from cache
-        m_cache.erase(filename);
+    std::optional<CachedFile> cached;
+    uint64_t cached_time = 0;
+    {
+        TraceScope trace(TraceStage::CACHE);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        const uint32_t slot = shard.table.find(filename, hash);
+        if (slot != NO_SLOT) {
+            cached = shard.table.entry(slot).data;
+            cached_time = shard.table.entry(slot).modified_time;
+        }
+    }
 
-        // Remove from LRU tracking
-        auto lru_it = m_lru_map.find(filename);
-        if (lru_it != m_lru_map.end()) {
-            m_lru_list.erase(lru_it->second);
-            m_lru_map.erase(lru_it);
-        } else {
-            m_logger->warn("file not found in LRU tracking: {}", filename);
+    if (cached && (!m_validate_on_hit ||
+                   is_current(filename, cached->size(), cached_time))) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        FENRIS_LOG_DEBUG_SAMPLED(m_logger,
+                                 "cache hit for range of file: {}",
+                                 filename);
+        ++shard.stats.hits;
+        m_metrics.hits.add();
+        const uint32_t slot = shard.table.find(filename, hash);
+        if (slot != NO_SLOT &&
+            shard.table.entry(slot).data.data() == cached->data()) {
+            shard.policy->record_hit(slot);
         }
+        if (file_size != nullptr) {
+            *file_size = cached->size();
+        }
+        return offset >= cached->size()
+                   ? CachedFile()
+                   : cached->slice(static_cast<size_t>(offset), length);
+    }
 
-        m_logger->debug("invalidated cache entry: {}", filename);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (cached) {
+            FENRIS_LOG_DEBUG_SAMPLED(m_logger,
+                                     "cached file changed on disk: {}",
+                                     filename);
+            ++shard.stats.stale_hits;
+            const uint32_t slot = shard.table.find(filename, hash);
+            if (slot != NO_SLOT &&
+                shard.table.entry(slot).data.data() == cached->data()) {
+                erase(shard, slot, false);
+            }
+            ++shard.invalidations;
+        }
+        ++shard.stats.misses;
+        m_metrics.misses.add();
     }
+    return std::nullopt;
 }
 
-void CacheManager::clear_cache()
+std::optional<CachedFile> CacheManager::read_range(const std::string &filename,
+                                                   uint64_t offset,
+                                                   size_t length)
+{
+    std::optional<CachedFile> cached = cached_range(filename, offset, length);
+    if (cached.has_value()) {
+        return cached;
+    }
+
+    // Not recorded with the policy, a range says nothing about the file
+    auto [data, result] = common::read_file_range(filename, offset, length);
+    if (result != common::FileOperationResult::SUCCESS) {
+        m_logger->warn("failed to read range of file: {}, error: {}",
+                       filename,
+                       common::file_operation_result_to_string(result));
+        return std::nullopt;
+    }
+    return data;
+}
+
+void CacheManager::invalidate(const std::string &filename)
+{
+    const uint64_t hash = CacheTable::hash_key(filename);
+    Shard &shard = shard_for(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    ++shard.invalidations;
+    const uint32_t slot = shard.table.find(filename, hash);
+    if (slot != NO_SLOT) {
+        erase(shard, slot, false);
+        FENRIS_LOG_DEBUG(m_logger, "invalidated cache entry: {}", filename);
+    }
+}
+
+void CacheManager::invalidate_prefix(const std::string &directory)
 {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    const std::string prefix = directory == "/" ? "/" : directory + "/";
 
-    size_t count = m_cache.size();
-    m_cache.clear();
-    m_lru_list.clear();
-    m_lru_map.clear();
+    size_t count = 0;
+    for (auto &shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        ++shard->invalidations;
+
+        std::vector<uint32_t> slots;
+        shard->table.for_each([&](uint32_t slot, const CacheEntry &entry) {
+            if (entry.key == directory || entry.key.starts_with(prefix)) {
+                slots.push_back(slot);
+            }
+        });
+        for (uint32_t slot : slots) {
+            erase(*shard, slot, false);
+        }
+        count += slots.size();
+    }
+    m_logger->debug("invalidated {} cache entries below {}", count, directory);
+}
+
+void CacheManager::clear_cache()
+{
+    size_t count = 0;
+    for (auto &shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        count += shard->table.size();
+        ++shard->invalidations;
+        shard->policy->clear();
+        shard->table.clear();
+        m_metrics.resident_bytes.subtract(shard->bytes);
+        shard->bytes = 0;
+    }
     m_logger->info("cache cleared, {} entries removed", count);
 }
 
+bool CacheManager::watch(const std::string &root)
+{
+    auto watcher = std::make_unique<FileWatcher>(
+        root, [this](const std::string &path, bool is_directory) {
+            if (is_directory) {
+                invalidate_prefix(path);
+            } else {
+                invalidate(path);
+            }
+        });
+    if (!watcher->start()) {
+        m_logger->error("failed to watch {} for cache invalidation", root);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_watcher_mutex);
+    m_watcher = std::move(watcher);
+    m_logger->info("invalidating cache entries on changes below {}", root);
+    return true;
+}
+
+void CacheManager::stop_watching()
+{
+    std::unique_ptr<FileWatcher> watcher;
+    {
+        std::lock_guard<std::mutex> lock(m_watcher_mutex);
+        watcher.swap(m_watcher);
+    }
+    if (watcher) {
+        watcher->stop();
+    }
+}
+
 size_t CacheManager::get_cache_size() const
 {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t count = 0;
+    for (const auto &shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        count += shard->table.size();
+    }
+    return count;
+}
+
+size_t CacheManager::get_cache_bytes() const
+{
+    size_t bytes = 0;
+    for (const auto &shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        bytes += shard->bytes;
+    }
+    return bytes;
+}
 
-    return m_cache.size();
+CacheStats CacheManager::get_stats() const
+{
+    CacheStats total;
+    for (const auto &shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        total.hits += shard->stats.hits;
+        total.misses += shard->stats.misses;
+        total.evictions += shard->stats.evictions;
+        total.rejections += shard->stats.rejections;
+        total.stale_hits += shard->stats.stale_hits;
+    }
+    return total;
 }
 
-void CacheManager::update_lru(const std::string &filename)
+void CacheManager::reset_stats()
 {
-    // Check if file is in LRU list
-    auto it = m_lru_map.find(filename);
-    if (it != m_lru_map.end() && it->second != m_lru_list.end()) {
-        // Move the file to the front of the list (most recently used)
-        m_lru_list.erase(it->second);
-        m_lru_list.push_front(filename);
-        m_lru_map[filename] = m_lru_list.begin();
-    } else {
-        // If not in LRU list but in cache, add it to LRU tracking
-        if (m_cache.find(filename) != m_cache.end()) {
-            m_lru_list.push_front(filename);
-            m_lru_map[filename] = m_lru_list.begin();
-        }
+    for (auto &shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->stats = CacheStats{};
     }
 }
 
-void CacheManager::remove_lru_entry()
+size_t CacheManager::get_shard_count() const
 {
-    if (m_lru_list.empty()) {
+    return m_shards.size();
+}
+
+CacheManager::Shard &CacheManager::shard_for(uint64_t hash)
+{
+    // The table probes with the low bits, pick shards with the high ones
+    return *m_shards[(hash >> 32) & m_shard_mask];
+}
+
+void CacheManager::store(Shard &shard,
+                         const std::string &filename,
+                         uint64_t hash,
+                         CachedFile data,
+                         uint64_t modified_time)
+{
+    const uint32_t existing = shard.table.find(filename, hash);
+
+    // A file that would fill the whole shard is served but not kept
+    if (data.size() > m_shard_max_bytes) {
+        FENRIS_LOG_DEBUG_SAMPLED(m_logger,
+                                 "file too large to cache: {} ({} bytes)",
+                                 filename,
+                                 data.size());
+        if (existing != NO_SLOT) {
+            erase(shard, existing, false);
+        }
         return;
     }
 
-    // Get the least recently used filename (at the back of the list)
-    std::string lru_filename = m_lru_list.back();
+    if (existing != NO_SLOT) {
+        // Rewriting a resident file counts as a use, not a new admission
+        CacheEntry &entry = shard.table.entry(existing);
+        shard.bytes = shard.bytes - entry.data.size() + data.size();
+        m_metrics.resident_bytes.add(static_cast<int64_t>(data.size()) -
+                                     static_cast<int64_t>(entry.data.size()));
+        entry.data = std::move(data);
+        entry.modified_time = modified_time;
+        shard.policy->record_hit(existing);
+        while (over_budget(shard, 0, 0)) {
+            if (!evict(shard)) {
+                break;
+            }
+        }
+        return;
+    }
 
-    m_logger->debug("removing LRU cache entry: {}", lru_filename);
+    if (over_budget(shard, data.size(), 1)) {
+        const uint32_t victim = shard.policy->victim();
+        if (victim != NO_SLOT && !shard.policy->admit(hash, victim)) {
+            FENRIS_LOG_DEBUG_SAMPLED(m_logger,
+                                     "cache admission rejected for file: {}",
+                                     filename);
+            ++shard.stats.rejections;
+            return;
+        }
+        while (over_budget(shard, data.size(), 1)) {
+            if (!evict(shard)) {
+                break;
+            }
+        }
+    }
 
-    // Remove from cache
-    m_cache.erase(lru_filename);
+    shard.bytes += data.size();
+    m_metrics.resident_bytes.add(data.size());
+    FENRIS_LOG_DEBUG_SAMPLED(m_logger,
+                             "file cached: {} ({} bytes)",
+                             filename,
+                             data.size());
+    const uint32_t slot = shard.table.insert(filename, hash, std::move(data));
+    shard.table.entry(slot).modified_time = modified_time;
+    shard.policy->insert(slot);
+}
 
-    // Remove from LRU tracking
-    m_lru_map.erase(lru_filename);
-    m_lru_list.pop_back();
+bool CacheManager::is_current(const std::string &filename,
+                              size_t size,
+                              uint64_t modified_time) const
+{
+    auto [file_info, result] = common::get_file_info(filename);
+    return result == common::FileOperationResult::SUCCESS &&
+           !file_info.is_directory() && file_info.size() == size &&
+           file_info.modified_time() == modified_time;
+}
+
+bool CacheManager::over_budget(const Shard &shard,
+                               size_t extra_bytes,
+                               size_t extra_entries) const
+{
+    if (shard.bytes + extra_bytes > m_shard_max_bytes) {
+        return true;
+    }
+    return m_shard_max_entries != 0 &&
+           shard.table.size() + extra_entries > m_shard_max_entries;
+}
+
+bool CacheManager::evict(Shard &shard)
+{
+    const uint32_t victim = shard.policy->victim();
+    if (victim == NO_SLOT) {
+        // Every resident entry is on one of the policy's lists
+        m_logger->error("eviction policy has no victim for a full shard");
+        return false;
+    }
+
+    FENRIS_LOG_DEBUG_SAMPLED(m_logger,
+                             "evicting cache entry: {}",
+                             shard.table.entry(victim).key);
+    ++shard.stats.evictions;
+    m_metrics.evictions.add();
+    erase(shard, victim, true);
+    return true;
+}
+
+void CacheManager::erase(Shard &shard, uint32_t slot, bool evicted)
+{
+    shard.bytes -= shard.table.entry(slot).data.size();
+    m_metrics.resident_bytes.subtract(shard.table.entry(slot).data.size());
+    shard.policy->remove(slot, evicted);
+    shard.table.erase(slot);
 }
 
 } // namespace server
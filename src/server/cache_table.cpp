@@ -0,0 +1,203 @@
+#include "server/cache_table.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <functional>
+
+namespace fenris {
+namespace server {
+
+namespace {
+
+// Keep at most three quarters of the buckets occupied
+bool needs_growth(size_t entries, size_t buckets)
+{
+    return entries * 4 > buckets * 3;
+}
+
+} // namespace
+
+CacheTable::CacheTable(size_t capacity)
+{
+    size_t buckets = 16;
+    while (needs_growth(capacity, buckets)) {
+        buckets *= 2;
+    }
+    m_buckets.resize(buckets);
+    m_mask = buckets - 1;
+    m_entries.reserve(capacity);
+}
+
+uint64_t CacheTable::hash_key(std::string_view key)
+{
+    return std::hash<std::string_view>{}(key);
+}
+
+uint32_t CacheTable::find(std::string_view key, uint64_t hash) const
+{
+    const auto tag = static_cast<uint32_t>(hash);
+    for (size_t i = tag & m_mask;; i = (i + 1) & m_mask) {
+        const Bucket &bucket = m_buckets[i];
+        if (bucket.slot == NO_SLOT) {
+            return NO_SLOT;
+        }
+        if (bucket.tag == tag && m_entries[bucket.slot].key == key) {
+            return bucket.slot;
+        }
+    }
+}
+
+uint32_t CacheTable::insert(std::string key, uint64_t hash, CachedFile data)
+{
+    if (needs_growth(m_size + 1, m_buckets.size())) {
+        grow();
+    }
+
+    uint32_t slot;
+    if (!m_free_slots.empty()) {
+        slot = m_free_slots.back();
+        m_free_slots.pop_back();
+    } else {
+        slot = static_cast<uint32_t>(m_entries.size());
+        m_entries.emplace_back();
+    }
+
+    CacheEntry &entry = m_entries[slot];
+    entry.key = std::move(key);
+    entry.data = std::move(data);
+    entry.hash = hash;
+    entry.modified_time = 0;
+    entry.prev = NO_SLOT;
+    entry.next = NO_SLOT;
+    entry.list = 0;
+    entry.occupied = true;
+
+    const auto tag = static_cast<uint32_t>(hash);
+    size_t i = tag & m_mask;
+    while (m_buckets[i].slot != NO_SLOT) {
+        i = (i + 1) & m_mask;
+    }
+    m_buckets[i] = Bucket{slot, tag};
+    ++m_size;
+    return slot;
+}
+
+void CacheTable::erase(uint32_t slot)
+{
+    size_t hole = bucket_of(slot);
+    m_buckets[hole] = Bucket{};
+
+    // Shift later members of the probe run back so lookups never stop early
+    for (size_t i = (hole + 1) & m_mask; m_buckets[i].slot != NO_SLOT;
+         i = (i + 1) & m_mask) {
+        const size_t home = m_buckets[i].tag & m_mask;
+        const bool reachable_from_hole = (i > hole)
+                                             ? (home <= hole || home > i)
+                                             : (home <= hole && home > i);
+        if (reachable_from_hole) {
+            m_buckets[hole] = m_buckets[i];
+            m_buckets[i] = Bucket{};
+            hole = i;
+        }
+    }
+
+    CacheEntry &entry = m_entries[slot];
+    entry.key.clear();
+    entry.data = CachedFile();
+    entry.list = 0;
+    entry.occupied = false;
+    m_free_slots.push_back(slot);
+    --m_size;
+}
+
+void CacheTable::clear()
+{
+    std::fill(m_buckets.begin(), m_buckets.end(), Bucket{});
+    m_entries.clear();
+    m_free_slots.clear();
+    m_size = 0;
+}
+
+size_t CacheTable::bucket_of(uint32_t slot) const
+{
+    size_t i = static_cast<uint32_t>(m_entries[slot].hash) & m_mask;
+    while (m_buckets[i].slot != slot) {
+        i = (i + 1) & m_mask;
+    }
+    return i;
+}
+
+void CacheTable::grow()
+{
+    std::vector<Bucket> old_buckets(m_buckets.size() * 2);
+    old_buckets.swap(m_buckets);
+    m_mask = m_buckets.size() - 1;
+
+    for (const Bucket &bucket : old_buckets) {
+        if (bucket.slot == NO_SLOT) {
+            continue;
+        }
+        size_t i = bucket.tag & m_mask;
+        while (m_buckets[i].slot != NO_SLOT) {
+            i = (i + 1) & m_mask;
+        }
+        m_buckets[i] = bucket;
+    }
+}
+
+SlotList::SlotList(CacheTable &table, uint8_t id) : m_table(table), m_id(id)
+{
+}
+
+void SlotList::push_front(uint32_t slot)
+{
+    CacheEntry &entry = m_table.entry(slot);
+    entry.list = m_id;
+    entry.prev = NO_SLOT;
+    entry.next = m_head;
+    if (m_head != NO_SLOT) {
+        m_table.entry(m_head).prev = slot;
+    } else {
+        m_tail = slot;
+    }
+    m_head = slot;
+    ++m_size;
+}
+
+void SlotList::unlink(uint32_t slot)
+{
+    CacheEntry &entry = m_table.entry(slot);
+    if (entry.prev != NO_SLOT) {
+        m_table.entry(entry.prev).next = entry.next;
+    } else {
+        m_head = entry.next;
+    }
+    if (entry.next != NO_SLOT) {
+        m_table.entry(entry.next).prev = entry.prev;
+    } else {
+        m_tail = entry.prev;
+    }
+    entry.prev = NO_SLOT;
+    entry.next = NO_SLOT;
+    entry.list = 0;
+    --m_size;
+}
+
+void SlotList::move_to_front(uint32_t slot)
+{
+    if (m_head == slot) {
+        return;
+    }
+    unlink(slot);
+    push_front(slot);
+}
+
+void SlotList::reset()
+{
+    m_head = NO_SLOT;
+    m_tail = NO_SLOT;
+    m_size = 0;
+}
+
+} // namespace server
+} // namespace fenris
@@ -0,0 +1,567 @@
+#include "server/chunk_store.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <cryptopp/sha.h>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+#include <unistd.h>
+#include <unordered_set>
+
+namespace fenris {
+namespace server {
+
+namespace fs = std::filesystem;
+
+using namespace common;
+
+namespace {
+
+// Steps of splitmix64, used once to fill the gear table
+constexpr uint64_t splitmix64(uint64_t &state)
+{
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Random value per byte, fixed so cuts are the same on every run
+constexpr std::array<uint64_t, 256> make_gear_table()
+{
+    std::array<uint64_t, 256> table{};
+    uint64_t state = 0;
+    for (auto &value : table) {
+        value = splitmix64(state);
+    }
+    return table;
+}
+
+constexpr std::array<uint64_t, 256> GEAR = make_gear_table();
+
+// The top bits of the gear hash, which depend on the last 64 bytes only
+constexpr uint64_t top_bits(unsigned bits)
+{
+    return bits == 0 ? 0 : ~uint64_t{0} << (64 - bits);
+}
+
+struct Cutter {
+    size_t min;
+    size_t avg;
+    size_t max;
+    // Cut where the hash has all mask bits clear, strict before avg
+    uint64_t strict_mask;
+    uint64_t loose_mask;
+};
+
+Cutter make_cutter(const ChunkStoreConfig &config)
+{
+    Cutter cutter{};
+    cutter.avg = std::bit_floor(std::max<size_t>(config.avg_chunk_size, 64));
+    cutter.min = std::min(config.min_chunk_size, cutter.avg);
+    cutter.max = std::max(config.max_chunk_size, cutter.avg);
+
+    const auto bits = static_cast<unsigned>(std::bit_width(cutter.avg) - 1);
+    cutter.strict_mask = top_bits(std::min(bits + 2, 63u));
+    cutter.loose_mask = top_bits(bits - 2);
+    return cutter;
+}
+
+// Length of the chunk at the front of data
+size_t cut_point(std::span<const uint8_t> data, const Cutter &cutter)
+{
+    size_t end = data.size();
+    if (end <= cutter.min) {
+        return end;
+    }
+    end = std::min(end, cutter.max);
+    const size_t normal = std::min(cutter.avg, end);
+
+    uint64_t hash = 0;
+    size_t i = cutter.min;
+    for (; i < normal; ++i) {
+        hash = (hash << 1) + GEAR[data[i]];
+        if ((hash & cutter.strict_mask) == 0) {
+            return i + 1;
+        }
+    }
+    for (; i < end; ++i) {
+        hash = (hash << 1) + GEAR[data[i]];
+        if ((hash & cutter.loose_mask) == 0) {
+            return i + 1;
+        }
+    }
+    return end;
+}
+
+// Raw SHA-256 of some bytes
+std::string sha256(std::span<const uint8_t> data)
+{
+    std::string digest(CryptoPP::SHA256::DIGESTSIZE, '\0');
+    CryptoPP::SHA256().CalculateDigest(
+        reinterpret_cast<CryptoPP::byte *>(digest.data()),
+        data.data(),
+        data.size());
+    return digest;
+}
+
+std::string to_hex(const std::string &bytes)
+{
+    static constexpr char DIGITS[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(bytes.size() * 2);
+    for (unsigned char byte : bytes) {
+        hex += DIGITS[byte >> 4];
+        hex += DIGITS[byte & 0x0f];
+    }
+    return hex;
+}
+
+std::span<const uint8_t> as_bytes(const std::string &data)
+{
+    return {reinterpret_cast<const uint8_t *>(data.data()), data.size()};
+}
+
+FileOperationResult errno_result(int error)
+{
+    return system_error_to_file_operation_result(
+        std::error_code(error, std::generic_category()));
+}
+
+} // namespace
+
+std::vector<size_t> chunk_lengths(std::span<const uint8_t> data,
+                                  const ChunkStoreConfig &config)
+{
+    const Cutter cutter = make_cutter(config);
+    std::vector<size_t> lengths;
+    lengths.reserve(data.size() / cutter.avg + 1);
+    while (!data.empty()) {
+        const size_t length = cut_point(data, cutter);
+        lengths.push_back(length);
+        data = data.subspan(length);
+    }
+    return lengths;
+}
+
+ChunkStore::ChunkStore(const std::string &directory,
+                       const ChunkStoreConfig &config,
+                       const std::string &logger_name)
+    : m_directory(directory), m_config(config),
+      m_cache(std::make_unique<CacheManager>(config.cache, logger_name)),
+      m_logger(get_logger(logger_name))
+{
+    std::error_code ec;
+    fs::create_directories(fs::path(m_directory) / "chunks", ec);
+    if (!ec) {
+        fs::create_directories(fs::path(m_directory) / "manifests", ec);
+    }
+    if (ec) {
+        m_logger->error("could not set up chunk store in {}: {}",
+                        m_directory,
+                        ec.message());
+        return;
+    }
+
+    load();
+    m_open = true;
+}
+
+bool ChunkStore::is_open() const
+{
+    return m_open;
+}
+
+FileOperationResult ChunkStore::put(const std::string &path,
+                                    std::span<const uint8_t> content,
+                                    uint64_t modified_time)
+{
+    if (!m_open) {
+        return FileOperationResult::IO_ERROR;
+    }
+
+    fenris::ChunkManifest manifest;
+    manifest.set_path(path);
+    manifest.set_size(content.size());
+    manifest.set_modified_time(modified_time);
+
+    // Hashing and writing new chunks needs no lock, a chunk's name is its
+    // content so racing writers of the same one write the same bytes
+    size_t offset = 0;
+    for (size_t length : chunk_lengths(content, m_config)) {
+        const auto chunk = content.subspan(offset, length);
+        offset += length;
+
+        auto *ref = manifest.add_chunks();
+        ref->set_hash(sha256(chunk));
+        ref->set_length(static_cast<uint32_t>(length));
+        auto result = write_chunk(ref->hash(), chunk);
+        if (result != FileOperationResult::SUCCESS) {
+            return result;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // A chunk found on disk above may have been deleted since, when the last
+    // file referring to it let go
+    offset = 0;
+    for (const auto &ref : manifest.chunks()) {
+        if (m_chunks.find(ref.hash()) == m_chunks.end()) {
+            auto result =
+                write_chunk(ref.hash(), content.subspan(offset, ref.length()));
+            if (result != FileOperationResult::SUCCESS) {
+                return result;
+            }
+        }
+        offset += ref.length();
+    }
+
+    // Referenced before the old manifest lets go, so chunks both share are
+    // never deleted in between
+    reference(manifest);
+    auto result = write_atomically(manifest_path(path),
+                                   as_bytes(manifest.SerializeAsString()));
+    if (result != FileOperationResult::SUCCESS) {
+        release(manifest);
+        return result;
+    }
+
+    m_logger->debug("stored {} as {} chunks", path, manifest.chunks_size());
+    install(std::move(manifest));
+    return FileOperationResult::SUCCESS;
+}
+
+FileOperationResult ChunkStore::link(const fenris::ChunkManifest &manifest,
+                                     const std::string &path,
+                                     uint64_t modified_time)
+{
+    if (!m_open) {
+        return FileOperationResult::IO_ERROR;
+    }
+
+    fenris::ChunkManifest copy = manifest;
+    copy.set_path(path);
+    copy.set_modified_time(modified_time);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto &ref : copy.chunks()) {
+        if (m_chunks.find(ref.hash()) == m_chunks.end()) {
+            return FileOperationResult::FILE_NOT_FOUND;
+        }
+    }
+
+    reference(copy);
+    auto result = write_atomically(manifest_path(path),
+                                   as_bytes(copy.SerializeAsString()));
+    if (result != FileOperationResult::SUCCESS) {
+        release(copy);
+        return result;
+    }
+    install(std::move(copy));
+    return FileOperationResult::SUCCESS;
+}
+
+std::optional<fenris::ChunkManifest>
+ChunkStore::find(const std::string &path,
+                 uint64_t size,
+                 uint64_t modified_time) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_manifests.find(path);
+    if (it == m_manifests.end() || it->second.size() != size ||
+        it->second.modified_time() != modified_time) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+std::pair<Buffer, FileOperationResult>
+ChunkStore::read(const fenris::ChunkManifest &manifest)
+{
+    return read_range(manifest, 0, manifest.size());
+}
+
+std::pair<Buffer, FileOperationResult>
+ChunkStore::read_range(const fenris::ChunkManifest &manifest,
+                       uint64_t offset,
+                       size_t length)
+{
+    if (offset >= manifest.size()) {
+        return {Buffer(), FileOperationResult::SUCCESS};
+    }
+    length = static_cast<size_t>(
+        std::min<uint64_t>(length, manifest.size() - offset));
+
+    Buffer range;
+    size_t filled = 0;
+    uint64_t chunk_start = 0;
+    for (const auto &ref : manifest.chunks()) {
+        const uint64_t chunk_end = chunk_start + ref.length();
+        if (chunk_end <= offset) {
+            chunk_start = chunk_end;
+            continue;
+        }
+
+        std::optional<CachedFile> chunk =
+            m_cache->read_shared(chunk_path(ref.hash()));
+        if (!chunk.has_value()) {
+            // Released by a put or remove that raced with this read
+            return {Buffer(), FileOperationResult::FILE_NOT_FOUND};
+        }
+        if (chunk->size() != ref.length()) {
+            m_logger->error("chunk {} of {} has {} bytes instead of {}",
+                            to_hex(ref.hash()),
+                            manifest.path(),
+                            chunk->size(),
+                            ref.length());
+            return {Buffer(), FileOperationResult::IO_ERROR};
+        }
+
+        const size_t skip = static_cast<size_t>(offset + filled - chunk_start);
+        const size_t take = std::min(ref.length() - skip, length - filled);
+        if (take == length) {
+            // Entirely inside one chunk, a view of the cached copy will do
+            return {chunk->slice(skip, take), FileOperationResult::SUCCESS};
+        }
+        if (range.empty()) {
+            range = Buffer::allocate(length);
+        }
+        std::copy_n(chunk->data() + skip, take, range.data() + filled);
+        filled += take;
+        if (filled == length) {
+            break;
+        }
+        chunk_start = chunk_end;
+    }
+
+    if (filled != length) {
+        m_logger->error("manifest of {} is shorter than {} bytes",
+                        manifest.path(),
+                        manifest.size());
+        return {Buffer(), FileOperationResult::IO_ERROR};
+    }
+    return {std::move(range), FileOperationResult::SUCCESS};
+}
+
+bool ChunkStore::remove(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_manifests.find(path);
+    if (it == m_manifests.end()) {
+        return false;
+    }
+    erase_manifest(it);
+    return true;
+}
+
+void ChunkStore::remove_prefix(const std::string &directory)
+{
+    const std::string prefix = directory == "/" ? "/" : directory + "/";
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_manifests.lower_bound(prefix);
+    while (it != m_manifests.end() &&
+           it->first.compare(0, prefix.size(), prefix) == 0) {
+        erase_manifest(it++);
+    }
+}
+
+std::vector<fenris::ChunkManifest>
+ChunkStore::find_prefix(const std::string &directory) const
+{
+    const std::string prefix = directory == "/" ? "/" : directory + "/";
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<fenris::ChunkManifest> manifests;
+    for (auto it = m_manifests.lower_bound(prefix);
+         it != m_manifests.end() &&
+         it->first.compare(0, prefix.size(), prefix) == 0;
+         ++it) {
+        manifests.push_back(it->second);
+    }
+    return manifests;
+}
+
+ChunkStoreStats ChunkStore::get_stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ChunkStoreStats stats;
+    stats.files = m_manifests.size();
+    stats.chunks = m_chunks.size();
+    stats.stored_bytes = m_stored_bytes;
+    stats.logical_bytes = m_logical_bytes;
+    return stats;
+}
+
+CacheStats ChunkStore::get_cache_stats() const
+{
+    return m_cache->get_stats();
+}
+
+std::string ChunkStore::chunk_path(const std::string &hash) const
+{
+    const std::string hex = to_hex(hash);
+    return m_directory + "/chunks/" + hex.substr(0, 2) + "/" + hex;
+}
+
+std::string ChunkStore::manifest_path(const std::string &path) const
+{
+    return m_directory + "/manifests/" + to_hex(sha256(as_bytes(path)));
+}
+
+FileOperationResult
+ChunkStore::write_atomically(const std::string &path,
+                             std::span<const uint8_t> data)
+{
+    std::string temp_path;
+    auto [fd, result] = create_temp_file(path, temp_path);
+    if (result != FileOperationResult::SUCCESS) {
+        return result;
+    }
+
+    while (!data.empty()) {
+        const ssize_t written = ::write(fd, data.data(), data.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            result = errno_result(errno);
+            break;
+        }
+        data = data.subspan(static_cast<size_t>(written));
+    }
+    if (result == FileOperationResult::SUCCESS && m_config.sync &&
+        ::fsync(fd) != 0) {
+        result = errno_result(errno);
+    }
+    if (::close(fd) != 0 && result == FileOperationResult::SUCCESS) {
+        result = FileOperationResult::IO_ERROR;
+    }
+    if (result == FileOperationResult::SUCCESS &&
+        ::rename(temp_path.c_str(), path.c_str()) != 0) {
+        result = errno_result(errno);
+    }
+    if (result != FileOperationResult::SUCCESS) {
+        ::unlink(temp_path.c_str());
+    }
+    return result;
+}
+
+FileOperationResult ChunkStore::write_chunk(const std::string &hash,
+                                            std::span<const uint8_t> data)
+{
+    const std::string path = chunk_path(hash);
+    if (::access(path.c_str(), F_OK) == 0) {
+        return FileOperationResult::SUCCESS;
+    }
+
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+    if (ec) {
+        return system_error_to_file_operation_result(ec);
+    }
+    return write_atomically(path, data);
+}
+
+void ChunkStore::reference(const fenris::ChunkManifest &manifest)
+{
+    for (const auto &ref : manifest.chunks()) {
+        ChunkEntry &entry = m_chunks[ref.hash()];
+        if (entry.references++ == 0) {
+            entry.length = ref.length();
+            m_stored_bytes += ref.length();
+        }
+    }
+}
+
+void ChunkStore::release(const fenris::ChunkManifest &manifest)
+{
+    for (const auto &ref : manifest.chunks()) {
+        auto it = m_chunks.find(ref.hash());
+        if (it == m_chunks.end() || --it->second.references != 0) {
+            continue;
+        }
+
+        const std::string path = chunk_path(ref.hash());
+        ::unlink(path.c_str());
+        m_cache->invalidate(path);
+        m_stored_bytes -= it->second.length;
+        m_chunks.erase(it);
+    }
+}
+
+void ChunkStore::install(fenris::ChunkManifest manifest)
+{
+    auto it = m_manifests.find(manifest.path());
+    if (it != m_manifests.end()) {
+        m_logical_bytes -= it->second.size();
+        release(it->second);
+        it->second = std::move(manifest);
+    } else {
+        const std::string path = manifest.path();
+        it = m_manifests.emplace(path, std::move(manifest)).first;
+    }
+    m_logical_bytes += it->second.size();
+}
+
+void ChunkStore::erase_manifest(
+    std::map<std::string, fenris::ChunkManifest>::iterator it)
+{
+    ::unlink(manifest_path(it->first).c_str());
+    m_logical_bytes -= it->second.size();
+    release(it->second);
+    m_manifests.erase(it);
+}
+
+void ChunkStore::load()
+{
+    std::error_code ec;
+    for (const auto &entry :
+         fs::directory_iterator(fs::path(m_directory) / "manifests", ec)) {
+        std::ifstream file(entry.path(), std::ios::binary);
+        fenris::ChunkManifest manifest;
+        if (entry.path().filename().string().front() == '.' ||
+            !manifest.ParseFromIstream(&file)) {
+            // Temporary files of interrupted writes, or damaged manifests
+            m_logger->warn("dropping unreadable manifest {}",
+                           entry.path().string());
+            fs::remove(entry.path(), ec);
+            continue;
+        }
+        reference(manifest);
+        m_logical_bytes += manifest.size();
+        std::string path = manifest.path();
+        m_manifests.emplace(std::move(path), std::move(manifest));
+    }
+
+    // Chunks without a manifest were written by a put that did not finish
+    std::unordered_set<std::string> live;
+    live.reserve(m_chunks.size());
+    for (const auto &[hash, chunk] : m_chunks) {
+        live.insert(to_hex(hash));
+    }
+    size_t orphans = 0;
+    for (const auto &entry : fs::recursive_directory_iterator(
+             fs::path(m_directory) / "chunks", ec)) {
+        if (entry.is_regular_file(ec) &&
+            live.count(entry.path().filename().string()) == 0) {
+            fs::remove(entry.path(), ec);
+            ++orphans;
+        }
+    }
+
+    m_logger->info("chunk store {} holds {} files in {} chunks, {} orphaned "
+                   "chunks removed",
+                   m_directory,
+                   m_manifests.size(),
+                   m_chunks.size(),
+                   orphans);
+}
+
+} // namespace server
+} // namespace fenris
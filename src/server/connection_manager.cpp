@@ -1,20 +1,30 @@
 #include "server/connection_manager.hpp"
+#include "common/file_operations.hpp"
+#include "common/handshake.hpp"
 #include "common/logging.hpp"
+#include "common/metrics.hpp"
 #include "common/network_utils.hpp"
 #include "common/request.hpp"
 #include "common/response.hpp"
+#include "common/session_resumption.hpp"
 #include "fenris.pb.h"
+#include "server/reactor.hpp"
 #include "server/request_manager.hpp"
 #include "server/server.hpp"
 
 #include <algorithm>
 #include <arpa/inet.h>
+#include <cerrno>
 #include <cstring>
+#include <deque>
 #include <fcntl.h>
 #include <iostream>
 #include <netdb.h>
+#include <span>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <thread>
 #include <unistd.h>
 
 namespace fenris {
@@ -24,6 +34,120 @@ using namespace common;
 using namespace common::network;
 using namespace common::crypto;
 
+namespace {
+
+// Read one chunk of a file and seal it in the buffer it was read into
+std::optional<Buffer> seal_file_chunk(const ChunkedAead &aead,
+                                      int file_fd,
+                                      uint64_t offset,
+                                      size_t size,
+                                      uint64_t index,
+                                      bool last)
+{
+    Buffer chunk = Buffer::allocate(size + AES_GCM_TAG_SIZE);
+    std::span<uint8_t> plaintext = chunk.mutable_span().first(size);
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(file_fd,
+                          plaintext.data() + done,
+                          size - done,
+                          static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return std::nullopt;
+        }
+        done += static_cast<size_t>(n);
+    }
+
+    if (aead.seal(index, last, chunk.mutable_span()) !=
+        EncryptionResult::SUCCESS) {
+        return std::nullopt;
+    }
+    return chunk;
+}
+
+// Reason a sub-request may not run inside a batch, empty if it may
+std::string batch_refusal(const fenris::Request &request, bool parallel)
+{
+    switch (request.command()) {
+    case fenris::RequestType::BATCH:
+        return "batches cannot be nested";
+    case fenris::RequestType::REKEY:
+    case fenris::RequestType::TERMINATE:
+        return "request cannot be batched";
+    case fenris::RequestType::CHANGE_DIR:
+        return parallel ? "cannot change directory in a parallel batch" : "";
+    default:
+        return "";
+    }
+}
+
+// Numeric address of an accepted peer, IPv4 or IPv6
+std::string peer_address(const struct sockaddr_storage &address)
+{
+    char text[INET6_ADDRSTRLEN] = {};
+    const void *raw =
+        address.ss_family == AF_INET6
+            ? static_cast<const void *>(
+                  &reinterpret_cast<const sockaddr_in6 &>(address).sin6_addr)
+            : static_cast<const void *>(
+                  &reinterpret_cast<const sockaddr_in &>(address).sin_addr);
+    if (inet_ntop(address.ss_family, raw, text, sizeof(text)) == nullptr) {
+        return "unknown";
+    }
+    return text;
+}
+
+fenris::Response batch_error(const std::string &message)
+{
+    fenris::Response response;
+    response.set_type(fenris::ResponseType::ERROR);
+    response.set_success(false);
+    response.set_error_message(message);
+    return response;
+}
+
+/**
+ * Metrics shared by every ConnectionManager in the process
+ */
+struct ConnectionMetrics {
+    Counter &accepted;
+    Gauge &active;
+    Histogram &full_handshakes;
+    Histogram &resumed_handshakes;
+    Counter &bytes_received;
+    Counter &bytes_sent;
+};
+
+ConnectionMetrics &metrics()
+{
+    static ConnectionMetrics metrics = [] {
+        MetricsRegistry &registry = MetricsRegistry::global();
+        const std::string handshake_help =
+            "Time spent keying a connection, waiting for the client excluded";
+        return ConnectionMetrics{
+            registry.counter("fenris_connections_accepted_total",
+                             "Connections accepted"),
+            registry.gauge("fenris_connections_active",
+                           "Connections currently open"),
+            registry.histogram(
+                "fenris_handshake_seconds", handshake_help, {{"kind", "full"}}),
+            registry.histogram("fenris_handshake_seconds",
+                               handshake_help,
+                               {{"kind", "resumed"}}),
+            registry.counter("fenris_received_bytes_total",
+                             "Encrypted request bytes received"),
+            registry.counter("fenris_sent_bytes_total",
+                             "Encrypted response and file stream bytes sent"),
+        };
+    }();
+    return metrics;
+}
+
+} // namespace
+
 ConnectionManager::ConnectionManager(const std::string &hostname,
                                      const std::string &port,
                                      const std::string &logger_name)
@@ -43,6 +167,121 @@ void ConnectionManager::set_non_blocking_mode(bool enabled)
     m_non_blocking_mode = enabled;
 }
 
+void ConnectionManager::set_reactor_mode(bool enabled)
+{
+    m_reactor_mode = enabled;
+}
+
+void ConnectionManager::set_plaintext_file_streaming(bool enabled)
+{
+    m_plaintext_file_streaming = enabled;
+}
+
+void ConnectionManager::set_sealed_file_streaming(bool enabled,
+                                                  size_t chunk_size)
+{
+    m_sealed_file_streaming = enabled;
+    m_sealed_chunk_size = std::max<size_t>(chunk_size, 1);
+}
+
+void ConnectionManager::set_session_tickets(bool enabled,
+                                            std::chrono::seconds lifetime)
+{
+    m_ticket_keeper =
+        enabled ? std::make_unique<TicketKeeper>(lifetime) : nullptr;
+}
+
+void ConnectionManager::set_compression(
+    bool enabled, const compress::WireCompressionConfig &config)
+{
+    m_compression = enabled;
+    m_compression_config = config;
+}
+
+void ConnectionManager::set_io_threads(size_t count)
+{
+    m_io_threads = count;
+}
+
+void ConnectionManager::set_worker_threads(size_t count)
+{
+    m_worker_threads = count;
+}
+
+void ConnectionManager::set_listen_backlog(int backlog)
+{
+    m_listen_backlog = std::max(1, backlog);
+}
+
+void ConnectionManager::set_reuse_port(bool enabled)
+{
+    m_reuse_port = enabled;
+}
+
+void ConnectionManager::set_cpu_affinity(bool enabled)
+{
+    m_cpu_affinity = enabled;
+}
+
+void ConnectionManager::set_acceptors(size_t count)
+{
+    m_acceptors = count;
+}
+
+void ConnectionManager::set_max_message_size(size_t bytes)
+{
+    m_max_message_size = bytes;
+}
+
+void ConnectionManager::set_memory_budget(size_t bytes)
+{
+    m_memory_budget_bytes = bytes;
+}
+
+MemoryBudgetStats ConnectionManager::get_memory_budget_stats() const
+{
+    return m_memory_budget ? m_memory_budget->get_stats()
+                           : MemoryBudgetStats{};
+}
+
+void ConnectionManager::set_rate_limits(const RateLimit &per_client,
+                                        const RateLimit &per_tenant)
+{
+    m_client_limit = per_client;
+    m_tenant_limit = per_tenant;
+}
+
+std::unordered_map<uint32_t, ThrottleStats>
+ConnectionManager::get_throttle_stats()
+{
+    return m_rate_limiter ? m_rate_limiter->get_stats()
+                          : std::unordered_map<uint32_t, ThrottleStats>{};
+}
+
+std::unordered_map<std::string, ThrottleStats>
+ConnectionManager::get_tenant_throttle_stats()
+{
+    return m_rate_limiter ? m_rate_limiter->get_tenant_stats()
+                          : std::unordered_map<std::string, ThrottleStats>{};
+}
+
+void ConnectionManager::set_pipelining(bool enabled)
+{
+    m_pipelining = enabled;
+}
+
+void ConnectionManager::set_read_leases(bool enabled,
+                                        std::chrono::milliseconds duration)
+{
+    m_read_lease = enabled ? std::max(duration, std::chrono::milliseconds(1))
+                           : std::chrono::milliseconds(0);
+}
+
+void ConnectionManager::set_keypair_pool_size(size_t count)
+{
+    m_keypair_pool_size = count;
+}
+
 void ConnectionManager::start()
 {
     if (m_running) {
@@ -56,6 +295,10 @@ void ConnectionManager::start()
         return;
     }
 
+    const size_t cores =
+        std::max<unsigned int>(1, std::thread::hardware_concurrency());
+    const size_t acceptors = m_acceptors != 0 ? m_acceptors : cores;
+
     struct addrinfo hints, *servinfo, *p;
     int rv;
 
@@ -70,65 +313,93 @@ void ConnectionManager::start()
         return;
     }
 
+    int listen_socket = -1;
     for (p = servinfo; p != nullptr; p = p->ai_next) {
-        m_server_socket = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-        if (m_server_socket == -1) {
-            m_logger->error("server: socket creation failed: {}",
-                            strerror(errno));
-            continue;
-        }
-
-        int rc, yes = 1;
-        rc = setsockopt(m_server_socket,
-                        SOL_SOCKET,
-                        SO_REUSEADDR,
-                        &yes,
-                        sizeof(int));
-        if (rc == -1) {
-            m_logger->error("setsockopt failed: {}", strerror(errno));
-            close(m_server_socket);
-            freeaddrinfo(servinfo);
-            return;
-        }
-
-        rc = bind(m_server_socket, p->ai_addr, p->ai_addrlen);
-        if (rc == -1) {
-            close(m_server_socket);
-            m_logger->error("server: bind failed: {}", strerror(errno));
-            continue;
+        listen_socket = open_listener(p, acceptors > 1);
+        if (listen_socket != -1) {
+            break;
         }
-
-        break;
     }
 
-    freeaddrinfo(servinfo);
-
     if (p == nullptr) {
+        freeaddrinfo(servinfo);
         m_logger->error("server: failed to bind");
         return;
     }
+    m_listen_sockets.push_back(listen_socket);
+
+    // The others join the first one's group. Its bound address is used so
+    // they land on the same port when the kernel picked it.
+    struct sockaddr_storage bound {};
+    socklen_t bound_length = sizeof(bound);
+    getsockname(listen_socket, (struct sockaddr *)&bound, &bound_length);
+    struct addrinfo bound_info = *p;
+    bound_info.ai_addr = (struct sockaddr *)&bound;
+    bound_info.ai_addrlen = bound_length;
+    while (m_listen_sockets.size() < acceptors) {
+        listen_socket = open_listener(&bound_info, true);
+        if (listen_socket == -1) {
+            break;
+        }
+        m_listen_sockets.push_back(listen_socket);
+    }
+    freeaddrinfo(servinfo);
 
-    // Listen for incoming connections
-    if (listen(m_server_socket, 10) == -1) {
-        m_logger->error("listen failed: {}", strerror(errno));
-        close(m_server_socket);
-        m_server_socket = -1;
+    if (m_listen_sockets.size() < acceptors) {
+        m_logger->error("could only open {} of {} listening sockets",
+                        m_listen_sockets.size(),
+                        acceptors);
+        close_listeners();
         return;
     }
 
-    // Set socket to non-blocking mode if requested (for testing)
-    if (m_non_blocking_mode) {
-        int flags = fcntl(m_server_socket, F_GETFL);
-        fcntl(m_server_socket, F_SETFL, flags | O_NONBLOCK);
+    if (m_memory_budget_bytes != 0) {
+        m_memory_budget = std::make_unique<MemoryBudget>(m_memory_budget_bytes);
+    }
+    if (m_client_limit.limited() || m_tenant_limit.limited()) {
+        m_rate_limiter =
+            std::make_unique<RateLimiter>(m_client_limit, m_tenant_limit);
+    }
+    m_thread_pool = std::make_unique<ThreadPool>(m_worker_threads);
+    if (m_cpu_affinity) {
+        m_thread_pool->pin_to_cores();
+    }
+    m_keypair_pool = std::make_unique<KeyPairPool>(m_keypair_pool_size);
+    m_keypair_pool->start();
+
+    if (m_reactor_mode) {
+        m_reactor = std::make_unique<Reactor>(
+            *this, m_io_threads != 0 ? m_io_threads : cores, *m_thread_pool);
+        if (!m_reactor->start()) {
+            m_logger->error("failed to start reactor");
+            m_reactor.reset();
+            m_thread_pool.reset();
+            m_keypair_pool.reset();
+            close_listeners();
+            return;
+        }
+        if (m_cpu_affinity) {
+            m_reactor->pin_to_cores();
+        }
     }
 
     m_running = true;
-    m_listen_thread =
-        std::thread(&ConnectionManager::listen_for_connection, this);
+    for (size_t i = 0; i < m_listen_sockets.size(); ++i) {
+        m_listen_threads.emplace_back(
+            &ConnectionManager::listen_for_connection, this, i);
+        if (m_cpu_affinity) {
+            pin_thread_to_core(m_listen_threads.back(), i);
+        }
+    }
 
     m_logger->info("connection manager started on {}:{}", m_hostname, m_port);
 }
 
+bool ConnectionManager::is_running() const
+{
+    return m_running;
+}
+
 void ConnectionManager::stop()
 {
     if (!m_running) {
@@ -136,63 +407,100 @@ void ConnectionManager::stop()
     }
 
     m_running = false;
+    stop_accepting();
 
-    if (m_server_socket != -1) {
-
-        int wake_socket = socket(AF_INET, SOCK_STREAM, 0);
-        if (wake_socket >= 0) {
-            struct sockaddr_in server_addr;
-            server_addr.sin_family = AF_INET;
-
-            try {
-                server_addr.sin_port = htons(std::stoi(m_port));
-            } catch (const std::invalid_argument &e) {
-                m_logger->error("invalid port number: {}. error: {}",
-                                m_port,
-                                e.what());
-                return;
-            } catch (const std::out_of_range &e) {
-                m_logger->error("port number out of range: {}. error: {}",
-                                m_port,
-                                e.what());
-                return;
-            }
+    // The reactor owns its sockets, shut it down before touching the rest
+    if (m_reactor) {
+        m_reactor->stop();
+        m_reactor.reset();
+    }
+
+    // Nor does it wake one waiting for its share of the memory budget
+    if (m_memory_budget) {
+        m_memory_budget->close();
+    }
 
-            inet_pton(AF_INET, m_hostname.c_str(), &server_addr.sin_addr);
+    {
+        std::lock_guard<std::mutex> lock(m_client_mutex);
 
-            // Connect to ourselves to unblock accept()
-            connect(wake_socket,
-                    (struct sockaddr *)&server_addr,
-                    sizeof(server_addr));
-            close(wake_socket);
-            m_logger->debug("wakeup socket closed");
+        // Wakes threads blocked on their socket, each closes its own once
+        // it removed itself, so a descriptor in the map is always open
+        for (auto &pair : m_client_sockets) {
+            shutdown(pair.second, SHUT_RDWR);
         }
     }
 
-    if (m_server_socket != -1) {
-        close(m_server_socket);
-        m_server_socket = -1;
+    // The threads exit side by side, joining them waits for the slowest
+    for (auto &[client_id, thread] : m_client_threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
     }
+    m_client_threads.clear();
+    m_finished_clients.clear();
+
+    // Every producer is gone, let the workers finish what is still queued
+    m_thread_pool.reset();
+    m_keypair_pool.reset();
+    m_memory_budget.reset();
+    m_rate_limiter.reset();
+    m_draining = false;
+
+    m_logger->info("connection manager stopped");
+}
 
-    if (m_listen_thread.joinable()) {
-        m_listen_thread.join();
+bool ConnectionManager::drain(std::chrono::milliseconds deadline)
+{
+    if (!m_running) {
+        return true;
     }
 
-    std::lock_guard<std::mutex> lock(m_client_mutex);
+    m_draining = true;
+    stop_accepting();
+    if (m_reactor) {
+        m_reactor->drain();
+    }
 
+    // A connection waiting for its next request reads end of file at once,
+    // one with a request in flight once it answered it. Responses still go
+    // out on the open write side.
+    std::unique_lock<std::mutex> lock(m_client_mutex);
+    const size_t draining = m_client_sockets.size();
     for (auto &pair : m_client_sockets) {
-        close(pair.second);
+        shutdown(pair.second, SHUT_RD);
     }
-    m_client_sockets.clear();
+    const bool drained = m_client_removed.wait_for(
+        lock, deadline, [this] { return m_client_sockets.empty(); });
+    const size_t remaining = m_client_sockets.size();
+    lock.unlock();
+
+    if (drained) {
+        m_logger->info("drained {} connections", draining);
+    } else {
+        m_logger->warn("{} of {} connections still busy after {} ms",
+                       remaining,
+                       draining,
+                       deadline.count());
+    }
+    stop();
+    return drained;
+}
 
-    for (auto &thread : m_client_threads) {
+void ConnectionManager::stop_accepting()
+{
+    // Shutting a listening socket down wakes the thread blocked in accept()
+    // on it. A connection to ourselves would only reach one socket of a
+    // SO_REUSEPORT group.
+    for (int listen_socket : m_listen_sockets) {
+        shutdown(listen_socket, SHUT_RDWR);
+    }
+    for (auto &thread : m_listen_threads) {
         if (thread.joinable()) {
             thread.join();
         }
     }
-    m_client_threads.clear();
-
-    m_logger->info("connection manager stopped");
+    m_listen_threads.clear();
+    close_listeners();
 }
 
 void ConnectionManager::set_client_handler(
@@ -207,17 +515,21 @@ size_t ConnectionManager::get_active_client_count() const
     return m_client_sockets.size();
 }
 
-void ConnectionManager::listen_for_connection()
+void ConnectionManager::listen_for_connection(size_t index)
 {
+    const int listen_socket = m_listen_sockets[index];
     struct sockaddr_storage client_addr;
     socklen_t sin_size = sizeof(client_addr);
 
-    while (m_running) {
+    while (m_running && !m_draining) {
 
         int client_fd =
-            accept(m_server_socket, (struct sockaddr *)&client_addr, &sin_size);
+            accept(listen_socket, (struct sockaddr *)&client_addr, &sin_size);
 
-        if (!m_running) {
+        if (!m_running || m_draining) {
+            if (client_fd != -1) {
+                close(client_fd);
+            }
             break;
         }
 
@@ -232,14 +544,13 @@ void ConnectionManager::listen_for_connection()
             m_logger->error("accept failed: {}", strerror(errno));
             continue;
         }
+        metrics().accepted.add();
 
-        // Get client information for logging
-        char client_ip[INET6_ADDRSTRLEN];
-        inet_ntop(client_addr.ss_family,
-                  &(((struct sockaddr_in *)&client_addr)->sin_addr),
-                  client_ip,
-                  sizeof client_ip);
-        m_logger->info("server: got connection from {}", client_ip);
+        // Names the client in logs and its tenant for rate limits
+        std::string client_ip = peer_address(client_addr);
+        FENRIS_LOG_INFO_SAMPLED(m_logger,
+                                "server: got connection from {}",
+                                client_ip);
 
         uint32_t client_id = generate_client_id();
 
@@ -247,52 +558,305 @@ void ConnectionManager::listen_for_connection()
             std::lock_guard<std::mutex> lock(m_client_mutex);
             m_client_sockets[client_id] = client_fd;
         }
+        metrics().active.add();
+
+        // Each acceptor feeds the loop, or pins the threads, of its own core
+        // so a connection stays where the kernel delivered it
+        if (m_reactor) {
+            std::optional<size_t> loop;
+            if (m_listen_sockets.size() > 1) {
+                loop = index;
+            }
+            if (!m_reactor->add_connection(
+                    client_fd, client_id, client_ip, loop)) {
+                m_logger->error("reactor rejected client: {}", client_id);
+                remove_client(client_id);
+                close(client_fd);
+            }
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(m_client_mutex);
+        reap_client_threads();
+        // The thread reports back under the lock, so only after it was added
+        std::thread &thread = m_client_threads[client_id];
+        thread = std::thread(
+            [this, client_fd, client_id, ip = std::move(client_ip)]() mutable {
+                handle_client(client_fd, client_id, std::move(ip));
+                std::lock_guard<std::mutex> lock(m_client_mutex);
+                m_finished_clients.push_back(client_id);
+            });
+        if (m_cpu_affinity && m_listen_sockets.size() > 1) {
+            pin_thread_to_core(thread, index);
+        }
+    }
+}
+
+void ConnectionManager::reap_client_threads()
+{
+    // Each of them is past its last use of the lock, so joining is short
+    for (uint32_t client_id : m_finished_clients) {
+        auto it = m_client_threads.find(client_id);
+        if (it != m_client_threads.end()) {
+            it->second.join();
+            m_client_threads.erase(it);
+        }
+    }
+    m_finished_clients.clear();
+}
+
+int ConnectionManager::open_listener(const struct addrinfo *address,
+                                     bool reuse_port)
+{
+    int listen_socket = socket(
+        address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (listen_socket == -1) {
+        m_logger->error("server: socket creation failed: {}", strerror(errno));
+        return -1;
+    }
+
+    int yes = 1;
+    if (setsockopt(
+            listen_socket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int)) == -1) {
+        m_logger->error("setsockopt failed: {}", strerror(errno));
+        close(listen_socket);
+        return -1;
+    }
+
+    if ((reuse_port || m_reuse_port) &&
+        setsockopt(
+            listen_socket, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int)) == -1) {
+        m_logger->error("setsockopt SO_REUSEPORT failed: {}", strerror(errno));
+        close(listen_socket);
+        return -1;
+    }
+
+    if (bind(listen_socket, address->ai_addr, address->ai_addrlen) == -1) {
+        m_logger->error("server: bind failed: {}", strerror(errno));
+        close(listen_socket);
+        return -1;
+    }
+
+    if (listen(listen_socket, m_listen_backlog) == -1) {
+        m_logger->error("listen failed: {}", strerror(errno));
+        close(listen_socket);
+        return -1;
+    }
+
+    // Set socket to non-blocking mode if requested (for testing)
+    if (m_non_blocking_mode) {
+        int flags = fcntl(listen_socket, F_GETFL);
+        fcntl(listen_socket, F_SETFL, flags | O_NONBLOCK);
+    }
+
+    return listen_socket;
+}
 
-        m_client_threads.emplace_back(&ConnectionManager::handle_client,
-                                      this,
-                                      client_fd,
-                                      client_id);
+void ConnectionManager::close_listeners()
+{
+    for (int listen_socket : m_listen_sockets) {
+        close(listen_socket);
     }
+    m_listen_sockets.clear();
 }
 
 bool ConnectionManager::perform_key_exchange(ClientInfo &client_info)
 {
-    auto [private_key, public_key, keygen_result] =
-        m_crypto_manager.generate_ecdh_keypair();
-    if (keygen_result != ECDHResult::SUCCESS) {
-        m_logger->error("failed to generate ECDH key pair: {}",
-                        ecdh_result_to_string(keygen_result));
-        return false;
+    // A refused resumption leaves the connection unkeyed, the client follows
+    // up with a full key exchange
+    while (!client_info.session) {
+        // Receive client's public key
+        std::vector<uint8_t> client_public_key;
+        NetworkResult recv_result =
+            receive_prefixed_data(client_info.socket,
+                                  client_public_key,
+                                  m_non_blocking_mode,
+                                  NO_TIMEOUT,
+                                  MAX_HANDSHAKE_FRAME_SIZE);
+        if (recv_result != NetworkResult::SUCCESS) {
+            m_logger->error("failed to receive client public key: {}",
+                            network_result_to_string(recv_result));
+            return false;
+        }
+
+        auto public_key =
+            complete_key_exchange(client_info, client_public_key);
+        if (!public_key.has_value()) {
+            return false;
+        }
+
+        // Send public key to client
+        NetworkResult send_result = send_prefixed_data(client_info.socket,
+                                                       *public_key,
+                                                       m_non_blocking_mode);
+        if (send_result != NetworkResult::SUCCESS) {
+            m_logger->error("failed to send public key: {}",
+                            network_result_to_string(send_result));
+            return false;
+        }
     }
 
-    // Receive client's public key
-    std::vector<uint8_t> server_public_key;
-    NetworkResult recv_result = receive_prefixed_data(client_info.socket,
-                                                      server_public_key,
-                                                      m_non_blocking_mode);
-    if (recv_result != NetworkResult::SUCCESS) {
-        m_logger->error("failed to receive client public key: {}",
-                        network_result_to_string(recv_result));
-        return false;
+    return true;
+}
+
+std::optional<std::vector<uint8_t>> ConnectionManager::complete_key_exchange(
+    ClientInfo &client_info,
+    std::span<const uint8_t> client_frame)
+{
+    auto key_exchange = decode_key_exchange(client_frame);
+    if (!key_exchange.has_value()) {
+        m_logger->error("malformed handshake from client: {}",
+                        client_info.client_id);
+        return std::nullopt;
+    }
+    ScopedTimer timer(key_exchange->resumption
+                          ? metrics().resumed_handshakes
+                          : metrics().full_handshakes);
+    if (key_exchange->resumption) {
+        return resume_session(client_info, *key_exchange->handshake);
     }
 
-    // Send public key to client
-    NetworkResult send_result =
-        send_prefixed_data(client_info.socket, public_key, m_non_blocking_mode);
-    if (send_result != NetworkResult::SUCCESS) {
-        m_logger->error("failed to send public key: {}",
-                        network_result_to_string(send_result));
-        return false;
+    auto agreement = agree_on_key(key_exchange->public_key);
+    if (!agreement.has_value()) {
+        return std::nullopt;
+    }
+
+    // Clients that sent a bare key get a bare key back
+    std::optional<fenris::Handshake> reply;
+    if (key_exchange->handshake.has_value()) {
+        reply = negotiate_capabilities(client_info, *key_exchange->handshake);
+        attach_ticket(client_info, agreement->second, *reply);
+    }
+
+    if (!install_key(client_info, std::move(agreement->second), 0)) {
+        return std::nullopt;
+    }
+    return encode_key_exchange(agreement->first, reply);
+}
+
+fenris::Handshake
+ConnectionManager::negotiate_capabilities(ClientInfo &client_info,
+                                          const fenris::Handshake &offer)
+{
+    fenris::Handshake reply;
+    client_info.capabilities = offer.capabilities() & supported_capabilities();
+    reply.set_capabilities(client_info.capabilities);
+    client_info.compression.reset();
+    if (has_capability(client_info.capabilities,
+                       fenris::CAPABILITY_COMPRESSION)) {
+        const uint32_t codecs = compress::negotiate_codecs(
+            offer.codecs(), m_compression_config.codecs);
+        reply.set_codecs(codecs);
+        // A compressed request must not expand past what is accepted
+        // uncompressed
+        compress::WireCompressionConfig config = m_compression_config;
+        config.max_message_size =
+            std::min(config.max_message_size, m_max_message_size);
+        client_info.compression =
+            std::make_shared<compress::WireCompression>(config, codecs);
+    }
+    FENRIS_LOG_DEBUG(m_logger,
+                     "client {} negotiated capabilities {:#x}",
+                     client_info.client_id,
+                     client_info.capabilities);
+    return reply;
+}
+
+std::optional<std::vector<uint8_t>>
+ConnectionManager::resume_session(ClientInfo &client_info,
+                                  const fenris::Handshake &offer)
+{
+    const auto &client_nonce = offer.resumption_nonce();
+    std::optional<std::vector<uint8_t>> secret;
+    if (m_ticket_keeper && client_nonce.size() == RESUMPTION_NONCE_SIZE) {
+        const auto *ticket =
+            reinterpret_cast<const uint8_t *>(offer.ticket().data());
+        secret = m_ticket_keeper->redeem({ticket, offer.ticket().size()});
+    }
+    // The empty reply tells the client to start over with its public key
+    if (!secret.has_value()) {
+        FENRIS_LOG_DEBUG(m_logger,
+                         "refused session ticket from client {}",
+                         client_info.client_id);
+        return encode_resumption(fenris::Handshake());
+    }
+
+    auto [server_nonce, nonce_result] =
+        m_crypto_manager.generate_random_bytes(RESUMPTION_NONCE_SIZE);
+    if (nonce_result != EncryptionResult::SUCCESS) {
+        m_logger->error("failed to generate resumption nonce: {}",
+                        encryption_result_to_string(nonce_result));
+        return std::nullopt;
+    }
+    auto [key, key_result] = derive_resumed_key(
+        *secret,
+        {reinterpret_cast<const uint8_t *>(client_nonce.data()),
+         client_nonce.size()},
+        server_nonce);
+    if (key_result != ECDHResult::SUCCESS) {
+        m_logger->error("failed to derive resumed key: {}",
+                        ecdh_result_to_string(key_result));
+        return std::nullopt;
+    }
+
+    fenris::Handshake reply = negotiate_capabilities(client_info, offer);
+    reply.set_resumption_nonce(server_nonce.data(), server_nonce.size());
+    attach_ticket(client_info, key, reply);
+
+    if (!install_key(client_info, std::move(key), 0)) {
+        return std::nullopt;
+    }
+    FENRIS_LOG_DEBUG(m_logger,
+                     "resumed session of client {}",
+                     client_info.client_id);
+    return encode_resumption(reply);
+}
+
+void ConnectionManager::attach_ticket(const ClientInfo &client_info,
+                                      const std::vector<uint8_t> &session_key,
+                                      fenris::Handshake &reply) const
+{
+    if (!m_ticket_keeper ||
+        !has_capability(client_info.capabilities,
+                        fenris::CAPABILITY_SESSION_TICKET)) {
+        return;
+    }
+
+    auto [secret, secret_result] = derive_resumption_secret(session_key);
+    std::optional<std::vector<uint8_t>> ticket;
+    if (secret_result == ECDHResult::SUCCESS) {
+        ticket = m_ticket_keeper->issue(secret);
+    }
+    if (!ticket.has_value()) {
+        // The session works without one, the next connect just costs more
+        m_logger->warn("failed to issue session ticket to client {}",
+                       client_info.client_id);
+        return;
+    }
+    reply.set_ticket(ticket->data(), ticket->size());
+}
+
+std::optional<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>
+ConnectionManager::agree_on_key(const std::vector<uint8_t> &peer_public_key)
+{
+    // Key pairs come pregenerated, only the shared secret is left to do here
+    auto [private_key, public_key, keygen_result] =
+        m_keypair_pool ? m_keypair_pool->take()
+                       : m_crypto_manager.generate_ecdh_keypair();
+    if (keygen_result != ECDHResult::SUCCESS) {
+        m_logger->error("failed to generate ECDH key pair: {}",
+                        ecdh_result_to_string(keygen_result));
+        return std::nullopt;
     }
 
     // Compute shared secret
     auto [shared_secret, ss_result] =
         m_crypto_manager.compute_ecdh_shared_secret(private_key,
-                                                    server_public_key);
+                                                    peer_public_key);
     if (ss_result != ECDHResult::SUCCESS) {
         m_logger->error("failed to compute ECDH shared secret: {}",
                         ecdh_result_to_string(ss_result));
-        return false;
+        return std::nullopt;
     }
 
     // Derive encryption key from shared secret
@@ -302,20 +866,117 @@ bool ConnectionManager::perform_key_exchange(ClientInfo &client_info)
     if (key_derive_result != ECDHResult::SUCCESS) {
         m_logger->error("failed to derive encryption key: {}",
                         ecdh_result_to_string(key_derive_result));
-        return false;
+        return std::nullopt;
     }
 
-    client_info.encryption_key = std::move(derived_key);
+    return std::make_pair(std::move(public_key), std::move(derived_key));
+}
+
+bool ConnectionManager::install_key(ClientInfo &client_info,
+                                    std::vector<uint8_t> key,
+                                    uint32_t epoch)
+{
+    auto session = std::make_shared<CryptoSession>();
+    EncryptionResult key_result = session->set_key(key);
+    if (key_result != EncryptionResult::SUCCESS) {
+        m_logger->error("failed to key session: {}",
+                        encryption_result_to_string(key_result));
+        return false;
+    }
+    client_info.encryption_key = std::move(key);
+    client_info.session = std::move(session);
+
+    if (has_capability(client_info.capabilities,
+                       fenris::CAPABILITY_SEQUENCED_NONCES)) {
+        client_info.send_nonces = std::make_shared<NonceSequence>(
+            NonceDirection::SERVER_TO_CLIENT, epoch);
+        client_info.receive_nonces = std::make_shared<NonceSequence>(
+            NonceDirection::CLIENT_TO_SERVER, epoch);
+    }
     return true;
 }
 
+bool ConnectionManager::is_rekey(const ClientInfo &client_info,
+                                 const fenris::Request &request)
+{
+    return request.command() == fenris::RequestType::REKEY &&
+           client_info.receive_nonces != nullptr;
+}
+
+std::optional<EncryptedMessage>
+ConnectionManager::rekey(ClientInfo &client_info,
+                         const fenris::Request &request)
+{
+    const uint32_t epoch = client_info.receive_nonces->epoch() + 1;
+    if (epoch > MAX_NONCE_EPOCH) {
+        m_logger->error("client {} ran out of key epochs",
+                        client_info.client_id);
+        return std::nullopt;
+    }
+
+    const std::vector<uint8_t> client_public_key(request.data().begin(),
+                                                 request.data().end());
+    auto agreement = agree_on_key(client_public_key);
+    if (!agreement.has_value()) {
+        return std::nullopt;
+    }
+
+    // The answer still goes out under the old key, the client switches
+    // once it has read it
+    fenris::Response response;
+    response.set_type(fenris::ResponseType::REKEYED);
+    response.set_success(true);
+    response.set_request_id(request.request_id());
+    response.set_data(agreement->first.data(), agreement->first.size());
+    auto message = encrypt_response(client_info, response);
+    if (!message.has_value() ||
+        !install_key(client_info, std::move(agreement->second), epoch)) {
+        return std::nullopt;
+    }
+
+    FENRIS_LOG_DEBUG(m_logger,
+                     "client {} rekeyed to epoch {}",
+                     client_info.client_id,
+                     epoch);
+    return message;
+}
+
+uint32_t ConnectionManager::supported_capabilities() const
+{
+    uint32_t capabilities = fenris::CAPABILITY_NONE;
+    if (m_plaintext_file_streaming && !m_reactor_mode) {
+        capabilities |= fenris::CAPABILITY_PLAINTEXT_FILE_STREAM;
+    }
+    if (m_sealed_file_streaming && !m_reactor_mode) {
+        capabilities |= fenris::CAPABILITY_SEALED_FILE_STREAM;
+    }
+    if (m_ticket_keeper) {
+        capabilities |= fenris::CAPABILITY_SESSION_TICKET;
+    }
+    if (m_compression) {
+        capabilities |= fenris::CAPABILITY_COMPRESSION;
+    }
+    if (m_pipelining && !m_reactor_mode) {
+        capabilities |= fenris::CAPABILITY_PIPELINING;
+    }
+    if (m_read_lease.count() > 0) {
+        capabilities |= fenris::CAPABILITY_READ_LEASES;
+    }
+    // Cheaper than random IVs and costs nothing to offer
+    capabilities |= fenris::CAPABILITY_SEQUENCED_NONCES;
+    return capabilities;
+}
+
 void ConnectionManager::handle_client(uint32_t client_socket,
-                                      uint32_t client_id)
+                                      uint32_t client_id,
+                                      std::string address)
 {
 
     ClientInfo client_info;
     client_info.client_id = client_id;
     client_info.socket = client_socket;
+    client_info.address = std::move(address);
+    open_quota(client_info);
 
     // Set client socket to non-blocking if server is in non-blocking mode
     if (m_non_blocking_mode) {
@@ -328,84 +989,628 @@ void ConnectionManager::handle_client(uint32_t client_socket,
     if (!perform_key_exchange(client_info)) {
         m_logger->error("key exchange failed with client: {}",
                         client_info.client_id);
-        close(client_socket);
         remove_client(client_id);
+        close(client_socket);
         return;
     }
 
+    // Pipelined requests that run concurrently are answered by the workers
+    // handling them, one response at a time
+    const bool pipelined = has_capability(client_info.capabilities,
+                                          fenris::CAPABILITY_PIPELINING);
+    std::mutex send_mutex;
+    std::deque<std::future<bool>> in_flight;
+    auto settle = [&in_flight](size_t limit) {
+        bool keep = true;
+        while (in_flight.size() > limit) {
+            keep = in_flight.front().get() && keep;
+            in_flight.pop_front();
+        }
+        return keep;
+    };
+
     // Process client requests
     while (m_running && keep_connection) {
+        if (client_info.quota) {
+            wait_for_quota(client_info);
+        }
 
-        auto request_opt = receive_request(client_info);
+        // Held until the request was answered
+        MemoryBudget::Lease lease;
+        RequestTrace trace = Tracer::global().begin();
+        TraceContext trace_context(&trace);
+        auto request_opt = receive_request(client_info, lease);
         if (!request_opt.has_value()) {
             m_logger->error("failed to receive request from client: {}",
                             client_info.client_id);
             break;
         }
+        adopt_trace(trace, *request_opt);
+
+        if (pipelined && runs_concurrently(client_info, *request_opt)) {
+            // Bound the workers one connection can hold
+            if (!settle(MAX_PIPELINED_REQUESTS - 1)) {
+                break;
+            }
+            auto pending = dispatch_pipelined(client_info,
+                                              send_mutex,
+                                              std::move(request_opt.value()),
+                                              std::move(lease),
+                                              std::move(trace));
+            if (!pending.valid()) {
+                m_logger->error("failed to dispatch request from client: {}",
+                                client_info.client_id);
+                break;
+            }
+            in_flight.push_back(std::move(pending));
+            continue;
+        }
+
+        // Everything else sees the effects of the requests before it
+        if (!settle(0)) {
+            break;
+        }
 
-        auto response = m_client_handler->handle_request(client_socket,
-                                                         request_opt.value());
-        keep_connection = response.second;
+        if (is_rekey(client_info, request_opt.value())) {
+            auto message = rekey(client_info, request_opt.value());
+            if (!message.has_value() || !send_message(client_info, *message)) {
+                m_logger->error("failed to rekey client: {}",
+                                client_info.client_id);
+                break;
+            }
+            continue;
+        }
+
+        if (has_capability(client_info.capabilities,
+                           fenris::CAPABILITY_PLAINTEXT_FILE_STREAM) ||
+            has_capability(client_info.capabilities,
+                           fenris::CAPABILITY_SEALED_FILE_STREAM)) {
+            auto streamed = stream_file(client_info, request_opt.value());
+            if (streamed.has_value()) {
+                if (!*streamed) {
+                    m_logger->error("failed to stream file to client: {}",
+                                    client_info.client_id);
+                    break;
+                }
+                Tracer::global().finish(trace);
+                continue;
+            }
+        }
 
-        if (!send_response(client_info, response.first)) {
+        const uint64_t request_id = request_opt->request_id();
+        Reply reply;
+        if (request_opt->command() == fenris::RequestType::BATCH) {
+            // Waits on the pool, so it stays on the connection thread
+            auto [response, keep] =
+                run_batch(client_socket, *request_opt, true);
+            reply.response = std::move(response);
+            reply.keep_connection = keep;
+        } else {
+            const bool wants_progress =
+                request_opt->tree().progress_interval_ms() != 0;
+            const FairShare share = fair_share(client_id, *request_opt);
+            auto pending =
+                wants_progress
+                    ? dispatch_with_progress(client_info, send_mutex,
+                                             std::move(request_opt.value()))
+                    : dispatch_request(
+                          client_socket,
+                          std::move(request_opt.value()),
+                          &trace,
+                          share);
+            if (!pending.valid()) {
+                m_logger->error("failed to dispatch request from client: {}",
+                                client_info.client_id);
+                break;
+            }
+            reply = pending.get();
+        }
+        keep_connection = reply.keep_connection;
+        reply.response.set_request_id(request_id);
+        grant_lease(client_info, reply.response);
+
+        if (!send_response(client_info, reply.response, reply.payload)) {
             m_logger->error("failed to send response to client: {}",
                             client_info.client_id);
             break;
         }
+        Tracer::global().finish(trace);
+    }
+
+    // The workers still hold references to client_info and send_mutex
+    settle(0);
+
+    if (client_info.quota) {
+        const ThrottleStats throttled = client_info.quota->get_stats();
+        FENRIS_LOG_DEBUG(m_logger,
+                         "client {} was throttled {} times for {} ms",
+                         client_id,
+                         throttled.throttles,
+                         throttled.throttled.count() / 1000000);
     }
 
-    close(client_socket);
     remove_client(client_id);
+    close(client_socket);
 }
 
-uint32_t ConnectionManager::generate_client_id()
+void ConnectionManager::open_quota(ClientInfo &client_info)
 {
-    return m_next_client_id++;
+    if (m_rate_limiter) {
+        client_info.quota =
+            m_rate_limiter->open(client_info.client_id, client_info.address);
+    }
 }
 
-void ConnectionManager::remove_client(uint32_t client_id)
+void ConnectionManager::wait_for_quota(const ClientInfo &client_info)
 {
-    std::lock_guard<std::mutex> lock(m_client_mutex);
-    m_client_sockets.erase(client_id);
+    using Clock = ClientQuota::Clock;
+    const Clock::time_point ready = client_info.quota->ready_at();
+    const Clock::time_point started = Clock::now();
+    if (ready <= started) {
+        return;
+    }
+
+    // Slept in slices so stop() is not held up by a long debt. A draining
+    // client is let through to read the end of its connection.
+    constexpr auto slice = std::chrono::milliseconds(50);
+    while (m_running && !m_draining && Clock::now() < ready) {
+        std::this_thread::sleep_for(
+            std::min<Clock::duration>(ready - Clock::now(), slice));
+    }
+    client_info.quota->record_throttle(Clock::now() - started);
 }
 
-bool ConnectionManager::send_response(const ClientInfo &client_info,
-                                      const fenris::Response &response)
+ConnectionManager::Reply
+ConnectionManager::answer(uint32_t client_socket,
+                          const fenris::Request &request)
 {
-    // Serialize the response
-    std::vector<uint8_t> serialized_response = serialize_response(response);
+    TraceScope trace(TraceStage::HANDLE);
+    if (request.command() == fenris::RequestType::READ_FILE) {
+        auto content = m_client_handler->file_content(client_socket, request);
+        if (content.has_value()) {
+            return {std::move(content->first),
+                    true,
+                    std::move(content->second)};
+        }
+    }
 
-    // Generate random IV
-    auto [iv, iv_gen_result] = m_crypto_manager.generate_random_iv();
-    if (iv_gen_result != crypto::EncryptionResult::SUCCESS) {
-        m_logger->error("failed to generate IV: {}",
-                        crypto::encryption_result_to_string(iv_gen_result));
+    auto [response, keep_connection] =
+        m_client_handler->handle_request(client_socket, request);
+    return {std::move(response), keep_connection, {}};
+}
+
+fenris::Response ConnectionManager::inline_payload(Reply reply)
+{
+    if (!reply.payload.empty()) {
+        reply.response.set_data(reply.payload.data(), reply.payload.size());
+    }
+    return std::move(reply.response);
+}
+
+std::future<ConnectionManager::Reply>
+ConnectionManager::dispatch_request(uint32_t client_socket,
+                                    fenris::Request request,
+                                    RequestTrace *trace,
+                                    std::optional<FairShare> share)
+{
+    const TaskPriority priority = request_priority(request);
+    const auto queued_at =
+        trace != nullptr ? trace->now() : RequestTrace::Clock::time_point{};
+    return m_thread_pool->submit(
+        [this,
+         client_socket,
+         request = std::move(request),
+         trace,
+         queued_at]() {
+            TraceContext trace_context(trace);
+            if (trace != nullptr) {
+                trace->record(TraceStage::QUEUE, queued_at, trace->now());
+            }
+            return answer(client_socket, request);
+        },
+        priority,
+        share);
+}
+
+std::future<bool>
+ConnectionManager::dispatch_pipelined(const ClientInfo &client_info,
+                                      std::mutex &send_mutex,
+                                      fenris::Request request,
+                                      MemoryBudget::Lease lease,
+                                      RequestTrace trace)
+{
+    const TaskPriority priority = request_priority(request);
+    const FairShare share = fair_share(client_info.client_id, request);
+    const auto queued_at = trace.now();
+    return m_thread_pool->submit(
+        [this,
+         &client_info,
+         &send_mutex,
+         request = std::move(request),
+         lease = std::move(lease),
+         trace = std::move(trace),
+         queued_at]() mutable {
+            TraceContext trace_context(&trace);
+            trace.record(TraceStage::QUEUE, queued_at, trace.now());
+            Reply reply = answer(client_info.socket, request);
+            reply.response.set_request_id(request.request_id());
+            grant_lease(client_info, reply.response);
+
+            // Nonces have to hit the wire in the order they were taken
+            std::lock_guard<std::mutex> lock(send_mutex);
+            if (!send_response(client_info, reply.response, reply.payload)) {
+                m_logger->error("failed to send response to client: {}",
+                                client_info.client_id);
+                return false;
+            }
+            Tracer::global().finish(trace);
+            return reply.keep_connection;
+        },
+        priority,
+        share);
+}
+
+std::future<ConnectionManager::Reply>
+ConnectionManager::dispatch_with_progress(const ClientInfo &client_info,
+                                          std::mutex &send_mutex,
+                                          fenris::Request request)
+{
+    const TaskPriority priority = request_priority(request);
+    const FairShare share = fair_share(client_info.client_id, request);
+    return m_thread_pool->submit(
+        [this, &client_info, &send_mutex, request = std::move(request)]() {
+            auto progress = [&](const fenris::Response &report) {
+                fenris::Response stamped = report;
+                stamped.set_request_id(request.request_id());
+                std::lock_guard<std::mutex> lock(send_mutex);
+                return send_response(client_info, stamped);
+            };
+            auto [response, keep_connection] =
+                m_client_handler->handle_request_with_progress(
+                    client_info.socket, request, progress);
+            return Reply{std::move(response), keep_connection, {}};
+        },
+        priority,
+        share);
+}
+
+void ConnectionManager::adopt_trace(RequestTrace &trace,
+                                    const fenris::Request &request)
+{
+    Tracer::global().adopt(
+        trace, request.trace_id(), fenris::RequestType_Name(request.command()));
+}
+
+bool ConnectionManager::runs_concurrently(const ClientInfo &client_info,
+                                          const fenris::Request &request)
+{
+    switch (request.command()) {
+    case fenris::RequestType::PING:
+    case fenris::RequestType::INFO_FILE:
+    case fenris::RequestType::LIST_DIR:
+    case fenris::RequestType::READ_CHUNK:
+    case fenris::RequestType::READ_RANGE:
+    case fenris::RequestType::SIGNATURES:
+        return true;
+    case fenris::RequestType::DU:
+    case fenris::RequestType::FIND:
+        // Progress reports would interleave with the others' responses
+        return request.tree().progress_interval_ms() == 0;
+    case fenris::RequestType::READ_FILE:
+        // A streamed file is written by the connection thread itself
+        return !has_capability(client_info.capabilities,
+                               fenris::CAPABILITY_PLAINTEXT_FILE_STREAM) &&
+               !has_capability(client_info.capabilities,
+                               fenris::CAPABILITY_SEALED_FILE_STREAM);
+    default:
         return false;
     }
+}
 
-    // Encrypt the serialized response using client's key and generated IV
-    auto [encrypted_response, encrypt_result] =
-        m_crypto_manager.encrypt_data(serialized_response,
-                                      client_info.encryption_key,
-                                      iv);
-    if (encrypt_result != crypto::EncryptionResult::SUCCESS) {
-        m_logger->error("failed to encrypt response: {}",
-                        crypto::encryption_result_to_string(encrypt_result));
+std::pair<fenris::Response, bool>
+ConnectionManager::run_batch(uint32_t client_socket,
+                             const fenris::Request &request,
+                             bool use_pool)
+{
+    const auto &requests = request.batch().requests();
+    const size_t count = static_cast<size_t>(requests.size());
+    if (count > MAX_BATCH_REQUESTS) {
+        return {batch_error("batch of " + std::to_string(count) +
+                            " requests exceeds the limit of " +
+                            std::to_string(MAX_BATCH_REQUESTS)),
+                true};
+    }
+
+    const bool parallel = request.batch().parallel();
+    std::vector<fenris::Response> results(count);
+    std::vector<std::pair<size_t, std::future<Reply>>> pending;
+    for (size_t i = 0; i < count; ++i) {
+        const fenris::Request &sub_request = requests[static_cast<int>(i)];
+        const std::string refusal = batch_refusal(sub_request, parallel);
+        if (!refusal.empty()) {
+            results[i] = batch_error(refusal);
+            continue;
+        }
+        if (parallel && use_pool) {
+            auto future = dispatch_request(client_socket, sub_request);
+            if (future.valid()) {
+                pending.emplace_back(i, std::move(future));
+                continue;
+            }
+        }
+        results[i] =
+            m_client_handler->handle_request(client_socket, sub_request).first;
+    }
+    for (auto &[index, future] : pending) {
+        results[index] = inline_payload(future.get());
+    }
+
+    fenris::Response response;
+    response.set_type(fenris::ResponseType::BATCH_RESULTS);
+    bool success = true;
+    auto *batch_results = response.mutable_batch_results();
+    for (size_t i = 0; i < count; ++i) {
+        results[i].set_request_id(requests[static_cast<int>(i)].request_id());
+        success = success && results[i].success();
+        *batch_results->add_responses() = std::move(results[i]);
+    }
+    response.set_success(success);
+    FENRIS_LOG_DEBUG_SAMPLED(m_logger,
+                             "ran batch of {} requests{}",
+                             count,
+                             parallel && use_pool ? " in parallel" : "");
+    return {std::move(response), true};
+}
+
+std::optional<bool>
+ConnectionManager::stream_file(const ClientInfo &client_info,
+                               const fenris::Request &request)
+{
+    if (request.command() != fenris::RequestType::READ_FILE) {
+        return std::nullopt;
+    }
+
+    auto path = m_client_handler->stream_path(client_info.socket, request);
+    if (!path.has_value()) {
+        return std::nullopt;
+    }
+
+    // Anything unusual is left to the handler, which reports proper errors
+    int file_fd = open(path->c_str(), O_RDONLY | O_CLOEXEC);
+    if (file_fd == -1) {
+        return std::nullopt;
+    }
+
+    struct stat file_stat {};
+    if (fstat(file_fd, &file_stat) == -1 || !S_ISREG(file_stat.st_mode) ||
+        file_stat.st_size == 0 || file_stat.st_size > UINT32_MAX) {
+        close(file_fd);
+        return std::nullopt;
+    }
+    const auto length = static_cast<uint32_t>(file_stat.st_size);
+
+    // The handler answers a revalidation of an unchanged file without data
+    const uint64_t modified_time = to_modified_time(file_stat.st_mtim);
+    if (request.if_modified_since() == modified_time) {
+        close(file_fd);
+        return std::nullopt;
+    }
+
+    // Sealing only pays once there is more than one chunk to spread out
+    const bool sealed = !has_capability(
+        client_info.capabilities, fenris::CAPABILITY_PLAINTEXT_FILE_STREAM);
+    if (sealed && length <= m_sealed_chunk_size) {
+        close(file_fd);
+        return std::nullopt;
+    }
+
+    fenris::Response response;
+    response.set_type(fenris::ResponseType::FILE_CONTENT);
+    response.set_success(true);
+    response.set_stream_length(length);
+    response.set_stream_sealed(sealed);
+    response.set_request_id(request.request_id());
+    response.mutable_file_info()->set_size(length);
+    response.mutable_file_info()->set_modified_time(modified_time);
+    grant_lease(client_info, response);
+
+    auto message = encrypt_response(client_info, response);
+    bool sent = message.has_value() && send_message(client_info, *message);
+    if (sent && sealed) {
+        sent = send_sealed_file(client_info, message->iv, file_fd, length);
+    } else if (sent) {
+        NetworkResult result = send_prefixed_file(
+            client_info.socket, file_fd, 0, length, m_non_blocking_mode);
+        if (result != NetworkResult::SUCCESS) {
+            m_logger->error("sendfile to client {} failed: {}",
+                            client_info.client_id,
+                            network_result_to_string(result));
+            sent = false;
+        } else {
+            metrics().bytes_sent.add(length);
+            if (client_info.quota) {
+                client_info.quota->charge(0, length);
+            }
+        }
+    }
+
+    close(file_fd);
+    return sent;
+}
+
+bool ConnectionManager::send_sealed_file(const ClientInfo &client_info,
+                                         std::span<const uint8_t> message_iv,
+                                         int file_fd,
+                                         uint32_t length)
+{
+    auto [stream_key, key_result] =
+        derive_stream_key(client_info.encryption_key, message_iv);
+    if (key_result != ECDHResult::SUCCESS) {
+        m_logger->error("failed to derive stream key: {}",
+                        ecdh_result_to_string(key_result));
         return false;
     }
+    auto aead = std::make_shared<const ChunkedAead>(std::move(stream_key));
+
+    const size_t chunk_size = m_sealed_chunk_size;
+    const uint64_t chunk_count = (length + chunk_size - 1) / chunk_size;
+
+    // Keep every worker busy with a chunk while the previous ones are on
+    // their way out, without reading the whole file ahead of the socket
+    const size_t window = 2 * m_thread_pool->get_thread_count();
+    std::deque<std::future<std::optional<Buffer>>> pending;
+    uint64_t next_chunk = 0;
+    bool sent = true;
+
+    for (uint64_t index = 0; index < chunk_count && sent; ++index) {
+        while (next_chunk < chunk_count && pending.size() < window) {
+            const uint64_t offset = next_chunk * chunk_size;
+            const size_t size =
+                std::min<uint64_t>(chunk_size, length - offset);
+            const bool last = next_chunk + 1 == chunk_count;
+            auto future = m_thread_pool->submit(
+                [aead, file_fd, offset, size, position = next_chunk, last]() {
+                    return seal_file_chunk(
+                        *aead, file_fd, offset, size, position, last);
+                });
+            if (!future.valid()) {
+                break;
+            }
+            pending.push_back(std::move(future));
+            ++next_chunk;
+        }
+        if (pending.empty()) {
+            m_logger->error("failed to queue sealed chunk for client {}",
+                            client_info.client_id);
+            sent = false;
+            break;
+        }
+
+        auto chunk = pending.front().get();
+        pending.pop_front();
+        if (!chunk.has_value()) {
+            m_logger->error("failed to seal chunk {} for client {}",
+                            index,
+                            client_info.client_id);
+            sent = false;
+            break;
+        }
+
+        const std::span<const uint8_t> segments[] = {chunk->span()};
+        NetworkResult result = send_prefixed_segments(
+            client_info.socket, segments, m_non_blocking_mode);
+        if (result != NetworkResult::SUCCESS) {
+            m_logger->error("failed to send sealed chunk to client {}: {}",
+                            client_info.client_id,
+                            network_result_to_string(result));
+            sent = false;
+        } else {
+            metrics().bytes_sent.add(chunk->size());
+            if (client_info.quota) {
+                client_info.quota->charge(0, chunk->size());
+            }
+        }
+    }
+
+    // The tasks still read from file_fd, which the caller closes
+    for (auto &future : pending) {
+        future.wait();
+    }
+    return sent;
+}
+
+TaskPriority ConnectionManager::request_priority(const fenris::Request &request)
+{
+    switch (request.command()) {
+    case fenris::RequestType::PING:
+    case fenris::RequestType::INFO_FILE:
+        return TaskPriority::HIGH;
+    default:
+        return TaskPriority::NORMAL;
+    }
+}
+
+FairShare ConnectionManager::fair_share(uint32_t client_id,
+                                        const fenris::Request &request)
+{
+    // Reads are charged what they ask for, since their request is small
+    // but their response is not. A READ_FILE's size is unknown up front.
+    uint64_t cost = FAIR_REQUEST_COST + request.data().size();
+    switch (request.command()) {
+    case fenris::RequestType::READ_CHUNK:
+    case fenris::RequestType::READ_RANGE:
+        cost += request.chunk().length();
+        break;
+    default:
+        break;
+    }
+    return FairShare{client_id, cost};
+}
+
+void ConnectionManager::grant_lease(const ClientInfo &client_info,
+                                    fenris::Response &response) const
+{
+    if (response.type() != fenris::ResponseType::FILE_CONTENT ||
+        !response.success() ||
+        !has_capability(client_info.capabilities,
+                        fenris::CAPABILITY_READ_LEASES)) {
+        return;
+    }
+    response.set_lease_ms(static_cast<uint64_t>(m_read_lease.count()));
+}
+
+uint32_t ConnectionManager::generate_client_id()
+{
+    return m_next_client_id++;
+}
+
+void ConnectionManager::remove_client(uint32_t client_id)
+{
+    std::optional<uint32_t> client_socket;
+    {
+        std::lock_guard<std::mutex> lock(m_client_mutex);
+        auto it = m_client_sockets.find(client_id);
+        if (it != m_client_sockets.end()) {
+            client_socket = it->second;
+        }
+    }
+
+    // Every caller closes the descriptor only after this returns, so the
+    // handler drops its state before the kernel can hand the number out
+    if (client_socket.has_value() && m_client_handler) {
+        m_client_handler->client_disconnected(*client_socket);
+    }
 
-    // Create the final message with IV prefixed to encrypted data
-    std::vector<uint8_t> message_with_iv;
-    message_with_iv.reserve(iv.size() + encrypted_response.size());
-    message_with_iv.insert(message_with_iv.end(), iv.begin(), iv.end());
-    message_with_iv.insert(message_with_iv.end(),
-                           encrypted_response.begin(),
-                           encrypted_response.end());
+    {
+        std::lock_guard<std::mutex> lock(m_client_mutex);
+        if (m_client_sockets.erase(client_id) != 0) {
+            metrics().active.subtract();
+        }
+    }
+    m_client_removed.notify_all();
+}
 
-    // Send the IV-prefixed encrypted response
-    NetworkResult send_result = send_prefixed_data(client_info.socket,
-                                                   message_with_iv,
-                                                   m_non_blocking_mode);
+bool ConnectionManager::send_response(const ClientInfo &client_info,
+                                      const fenris::Response &response,
+                                      std::span<const uint8_t> payload)
+{
+    auto message = encrypt_response(client_info, response, payload);
+    if (!message.has_value()) {
+        return false;
+    }
+    return send_message(client_info, *message);
+}
+
+bool ConnectionManager::send_message(const ClientInfo &client_info,
+                                     const EncryptedMessage &message)
+{
+    TraceScope trace(TraceStage::SEND);
+    // Send the length prefix, IV and encrypted response in one go
+    const std::span<const uint8_t> segments[] = {message.iv,
+                                                 message.ciphertext};
+    NetworkResult send_result = send_prefixed_segments(client_info.socket,
+                                                       segments,
+                                                       m_non_blocking_mode);
     if (send_result != NetworkResult::SUCCESS) {
         m_logger->error("failed to send encrypted response to client {}: {}",
                         client_info.client_id,
@@ -417,45 +1622,191 @@ bool ConnectionManager::send_response(const ClientInfo &client_info,
 }
 
 std::optional<fenris::Request>
-ConnectionManager::receive_request(const ClientInfo &client_info)
+ConnectionManager::receive_request(const ClientInfo &client_info,
+                                  MemoryBudget::Lease &lease)
 {
-    // Receive encrypted data (includes IV + encrypted request)
-    std::vector<uint8_t> encrypted_data;
-    NetworkResult recv_result = receive_prefixed_data(client_info.socket,
-                                                      encrypted_data,
-                                                      m_non_blocking_mode);
+    // Receive the IV and the encrypted request into separate buffers
+    std::vector<uint8_t> iv(AES_GCM_IV_SIZE);
+    size_t size = 0;
+    NetworkResult recv_result = receive_preamble(client_info.socket,
+                                                 iv,
+                                                 size,
+                                                 m_non_blocking_mode,
+                                                 NO_TIMEOUT,
+                                                 m_max_message_size);
     if (recv_result != NetworkResult::SUCCESS) {
-        m_logger->error("failed to receive request from client: {}",
-                        client_info.client_id);
+        m_logger->error("failed to receive request from client {}: {}",
+                        client_info.client_id,
+                        network_result_to_string(recv_result));
         return std::nullopt;
     }
 
-    if (encrypted_data.size() < AES_GCM_IV_SIZE) {
-        m_logger->error("received data too small to contain IV from client: {}",
-                        client_info.client_id);
+    // Nothing is allocated for the body before it fits the budget
+    if (m_memory_budget) {
+        auto granted = m_memory_budget->acquire(size);
+        if (!granted.has_value()) {
+            return std::nullopt;
+        }
+        lease = std::move(*granted);
+    }
+
+    Buffer encrypted_request;
+    {
+        TraceScope trace(TraceStage::RECEIVE);
+        // Leased memory is there to be used, so the body is read into one
+        // slab instead of being copied as it grows
+        recv_result = receive_body(client_info.socket,
+                                   encrypted_request,
+                                   size,
+                                   m_non_blocking_mode,
+                                   NO_TIMEOUT,
+                                   static_cast<bool>(lease));
+    }
+    if (recv_result != NetworkResult::SUCCESS) {
+        m_logger->error("failed to receive request from client {}: {}",
+                        client_info.client_id,
+                        network_result_to_string(recv_result));
+        return std::nullopt;
+    }
+
+    return decrypt_request(client_info, iv, std::move(encrypted_request));
+}
+
+std::optional<EncryptedMessage>
+ConnectionManager::encrypt_response(const ClientInfo &client_info,
+                                    const fenris::Response &response,
+                                    std::span<const uint8_t> payload)
+{
+    // Serialize the response with room for the tag behind it, so it is
+    // encrypted where it was written. A payload is copied in once, straight
+    // behind the rest of the message.
+    Buffer frame;
+    {
+        TraceScope trace(TraceStage::SERIALIZE);
+        frame = payload.empty()
+                    ? serialize_response_to_buffer(response, AES_GCM_TAG_SIZE)
+                    : serialize_response_to_buffer(
+                          response, payload, AES_GCM_TAG_SIZE);
+        if (frame.size() < AES_GCM_TAG_SIZE) {
+            m_logger->error("failed to serialize response");
+            return std::nullopt;
+        }
+        if (client_info.compression) {
+            auto [compressed, compress_result] =
+                client_info.compression->encode(
+                    frame.span().first(frame.size() - AES_GCM_TAG_SIZE),
+                    AES_GCM_TAG_SIZE);
+            if (compress_result != compress::CompressionResult::SUCCESS) {
+                m_logger->error(
+                    "failed to compress response: {}",
+                    compress::compression_result_to_string(compress_result));
+                return std::nullopt;
+            }
+            frame = std::move(compressed);
+        }
+    }
+
+    // Take the next nonce of the connection, or a random IV from clients
+    // that did not negotiate sequenced nonces
+    auto [iv, iv_gen_result] = client_info.send_nonces
+                                   ? client_info.send_nonces->next()
+                                   : m_crypto_manager.generate_random_iv();
+    if (iv_gen_result != crypto::EncryptionResult::SUCCESS) {
+        m_logger->error("failed to generate IV: {}",
+                        crypto::encryption_result_to_string(iv_gen_result));
+        return std::nullopt;
+    }
+
+    // Encrypt the serialized response using client's key and generated IV,
+    // with the connection's keyed cipher once the key exchange set it up
+    EncryptionResult encrypt_result;
+    {
+        TraceScope trace(TraceStage::ENCRYPT);
+        encrypt_result =
+            client_info.session
+                ? client_info.session->encrypt_in_place(frame.mutable_span(),
+                                                        iv)
+                : m_crypto_manager.encrypt_in_place(
+                      frame.mutable_span(), client_info.encryption_key, iv);
+    }
+    if (encrypt_result != crypto::EncryptionResult::SUCCESS) {
+        m_logger->error("failed to encrypt response: {}",
+                        crypto::encryption_result_to_string(encrypt_result));
         return std::nullopt;
     }
 
-    // Extract IV from the beginning of the message
-    std::vector<uint8_t> iv(encrypted_data.begin(),
-                            encrypted_data.begin() + AES_GCM_IV_SIZE);
+    metrics().bytes_sent.add(iv.size() + frame.size());
+    if (client_info.quota) {
+        client_info.quota->charge(0, iv.size() + frame.size());
+    }
+    return EncryptedMessage{std::move(iv), std::move(frame)};
+}
 
-    // Extract the encrypted request data (after the IV)
-    std::vector<uint8_t> encrypted_request(encrypted_data.begin() +
-                                               AES_GCM_IV_SIZE,
-                                           encrypted_data.end());
+std::optional<fenris::Request>
+ConnectionManager::decrypt_request(const ClientInfo &client_info,
+                                   const std::vector<uint8_t> &iv,
+                                   Buffer ciphertext)
+{
+    metrics().bytes_received.add(iv.size() + ciphertext.size());
+    if (client_info.quota) {
+        client_info.quota->charge(1, iv.size() + ciphertext.size());
+    }
+    if (iv.size() != AES_GCM_IV_SIZE) {
+        m_logger->error("received invalid IV from client: {}",
+                        client_info.client_id);
+        return std::nullopt;
+    }
 
-    // Decrypt the request using client's key and extracted IV
-    auto [decrypted_data, decrypt_result] =
-        m_crypto_manager.decrypt_data(encrypted_request,
-                                      client_info.encryption_key,
-                                      iv);
+    // Replays are refused before spending time on the ciphertext
+    if (client_info.receive_nonces) {
+        EncryptionResult nonce_result = client_info.receive_nonces->verify(iv);
+        if (nonce_result != EncryptionResult::SUCCESS) {
+            m_logger->error("rejected IV from client {}: {}",
+                            client_info.client_id,
+                            encryption_result_to_string(nonce_result));
+            return std::nullopt;
+        }
+    }
+
+    // Decrypt the request in the buffer it was received into, using
+    // client's key and the received IV
+    EncryptionResult decrypt_result;
+    {
+        TraceScope trace(TraceStage::DECRYPT);
+        decrypt_result =
+            client_info.session
+                ? client_info.session->decrypt_in_place(
+                      ciphertext.mutable_span(), iv)
+                : m_crypto_manager.decrypt_in_place(ciphertext.mutable_span(),
+                                                    client_info.encryption_key,
+                                                    iv);
+    }
     if (decrypt_result != crypto::EncryptionResult::SUCCESS) {
         m_logger->error("failed to decrypt request from client {}: {}",
                         client_info.client_id,
                         crypto::encryption_result_to_string(decrypt_result));
         return std::nullopt;
     }
+    if (client_info.receive_nonces) {
+        client_info.receive_nonces->accept(iv);
+    }
+    Buffer decrypted_data =
+        ciphertext.slice(0, ciphertext.size() - AES_GCM_TAG_SIZE);
+
+    TraceScope trace(TraceStage::PARSE);
+
+    if (client_info.compression) {
+        auto [message, decompress_result] =
+            client_info.compression->decode(decrypted_data);
+        if (decompress_result != compress::CompressionResult::SUCCESS) {
+            m_logger->error(
+                "failed to decompress request from client {}: {}",
+                client_info.client_id,
+                compress::compression_result_to_string(decompress_result));
+            return std::nullopt;
+        }
+        return deserialize_request(message);
+    }
 
     return deserialize_request(decrypted_data);
 }
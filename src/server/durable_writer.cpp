@@ -0,0 +1,242 @@
+#include "server/durable_writer.hpp"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <filesystem>
+#include <set>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fenris {
+namespace server {
+
+namespace fs = std::filesystem;
+
+using namespace common;
+
+namespace {
+
+FileOperationResult errno_to_result(int error)
+{
+    return system_error_to_file_operation_result(
+        std::error_code(error, std::generic_category()));
+}
+
+// Write all of data, retrying short writes
+bool write_all(int fd, std::string_view data)
+{
+    size_t total = 0;
+    while (total < data.size()) {
+        const ssize_t n =
+            ::write(fd, data.data() + total, data.size() - total);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        total += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Directory whose entry a rename of path changes
+std::string directory_of(const std::string &path)
+{
+    const fs::path parent = fs::path(path).parent_path();
+    return parent.empty() ? "." : parent.string();
+}
+
+// Whether the owner may write to a file. rename() would replace a read-only
+// file that an in-place write could not open, so it is checked up front.
+bool owner_writable(const struct stat &status)
+{
+    return (status.st_mode & S_IWUSR) != 0;
+}
+
+} // namespace
+
+DurableWriter::DurableWriter(const DurableWriteConfig &config,
+                             const std::string &logger_name)
+    : m_config(config), m_logger(get_logger(logger_name))
+{
+    if (m_config.max_batch == 0) {
+        m_config.max_batch = 1;
+    }
+}
+
+FileOperationResult DurableWriter::write_file(const std::string &filepath,
+                                              std::string_view data)
+{
+    struct stat status {};
+    const bool exists = ::stat(filepath.c_str(), &status) == 0;
+    if (exists && S_ISDIR(status.st_mode)) {
+        return FileOperationResult::INVALID_PATH;
+    }
+    if (exists && !owner_writable(status)) {
+        return FileOperationResult::PERMISSION_DENIED;
+    }
+
+    Pending pending{-1, "", filepath};
+    auto [fd, result] = create_temp_file(filepath, pending.temp_path);
+    if (result != FileOperationResult::SUCCESS) {
+        return result;
+    }
+    pending.fd = fd;
+
+    // The replacement keeps the permissions of the file it replaces
+    bool written = !exists || ::fchmod(fd, status.st_mode & 07777) == 0;
+    written = written && write_all(fd, data);
+    if (!written) {
+        m_logger->warn("failed to write temporary file for {}", filepath);
+        ::close(fd);
+        ::unlink(pending.temp_path.c_str());
+        return FileOperationResult::IO_ERROR;
+    }
+
+    return commit(pending);
+}
+
+FileOperationResult DurableWriter::append_file(const std::string &filepath,
+                                               std::string_view data)
+{
+    struct stat status {};
+    if (::stat(filepath.c_str(), &status) != 0) {
+        return errno_to_result(errno);
+    }
+    if (S_ISDIR(status.st_mode)) {
+        return FileOperationResult::INVALID_PATH;
+    }
+    if (!owner_writable(status)) {
+        return FileOperationResult::PERMISSION_DENIED;
+    }
+
+    const int fd = ::open(filepath.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0) {
+        return errno_to_result(errno);
+    }
+    if (!write_all(fd, data)) {
+        m_logger->warn("failed to append to {}", filepath);
+        ::close(fd);
+        return FileOperationResult::IO_ERROR;
+    }
+
+    Pending pending{fd, "", filepath};
+    return commit(pending);
+}
+
+DurableWriteStats DurableWriter::get_stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+FileOperationResult DurableWriter::commit(Pending &pending)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_queue.push_back(&pending);
+    if (m_queue.size() >= m_config.max_batch) {
+        m_batch_full.notify_one();
+    }
+
+    while (!pending.done) {
+        if (m_flushing) {
+            m_batch_done.wait(lock);
+            continue;
+        }
+
+        // Lead the next batch, giving other writers the window to join it
+        m_flushing = true;
+        if (m_config.commit_window.count() > 0) {
+            m_batch_full.wait_for(lock, m_config.commit_window, [this]() {
+                return m_queue.size() >= m_config.max_batch;
+            });
+        }
+
+        std::vector<Pending *> batch;
+        if (m_queue.size() > m_config.max_batch) {
+            // Take the oldest writes, the rest wait for the next batch
+            batch.assign(m_queue.begin(),
+                         m_queue.begin() +
+                             static_cast<std::ptrdiff_t>(m_config.max_batch));
+            m_queue.erase(m_queue.begin(),
+                          m_queue.begin() +
+                              static_cast<std::ptrdiff_t>(m_config.max_batch));
+        } else {
+            batch.swap(m_queue);
+        }
+
+        lock.unlock();
+        flush(batch);
+        lock.lock();
+
+        for (Pending *flushed : batch) {
+            flushed->done = true;
+        }
+        m_flushing = false;
+        m_batch_done.notify_all();
+    }
+
+    return pending.result;
+}
+
+void DurableWriter::flush(const std::vector<Pending *> &batch)
+{
+    // Start writeback of every file before waiting on any, so the device
+    // sees the whole batch at once instead of one file per flush
+    for (Pending *pending : batch) {
+        ::sync_file_range(pending->fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+    }
+    for (Pending *pending : batch) {
+        if (::fdatasync(pending->fd) != 0) {
+            m_logger->error("failed to flush {}", pending->path);
+            pending->result = FileOperationResult::IO_ERROR;
+        }
+        ::close(pending->fd);
+    }
+
+    std::set<std::string> directories;
+    for (Pending *pending : batch) {
+        if (pending->temp_path.empty()) {
+            continue;
+        }
+        if (pending->result != FileOperationResult::SUCCESS) {
+            ::unlink(pending->temp_path.c_str());
+            continue;
+        }
+        if (::rename(pending->temp_path.c_str(), pending->path.c_str()) != 0) {
+            pending->result = errno_to_result(errno);
+            ::unlink(pending->temp_path.c_str());
+            continue;
+        }
+        directories.insert(directory_of(pending->path));
+    }
+
+    // The renames only survive a crash once their directories are flushed
+    for (const std::string &directory : directories) {
+        const int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd < 0 || ::fsync(fd) != 0) {
+            m_logger->error("failed to flush directory {}", directory);
+            for (Pending *pending : batch) {
+                if (!pending->temp_path.empty() &&
+                    directory_of(pending->path) == directory) {
+                    pending->result = FileOperationResult::IO_ERROR;
+                }
+            }
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.writes += batch.size();
+    ++m_stats.batches;
+    m_stats.directory_syncs += directories.size();
+    m_logger->debug("flushed {} writes with {} directory syncs",
+                    batch.size(),
+                    directories.size());
+}
+
+} // namespace server
+} // namespace fenris
@@ -0,0 +1,290 @@
+#include "server/eviction_policy.hpp"
+
+#include <algorithm>
+#include <bit>
+
+namespace fenris {
+namespace server {
+
+namespace {
+
+// Derive an independent second hash for the sketch rows (splitmix64)
+uint64_t mix(uint64_t value)
+{
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+} // namespace
+
+std::string eviction_policy_type_to_string(EvictionPolicyType type)
+{
+    switch (type) {
+    case EvictionPolicyType::LRU:
+        return "lru";
+    case EvictionPolicyType::TINY_LFU:
+        return "tinylfu";
+    case EvictionPolicyType::ARC:
+        return "arc";
+    default:
+        return "unknown";
+    }
+}
+
+LruPolicy::LruPolicy(CacheTable &table) : m_order(table, 1)
+{
+}
+
+void LruPolicy::record_hit(uint32_t slot)
+{
+    if (m_order.contains(slot)) {
+        m_order.move_to_front(slot);
+    }
+}
+
+void LruPolicy::insert(uint32_t slot)
+{
+    if (m_order.contains(slot)) {
+        m_order.move_to_front(slot);
+        return;
+    }
+    m_order.push_front(slot);
+}
+
+void LruPolicy::remove(uint32_t slot, bool evicted)
+{
+    (void)evicted;
+    if (m_order.contains(slot)) {
+        m_order.unlink(slot);
+    }
+}
+
+void LruPolicy::clear()
+{
+    m_order.reset();
+}
+
+uint32_t LruPolicy::victim() const
+{
+    return m_order.back();
+}
+
+FrequencySketch::FrequencySketch(size_t capacity)
+{
+    // Small caches still see many distinct keys, keep collisions rare
+    const size_t width = std::bit_ceil(std::max<size_t>(capacity, 256));
+    m_counters.assign(ROWS * width, 0);
+    m_mask = width - 1;
+    m_sample_size = 10 * width;
+}
+
+void FrequencySketch::increment(uint64_t hash)
+{
+    for (size_t row = 0; row < ROWS; ++row) {
+        uint8_t &counter = m_counters[index(hash, row)];
+        if (counter < MAX_COUNT) {
+            ++counter;
+        }
+    }
+
+    if (++m_additions >= m_sample_size) {
+        age();
+    }
+}
+
+uint8_t FrequencySketch::estimate(uint64_t hash) const
+{
+    uint8_t result = MAX_COUNT;
+    for (size_t row = 0; row < ROWS; ++row) {
+        result = std::min(result, m_counters[index(hash, row)]);
+    }
+    return result;
+}
+
+size_t FrequencySketch::index(uint64_t hash, size_t row) const
+{
+    // Double hashing gives each row its own column for the same key
+    const uint64_t step = mix(hash) | 1;
+    return row * (m_mask + 1) + ((hash + row * step) & m_mask);
+}
+
+void FrequencySketch::age()
+{
+    for (auto &counter : m_counters) {
+        counter >>= 1;
+    }
+    m_additions /= 2;
+}
+
+TinyLfuPolicy::TinyLfuPolicy(CacheTable &table, size_t capacity)
+    : m_table(table), m_sketch(capacity), m_lru(table)
+{
+}
+
+void TinyLfuPolicy::record_hit(uint32_t slot)
+{
+    m_sketch.increment(m_table.entry(slot).hash);
+    m_lru.record_hit(slot);
+}
+
+void TinyLfuPolicy::record_miss(uint64_t hash)
+{
+    m_sketch.increment(hash);
+}
+
+bool TinyLfuPolicy::admit(uint64_t hash, uint32_t victim)
+{
+    return m_sketch.estimate(hash) >
+           m_sketch.estimate(m_table.entry(victim).hash);
+}
+
+void TinyLfuPolicy::insert(uint32_t slot)
+{
+    m_lru.insert(slot);
+}
+
+void TinyLfuPolicy::remove(uint32_t slot, bool evicted)
+{
+    m_lru.remove(slot, evicted);
+}
+
+void TinyLfuPolicy::clear()
+{
+    m_lru.clear();
+}
+
+uint32_t TinyLfuPolicy::victim() const
+{
+    return m_lru.victim();
+}
+
+ArcPolicy::ArcPolicy(CacheTable &table, size_t capacity)
+    : m_table(table),
+      m_capacity(std::max<size_t>(capacity, 1)),
+      m_t1(table, T1_ID),
+      m_t2(table, T2_ID)
+{
+}
+
+void ArcPolicy::record_hit(uint32_t slot)
+{
+    if (m_t1.contains(slot)) {
+        m_t1.unlink(slot);
+        m_t2.push_front(slot);
+    } else if (m_t2.contains(slot)) {
+        m_t2.move_to_front(slot);
+    }
+}
+
+void ArcPolicy::insert(uint32_t slot)
+{
+    if (m_t1.contains(slot) || m_t2.contains(slot)) {
+        record_hit(slot);
+        return;
+    }
+
+    const uint64_t hash = m_table.entry(slot).hash;
+    auto ghost = m_ghosts.find(hash);
+    if (ghost == m_ghosts.end()) {
+        m_t1.push_front(slot);
+        trim_ghosts();
+        return;
+    }
+
+    if (!ghost->second.frequent) {
+        // T1 was too small to keep this key, grow its target
+        const size_t delta = std::max<size_t>(m_b2.size() / m_b1.size(), 1);
+        m_target = std::min(m_capacity, m_target + delta);
+    } else {
+        // T2 was too small to keep this key, shrink T1's target
+        const size_t delta = std::max<size_t>(m_b1.size() / m_b2.size(), 1);
+        m_target = m_target > delta ? m_target - delta : 0;
+    }
+    drop_ghost(hash);
+    m_t2.push_front(slot);
+    trim_ghosts();
+}
+
+void ArcPolicy::remove(uint32_t slot, bool evicted)
+{
+    bool frequent;
+    if (m_t1.contains(slot)) {
+        m_t1.unlink(slot);
+        frequent = false;
+    } else if (m_t2.contains(slot)) {
+        m_t2.unlink(slot);
+        frequent = true;
+    } else {
+        return;
+    }
+
+    if (evicted) {
+        // Remember the key so a quick return can adapt the target
+        add_ghost(m_table.entry(slot).hash, frequent);
+        trim_ghosts();
+    }
+}
+
+void ArcPolicy::clear()
+{
+    m_t1.reset();
+    m_t2.reset();
+}
+
+uint32_t ArcPolicy::victim() const
+{
+    if (!m_t1.empty() && (m_t1.size() > m_target || m_t2.empty())) {
+        return m_t1.back();
+    }
+    return m_t2.back();
+}
+
+void ArcPolicy::add_ghost(uint64_t hash, bool frequent)
+{
+    drop_ghost(hash);
+    std::list<uint64_t> &ghosts = frequent ? m_b2 : m_b1;
+    ghosts.push_front(hash);
+    m_ghosts.emplace(hash, Ghost{frequent, ghosts.begin()});
+}
+
+void ArcPolicy::drop_ghost(uint64_t hash)
+{
+    auto it = m_ghosts.find(hash);
+    if (it == m_ghosts.end()) {
+        return;
+    }
+    (it->second.frequent ? m_b2 : m_b1).erase(it->second.it);
+    m_ghosts.erase(it);
+}
+
+void ArcPolicy::trim_ghosts()
+{
+    while (!m_b1.empty() && m_t1.size() + m_b1.size() > m_capacity) {
+        drop_ghost(m_b1.back());
+    }
+    while (!m_b2.empty() &&
+           m_t1.size() + m_t2.size() + m_b1.size() + m_b2.size() >
+               2 * m_capacity) {
+        drop_ghost(m_b2.back());
+    }
+}
+
+std::unique_ptr<EvictionPolicy> make_eviction_policy(EvictionPolicyType type,
+                                                     CacheTable &table,
+                                                     size_t capacity)
+{
+    switch (type) {
+    case EvictionPolicyType::TINY_LFU:
+        return std::make_unique<TinyLfuPolicy>(table, capacity);
+    case EvictionPolicyType::ARC:
+        return std::make_unique<ArcPolicy>(table, capacity);
+    case EvictionPolicyType::LRU:
+    default:
+        return std::make_unique<LruPolicy>(table);
+    }
+}
+
+} // namespace server
+} // namespace fenris
@@ -0,0 +1,250 @@
+#include "server/file_watcher.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <vector>
+
+namespace fenris {
+namespace server {
+
+namespace fs = std::filesystem;
+
+using namespace common;
+
+namespace {
+
+constexpr uint32_t WATCH_MASK = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB |
+                                IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR |
+                                IN_EXCL_UNLINK;
+
+// Events after which a path may no longer hold what was cached for it
+constexpr uint32_t CHANGE_MASK = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB |
+                                 IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                 IN_MOVED_TO;
+
+bool is_under(const std::string &path, const std::string &directory)
+{
+    return path == directory ||
+           (path.size() > directory.size() &&
+            path.compare(0, directory.size(), directory) == 0 &&
+            path[directory.size()] == '/');
+}
+
+} // namespace
+
+FileWatcher::FileWatcher(const std::string &root,
+                         ChangeCallback callback,
+                         const std::string &logger_name)
+    : m_root(root),
+      m_callback(std::move(callback)),
+      m_logger(get_logger(logger_name))
+{
+    while (m_root.size() > 1 && m_root.back() == '/') {
+        m_root.pop_back();
+    }
+}
+
+FileWatcher::~FileWatcher()
+{
+    stop();
+}
+
+bool FileWatcher::start()
+{
+    if (m_running) {
+        return true;
+    }
+
+    m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotify_fd == -1) {
+        m_logger->error("inotify_init1 failed: {}", strerror(errno));
+        return false;
+    }
+
+    m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wake_fd == -1) {
+        m_logger->error("eventfd failed: {}", strerror(errno));
+        close(m_inotify_fd);
+        m_inotify_fd = -1;
+        return false;
+    }
+
+    add_watch_tree(m_root);
+    if (get_watch_count() == 0) {
+        m_logger->error("failed to watch {}", m_root);
+        close(m_wake_fd);
+        close(m_inotify_fd);
+        m_wake_fd = -1;
+        m_inotify_fd = -1;
+        return false;
+    }
+
+    m_running = true;
+    m_thread = std::thread(&FileWatcher::run, this);
+
+    m_logger->info("watching {} ({} directories)", m_root, get_watch_count());
+    return true;
+}
+
+void FileWatcher::stop()
+{
+    if (!m_running.exchange(false)) {
+        return;
+    }
+
+    uint64_t one = 1;
+    if (write(m_wake_fd, &one, sizeof(one)) == -1) {
+        m_logger->warn("failed to wake file watcher: {}", strerror(errno));
+    }
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+
+    // Closing the descriptor releases every watch at once
+    close(m_inotify_fd);
+    close(m_wake_fd);
+    m_inotify_fd = -1;
+    m_wake_fd = -1;
+
+    std::lock_guard<std::mutex> lock(m_watches_mutex);
+    m_watches.clear();
+}
+
+size_t FileWatcher::get_watch_count() const
+{
+    std::lock_guard<std::mutex> lock(m_watches_mutex);
+    return m_watches.size();
+}
+
+void FileWatcher::run()
+{
+    // Large enough for many events, aligned as inotify_event requires
+    alignas(struct inotify_event) char buffer[64 * 1024];
+
+    struct pollfd fds[2];
+    fds[0] = {m_inotify_fd, POLLIN, 0};
+    fds[1] = {m_wake_fd, POLLIN, 0};
+
+    while (m_running) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            m_logger->error("poll failed: {}", strerror(errno));
+            break;
+        }
+        if (fds[1].revents != 0) {
+            break;
+        }
+
+        for (;;) {
+            ssize_t length = read(m_inotify_fd, buffer, sizeof(buffer));
+            if (length <= 0) {
+                if (length == -1 && errno != EAGAIN && errno != EINTR) {
+                    m_logger->error("failed to read inotify events: {}",
+                                    strerror(errno));
+                }
+                break;
+            }
+            process_events(buffer, static_cast<size_t>(length));
+        }
+    }
+}
+
+void FileWatcher::process_events(const char *buffer, size_t length)
+{
+    for (size_t offset = 0; offset < length;) {
+        const auto *event =
+            reinterpret_cast<const struct inotify_event *>(buffer + offset);
+        offset += sizeof(struct inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            // Events were lost, anything below the root may be stale
+            m_logger->warn("inotify queue overflow, reporting {}", m_root);
+            m_callback(m_root, true);
+            continue;
+        }
+
+        std::string directory;
+        {
+            std::lock_guard<std::mutex> lock(m_watches_mutex);
+            auto it = m_watches.find(event->wd);
+            if (it == m_watches.end()) {
+                continue;
+            }
+            directory = it->second;
+            if (event->mask & IN_IGNORED) {
+                m_watches.erase(it);
+                continue;
+            }
+        }
+
+        if (event->mask & IN_DELETE_SELF) {
+            m_callback(directory, true);
+            continue;
+        }
+        if ((event->mask & CHANGE_MASK) == 0 || event->len == 0) {
+            continue;
+        }
+
+        const std::string path = directory + "/" + event->name;
+        const bool is_directory = (event->mask & IN_ISDIR) != 0;
+        m_logger->debug("change event 0x{:x} for {}", event->mask, path);
+
+        if (is_directory && (event->mask & IN_MOVED_FROM)) {
+            // The old watches would keep reporting under the old name
+            remove_watch_tree(path);
+        }
+        if (is_directory && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+            add_watch_tree(path);
+        }
+
+        m_callback(path, is_directory);
+    }
+}
+
+void FileWatcher::add_watch_tree(const std::string &directory)
+{
+    std::vector<std::string> directories{directory};
+    std::error_code ec;
+    fs::recursive_directory_iterator it(
+        directory, fs::directory_options::skip_permission_denied, ec);
+    for (; !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (it->is_directory(ec) && !it->is_symlink(ec)) {
+            directories.push_back(it->path().string());
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_watches_mutex);
+    for (const auto &path : directories) {
+        int wd = inotify_add_watch(m_inotify_fd, path.c_str(), WATCH_MASK);
+        if (wd == -1) {
+            m_logger->warn("failed to watch {}: {}", path, strerror(errno));
+            continue;
+        }
+        m_watches[wd] = path;
+    }
+}
+
+void FileWatcher::remove_watch_tree(const std::string &directory)
+{
+    std::lock_guard<std::mutex> lock(m_watches_mutex);
+    for (auto it = m_watches.begin(); it != m_watches.end();) {
+        if (is_under(it->second, directory)) {
+            inotify_rm_watch(m_inotify_fd, it->first);
+            it = m_watches.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+} // namespace server
+} // namespace fenris
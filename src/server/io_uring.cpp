@@ -0,0 +1,259 @@
+#include "server/io_uring.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace fenris {
+namespace server {
+
+namespace {
+
+int io_uring_setup(unsigned entries, io_uring_params *params)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int ring_fd,
+                   unsigned to_submit,
+                   unsigned min_complete,
+                   unsigned flags)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter,
+                                    ring_fd,
+                                    to_submit,
+                                    min_complete,
+                                    flags,
+                                    nullptr,
+                                    0));
+}
+
+int io_uring_register(int ring_fd,
+                      unsigned opcode,
+                      const void *arg,
+                      unsigned nr_args)
+{
+    return static_cast<int>(
+        syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+}
+
+// The kernel updates the heads and tails concurrently with us
+unsigned load_acquire(unsigned *value)
+{
+    return std::atomic_ref<unsigned>(*value).load(std::memory_order_acquire);
+}
+
+void store_release(unsigned *value, unsigned new_value)
+{
+    std::atomic_ref<unsigned>(*value).store(new_value,
+                                            std::memory_order_release);
+}
+
+template <typename T>
+T *at_offset(void *base, uint32_t offset)
+{
+    return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+}
+
+void *map_ring(int ring_fd, size_t size, off_t offset)
+{
+    return mmap(nullptr,
+                size,
+                PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE,
+                ring_fd,
+                offset);
+}
+
+} // namespace
+
+IoUring::~IoUring()
+{
+    release();
+}
+
+int IoUring::init(unsigned entries, std::initializer_list<uint8_t> opcodes)
+{
+    if (is_open()) {
+        return 0;
+    }
+
+    io_uring_params params{};
+    m_ring_fd = io_uring_setup(entries, &params);
+    if (m_ring_fd < 0) {
+        m_ring_fd = -1;
+        return -errno;
+    }
+
+    m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cq_ring_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        m_sq_ring_size = m_cq_ring_size =
+            std::max(m_sq_ring_size, m_cq_ring_size);
+    }
+
+    m_sq_ring = map_ring(m_ring_fd, m_sq_ring_size, IORING_OFF_SQ_RING);
+    if (m_sq_ring == MAP_FAILED) {
+        m_sq_ring = nullptr;
+        const int error = errno;
+        release();
+        return -error;
+    }
+
+    m_cq_ring = single_mmap
+                    ? m_sq_ring
+                    : map_ring(m_ring_fd, m_cq_ring_size, IORING_OFF_CQ_RING);
+    if (m_cq_ring == MAP_FAILED) {
+        m_cq_ring = nullptr;
+        const int error = errno;
+        release();
+        return -error;
+    }
+
+    m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = map_ring(m_ring_fd, m_sqes_size, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        const int error = errno;
+        release();
+        return -error;
+    }
+    m_sqes = static_cast<io_uring_sqe *>(sqes);
+
+    m_sq_head = at_offset<unsigned>(m_sq_ring, params.sq_off.head);
+    m_sq_tail = at_offset<unsigned>(m_sq_ring, params.sq_off.tail);
+    m_sq_array = at_offset<unsigned>(m_sq_ring, params.sq_off.array);
+    m_sq_mask = *at_offset<unsigned>(m_sq_ring, params.sq_off.ring_mask);
+    m_sq_entries = params.sq_entries;
+    m_cq_head = at_offset<unsigned>(m_cq_ring, params.cq_off.head);
+    m_cq_tail = at_offset<unsigned>(m_cq_ring, params.cq_off.tail);
+    m_cqes = at_offset<io_uring_cqe>(m_cq_ring, params.cq_off.cqes);
+    m_cq_mask = *at_offset<unsigned>(m_cq_ring, params.cq_off.ring_mask);
+    m_sqe_head = m_sqe_tail = *m_sq_tail;
+
+    // Kernels predating the probe predate most file opcodes as well
+    constexpr unsigned PROBE_OPS = 256;
+    const size_t probe_size =
+        sizeof(io_uring_probe) + PROBE_OPS * sizeof(io_uring_probe_op);
+    auto storage = std::make_unique<unsigned char[]>(probe_size);
+    std::memset(storage.get(), 0, probe_size);
+    auto *probe = reinterpret_cast<io_uring_probe *>(storage.get());
+    if (io_uring_register(m_ring_fd, IORING_REGISTER_PROBE, probe, PROBE_OPS) <
+        0) {
+        const int error = errno;
+        release();
+        return -error;
+    }
+    for (uint8_t opcode : opcodes) {
+        if (opcode > probe->last_op ||
+            (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED) == 0) {
+            release();
+            return -EOPNOTSUPP;
+        }
+    }
+
+    return 0;
+}
+
+io_uring_sqe *IoUring::get_sqe()
+{
+    if (m_sqe_tail - load_acquire(m_sq_head) >= m_sq_entries) {
+        return nullptr;
+    }
+
+    io_uring_sqe *sqe = &m_sqes[m_sqe_tail & m_sq_mask];
+    ++m_sqe_tail;
+    std::memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int IoUring::submit(unsigned wait_for)
+{
+    // Publish everything prepared since the last call
+    unsigned tail = *m_sq_tail;
+    while (m_sqe_head != m_sqe_tail) {
+        m_sq_array[tail & m_sq_mask] = m_sqe_head & m_sq_mask;
+        ++tail;
+        ++m_sqe_head;
+    }
+    store_release(m_sq_tail, tail);
+
+    // Entries the kernel refused last time are still in the ring
+    const unsigned to_submit = tail - load_acquire(m_sq_head);
+    if (to_submit == 0 && wait_for == 0) {
+        return 0;
+    }
+
+    const int result =
+        io_uring_enter(m_ring_fd,
+                       to_submit,
+                       wait_for,
+                       wait_for != 0 ? IORING_ENTER_GETEVENTS : 0);
+    return result < 0 ? -errno : result;
+}
+
+int IoUring::register_buffers(const std::vector<iovec> &buffers)
+{
+    const int result =
+        io_uring_register(m_ring_fd,
+                          IORING_REGISTER_BUFFERS,
+                          buffers.data(),
+                          static_cast<unsigned>(buffers.size()));
+    return result < 0 ? -errno : 0;
+}
+
+int IoUring::register_file_slots(unsigned count)
+{
+    const std::vector<int> slots(count, -1);
+    const int result = io_uring_register(
+        m_ring_fd, IORING_REGISTER_FILES, slots.data(), count);
+    return result < 0 ? -errno : 0;
+}
+
+bool IoUring::peek_completion(uint64_t &user_data,
+                              int32_t &res,
+                              uint32_t &flags)
+{
+    const unsigned head = *m_cq_head;
+    if (head == load_acquire(m_cq_tail)) {
+        return false;
+    }
+
+    const io_uring_cqe &cqe = m_cqes[head & m_cq_mask];
+    user_data = cqe.user_data;
+    res = cqe.res;
+    flags = cqe.flags;
+    store_release(m_cq_head, head + 1);
+    return true;
+}
+
+void IoUring::release()
+{
+    if (m_sqes != nullptr) {
+        munmap(m_sqes, m_sqes_size);
+        m_sqes = nullptr;
+    }
+    if (m_cq_ring != nullptr && m_cq_ring != m_sq_ring) {
+        munmap(m_cq_ring, m_cq_ring_size);
+    }
+    m_cq_ring = nullptr;
+    if (m_sq_ring != nullptr) {
+        munmap(m_sq_ring, m_sq_ring_size);
+        m_sq_ring = nullptr;
+    }
+    if (m_ring_fd >= 0) {
+        // Closing the ring also drops registered buffers and files
+        close(m_ring_fd);
+        m_ring_fd = -1;
+    }
+}
+
+} // namespace server
+} // namespace fenris
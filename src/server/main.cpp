@@ -1,21 +1,329 @@
 #include "common/logging.hpp"
+#include "server/server.hpp"
+#include <argparse/argparse.hpp>
+#include <csignal>
 #include <iostream>
+#include <pthread.h>
+#include <stdexcept>
+
+/**
+ * Set up command line argument parser with all available options
+ */
+void setup_argument_parser(argparse::ArgumentParser &program)
+{
+    program.add_argument("--host", "-H")
+        .help("Address to listen on")
+        .default_value(std::string("0.0.0.0"));
+
+    program.add_argument("--port", "-p")
+        .help("Port to listen on")
+        .default_value(std::string("5555"));
+
+    program.add_argument("--root", "-r")
+        .help("Directory served to clients as /")
+        .default_value(std::string("."));
+
+    program.add_argument("--reactor")
+        .help("Multiplex clients on epoll loops instead of a thread each")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--io-threads")
+        .help("Reactor event loops, 0 for one per core")
+        .default_value(size_t{0})
+        .scan<'u', size_t>();
+
+    program.add_argument("--worker-threads")
+        .help("Threads running requests, 0 for one per core")
+        .default_value(size_t{0})
+        .scan<'u', size_t>();
+
+    program.add_argument("--cache-mb")
+        .help("Megabytes of file content to cache, 0 to disable the cache")
+        .default_value(size_t{256})
+        .scan<'u', size_t>();
+
+    program.add_argument("--preload")
+        .help("Directories to load into the content cache before listening")
+        .default_value(std::vector<std::string>{})
+        .append();
+
+    program.add_argument("--acceptors")
+        .help("Listening sockets sharing the port through SO_REUSEPORT, each "
+              "accepting on its own thread, 0 for one per core")
+        .default_value(size_t{1})
+        .scan<'u', size_t>();
+
+    program.add_argument("--listen-backlog")
+        .help("Connections that may wait to be accepted")
+        .default_value(fenris::server::DEFAULT_LISTEN_BACKLOG)
+        .scan<'i', int>();
+
+    program.add_argument("--reuse-port")
+        .help("Bind with SO_REUSEPORT so several servers share the port")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--cpu-affinity")
+        .help("Pin worker and event loop threads to cores")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--max-message-mb")
+        .help("Largest request a client may send, in megabytes")
+        .default_value(fenris::server::DEFAULT_MAX_MESSAGE_SIZE / 1024 / 1024)
+        .scan<'u', size_t>();
+
+    program.add_argument("--memory-budget-mb")
+        .help("Megabytes of requests held across all clients before reading "
+              "pauses, 0 for no limit")
+        .default_value(size_t{1024})
+        .scan<'u', size_t>();
+
+    program.add_argument("--client-ops-per-sec")
+        .help("Requests per second each connection may send, 0 for no limit")
+        .default_value(0.0)
+        .scan<'g', double>();
+
+    program.add_argument("--client-mb-per-sec")
+        .help("Megabytes per second each connection may move, 0 for no "
+              "limit")
+        .default_value(0.0)
+        .scan<'g', double>();
+
+    program.add_argument("--tenant-ops-per-sec")
+        .help("Requests per second all connections from one address may "
+              "send, 0 for no limit")
+        .default_value(0.0)
+        .scan<'g', double>();
+
+    program.add_argument("--tenant-mb-per-sec")
+        .help("Megabytes per second all connections from one address may "
+              "move, 0 for no limit")
+        .default_value(0.0)
+        .scan<'g', double>();
+
+    program.add_argument("--drain-seconds")
+        .help("On shutdown, seconds requests in flight get to finish before "
+              "their clients are disconnected, 0 to disconnect at once")
+        .default_value(uint32_t{10})
+        .scan<'u', uint32_t>();
+
+    program.add_argument("--chunk-store")
+        .help("Directory of a store deduplicating written files")
+        .default_value(std::string(""));
+
+    program.add_argument("--cold-tier")
+        .help("Directory, e.g. a mounted bucket, that rarely read files move "
+              "to")
+        .default_value(std::string(""));
+
+    program.add_argument("--cold-after-hours")
+        .help("Hours a file goes unread before it moves to the cold tier")
+        .default_value(uint32_t{24})
+        .scan<'u', uint32_t>();
+
+    program.add_argument("--hot-tier-gb")
+        .help("Gigabytes of files kept local, the least read move to the "
+              "cold tier beyond it, 0 for no limit")
+        .default_value(size_t{0})
+        .scan<'u', size_t>();
+
+    program.add_argument("--no-readahead")
+        .help("Do not prefetch ahead of clients reading files in order")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--tree-threads")
+        .help("Threads walking trees for du, cptree, rmtree and find, shared "
+              "by all clients, 0 for one per core")
+        .default_value(size_t{0})
+        .scan<'u', size_t>();
+
+    program.add_argument("--async-io")
+        .help("Read and write file content through io_uring, falling back to "
+              "a thread pool without it")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--durable-writes")
+        .help("Flush writes to disk before replying")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--plaintext-file-stream")
+        .help("Send file contents unencrypted to clients that ask "
+              "(trusted networks only)")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--metrics-port")
+        .help("Port serving Prometheus metrics at /metrics, none if unset")
+        .default_value(std::string(""));
+
+    program.add_argument("--trace-file")
+        .help("Write sampled request traces to this file in Chrome trace "
+              "format")
+        .default_value(std::string(""));
+
+    program.add_argument("--trace-sample-rate")
+        .help("Trace one request in this many")
+        .default_value(uint32_t{100})
+        .scan<'u', uint32_t>();
+
+    program.add_argument("--log-level")
+        .help("Logging level (trace, debug, info, warn, error, critical)")
+        .default_value(std::string("info"));
+
+    program.add_argument("--log-file")
+        .help("Path to log file")
+        .default_value(std::string("fenris_server.log"));
+
+    program.add_argument("--no-console-log")
+        .help("Disable logging to console")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--file-log")
+        .help("Enable logging to file")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--async-log")
+        .help("Format and write log lines on a background thread")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--log-queue-size")
+        .help("Log lines the background thread may fall behind by")
+        .default_value(size_t{8192})
+        .scan<'u', size_t>();
+
+    program.add_argument("--log-drop-on-overflow")
+        .help("Drop the oldest queued log lines instead of waiting when the "
+              "background thread falls behind")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--log-sample-rate")
+        .help("Write one in this many per-request log lines")
+        .default_value(uint32_t{1})
+        .scan<'u', uint32_t>();
+}
+
+/**
+ * Parse arguments and handle parsing errors
+ */
+bool parse_arguments(argparse::ArgumentParser &program, int argc, char *argv[])
+{
+    try {
+        program.parse_args(argc, argv);
+        return true;
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << program;
+        return false;
+    }
+}
+
+fenris::server::ServerConfig
+create_config(const argparse::ArgumentParser &program)
+{
+    fenris::server::ServerConfig config;
+    config.host = program.get("--host");
+    config.port = program.get("--port");
+    config.root = program.get("--root");
+    config.reactor = program.get<bool>("--reactor");
+    config.io_threads = program.get<size_t>("--io-threads");
+    config.worker_threads = program.get<size_t>("--worker-threads");
+    config.cache_bytes = program.get<size_t>("--cache-mb") * 1024 * 1024;
+    config.preload = program.get<std::vector<std::string>>("--preload");
+    config.acceptors = program.get<size_t>("--acceptors");
+    config.listen_backlog = program.get<int>("--listen-backlog");
+    config.reuse_port = program.get<bool>("--reuse-port");
+    config.cpu_affinity = program.get<bool>("--cpu-affinity");
+    config.max_message_size =
+        program.get<size_t>("--max-message-mb") * 1024 * 1024;
+    config.memory_budget =
+        program.get<size_t>("--memory-budget-mb") * 1024 * 1024;
+    config.client_limit.ops_per_second =
+        program.get<double>("--client-ops-per-sec");
+    config.client_limit.bytes_per_second =
+        program.get<double>("--client-mb-per-sec") * 1024 * 1024;
+    config.tenant_limit.ops_per_second =
+        program.get<double>("--tenant-ops-per-sec");
+    config.tenant_limit.bytes_per_second =
+        program.get<double>("--tenant-mb-per-sec") * 1024 * 1024;
+    config.drain_timeout =
+        std::chrono::seconds(program.get<uint32_t>("--drain-seconds"));
+    config.chunk_store = program.get("--chunk-store");
+    config.cold_tier = program.get("--cold-tier");
+    config.cold_after =
+        std::chrono::hours(program.get<uint32_t>("--cold-after-hours"));
+    config.hot_tier_bytes =
+        program.get<size_t>("--hot-tier-gb") * 1024 * 1024 * 1024;
+    config.readahead = !program.get<bool>("--no-readahead");
+    config.tree_threads = program.get<size_t>("--tree-threads");
+    config.async_io = program.get<bool>("--async-io");
+    config.durable_writes = program.get<bool>("--durable-writes");
+    config.plaintext_file_streaming =
+        program.get<bool>("--plaintext-file-stream");
+    config.metrics_port = program.get("--metrics-port");
+    config.trace_file = program.get("--trace-file");
+    config.trace_sample_rate = program.get<uint32_t>("--trace-sample-rate");
+    return config;
+}
 
 int main(int argc, char *argv[])
 {
-    fenris::common::LoggingConfig config;
-    config.level = fenris::common::LogLevel::INFO;
-    config.file_logging = true;
-    config.log_file_path = "fenris_server.log";
+    argparse::ArgumentParser program("fenris_server");
+    setup_argument_parser(program);
+
+    if (!parse_arguments(program, argc, argv)) {
+        return 1;
+    }
+
+    using fenris::common::AsyncOverflow;
+    fenris::common::LoggingConfig logging_base;
+    logging_base.async = program.get<bool>("--async-log");
+    logging_base.async_queue_size = program.get<size_t>("--log-queue-size");
+    logging_base.async_overflow = program.get<bool>("--log-drop-on-overflow")
+                                      ? AsyncOverflow::DROP_OLDEST
+                                      : AsyncOverflow::BLOCK;
+    logging_base.sample_rate = program.get<uint32_t>("--log-sample-rate");
 
-    if (!fenris::common::initialize_logging(config, "fenris_server")) {
+    if (!fenris::common::configure_logging(
+            program, "fenris_server", logging_base)) {
         std::cerr << "Failed to initialize logging system" << std::endl;
         return 1;
     }
 
     auto logger = fenris::common::get_logger("fenris_server");
 
+    // Blocked before any thread starts so every thread inherits the mask and
+    // the signals are only ever taken by sigwait() below
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    // A client hanging up mid-response must fail the send, not end the server
+    signal(SIGPIPE, SIG_IGN);
+
     logger->info("Fenris server starting up");
+
+    fenris::server::Server server(create_config(program));
+    if (!server.start()) {
+        return 1;
+    }
+
+    int signal_number = 0;
+    sigwait(&signals, &signal_number);
+    logger->info("received signal {}", signal_number);
+
     logger->info("Fenris server shutting down");
+    server.stop();
+    fenris::common::shutdown_logging();
     return 0;
 }
@@ -0,0 +1,112 @@
+#include "server/memory_budget.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace fenris {
+namespace server {
+
+MemoryBudget::Lease::~Lease()
+{
+    release();
+}
+
+MemoryBudget::Lease::Lease(Lease &&other) noexcept
+    : m_budget(std::exchange(other.m_budget, nullptr)),
+      m_size(std::exchange(other.m_size, 0))
+{
+}
+
+MemoryBudget::Lease &MemoryBudget::Lease::operator=(Lease &&other) noexcept
+{
+    if (this != &other) {
+        release();
+        m_budget = std::exchange(other.m_budget, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+    }
+    return *this;
+}
+
+void MemoryBudget::Lease::release()
+{
+    if (m_budget) {
+        m_budget->give_back(m_size);
+        m_budget = nullptr;
+        m_size = 0;
+    }
+}
+
+MemoryBudget::MemoryBudget(size_t limit) : m_limit(limit) {}
+
+std::optional<MemoryBudget::Lease> MemoryBudget::acquire(size_t bytes)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_closed && !fits(bytes)) {
+        ++m_stats.waits;
+        m_released.wait(lock, [&] { return m_closed || fits(bytes); });
+    }
+    if (m_closed) {
+        return std::nullopt;
+    }
+    return grant(bytes);
+}
+
+std::optional<MemoryBudget::Lease> MemoryBudget::try_acquire(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_closed) {
+        return std::nullopt;
+    }
+    if (!fits(bytes)) {
+        ++m_stats.waits;
+        return std::nullopt;
+    }
+    return grant(bytes);
+}
+
+void MemoryBudget::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+    }
+    m_released.notify_all();
+}
+
+size_t MemoryBudget::in_use() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_in_use;
+}
+
+MemoryBudgetStats MemoryBudget::get_stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+bool MemoryBudget::fits(size_t bytes) const
+{
+    // Oversized requests go alone rather than never
+    return m_in_use == 0 || bytes <= m_limit - std::min(m_in_use, m_limit);
+}
+
+MemoryBudget::Lease MemoryBudget::grant(size_t bytes)
+{
+    m_in_use += bytes;
+    ++m_stats.leases;
+    m_stats.peak_bytes = std::max<uint64_t>(m_stats.peak_bytes, m_in_use);
+    return Lease(this, bytes);
+}
+
+void MemoryBudget::give_back(size_t bytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_in_use -= bytes;
+    }
+    m_released.notify_all();
+}
+
+} // namespace server
+} // namespace fenris
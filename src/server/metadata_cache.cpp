@@ -0,0 +1,308 @@
+#include "server/metadata_cache.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace fenris {
+namespace server {
+
+using namespace common;
+
+namespace {
+
+// Directory holding path, "/" for the root and its direct children
+std::string parent_of(const std::string &path)
+{
+    const size_t slash = path.find_last_of('/');
+    if (slash == std::string::npos || slash == 0) {
+        return "/";
+    }
+    return path.substr(0, slash);
+}
+
+// Whether path is directory or lies below it
+bool is_below(const std::string &path, const std::string &directory)
+{
+    if (directory == "/") {
+        return true;
+    }
+    return path.starts_with(directory) &&
+           (path.size() == directory.size() || path[directory.size()] == '/');
+}
+
+} // namespace
+
+MetadataCache::MetadataCache(const MetadataCacheConfig &config,
+                             const std::string &logger_name)
+    : m_config(config), m_logger(get_logger(logger_name))
+{
+}
+
+std::optional<std::string>
+MetadataCache::get_file_info(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return lookup(m_file_infos, path);
+}
+
+std::optional<std::string>
+MetadataCache::get_listing(const std::string &directory,
+                           const std::string &page)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_listings.find(directory);
+    if (it == m_listings.end()) {
+        ++m_stats.misses;
+        return std::nullopt;
+    }
+
+    auto bytes = lookup(it->second, page);
+    if (it->second.empty()) {
+        m_listings.erase(it);
+    }
+    return bytes;
+}
+
+uint64_t MetadataCache::generation() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_generation;
+}
+
+void MetadataCache::put_file_info(const std::string &path,
+                                  const fenris::FileInfo &file_info,
+                                  uint64_t generation)
+{
+    std::string bytes = file_info.SerializeAsString();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (generation != m_generation) {
+        return;
+    }
+    if (!m_file_infos.contains(path) && !make_room()) {
+        return;
+    }
+    auto [it, inserted] = m_file_infos.try_emplace(path);
+    if (inserted) {
+        ++m_entry_count;
+    }
+    it->second = Entry{std::move(bytes), Clock::now() + m_config.ttl};
+}
+
+void MetadataCache::put_listing(const std::string &directory,
+                                const std::string &page,
+                                const fenris::DirectoryListing &listing,
+                                uint64_t generation)
+{
+    std::string bytes = listing.SerializeAsString();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (generation != m_generation) {
+        return;
+    }
+    auto directory_it = m_listings.find(directory);
+    const bool cached = directory_it != m_listings.end() &&
+                        directory_it->second.contains(page);
+    // Making room may drop whole directories, so look them up again after
+    if (!cached && !make_room()) {
+        return;
+    }
+    auto [it, inserted] = m_listings[directory].try_emplace(page);
+    if (inserted) {
+        ++m_entry_count;
+    }
+    it->second = Entry{std::move(bytes), Clock::now() + m_config.ttl};
+}
+
+void MetadataCache::invalidate(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_generation;
+    erase_file_info(path);
+    erase_listings(parent_of(path));
+}
+
+void MetadataCache::invalidate_entry(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_generation;
+    const std::string parent = parent_of(path);
+    erase_file_info(path);
+    erase_listings(path);
+    erase_file_info(parent);
+    erase_listings(parent);
+}
+
+void MetadataCache::invalidate_prefix(const std::string &directory)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_generation;
+
+    std::vector<std::string> paths;
+    for (const auto &[path, entry] : m_file_infos) {
+        if (is_below(path, directory)) {
+            paths.push_back(path);
+        }
+    }
+    for (const auto &path : paths) {
+        erase_file_info(path);
+    }
+
+    paths.clear();
+    for (const auto &[path, pages] : m_listings) {
+        if (is_below(path, directory)) {
+            paths.push_back(path);
+        }
+    }
+    for (const auto &path : paths) {
+        erase_listings(path);
+    }
+
+    if (directory != "/") {
+        const std::string parent = parent_of(directory);
+        erase_file_info(parent);
+        erase_listings(parent);
+    }
+}
+
+void MetadataCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_generation;
+    m_stats.invalidations += m_entry_count;
+    m_file_infos.clear();
+    m_listings.clear();
+    m_entry_count = 0;
+}
+
+bool MetadataCache::watch(const std::string &root)
+{
+    std::string prefix = root;
+    while (prefix.size() > 1 && prefix.back() == '/') {
+        prefix.pop_back();
+    }
+
+    // The watcher reports local paths, keys are relative to the root
+    auto watcher = std::make_unique<FileWatcher>(
+        prefix,
+        [this, prefix](const std::string &local_path, bool is_directory) {
+            const std::string path = local_path.size() > prefix.size()
+                                         ? local_path.substr(prefix.size())
+                                         : "/";
+            if (is_directory) {
+                invalidate_prefix(path);
+            } else {
+                invalidate_entry(path);
+            }
+        },
+        "ServerMetadataWatcher");
+    if (!watcher->start()) {
+        m_logger->error("failed to watch {} for metadata invalidation", root);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_watcher_mutex);
+    m_watcher = std::move(watcher);
+    m_logger->info("invalidating metadata on changes below {}", root);
+    return true;
+}
+
+void MetadataCache::stop_watching()
+{
+    std::unique_ptr<FileWatcher> watcher;
+    {
+        std::lock_guard<std::mutex> lock(m_watcher_mutex);
+        watcher.swap(m_watcher);
+    }
+    if (watcher) {
+        watcher->stop();
+    }
+}
+
+size_t MetadataCache::get_entry_count() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entry_count;
+}
+
+MetadataCacheStats MetadataCache::get_stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+std::optional<std::string> MetadataCache::lookup(Entries &entries,
+                                                 const std::string &key)
+{
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        ++m_stats.misses;
+        return std::nullopt;
+    }
+    if (Clock::now() >= it->second.expires) {
+        entries.erase(it);
+        --m_entry_count;
+        ++m_stats.expirations;
+        ++m_stats.misses;
+        return std::nullopt;
+    }
+
+    ++m_stats.hits;
+    return it->second.bytes;
+}
+
+bool MetadataCache::make_room()
+{
+    if (m_entry_count < m_config.max_entries) {
+        return true;
+    }
+
+    // Nothing expired since the last sweep, don't scan everything again
+    const Clock::time_point now = Clock::now();
+    if (now < m_next_sweep) {
+        return false;
+    }
+
+    m_next_sweep = Clock::time_point::max();
+    const auto drop_expired = [&](Entries &entries) {
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (now >= it->second.expires) {
+                it = entries.erase(it);
+                --m_entry_count;
+                ++m_stats.expirations;
+            } else {
+                m_next_sweep = std::min(m_next_sweep, it->second.expires);
+                ++it;
+            }
+        }
+    };
+
+    drop_expired(m_file_infos);
+    for (auto it = m_listings.begin(); it != m_listings.end();) {
+        drop_expired(it->second);
+        it = it->second.empty() ? m_listings.erase(it) : std::next(it);
+    }
+    return m_entry_count < m_config.max_entries;
+}
+
+void MetadataCache::erase_file_info(const std::string &path)
+{
+    if (m_file_infos.erase(path) != 0) {
+        --m_entry_count;
+        ++m_stats.invalidations;
+    }
+}
+
+void MetadataCache::erase_listings(const std::string &directory)
+{
+    auto it = m_listings.find(directory);
+    if (it == m_listings.end()) {
+        return;
+    }
+    m_entry_count -= it->second.size();
+    m_stats.invalidations += it->second.size();
+    m_listings.erase(it);
+}
+
+} // namespace server
+} // namespace fenris
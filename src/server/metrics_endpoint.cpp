@@ -0,0 +1,229 @@
+#include "server/metrics_endpoint.hpp"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace fenris {
+namespace server {
+
+using namespace common;
+
+namespace {
+
+// Longest request head read from a scraper, anything longer is refused
+constexpr size_t MAX_REQUEST_HEAD = 8 * 1024;
+
+// A scraper that stalls longer than this is dropped, so it cannot hold up
+// the next one
+constexpr int SCRAPE_TIMEOUT_SECONDS = 5;
+
+bool send_all(int fd, std::string_view data)
+{
+    while (!data.empty()) {
+        ssize_t sent = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        data.remove_prefix(static_cast<size_t>(sent));
+    }
+    return true;
+}
+
+std::string http_response(const std::string &status,
+                          const std::string &content_type,
+                          const std::string &body)
+{
+    return "HTTP/1.1 " + status + "\r\nContent-Type: " + content_type +
+           "\r\nContent-Length: " + std::to_string(body.size()) +
+           "\r\nConnection: close\r\n\r\n" + body;
+}
+
+} // namespace
+
+MetricsEndpoint::MetricsEndpoint(const std::string &host,
+                                 const std::string &port,
+                                 MetricsRegistry &registry,
+                                 const std::string &logger_name)
+    : m_host(host), m_port(port), m_registry(registry),
+      m_logger(get_logger(logger_name))
+{
+}
+
+MetricsEndpoint::~MetricsEndpoint()
+{
+    stop();
+}
+
+bool MetricsEndpoint::start()
+{
+    if (m_running) {
+        return true;
+    }
+
+    struct addrinfo hints {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    struct addrinfo *servinfo = nullptr;
+    int rv = getaddrinfo(m_host.c_str(), m_port.c_str(), &hints, &servinfo);
+    if (rv != 0) {
+        m_logger->error("metrics endpoint getaddrinfo: {}", gai_strerror(rv));
+        return false;
+    }
+
+    for (struct addrinfo *p = servinfo; p != nullptr; p = p->ai_next) {
+        int fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if (fd == -1) {
+            continue;
+        }
+        int yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        if (bind(fd, p->ai_addr, p->ai_addrlen) == 0 && listen(fd, 16) == 0) {
+            m_listen_socket = fd;
+            break;
+        }
+        close(fd);
+    }
+    freeaddrinfo(servinfo);
+
+    if (m_listen_socket == -1) {
+        m_logger->error("metrics endpoint could not listen on {}:{}: {}",
+                        m_host,
+                        m_port,
+                        strerror(errno));
+        return false;
+    }
+
+    struct sockaddr_storage bound {};
+    socklen_t bound_length = sizeof(bound);
+    getsockname(m_listen_socket, (struct sockaddr *)&bound, &bound_length);
+    m_bound_port =
+        ntohs(bound.ss_family == AF_INET6
+                  ? ((struct sockaddr_in6 *)&bound)->sin6_port
+                  : ((struct sockaddr_in *)&bound)->sin_port);
+
+    m_running = true;
+    m_thread = std::thread(&MetricsEndpoint::serve, this);
+    m_logger->info("serving metrics on {}:{}/metrics", m_host, m_bound_port);
+    return true;
+}
+
+void MetricsEndpoint::stop()
+{
+    if (!m_running) {
+        return;
+    }
+    m_running = false;
+
+    // Wakes the thread blocked in accept()
+    shutdown(m_listen_socket, SHUT_RDWR);
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    close(m_listen_socket);
+    m_listen_socket = -1;
+    m_bound_port = 0;
+}
+
+bool MetricsEndpoint::is_running() const
+{
+    return m_running;
+}
+
+uint16_t MetricsEndpoint::port() const
+{
+    return m_bound_port;
+}
+
+void MetricsEndpoint::serve()
+{
+    while (m_running) {
+        int client_fd = accept(m_listen_socket, nullptr, nullptr);
+        if (!m_running) {
+            if (client_fd != -1) {
+                close(client_fd);
+            }
+            break;
+        }
+        if (client_fd == -1) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                m_logger->error("metrics endpoint accept failed: {}",
+                                strerror(errno));
+            }
+            continue;
+        }
+        answer(client_fd);
+        close(client_fd);
+    }
+}
+
+void MetricsEndpoint::answer(int client_fd)
+{
+    struct timeval timeout {};
+    timeout.tv_sec = SCRAPE_TIMEOUT_SECONDS;
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // Only the request line matters, the rest of the head is read so the
+    // client is not reset while still sending it
+    std::string head;
+    char chunk[1024];
+    while (head.find("\r\n\r\n") == std::string::npos &&
+           head.size() < MAX_REQUEST_HEAD) {
+        ssize_t received = recv(client_fd, chunk, sizeof(chunk), 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            break;
+        }
+        head.append(chunk, static_cast<size_t>(received));
+    }
+
+    const std::string_view line =
+        std::string_view(head).substr(0, head.find("\r\n"));
+    const size_t method_end = line.find(' ');
+    const size_t target_end = line.find(' ', method_end + 1);
+    if (method_end == std::string_view::npos ||
+        target_end == std::string_view::npos) {
+        send_all(
+            client_fd,
+            http_response("400 Bad Request", "text/plain", "bad request\n"));
+        return;
+    }
+
+    const std::string_view method = line.substr(0, method_end);
+    std::string_view target =
+        line.substr(method_end + 1, target_end - method_end - 1);
+    target = target.substr(0, target.find('?'));
+
+    if (target != "/metrics") {
+        send_all(client_fd,
+                 http_response("404 Not Found", "text/plain", "not found\n"));
+        return;
+    }
+    if (method != "GET") {
+        send_all(client_fd,
+                 http_response("405 Method Not Allowed",
+                               "text/plain",
+                               "only GET is supported\n"));
+        return;
+    }
+
+    send_all(client_fd,
+             http_response("200 OK",
+                           "text/plain; version=0.0.4; charset=utf-8",
+                           m_registry.render()));
+}
+
+} // namespace server
+} // namespace fenris
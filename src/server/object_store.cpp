@@ -0,0 +1,187 @@
+#include "server/object_store.hpp"
+
+#include <cerrno>
+#include <filesystem>
+#include <system_error>
+#include <unistd.h>
+
+namespace fenris {
+namespace server {
+
+namespace fs = std::filesystem;
+
+using namespace common;
+
+namespace {
+
+// Objects are written here first, keys may not start with a dot so none
+// lives below it
+constexpr const char *INCOMING = ".incoming";
+
+FileOperationResult errno_result(int error)
+{
+    return system_error_to_file_operation_result(
+        std::error_code(error, std::generic_category()));
+}
+
+} // namespace
+
+DirectoryObjectStore::DirectoryObjectStore(const std::string &directory,
+                                           bool sync)
+    : m_directory(directory), m_sync(sync)
+{
+    std::error_code ec;
+    fs::create_directories(fs::path(m_directory) / INCOMING, ec);
+    m_open = !ec;
+}
+
+bool DirectoryObjectStore::is_open() const
+{
+    return m_open;
+}
+
+std::string DirectoryObjectStore::object_path(const std::string &key) const
+{
+    if (key.empty() || key.front() == '.' || key.front() == '/') {
+        return "";
+    }
+    for (const auto &component : fs::path(key)) {
+        if (component == "." || component == ".." || component.empty()) {
+            return "";
+        }
+    }
+    return m_directory + "/" + key;
+}
+
+FileOperationResult DirectoryObjectStore::put(const std::string &key,
+                                              std::span<const uint8_t> data)
+{
+    const std::string path = object_path(key);
+    if (path.empty()) {
+        return FileOperationResult::INVALID_PATH;
+    }
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+    if (ec) {
+        return system_error_to_file_operation_result(ec);
+    }
+
+    std::string temp_path;
+    auto [fd, result] = create_temp_file(
+        (fs::path(m_directory) / INCOMING / "object").string(), temp_path);
+    if (result != FileOperationResult::SUCCESS) {
+        return result;
+    }
+    while (!data.empty()) {
+        const ssize_t written = ::write(fd, data.data(), data.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            result = errno_result(errno);
+            break;
+        }
+        data = data.subspan(static_cast<size_t>(written));
+    }
+    if (result == FileOperationResult::SUCCESS && m_sync && ::fsync(fd) != 0) {
+        result = errno_result(errno);
+    }
+    if (::close(fd) != 0 && result == FileOperationResult::SUCCESS) {
+        result = FileOperationResult::IO_ERROR;
+    }
+    if (result == FileOperationResult::SUCCESS &&
+        ::rename(temp_path.c_str(), path.c_str()) != 0) {
+        result = errno_result(errno);
+    }
+    if (result != FileOperationResult::SUCCESS) {
+        ::unlink(temp_path.c_str());
+    }
+    return result;
+}
+
+std::pair<Buffer, FileOperationResult>
+DirectoryObjectStore::get(const std::string &key)
+{
+    const std::string path = object_path(key);
+    if (path.empty()) {
+        return {Buffer(), FileOperationResult::INVALID_PATH};
+    }
+    // Objects are replaced by rename and never truncated, so mapping them
+    // is safe
+    return read_file_buffer(path);
+}
+
+std::pair<Buffer, FileOperationResult> DirectoryObjectStore::get_range(
+    const std::string &key, uint64_t offset, size_t length)
+{
+    const std::string path = object_path(key);
+    if (path.empty()) {
+        return {Buffer(), FileOperationResult::INVALID_PATH};
+    }
+    return read_file_range(path, offset, length);
+}
+
+FileOperationResult DirectoryObjectStore::remove(const std::string &key)
+{
+    const std::string path = object_path(key);
+    if (path.empty()) {
+        return FileOperationResult::INVALID_PATH;
+    }
+    if (::unlink(path.c_str()) != 0) {
+        return errno_result(errno);
+    }
+
+    // Directories left empty go as well, rmdir() refuses the others
+    fs::path parent = fs::path(path).parent_path();
+    while (parent.string().size() > m_directory.size() &&
+           ::rmdir(parent.c_str()) == 0) {
+        parent = parent.parent_path();
+    }
+    return FileOperationResult::SUCCESS;
+}
+
+std::pair<std::vector<std::string>, FileOperationResult>
+DirectoryObjectStore::list(const std::string &prefix)
+{
+    // Only the directory the prefix ends in has to be walked
+    const size_t slash = prefix.rfind('/');
+    const std::string base =
+        slash == std::string::npos ? "" : prefix.substr(0, slash);
+    if (!base.empty() && object_path(base).empty()) {
+        return {{}, FileOperationResult::INVALID_PATH};
+    }
+
+    std::vector<std::string> keys;
+    std::error_code ec;
+    fs::recursive_directory_iterator it(fs::path(m_directory) / base, ec);
+    if (ec) {
+        // Nothing was ever stored below the prefix
+        return {keys,
+                ec == std::errc::no_such_file_or_directory
+                    ? FileOperationResult::SUCCESS
+                    : system_error_to_file_operation_result(ec)};
+    }
+    for (; !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (it.depth() == 0 && base.empty() &&
+            it->path().filename() == INCOMING) {
+            it.disable_recursion_pending();
+            continue;
+        }
+        std::error_code type_ec;
+        if (!it->is_regular_file(type_ec)) {
+            continue;
+        }
+        std::string key =
+            it->path().lexically_relative(m_directory).generic_string();
+        if (key.compare(0, prefix.size(), prefix) == 0) {
+            keys.push_back(std::move(key));
+        }
+    }
+    if (ec) {
+        return {std::move(keys), system_error_to_file_operation_result(ec)};
+    }
+    return {std::move(keys), FileOperationResult::SUCCESS};
+}
+
+} // namespace server
+} // namespace fenris
@@ -0,0 +1,192 @@
+#include "server/rate_limiter.hpp"
+#include "common/metrics.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace fenris {
+namespace server {
+
+using namespace common;
+
+TokenBucket::TokenBucket(double rate, double capacity)
+    : m_rate(rate), m_capacity(std::max(capacity, 1.0)), m_tokens(m_capacity),
+      m_updated(Clock::now())
+{
+}
+
+void TokenBucket::refill(Clock::time_point now)
+{
+    if (now <= m_updated) {
+        return;
+    }
+    const double elapsed =
+        std::chrono::duration<double>(now - m_updated).count();
+    m_tokens = std::min(m_capacity, m_tokens + elapsed * m_rate);
+    m_updated = now;
+}
+
+void TokenBucket::take(double tokens, Clock::time_point now)
+{
+    if (m_rate <= 0) {
+        return;
+    }
+    refill(now);
+    m_tokens -= tokens;
+}
+
+TokenBucket::Clock::time_point TokenBucket::ready_at(Clock::time_point now)
+{
+    if (m_rate <= 0) {
+        return now;
+    }
+    refill(now);
+    if (m_tokens >= 0) {
+        return now;
+    }
+    return now + std::chrono::duration_cast<Clock::duration>(
+                     std::chrono::duration<double>(-m_tokens / m_rate));
+}
+
+ClientQuota::Buckets::Buckets(const RateLimit &limit)
+    : ops(limit.ops_per_second, limit.ops_per_second * limit.burst_seconds),
+      bytes(limit.bytes_per_second,
+            limit.bytes_per_second * limit.burst_seconds)
+{
+}
+
+ClientQuota::ClientQuota(uint32_t client_id,
+                         const RateLimit &limit,
+                         std::shared_ptr<Tenant> tenant,
+                         Histogram &throttle_seconds)
+    : m_client_id(client_id), m_buckets(limit), m_tenant(std::move(tenant)),
+      m_throttle_seconds(&throttle_seconds)
+{
+}
+
+void ClientQuota::charge(uint64_t ops, uint64_t bytes)
+{
+    const Clock::time_point now = Clock::now();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_buckets.ops.take(static_cast<double>(ops), now);
+        m_buckets.bytes.take(static_cast<double>(bytes), now);
+    }
+    std::lock_guard<std::mutex> lock(m_tenant->mutex);
+    m_tenant->buckets.ops.take(static_cast<double>(ops), now);
+    m_tenant->buckets.bytes.take(static_cast<double>(bytes), now);
+}
+
+ClientQuota::Clock::time_point ClientQuota::ready_at()
+{
+    const Clock::time_point now = Clock::now();
+    Clock::time_point ready;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ready = std::max(m_buckets.ops.ready_at(now),
+                         m_buckets.bytes.ready_at(now));
+    }
+    std::lock_guard<std::mutex> lock(m_tenant->mutex);
+    return std::max({ready,
+                     m_tenant->buckets.ops.ready_at(now),
+                     m_tenant->buckets.bytes.ready_at(now)});
+}
+
+void ClientQuota::record_throttle(Clock::duration waited)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_stats.throttles;
+        m_stats.throttled += waited;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_tenant->mutex);
+        ++m_tenant->stats.throttles;
+        m_tenant->stats.throttled += waited;
+    }
+    m_throttle_seconds->observe(waited);
+}
+
+ThrottleStats ClientQuota::get_stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+RateLimiter::RateLimiter(const RateLimit &per_client,
+                         const RateLimit &per_tenant)
+    : m_per_client(per_client), m_per_tenant(per_tenant),
+      m_throttle_seconds(&MetricsRegistry::global().histogram(
+          "fenris_throttle_seconds",
+          "Time a client's next request was held back by rate limits"))
+{
+}
+
+std::shared_ptr<ClientQuota> RateLimiter::open(uint32_t client_id,
+                                               const std::string &tenant)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Entries of tenants and clients that are gone are dropped whenever the
+    // table doubled, which keeps accepting a connection amortized O(1)
+    if (m_clients.size() >= m_sweep_at) {
+        std::erase_if(m_tenants,
+                      [](const auto &entry) { return entry.second.expired(); });
+        std::erase_if(m_clients,
+                      [](const auto &entry) { return entry.second.expired(); });
+        m_sweep_at = std::max<size_t>(64, 2 * m_clients.size());
+    }
+
+    std::shared_ptr<ClientQuota::Tenant> shared = m_tenants[tenant].lock();
+    if (!shared) {
+        shared = std::make_shared<ClientQuota::Tenant>(tenant, m_per_tenant);
+        m_tenants[tenant] = shared;
+    }
+
+    std::shared_ptr<ClientQuota> quota(new ClientQuota(
+        client_id, m_per_client, std::move(shared), *m_throttle_seconds));
+    m_clients[client_id] = quota;
+    return quota;
+}
+
+std::unordered_map<uint32_t, ThrottleStats> RateLimiter::get_stats()
+{
+    std::vector<std::shared_ptr<ClientQuota>> quotas;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto &[client_id, weak] : m_clients) {
+            if (auto quota = weak.lock()) {
+                quotas.push_back(std::move(quota));
+            }
+        }
+    }
+
+    std::unordered_map<uint32_t, ThrottleStats> stats;
+    for (const auto &quota : quotas) {
+        stats[quota->client_id()] = quota->get_stats();
+    }
+    return stats;
+}
+
+std::unordered_map<std::string, ThrottleStats> RateLimiter::get_tenant_stats()
+{
+    std::vector<std::shared_ptr<ClientQuota::Tenant>> tenants;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto &[name, weak] : m_tenants) {
+            if (auto tenant = weak.lock()) {
+                tenants.push_back(std::move(tenant));
+            }
+        }
+    }
+
+    std::unordered_map<std::string, ThrottleStats> stats;
+    for (const auto &tenant : tenants) {
+        std::lock_guard<std::mutex> lock(tenant->mutex);
+        stats[tenant->name] = tenant->stats;
+    }
+    return stats;
+}
+
+} // namespace server
+} // namespace fenris
@@ -0,0 +1,775 @@
+#include "server/reactor.hpp"
+#include "common/logging.hpp"
+#include "common/network_utils.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <initializer_list>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <utility>
+
+namespace fenris {
+namespace server {
+
+using namespace common;
+using namespace common::network;
+
+namespace {
+// Maximum number of events drained per epoll_wait call
+constexpr int MAX_EVENTS = 64;
+
+// How often a loop with paused connections checks the memory budget again
+constexpr int PAUSED_RETRY_MS = 5;
+
+/**
+ * Build iovecs for the parts of a frame that have not been transferred yet
+ * @param iov Output array with room for one entry per part
+ * @param parts Buffers in wire order
+ * @param done Number of bytes already transferred across all parts
+ * @return Number of iovecs filled
+ */
+size_t pending_iovecs(struct iovec *iov,
+                      std::initializer_list<std::pair<uint8_t *, size_t>> parts,
+                      size_t done)
+{
+    size_t count = 0;
+    for (const auto &[data, size] : parts) {
+        if (done >= size) {
+            done -= size;
+            continue;
+        }
+        iov[count].iov_base = data + done;
+        iov[count].iov_len = size - done;
+        ++count;
+        done = 0;
+    }
+    return count;
+}
+} // namespace
+
+Reactor::Reactor(ConnectionManager &manager,
+                 size_t io_threads,
+                 ThreadPool &thread_pool,
+                 const std::string &logger_name)
+    : m_manager(manager), m_io_thread_count(std::max<size_t>(1, io_threads)),
+      m_thread_pool(thread_pool), m_logger(get_logger(logger_name))
+{
+}
+
+Reactor::~Reactor()
+{
+    stop();
+}
+
+bool Reactor::start()
+{
+    if (m_running) {
+        return true;
+    }
+
+    for (size_t i = 0; i < m_io_thread_count; ++i) {
+        auto loop = std::make_unique<EventLoop>();
+        loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (loop->epoll_fd == -1) {
+            m_logger->error("epoll_create1 failed: {}", strerror(errno));
+            return false;
+        }
+
+        loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loop->wake_fd == -1) {
+            m_logger->error("eventfd failed: {}", strerror(errno));
+            close(loop->epoll_fd);
+            return false;
+        }
+
+        struct epoll_event ev {};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr; // nullptr marks the wakeup descriptor
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &ev) ==
+            -1) {
+            m_logger->error("failed to register wakeup fd: {}",
+                            strerror(errno));
+            close(loop->wake_fd);
+            close(loop->epoll_fd);
+            return false;
+        }
+
+        m_loops.push_back(std::move(loop));
+    }
+
+    m_running = true;
+
+    for (auto &loop : m_loops) {
+        loop->thread =
+            std::thread(&Reactor::run_event_loop, this, std::ref(*loop));
+    }
+
+    m_logger->info("reactor started with {} I/O threads and {} workers",
+                   m_io_thread_count,
+                   m_thread_pool.get_thread_count());
+    return true;
+}
+
+bool Reactor::pin_to_cores(size_t first_core)
+{
+    bool pinned = true;
+    for (size_t i = 0; i < m_loops.size(); ++i) {
+        pinned = pin_thread_to_core(m_loops[i]->thread, first_core + i) &&
+                 pinned;
+    }
+    if (!pinned) {
+        m_logger->warn("could not pin every I/O thread to a core");
+    }
+    return pinned;
+}
+
+void Reactor::stop()
+{
+    if (!m_running.exchange(false)) {
+        return;
+    }
+
+    // Wake up every epoll loop so it notices m_running changed
+    for (auto &loop : m_loops) {
+        wake(*loop);
+    }
+    for (auto &loop : m_loops) {
+        if (loop->thread.joinable()) {
+            loop->thread.join();
+        }
+    }
+
+    // Requests already on the pool still reference their connection
+    {
+        std::unique_lock<std::mutex> lock(m_in_flight_mutex);
+        m_in_flight_cv.wait(lock, [this] { return m_in_flight == 0; });
+    }
+
+    std::unordered_map<uint32_t, std::unique_ptr<Connection>> remaining;
+    {
+        std::lock_guard<std::mutex> lock(m_connection_mutex);
+        remaining.swap(m_connections);
+    }
+    for (auto &[client_id, connection] : remaining) {
+        m_manager.remove_client(client_id);
+        close(connection->info.socket);
+    }
+
+    for (auto &loop : m_loops) {
+        close(loop->wake_fd);
+        close(loop->epoll_fd);
+    }
+    m_loops.clear();
+    m_draining = false;
+
+    m_logger->info("reactor stopped, {} connections closed", remaining.size());
+}
+
+void Reactor::drain()
+{
+    if (!m_running || m_draining.exchange(true)) {
+        return;
+    }
+    for (auto &loop : m_loops) {
+        wake(*loop);
+    }
+}
+
+void Reactor::wake(EventLoop &loop)
+{
+    uint64_t one = 1;
+    if (write(loop.wake_fd, &one, sizeof(one)) == -1) {
+        m_logger->warn("failed to wake event loop: {}", strerror(errno));
+    }
+}
+
+bool Reactor::add_connection(int client_socket,
+                             uint32_t client_id,
+                             const std::string &address,
+                             std::optional<size_t> loop_index)
+{
+    if (!m_running || m_loops.empty()) {
+        return false;
+    }
+
+    int flags = fcntl(client_socket, F_GETFL);
+    if (flags == -1 ||
+        fcntl(client_socket, F_SETFL, flags | O_NONBLOCK) == -1) {
+        m_logger->error("failed to make client socket non-blocking: {}",
+                        strerror(errno));
+        return false;
+    }
+
+    auto connection = std::make_unique<Connection>();
+    connection->info.client_id = client_id;
+    connection->info.socket = static_cast<uint32_t>(client_socket);
+    connection->info.address = address;
+    m_manager.open_quota(connection->info);
+
+    const size_t index = loop_index ? *loop_index : m_next_loop++;
+    EventLoop &loop = *m_loops[index % m_loops.size()];
+    connection->epoll_fd = loop.epoll_fd;
+
+    Connection *raw = connection.get();
+    {
+        std::lock_guard<std::mutex> lock(m_connection_mutex);
+        m_connections[client_id] = std::move(connection);
+    }
+
+    struct epoll_event ev {};
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.ptr = raw;
+    if (epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, client_socket, &ev) == -1) {
+        m_logger->error("failed to register client {}: {}",
+                        client_id,
+                        strerror(errno));
+        std::lock_guard<std::mutex> lock(m_connection_mutex);
+        m_connections.erase(client_id);
+        return false;
+    }
+
+    return true;
+}
+
+size_t Reactor::get_connection_count() const
+{
+    std::lock_guard<std::mutex> lock(m_connection_mutex);
+    return m_connections.size();
+}
+
+void Reactor::run_event_loop(EventLoop &loop)
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    while (m_running) {
+        int count =
+            epoll_wait(loop.epoll_fd, events, MAX_EVENTS, wait_timeout(loop));
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            m_logger->error("epoll_wait failed: {}", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            if (events[i].data.ptr == nullptr) {
+                uint64_t value;
+                while (read(loop.wake_fd, &value, sizeof(value)) > 0) {
+                }
+                continue;
+            }
+            if (!m_running) {
+                break;
+            }
+            handle_event(loop,
+                         *static_cast<Connection *>(events[i].data.ptr),
+                         events[i].events);
+        }
+
+        if (!loop.paused.empty()) {
+            resume_paused(loop);
+        }
+        if (!loop.throttled.empty()) {
+            resume_throttled(loop);
+        }
+    }
+}
+
+int Reactor::wait_timeout(const EventLoop &loop) const
+{
+    int timeout = loop.paused.empty() ? -1 : PAUSED_RETRY_MS;
+    if (loop.throttled.empty()) {
+        return timeout;
+    }
+
+    auto until = loop.throttled.front().until;
+    for (const Throttled &entry : loop.throttled) {
+        until = std::min(until, entry.until);
+    }
+    // Rounded up, waking early would only go back to sleep
+    const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(
+        until - ClientQuota::Clock::now());
+    const int throttled_ms = static_cast<int>(
+        std::clamp<int64_t>(remaining.count(), 0, 60 * 1000));
+    return timeout == -1 ? throttled_ms : std::min(timeout, throttled_ms);
+}
+
+void Reactor::resume_throttled(EventLoop &loop)
+{
+    const auto now = ClientQuota::Clock::now();
+    const bool draining = m_draining;
+    std::vector<Throttled> due;
+    auto waiting = std::partition(
+        loop.throttled.begin(),
+        loop.throttled.end(),
+        [now, draining](const Throttled &entry) {
+            return !draining && entry.until > now;
+        });
+    due.assign(waiting, loop.throttled.end());
+    loop.throttled.erase(waiting, loop.throttled.end());
+
+    for (const Throttled &entry : due) {
+        if (!m_running) {
+            break;
+        }
+        entry.connection->info.quota->record_throttle(now - entry.since);
+        handle_event(loop, *entry.connection, EPOLLIN);
+    }
+}
+
+void Reactor::resume_paused(EventLoop &loop)
+{
+    // Oldest first, and whoever still does not fit queues up again
+    std::vector<Connection *> paused;
+    paused.swap(loop.paused);
+    for (Connection *connection : paused) {
+        if (!m_running) {
+            break;
+        }
+        handle_event(loop, *connection, EPOLLIN);
+    }
+}
+
+bool Reactor::submit(Connection &connection,
+                     fenris::Request request,
+                     RequestTrace trace)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+        ++m_in_flight;
+    }
+
+    const TaskPriority priority = ConnectionManager::request_priority(request);
+    const FairShare share =
+        ConnectionManager::fair_share(connection.info.client_id, request);
+    Connection *raw = &connection;
+    const auto queued_at = trace.now();
+    auto pending = m_thread_pool.submit(
+        [this,
+         raw,
+         request = std::move(request),
+         trace = std::move(trace),
+         queued_at]() mutable {
+            trace.record(TraceStage::QUEUE, queued_at, trace.now());
+            process_request(*raw, std::move(request), trace);
+
+            std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+            if (--m_in_flight == 0) {
+                m_in_flight_cv.notify_all();
+            }
+        },
+        priority,
+        share);
+
+    if (!pending.valid()) {
+        std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+        if (--m_in_flight == 0) {
+            m_in_flight_cv.notify_all();
+        }
+        return false;
+    }
+    return true;
+}
+
+void Reactor::handle_event(EventLoop &loop,
+                           Connection &connection,
+                           uint32_t events)
+{
+    if (events & EPOLLERR) {
+        FENRIS_LOG_DEBUG(m_logger,
+                         "socket error on client {}",
+                         connection.info.client_id);
+        close_connection(connection);
+        return;
+    }
+
+    switch (connection.state) {
+    case ConnectionState::RECV_PUBLIC_KEY:
+    case ConnectionState::RECV_REQUEST: {
+        // A client over its quota is not read until the quota refilled,
+        // handle_event() then runs again from resume_throttled()
+        if (connection.state == ConnectionState::RECV_REQUEST &&
+            connection.header_received == 0 && connection.info.quota &&
+            !m_draining) {
+            const auto now = ClientQuota::Clock::now();
+            const auto ready = connection.info.quota->ready_at();
+            if (ready > now) {
+                loop.throttled.push_back({&connection, now, ready});
+                break;
+            }
+        }
+
+        IoStatus status = read_frame(connection);
+        if (status == IoStatus::FAILED) {
+            close_connection(connection);
+        } else if (status == IoStatus::PAUSED) {
+            loop.paused.push_back(&connection);
+        } else if (status == IoStatus::PENDING) {
+            if (!arm(connection, EPOLLIN | EPOLLRDHUP)) {
+                close_connection(connection);
+            }
+        } else {
+            handle_frame(connection);
+        }
+        break;
+    }
+
+    case ConnectionState::SEND_PUBLIC_KEY:
+    case ConnectionState::SEND_RESPONSE:
+        flush(connection);
+        break;
+
+    default:
+        m_logger->warn("unexpected event for client {} in state {}",
+                       connection.info.client_id,
+                       static_cast<int>(connection.state));
+        break;
+    }
+}
+
+void Reactor::handle_frame(Connection &connection)
+{
+    Buffer frame = std::move(connection.in_buffer);
+    connection.in_buffer = {};
+    connection.in_received = 0;
+    connection.header_received = 0;
+
+    if (connection.state == ConnectionState::RECV_PUBLIC_KEY) {
+        auto public_key =
+            m_manager.complete_key_exchange(connection.info, frame);
+        if (!public_key.has_value()) {
+            m_logger->error("key exchange failed with client: {}",
+                            connection.info.client_id);
+            close_connection(connection);
+            return;
+        }
+
+        queue_frame(connection, {}, Buffer::wrap(std::move(*public_key)));
+        connection.state = ConnectionState::SEND_PUBLIC_KEY;
+        flush(connection);
+        return;
+    }
+
+    RequestTrace trace = Tracer::global().begin();
+    TraceContext trace_context(&trace);
+    auto request_opt =
+        m_manager.decrypt_request(connection.info,
+                                  connection.in_iv,
+                                  std::move(frame));
+    if (!request_opt.has_value()) {
+        m_logger->error("failed to decode request from client: {}",
+                        connection.info.client_id);
+        close_connection(connection);
+        return;
+    }
+
+    // Rekeying is as cheap as the initial key exchange, which also runs here
+    if (ConnectionManager::is_rekey(connection.info, *request_opt)) {
+        connection.lease.release();
+        auto message = m_manager.rekey(connection.info, *request_opt);
+        if (!message.has_value()) {
+            m_logger->error("failed to rekey client: {}",
+                            connection.info.client_id);
+            close_connection(connection);
+            return;
+        }
+        queue_frame(connection,
+                    std::move(message->iv),
+                    std::move(message->ciphertext));
+        connection.state = ConnectionState::SEND_RESPONSE;
+        flush(connection);
+        return;
+    }
+
+    ConnectionManager::adopt_trace(trace, *request_opt);
+    connection.state = ConnectionState::PROCESSING;
+    if (!submit(connection, std::move(*request_opt), std::move(trace))) {
+        m_logger->error("failed to dispatch request from client: {}",
+                        connection.info.client_id);
+        close_connection(connection);
+    }
+}
+
+void Reactor::process_request(Connection &connection,
+                              fenris::Request request,
+                              RequestTrace &trace)
+{
+    TraceContext trace_context(&trace);
+
+    // Already on a worker, so batches run their requests right here
+    ConnectionManager::Reply reply;
+    if (request.command() == fenris::RequestType::BATCH) {
+        auto [response, keep_connection] =
+            m_manager.run_batch(connection.info.socket, request, false);
+        reply.response = std::move(response);
+        reply.keep_connection = keep_connection;
+    } else {
+        reply = m_manager.answer(connection.info.socket, request);
+    }
+    connection.keep_connection = reply.keep_connection;
+    connection.lease.release();
+    reply.response.set_request_id(request.request_id());
+    m_manager.grant_lease(connection.info, reply.response);
+
+    auto message = m_manager.encrypt_response(
+        connection.info, reply.response, reply.payload);
+    if (!message.has_value()) {
+        m_logger->error("failed to encode response for client: {}",
+                        connection.info.client_id);
+        close_connection(connection);
+        return;
+    }
+
+    queue_frame(connection,
+                std::move(message->iv),
+                std::move(message->ciphertext));
+    connection.state = ConnectionState::SEND_RESPONSE;
+    {
+        // Covers what the socket takes right away, a remainder goes out
+        // from the event loop
+        TraceScope send(TraceStage::SEND);
+        flush(connection);
+    }
+    Tracer::global().finish(trace);
+}
+
+void Reactor::queue_frame(Connection &connection,
+                          std::vector<uint8_t> iv,
+                          Buffer payload)
+{
+    const size_t size = iv.size() + payload.size();
+    uint32_t size_net = htonl(static_cast<uint32_t>(size));
+    std::memcpy(connection.out_header, &size_net, sizeof(size_net));
+    connection.out_iv = std::move(iv);
+    connection.out_buffer = std::move(payload);
+    connection.out_sent = 0;
+}
+
+void Reactor::flush(Connection &connection)
+{
+    IoStatus status = write_frame(connection);
+    if (status == IoStatus::FAILED) {
+        close_connection(connection);
+        return;
+    }
+
+    if (status == IoStatus::PENDING) {
+        if (!arm(connection, EPOLLOUT | EPOLLRDHUP)) {
+            close_connection(connection);
+        }
+        return;
+    }
+
+    connection.out_iv = {};
+    connection.out_buffer = {};
+    connection.out_sent = 0;
+
+    if (connection.state == ConnectionState::SEND_RESPONSE &&
+        !connection.keep_connection) {
+        close_connection(connection);
+        return;
+    }
+
+    // A refused resumption is followed by a full key exchange
+    if (connection.state == ConnectionState::SEND_PUBLIC_KEY &&
+        !connection.info.session) {
+        connection.state = ConnectionState::RECV_PUBLIC_KEY;
+        if (!arm(connection, EPOLLIN | EPOLLRDHUP)) {
+            close_connection(connection);
+        }
+        return;
+    }
+
+    connection.state = ConnectionState::RECV_REQUEST;
+    connection.in_iv.resize(crypto::AES_GCM_IV_SIZE);
+    if (!arm(connection, EPOLLIN | EPOLLRDHUP)) {
+        close_connection(connection);
+    }
+}
+
+IoStatus Reactor::read_frame(Connection &connection)
+{
+    int fd = static_cast<int>(connection.info.socket);
+
+    // Prefix and IV have a fixed size, so they are read together
+    const size_t preamble = sizeof(connection.header) + connection.in_iv.size();
+    while (connection.header_received < preamble) {
+        struct iovec iov[2];
+        struct msghdr msg {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = pending_iovecs(
+            iov,
+            {{connection.header, sizeof(connection.header)},
+             {connection.in_iv.data(), connection.in_iv.size()}},
+            connection.header_received);
+
+        ssize_t received = recvmsg(fd, &msg, 0);
+        if (received > 0) {
+            connection.header_received += static_cast<size_t>(received);
+            continue;
+        }
+        if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return IoStatus::PENDING;
+        }
+        if (received == -1 && errno == EINTR) {
+            continue;
+        }
+        return IoStatus::FAILED;
+    }
+
+    uint32_t size_net;
+    std::memcpy(&size_net, connection.header, sizeof(size_net));
+    const size_t frame_size = ntohl(size_net);
+    if (frame_size < connection.in_iv.size()) {
+        m_logger->error("frame from client {} is too small to hold an IV",
+                        connection.info.client_id);
+        return IoStatus::FAILED;
+    }
+    const size_t size = frame_size - connection.in_iv.size();
+
+    const bool is_request = connection.state == ConnectionState::RECV_REQUEST;
+    const size_t max_size = is_request ? m_manager.m_max_message_size
+                                       : MAX_HANDSHAKE_FRAME_SIZE;
+    if (frame_size > max_size) {
+        m_logger->error("frame of {} bytes from client {} exceeds the limit",
+                        frame_size,
+                        connection.info.client_id);
+        return IoStatus::FAILED;
+    }
+
+    // The body is only read once the budget has room for it
+    MemoryBudget *budget = m_manager.m_memory_budget.get();
+    if (is_request && budget && !connection.lease) {
+        auto lease = budget->try_acquire(size);
+        if (!lease.has_value()) {
+            return IoStatus::PAUSED;
+        }
+        connection.lease = std::move(*lease);
+    }
+
+    while (connection.in_received < size) {
+        if (connection.in_received == connection.in_buffer.size()) {
+            try {
+                // Leased requests get their whole slab at once
+                grow_receive_buffer(connection.in_buffer,
+                                    connection.in_received,
+                                    size,
+                                    static_cast<bool>(connection.lease));
+            } catch (const std::bad_alloc &) {
+                m_logger->error("failed to allocate {} bytes for client {}",
+                                size,
+                                connection.info.client_id);
+                return IoStatus::FAILED;
+            }
+        }
+
+        ssize_t received = recv(fd,
+                                connection.in_buffer.data() +
+                                    connection.in_received,
+                                connection.in_buffer.size() -
+                                    connection.in_received,
+                                0);
+        if (received > 0) {
+            connection.in_received += static_cast<size_t>(received);
+            continue;
+        }
+        if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return IoStatus::PENDING;
+        }
+        if (received == -1 && errno == EINTR) {
+            continue;
+        }
+        return IoStatus::FAILED;
+    }
+
+    return IoStatus::COMPLETE;
+}
+
+IoStatus Reactor::write_frame(Connection &connection)
+{
+    int fd = static_cast<int>(connection.info.socket);
+    const size_t total = sizeof(connection.out_header) +
+                         connection.out_iv.size() +
+                         connection.out_buffer.size();
+
+    while (connection.out_sent < total) {
+        struct iovec iov[3];
+        struct msghdr msg {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = pending_iovecs(
+            iov,
+            {{connection.out_header, sizeof(connection.out_header)},
+             {connection.out_iv.data(), connection.out_iv.size()},
+             {connection.out_buffer.data(), connection.out_buffer.size()}},
+            connection.out_sent);
+
+        ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (sent > 0) {
+            connection.out_sent += static_cast<size_t>(sent);
+            continue;
+        }
+        if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return IoStatus::PENDING;
+        }
+        if (sent == -1 && errno == EINTR) {
+            continue;
+        }
+        return IoStatus::FAILED;
+    }
+
+    return IoStatus::COMPLETE;
+}
+
+bool Reactor::arm(Connection &connection, uint32_t events)
+{
+    struct epoll_event ev {};
+    ev.events = events | EPOLLONESHOT;
+    ev.data.ptr = &connection;
+    if (epoll_ctl(connection.epoll_fd,
+                  EPOLL_CTL_MOD,
+                  static_cast<int>(connection.info.socket),
+                  &ev) == -1) {
+        m_logger->error("failed to re-arm client {}: {}",
+                        connection.info.client_id,
+                        strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void Reactor::close_connection(Connection &connection)
+{
+    const uint32_t client_id = connection.info.client_id;
+    const int fd = static_cast<int>(connection.info.socket);
+
+    connection.state = ConnectionState::CLOSED;
+    epoll_ctl(connection.epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+
+    // Removed before it is closed, so drain() never shuts down a descriptor
+    // that was already reused
+    m_manager.remove_client(client_id);
+    close(fd);
+    FENRIS_LOG_DEBUG(m_logger, "client {} disconnected", client_id);
+
+    std::unique_ptr<Connection> owned;
+    {
+        std::lock_guard<std::mutex> lock(m_connection_mutex);
+        auto it = m_connections.find(client_id);
+        if (it != m_connections.end()) {
+            owned = std::move(it->second);
+            m_connections.erase(it);
+        }
+    }
+}
+
+} // namespace server
+} // namespace fenris
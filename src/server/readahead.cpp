@@ -0,0 +1,129 @@
+#include "server/readahead.hpp"
+#include "common/metrics.hpp"
+
+#include <algorithm>
+
+namespace fenris {
+namespace server {
+
+using namespace common;
+
+namespace {
+
+// Weight of the latest read in a stream's rate
+constexpr double RATE_WEIGHT = 0.25;
+
+} // namespace
+
+ReadaheadTracker::ReadaheadTracker(const ReadaheadConfig &config)
+    : m_config(config),
+      m_prefetches_total(&MetricsRegistry::global().counter(
+          "fenris_readahead_prefetches_total",
+          "Ranges prefetched ahead of sequential chunk reads")),
+      m_prefetched_bytes_total(&MetricsRegistry::global().counter(
+          "fenris_readahead_prefetched_bytes_total",
+          "Bytes prefetched ahead of sequential chunk reads"))
+{
+}
+
+Prefetch ReadaheadTracker::on_read(uint32_t client,
+                                   const std::string &path,
+                                   uint64_t offset,
+                                   uint64_t length,
+                                   Clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_streams.find(Key(client, path));
+    if (it == m_streams.end()) {
+        if (m_streams.size() >= m_config.max_streams) {
+            evict();
+        }
+        it = m_streams.emplace(Key(client, path), Stream{}).first;
+    }
+    Stream &stream = it->second;
+
+    // Pipelined reads of the next few blocks may arrive in any order
+    const uint64_t slack = std::max(stream.window, 2 * length);
+    const bool continues = stream.reads != 0 &&
+                           offset + slack >= stream.head &&
+                           offset <= stream.head + slack;
+    if (continues) {
+        ++m_stats.sequential_reads;
+        ++stream.reads;
+        const double seconds =
+            std::chrono::duration<double>(now - stream.last_read).count();
+        if (seconds > 0) {
+            const double rate = static_cast<double>(length) / seconds;
+            stream.rate = stream.rate == 0
+                              ? rate
+                              : RATE_WEIGHT * rate +
+                                    (1 - RATE_WEIGHT) * stream.rate;
+        }
+        stream.head = std::max(stream.head, offset + length);
+    } else {
+        if (stream.reads != 0) {
+            ++m_stats.random_reads;
+        }
+        stream = Stream{};
+        stream.reads = 1;
+        stream.head = offset + length;
+    }
+    stream.last_read = now;
+
+    if (stream.reads < m_config.trigger_reads) {
+        return {};
+    }
+
+    const double lead =
+        stream.rate *
+        std::chrono::duration<double>(m_config.lead_time).count();
+    stream.window = std::clamp(
+        std::max(static_cast<uint64_t>(lead), 2 * length),
+        m_config.min_window,
+        std::max(m_config.min_window, m_config.max_window));
+
+    // More is asked for once half of the window was read, so requests for
+    // small blocks do not each cost a call
+    const uint64_t end = stream.head + stream.window;
+    if (stream.prefetched >= stream.head + stream.window / 2) {
+        return {};
+    }
+    const uint64_t start = std::max(stream.prefetched, stream.head);
+    stream.prefetched = end;
+    ++m_stats.prefetches;
+    m_stats.prefetched_bytes += end - start;
+    m_prefetches_total->add();
+    m_prefetched_bytes_total->add(end - start);
+    return {start, end - start};
+}
+
+void ReadaheadTracker::forget(uint32_t client)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_streams.lower_bound(Key(client, ""));
+    while (it != m_streams.end() && it->first.first == client) {
+        it = m_streams.erase(it);
+    }
+}
+
+ReadaheadStats ReadaheadTracker::get_stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void ReadaheadTracker::evict()
+{
+    auto oldest = m_streams.begin();
+    for (auto it = m_streams.begin(); it != m_streams.end(); ++it) {
+        if (it->second.last_read < oldest->second.last_read) {
+            oldest = it;
+        }
+    }
+    if (oldest != m_streams.end()) {
+        m_streams.erase(oldest);
+    }
+}
+
+} // namespace server
+} // namespace fenris
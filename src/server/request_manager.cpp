@@ -1,7 +1,1421 @@
 #include "server/request_manager.hpp"
+#include "common/delta_sync.hpp"
+#include "common/request.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <future>
+#include <sys/stat.h>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
 
 namespace fenris {
 namespace server {
 
+namespace fs = std::filesystem;
+
+using namespace common;
+
+namespace {
+
+// Requests walking a tree, which hold the tiers only once the walk is done
+bool is_tree_request(RequestType command)
+{
+    return command == RequestType::DU || command == RequestType::COPY_TREE ||
+           command == RequestType::DELETE_TREE || command == RequestType::FIND;
+}
+
+} // namespace
+
+RequestManager::RequestManager(const std::string &root_directory,
+                               const std::string &logger_name)
+    : m_root(fs::absolute(root_directory)),
+      m_tree_pool(std::make_unique<ThreadPool>(0, "TreeWalkerPool")),
+      m_logger(get_logger(logger_name))
+{
+    auto [root_handle, result] = DirectoryHandle::open(m_root.string());
+    if (result != FileOperationResult::SUCCESS) {
+        // Resolving full paths from the working directory still works
+        m_logger->warn("could not open root directory {}: {}",
+                       m_root.string(),
+                       file_operation_result_to_string(result));
+    }
+    m_root_handle =
+        std::make_shared<const DirectoryHandle>(std::move(root_handle));
+}
+
+std::pair<fenris::Response, bool>
+RequestManager::handle_request(uint32_t client_socket,
+                               const fenris::Request &request)
+{
+    FENRIS_LOG_DEBUG_SAMPLED(m_logger,
+                             "handling request {} from client socket {}",
+                             static_cast<int>(request.command()),
+                             client_socket);
+    if (is_tree_request(request.command())) {
+        return {handle_tree(client_socket, request, nullptr), true};
+    }
+    auto tiers = hold_tiers();
+
+    switch (request.command()) {
+    case RequestType::PING:
+        return {handle_ping(request), true};
+    case RequestType::CREATE_FILE:
+        return {handle_create_file(client_socket, request), true};
+    case RequestType::READ_FILE: {
+        auto [response, content] = handle_read_file(client_socket, request);
+        response.set_data(content.data(), content.size());
+        return {std::move(response), true};
+    }
+    case RequestType::WRITE_FILE:
+        return {handle_write_file(client_socket, request), true};
+    case RequestType::APPEND_FILE:
+        return {handle_append_file(client_socket, request), true};
+    case RequestType::DELETE_FILE:
+        return {handle_delete_file(client_socket, request), true};
+    case RequestType::INFO_FILE:
+        return {handle_info_file(client_socket, request), true};
+    case RequestType::CREATE_DIR:
+        return {handle_create_dir(client_socket, request), true};
+    case RequestType::LIST_DIR:
+        return {handle_list_dir(client_socket, request), true};
+    case RequestType::CHANGE_DIR:
+        return {handle_change_dir(client_socket, request), true};
+    case RequestType::DELETE_DIR:
+        return {handle_delete_dir(client_socket, request), true};
+    case RequestType::READ_CHUNK:
+    case RequestType::READ_RANGE:
+        return {handle_read_chunk(client_socket, request), true};
+    case RequestType::WRITE_CHUNK:
+        return {handle_write_chunk(client_socket, request), true};
+    case RequestType::WRITE_AT:
+        return {handle_write_at(client_socket, request), true};
+    case RequestType::SIGNATURES:
+        return {handle_signatures(client_socket, request), true};
+    case RequestType::PATCH_FILE:
+        return {handle_patch_file(client_socket, request), true};
+    case RequestType::TERMINATE:
+        client_disconnected(client_socket);
+        return {make_success(ResponseType::TERMINATED, "Goodbye"), false};
+    default:
+        m_logger->warn("unknown request type: {}",
+                       static_cast<int>(request.command()));
+        return {make_error("Unknown request type"), true};
+    }
+}
+
+std::pair<fenris::Response, bool>
+RequestManager::handle_request_with_progress(uint32_t client_socket,
+                                             const fenris::Request &request,
+                                             const ProgressSink &progress)
+{
+    if (is_tree_request(request.command())) {
+        return {handle_tree(client_socket, request, &progress), true};
+    }
+    return handle_request(client_socket, request);
+}
+
+std::optional<std::string>
+RequestManager::stream_path(uint32_t client_socket,
+                            const fenris::Request &request)
+{
+    if (request.command() != RequestType::READ_FILE) {
+        return std::nullopt;
+    }
+    const std::string path =
+        resolve_path(client_socket, request.filename()).string();
+
+    // A placeholder holds no content, the handler reads it from the store
+    if (m_chunk_store || m_tiering) {
+        auto tiers = hold_tiers();
+        const std::string key = normalize_client_path(
+            current_directory(client_socket).path, request.filename());
+        auto [file_info, result] = get_file_info(path);
+        if (result == FileOperationResult::SUCCESS &&
+            (find_manifest(key, file_info) || find_tiered(key, file_info))) {
+            return std::nullopt;
+        }
+        // Counted before the lock is let go, so the file is not moved away
+        // before it was opened
+        if (m_tiering) {
+            m_tiering->record_access(key);
+        }
+    }
+    return path;
+}
+
+std::optional<std::pair<fenris::Response, Buffer>>
+RequestManager::file_content(uint32_t client_socket,
+                             const fenris::Request &request)
+{
+    if (request.command() != RequestType::READ_FILE) {
+        return std::nullopt;
+    }
+    auto tiers = hold_tiers();
+    return handle_read_file(client_socket, request);
+}
+
+void RequestManager::client_disconnected(uint32_t client_socket)
+{
+    if (m_readahead) {
+        m_readahead->forget(client_socket);
+    }
+
+    // Closes the directory's descriptor, unless a request still holds it,
+    // once the lock is released
+    ClientDirectory directory;
+    {
+        std::lock_guard<std::mutex> lock(m_directories_mutex);
+        auto it = m_directories.find(client_socket);
+        if (it == m_directories.end()) {
+            return;
+        }
+        directory = std::move(it->second);
+        m_directories.erase(it);
+    }
+}
+
+void RequestManager::set_durable_writes(bool enabled,
+                                        const DurableWriteConfig &config)
+{
+    m_durable_writer =
+        enabled ? std::make_unique<DurableWriter>(config) : nullptr;
+}
+
+void RequestManager::set_tree_threads(size_t threads)
+{
+    m_tree_pool = std::make_unique<ThreadPool>(threads, "TreeWalkerPool");
+}
+
+void RequestManager::set_metadata_cache(bool enabled,
+                                        const MetadataCacheConfig &config)
+{
+    if (!enabled) {
+        m_metadata_cache.reset();
+        return;
+    }
+
+    m_metadata_cache = std::make_unique<MetadataCache>(config);
+    if (!m_metadata_cache->watch(m_root.string())) {
+        m_logger->warn("metadata changed by other processes is only noticed "
+                       "once its entries expire");
+    }
+}
+
+void RequestManager::set_content_cache(bool enabled, const CacheConfig &config)
+{
+    if (!enabled) {
+        m_content_cache.reset();
+        m_content_cache_bytes = 0;
+        return;
+    }
+
+    m_content_cache =
+        std::make_unique<CacheManager>(config, "ServerContentCache");
+    m_content_cache_bytes = config.max_bytes;
+    if (!m_content_cache->watch(m_root.string())) {
+        m_logger->warn("files changed by other processes may be served from "
+                       "the cache");
+    }
+}
+
+size_t RequestManager::warm_content_cache(const std::string &directory)
+{
+    if (!m_content_cache) {
+        return 0;
+    }
+
+    const std::string client_path = normalize_client_path("/", directory);
+    const fs::path root = m_root / fs::path(client_path).relative_path();
+    TreeWalkOptions options;
+    options.pool = m_tree_pool.get();
+    TreeWalker walker(options);
+    std::atomic<size_t> files{0};
+    std::atomic<size_t> bytes{0};
+
+    walker.walk(root.string(), [&](const TreeEntry &entry) {
+        if (!S_ISREG(entry.mode) || entry.size == 0) {
+            return true;
+        }
+        // Files that would not fit in what is left are skipped, smaller ones
+        // further on may still
+        if (bytes.fetch_add(entry.size) + entry.size > m_content_cache_bytes) {
+            bytes -= entry.size;
+            return true;
+        }
+        if (m_content_cache->read_shared((root / entry.path).string())) {
+            ++files;
+        }
+        return true;
+    });
+
+    m_logger->info("warmed content cache with {} files below {}",
+                   files.load(),
+                   root.string());
+    return files;
+}
+
+CacheStats RequestManager::get_content_cache_stats() const
+{
+    return m_content_cache ? m_content_cache->get_stats() : CacheStats{};
+}
+
+bool RequestManager::set_storage_tiering(bool enabled,
+                                         const std::string &directory,
+                                         const TieringConfig &config)
+{
+    m_tiering.reset();
+    if (!enabled) {
+        return true;
+    }
+
+    auto store = std::make_unique<DirectoryObjectStore>(directory);
+    if (!store->is_open()) {
+        m_logger->warn("cold tier {} unavailable, files stay in the tree",
+                       directory);
+        return false;
+    }
+    m_tiering = std::make_unique<TieringEngine>(
+        m_root.string(), std::move(store), config);
+    return true;
+}
+
+size_t RequestManager::demote_cold_files()
+{
+    return m_tiering ? m_tiering->demote_cold() : 0;
+}
+
+TieringStats RequestManager::get_tiering_stats() const
+{
+    return m_tiering ? m_tiering->get_stats() : TieringStats{};
+}
+
+void RequestManager::set_readahead(bool enabled,
+                                   const ReadaheadConfig &config)
+{
+    m_readahead =
+        enabled ? std::make_unique<ReadaheadTracker>(config) : nullptr;
+}
+
+ReadaheadStats RequestManager::get_readahead_stats() const
+{
+    return m_readahead ? m_readahead->get_stats() : ReadaheadStats{};
+}
+
+void RequestManager::set_async_io(bool enabled, const AsyncIoConfig &config)
+{
+    if (!enabled) {
+        m_async_io.reset();
+        return;
+    }
+
+    m_async_io = std::make_unique<AsyncFileIo>(config);
+    m_async_io->start();
+}
+
+std::shared_lock<std::shared_mutex> RequestManager::hold_tiers()
+{
+    return m_tiering ? m_tiering->lock_tree()
+                     : std::shared_lock<std::shared_mutex>();
+}
+
+bool RequestManager::set_chunk_store(bool enabled,
+                                     const std::string &directory,
+                                     const ChunkStoreConfig &config)
+{
+    if (!enabled) {
+        m_chunk_store.reset();
+        return true;
+    }
+
+    m_chunk_store = std::make_unique<ChunkStore>(directory, config);
+    if (!m_chunk_store->is_open()) {
+        m_logger->warn("chunk store unavailable, files are written plain");
+        m_chunk_store.reset();
+        return false;
+    }
+    return true;
+}
+
+std::optional<fenris::ChunkManifest>
+RequestManager::find_manifest(const std::string &key,
+                              const fenris::FileInfo &file_info)
+{
+    if (!m_chunk_store || file_info.is_directory()) {
+        return std::nullopt;
+    }
+    return m_chunk_store->find(
+        key, file_info.size(), file_info.modified_time());
+}
+
+std::optional<fenris::TieredFile>
+RequestManager::find_tiered(const std::string &key,
+                            const fenris::FileInfo &file_info)
+{
+    if (!m_tiering || file_info.is_directory()) {
+        return std::nullopt;
+    }
+    return m_tiering->find(key, file_info.size(), file_info.modified_time());
+}
+
+FileOperationResult
+RequestManager::store_chunked(uint32_t client_socket,
+                              const fenris::Request &request)
+{
+    const std::string key = normalize_client_path(
+        current_directory(client_socket).path, request.filename());
+    const std::string path =
+        resolve_path(client_socket, request.filename()).string();
+    const std::string &data = request.data();
+
+    // The placeholder goes first, the manifest is matched by its time
+    auto [modified_time, result] = write_sparse_file(path, data.size());
+    if (result != FileOperationResult::SUCCESS) {
+        return result;
+    }
+    result = m_chunk_store->put(
+        key,
+        {reinterpret_cast<const uint8_t *>(data.data()), data.size()},
+        modified_time);
+    if (result != FileOperationResult::SUCCESS) {
+        m_logger->warn("could not store {} as chunks, writing it plain: {}",
+                       key,
+                       file_operation_result_to_string(result));
+        m_chunk_store->remove(key);
+        return DirectoryHandle().write_file(path, data);
+    }
+    return FileOperationResult::SUCCESS;
+}
+
+FileOperationResult
+RequestManager::materialize(uint32_t client_socket,
+                            const std::string &filename)
+{
+    if (!m_chunk_store && !m_tiering) {
+        return FileOperationResult::SUCCESS;
+    }
+
+    const std::string key =
+        normalize_client_path(current_directory(client_socket).path, filename);
+    const std::string path = resolve_path(client_socket, filename).string();
+
+    // A missing file is left for the request itself to report
+    auto [file_info, info_result] = get_file_info(path);
+    if (info_result != FileOperationResult::SUCCESS) {
+        return FileOperationResult::SUCCESS;
+    }
+    if (auto tiered = find_tiered(key, file_info)) {
+        return m_tiering->restore(*tiered);
+    }
+    auto manifest = find_manifest(key, file_info);
+    if (!manifest.has_value()) {
+        return FileOperationResult::SUCCESS;
+    }
+
+    auto [content, result] = m_chunk_store->read(*manifest);
+    if (result == FileOperationResult::SUCCESS) {
+        result = DirectoryHandle().write_file(path, content.view());
+    }
+    if (result != FileOperationResult::SUCCESS) {
+        m_logger->warn("could not restore {} from the chunk store: {}",
+                       key,
+                       file_operation_result_to_string(result));
+        return result;
+    }
+    m_chunk_store->remove(key);
+    return FileOperationResult::SUCCESS;
+}
+
+void RequestManager::release_chunks(uint32_t client_socket,
+                                    const fenris::Request &request)
+{
+    if (!m_chunk_store && !m_tiering) {
+        return;
+    }
+
+    const std::string path = normalize_client_path(
+        current_directory(client_socket).path, request.filename());
+    if (request.command() == RequestType::DELETE_DIR ||
+        request.command() == RequestType::DELETE_TREE) {
+        if (m_chunk_store) {
+            m_chunk_store->remove_prefix(path);
+        }
+        if (m_tiering) {
+            m_tiering->remove_prefix(path);
+        }
+        return;
+    }
+    // Deleted, or overwritten by content that is not in the store
+    if (m_chunk_store) {
+        m_chunk_store->remove(path);
+    }
+    if (m_tiering) {
+        m_tiering->remove(path);
+    }
+}
+
+void RequestManager::invalidate_caches(uint32_t client_socket,
+                                      const fenris::Request &request)
+{
+    if (m_content_cache) {
+        invalidate_content(client_socket, request);
+    }
+    if (!m_metadata_cache) {
+        return;
+    }
+
+    const std::string path = normalize_client_path(
+        current_directory(client_socket).path, request.filename());
+    switch (request.command()) {
+    case RequestType::CREATE_FILE:
+    case RequestType::DELETE_FILE:
+    case RequestType::CREATE_DIR:
+    case RequestType::WRITE_FILE:
+    case RequestType::PATCH_FILE:
+        // Writing a whole file may create it as well, and a patched file is
+        // a new one renamed over the old
+        m_metadata_cache->invalidate_entry(path);
+        break;
+    case RequestType::WRITE_CHUNK:
+        if (request.chunk().offset() == 0) {
+            m_metadata_cache->invalidate_entry(path);
+        } else {
+            m_metadata_cache->invalidate(path);
+        }
+        break;
+    case RequestType::DELETE_DIR:
+    case RequestType::DELETE_TREE:
+        m_metadata_cache->invalidate_prefix(path);
+        break;
+    case RequestType::COPY_TREE:
+        m_metadata_cache->invalidate_prefix(normalize_client_path(
+            current_directory(client_socket).path,
+            request.tree().destination()));
+        break;
+    default:
+        // Appends and patches change only the size and time of the file
+        m_metadata_cache->invalidate(path);
+        break;
+    }
+}
+
+void RequestManager::invalidate_content(uint32_t client_socket,
+                                        const fenris::Request &request)
+{
+    // Keys are local paths, the way the root watcher reports changes
+    const std::string path =
+        resolve_path(client_socket, request.filename()).string();
+    switch (request.command()) {
+    case RequestType::DELETE_DIR:
+    case RequestType::DELETE_TREE:
+        m_content_cache->invalidate_prefix(path);
+        break;
+    case RequestType::COPY_TREE:
+        m_content_cache->invalidate_prefix(
+            resolve_path(client_socket, request.tree().destination())
+                .string());
+        break;
+    case RequestType::CREATE_DIR:
+        break;
+    default:
+        m_content_cache->invalidate(path);
+        break;
+    }
+}
+
+fs::path RequestManager::resolve_path(uint32_t client_socket,
+                                      const std::string &path)
+{
+    const std::string client_path =
+        normalize_client_path(current_directory(client_socket).path, path);
+    return m_root / fs::path(client_path).relative_path();
+}
+
+RequestManager::ResolvedPath
+RequestManager::resolve_at(uint32_t client_socket, const std::string &path)
+{
+    const ClientDirectory directory = current_directory(client_socket);
+    const std::string client_path =
+        normalize_client_path(directory.path, path);
+
+    if (!m_root_handle->is_open()) {
+        return {m_root_handle,
+                (m_root / fs::path(client_path).relative_path()).string()};
+    }
+
+    if (directory.handle) {
+        const std::string &base = directory.path;
+        if (client_path == base) {
+            return {directory.handle, "."};
+        }
+        if (client_path.size() > base.size() &&
+            client_path.compare(0, base.size(), base) == 0 &&
+            client_path[base.size()] == '/') {
+            return {directory.handle, client_path.substr(base.size() + 1)};
+        }
+    }
+
+    return {m_root_handle, client_path == "/" ? "." : client_path.substr(1)};
+}
+
+std::pair<Buffer, FileOperationResult>
+RequestManager::read_content(const ResolvedPath &resolved)
+{
+    if (!m_async_io) {
+        // Read rather than mapped: WRITE_FILE truncates in place, and a
+        // mapping shrunk under the serializer would fault the server
+        return resolved.directory->read_file_buffer(resolved.path, 0);
+    }
+
+    // Owned by the callback, which may still be returning from set_value()
+    // when the waiting worker moves on
+    auto read = std::make_shared<
+        std::promise<std::pair<Buffer, FileOperationResult>>>();
+    auto content = read->get_future();
+    m_async_io->read_file(
+        resolved.directory,
+        resolved.path,
+        [read](Buffer buffer, FileOperationResult result) {
+            read->set_value({std::move(buffer), result});
+        });
+    return content.get();
+}
+
+std::pair<Buffer, FileOperationResult>
+RequestManager::read_range(const ResolvedPath &resolved,
+                           uint64_t offset,
+                           size_t length,
+                           uint64_t &file_size,
+                           const Prefetch &prefetch)
+{
+    if (!m_async_io) {
+        return resolved.directory->read_file_range(
+            resolved.path, offset, length, &file_size, prefetch);
+    }
+
+    auto read = std::make_shared<
+        std::promise<std::tuple<Buffer, uint64_t, FileOperationResult>>>();
+    auto chunk = read->get_future();
+    m_async_io->read_chunk(
+        resolved.directory,
+        resolved.path,
+        offset,
+        length,
+        prefetch,
+        [read](Buffer buffer, uint64_t size, FileOperationResult result) {
+            read->set_value({std::move(buffer), size, result});
+        });
+    auto [data, size, result] = chunk.get();
+    file_size = size;
+    return {std::move(data), result};
+}
+
+FileOperationResult RequestManager::write_content(const ResolvedPath &resolved,
+                                                  const std::string &data,
+                                                  bool append)
+{
+    if (!m_async_io) {
+        return append ? resolved.directory->append_file(resolved.path, data)
+                      : resolved.directory->write_file(resolved.path, data);
+    }
+
+    auto written = std::make_shared<std::promise<FileOperationResult>>();
+    auto result = written->get_future();
+    auto done = [written](FileOperationResult status) {
+        written->set_value(status);
+    };
+    if (append) {
+        m_async_io->append_file(
+            resolved.directory, resolved.path, data, std::move(done));
+    } else {
+        m_async_io->write_file(
+            resolved.directory, resolved.path, data, std::move(done));
+    }
+    return result.get();
+}
+
+fenris::Response RequestManager::handle_ping(const fenris::Request &request)
+{
+    return make_success(ResponseType::PONG, request.data());
+}
+
+fenris::Response
+RequestManager::handle_create_file(uint32_t client_socket,
+                                   const fenris::Request &request)
+{
+    auto [directory, path] = resolve_at(client_socket, request.filename());
+    auto result = directory->create_file(path);
+    if (result != FileOperationResult::SUCCESS) {
+        return make_error(result);
+    }
+    invalidate_caches(client_socket, request);
+    return make_success(ResponseType::SUCCESS,
+                        "File created: " + request.filename());
+}
+
+std::pair<fenris::Response, Buffer>
+RequestManager::handle_read_file(uint32_t client_socket,
+                                 const fenris::Request &request)
+{
+    const ResolvedPath resolved = resolve_at(client_socket, request.filename());
+
+    // Taken before the read, so a change racing with it shows up as a newer
+    // time on the next revalidation
+    auto [file_info, info_result] =
+        resolved.directory->get_file_info(resolved.path);
+    const bool has_info = info_result == FileOperationResult::SUCCESS;
+    if (has_info && request.if_modified_since() != 0 &&
+        file_info.modified_time() == request.if_modified_since()) {
+        fenris::Response response = make_success(ResponseType::FILE_CONTENT);
+        response.set_not_modified(true);
+        *response.mutable_file_info() = std::move(file_info);
+        return {std::move(response), {}};
+    }
+
+    fenris::Response response = make_success(ResponseType::FILE_CONTENT);
+    Buffer content;
+    std::optional<fenris::ChunkManifest> manifest;
+    std::optional<fenris::TieredFile> tiered;
+    if (m_chunk_store || m_tiering) {
+        const std::string key = normalize_client_path(
+            current_directory(client_socket).path, request.filename());
+        if (m_tiering) {
+            m_tiering->record_access(key);
+        }
+        if (has_info) {
+            manifest = find_manifest(key, file_info);
+            tiered = find_tiered(key, file_info);
+        }
+    }
+    if (manifest.has_value()) {
+        auto [stored, result] = m_chunk_store->read(*manifest);
+        if (result != FileOperationResult::SUCCESS) {
+            return {make_error(result), {}};
+        }
+        content = std::move(stored);
+    } else if (tiered.has_value()) {
+        auto [stored, result] = m_tiering->read(*tiered);
+        if (result != FileOperationResult::SUCCESS) {
+            return {make_error(result), {}};
+        }
+        content = std::move(stored);
+    } else {
+        std::optional<CachedFile> cached;
+        if (m_content_cache) {
+            cached = m_content_cache->read_shared(
+                resolve_path(client_socket, request.filename()).string());
+        }
+        if (cached.has_value()) {
+            content = std::move(*cached);
+        } else {
+            auto [read, result] = read_content(resolved);
+            if (result != FileOperationResult::SUCCESS) {
+                return {make_error(result), {}};
+            }
+            content = std::move(read);
+        }
+    }
+    if (has_info) {
+        *response.mutable_file_info() = std::move(file_info);
+    }
+    return {std::move(response), std::move(content)};
+}
+
+fenris::Response
+RequestManager::handle_write_file(uint32_t client_socket,
+                                  const fenris::Request &request)
+{
+    FileOperationResult result;
+    const bool chunked =
+        m_chunk_store &&
+        request.data().size() >= m_chunk_store->config().min_file_size;
+    if (chunked) {
+        result = store_chunked(client_socket, request);
+    } else if (m_durable_writer) {
+        result = m_durable_writer->write_file(
+            resolve_path(client_socket, request.filename()).string(),
+            request.data());
+    } else {
+        result = write_content(resolve_at(client_socket, request.filename()),
+                               request.data(),
+                               false);
+    }
+    if (result != FileOperationResult::SUCCESS) {
+        return make_error(result);
+    }
+    if (!chunked) {
+        release_chunks(client_socket, request);
+    }
+    invalidate_caches(client_socket, request);
+    return make_success(ResponseType::SUCCESS,
+                        "File written: " + request.filename());
+}
+
+fenris::Response
+RequestManager::handle_append_file(uint32_t client_socket,
+                                   const fenris::Request &request)
+{
+    FileOperationResult result = materialize(client_socket, request.filename());
+    if (result != FileOperationResult::SUCCESS) {
+        return make_error(result);
+    }
+    if (m_durable_writer) {
+        result = m_durable_writer->append_file(
+            resolve_path(client_socket, request.filename()).string(),
+            request.data());
+    } else {
+        result = write_content(resolve_at(client_socket, request.filename()),
+                               request.data(),
+                               true);
+    }
+    if (result != FileOperationResult::SUCCESS) {
+        return make_error(result);
+    }
+    invalidate_caches(client_socket, request);
+    return make_success(ResponseType::SUCCESS,
+                        "Appended to file: " + request.filename());
+}
+
+fenris::Response
+RequestManager::handle_delete_file(uint32_t client_socket,
+                                   const fenris::Request &request)
+{
+    auto [directory, path] = resolve_at(client_socket, request.filename());
+    auto result = directory->delete_file(path);
+    if (result != FileOperationResult::SUCCESS) {
+        return make_error(result);
+    }
+    release_chunks(client_socket, request);
+    invalidate_caches(client_socket, request);
+    return make_success(ResponseType::SUCCESS,
+                        "File deleted: " + request.filename());
+}
+
+fenris::Response
+RequestManager::handle_info_file(uint32_t client_socket,
+                                 const fenris::Request &request)
+{
+    fenris::Response response = make_success(ResponseType::FILE_INFO);
+    auto *file_info = response.mutable_file_info();
+
+    std::string key;
+    std::optional<std::string> cached;
+    if (m_metadata_cache) {
+        key = normalize_client_path(current_directory(client_socket).path,
+                                    request.filename());
+        cached = m_metadata_cache->get_file_info(key);
+    }
+
+    if (cached.has_value()) {
+        file_info->ParseFromString(*cached);
+    } else {
+        const uint64_t generation =
+            m_metadata_cache ? m_metadata_cache->generation() : 0;
+        auto [directory, path] = resolve_at(client_socket, request.filename());
+        auto [info, result] = directory->get_file_info(path);
+        if (result != FileOperationResult::SUCCESS) {
+            return make_error(result);
+        }
+        if (m_metadata_cache) {
+            // Cached without a name, each reply carries the one asked for
+            info.clear_name();
+            m_metadata_cache->put_file_info(key, info, generation);
+        }
+        *file_info = std::move(info);
+    }
+
+    // Report the name the client asked for rather than the local path
+    file_info->set_name(request.filename());
+    return response;
+}
+
+fenris::Response
+RequestManager::handle_create_dir(uint32_t client_socket,
+                                  const fenris::Request &request)
+{
+    auto result = create_directory(
+        resolve_path(client_socket, request.filename()).string());
+    if (result != FileOperationResult::SUCCESS) {
+        return make_error(result);
+    }
+    invalidate_caches(client_socket, request);
+    return make_success(ResponseType::SUCCESS,
+                        "Directory created: " + request.filename());
+}
+
+fenris::Response
+RequestManager::handle_list_dir(uint32_t client_socket,
+                                const fenris::Request &request)
+{
+    const std::string path =
+        request.filename().empty() ? "." : request.filename();
+    const size_t page_size =
+        request.list().page_size() == 0
+            ? DEFAULT_LIST_PAGE_SIZE
+            : std::min<size_t>(request.list().page_size(), MAX_LIST_PAGE_SIZE);
+
+    std::string key;
+    std::string page_key;
+    uint64_t generation = 0;
+    if (m_metadata_cache) {
+        key = normalize_client_path(current_directory(client_socket).path,
+                                    path);
+        page_key = std::to_string(request.list().cursor()) + ":" +
+                   std::to_string(page_size) +
+                   (request.list().names_only() ? ":n" : "");
+        if (auto cached = m_metadata_cache->get_listing(key, page_key)) {
+            fenris::Response response = make_success(ResponseType::DIR_LISTING);
+            response.mutable_directory_listing()->ParseFromString(*cached);
+            return response;
+        }
+        generation = m_metadata_cache->generation();
+    }
+
+    auto [directory, relative_path] = resolve_at(client_socket, path);
+    auto [page, result] =
+        directory->list_directory_page(relative_path,
+                                       request.list().cursor(),
+                                       page_size,
+                                       request.list().names_only());
+    if (result != FileOperationResult::SUCCESS) {
+        return make_error(result);
+    }
+
+    // Sorted within the page, the cursor follows the directory order
+    std::sort(page.entries.begin(),
+              page.entries.end(),
+              [](const fenris::FileInfo &a, const fenris::FileInfo &b) {
+                  return a.name() < b.name();
+              });
+
+    fenris::Response response = make_success(ResponseType::DIR_LISTING);
+    auto *listing = response.mutable_directory_listing();
+    for (auto &entry : page.entries) {
+        *listing->add_entries() = std::move(entry);
+    }
+    listing->set_next_cursor(page.next_cursor);
+    listing->set_names_only(request.list().names_only());
+    if (m_metadata_cache) {
+        m_metadata_cache->put_listing(key, page_key, *listing, generation);
+    }
+    return response;
+}
+
+fenris::Response
+RequestManager::handle_change_dir(uint32_t client_socket,
+                                  const fenris::Request &request)
+{
+    const std::string client_path = normalize_client_path(
+        current_directory(client_socket).path, request.filename());
+
+    // Opening the directory is also the check that it is one
+    ClientDirectory directory{client_path, nullptr};
+    if (client_path != "/" || !m_root_handle->is_open()) {
+        auto [parent, path] = resolve_at(client_socket, request.filename());
+        auto [handle, result] = parent->open_directory(path);
+        if (result != FileOperationResult::SUCCESS) {
+            return make_error(result);
+        }
+        directory.handle =
+            std::make_shared<const DirectoryHandle>(std::move(handle));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_directories_mutex);
+        m_directories[client_socket] = std::move(directory);
+    }
+    return make_success(ResponseType::SUCCESS,
+                        "Changed directory to: " + client_path);
+}
+
+fenris::Response
+RequestManager::handle_delete_dir(uint32_t client_socket,
+                                  const fenris::Request &request)
+{
+    auto result = delete_directory(
+        resolve_path(client_socket, request.filename()).string());
+    if (result != FileOperationResult::SUCCESS) {
+        return make_error(result);
+    }
+    release_chunks(client_socket, request);
+    invalidate_caches(client_socket, request);
+    return make_success(ResponseType::SUCCESS,
+                        "Directory deleted: " + request.filename());
+}
+
+fenris::Response
+RequestManager::handle_read_chunk(uint32_t client_socket,
+                                  const fenris::Request &request)
+{
+    const uint64_t offset = request.chunk().offset();
+    size_t length = request.chunk().length() == 0
+                        ? DEFAULT_CHUNK_SIZE
+                        : static_cast<size_t>(std::min<uint64_t>(
+                              request.chunk().length(), MAX_CHUNK_SIZE));
+
+    const ResolvedPath resolved = resolve_at(client_socket, request.filename());
+    uint64_t total_size = 0;
+    Buffer data;
+    FileOperationResult result = FileOperationResult::SUCCESS;
+    std::optional<fenris::ChunkManifest> manifest;
+    std::optional<fenris::TieredFile> tiered;
+    std::string key;
+    if (m_chunk_store || m_tiering || m_readahead) {
+        key = normalize_client_path(current_directory(client_socket).path,
+                                    request.filename());
+    }
+    if (m_chunk_store || m_tiering) {
+        if (m_tiering) {
+            m_tiering->record_access(key);
+        }
+        auto [file_info, info_result] =
+            resolved.directory->get_file_info(resolved.path);
+        if (info_result == FileOperationResult::SUCCESS) {
+            manifest = find_manifest(key, file_info);
+            tiered = find_tiered(key, file_info);
+        }
+    }
+    if (manifest.has_value()) {
+        total_size = manifest->size();
+        std::tie(data, result) =
+            m_chunk_store->read_range(*manifest, offset, length);
+    } else if (tiered.has_value()) {
+        total_size = tiered->size();
+        std::tie(data, result) =
+            m_tiering->read_range(*tiered, offset, length);
+    } else {
+        std::optional<CachedFile> cached;
+        if (m_content_cache) {
+            cached = m_content_cache->cached_range(
+                resolve_path(client_socket, request.filename()).string(),
+                offset,
+                length,
+                &total_size);
+        }
+        if (cached.has_value()) {
+            data = std::move(*cached);
+        } else {
+            // Only reads that reach the disk are worth reading ahead of
+            Prefetch prefetch;
+            if (m_readahead) {
+                prefetch =
+                    m_readahead->on_read(client_socket, key, offset, length);
+            }
+            std::tie(data, result) =
+                read_range(resolved, offset, length, total_size, prefetch);
+        }
+    }
+    if (result != FileOperationResult::SUCCESS) {
+        return make_error(result);
+    }
+
+    fenris::Response response = make_success(ResponseType::FILE_CHUNK);
+    auto *chunk_info = response.mutable_chunk_info();
+    chunk_info->set_offset(offset);
+    chunk_info->set_length(data.size());
+    chunk_info->set_total_size(total_size);
+    chunk_info->set_final(offset + data.size() >= total_size);
+    response.set_data(data.data(), data.size());
+    return response;
+}
+
+fenris::Response
+RequestManager::handle_write_chunk(uint32_t client_socket,
+                                   const fenris::Request &request)
+{
+    if (request.data().size() > MAX_CHUNK_SIZE) {
+        return make_error("Chunk exceeds maximum size");
+    }
+
+    // The first block (re)creates the file, later ones patch it in place
+    const uint64_t offset = request.chunk().offset();
+    if (offset != 0) {
+        auto result = materialize(client_socket, request.filename());
+        if (result != FileOperationResult::SUCCESS) {
+            return make_error(result);
+        }
+    }
+    auto [directory, path] = resolve_at(client_socket, request.filename());
+    auto result = offset == 0
+                      ? directory->write_file(path, request.data())
+                      : directory->write_file_at(path, offset, request.data());
+    if (result != FileOperationResult::SUCCESS) {
+        return make_error(result);
+    }
+
+    if (offset == 0) {
+        release_chunks(client_socket, request);
+    }
+    invalidate_caches(client_socket, request);
+
+    fenris::Response response = make_success(ResponseType::SUCCESS);
+    auto *chunk_info = response.mutable_chunk_info();
+    chunk_info->set_offset(offset);
+    chunk_info->set_length(request.data().size());
+    chunk_info->set_final(request.chunk().final());
+    chunk_info->set_total_size(offset + request.data().size());
+    if (request.chunk().final()) {
+        response.set_data("File written: " + request.filename());
+    }
+    return response;
+}
+
+fenris::Response
+RequestManager::handle_write_at(uint32_t client_socket,
+                                const fenris::Request &request)
+{
+    if (request.data().size() > MAX_CHUNK_SIZE) {
+        return make_error("Chunk exceeds maximum size");
+    }
+
+    auto result = materialize(client_socket, request.filename());
+    if (result != FileOperationResult::SUCCESS) {
+        return make_error(result);
+    }
+
+    const uint64_t offset = request.chunk().offset();
+    auto [directory, path] = resolve_at(client_socket, request.filename());
+    result = directory->write_file_at(path, offset, request.data());
+    if (result != FileOperationResult::SUCCESS) {
+        return make_error(result);
+    }
+
+    invalidate_caches(client_socket, request);
+    auto [total_size, size_result] = directory->get_file_size(path);
+
+    fenris::Response response = make_success(
+        ResponseType::SUCCESS,
+        "Wrote " + std::to_string(request.data().size()) + " bytes at " +
+            std::to_string(offset) + ": " + request.filename());
+    auto *chunk_info = response.mutable_chunk_info();
+    chunk_info->set_offset(offset);
+    chunk_info->set_length(request.data().size());
+    chunk_info->set_total_size(size_result == FileOperationResult::SUCCESS
+                                   ? total_size
+                                   : offset + request.data().size());
+    return response;
+}
+
+fenris::Response
+RequestManager::handle_signatures(uint32_t client_socket,
+                                  const fenris::Request &request)
+{
+    // Signatures and patches work on the bytes in the tree
+    auto materialized = materialize(client_socket, request.filename());
+    if (materialized != FileOperationResult::SUCCESS) {
+        return make_error(materialized);
+    }
+
+    auto [directory, path] = resolve_at(client_socket, request.filename());
+
+    // Taken before the content, a change after it fails the patch
+    auto [file_info, info_result] = directory->get_file_info(path);
+    if (info_result != FileOperationResult::SUCCESS) {
+        return make_error(info_result);
+    }
+    // Read rather than mapped, a concurrent truncate must not fault us
+    auto [content, result] = directory->read_file_buffer(path, 0);
+    if (result != FileOperationResult::SUCCESS) {
+        return make_error(result);
+    }
+
+    const size_t block_size =
+        request.chunk().length() == 0
+            ? delta::block_size_for(content.size())
+            : static_cast<size_t>(
+                  std::clamp<uint64_t>(request.chunk().length(),
+                                       delta::MIN_DELTA_BLOCK_SIZE,
+                                       delta::MAX_DELTA_BLOCK_SIZE));
+    fenris::Response response = make_success(ResponseType::FILE_SIGNATURES);
+    auto *signatures = response.mutable_signatures();
+    *signatures = delta::compute_signatures(content.span(), block_size);
+    signatures->set_modified_time(file_info.modified_time());
+    return response;
+}
+
+fenris::Response
+RequestManager::handle_patch_file(uint32_t client_socket,
+                                  const fenris::Request &request)
+{
+    auto [directory, path] = resolve_at(client_socket, request.filename());
+    const fenris::Delta &delta = request.delta();
+
+    auto [file_info, info_result] = directory->get_file_info(path);
+    if (info_result != FileOperationResult::SUCCESS) {
+        return make_error(info_result);
+    }
+    if (file_info.is_directory()) {
+        return make_error(FileOperationResult::INVALID_PATH);
+    }
+    if (file_info.size() != delta.base_size() ||
+        file_info.modified_time() != delta.base_modified_time()) {
+        return make_error("File changed since its signatures were taken");
+    }
+    auto [base, result] = directory->read_file_buffer(path, 0);
+    if (result != FileOperationResult::SUCCESS) {
+        return make_error(result);
+    }
+
+    std::string temp_path;
+    auto [fd, temp_result] = directory->create_temp_file(path, temp_path);
+    if (temp_result != FileOperationResult::SUCCESS) {
+        return make_error(temp_result);
+    }
+
+    // The patched file keeps the permissions of the one it replaces
+    delta::DeltaResult applied = delta::DeltaResult::IO_ERROR;
+    if (::fchmod(fd, file_info.permissions()) == 0) {
+        applied = delta::apply_delta(base.span(), delta, fd);
+    }
+    bool written = applied == delta::DeltaResult::SUCCESS &&
+                   (!m_durable_writer || ::fsync(fd) == 0);
+    written = ::close(fd) == 0 && written;
+    // Durable writes also make the rename itself survive a crash
+    if (!written ||
+        directory->replace_file(temp_path, path, m_durable_writer != nullptr) !=
+            FileOperationResult::SUCCESS) {
+        directory->delete_file(temp_path);
+        if (applied == delta::DeltaResult::SUCCESS) {
+            applied = delta::DeltaResult::IO_ERROR;
+        }
+        m_logger->warn("failed to patch {}: {}",
+                       request.filename(),
+                       delta::delta_result_to_string(applied));
+        return make_error(delta::delta_result_to_string(applied));
+    }
+
+    release_chunks(client_socket, request);
+    invalidate_caches(client_socket, request);
+    return make_success(ResponseType::SUCCESS,
+                        "File patched: " + request.filename());
+}
+
+fenris::Response RequestManager::handle_tree(uint32_t client_socket,
+                                             const fenris::Request &request,
+                                             const ProgressSink *progress)
+{
+    const std::string key = normalize_client_path(
+        current_directory(client_socket).path, request.filename());
+    const std::string path =
+        resolve_path(client_socket, request.filename()).string();
+    const RequestType command = request.command();
+
+    if (command == RequestType::DELETE_TREE && key == "/") {
+        return make_error("Refusing to delete the root directory");
+    }
+    if (command == RequestType::COPY_TREE &&
+        request.tree().destination().empty()) {
+        return make_error("No destination given");
+    }
+    if (command == RequestType::FIND && request.tree().pattern().empty()) {
+        return make_error("No pattern given");
+    }
+
+    TreeWalkOptions options;
+    options.pool = m_tree_pool.get();
+    // FIND only looks at names
+    options.stat_entries = command != RequestType::FIND;
+    if (progress) {
+        options.tick_interval =
+            std::chrono::milliseconds(request.tree().progress_interval_ms());
+    }
+    TreeWalker walker(options);
+
+    TreeCounters counters;
+    const size_t max_results =
+        request.tree().max_results() != 0
+            ? std::min<size_t>(request.tree().max_results(), MAX_FIND_RESULTS)
+            : MAX_FIND_RESULTS;
+    TreeMatches matches(max_results);
+
+    auto summarize = [&](fenris::TreeSummary &summary) {
+        summary.set_files(counters.files);
+        summary.set_directories(counters.directories);
+        summary.set_bytes(counters.bytes);
+        summary.set_errors(counters.errors);
+        for (auto &match : matches.take()) {
+            summary.add_matches(std::move(match));
+        }
+        summary.set_truncated(matches.truncated());
+    };
+    TreeWalker::Tick tick;
+    if (progress) {
+        tick = [&]() {
+            fenris::Response report =
+                make_success(ResponseType::TREE_PROGRESS);
+            summarize(*report.mutable_tree_summary());
+            return (*progress)(report);
+        };
+    }
+
+    FileOperationResult result = FileOperationResult::SUCCESS;
+    std::string message;
+    switch (command) {
+    case RequestType::DU:
+        result = tree_usage(walker, path, counters, tick);
+        message = "Usage of " + request.filename();
+        break;
+    case RequestType::COPY_TREE:
+        result = copy_tree(
+            walker,
+            path,
+            resolve_path(client_socket, request.tree().destination()).string(),
+            counters,
+            tick);
+        message = "Copied " + request.filename() + " to " +
+                  request.tree().destination();
+        break;
+    case RequestType::DELETE_TREE:
+        result = delete_tree(walker, path, counters, tick);
+        message = "Deleted " + request.filename();
+        break;
+    default:
+        result = find_in_tree(walker,
+                              path,
+                              request.tree().pattern(),
+                              key == "/" ? key : key + "/",
+                              counters,
+                              matches,
+                              tick);
+        message = "Matches below " + request.filename();
+        break;
+    }
+
+    auto tiers = hold_tiers();
+    if (command == RequestType::DELETE_TREE) {
+        // Even a failed delete may have got part of the way
+        release_chunks(client_socket, request);
+        invalidate_caches(client_socket, request);
+    } else if (command == RequestType::COPY_TREE &&
+               result == FileOperationResult::SUCCESS) {
+        const std::string destination =
+            normalize_client_path(current_directory(client_socket).path,
+                                  request.tree().destination());
+        if (m_chunk_store) {
+            link_copied_chunks(key, destination);
+        }
+        if (m_tiering) {
+            copy_cold_files(key, destination);
+        }
+        invalidate_caches(client_socket, request);
+    }
+
+    // A FIND that filled max_results stops the walk itself
+    fenris::Response response;
+    if (result != FileOperationResult::SUCCESS) {
+        response = make_error(result);
+    } else if (walker.cancelled() && !matches.truncated()) {
+        response = make_error("Cancelled");
+    } else {
+        response = make_success(ResponseType::TREE_RESULT, message);
+    }
+    summarize(*response.mutable_tree_summary());
+
+    FENRIS_LOG_DEBUG(
+        m_logger,
+        "tree request {} on {}: {} files, {} directories, {} errors",
+        static_cast<int>(command),
+        key,
+        response.tree_summary().files(),
+        response.tree_summary().directories(),
+        response.tree_summary().errors());
+    return response;
+}
+
+void RequestManager::link_copied_chunks(const std::string &from,
+                                        const std::string &to)
+{
+    for (const auto &manifest : m_chunk_store->find_prefix(from)) {
+        auto [source_info, result] = get_file_info(
+            (m_root / fs::path(manifest.path()).relative_path()).string());
+        if (result != FileOperationResult::SUCCESS ||
+            !find_manifest(manifest.path(), source_info)) {
+            continue;
+        }
+
+        const std::string copy = to + manifest.path().substr(from.size());
+        const std::string copy_path =
+            (m_root / fs::path(copy).relative_path()).string();
+        auto [copy_info, copy_result] = get_file_info(copy_path);
+        if (copy_result == FileOperationResult::SUCCESS) {
+            copy_result =
+                m_chunk_store->link(manifest, copy, copy_info.modified_time());
+        }
+        if (copy_result != FileOperationResult::SUCCESS) {
+            // The copied placeholder must not pass for the content
+            m_logger->warn("could not link chunks of {} to {}: {}",
+                           manifest.path(),
+                           copy,
+                           file_operation_result_to_string(copy_result));
+            delete_file(copy_path);
+        }
+    }
+}
+
+void RequestManager::copy_cold_files(const std::string &from,
+                                     const std::string &to)
+{
+    for (const auto &file : m_tiering->find_prefix(from)) {
+        auto [source_info, result] = get_file_info(
+            (m_root / fs::path(file.path()).relative_path()).string());
+        if (result != FileOperationResult::SUCCESS ||
+            !find_tiered(file.path(), source_info)) {
+            continue;
+        }
+
+        const std::string copy = to + file.path().substr(from.size());
+        const std::string copy_path =
+            (m_root / fs::path(copy).relative_path()).string();
+        auto [copy_info, copy_result] = get_file_info(copy_path);
+        if (copy_result == FileOperationResult::SUCCESS) {
+            copy_result = m_tiering->copy_out(file, copy_path);
+        }
+        if (copy_result != FileOperationResult::SUCCESS) {
+            // The copied placeholder must not pass for the content
+            m_logger->warn("could not copy cold file {} to {}: {}",
+                           file.path(),
+                           copy,
+                           file_operation_result_to_string(copy_result));
+            delete_file(copy_path);
+        }
+    }
+}
+
+fenris::Response RequestManager::make_success(fenris::ResponseType type,
+                                              const std::string &data)
+{
+    fenris::Response response;
+    response.set_type(type);
+    response.set_success(true);
+    if (!data.empty()) {
+        response.set_data(data);
+    }
+    return response;
+}
+
+fenris::Response RequestManager::make_error(const std::string &message)
+{
+    fenris::Response response;
+    response.set_type(ResponseType::ERROR);
+    response.set_success(false);
+    response.set_error_message(message);
+    return response;
+}
+
+fenris::Response RequestManager::make_error(FileOperationResult result)
+{
+    return make_error(file_operation_result_to_string(result));
+}
+
+RequestManager::ClientDirectory
+RequestManager::current_directory(uint32_t client_socket)
+{
+    std::lock_guard<std::mutex> lock(m_directories_mutex);
+    auto it = m_directories.find(client_socket);
+    return it != m_directories.end() ? it->second : ClientDirectory{};
+}
+
 } // namespace server
 } // namespace fenris
@@ -1,7 +1,149 @@
 #include "server/server.hpp"
+#include "common/tracing.hpp"
+#include "server/request_manager.hpp"
+
+#include <utility>
 
 namespace fenris {
 namespace server {
 
+using namespace common;
+
+Server::Server(const ServerConfig &config, const std::string &logger_name)
+    : m_config(config), m_logger(get_logger(logger_name))
+{
+    auto request_manager = std::make_unique<RequestManager>(m_config.root);
+    request_manager->set_metadata_cache(m_config.metadata_cache);
+    if (m_config.cache_bytes != 0) {
+        CacheConfig cache;
+        cache.max_bytes = m_config.cache_bytes;
+        request_manager->set_content_cache(true, cache);
+    }
+    if (!m_config.chunk_store.empty() &&
+        !request_manager->set_chunk_store(true, m_config.chunk_store)) {
+        m_logger->warn("could not open chunk store {}, writes stay plain",
+                       m_config.chunk_store);
+    }
+    if (!m_config.cold_tier.empty()) {
+        TieringConfig tiering;
+        tiering.cold_after = m_config.cold_after;
+        tiering.hot_bytes = m_config.hot_tier_bytes;
+        if (!request_manager->set_storage_tiering(
+                true, m_config.cold_tier, tiering)) {
+            m_logger->warn("could not open cold tier {}, files stay local",
+                           m_config.cold_tier);
+        }
+    }
+    request_manager->set_readahead(m_config.readahead);
+    request_manager->set_tree_threads(m_config.tree_threads);
+    request_manager->set_async_io(m_config.async_io);
+    request_manager->set_durable_writes(m_config.durable_writes);
+    m_request_manager = request_manager.get();
+
+    m_connection_manager = std::make_unique<ConnectionManager>(
+        m_config.host, m_config.port);
+    m_connection_manager->set_reactor_mode(m_config.reactor);
+    m_connection_manager->set_io_threads(m_config.io_threads);
+    m_connection_manager->set_worker_threads(m_config.worker_threads);
+    m_connection_manager->set_acceptors(m_config.acceptors);
+    m_connection_manager->set_listen_backlog(m_config.listen_backlog);
+    m_connection_manager->set_reuse_port(m_config.reuse_port);
+    m_connection_manager->set_cpu_affinity(m_config.cpu_affinity);
+    m_connection_manager->set_max_message_size(m_config.max_message_size);
+    m_connection_manager->set_memory_budget(m_config.memory_budget);
+    m_connection_manager->set_rate_limits(m_config.client_limit,
+                                          m_config.tenant_limit);
+    m_connection_manager->set_session_tickets(true);
+    m_connection_manager->set_pipelining(true);
+    m_connection_manager->set_read_leases(true);
+    m_connection_manager->set_sealed_file_streaming(true);
+    m_connection_manager->set_compression(true);
+    m_connection_manager->set_plaintext_file_streaming(
+        m_config.plaintext_file_streaming);
+    m_connection_manager->set_client_handler(std::move(request_manager));
+
+    if (!m_config.metrics_port.empty()) {
+        m_metrics_endpoint =
+            std::make_unique<MetricsEndpoint>(m_config.host,
+                                              m_config.metrics_port,
+                                              MetricsRegistry::global(),
+                                              logger_name);
+    }
+}
+
+Server::~Server()
+{
+    stop();
+}
+
+bool Server::start()
+{
+    // Before listening, so the first clients already find a warm cache
+    for (const auto &directory : m_config.preload) {
+        m_request_manager->warm_content_cache(directory);
+    }
+
+    if (!m_config.trace_file.empty() &&
+        !Tracer::global().open(m_config.trace_file,
+                               m_config.trace_sample_rate,
+                               "fenris_server")) {
+        m_logger->error("could not open trace file {}", m_config.trace_file);
+        return false;
+    }
+
+    m_connection_manager->start();
+    if (!m_connection_manager->is_running()) {
+        m_logger->error("could not listen on {}:{}",
+                        m_config.host,
+                        m_config.port);
+        return false;
+    }
+    if (m_metrics_endpoint && !m_metrics_endpoint->start()) {
+        m_connection_manager->stop();
+        return false;
+    }
+
+    m_logger->info("serving {} on {}:{} ({} mode)",
+                   m_config.root,
+                   m_config.host,
+                   m_config.port,
+                   m_config.reactor ? "reactor" : "thread per client");
+    return true;
+}
+
+void Server::stop()
+{
+    // Metrics stay up while draining, so scrapes see the clients leave
+    if (m_connection_manager->is_running()) {
+        if (m_config.drain_timeout.count() > 0) {
+            m_connection_manager->drain(m_config.drain_timeout);
+        } else {
+            m_connection_manager->stop();
+        }
+        m_logger->info("stopped serving {}", m_config.root);
+    }
+    if (m_metrics_endpoint) {
+        m_metrics_endpoint->stop();
+    }
+    if (!m_config.trace_file.empty()) {
+        Tracer::global().close();
+    }
+}
+
+bool Server::is_running() const
+{
+    return m_connection_manager->is_running();
+}
+
+size_t Server::get_active_client_count() const
+{
+    return m_connection_manager->get_active_client_count();
+}
+
+CacheStats Server::get_content_cache_stats() const
+{
+    return m_request_manager->get_content_cache_stats();
+}
+
 } // namespace server
 } // namespace fenris
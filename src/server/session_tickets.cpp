@@ -0,0 +1,87 @@
+#include "server/session_tickets.hpp"
+#include "fenris.pb.h"
+
+namespace fenris {
+namespace server {
+
+using namespace common::crypto;
+
+namespace {
+
+// Tickets expire on the steady clock, they never outlive the process anyway
+uint64_t now_seconds()
+{
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+}
+
+} // namespace
+
+TicketKeeper::TicketKeeper(std::chrono::seconds lifetime)
+    : m_lifetime(lifetime),
+      m_key(CryptoManager().generate_random_bytes(AES_GCM_KEY_SIZE).first)
+{
+}
+
+std::optional<std::vector<uint8_t>>
+TicketKeeper::issue(const std::vector<uint8_t> &resumption_secret) const
+{
+    fenris::SessionTicket contents;
+    contents.set_secret(resumption_secret.data(), resumption_secret.size());
+    contents.set_expires_at(now_seconds() +
+                            static_cast<uint64_t>(m_lifetime.count()));
+
+    std::vector<uint8_t> plaintext(contents.ByteSizeLong());
+    if (!contents.SerializeToArray(plaintext.data(),
+                                   static_cast<int>(plaintext.size()))) {
+        return std::nullopt;
+    }
+
+    CryptoManager crypto_manager;
+    auto [iv, iv_result] = crypto_manager.generate_random_iv();
+    if (iv_result != EncryptionResult::SUCCESS) {
+        return std::nullopt;
+    }
+    auto [sealed, seal_result] =
+        crypto_manager.encrypt_data(plaintext, m_key, iv);
+    if (seal_result != EncryptionResult::SUCCESS) {
+        return std::nullopt;
+    }
+
+    std::vector<uint8_t> ticket = std::move(iv);
+    ticket.insert(ticket.end(), sealed.begin(), sealed.end());
+    return ticket;
+}
+
+std::optional<std::vector<uint8_t>>
+TicketKeeper::redeem(std::span<const uint8_t> ticket) const
+{
+    if (ticket.size() <= AES_GCM_IV_SIZE + AES_GCM_TAG_SIZE) {
+        return std::nullopt;
+    }
+
+    const std::vector<uint8_t> iv(ticket.begin(),
+                                  ticket.begin() + AES_GCM_IV_SIZE);
+    const std::vector<uint8_t> sealed(ticket.begin() + AES_GCM_IV_SIZE,
+                                      ticket.end());
+    CryptoManager crypto_manager;
+    auto [plaintext, open_result] =
+        crypto_manager.decrypt_data(sealed, m_key, iv);
+    if (open_result != EncryptionResult::SUCCESS) {
+        return std::nullopt;
+    }
+
+    fenris::SessionTicket contents;
+    if (!contents.ParseFromArray(plaintext.data(),
+                                 static_cast<int>(plaintext.size())) ||
+        contents.secret().empty() || contents.expires_at() <= now_seconds()) {
+        return std::nullopt;
+    }
+    return std::vector<uint8_t>(contents.secret().begin(),
+                                contents.secret().end());
+}
+
+} // namespace server
+} // namespace fenris
@@ -0,0 +1,234 @@
+#include "server/thread_pool.hpp"
+#include "common/logging.hpp"
+
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+
+namespace fenris {
+namespace server {
+
+using namespace common;
+
+namespace {
+// Identifies the pool and deque owned by the current worker thread so that
+// nested submissions stay on the submitting worker's deque
+thread_local const ThreadPool *t_current_pool = nullptr;
+thread_local size_t t_current_index = 0;
+} // namespace
+
+bool pin_thread_to_core(std::thread &thread, size_t core)
+{
+    const size_t cores =
+        std::max<unsigned int>(1, std::thread::hardware_concurrency());
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % cores, &set);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) ==
+           0;
+}
+
+ThreadPool::ThreadPool(size_t thread_count, const std::string &logger_name)
+    : m_logger(get_logger(logger_name))
+{
+    if (thread_count == 0) {
+        thread_count =
+            std::max<unsigned int>(1, std::thread::hardware_concurrency());
+    }
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        m_queues.push_back(std::make_unique<WorkQueue>());
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+        m_workers.emplace_back(&ThreadPool::run_worker, this, i);
+    }
+
+    m_logger->debug("thread pool started with {} workers", thread_count);
+}
+
+ThreadPool::~ThreadPool()
+{
+    shutdown();
+}
+
+bool ThreadPool::pin_to_cores(size_t first_core)
+{
+    bool pinned = true;
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        pinned = pin_thread_to_core(m_workers[i], first_core + i) && pinned;
+    }
+    if (!pinned) {
+        m_logger->warn("could not pin every worker to a core");
+    }
+    return pinned;
+}
+
+void ThreadPool::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        if (m_stopping) {
+            return;
+        }
+        m_stopping = true;
+    }
+    m_sleep_cv.notify_all();
+
+    for (auto &worker : m_workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    m_logger->debug("thread pool stopped");
+}
+
+size_t ThreadPool::get_thread_count() const
+{
+    return m_workers.size();
+}
+
+size_t ThreadPool::get_pending_count() const
+{
+    return m_pending.load();
+}
+
+bool ThreadPool::enqueue(Task task,
+                         TaskPriority priority,
+                         const std::optional<FairShare> &share)
+{
+    const bool fair = share.has_value() && priority == TaskPriority::NORMAL;
+
+    WorkQueue *queue;
+    if (fair) {
+        queue = nullptr;
+    } else if (priority == TaskPriority::HIGH) {
+        queue = &m_priority_queue;
+    } else if (t_current_pool == this) {
+        queue = m_queues[t_current_index].get();
+    } else {
+        queue = m_queues[m_next_queue++ % m_queues.size()].get();
+    }
+
+    {
+        // Checked under the sleep mutex so a task can never be queued after
+        // the workers decided to exit
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        if (m_stopping) {
+            return false;
+        }
+
+        if (fair) {
+            push_fair(std::move(task), *share);
+        } else {
+            std::lock_guard<std::mutex> queue_lock(queue->mutex);
+            queue->tasks.push_back(std::move(task));
+        }
+        ++m_pending;
+    }
+    m_sleep_cv.notify_one();
+    return true;
+}
+
+void ThreadPool::push_fair(Task task, const FairShare &share)
+{
+    std::lock_guard<std::mutex> lock(m_fair_lane.mutex);
+
+    uint64_t &finish = m_fair_lane.finish_tags[share.flow];
+    const uint64_t start = std::max(m_fair_lane.virtual_time, finish);
+    finish = start + std::max<uint64_t>(share.cost, 1) /
+                         std::max<uint32_t>(share.weight, 1);
+
+    m_fair_lane.tasks.emplace(std::make_pair(start, m_fair_lane.arrivals++),
+                              std::move(task));
+}
+
+bool ThreadPool::pop_fair(Task &task)
+{
+    std::lock_guard<std::mutex> lock(m_fair_lane.mutex);
+    if (m_fair_lane.tasks.empty()) {
+        return false;
+    }
+
+    auto first = m_fair_lane.tasks.begin();
+    m_fair_lane.virtual_time =
+        std::max(m_fair_lane.virtual_time, first->first.first);
+    task = std::move(first->second);
+    m_fair_lane.tasks.erase(first);
+
+    // A flow whose finish tag the virtual time passed starts at the virtual
+    // time again, so its tag can go
+    if (m_fair_lane.finish_tags.size() >= m_fair_lane.sweep_at) {
+        std::erase_if(m_fair_lane.finish_tags, [this](const auto &entry) {
+            return entry.second <= m_fair_lane.virtual_time;
+        });
+        m_fair_lane.sweep_at =
+            std::max<size_t>(64, 2 * m_fair_lane.finish_tags.size());
+    }
+    return true;
+}
+
+bool ThreadPool::try_pop(size_t index, Task &task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_priority_queue.mutex);
+        if (!m_priority_queue.tasks.empty()) {
+            task = std::move(m_priority_queue.tasks.front());
+            m_priority_queue.tasks.pop_front();
+            return true;
+        }
+    }
+
+    {
+        WorkQueue &own = *m_queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.front());
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+
+    if (pop_fair(task)) {
+        return true;
+    }
+
+    // Steal from the opposite end to stay away from the owner
+    for (size_t offset = 1; offset < m_queues.size(); ++offset) {
+        WorkQueue &victim = *m_queues[(index + offset) % m_queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::run_worker(size_t index)
+{
+    t_current_pool = this;
+    t_current_index = index;
+
+    while (true) {
+        Task task;
+        if (try_pop(index, task)) {
+            --m_pending;
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_sleep_mutex);
+        m_sleep_cv.wait(lock, [this] { return m_stopping || m_pending > 0; });
+        if (m_stopping && m_pending == 0) {
+            break;
+        }
+    }
+
+    t_current_pool = nullptr;
+}
+
+} // namespace server
+} // namespace fenris
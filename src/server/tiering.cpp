@@ -0,0 +1,715 @@
+#include "server/tiering.hpp"
+#include "common/metrics.hpp"
+#include "server/tree_walker.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <tuple>
+#include <unistd.h>
+
+namespace fenris {
+namespace server {
+
+using namespace common;
+
+namespace {
+
+// The data and index objects of a client path, which starts with '/'
+std::string data_key(const std::string &path)
+{
+    return "data" + path;
+}
+
+std::string index_key(const std::string &path)
+{
+    return "index" + path;
+}
+
+// Now on the clock of FileInfo::modified_time
+uint64_t file_time_now()
+{
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::file_clock::now().time_since_epoch())
+            .count());
+}
+
+// Inverse of to_modified_time()
+struct timespec to_timespec(uint64_t modified_time)
+{
+    const auto system_time =
+        std::chrono::file_clock::to_sys(std::chrono::file_clock::time_point(
+            std::chrono::duration_cast<std::chrono::file_clock::duration>(
+                std::chrono::nanoseconds(modified_time))));
+    const auto since_epoch =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            system_time.time_since_epoch());
+    const auto seconds = std::chrono::floor<std::chrono::seconds>(since_epoch);
+
+    struct timespec timestamp {};
+    timestamp.tv_sec = static_cast<time_t>(seconds.count());
+    timestamp.tv_nsec = static_cast<long>((since_epoch - seconds).count());
+    return timestamp;
+}
+
+// A file that takes fewer blocks than its size, which a placeholder does
+bool is_sparse(const struct stat &status)
+{
+    return static_cast<uint64_t>(status.st_blocks) * 512 <
+           static_cast<uint64_t>(status.st_size);
+}
+
+FileOperationResult errno_result(int error)
+{
+    return system_error_to_file_operation_result(
+        std::error_code(error, std::generic_category()));
+}
+
+FileOperationResult write_all(int fd, std::span<const uint8_t> data)
+{
+    while (!data.empty()) {
+        const ssize_t written = ::write(fd, data.data(), data.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno_result(errno);
+        }
+        data = data.subspan(static_cast<size_t>(written));
+    }
+    return FileOperationResult::SUCCESS;
+}
+
+/**
+ * Put content in place of a local file through a temporary sibling
+ *
+ * The file keeps its permissions, and with a modified_time other than 0 its
+ * modification time as well.
+ */
+FileOperationResult replace_file(const std::string &path,
+                                 std::span<const uint8_t> content,
+                                 uint64_t modified_time)
+{
+    struct stat status {};
+    const bool existed = ::stat(path.c_str(), &status) == 0;
+
+    std::string temp_path;
+    auto [fd, result] = create_temp_file(path, temp_path);
+    if (result != FileOperationResult::SUCCESS) {
+        return result;
+    }
+    result = write_all(fd, content);
+    if (result == FileOperationResult::SUCCESS && existed &&
+        ::fchmod(fd, status.st_mode & 07777) != 0) {
+        result = errno_result(errno);
+    }
+    if (result == FileOperationResult::SUCCESS && modified_time != 0) {
+        const struct timespec times[2] = {{0, UTIME_OMIT},
+                                          to_timespec(modified_time)};
+        if (::futimens(fd, times) != 0) {
+            result = errno_result(errno);
+        }
+    }
+    if (::close(fd) != 0 && result == FileOperationResult::SUCCESS) {
+        result = FileOperationResult::IO_ERROR;
+    }
+    if (result == FileOperationResult::SUCCESS &&
+        ::rename(temp_path.c_str(), path.c_str()) != 0) {
+        result = errno_result(errno);
+    }
+    if (result != FileOperationResult::SUCCESS) {
+        ::unlink(temp_path.c_str());
+    }
+    return result;
+}
+
+} // namespace
+
+TieringEngine::TieringEngine(const std::string &root,
+                             std::unique_ptr<ObjectStore> store,
+                             const TieringConfig &config,
+                             const std::string &logger_name)
+    : m_root(root), m_store(std::move(store)), m_config(config),
+      m_demotions_total(&MetricsRegistry::global().counter(
+          "fenris_tier_demotions_total",
+          "Files moved from the local tree to the cold tier")),
+      m_promotions_total(&MetricsRegistry::global().counter(
+          "fenris_tier_promotions_total",
+          "Files moved from the cold tier back to the local tree")),
+      m_cold_reads_total(&MetricsRegistry::global().counter(
+          "fenris_tier_cold_reads_total",
+          "Reads served from the cold tier")),
+      m_logger(get_logger(logger_name))
+{
+    load();
+    m_promoter = std::thread([this] { run_promotions(); });
+    if (m_config.scan_interval.count() > 0) {
+        m_scanner = std::thread([this] { run_scans(); });
+    }
+}
+
+TieringEngine::~TieringEngine()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wakeup.notify_all();
+    m_promoted.notify_all();
+    if (m_promoter.joinable()) {
+        m_promoter.join();
+    }
+    if (m_scanner.joinable()) {
+        m_scanner.join();
+    }
+}
+
+std::shared_lock<std::shared_mutex> TieringEngine::lock_tree()
+{
+    return std::shared_lock<std::shared_mutex>(m_tree_mutex);
+}
+
+double TieringEngine::decayed_reads(const Access &access, uint64_t now) const
+{
+    if (now <= access.last) {
+        return access.reads;
+    }
+    const auto half_life =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            m_config.cold_after)
+            .count();
+    if (half_life <= 0) {
+        return 0;
+    }
+    return access.reads *
+           std::exp2(-static_cast<double>(now - access.last) /
+                     static_cast<double>(half_life));
+}
+
+std::string TieringEngine::local_path(const std::string &path) const
+{
+    return m_root + path;
+}
+
+void TieringEngine::record_access(const std::string &path)
+{
+    const uint64_t now = file_time_now();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Access &access = m_accesses[path];
+    access.reads = decayed_reads(access, now) + 1;
+    access.last = now;
+}
+
+std::optional<fenris::TieredFile>
+TieringEngine::find(const std::string &path,
+                    uint64_t size,
+                    uint64_t modified_time) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_files.find(path);
+    if (it == m_files.end() || it->second.size() != size ||
+        it->second.modified_time() != modified_time) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+std::vector<fenris::TieredFile>
+TieringEngine::find_prefix(const std::string &directory) const
+{
+    const std::string prefix = directory == "/" ? "/" : directory + "/";
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<fenris::TieredFile> files;
+    for (auto it = m_files.lower_bound(prefix);
+         it != m_files.end() &&
+         it->first.compare(0, prefix.size(), prefix) == 0;
+         ++it) {
+        files.push_back(it->second);
+    }
+    return files;
+}
+
+std::pair<Buffer, FileOperationResult>
+TieringEngine::read(const fenris::TieredFile &file)
+{
+    auto [content, result] = m_store->get(data_key(file.path()));
+    if (result == FileOperationResult::SUCCESS &&
+        content.size() != file.size()) {
+        m_logger->error("cold copy of {} has {} bytes instead of {}",
+                        file.path(),
+                        content.size(),
+                        file.size());
+        return {Buffer(), FileOperationResult::IO_ERROR};
+    }
+    if (result == FileOperationResult::SUCCESS) {
+        cold_read(file);
+    }
+    return {std::move(content), result};
+}
+
+std::pair<Buffer, FileOperationResult> TieringEngine::read_range(
+    const fenris::TieredFile &file, uint64_t offset, size_t length)
+{
+    auto [content, result] =
+        m_store->get_range(data_key(file.path()), offset, length);
+    if (result == FileOperationResult::SUCCESS) {
+        cold_read(file);
+    }
+    return {std::move(content), result};
+}
+
+void TieringEngine::cold_read(const fenris::TieredFile &file)
+{
+    m_cold_reads_total->add();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_stats.cold_reads;
+
+    // The read was counted by record_access() just before, as of then
+    auto access = m_accesses.find(file.path());
+    if (access == m_accesses.end() ||
+        access->second.reads < m_config.promote_reads ||
+        !m_queued.insert(file.path()).second) {
+        return;
+    }
+    m_promotions.push_back(file.path());
+    m_wakeup.notify_all();
+}
+
+FileOperationResult TieringEngine::restore(const fenris::TieredFile &file)
+{
+    auto [content, result] = m_store->get(data_key(file.path()));
+    if (result == FileOperationResult::SUCCESS) {
+        result = replace_file(local_path(file.path()),
+                              {content.data(), content.size()},
+                              file.modified_time());
+    }
+    if (result != FileOperationResult::SUCCESS) {
+        m_logger->warn("could not restore {} from the cold tier: {}",
+                       file.path(),
+                       file_operation_result_to_string(result));
+        return result;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_files.find(file.path());
+    if (it != m_files.end()) {
+        erase(it);
+        ++m_stats.promotions;
+        m_promotions_total->add();
+    }
+    return FileOperationResult::SUCCESS;
+}
+
+FileOperationResult TieringEngine::copy_out(const fenris::TieredFile &file,
+                                            const std::string &path)
+{
+    auto [content, result] = m_store->get(data_key(file.path()));
+    if (result != FileOperationResult::SUCCESS) {
+        return result;
+    }
+    return replace_file(path, {content.data(), content.size()}, 0);
+}
+
+bool TieringEngine::remove(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_files.find(path);
+    if (it == m_files.end()) {
+        return false;
+    }
+    erase(it);
+    return true;
+}
+
+void TieringEngine::remove_prefix(const std::string &directory)
+{
+    const std::string prefix = directory == "/" ? "/" : directory + "/";
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_files.lower_bound(prefix);
+    while (it != m_files.end() &&
+           it->first.compare(0, prefix.size(), prefix) == 0) {
+        erase(it++);
+    }
+}
+
+void TieringEngine::erase(
+    std::map<std::string, fenris::TieredFile>::iterator it)
+{
+    m_store->remove(index_key(it->first));
+    m_store->remove(data_key(it->first));
+    m_cold_bytes -= it->second.size();
+    m_files.erase(it);
+}
+
+size_t TieringEngine::demote_cold()
+{
+    struct Candidate {
+        std::string path;
+        uint64_t size = 0;
+        uint64_t last = 0;
+        double reads = 0;
+    };
+
+    // Anything accessed after this stays, the scan is already out of date
+    const uint64_t picked_at = file_time_now();
+
+    std::mutex candidates_mutex;
+    std::vector<Candidate> candidates;
+    uint64_t hot_bytes = 0;
+    TreeWalkOptions options;
+    options.stat_entries = false;
+    TreeWalker walker(options);
+    walker.walk(m_root, [&](const TreeEntry &entry) {
+        struct stat status {};
+        if (entry.is_directory ||
+            ::fstatat(entry.parent_fd,
+                      entry.name.c_str(),
+                      &status,
+                      AT_SYMLINK_NOFOLLOW) != 0 ||
+            !S_ISREG(status.st_mode) || is_sparse(status)) {
+            return true;
+        }
+        Candidate candidate;
+        candidate.path = "/" + entry.path;
+        candidate.size = static_cast<uint64_t>(status.st_size);
+        candidate.last = to_modified_time(status.st_mtim);
+
+        std::lock_guard<std::mutex> lock(candidates_mutex);
+        hot_bytes += candidate.size;
+        if (candidate.size >= m_config.min_file_size) {
+            candidates.push_back(std::move(candidate));
+        }
+        return true;
+    });
+
+    const uint64_t cold_after = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            m_config.cold_after)
+            .count());
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto &candidate : candidates) {
+            auto access = m_accesses.find(candidate.path);
+            if (access != m_accesses.end()) {
+                candidate.last = std::max(candidate.last, access->second.last);
+                candidate.reads = decayed_reads(access->second, picked_at);
+            }
+        }
+        // Counts that decayed below a read are not worth keeping
+        std::erase_if(m_accesses, [&](const auto &entry) {
+            return decayed_reads(entry.second, picked_at) < 1.0 &&
+                   picked_at - std::min(picked_at, entry.second.last) >=
+                       cold_after;
+        });
+    }
+
+    // Files nobody read for cold_after go first, then the least read ones
+    // while the tree holds more than hot_bytes
+    std::sort(candidates.begin(),
+              candidates.end(),
+              [](const Candidate &a, const Candidate &b) {
+                  return std::tie(a.reads, a.last) < std::tie(b.reads, b.last);
+              });
+    size_t demoted = 0;
+    for (const auto &candidate : candidates) {
+        const bool idle =
+            picked_at - std::min(picked_at, candidate.last) >= cold_after;
+        const bool over_budget =
+            m_config.hot_bytes != 0 && hot_bytes > m_config.hot_bytes;
+        if (!idle && !over_budget) {
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_stopping) {
+                break;
+            }
+        }
+        if (demote(candidate.path, picked_at)) {
+            hot_bytes -= candidate.size;
+            ++demoted;
+        }
+    }
+
+    if (demoted != 0) {
+        m_logger->info("moved {} files to the cold tier", demoted);
+    }
+    return demoted;
+}
+
+bool TieringEngine::demote(const std::string &path, uint64_t picked_at)
+{
+    {
+        // A placeholder on a file system without holes is not sparse
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_files.count(path) != 0) {
+            return false;
+        }
+    }
+    const std::string local = local_path(path);
+    struct stat status {};
+    if (::lstat(local.c_str(), &status) != 0 || !S_ISREG(status.st_mode)) {
+        return false;
+    }
+    const uint64_t modified_time = to_modified_time(status.st_mtim);
+
+    // Read plainly rather than mapped, a client truncating the file meanwhile
+    // must not fault the server
+    auto [content, result] = read_file_buffer(local, 0);
+    if (result != FileOperationResult::SUCCESS ||
+        content.size() != static_cast<uint64_t>(status.st_size)) {
+        return false;
+    }
+
+    fenris::TieredFile file;
+    file.set_path(path);
+    file.set_size(content.size());
+    file.set_modified_time(modified_time);
+    const std::string record = file.SerializeAsString();
+    result = m_store->put(data_key(path), {content.data(), content.size()});
+    if (result == FileOperationResult::SUCCESS) {
+        // A crash from here on leaves a record matching the file itself,
+        // whose content the data object holds as well
+        result = m_store->put(
+            index_key(path),
+            {reinterpret_cast<const uint8_t *>(record.data()), record.size()});
+    }
+    if (result != FileOperationResult::SUCCESS) {
+        m_logger->warn("could not move {} to the cold tier: {}",
+                       path,
+                       file_operation_result_to_string(result));
+        m_store->remove(data_key(path));
+        return false;
+    }
+
+    std::unique_lock<std::shared_mutex> tree(m_tree_mutex);
+    struct stat now {};
+    bool unchanged = ::lstat(local.c_str(), &now) == 0 &&
+                     now.st_ino == status.st_ino &&
+                     now.st_size == status.st_size &&
+                     to_modified_time(now.st_mtim) == modified_time;
+    if (unchanged) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto access = m_accesses.find(path);
+        unchanged = access == m_accesses.end() ||
+                    access->second.last <= picked_at;
+    }
+
+    if (unchanged) {
+        // The placeholder keeps the size, time and permissions of the file
+        std::string temp_path;
+        int fd;
+        std::tie(fd, result) = create_temp_file(local, temp_path);
+        if (result == FileOperationResult::SUCCESS) {
+            const struct timespec times[2] = {status.st_atim, status.st_mtim};
+            if (::ftruncate(fd, status.st_size) != 0 ||
+                ::fchmod(fd, status.st_mode & 07777) != 0 ||
+                ::futimens(fd, times) != 0) {
+                result = errno_result(errno);
+            }
+            if (::close(fd) != 0 && result == FileOperationResult::SUCCESS) {
+                result = FileOperationResult::IO_ERROR;
+            }
+            if (result == FileOperationResult::SUCCESS &&
+                ::rename(temp_path.c_str(), local.c_str()) != 0) {
+                result = errno_result(errno);
+            }
+            if (result != FileOperationResult::SUCCESS) {
+                ::unlink(temp_path.c_str());
+            }
+        }
+        if (result != FileOperationResult::SUCCESS) {
+            m_logger->warn("could not leave a placeholder for {}: {}",
+                           path,
+                           file_operation_result_to_string(result));
+            unchanged = false;
+        }
+    }
+
+    if (!unchanged) {
+        m_store->remove(index_key(path));
+        m_store->remove(data_key(path));
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cold_bytes += file.size();
+    m_files[path] = std::move(file);
+    ++m_stats.demotions;
+    m_demotions_total->add();
+    return true;
+}
+
+void TieringEngine::promote(const std::string &path)
+{
+    fenris::TieredFile file;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_files.find(path);
+        if (it == m_files.end()) {
+            return;
+        }
+        file = it->second;
+    }
+
+    // Fetched and written beside the placeholder without holding up
+    // requests, only the rename waits for them
+    const std::string local = local_path(path);
+    auto [content, result] = m_store->get(data_key(path));
+    std::string temp_path;
+    int fd = -1;
+    if (result == FileOperationResult::SUCCESS) {
+        std::tie(fd, result) = create_temp_file(local, temp_path);
+    }
+    if (result == FileOperationResult::SUCCESS) {
+        result = write_all(fd, {content.data(), content.size()});
+        struct stat placeholder {};
+        if (result == FileOperationResult::SUCCESS &&
+            ::stat(local.c_str(), &placeholder) == 0 &&
+            ::fchmod(fd, placeholder.st_mode & 07777) != 0) {
+            result = errno_result(errno);
+        }
+        const struct timespec times[2] = {{0, UTIME_OMIT},
+                                          to_timespec(file.modified_time())};
+        if (result == FileOperationResult::SUCCESS &&
+            ::futimens(fd, times) != 0) {
+            result = errno_result(errno);
+        }
+        if (::close(fd) != 0 && result == FileOperationResult::SUCCESS) {
+            result = FileOperationResult::IO_ERROR;
+        }
+    }
+    if (result != FileOperationResult::SUCCESS) {
+        m_logger->warn("could not move {} back from the cold tier: {}",
+                       path,
+                       file_operation_result_to_string(result));
+        if (!temp_path.empty()) {
+            ::unlink(temp_path.c_str());
+        }
+        return;
+    }
+
+    std::unique_lock<std::shared_mutex> tree(m_tree_mutex);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_files.find(path);
+    struct stat status {};
+    const bool unchanged =
+        it != m_files.end() && ::lstat(local.c_str(), &status) == 0 &&
+        static_cast<uint64_t>(status.st_size) == it->second.size() &&
+        to_modified_time(status.st_mtim) == it->second.modified_time();
+    if (!unchanged || ::rename(temp_path.c_str(), local.c_str()) != 0) {
+        ::unlink(temp_path.c_str());
+        return;
+    }
+    erase(it);
+    ++m_stats.promotions;
+    m_promotions_total->add();
+}
+
+void TieringEngine::flush()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_promoted.wait(lock, [this] {
+        return m_stopping || (m_promotions.empty() && !m_promoting);
+    });
+}
+
+TieringStats TieringEngine::get_stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    TieringStats stats = m_stats;
+    stats.cold_files = m_files.size();
+    stats.cold_bytes = m_cold_bytes;
+    return stats;
+}
+
+void TieringEngine::run_promotions()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_wakeup.wait(
+            lock, [this] { return m_stopping || !m_promotions.empty(); });
+        if (m_stopping) {
+            return;
+        }
+        std::string path = std::move(m_promotions.front());
+        m_promotions.pop_front();
+        m_promoting = true;
+
+        lock.unlock();
+        promote(path);
+        lock.lock();
+
+        m_queued.erase(path);
+        m_promoting = false;
+        m_promoted.notify_all();
+    }
+}
+
+void TieringEngine::run_scans()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_wakeup.wait_for(
+        lock, m_config.scan_interval, [this] { return m_stopping; })) {
+        lock.unlock();
+        demote_cold();
+        lock.lock();
+    }
+}
+
+void TieringEngine::load()
+{
+    auto [keys, result] = m_store->list("index/");
+    if (result != FileOperationResult::SUCCESS) {
+        m_logger->error("could not list the cold tier: {}",
+                        file_operation_result_to_string(result));
+    }
+
+    size_t dropped = 0;
+    for (const auto &key : keys) {
+        const std::string path = key.substr(std::string("index").size());
+        auto [record, get_result] = m_store->get(key);
+        fenris::TieredFile file;
+        struct stat status {};
+        const bool valid =
+            get_result == FileOperationResult::SUCCESS &&
+            file.ParseFromArray(record.data(),
+                                static_cast<int>(record.size())) &&
+            file.path() == path &&
+            ::lstat(local_path(path).c_str(), &status) == 0 &&
+            static_cast<uint64_t>(status.st_size) == file.size() &&
+            to_modified_time(status.st_mtim) == file.modified_time();
+        if (!valid) {
+            // Deleted or rewritten while the server was down
+            m_store->remove(key);
+            m_store->remove(data_key(path));
+            ++dropped;
+            continue;
+        }
+        m_cold_bytes += file.size();
+        m_files.emplace(path, std::move(file));
+    }
+
+    // Data without a record was left by a move that did not finish
+    auto [data_keys, data_result] = m_store->list("data/");
+    for (const auto &key : data_keys) {
+        if (m_files.count(key.substr(std::string("data").size())) == 0) {
+            m_store->remove(key);
+        }
+    }
+
+    m_logger->info("cold tier holds {} files, {} stale records dropped",
+                   m_files.size(),
+                   dropped);
+}
+
+} // namespace server
+} // namespace fenris
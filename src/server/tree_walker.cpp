@@ -0,0 +1,546 @@
+#include "server/tree_walker.hpp"
+#include "server/thread_pool.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <filesystem>
+#include <fnmatch.h>
+#include <future>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+
+namespace fenris {
+namespace server {
+
+namespace fs = std::filesystem;
+
+using namespace common;
+
+namespace {
+
+// Room for a few hundred entries per getdents64() call
+constexpr size_t DIRENT_BUFFER_SIZE = 32 * 1024;
+
+// Bytes handed to copy_file_range() or read() at once
+constexpr size_t COPY_BLOCK_SIZE = 1024 * 1024;
+
+FileOperationResult errno_result(int error)
+{
+    return system_error_to_file_operation_result(
+        std::error_code(error, std::generic_category()));
+}
+
+// A directory waiting to be read
+struct PendingDirectory {
+    std::string path;
+    uint32_t depth;
+};
+
+// Copy the rest of in to out, the kernel moving the bytes where it can
+bool copy_descriptor(int in, int out, uint64_t &copied)
+{
+    bool use_copy_range = true;
+    std::vector<char> buffer;
+    while (true) {
+        if (use_copy_range) {
+            const ssize_t n = ::copy_file_range(in,
+                                                nullptr,
+                                                out,
+                                                nullptr,
+                                                COPY_BLOCK_SIZE,
+                                                0);
+            if (n > 0) {
+                copied += static_cast<uint64_t>(n);
+                continue;
+            }
+            if (n == 0) {
+                return true;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            // Across file systems on older kernels, or where the file
+            // system has no support for it
+            if (errno != EXDEV && errno != ENOSYS && errno != EINVAL &&
+                errno != EOPNOTSUPP) {
+                return false;
+            }
+            use_copy_range = false;
+            buffer.resize(COPY_BLOCK_SIZE);
+        }
+
+        const ssize_t n = ::read(in, buffer.data(), buffer.size());
+        if (n == 0) {
+            return true;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        ssize_t written = 0;
+        while (written < n) {
+            const ssize_t w = ::write(out,
+                                      buffer.data() + written,
+                                      static_cast<size_t>(n - written));
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            written += w;
+        }
+        copied += static_cast<uint64_t>(n);
+    }
+}
+
+// Copy one regular file of the source tree
+bool copy_regular_file(const TreeEntry &entry,
+                       int destination_fd,
+                       uint64_t &copied)
+{
+    const int in = ::openat(entry.parent_fd,
+                            entry.name.c_str(),
+                            O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (in < 0) {
+        return false;
+    }
+    const mode_t permissions = entry.mode & 07777 ? entry.mode & 07777 : 0644;
+    const int out = ::openat(destination_fd,
+                             entry.path.c_str(),
+                             O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                             permissions);
+    if (out < 0) {
+        ::close(in);
+        return false;
+    }
+
+    const bool copied_all = copy_descriptor(in, out, copied);
+    ::close(in);
+    return ::close(out) == 0 && copied_all;
+}
+
+// Recreate a symbolic link of the source tree, pointing where it did
+bool copy_symlink(const TreeEntry &entry, int destination_fd)
+{
+    std::string target(PATH_MAX, '\0');
+    const ssize_t length = ::readlinkat(entry.parent_fd,
+                                        entry.name.c_str(),
+                                        target.data(),
+                                        target.size());
+    if (length < 0 || static_cast<size_t>(length) >= target.size()) {
+        return false;
+    }
+    target.resize(static_cast<size_t>(length));
+    return ::symlinkat(target.c_str(), destination_fd, entry.path.c_str()) ==
+           0;
+}
+
+} // namespace
+
+TreeWalker::TreeWalker(const TreeWalkOptions &options) : m_options(options)
+{
+    if (m_options.threads == 0 && m_options.pool) {
+        m_options.threads = m_options.pool->get_thread_count();
+    } else if (m_options.threads == 0) {
+        m_options.threads =
+            std::max<unsigned int>(1, std::thread::hardware_concurrency());
+    }
+}
+
+FileOperationResult TreeWalker::walk(const std::string &root,
+                                     const Visitor &visitor,
+                                     const Tick &tick)
+{
+    m_cancelled = false;
+    m_errors = 0;
+
+    const int root_fd =
+        ::open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd < 0) {
+        return errno == ENOTDIR ? FileOperationResult::INVALID_PATH
+                                : errno_result(errno);
+    }
+
+    std::vector<PendingDirectory> stack{{"", 1}};
+    // Directories pushed and not yet read to the end
+    size_t outstanding = 1;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    auto read_directory = [&](const PendingDirectory &directory) {
+        const int fd = directory.path.empty()
+                           ? ::dup(root_fd)
+                           : ::openat(root_fd,
+                                      directory.path.c_str(),
+                                      O_RDONLY | O_DIRECTORY | O_NOFOLLOW |
+                                          O_CLOEXEC);
+        if (fd < 0) {
+            ++m_errors;
+            return;
+        }
+
+        std::vector<char> buffer(DIRENT_BUFFER_SIZE);
+        while (!m_cancelled) {
+            const long length =
+                ::syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+            if (length <= 0) {
+                if (length < 0) {
+                    ++m_errors;
+                }
+                break;
+            }
+
+            // dirent64 has the layout getdents64() fills the buffer with
+            for (long offset = 0; offset < length && !m_cancelled;) {
+                const auto *dirent =
+                    reinterpret_cast<const struct dirent64 *>(&buffer[offset]);
+                offset += dirent->d_reclen;
+                if (std::strcmp(dirent->d_name, ".") == 0 ||
+                    std::strcmp(dirent->d_name, "..") == 0) {
+                    continue;
+                }
+
+                TreeEntry entry;
+                entry.parent_fd = fd;
+                entry.name = dirent->d_name;
+                entry.path = directory.path.empty()
+                                 ? entry.name
+                                 : directory.path + "/" + entry.name;
+                entry.depth = directory.depth;
+                entry.mode = DTTOIF(dirent->d_type);
+
+                if (m_options.stat_entries || dirent->d_type == DT_UNKNOWN) {
+                    struct stat status {};
+                    if (::fstatat(fd,
+                                  dirent->d_name,
+                                  &status,
+                                  AT_SYMLINK_NOFOLLOW) != 0) {
+                        // Deleted since the directory was read
+                        continue;
+                    }
+                    entry.mode = status.st_mode;
+                    entry.size = static_cast<uint64_t>(status.st_size);
+                }
+                entry.is_directory = S_ISDIR(entry.mode);
+
+                if (visitor(entry) && entry.is_directory) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stack.push_back(
+                        {std::move(entry.path), directory.depth + 1});
+                    ++outstanding;
+                    cv.notify_one();
+                }
+            }
+        }
+        ::close(fd);
+    };
+
+    auto work = [&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [&]() {
+                return !stack.empty() || outstanding == 0 || m_cancelled;
+            });
+            if (outstanding == 0 || m_cancelled) {
+                return;
+            }
+
+            PendingDirectory directory = std::move(stack.back());
+            stack.pop_back();
+            lock.unlock();
+            read_directory(directory);
+            lock.lock();
+
+            // A visitor may have cancelled while the others wait for work
+            if (--outstanding == 0 || m_cancelled) {
+                cv.notify_all();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    std::vector<std::future<void>> tasks;
+    for (size_t i = 0; i < m_options.threads; ++i) {
+        if (!m_options.pool) {
+            threads.emplace_back(work);
+            continue;
+        }
+        std::future<void> task = m_options.pool->submit(work);
+        if (task.valid()) {
+            tasks.push_back(std::move(task));
+        }
+    }
+    if (threads.empty() && tasks.empty()) {
+        // The pool was shut down, walk on this thread instead
+        work();
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto finished = [&]() { return outstanding == 0 || m_cancelled; };
+        if (tick && m_options.tick_interval.count() > 0) {
+            while (!cv.wait_for(lock, m_options.tick_interval, finished)) {
+                lock.unlock();
+                const bool keep_going = tick();
+                lock.lock();
+                if (!keep_going) {
+                    m_cancelled = true;
+                }
+            }
+        } else {
+            cv.wait(lock, finished);
+        }
+        // Wake the threads blocked on an empty stack when cancelled
+        cv.notify_all();
+    }
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    // Tasks still queued behind other walks find nothing left to do, but
+    // must not outlive the state they point to
+    for (auto &task : tasks) {
+        task.wait();
+    }
+    ::close(root_fd);
+    return FileOperationResult::SUCCESS;
+}
+
+void TreeWalker::cancel()
+{
+    m_cancelled = true;
+}
+
+bool TreeWalker::cancelled() const
+{
+    return m_cancelled;
+}
+
+uint64_t TreeWalker::errors() const
+{
+    return m_errors;
+}
+
+bool TreeMatches::add(std::string path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_count >= m_limit) {
+        m_truncated = true;
+        return false;
+    }
+    ++m_count;
+    m_pending.push_back(std::move(path));
+    return true;
+}
+
+std::vector<std::string> TreeMatches::take()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return std::exchange(m_pending, {});
+}
+
+bool TreeMatches::truncated() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_truncated;
+}
+
+FileOperationResult tree_usage(TreeWalker &walker,
+                               const std::string &root,
+                               TreeCounters &counters,
+                               const TreeWalker::Tick &tick)
+{
+    auto visitor = [&](const TreeEntry &entry) {
+        if (entry.is_directory) {
+            ++counters.directories;
+            return true;
+        }
+        ++counters.files;
+        if (S_ISREG(entry.mode)) {
+            counters.bytes += entry.size;
+        }
+        return true;
+    };
+
+    const FileOperationResult result = walker.walk(root, visitor, tick);
+    counters.errors += walker.errors();
+    return result;
+}
+
+FileOperationResult find_in_tree(TreeWalker &walker,
+                                 const std::string &root,
+                                 const std::string &pattern,
+                                 const std::string &prefix,
+                                 TreeCounters &counters,
+                                 TreeMatches &matches,
+                                 const TreeWalker::Tick &tick)
+{
+    auto visitor = [&](const TreeEntry &entry) {
+        if (entry.is_directory) {
+            ++counters.directories;
+        } else {
+            ++counters.files;
+        }
+        if (::fnmatch(pattern.c_str(), entry.name.c_str(), 0) == 0 &&
+            !matches.add(prefix + entry.path)) {
+            walker.cancel();
+        }
+        return true;
+    };
+
+    const FileOperationResult result = walker.walk(root, visitor, tick);
+    counters.errors += walker.errors();
+    return result;
+}
+
+FileOperationResult copy_tree(TreeWalker &walker,
+                              const std::string &source,
+                              const std::string &destination,
+                              TreeCounters &counters,
+                              const TreeWalker::Tick &tick)
+{
+    struct stat source_status {};
+    if (::stat(source.c_str(), &source_status) != 0) {
+        return errno_result(errno);
+    }
+    if (!S_ISDIR(source_status.st_mode)) {
+        return FileOperationResult::INVALID_PATH;
+    }
+
+    // A copy into itself would keep finding the entries it just made
+    std::error_code ec;
+    const std::string from = fs::weakly_canonical(source, ec).string();
+    const std::string to = fs::weakly_canonical(destination, ec).string();
+    if (ec) {
+        return system_error_to_file_operation_result(ec);
+    }
+    if (to == from || to.starts_with(from + "/")) {
+        return FileOperationResult::INVALID_PATH;
+    }
+
+    const mode_t permissions = (source_status.st_mode & 07777) | S_IRWXU;
+    if (::mkdir(destination.c_str(), permissions) != 0) {
+        return errno == EEXIST ? FileOperationResult::DIRECTORY_ALREADY_EXISTS
+                               : errno_result(errno);
+    }
+    const int destination_fd =
+        ::open(destination.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (destination_fd < 0) {
+        return errno_result(errno);
+    }
+
+    auto visitor = [&](const TreeEntry &entry) {
+        if (entry.is_directory) {
+            // Made before the walk reads into it, writable so it can be
+            // filled whatever the source's permissions
+            const mode_t permissions =
+                entry.mode & 07777 ? entry.mode & 07777 : 0755;
+            if (::mkdirat(destination_fd,
+                          entry.path.c_str(),
+                          permissions | S_IRWXU) != 0) {
+                ++counters.errors;
+                return false;
+            }
+            ++counters.directories;
+            return true;
+        }
+
+        uint64_t copied = 0;
+        bool ok = false;
+        if (S_ISREG(entry.mode)) {
+            ok = copy_regular_file(entry, destination_fd, copied);
+        } else if (S_ISLNK(entry.mode)) {
+            ok = copy_symlink(entry, destination_fd);
+        }
+        counters.bytes += copied;
+        if (ok) {
+            ++counters.files;
+        } else {
+            ++counters.errors;
+        }
+        return false;
+    };
+
+    const FileOperationResult result = walker.walk(source, visitor, tick);
+    counters.errors += walker.errors();
+    ::close(destination_fd);
+    return result;
+}
+
+FileOperationResult delete_tree(TreeWalker &walker,
+                                const std::string &root,
+                                TreeCounters &counters,
+                                const TreeWalker::Tick &tick)
+{
+    std::vector<PendingDirectory> directories;
+    std::mutex directories_mutex;
+
+    auto visitor = [&](const TreeEntry &entry) {
+        if (entry.is_directory) {
+            std::lock_guard<std::mutex> lock(directories_mutex);
+            directories.push_back({entry.path, entry.depth});
+            return true;
+        }
+        if (::unlinkat(entry.parent_fd, entry.name.c_str(), 0) != 0) {
+            ++counters.errors;
+            return false;
+        }
+        ++counters.files;
+        if (S_ISREG(entry.mode)) {
+            counters.bytes += entry.size;
+        }
+        return false;
+    };
+
+    const FileOperationResult result = walker.walk(root, visitor, tick);
+    counters.errors += walker.errors();
+    if (result != FileOperationResult::SUCCESS) {
+        return result;
+    }
+    if (walker.cancelled()) {
+        return FileOperationResult::DIRECTORY_NOT_EMPTY;
+    }
+
+    // Children before their parents
+    std::sort(directories.begin(),
+              directories.end(),
+              [](const PendingDirectory &a, const PendingDirectory &b) {
+                  return a.depth > b.depth;
+              });
+    const int root_fd =
+        ::open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd < 0) {
+        return errno_result(errno);
+    }
+    for (const auto &directory : directories) {
+        if (::unlinkat(root_fd, directory.path.c_str(), AT_REMOVEDIR) == 0) {
+            ++counters.directories;
+        } else {
+            ++counters.errors;
+        }
+    }
+    ::close(root_fd);
+
+    if (counters.errors > 0) {
+        return FileOperationResult::DIRECTORY_NOT_EMPTY;
+    }
+    if (::rmdir(root.c_str()) != 0) {
+        return errno_result(errno);
+    }
+    return FileOperationResult::SUCCESS;
+}
+
+} // namespace server
+} // namespace fenris
@@ -1,3 +1,4 @@
+#include "client/async_connection.hpp"
 #include "client/client.hpp"
 #include "client/connection_manager.hpp"
 #include "common/crypto_manager.hpp"
@@ -7,6 +8,7 @@
 #include "fenris.pb.h"
 
 #include <arpa/inet.h>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <cstring>
@@ -146,6 +148,13 @@ class MockServer {
         m_next_response = response;
     }
 
+    // Answer each request with a PONG carrying the request's data
+    void set_echo_requests(bool enabled)
+    {
+        std::lock_guard<std::mutex> lock(m_response_mutex);
+        m_echo_requests = enabled;
+    }
+
   private:
     void run()
     {
@@ -219,7 +228,11 @@ class MockServer {
             fenris::Response response_to_send;
             {
                 std::lock_guard<std::mutex> lock(m_response_mutex);
-                if (m_next_response.IsInitialized()) {
+                if (m_echo_requests) {
+                    response_to_send.set_success(true);
+                    response_to_send.set_type(fenris::ResponseType::PONG);
+                    response_to_send.set_data(request.data());
+                } else if (m_next_response.IsInitialized()) {
                     response_to_send = m_next_response;
                     m_next_response.Clear();
                 } else {
@@ -392,6 +405,7 @@ class MockServer {
     std::mutex m_requests_mutex;
 
     fenris::Response m_next_response;
+    bool m_echo_requests{false};
     std::mutex m_response_mutex;
     crypto::CryptoManager m_crypto_manager;
 };
@@ -548,6 +562,57 @@ TEST_F(ClientConnectionManagerTest, SendAndReceiveMultiple)
     m_connection_manager->disconnect();
 }
 
+TEST_F(ClientConnectionManagerTest, AsyncConnectionDrivesSessionFromThreads)
+{
+    m_mock_server->set_echo_requests(true);
+    ASSERT_TRUE(m_connection_manager->connect());
+
+    AsyncConnection async_connection(*m_connection_manager);
+    ASSERT_TRUE(async_connection.start());
+
+    constexpr int thread_count = 4;
+    constexpr int requests_per_thread = 25;
+    std::atomic<int> matched{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t]() {
+            std::vector<std::pair<std::string, ResponseFuture>> futures;
+            for (int i = 0; i < requests_per_thread; ++i) {
+                fenris::Request request;
+                request.set_command(fenris::RequestType::PING);
+                request.set_data(std::to_string(t) + "-" + std::to_string(i));
+                futures.emplace_back(request.data(),
+                                     async_connection.submit(request));
+            }
+            for (auto &[data, future] : futures) {
+                auto response = future.get();
+                if (response.has_value() && response->data() == data) {
+                    ++matched;
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(matched, thread_count * requests_per_thread);
+    EXPECT_EQ(async_connection.outstanding(), 0);
+
+    // Once stopped, submissions fail and the session is usable directly
+    async_connection.stop();
+    fenris::Request late_request;
+    late_request.set_command(fenris::RequestType::PING);
+    EXPECT_FALSE(async_connection.submit(late_request).get().has_value());
+
+    late_request.set_data("direct");
+    ASSERT_TRUE(m_connection_manager->send_request(late_request));
+    auto response = m_connection_manager->receive_response();
+    ASSERT_TRUE(response.has_value());
+    EXPECT_EQ(response->data(), "direct");
+    EXPECT_EQ(m_mock_server->get_received_requests().size(),
+              thread_count * requests_per_thread + 1);
+}
+
 } // namespace tests
 } // namespace client
 } // namespace fenris
@@ -13,6 +13,8 @@
 #include <condition_variable>
 #include <cstring>
 #include <fcntl.h>
+#include <filesystem>
+#include <fstream>
 #include <gtest/gtest.h>
 #include <iostream>
 #include <mutex>
@@ -231,6 +233,11 @@ public:
         m_directories.insert(path);
     }
 
+    std::string get_file(const std::string& path) {
+        std::lock_guard<std::mutex> lock(m_fs_mutex);
+        return m_files[path];
+    }
+
     const std::vector<uint8_t>& get_encryption_key() const {
         return m_encryption_key;
     }
@@ -514,6 +521,14 @@ private:
             handle_info_file_request(request, response);
             break;
 
+        case fenris::RequestType::READ_CHUNK:
+            handle_read_chunk_request(request, response);
+            break;
+
+        case fenris::RequestType::WRITE_CHUNK:
+            handle_write_chunk_request(request, response);
+            break;
+
         case fenris::RequestType::TERMINATE:
             response.set_type(fenris::ResponseType::SUCCESS);
             response.set_data("Server terminating connection");
@@ -739,6 +754,55 @@ private:
         }
     }
 
+    void handle_read_chunk_request(const fenris::Request& request, fenris::Response& response) {
+        std::string file_path = request.filename();
+
+        std::lock_guard<std::mutex> lock(m_fs_mutex);
+        if (m_files.find(file_path) == m_files.end()) {
+            response.set_success(false);
+            response.set_type(fenris::ResponseType::ERROR);
+            response.set_error_message("file not found");
+            return;
+        }
+
+        const std::string& content = m_files[file_path];
+        uint64_t offset = std::min<uint64_t>(request.chunk().offset(), content.size());
+        std::string data = content.substr(offset, request.chunk().length());
+
+        response.set_type(fenris::ResponseType::FILE_CHUNK);
+        auto chunk_info = response.mutable_chunk_info();
+        chunk_info->set_offset(offset);
+        chunk_info->set_length(data.size());
+        chunk_info->set_total_size(content.size());
+        chunk_info->set_final(offset + data.size() >= content.size());
+        response.set_data(data);
+    }
+
+    void handle_write_chunk_request(const fenris::Request& request, fenris::Response& response) {
+        std::string file_path = request.filename();
+        uint64_t offset = request.chunk().offset();
+
+        std::lock_guard<std::mutex> lock(m_fs_mutex);
+        if (offset == 0) {
+            m_files[file_path].clear();
+        }
+
+        std::string& content = m_files[file_path];
+        if (content.size() != offset) {
+            response.set_success(false);
+            response.set_type(fenris::ResponseType::ERROR);
+            response.set_error_message("chunk out of order");
+            return;
+        }
+        content += request.data();
+
+        response.set_type(fenris::ResponseType::SUCCESS);
+        auto chunk_info = response.mutable_chunk_info();
+        chunk_info->set_offset(offset);
+        chunk_info->set_length(request.data().size());
+        chunk_info->set_final(request.chunk().final());
+    }
+
     // Helper method to get current time as a string for file info
     std::string get_current_time_string() {
         auto now = std::chrono::system_clock::now();
@@ -1316,6 +1380,179 @@ TEST_F(ClientIntegrationTest, NonExistentResources) {
     EXPECT_GE(error_count, 4);
 }
 
+// Build a payload spanning several default-sized chunks
+static std::string make_large_content() {
+    std::string content(2 * DEFAULT_CHUNK_SIZE + 12345, '\0');
+    for (size_t i = 0; i < content.size(); ++i) {
+        content[i] = static_cast<char>((i * 31) % 256);
+    }
+    return content;
+}
+
+// Test upload streams a local file in chunks
+TEST_F(ClientIntegrationTest, UploadCommand) {
+    const std::string local_path = "/tmp/fenris_upload_test.bin";
+    const std::string content = make_large_content();
+    {
+        std::ofstream file(local_path, std::ios::binary);
+        file.write(content.data(), content.size());
+    }
+
+    m_mock_tui->queue_command({"upload", local_path, "/uploaded.bin"});
+    runClient();
+    std::filesystem::remove(local_path);
+
+    auto requests = m_mock_server->get_received_requests();
+
+    // One WRITE_CHUNK per block, only the last one is final
+    ASSERT_EQ(requests.size(), 3);
+    uint64_t expected_offset = 0;
+    for (size_t i = 0; i < requests.size(); ++i) {
+        EXPECT_EQ(requests[i].command(), fenris::RequestType::WRITE_CHUNK);
+        EXPECT_EQ(requests[i].filename(), "/uploaded.bin");
+        EXPECT_EQ(requests[i].chunk().offset(), expected_offset);
+        EXPECT_LE(requests[i].data().size(), DEFAULT_CHUNK_SIZE);
+        EXPECT_EQ(requests[i].chunk().final(), i == requests.size() - 1);
+        expected_offset += requests[i].data().size();
+    }
+
+    EXPECT_EQ(m_mock_server->get_file("/uploaded.bin"), content);
+
+    auto results = m_mock_tui->get_displayed_results();
+    bool found_upload = false;
+    for (const auto& result : results) {
+        if (result.first && result.second.find("Uploaded") != std::string::npos) {
+            found_upload = true;
+            break;
+        }
+    }
+    EXPECT_TRUE(found_upload);
+}
+
+// Test download streams a remote file to disk in chunks
+TEST_F(ClientIntegrationTest, DownloadCommand) {
+    const std::string local_path = "/tmp/fenris_download_test.bin";
+    const std::string content = make_large_content();
+    m_mock_server->add_file("/large.bin", content);
+
+    m_mock_tui->queue_command({"download", "/large.bin", local_path});
+    m_mock_tui->queue_command({"download", "/missing.bin", local_path + ".missing"});
+    runClient();
+
+    std::ifstream file(local_path, std::ios::binary);
+    std::string downloaded((std::istreambuf_iterator<char>(file)),
+                           std::istreambuf_iterator<char>());
+    file.close();
+    std::filesystem::remove(local_path);
+    std::filesystem::remove(local_path + ".missing");
+
+    EXPECT_EQ(downloaded, content);
+
+    auto requests = m_mock_server->get_received_requests();
+    ASSERT_EQ(requests.size(), 4);
+    for (size_t i = 0; i < 3; ++i) {
+        EXPECT_EQ(requests[i].command(), fenris::RequestType::READ_CHUNK);
+        EXPECT_EQ(requests[i].chunk().offset(), i * DEFAULT_CHUNK_SIZE);
+    }
+
+    auto results = m_mock_tui->get_displayed_results();
+    bool found_download = false;
+    bool found_failure = false;
+    for (const auto& result : results) {
+        if (result.first && result.second.find("Downloaded") != std::string::npos) {
+            found_download = true;
+        }
+        if (!result.first && result.second.find("file not found") != std::string::npos) {
+            found_failure = true;
+        }
+    }
+    EXPECT_TRUE(found_download);
+    EXPECT_TRUE(found_failure);
+}
+
+// Test --streams is taken off the arguments and checked before transferring
+TEST_F(ClientIntegrationTest, TransferStreamsOption) {
+    const std::string local_path = "/tmp/fenris_streams_test.bin";
+    const std::string content = make_large_content();
+    {
+        std::ofstream file(local_path, std::ios::binary);
+        file.write(content.data(), content.size());
+    }
+
+    m_mock_tui->queue_command(
+        {"upload", "--streams", "1", local_path, "/streamed.bin"});
+    m_mock_tui->queue_command(
+        {"download", "--streams", "0", "/streamed.bin", local_path});
+    m_mock_tui->queue_command(
+        {"download", "--streams", "two", "/streamed.bin", local_path});
+    runClient();
+    std::filesystem::remove(local_path);
+
+    // A single stream keeps to the session already open
+    auto requests = m_mock_server->get_received_requests();
+    ASSERT_EQ(requests.size(), 3);
+    for (const auto& request : requests) {
+        EXPECT_EQ(request.command(), fenris::RequestType::WRITE_CHUNK);
+    }
+    EXPECT_EQ(m_mock_server->get_file("/streamed.bin"), content);
+
+    auto results = m_mock_tui->get_displayed_results();
+    size_t rejected = 0;
+    bool found_upload = false;
+    for (const auto& result : results) {
+        if (result.first &&
+            result.second.find("Uploaded") != std::string::npos) {
+            found_upload = true;
+        }
+        if (!result.first &&
+            result.second.find("Streams must be") != std::string::npos) {
+            ++rejected;
+        }
+    }
+    EXPECT_TRUE(found_upload);
+    EXPECT_EQ(rejected, 2);
+}
+
+TEST_F(ClientIntegrationTest, DeltaUploadFallsBackToWholeFile) {
+    const std::string local_path = "/tmp/fenris_delta_test.bin";
+    const std::string content = make_large_content();
+    {
+        std::ofstream file(local_path, std::ios::binary);
+        file.write(content.data(), content.size());
+    }
+
+    // Without signatures from the server the file goes up in chunks
+    m_mock_tui->queue_command({"upload", "--delta", local_path, "/delta.bin"});
+    m_mock_tui->queue_command(
+        {"upload", "--delta", "--streams", "2", local_path, "/delta.bin"});
+    runClient();
+    std::filesystem::remove(local_path);
+
+    auto requests = m_mock_server->get_received_requests();
+    ASSERT_GE(requests.size(), 2);
+    EXPECT_EQ(requests[0].command(), fenris::RequestType::SIGNATURES);
+    for (size_t i = 1; i < requests.size(); ++i) {
+        EXPECT_EQ(requests[i].command(), fenris::RequestType::WRITE_CHUNK);
+    }
+    EXPECT_EQ(m_mock_server->get_file("/delta.bin"), content);
+
+    auto results = m_mock_tui->get_displayed_results();
+    bool found_upload = false;
+    bool rejected = false;
+    for (const auto& result : results) {
+        if (result.first &&
+            result.second.find("Uploaded") != std::string::npos) {
+            found_upload = true;
+        }
+        if (!result.first &&
+            result.second.find("cannot be combined") != std::string::npos) {
+            rejected = true;
+        }
+    }
+    EXPECT_TRUE(found_upload);
+    EXPECT_TRUE(rejected);
+}
+
 } // namespace tests
 } // namespace client
 } // namespace fenris
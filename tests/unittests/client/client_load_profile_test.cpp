@@ -0,0 +1,118 @@
+#include "client/latency_histogram.hpp"
+#include "client/load_profile.hpp"
+
+#include <array>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <random>
+
+namespace fenris {
+namespace client {
+namespace tests {
+
+TEST(LatencyHistogramTest, SmallValuesAreExact)
+{
+    LatencyHistogram histogram;
+    for (uint64_t value = 1; value <= 100; ++value) {
+        histogram.record(value);
+    }
+
+    EXPECT_EQ(histogram.count(), 100);
+    EXPECT_EQ(histogram.min(), 1);
+    EXPECT_EQ(histogram.max(), 100);
+    EXPECT_DOUBLE_EQ(histogram.mean(), 50.5);
+    EXPECT_EQ(histogram.percentile(50), 50);
+    EXPECT_EQ(histogram.percentile(99), 99);
+    EXPECT_EQ(histogram.percentile(100), 100);
+    EXPECT_EQ(histogram.percentile(0), 1);
+}
+
+TEST(LatencyHistogramTest, LargeValuesStayWithinPrecision)
+{
+    LatencyHistogram histogram;
+    std::mt19937_64 rng(7);
+    std::uniform_int_distribution<uint64_t> latency(1'000, 1'000'000'000);
+    for (int i = 0; i < 10'000; ++i) {
+        histogram.record(latency(rng));
+    }
+
+    // Uniform values, so the 90th percentile is near 900 ms
+    const double relative_error =
+        1.0 / (1 << LatencyHistogram::SUB_BUCKET_BITS);
+    const double p90 = static_cast<double>(histogram.percentile(90));
+    EXPECT_NEAR(p90, 900'000'000.0, 900'000'000.0 * (0.02 + relative_error));
+    EXPECT_LE(histogram.percentile(99.9), histogram.max());
+
+    // The extremes of the 64-bit range have buckets too
+    histogram.record(UINT64_MAX);
+    EXPECT_EQ(histogram.percentile(100), UINT64_MAX);
+}
+
+TEST(LatencyHistogramTest, MergeCombinesCounts)
+{
+    LatencyHistogram fast;
+    LatencyHistogram slow;
+    for (int i = 0; i < 90; ++i) {
+        fast.record(10);
+    }
+    for (int i = 0; i < 10; ++i) {
+        slow.record(100'000);
+    }
+
+    fast.merge(slow);
+    EXPECT_EQ(fast.count(), 100);
+    EXPECT_EQ(fast.percentile(90), 10);
+    EXPECT_GE(fast.percentile(95), 99'000);
+    EXPECT_EQ(fast.max(), 100'000);
+
+    LatencyHistogram empty;
+    EXPECT_EQ(empty.percentile(99), 0);
+    EXPECT_EQ(empty.min(), 0);
+}
+
+TEST(LoadProfileTest, OpMixFollowsWeights)
+{
+    auto mix = OpMix::parse("ping:1, read:3,write:0");
+    ASSERT_TRUE(mix.has_value());
+    EXPECT_DOUBLE_EQ(mix->share(LoadOp::PING), 0.25);
+    EXPECT_DOUBLE_EQ(mix->share(LoadOp::READ), 0.75);
+    EXPECT_DOUBLE_EQ(mix->share(LoadOp::WRITE), 0.0);
+
+    std::mt19937_64 rng(1);
+    std::array<int, LOAD_OP_COUNT> picks{};
+    for (int i = 0; i < 10'000; ++i) {
+        ++picks[static_cast<size_t>(mix->pick(rng))];
+    }
+    EXPECT_EQ(picks[static_cast<size_t>(LoadOp::WRITE)], 0);
+    EXPECT_NEAR(picks[static_cast<size_t>(LoadOp::READ)], 7'500, 300);
+
+    EXPECT_FALSE(OpMix::parse("ping:1,delete:1").has_value());
+    EXPECT_FALSE(OpMix::parse("ping:-1").has_value());
+    EXPECT_FALSE(OpMix::parse("ping:x").has_value());
+    EXPECT_FALSE(OpMix::parse("ping:0").has_value());
+    EXPECT_FALSE(OpMix::parse("").has_value());
+}
+
+TEST(LoadProfileTest, SizesTakeSuffixes)
+{
+    auto sizes = SizeDistribution::parse("512,4k:2,1M:1");
+    ASSERT_TRUE(sizes.has_value());
+    ASSERT_EQ(sizes->sizes().size(), 3);
+    EXPECT_EQ(sizes->sizes()[0], 512);
+    EXPECT_EQ(sizes->sizes()[1], 4096);
+    EXPECT_EQ(sizes->sizes()[2], 1024 * 1024);
+    EXPECT_EQ(sizes->max(), 1024 * 1024);
+
+    auto fixed = SizeDistribution::parse("16k");
+    ASSERT_TRUE(fixed.has_value());
+    std::mt19937_64 rng(1);
+    EXPECT_EQ(fixed->pick(rng), 16 * 1024);
+
+    EXPECT_FALSE(SizeDistribution::parse("4q").has_value());
+    EXPECT_FALSE(SizeDistribution::parse("k").has_value());
+    EXPECT_FALSE(SizeDistribution::parse("4k:").has_value());
+}
+
+} // namespace tests
+} // namespace client
+} // namespace fenris
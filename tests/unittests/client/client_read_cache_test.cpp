@@ -0,0 +1,121 @@
+#include "client/read_cache.hpp"
+#include "common/logging.hpp"
+
+#include <chrono>
+#include <gtest/gtest.h>
+#include <string>
+
+namespace fenris {
+namespace client {
+namespace tests {
+
+using namespace std::chrono_literals;
+
+class ReadCacheTest : public ::testing::Test {
+  protected:
+    void SetUp() override
+    {
+        common::LoggingConfig log_config;
+        log_config.level = common::LogLevel::DEBUG;
+        log_config.console_logging = true;
+        log_config.file_logging = false;
+
+        common::initialize_logging(log_config, "TestReadCache");
+    }
+
+    static ReadCache::Clock::time_point in(std::chrono::milliseconds delay)
+    {
+        return ReadCache::Clock::now() + delay;
+    }
+};
+
+TEST_F(ReadCacheTest, LeasedEntriesAreHits)
+{
+    ReadCache cache;
+    EXPECT_FALSE(cache.lookup("/conf.txt").has_value());
+
+    cache.store("/conf.txt", "v1", 100, in(1h));
+    auto cached = cache.lookup("/conf.txt");
+    ASSERT_TRUE(cached.has_value());
+    EXPECT_TRUE(cached->leased);
+    EXPECT_EQ(cached->content, "v1");
+    EXPECT_EQ(cached->modified_time, 100);
+
+    ReadCacheStats stats = cache.get_stats();
+    EXPECT_EQ(stats.hits, 1);
+    EXPECT_EQ(stats.misses, 1);
+}
+
+TEST_F(ReadCacheTest, ExpiredLeasesAreRenewedOnlyForTheSameVersion)
+{
+    ReadCache cache;
+    cache.store("/conf.txt", "v1", 100, in(-1ms));
+
+    // Past its lease the entry is still offered, for revalidation
+    auto cached = cache.lookup("/conf.txt");
+    ASSERT_TRUE(cached.has_value());
+    EXPECT_FALSE(cached->leased);
+    EXPECT_EQ(cache.get_stats().hits, 0);
+
+    auto renewed = cache.renew("/conf.txt", 100, in(1h));
+    ASSERT_TRUE(renewed.has_value());
+    EXPECT_EQ(*renewed, "v1");
+    EXPECT_TRUE(cache.lookup("/conf.txt")->leased);
+    EXPECT_EQ(cache.get_stats().revalidations, 1);
+
+    // Another version means the copy is of no use
+    EXPECT_FALSE(cache.renew("/conf.txt", 200, in(1h)).has_value());
+    EXPECT_FALSE(cache.lookup("/conf.txt").has_value());
+    EXPECT_FALSE(cache.renew("/missing.txt", 100, in(1h)).has_value());
+}
+
+TEST_F(ReadCacheTest, InvalidationDropsFilesAndDirectories)
+{
+    ReadCache cache;
+    cache.store("/a.txt", "a", 1, in(1h));
+    cache.store("/dir/b.txt", "b", 1, in(1h));
+    cache.store("/dir/sub/c.txt", "c", 1, in(1h));
+    cache.store("/directory.txt", "d", 1, in(1h));
+
+    cache.invalidate("/a.txt");
+    EXPECT_FALSE(cache.lookup("/a.txt").has_value());
+
+    cache.invalidate_prefix("/dir");
+    EXPECT_FALSE(cache.lookup("/dir/b.txt").has_value());
+    EXPECT_FALSE(cache.lookup("/dir/sub/c.txt").has_value());
+    EXPECT_TRUE(cache.lookup("/directory.txt").has_value());
+    EXPECT_EQ(cache.get_entry_count(), 1);
+    EXPECT_EQ(cache.get_cache_bytes(), 1);
+
+    cache.clear();
+    EXPECT_EQ(cache.get_entry_count(), 0);
+    EXPECT_EQ(cache.get_cache_bytes(), 0);
+}
+
+TEST_F(ReadCacheTest, EvictsLeastRecentlyReadWithinBudget)
+{
+    ReadCacheConfig config;
+    config.max_bytes = 10;
+    config.max_entry_bytes = 6;
+    ReadCache cache(config);
+
+    cache.store("/a", "aaaa", 1, in(1h));
+    cache.store("/b", "bbbb", 1, in(1h));
+    cache.lookup("/a");
+    cache.store("/c", "cccc", 1, in(1h));
+
+    EXPECT_TRUE(cache.lookup("/a").has_value());
+    EXPECT_FALSE(cache.lookup("/b").has_value());
+    EXPECT_TRUE(cache.lookup("/c").has_value());
+    EXPECT_EQ(cache.get_cache_bytes(), 8);
+    EXPECT_EQ(cache.get_stats().evictions, 1);
+
+    // Too large to cache, and the older copy goes too
+    cache.store("/a", "aaaaaaa", 2, in(1h));
+    EXPECT_FALSE(cache.lookup("/a").has_value());
+    EXPECT_EQ(cache.get_cache_bytes(), 4);
+}
+
+} // namespace tests
+} // namespace client
+} // namespace fenris
@@ -64,6 +64,15 @@ TEST_F(RequestManagerTest, GenerateLsRequest)
     EXPECT_EQ(request_opt_with_path.value().command(),
               fenris::RequestType::LIST_DIR);
     EXPECT_EQ(request_opt_with_path.value().filename(), "/some/dir");
+    EXPECT_FALSE(request_opt_with_path.value().list().names_only());
+
+    auto args_names_only = create_args({"ls", "-n", "/some/dir"});
+    auto request_opt_names_only =
+        request_manager.generate_request(args_names_only);
+    ASSERT_TRUE(request_opt_names_only.has_value());
+    EXPECT_EQ(request_opt_names_only.value().filename(), "/some/dir");
+    EXPECT_TRUE(request_opt_names_only.value().list().names_only());
+    EXPECT_EQ(request_opt_names_only.value().list().cursor(), 0);
 }
 
 TEST_F(RequestManagerTest, GenerateReadFileRequest)
@@ -173,6 +182,104 @@ TEST_F(RequestManagerTest, GenerateDeleteDirRequest)
     EXPECT_EQ(request_opt.value().filename(), "empty_dir");
 }
 
+TEST_F(RequestManagerTest, GenerateRangeRequests)
+{
+    auto request_opt = request_manager.generate_request(
+        create_args({"readat", "table.db", "4096", "512"}));
+    ASSERT_TRUE(request_opt.has_value());
+    EXPECT_EQ(request_opt.value().command(), fenris::RequestType::READ_RANGE);
+    EXPECT_EQ(request_opt.value().filename(), "table.db");
+    EXPECT_EQ(request_opt.value().chunk().offset(), 4096);
+    EXPECT_EQ(request_opt.value().chunk().length(), 512);
+
+    request_opt = request_manager.generate_request(
+        create_args({"writeat", "table.db", "8", "patched", "bytes"}));
+    ASSERT_TRUE(request_opt.has_value());
+    EXPECT_EQ(request_opt.value().command(), fenris::RequestType::WRITE_AT);
+    EXPECT_EQ(request_opt.value().chunk().offset(), 8);
+    EXPECT_EQ(request_opt.value().data(), "patched bytes");
+
+    EXPECT_FALSE(request_manager
+                     .generate_request(
+                         create_args({"readat", "table.db", "-1", "512"}))
+                     .has_value());
+    EXPECT_FALSE(
+        request_manager
+            .generate_request(create_args({"writeat", "table.db", "8"}))
+            .has_value());
+}
+
+TEST_F(RequestManagerTest, GenerateBatchRequest)
+{
+    std::string script = create_temp_file("# set up\n"
+                                          "mkdir logs\n"
+                                          "\n"
+                                          "  create logs/a.txt hello\n"
+                                          "info logs/a.txt\n");
+    auto request_opt = request_manager.generate_request(
+        create_args({"batch", script.c_str()}));
+    ASSERT_TRUE(request_opt.has_value());
+    EXPECT_EQ(request_opt->command(), fenris::RequestType::BATCH);
+    EXPECT_FALSE(request_opt->batch().parallel());
+    ASSERT_EQ(request_opt->batch().requests_size(), 3);
+    EXPECT_EQ(request_opt->batch().requests(0).command(),
+              fenris::RequestType::CREATE_DIR);
+    EXPECT_EQ(request_opt->batch().requests(1).filename(), "logs/a.txt");
+    EXPECT_EQ(request_opt->batch().requests(1).data(), "hello");
+    EXPECT_EQ(request_opt->batch().requests(2).command(),
+              fenris::RequestType::INFO_FILE);
+
+    request_opt = request_manager.generate_request(
+        create_args({"batch", "-p", script.c_str()}));
+    ASSERT_TRUE(request_opt.has_value());
+    EXPECT_TRUE(request_opt->batch().parallel());
+    unlink(script.c_str());
+
+    // A bad line, a nested batch or nothing to run rejects the script
+    for (const char *content :
+         {"ping\ncat\n", "batch other.txt\n", "# only a comment\n"}) {
+        script = create_temp_file(content);
+        EXPECT_FALSE(
+            request_manager
+                .generate_request(create_args({"batch", script.c_str()}))
+                .has_value());
+        unlink(script.c_str());
+    }
+    EXPECT_FALSE(request_manager
+                     .generate_request(create_args({"batch", "/nonexistent"}))
+                     .has_value());
+    EXPECT_FALSE(
+        request_manager.generate_request(create_args({"batch", "-p"}))
+            .has_value());
+}
+
+TEST_F(RequestManagerTest, GenerateTreeRequests)
+{
+    auto copy = request_manager.generate_request(
+        create_args({"cptree", "src", "dst"}));
+    ASSERT_TRUE(copy.has_value());
+    EXPECT_EQ(copy->command(), fenris::RequestType::COPY_TREE);
+    EXPECT_EQ(copy->filename(), "src");
+    EXPECT_EQ(copy->tree().destination(), "dst");
+    EXPECT_EQ(copy->tree().progress_interval_ms(), TREE_PROGRESS_INTERVAL_MS);
+
+    auto find = request_manager.generate_request(
+        create_args({"find", "/logs", "*.log"}));
+    ASSERT_TRUE(find.has_value());
+    EXPECT_EQ(find->command(), fenris::RequestType::FIND);
+    EXPECT_EQ(find->tree().pattern(), "*.log");
+
+    auto du = request_manager.generate_request(create_args({"du", "/"}));
+    ASSERT_TRUE(du.has_value());
+    EXPECT_EQ(du->command(), fenris::RequestType::DU);
+
+    EXPECT_FALSE(
+        request_manager.generate_request(create_args({"cptree", "src"}))
+            .has_value());
+    EXPECT_FALSE(
+        request_manager.generate_request(create_args({"rmtree"})).has_value());
+}
+
 TEST_F(RequestManagerTest, GenerateTerminateRequest)
 {
     auto args = create_args({"terminate"}); // Assuming 'terminate' is a valid command
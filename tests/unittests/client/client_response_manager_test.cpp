@@ -168,6 +168,29 @@ TEST_F(ResponseManagerTest, HandleTerminatedResponse)
     EXPECT_EQ(result[1], "Server connection terminated");
 }
 
+TEST_F(ResponseManagerTest, HandleBatchResultsResponse)
+{
+    fenris::Response response;
+    response.set_success(false);
+    response.set_type(fenris::ResponseType::BATCH_RESULTS);
+    auto *pong = response.mutable_batch_results()->add_responses();
+    pong->set_success(true);
+    pong->set_type(fenris::ResponseType::PONG);
+    auto *error = response.mutable_batch_results()->add_responses();
+    error->set_success(false);
+    error->set_type(fenris::ResponseType::ERROR);
+    error->set_error_message("File not found");
+
+    auto result = response_manager.handle_response(response);
+    ASSERT_EQ(result.size(), 6);
+    EXPECT_EQ(result[0], "Error");
+    EXPECT_EQ(result[1], "[1] Success");
+    EXPECT_EQ(result[2], "Server is alive");
+    EXPECT_EQ(result[3], "[2] Error");
+    EXPECT_EQ(result[4], "Error: File not found");
+    EXPECT_EQ(result[5], "2 commands, 1 failed");
+}
+
 TEST_F(ResponseManagerTest, HandleUnknownResponseType)
 {
     fenris::Response response;
@@ -0,0 +1,213 @@
+#include "common/buffer.hpp"
+#include "common/buffer_pool.hpp"
+#include "common/request.hpp"
+#include "common/response.hpp"
+
+#include <cstring>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fenris {
+namespace common {
+namespace tests {
+
+TEST(BufferTest, DefaultIsEmpty)
+{
+    Buffer buffer;
+    EXPECT_TRUE(buffer.empty());
+    EXPECT_EQ(buffer.size(), 0);
+    EXPECT_EQ(buffer.data(), nullptr);
+    EXPECT_EQ(buffer.use_count(), 0);
+}
+
+TEST(BufferTest, CopyOfDuplicatesBytes)
+{
+    std::vector<uint8_t> source = {1, 2, 3, 4};
+    Buffer buffer = Buffer::copy_of(source);
+    source[0] = 9;
+
+    ASSERT_EQ(buffer.size(), 4);
+    EXPECT_EQ(buffer.to_vector(), (std::vector<uint8_t>{1, 2, 3, 4}));
+}
+
+TEST(BufferTest, WrapAdoptsStorageWithoutCopy)
+{
+    std::vector<uint8_t> source(1024, 0xAB);
+    const uint8_t *original = source.data();
+
+    Buffer buffer = Buffer::wrap(std::move(source));
+    EXPECT_EQ(buffer.data(), original);
+    EXPECT_EQ(buffer.size(), 1024);
+
+    std::string text = "a string long enough to live on the heap";
+    const char *text_data = text.data();
+    Buffer from_string = Buffer::wrap(std::move(text));
+    EXPECT_EQ(reinterpret_cast<const char *>(from_string.data()), text_data);
+    EXPECT_EQ(from_string.view(), "a string long enough to live on the heap");
+}
+
+TEST(BufferTest, SliceSharesSlab)
+{
+    Buffer buffer = Buffer::copy_of(std::vector<uint8_t>{0, 1, 2, 3, 4, 5});
+    Buffer slice = buffer.slice(2, 3);
+
+    EXPECT_EQ(slice.data(), buffer.data() + 2);
+    EXPECT_EQ(slice.to_vector(), (std::vector<uint8_t>{2, 3, 4}));
+    EXPECT_EQ(buffer.use_count(), 2);
+
+    // Writes through one view are visible through the other
+    slice.data()[0] = 42;
+    EXPECT_EQ(buffer.data()[2], 42);
+
+    // Out of range slices are clamped or empty
+    EXPECT_EQ(buffer.slice(4).size(), 2);
+    EXPECT_TRUE(buffer.slice(6).empty());
+}
+
+TEST(BufferTest, SliceOutlivesOriginal)
+{
+    Buffer slice;
+    {
+        Buffer buffer = Buffer::copy_of(std::vector<uint8_t>{7, 8, 9});
+        slice = buffer.slice(1);
+    }
+
+    EXPECT_EQ(slice.use_count(), 1);
+    EXPECT_EQ(slice.to_vector(), (std::vector<uint8_t>{8, 9}));
+}
+
+TEST(BufferTest, TruncateOnlyShrinks)
+{
+    Buffer buffer = Buffer::allocate(16);
+    buffer.truncate(32);
+    EXPECT_EQ(buffer.size(), 16);
+    buffer.truncate(4);
+    EXPECT_EQ(buffer.size(), 4);
+}
+
+TEST(BufferTest, AdoptKeepsOwnerAlive)
+{
+    bool released = false;
+    auto *bytes = new uint8_t[4]{'a', 'b', 'c', 'd'};
+    std::shared_ptr<void> owner(bytes, [&released](void *memory) {
+        delete[] static_cast<uint8_t *>(memory);
+        released = true;
+    });
+
+    Buffer buffer = Buffer::adopt(std::move(owner), bytes, 4);
+    Buffer tail = buffer.slice(2);
+    buffer = Buffer();
+    EXPECT_FALSE(released);
+    EXPECT_EQ(tail.view(), "cd");
+
+    tail = Buffer();
+    EXPECT_TRUE(released);
+}
+
+TEST(BufferTest, ProtobufRoundTrip)
+{
+    fenris::Request request;
+    request.set_command(fenris::RequestType::WRITE_FILE);
+    request.set_filename("/tmp/file.bin");
+    request.set_data(std::string(4096, 'x'));
+
+    Buffer serialized = serialize_request_to_buffer(request);
+    EXPECT_EQ(serialized.to_vector(), serialize_request(request));
+
+    fenris::Request parsed = deserialize_request(serialized);
+    EXPECT_EQ(parsed.filename(), request.filename());
+    EXPECT_EQ(parsed.data(), request.data());
+
+    fenris::Response response;
+    response.set_type(fenris::ResponseType::FILE_CONTENT);
+    response.set_success(true);
+    response.set_data("payload");
+
+    fenris::Response parsed_response =
+        deserialize_response(serialize_response_to_buffer(response));
+    EXPECT_EQ(parsed_response.data(), "payload");
+    EXPECT_TRUE(parsed_response.success());
+}
+
+TEST(BufferTest, SerializesWithTailRoom)
+{
+    fenris::Request request;
+    request.set_command(fenris::RequestType::PING);
+    request.set_data("ping");
+    const std::vector<uint8_t> expected = serialize_request(request);
+
+    Buffer serialized = serialize_request_to_buffer(request, 16);
+    ASSERT_EQ(serialized.size(), expected.size() + 16);
+    EXPECT_EQ(serialized.slice(0, expected.size()).to_vector(), expected);
+
+    fenris::Response response;
+    response.set_data("pong");
+    Buffer serialized_response = serialize_response_to_buffer(response, 16);
+    ASSERT_GT(serialized_response.size(), 16);
+    fenris::Response parsed = deserialize_response(
+        serialized_response.slice(0, serialized_response.size() - 16));
+    EXPECT_EQ(parsed.data(), "pong");
+}
+
+TEST(BufferPoolTest, SizesRoundUpToClasses)
+{
+    EXPECT_EQ(BufferPool::class_size(1), BufferPool::MIN_CLASS_SIZE);
+    EXPECT_EQ(BufferPool::class_size(4096), 4096u);
+    EXPECT_EQ(BufferPool::class_size(4097), 8192u);
+    EXPECT_EQ(BufferPool::class_size(BufferPool::MAX_CLASS_SIZE),
+              BufferPool::MAX_CLASS_SIZE);
+    EXPECT_EQ(BufferPool::class_size(BufferPool::MAX_CLASS_SIZE + 1), 0u);
+}
+
+TEST(BufferPoolTest, FreedSlabIsReused)
+{
+    BufferPool::trim();
+    const uint8_t *first = nullptr;
+    {
+        Buffer buffer = Buffer::allocate(3000);
+        first = buffer.data();
+    }
+
+    const BufferPoolStats before = BufferPool::get_stats();
+    Buffer again = Buffer::allocate(4000);
+    const BufferPoolStats after = BufferPool::get_stats();
+
+    // Same class, so the slab and its reference count both come back
+    EXPECT_EQ(again.data(), first);
+    EXPECT_EQ(after.misses, before.misses);
+    EXPECT_EQ(after.hits, before.hits + 2);
+}
+
+TEST(BufferPoolTest, SlabsTravelBetweenThreads)
+{
+    BufferPool::trim();
+    std::vector<Buffer> received;
+    for (int i = 0; i < 64; ++i) {
+        received.push_back(Buffer::allocate(64 * 1024));
+    }
+
+    // Freed on a thread that exits, so its cache empties into the depot
+    // rather than keeping the slabs
+    std::thread worker([moved = std::move(received)]() mutable {
+        moved.clear();
+    });
+    worker.join();
+
+    const BufferPoolStats before = BufferPool::get_stats();
+    Buffer buffer = Buffer::allocate(64 * 1024);
+    EXPECT_EQ(BufferPool::get_stats().misses, before.misses);
+}
+
+TEST(BufferPoolTest, LargeSlabsBypassThePool)
+{
+    const BufferPoolStats before = BufferPool::get_stats();
+    Buffer buffer = Buffer::allocate(BufferPool::MAX_CLASS_SIZE + 1);
+    ASSERT_EQ(buffer.size(), BufferPool::MAX_CLASS_SIZE + 1);
+    EXPECT_EQ(BufferPool::get_stats().oversized, before.oversized + 1);
+}
+
+} // namespace tests
+} // namespace common
+} // namespace fenris
@@ -0,0 +1,115 @@
+#include "common/chunked_aead.hpp"
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+namespace fenris {
+namespace common {
+namespace crypto {
+namespace tests {
+
+namespace {
+
+std::vector<uint8_t> make_stream_key()
+{
+    const std::vector<uint8_t> session_key(32, 0x42);
+    const std::vector<uint8_t> iv(AES_GCM_IV_SIZE, 0x07);
+    auto [key, result] = derive_stream_key(session_key, iv);
+    EXPECT_EQ(result, ECDHResult::SUCCESS);
+    return key;
+}
+
+// Plaintext of the given size followed by room for the tag
+std::vector<uint8_t> make_chunk(size_t size, uint8_t seed)
+{
+    std::vector<uint8_t> chunk(size + AES_GCM_TAG_SIZE);
+    for (size_t i = 0; i < size; ++i) {
+        chunk[i] = static_cast<uint8_t>(seed + i);
+    }
+    return chunk;
+}
+
+} // namespace
+
+TEST(ChunkedAeadTest, StreamKeysDifferPerMessage)
+{
+    const std::vector<uint8_t> session_key(32, 0x42);
+    const std::vector<uint8_t> first_iv(AES_GCM_IV_SIZE, 1);
+    const std::vector<uint8_t> second_iv(AES_GCM_IV_SIZE, 2);
+
+    auto [first, first_result] = derive_stream_key(session_key, first_iv);
+    auto [second, second_result] = derive_stream_key(session_key, second_iv);
+    ASSERT_EQ(first_result, ECDHResult::SUCCESS);
+    ASSERT_EQ(second_result, ECDHResult::SUCCESS);
+    EXPECT_EQ(first.size(), session_key.size());
+    EXPECT_NE(first, second);
+    EXPECT_NE(first, session_key);
+}
+
+TEST(ChunkedAeadTest, OpensChunksAtTheirPosition)
+{
+    const ChunkedAead aead(make_stream_key());
+    const auto plaintext = make_chunk(1000, 3);
+
+    auto chunk = plaintext;
+    ASSERT_EQ(aead.seal(5, false, chunk), EncryptionResult::SUCCESS);
+    EXPECT_NE(chunk, plaintext);
+
+    auto opened = chunk;
+    ASSERT_EQ(aead.open(5, false, opened), EncryptionResult::SUCCESS);
+    EXPECT_TRUE(std::equal(
+        plaintext.begin(), plaintext.end() - AES_GCM_TAG_SIZE, opened.begin()));
+
+    // Moved, or claimed to end the stream, it no longer authenticates
+    auto moved = chunk;
+    EXPECT_EQ(aead.open(6, false, moved), EncryptionResult::DECRYPTION_FAILED);
+    EXPECT_TRUE(std::all_of(moved.begin(),
+                            moved.end() - AES_GCM_TAG_SIZE,
+                            [](uint8_t byte) { return byte == 0; }));
+    auto truncated = chunk;
+    EXPECT_EQ(aead.open(5, true, truncated),
+              EncryptionResult::DECRYPTION_FAILED);
+
+    std::vector<uint8_t> too_short(AES_GCM_TAG_SIZE - 1);
+    EXPECT_EQ(aead.seal(0, true, too_short), EncryptionResult::INVALID_DATA);
+    EXPECT_EQ(ChunkedAead({1, 2, 3}).seal(0, true, chunk),
+              EncryptionResult::INVALID_KEY_SIZE);
+}
+
+TEST(ChunkedAeadTest, SealsFromManyThreads)
+{
+    const ChunkedAead aead(make_stream_key());
+    constexpr size_t chunk_count = 16;
+
+    std::vector<std::vector<uint8_t>> chunks;
+    for (size_t i = 0; i < chunk_count; ++i) {
+        chunks.push_back(make_chunk(4096 + i, static_cast<uint8_t>(i)));
+    }
+    const auto plaintexts = chunks;
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < chunk_count; ++i) {
+        threads.emplace_back([&aead, &chunks, i]() {
+            EXPECT_EQ(aead.seal(i, i + 1 == chunk_count, chunks[i]),
+                      EncryptionResult::SUCCESS);
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    // Opened in order, every chunk matches the one sealed at its position
+    for (size_t i = 0; i < chunk_count; ++i) {
+        ASSERT_EQ(aead.open(i, i + 1 == chunk_count, chunks[i]),
+                  EncryptionResult::SUCCESS);
+        EXPECT_TRUE(std::equal(plaintexts[i].begin(),
+                               plaintexts[i].end() - AES_GCM_TAG_SIZE,
+                               chunks[i].begin()));
+    }
+}
+
+} // namespace tests
+} // namespace crypto
+} // namespace common
+} // namespace fenris
@@ -0,0 +1,191 @@
+#include "common/codec.hpp"
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace fenris {
+namespace common {
+namespace compress {
+namespace tests {
+
+static std::vector<uint8_t> make_text(size_t size, unsigned seed = 3)
+{
+    static const std::string words[] = {
+        "server ", "client ", "chunk ", "stream ", "file ", "request "};
+    std::vector<uint8_t> text;
+    text.reserve(size);
+    std::mt19937 gen(seed);
+    while (text.size() < size) {
+        const std::string &word = words[gen() % 6];
+        text.insert(text.end(), word.begin(), word.end());
+    }
+    text.resize(size);
+    return text;
+}
+
+static std::vector<uint8_t> make_random(size_t size)
+{
+    std::vector<uint8_t> data(size);
+    std::mt19937 gen(3);
+    for (auto &byte : data) {
+        byte = static_cast<uint8_t>(gen());
+    }
+    return data;
+}
+
+class CodecTest : public ::testing::TestWithParam<CodecId> {};
+
+TEST_P(CodecTest, RoundTripsMessages)
+{
+    auto encoder = make_codec(GetParam());
+    auto decoder = make_codec(GetParam());
+    ASSERT_NE(encoder, nullptr);
+    EXPECT_EQ(encoder->id(), GetParam());
+
+    // Long runs make LZ4 matches overlap their own output, far_repeat
+    // repeats itself further back than LZ4's 64 KiB window
+    std::vector<uint8_t> runs(100000, 'a');
+    runs.insert(runs.end(), 1000, 'b');
+    std::vector<uint8_t> far_repeat = make_random(70000);
+    const std::vector<uint8_t> head(far_repeat.begin(),
+                                    far_repeat.begin() + 5000);
+    far_repeat.insert(far_repeat.end(), head.begin(), head.end());
+    const std::vector<std::vector<uint8_t>> messages = {
+        {},
+        {42},
+        make_text(12),
+        make_text(13),
+        make_text(1024 * 1024),
+        make_random(100000),
+        runs,
+        far_repeat,
+        make_text(300),
+    };
+
+    for (const auto &message : messages) {
+        std::vector<uint8_t> compressed = {0xEE};
+        ASSERT_EQ(encoder->compress(message, compressed),
+                  CompressionResult::SUCCESS);
+        // Output is appended
+        ASSERT_FALSE(compressed.empty());
+        EXPECT_EQ(compressed[0], 0xEE);
+
+        std::vector<uint8_t> restored;
+        ASSERT_EQ(decoder->decompress(std::span(compressed).subspan(1),
+                                      0,
+                                      restored),
+                  CompressionResult::SUCCESS)
+            << "message of " << message.size() << " bytes";
+        EXPECT_EQ(restored, message);
+    }
+}
+
+TEST_P(CodecTest, EnforcesOutputLimit)
+{
+    auto encoder = make_codec(GetParam());
+    auto decoder = make_codec(GetParam());
+    const std::vector<uint8_t> message = make_text(64 * 1024);
+
+    std::vector<uint8_t> compressed;
+    ASSERT_EQ(encoder->compress(message, compressed),
+              CompressionResult::SUCCESS);
+    std::vector<uint8_t> restored;
+    EXPECT_EQ(decoder->decompress(compressed, 1024, restored),
+              CompressionResult::BUFFER_TOO_SMALL);
+}
+
+INSTANTIATE_TEST_SUITE_P(AllCodecs,
+                         CodecTest,
+                         ::testing::Values(CodecId::NONE,
+                                           CodecId::DEFLATE,
+                                           CodecId::LZ4),
+                         [](const auto &info) {
+                             return codec_id_to_string(info.param);
+                         });
+
+TEST(CodecIdTest, BuildsAvailableCodecsOnly)
+{
+    EXPECT_NE(available_codecs() & codec_mask(CodecId::DEFLATE), 0);
+    EXPECT_NE(available_codecs() & codec_mask(CodecId::LZ4), 0);
+    EXPECT_EQ(make_codec(static_cast<CodecId>(7)), nullptr);
+    EXPECT_EQ(codec_id_to_string(CodecId::LZ4), "lz4");
+}
+
+TEST(Lz4CodecTest, ReadsTheBlockFormat)
+{
+    // "abc", then a match of 9 bytes at offset 3, then "defgh" as the
+    // final literals, built by hand from the format description
+    const std::vector<uint8_t> block = {
+        0x35, 'a', 'b', 'c', 0x03, 0x00, 0x50, 'd', 'e', 'f', 'g', 'h'};
+    auto codec = make_codec(CodecId::LZ4);
+    std::vector<uint8_t> restored;
+    ASSERT_EQ(codec->decompress(block, 0, restored),
+              CompressionResult::SUCCESS);
+    EXPECT_EQ(std::string(restored.begin(), restored.end()),
+              "abcabcabcabcdefgh");
+
+    // Repetitive input turns into few sequences
+    const std::vector<uint8_t> text = make_text(64 * 1024);
+    std::vector<uint8_t> compressed;
+    ASSERT_EQ(codec->compress(text, compressed), CompressionResult::SUCCESS);
+    EXPECT_LT(compressed.size(), text.size() / 2);
+}
+
+TEST(Lz4CodecTest, RejectsMalformedBlocks)
+{
+    auto codec = make_codec(CodecId::LZ4);
+    const std::vector<std::vector<uint8_t>> blocks = {
+        // Empty, a block always has a final sequence
+        {},
+        // Literals run past the end
+        {0x50, 'a', 'b'},
+        // Offset 0
+        {0x10, 'a', 0x00, 0x00, 0x00},
+        // Offset before the start of the message
+        {0x10, 'a', 0x02, 0x00, 0x00},
+        // Truncated offset
+        {0x10, 'a', 0x01},
+        // Length continuation cut off
+        {0xF0, 0xFF},
+    };
+    for (const auto &block : blocks) {
+        std::vector<uint8_t> restored;
+        EXPECT_EQ(codec->decompress(block, 0, restored),
+                  CompressionResult::INVALID_DATA);
+    }
+}
+
+TEST(DeflateCodecTest, DictionaryHelpsShortMessages)
+{
+    CodecOptions options;
+    options.dictionary = make_text(16 * 1024, 5);
+    auto primed_encoder = make_codec(CodecId::DEFLATE, options);
+    auto primed_decoder = make_codec(CodecId::DEFLATE, options);
+    auto plain_encoder = make_codec(CodecId::DEFLATE);
+
+    const std::vector<uint8_t> message = make_text(400, 9);
+    std::vector<uint8_t> primed;
+    std::vector<uint8_t> plain;
+    ASSERT_EQ(primed_encoder->compress(message, primed),
+              CompressionResult::SUCCESS);
+    ASSERT_EQ(plain_encoder->compress(message, plain),
+              CompressionResult::SUCCESS);
+    EXPECT_LT(primed.size(), plain.size());
+
+    std::vector<uint8_t> restored;
+    ASSERT_EQ(primed_decoder->decompress(primed, 0, restored),
+              CompressionResult::SUCCESS);
+    EXPECT_EQ(restored, message);
+
+    // Without the dictionary the message cannot be read
+    auto plain_decoder = make_codec(CodecId::DEFLATE);
+    restored.clear();
+    EXPECT_EQ(plain_decoder->decompress(primed, 0, restored),
+              CompressionResult::INVALID_DATA);
+}
+
+} // namespace tests
+} // namespace compress
+} // namespace common
+} // namespace fenris
@@ -1,4 +1,5 @@
 #include "common/compression_manager.hpp"
+#include <algorithm>
 #include <cstring>
 #include <gtest/gtest.h>
 #include <random>
@@ -176,6 +177,159 @@ TEST_F(CompressionTest, DecompressTooSmallBuffer)
     EXPECT_EQ(decompress_success, CompressionResult::BUFFER_TOO_SMALL);
 }
 
+// Text that deflate shrinks well
+static std::vector<uint8_t> make_text(size_t size)
+{
+    static const std::string words[] = {
+        "server ", "client ", "chunk ", "stream ", "file ", "request "};
+    std::vector<uint8_t> text;
+    text.reserve(size);
+    std::mt19937 gen(42);
+    while (text.size() < size) {
+        const std::string &word = words[gen() % 6];
+        text.insert(text.end(), word.begin(), word.end());
+    }
+    text.resize(size);
+    return text;
+}
+
+// Test that every synced chunk can be decompressed as soon as it arrives
+TEST_F(CompressionTest, StreamChunksDecompressIndependently)
+{
+    const std::vector<uint8_t> input = make_text(1024 * 1024);
+    constexpr size_t chunk_size = 64 * 1024;
+
+    StreamCompressor compressor(6);
+    StreamDecompressor decompressor;
+    std::vector<uint8_t> output;
+    size_t compressed_total = 0;
+    for (size_t offset = 0; offset < input.size(); offset += chunk_size) {
+        std::vector<uint8_t> compressed;
+        ASSERT_EQ(compressor.compress(input.data() + offset,
+                                      chunk_size,
+                                      StreamFlush::SYNC,
+                                      compressed),
+                  CompressionResult::SUCCESS);
+        compressed_total += compressed.size();
+
+        ASSERT_EQ(decompressor.decompress(
+                      compressed.data(), compressed.size(), output),
+                  CompressionResult::SUCCESS);
+        ASSERT_EQ(output.size(), offset + chunk_size);
+        EXPECT_FALSE(decompressor.at_stream_end());
+    }
+    EXPECT_EQ(output, input);
+    EXPECT_LT(compressed_total, input.size() / 3);
+
+    // Ending the stream produces only its trailer
+    std::vector<uint8_t> trailer;
+    ASSERT_EQ(
+        compressor.compress(nullptr, 0, StreamFlush::FINISH, trailer),
+        CompressionResult::SUCCESS);
+    ASSERT_EQ(decompressor.decompress(trailer.data(), trailer.size(), output),
+              CompressionResult::SUCCESS);
+    EXPECT_EQ(output.size(), input.size());
+    EXPECT_TRUE(decompressor.at_stream_end());
+}
+
+// Test that later messages refer back to earlier ones
+TEST_F(CompressionTest, StreamKeepsWindowAcrossMessages)
+{
+    const std::vector<uint8_t> message = make_text(4096);
+
+    StreamCompressor compressor(6);
+    std::vector<uint8_t> first;
+    std::vector<uint8_t> second;
+    ASSERT_EQ(compressor.compress(
+                  message.data(), message.size(), StreamFlush::SYNC, first),
+              CompressionResult::SUCCESS);
+    ASSERT_EQ(compressor.compress(
+                  message.data(), message.size(), StreamFlush::SYNC, second),
+              CompressionResult::SUCCESS);
+    EXPECT_LT(second.size() * 4, first.size());
+
+    StreamDecompressor decompressor;
+    std::vector<uint8_t> output;
+    ASSERT_EQ(decompressor.decompress(first.data(), first.size(), output),
+              CompressionResult::SUCCESS);
+    ASSERT_EQ(decompressor.decompress(second.data(), second.size(), output),
+              CompressionResult::SUCCESS);
+    ASSERT_EQ(output.size(), 2 * message.size());
+    EXPECT_TRUE(std::equal(message.begin(), message.end(), output.begin()));
+    EXPECT_TRUE(std::equal(
+        message.begin(), message.end(), output.begin() + message.size()));
+}
+
+// Test that finished streams match the one-shot format and can follow each
+// other
+TEST_F(CompressionTest, StreamFinishMatchesOneShot)
+{
+    const std::vector<uint8_t> input = make_text(10000);
+
+    StreamCompressor compressor(9);
+    std::vector<uint8_t> streams;
+    for (int i = 0; i < 2; ++i) {
+        std::vector<uint8_t> compressed;
+        ASSERT_EQ(compressor.compress(input.data(),
+                                      input.size(),
+                                      StreamFlush::FINISH,
+                                      compressed),
+                  CompressionResult::SUCCESS);
+
+        auto [decompressed, result] =
+            compression_manager.decompress(compressed, input.size());
+        EXPECT_EQ(result, CompressionResult::SUCCESS);
+        EXPECT_EQ(decompressed, input);
+        streams.insert(streams.end(), compressed.begin(), compressed.end());
+    }
+
+    // Both streams in one piece, split at an arbitrary point
+    StreamDecompressor decompressor;
+    std::vector<uint8_t> output;
+    const size_t split = streams.size() / 2 + 3;
+    ASSERT_EQ(decompressor.decompress(streams.data(), split, output),
+              CompressionResult::SUCCESS);
+    EXPECT_FALSE(decompressor.at_stream_end());
+    ASSERT_EQ(decompressor.decompress(
+                  streams.data() + split, streams.size() - split, output),
+              CompressionResult::SUCCESS);
+    EXPECT_TRUE(decompressor.at_stream_end());
+    ASSERT_EQ(output.size(), 2 * input.size());
+    EXPECT_TRUE(std::equal(input.begin(), input.end(), output.begin()));
+}
+
+// Test stream errors
+TEST_F(CompressionTest, StreamErrors)
+{
+    std::vector<uint8_t> output;
+    StreamCompressor invalid_level(10);
+    const uint8_t byte = 1;
+    EXPECT_EQ(invalid_level.compress(&byte, 1, StreamFlush::FINISH, output),
+              CompressionResult::INVALID_LEVEL);
+    EXPECT_TRUE(output.empty());
+
+    const std::vector<uint8_t> invalid_data = {0x78, 0x9C, 0xFF, 0xFF, 0xFF};
+    StreamDecompressor decompressor;
+    EXPECT_EQ(decompressor.decompress(
+                  invalid_data.data(), invalid_data.size(), output),
+              CompressionResult::INVALID_DATA);
+
+    // Small inputs that expand past the limit are cut off
+    const std::vector<uint8_t> zeros(1024 * 1024, 0);
+    std::vector<uint8_t> compressed;
+    StreamCompressor compressor(9);
+    ASSERT_EQ(compressor.compress(
+                  zeros.data(), zeros.size(), StreamFlush::FINISH, compressed),
+              CompressionResult::SUCCESS);
+    EXPECT_LT(compressed.size(), 2048);
+
+    StreamDecompressor limited(64 * 1024);
+    output.clear();
+    EXPECT_EQ(limited.decompress(compressed.data(), compressed.size(), output),
+              CompressionResult::BUFFER_TOO_SMALL);
+    EXPECT_LT(output.size(), zeros.size());
+}
+
 } // namespace tests
 } // namespace compress
 } // namespace common
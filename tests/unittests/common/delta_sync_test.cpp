@@ -0,0 +1,203 @@
+#include "common/delta_sync.hpp"
+#include <cstdio>
+#include <gtest/gtest.h>
+#include <random>
+#include <unistd.h>
+#include <vector>
+
+namespace fenris {
+namespace common {
+namespace delta {
+namespace tests {
+
+namespace {
+
+std::vector<uint8_t> random_bytes(size_t size, uint32_t seed)
+{
+    std::mt19937 generator(seed);
+    std::vector<uint8_t> data(size);
+    for (auto &byte : data) {
+        byte = static_cast<uint8_t>(generator());
+    }
+    return data;
+}
+
+uint32_t reference_checksum(const std::vector<uint8_t> &data,
+                            size_t offset,
+                            size_t length)
+{
+    uint32_t a = 0;
+    uint32_t b = 0;
+    for (size_t i = 0; i < length; ++i) {
+        a += data[offset + i];
+        b += static_cast<uint32_t>(length - i) * data[offset + i];
+    }
+    return (a & 0xffff) | (b << 16);
+}
+
+// Run apply_delta() on base and return what it wrote
+std::pair<std::string, DeltaResult> rebuild(const std::vector<uint8_t> &base,
+                                            const fenris::Delta &delta)
+{
+    std::FILE *file = std::tmpfile();
+    if (file == nullptr) {
+        return {"", DeltaResult::IO_ERROR};
+    }
+    const DeltaResult result = apply_delta(base, delta, ::fileno(file));
+    std::string output;
+    char buffer[4096];
+    ::lseek(::fileno(file), 0, SEEK_SET);
+    ssize_t n = 0;
+    while ((n = ::read(::fileno(file), buffer, sizeof(buffer))) > 0) {
+        output.append(buffer, static_cast<size_t>(n));
+    }
+    std::fclose(file);
+    return {output, result};
+}
+
+// Bytes the delta carries literally
+size_t literal_bytes(const fenris::Delta &delta)
+{
+    size_t total = 0;
+    for (const auto &op : delta.ops()) {
+        total += op.literal().size();
+    }
+    return total;
+}
+
+// Delta from base to target and back through apply_delta()
+fenris::Delta round_trip(const std::vector<uint8_t> &base,
+                         const std::vector<uint8_t> &target,
+                         size_t block_size)
+{
+    const auto signatures = compute_signatures(base, block_size);
+    const auto delta = compute_delta(signatures, target);
+    auto [output, result] = rebuild(base, delta);
+    EXPECT_EQ(result, DeltaResult::SUCCESS);
+    EXPECT_EQ(output, std::string(target.begin(), target.end()));
+    return delta;
+}
+
+} // namespace
+
+TEST(DeltaSyncTest, WeakChecksumMatchesReference)
+{
+    const auto data = random_bytes(4096, 1);
+    const std::span<const uint8_t> bytes(data);
+    for (size_t length : {0, 1, 31, 32, 33, 63, 64, 100, 1000, 4096}) {
+        for (size_t offset : {0, 1, 7}) {
+            if (offset + length > data.size()) {
+                continue;
+            }
+            EXPECT_EQ(weak_checksum(bytes.subspan(offset, length)),
+                      reference_checksum(data, offset, length))
+                << "length " << length << " offset " << offset;
+        }
+    }
+
+    const std::vector<uint8_t> ones(100000, 0xff);
+    EXPECT_EQ(weak_checksum(ones), reference_checksum(ones, 0, ones.size()));
+}
+
+TEST(DeltaSyncTest, RollingChecksumFollowsWindow)
+{
+    const auto data = random_bytes(2000, 2);
+    const std::span<const uint8_t> bytes(data);
+    const size_t window = 333;
+    RollingChecksum checksum(bytes.subspan(0, window));
+    for (size_t pos = 0; pos + window < data.size(); ++pos) {
+        ASSERT_EQ(checksum.value(),
+                  weak_checksum(bytes.subspan(pos, window)))
+            << "offset " << pos;
+        checksum.roll(data[pos], data[pos + window]);
+    }
+}
+
+TEST(DeltaSyncTest, BlockSizeGrowsWithFile)
+{
+    EXPECT_EQ(block_size_for(0), MIN_DELTA_BLOCK_SIZE);
+    EXPECT_EQ(block_size_for(1024 * 1024), MIN_DELTA_BLOCK_SIZE);
+    EXPECT_EQ(block_size_for(uint64_t{1} << 30), size_t{32 * 1024});
+    EXPECT_EQ(block_size_for(uint64_t{1} << 50), MAX_DELTA_BLOCK_SIZE);
+}
+
+TEST(DeltaSyncTest, SignaturesCoverEveryBlock)
+{
+    const auto data = random_bytes(10000, 3);
+    const auto signatures = compute_signatures(data, 4096);
+    EXPECT_EQ(signatures.block_size(), 4096u);
+    EXPECT_EQ(signatures.file_size(), data.size());
+    ASSERT_EQ(signatures.blocks_size(), 3);
+    EXPECT_EQ(signatures.blocks(2).weak(),
+              reference_checksum(data, 8192, data.size() - 8192));
+    EXPECT_EQ(signatures.blocks(0).strong().size(), STRONG_HASH_SIZE);
+}
+
+TEST(DeltaSyncTest, UnchangedFileIsOneCopy)
+{
+    const auto data = random_bytes(10000, 4);
+    const auto delta = round_trip(data, data, 2048);
+    ASSERT_EQ(delta.ops_size(), 1);
+    EXPECT_EQ(delta.ops(0).copy_block(), 0u);
+    EXPECT_EQ(delta.ops(0).copy_count(), 5u);
+    EXPECT_EQ(literal_bytes(delta), 0u);
+}
+
+TEST(DeltaSyncTest, InsertionSendsOnlyNewBytes)
+{
+    const auto base = random_bytes(64 * 1024, 5);
+    auto target = base;
+    const auto inserted = random_bytes(100, 6);
+    target.insert(target.begin() + 10000, inserted.begin(), inserted.end());
+
+    const auto delta = round_trip(base, target, 2048);
+    // The block the bytes went into is sent again, the rest is found at its
+    // new offset
+    EXPECT_LE(literal_bytes(delta), 2048u + inserted.size());
+}
+
+TEST(DeltaSyncTest, AppendTruncateAndReplace)
+{
+    const auto base = random_bytes(50000, 7);
+
+    auto appended = base;
+    const auto tail = random_bytes(3000, 8);
+    appended.insert(appended.end(), tail.begin(), tail.end());
+    EXPECT_LE(literal_bytes(round_trip(base, appended, 4096)),
+              tail.size() + 4096);
+
+    const std::vector<uint8_t> truncated(base.begin(), base.begin() + 20000);
+    EXPECT_LE(literal_bytes(round_trip(base, truncated, 4096)), 4096u);
+
+    const auto replaced = random_bytes(50000, 9);
+    EXPECT_EQ(literal_bytes(round_trip(base, replaced, 4096)),
+              replaced.size());
+
+    round_trip(base, {}, 4096);
+    round_trip({}, base, 4096);
+}
+
+TEST(DeltaSyncTest, RejectsDeltaForAnotherBase)
+{
+    const auto base = random_bytes(8192, 10);
+    const auto target = random_bytes(8192, 11);
+    const auto delta = compute_delta(compute_signatures(base, 2048), base);
+
+    // A copy past the end of a shorter base
+    const std::vector<uint8_t> shorter(base.begin(), base.begin() + 4096);
+    fenris::Delta moved = delta;
+    moved.set_base_size(shorter.size());
+    EXPECT_EQ(rebuild(shorter, moved).second, DeltaResult::INVALID_DELTA);
+
+    // The same size but other content
+    EXPECT_EQ(rebuild(target, delta).second, DeltaResult::HASH_MISMATCH);
+
+    fenris::Delta longer = delta;
+    longer.set_target_size(delta.target_size() + 1);
+    EXPECT_EQ(rebuild(base, longer).second, DeltaResult::INVALID_DELTA);
+}
+
+} // namespace tests
+} // namespace delta
+} // namespace common
+} // namespace fenris
@@ -1,4 +1,7 @@
 #include "common/crypto_manager.hpp"
+#include "common/crypto_session.hpp"
+#include "common/metrics.hpp"
+#include <algorithm>
 #include <cstring>
 #include <gtest/gtest.h>
 #include <random>
@@ -270,6 +273,260 @@ TEST(EncryptionTest, DifferentKeySizes)
     }
 }
 
+// Test that the buffer API produces the same wire format as the vector API
+TEST(EncryptionTest, BufferMatchesVectorFormat)
+{
+    auto crypto_manager = CryptoManager();
+
+    std::string message = "Shared buffers must stay wire compatible";
+    std::vector<uint8_t> plaintext(message.begin(), message.end());
+    std::vector<uint8_t> key(32, 7);
+    std::vector<uint8_t> iv(12, 9);
+
+    auto [vector_cipher, vector_result] =
+        crypto_manager.encrypt_data(plaintext, key, iv);
+    auto [buffer_cipher, buffer_result] =
+        crypto_manager.encrypt_buffer(plaintext, key, iv);
+    ASSERT_EQ(vector_result, EncryptionResult::SUCCESS);
+    ASSERT_EQ(buffer_result, EncryptionResult::SUCCESS);
+    EXPECT_EQ(buffer_cipher.to_vector(), vector_cipher);
+
+    // Either side can decrypt the other's output
+    auto [from_vector, from_vector_result] =
+        crypto_manager.decrypt_buffer(vector_cipher, key, iv);
+    ASSERT_EQ(from_vector_result, EncryptionResult::SUCCESS);
+    EXPECT_EQ(from_vector.to_vector(), plaintext);
+
+    auto [from_buffer, from_buffer_result] =
+        crypto_manager.decrypt_data(buffer_cipher.to_vector(), key, iv);
+    ASSERT_EQ(from_buffer_result, EncryptionResult::SUCCESS);
+    EXPECT_EQ(from_buffer, plaintext);
+}
+
+// Test that a tampered tag is rejected by the buffer API
+TEST(EncryptionTest, BufferTamperedCiphertext)
+{
+    auto crypto_manager = CryptoManager();
+
+    std::vector<uint8_t> plaintext(64, 0x42);
+    std::vector<uint8_t> key(32, 1);
+    std::vector<uint8_t> iv(12, 2);
+
+    auto [ciphertext, encrypt_result] =
+        crypto_manager.encrypt_buffer(plaintext, key, iv);
+    ASSERT_EQ(encrypt_result, EncryptionResult::SUCCESS);
+
+    ciphertext.data()[ciphertext.size() - 1] ^= 0x01;
+    auto [decrypted, decrypt_result] =
+        crypto_manager.decrypt_buffer(ciphertext, key, iv);
+    EXPECT_EQ(decrypt_result, EncryptionResult::DECRYPTION_FAILED);
+    EXPECT_TRUE(decrypted.empty());
+
+    std::vector<uint8_t> short_data(AES_GCM_TAG_SIZE - 1);
+    auto [unused, short_result] =
+        crypto_manager.decrypt_buffer(short_data, key, iv);
+    EXPECT_EQ(short_result, EncryptionResult::INVALID_DATA);
+}
+
+// Test that a session round-trips many messages under one key
+TEST(EncryptionTest, SessionRoundTripsMessages)
+{
+    std::vector<uint8_t> key(32, 3);
+    CryptoSession sender;
+    CryptoSession receiver;
+    EXPECT_FALSE(sender.has_key());
+    ASSERT_EQ(sender.set_key(key), EncryptionResult::SUCCESS);
+    ASSERT_EQ(receiver.set_key(key), EncryptionResult::SUCCESS);
+    EXPECT_TRUE(sender.has_key());
+
+    for (uint8_t i = 0; i < 16; ++i) {
+        std::vector<uint8_t> plaintext(i * 37, i);
+        std::vector<uint8_t> iv(AES_GCM_IV_SIZE, i);
+
+        auto [ciphertext, encrypt_result] = sender.encrypt(plaintext, iv);
+        ASSERT_EQ(encrypt_result, EncryptionResult::SUCCESS);
+        EXPECT_EQ(ciphertext.size(), plaintext.size() + AES_GCM_TAG_SIZE);
+
+        auto [decrypted, decrypt_result] = receiver.decrypt(ciphertext, iv);
+        ASSERT_EQ(decrypt_result, EncryptionResult::SUCCESS);
+        EXPECT_EQ(decrypted.to_vector(), plaintext);
+    }
+}
+
+// Test that session messages show up in the cipher metrics
+TEST(EncryptionTest, SessionCountsCipherPasses)
+{
+    MetricsRegistry &registry = MetricsRegistry::global();
+    Counter &encrypted = registry.counter(
+        "fenris_crypto_bytes_total", "", {{"op", "encrypt"}});
+    Counter &decrypted = registry.counter(
+        "fenris_crypto_bytes_total", "", {{"op", "decrypt"}});
+    Counter &failed = registry.counter(
+        "fenris_crypto_failures_total", "", {{"op", "decrypt"}});
+    const uint64_t encrypted_before = encrypted.value();
+    const uint64_t decrypted_before = decrypted.value();
+    const uint64_t failed_before = failed.value();
+
+    std::vector<uint8_t> key(32, 5);
+    CryptoSession session;
+    ASSERT_EQ(session.set_key(key), EncryptionResult::SUCCESS);
+    std::vector<uint8_t> plaintext(100, 1);
+    std::vector<uint8_t> iv(AES_GCM_IV_SIZE, 2);
+    auto [ciphertext, encrypt_result] = session.encrypt(plaintext, iv);
+    ASSERT_EQ(encrypt_result, EncryptionResult::SUCCESS);
+    ASSERT_EQ(session.decrypt(ciphertext, iv).second,
+              EncryptionResult::SUCCESS);
+
+    std::vector<uint8_t> tampered = ciphertext.to_vector();
+    tampered[0] ^= 1;
+    EXPECT_EQ(session.decrypt(tampered, iv).second,
+              EncryptionResult::DECRYPTION_FAILED);
+
+    EXPECT_EQ(encrypted.value() - encrypted_before, 100u);
+    EXPECT_EQ(decrypted.value() - decrypted_before, 200u);
+    EXPECT_EQ(failed.value() - failed_before, 1u);
+}
+
+// Test that a session and the per-call API read each other's output
+TEST(EncryptionTest, SessionMatchesBufferFormat)
+{
+    auto crypto_manager = CryptoManager();
+    std::string message = "Sessions must stay wire compatible";
+    std::vector<uint8_t> plaintext(message.begin(), message.end());
+    std::vector<uint8_t> key(32, 7);
+    std::vector<uint8_t> iv(12, 9);
+
+    CryptoSession session;
+    ASSERT_EQ(session.set_key(key), EncryptionResult::SUCCESS);
+
+    auto [session_cipher, session_result] = session.encrypt(plaintext, iv);
+    auto [buffer_cipher, buffer_result] =
+        crypto_manager.encrypt_buffer(plaintext, key, iv);
+    ASSERT_EQ(session_result, EncryptionResult::SUCCESS);
+    ASSERT_EQ(buffer_result, EncryptionResult::SUCCESS);
+    EXPECT_EQ(session_cipher.to_vector(), buffer_cipher.to_vector());
+
+    auto [from_buffer, from_buffer_result] =
+        session.decrypt(buffer_cipher, iv);
+    ASSERT_EQ(from_buffer_result, EncryptionResult::SUCCESS);
+    EXPECT_EQ(from_buffer.to_vector(), plaintext);
+
+    auto [from_session, from_session_result] =
+        crypto_manager.decrypt_buffer(session_cipher, key, iv);
+    ASSERT_EQ(from_session_result, EncryptionResult::SUCCESS);
+    EXPECT_EQ(from_session.to_vector(), plaintext);
+}
+
+// Test that a session rejects bad keys, IVs and tampered messages
+TEST(EncryptionTest, SessionRejectsInvalidInput)
+{
+    std::vector<uint8_t> plaintext(64, 0x42);
+    std::vector<uint8_t> iv(12, 2);
+
+    CryptoSession session;
+    auto [unkeyed, unkeyed_result] = session.encrypt(plaintext, iv);
+    EXPECT_EQ(unkeyed_result, EncryptionResult::INVALID_KEY_SIZE);
+
+    std::vector<uint8_t> bad_key(20, 1);
+    EXPECT_EQ(session.set_key(bad_key), EncryptionResult::INVALID_KEY_SIZE);
+    EXPECT_FALSE(session.has_key());
+
+    std::vector<uint8_t> key(16, 1);
+    ASSERT_EQ(session.set_key(key), EncryptionResult::SUCCESS);
+
+    std::vector<uint8_t> bad_iv(8, 2);
+    auto [bad_iv_cipher, bad_iv_result] = session.encrypt(plaintext, bad_iv);
+    EXPECT_EQ(bad_iv_result, EncryptionResult::INVALID_IV_SIZE);
+
+    auto [ciphertext, encrypt_result] = session.encrypt(plaintext, iv);
+    ASSERT_EQ(encrypt_result, EncryptionResult::SUCCESS);
+    ciphertext.data()[0] ^= 0x01;
+    auto [decrypted, decrypt_result] = session.decrypt(ciphertext, iv);
+    EXPECT_EQ(decrypt_result, EncryptionResult::DECRYPTION_FAILED);
+    EXPECT_TRUE(decrypted.empty());
+
+    // The failed message leaves the session usable
+    ciphertext.data()[0] ^= 0x01;
+    auto [restored, restored_result] = session.decrypt(ciphertext, iv);
+    ASSERT_EQ(restored_result, EncryptionResult::SUCCESS);
+    EXPECT_EQ(restored.to_vector(), plaintext);
+
+    std::vector<uint8_t> short_data(AES_GCM_TAG_SIZE - 1);
+    auto [unused, short_result] = session.decrypt(short_data, iv);
+    EXPECT_EQ(short_result, EncryptionResult::INVALID_DATA);
+}
+
+// Test that in-place encryption matches the buffer API and reads back
+TEST(EncryptionTest, InPlaceMatchesBufferFormat)
+{
+    auto crypto_manager = CryptoManager();
+    std::string message = "Encrypted where it was serialized";
+    std::vector<uint8_t> plaintext(message.begin(), message.end());
+    std::vector<uint8_t> key(32, 5);
+    std::vector<uint8_t> iv(12, 6);
+
+    auto [expected, expected_result] =
+        crypto_manager.encrypt_buffer(plaintext, key, iv);
+    ASSERT_EQ(expected_result, EncryptionResult::SUCCESS);
+
+    // The plaintext with room for the tag behind it
+    std::vector<uint8_t> buffer = plaintext;
+    buffer.resize(plaintext.size() + AES_GCM_TAG_SIZE);
+    ASSERT_EQ(crypto_manager.encrypt_in_place(buffer, key, iv),
+              EncryptionResult::SUCCESS);
+    EXPECT_EQ(buffer, expected.to_vector());
+
+    ASSERT_EQ(crypto_manager.decrypt_in_place(buffer, key, iv),
+              EncryptionResult::SUCCESS);
+    buffer.resize(plaintext.size());
+    EXPECT_EQ(buffer, plaintext);
+
+    // A session produces and accepts the same bytes
+    CryptoSession session;
+    ASSERT_EQ(session.set_key(key), EncryptionResult::SUCCESS);
+    buffer.resize(plaintext.size() + AES_GCM_TAG_SIZE);
+    ASSERT_EQ(session.encrypt_in_place(buffer, iv), EncryptionResult::SUCCESS);
+    EXPECT_EQ(buffer, expected.to_vector());
+    ASSERT_EQ(session.decrypt_in_place(buffer, iv), EncryptionResult::SUCCESS);
+    EXPECT_TRUE(std::equal(plaintext.begin(), plaintext.end(), buffer.begin()));
+}
+
+// Test that failed in-place decryption leaves no plaintext behind
+TEST(EncryptionTest, InPlaceRejectsInvalidInput)
+{
+    auto crypto_manager = CryptoManager();
+    std::vector<uint8_t> key(32, 1);
+    std::vector<uint8_t> iv(12, 2);
+    CryptoSession session;
+    ASSERT_EQ(session.set_key(key), EncryptionResult::SUCCESS);
+
+    std::vector<uint8_t> buffer(64 + AES_GCM_TAG_SIZE, 0x42);
+    ASSERT_EQ(crypto_manager.encrypt_in_place(buffer, key, iv),
+              EncryptionResult::SUCCESS);
+    buffer.back() ^= 0x01;
+    std::vector<uint8_t> copy = buffer;
+
+    EXPECT_EQ(crypto_manager.decrypt_in_place(buffer, key, iv),
+              EncryptionResult::DECRYPTION_FAILED);
+    EXPECT_EQ(std::count(buffer.begin(), buffer.begin() + 64, 0), 64);
+    EXPECT_EQ(session.decrypt_in_place(copy, iv),
+              EncryptionResult::DECRYPTION_FAILED);
+    EXPECT_EQ(std::count(copy.begin(), copy.begin() + 64, 0), 64);
+
+    // No room for the tag
+    std::vector<uint8_t> short_buffer(AES_GCM_TAG_SIZE - 1);
+    EXPECT_EQ(crypto_manager.encrypt_in_place(short_buffer, key, iv),
+              EncryptionResult::INVALID_DATA);
+    EXPECT_EQ(session.encrypt_in_place(short_buffer, iv),
+              EncryptionResult::INVALID_DATA);
+    EXPECT_EQ(crypto_manager.decrypt_in_place(short_buffer, key, iv),
+              EncryptionResult::INVALID_DATA);
+
+    std::vector<uint8_t> bad_key(20, 1);
+    EXPECT_EQ(crypto_manager.encrypt_in_place(buffer, bad_key, iv),
+              EncryptionResult::INVALID_KEY_SIZE);
+}
+
 } // namespace tests
 } // namespace crypto
 } // namespace common
@@ -124,6 +124,70 @@ TEST_F(FileOperationsTest, WriteFile)
     EXPECT_EQ(updated_content_str, new_content);
 }
 
+// Test reading a file block by block
+TEST_F(FileOperationsTest, ReadFileChunk)
+{
+    std::string filename = "test_read_chunk.txt";
+    std::string test_content = "0123456789abcdefghij";
+    create_test_file(filename, test_content);
+    std::string filepath = (test_dir / filename).string();
+
+    auto [first, first_error] = read_file_chunk(filepath, 0, 8);
+    EXPECT_EQ(first_error, FileOperationResult::SUCCESS);
+    EXPECT_EQ(first, "01234567");
+
+    auto [middle, middle_error] = read_file_chunk(filepath, 8, 8);
+    EXPECT_EQ(middle_error, FileOperationResult::SUCCESS);
+    EXPECT_EQ(middle, "89abcdef");
+
+    // The last block is short, reading past the end yields nothing
+    auto [last, last_error] = read_file_chunk(filepath, 16, 8);
+    EXPECT_EQ(last_error, FileOperationResult::SUCCESS);
+    EXPECT_EQ(last, "ghij");
+
+    auto [past, past_error] = read_file_chunk(filepath, 64, 8);
+    EXPECT_EQ(past_error, FileOperationResult::SUCCESS);
+    EXPECT_TRUE(past.empty());
+
+    auto [missing, missing_error] =
+        read_file_chunk(filepath + ".nonexistent", 0, 8);
+    EXPECT_EQ(missing_error, FileOperationResult::FILE_NOT_FOUND);
+    EXPECT_TRUE(missing.empty());
+}
+
+// Test writing a file block by block
+TEST_F(FileOperationsTest, WriteFileChunk)
+{
+    std::string filepath = (test_dir / "test_write_chunk.txt").string();
+
+    // Blocks after the first need the file to exist
+    EXPECT_EQ(write_file_chunk(filepath, 4, "late"),
+              FileOperationResult::FILE_NOT_FOUND);
+
+    EXPECT_EQ(write_file_chunk(filepath, 0, "0123"),
+              FileOperationResult::SUCCESS);
+    EXPECT_EQ(write_file_chunk(filepath, 4, "4567"),
+              FileOperationResult::SUCCESS);
+    EXPECT_EQ(write_file_chunk(filepath, 8, "89"),
+              FileOperationResult::SUCCESS);
+
+    auto [content, error] = read_file(filepath);
+    EXPECT_EQ(error, FileOperationResult::SUCCESS);
+    EXPECT_EQ(content, "0123456789");
+
+    // Rewriting a block in the middle keeps the rest of the file
+    EXPECT_EQ(write_file_chunk(filepath, 2, "xy"),
+              FileOperationResult::SUCCESS);
+    auto [patched, patched_error] = read_file(filepath);
+    EXPECT_EQ(patched, "01xy456789");
+
+    // A new first block truncates
+    EXPECT_EQ(write_file_chunk(filepath, 0, "new"),
+              FileOperationResult::SUCCESS);
+    auto [truncated, truncated_error] = read_file(filepath);
+    EXPECT_EQ(truncated, "new");
+}
+
 // Test appending to a file
 TEST_F(FileOperationsTest, AppendFile)
 {
@@ -345,6 +409,49 @@ TEST_F(FileOperationsTest, ListDirectory)
     EXPECT_TRUE(file_infos_error.empty());
 }
 
+TEST_F(FileOperationsTest, ListDirectoryInPages)
+{
+    constexpr int FILES = 50;
+    for (int i = 0; i < FILES; ++i) {
+        create_test_file("file" + std::to_string(i) + ".txt", "content");
+    }
+    fs::create_directory(test_dir / "subdir");
+
+    for (bool names_only : {false, true}) {
+        SCOPED_TRACE(names_only ? "names only" : "with details");
+        std::vector<std::string> names;
+        uint64_t cursor = 0;
+        int pages = 0;
+        do {
+            auto [page, error] =
+                list_directory_page(test_dir.string(), cursor, 7, names_only);
+            ASSERT_EQ(error, FileOperationResult::SUCCESS);
+            EXPECT_LE(page.entries.size(), 7);
+            for (const auto &entry : page.entries) {
+                names.push_back(entry.name());
+                EXPECT_EQ(entry.is_directory(), entry.name() == "subdir");
+                if (!entry.is_directory()) {
+                    EXPECT_EQ(entry.size(), names_only ? 0 : 7);
+                }
+                EXPECT_EQ(entry.modified_time() == 0, names_only);
+            }
+            cursor = page.next_cursor;
+            ASSERT_LT(++pages, 20);
+        } while (cursor != 0);
+
+        // Every entry shows up exactly once across the pages
+        std::sort(names.begin(), names.end());
+        EXPECT_EQ(names.size(), FILES + 1);
+        EXPECT_EQ(std::adjacent_find(names.begin(), names.end()), names.end());
+        EXPECT_GE(pages, (FILES + 1) / 7);
+    }
+
+    auto [missing, missing_error] =
+        list_directory_page((test_dir / "nonexistent").string(), 0, 7);
+    EXPECT_EQ(missing_error, FileOperationResult::FILE_NOT_FOUND);
+    EXPECT_TRUE(missing.entries.empty());
+}
+
 // Test changing directory
 TEST_F(FileOperationsTest, ChangeDirectory)
 {
@@ -514,6 +621,197 @@ TEST_F(FileOperationsTest, PermissionErrors)
     fs::permissions(dirpath, fs::perms::owner_all, fs::perm_options::add);
 }
 
+// Test mapping a file read-only
+TEST_F(FileOperationsTest, MapFile)
+{
+    std::string filepath = (test_dir / "mapped.bin").string();
+    std::string content(3 * 4096 + 17, '\0');
+    for (size_t i = 0; i < content.size(); ++i) {
+        content[i] = static_cast<char>(i % 253);
+    }
+    ASSERT_EQ(write_file(filepath, content), FileOperationResult::SUCCESS);
+
+    auto [mapped, result] = map_file(filepath);
+    EXPECT_EQ(result, FileOperationResult::SUCCESS);
+    EXPECT_EQ(mapped.view(), content);
+
+    // Slices keep the mapping alive after the original view is gone
+    Buffer tail = mapped.slice(content.size() - 17);
+    mapped = Buffer();
+    EXPECT_EQ(tail.view(), content.substr(content.size() - 17));
+
+    // Empty files map to an empty buffer
+    std::string empty_path = (test_dir / "empty.bin").string();
+    ASSERT_EQ(create_file(empty_path), FileOperationResult::SUCCESS);
+    auto [empty, empty_result] = map_file(empty_path, AccessPattern::RANDOM);
+    EXPECT_EQ(empty_result, FileOperationResult::SUCCESS);
+    EXPECT_TRUE(empty.empty());
+
+    auto [missing, missing_result] =
+        map_file((test_dir / "missing.bin").string());
+    EXPECT_EQ(missing_result, FileOperationResult::FILE_NOT_FOUND);
+    EXPECT_TRUE(missing.empty());
+
+    auto [directory, directory_result] = map_file(test_dir.string());
+    EXPECT_EQ(directory_result, FileOperationResult::INVALID_PATH);
+}
+
+// Test reading a file into a buffer, mapped or not
+TEST_F(FileOperationsTest, ReadFileBuffer)
+{
+    std::string filepath = (test_dir / "buffer.txt").string();
+    ASSERT_EQ(write_file(filepath, "buffered content"),
+              FileOperationResult::SUCCESS);
+
+    auto [read, read_result] = read_file_buffer(filepath);
+    EXPECT_EQ(read_result, FileOperationResult::SUCCESS);
+    EXPECT_EQ(read.view(), "buffered content");
+
+    auto [mapped, mapped_result] = read_file_buffer(filepath, 8);
+    EXPECT_EQ(mapped_result, FileOperationResult::SUCCESS);
+    EXPECT_EQ(mapped.view(), "buffered content");
+
+    auto [unmapped, unmapped_result] = read_file_buffer(filepath, 0);
+    EXPECT_EQ(unmapped_result, FileOperationResult::SUCCESS);
+    EXPECT_EQ(unmapped.view(), "buffered content");
+
+    auto [missing, missing_result] =
+        read_file_buffer((test_dir / "missing.txt").string());
+    EXPECT_EQ(missing_result, FileOperationResult::FILE_NOT_FOUND);
+}
+
+// Test reading byte ranges with pread()
+TEST_F(FileOperationsTest, ReadFileRange)
+{
+    std::string filepath = (test_dir / "range.txt").string();
+    ASSERT_EQ(write_file(filepath, "0123456789"), FileOperationResult::SUCCESS);
+
+    auto [middle, middle_result] = read_file_range(filepath, 3, 4);
+    EXPECT_EQ(middle_result, FileOperationResult::SUCCESS);
+    EXPECT_EQ(middle.view(), "3456");
+
+    // Ranges are cut short at the end of the file and empty past it
+    auto [tail, tail_result] = read_file_range(filepath, 8, 100);
+    EXPECT_EQ(tail_result, FileOperationResult::SUCCESS);
+    EXPECT_EQ(tail.view(), "89");
+
+    auto [past_end, past_end_result] = read_file_range(filepath, 10, 4);
+    EXPECT_EQ(past_end_result, FileOperationResult::SUCCESS);
+    EXPECT_TRUE(past_end.empty());
+
+    auto [missing, missing_result] =
+        read_file_range((test_dir / "missing.txt").string(), 0, 4);
+    EXPECT_EQ(missing_result, FileOperationResult::FILE_NOT_FOUND);
+
+    auto [directory, directory_result] =
+        read_file_range(test_dir.string(), 0, 4);
+    EXPECT_EQ(directory_result, FileOperationResult::INVALID_PATH);
+}
+
+// Test overwriting byte ranges with pwrite()
+TEST_F(FileOperationsTest, WriteFileAt)
+{
+    std::string filepath = (test_dir / "patched.txt").string();
+    ASSERT_EQ(write_file(filepath, "0123456789"), FileOperationResult::SUCCESS);
+
+    // The rest of the file is kept, nothing is truncated
+    EXPECT_EQ(write_file_at(filepath, 2, "ab"), FileOperationResult::SUCCESS);
+    EXPECT_EQ(read_file(filepath).first, "01ab456789");
+
+    // Writing past the end extends the file, the gap reads as zeros
+    EXPECT_EQ(write_file_at(filepath, 12, "xy"), FileOperationResult::SUCCESS);
+    EXPECT_EQ(read_file(filepath).first,
+              std::string("01ab456789\0\0xy", 14));
+
+    EXPECT_EQ(write_file_at((test_dir / "missing.txt").string(), 0, "data"),
+              FileOperationResult::FILE_NOT_FOUND);
+    EXPECT_FALSE(file_exists((test_dir / "missing.txt").string()));
+    EXPECT_EQ(write_file_at(test_dir.string(), 0, "data"),
+              FileOperationResult::INVALID_PATH);
+}
+
+// Test resolving paths against an open directory
+TEST_F(FileOperationsTest, DirectoryHandle)
+{
+    fs::create_directory(test_dir / "sub");
+    auto [directory, open_result] =
+        DirectoryHandle::open((test_dir / "sub").string());
+    ASSERT_EQ(open_result, FileOperationResult::SUCCESS);
+    EXPECT_TRUE(directory.is_open());
+
+    // Relative paths resolve below the directory, not the working directory
+    EXPECT_EQ(directory.write_file("note.txt", "hello"),
+              FileOperationResult::SUCCESS);
+    EXPECT_EQ(read_file((test_dir / "sub" / "note.txt").string()).first,
+              "hello");
+    EXPECT_EQ(directory.append_file("note.txt", " there"),
+              FileOperationResult::SUCCESS);
+    EXPECT_EQ(directory.read_file("note.txt").first, "hello there");
+
+    auto [file_info, info_result] = directory.get_file_info("note.txt");
+    EXPECT_EQ(info_result, FileOperationResult::SUCCESS);
+    EXPECT_EQ(file_info.name(), "note.txt");
+    EXPECT_EQ(file_info.size(), 11);
+    auto [expected, expected_result] =
+        get_file_info((test_dir / "sub" / "note.txt").string());
+    EXPECT_EQ(file_info.modified_time(), expected.modified_time());
+    EXPECT_EQ(file_info.permissions(), expected.permissions());
+
+    uint64_t file_size = 0;
+    auto [range, range_result] =
+        directory.read_file_range("note.txt", 6, 100, &file_size);
+    EXPECT_EQ(range.view(), "there");
+    EXPECT_EQ(file_size, 11);
+
+    EXPECT_EQ(directory.create_file("note.txt"),
+              FileOperationResult::FILE_ALREADY_EXISTS);
+    EXPECT_EQ(directory.delete_file("note.txt"), FileOperationResult::SUCCESS);
+    EXPECT_EQ(directory.delete_file("note.txt"),
+              FileOperationResult::FILE_NOT_FOUND);
+
+    // Absolute paths ignore the directory
+    create_test_file("top.txt", "top");
+    EXPECT_EQ(directory.read_file((test_dir / "top.txt").string()).first,
+              "top");
+
+    EXPECT_EQ(directory.open_directory("missing").second,
+              FileOperationResult::FILE_NOT_FOUND);
+    EXPECT_EQ(DirectoryHandle::open((test_dir / "top.txt").string()).second,
+              FileOperationResult::INVALID_PATH);
+
+    // Handles move, the moved-from one falls back to the working directory
+    DirectoryHandle moved = std::move(directory);
+    EXPECT_TRUE(moved.is_open());
+    EXPECT_FALSE(directory.is_open());
+}
+
+// Test replacing a file through a temporary one next to it
+TEST_F(FileOperationsTest, DirectoryHandleReplacesFiles)
+{
+    fs::create_directories(test_dir / "sub" / "deeper");
+    auto [directory, open_result] =
+        DirectoryHandle::open((test_dir / "sub").string());
+    ASSERT_EQ(open_result, FileOperationResult::SUCCESS);
+    ASSERT_EQ(directory.write_file("deeper/file.txt", "old"),
+              FileOperationResult::SUCCESS);
+
+    std::string temp_path;
+    auto [fd, temp_result] =
+        directory.create_temp_file("deeper/file.txt", temp_path);
+    ASSERT_EQ(temp_result, FileOperationResult::SUCCESS);
+    EXPECT_EQ(fs::path(temp_path).parent_path(), "deeper");
+    ASSERT_EQ(::write(fd, "new", 3), 3);
+    ::close(fd);
+
+    EXPECT_EQ(directory.replace_file(temp_path, "deeper/file.txt", true),
+              FileOperationResult::SUCCESS);
+    EXPECT_EQ(read_file((test_dir / "sub/deeper/file.txt").string()).first,
+              "new");
+    EXPECT_FALSE(fs::exists(test_dir / "sub" / temp_path));
+    EXPECT_EQ(directory.replace_file(temp_path, "deeper/file.txt", false),
+              FileOperationResult::FILE_NOT_FOUND);
+}
+
 // Test getting current directory
 TEST_F(FileOperationsTest, GetCurrentDirectory)
 {
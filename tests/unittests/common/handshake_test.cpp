@@ -0,0 +1,99 @@
+#include "common/handshake.hpp"
+#include <gtest/gtest.h>
+#include <vector>
+
+namespace fenris {
+namespace common {
+namespace tests {
+
+static std::vector<uint8_t> make_public_key()
+{
+    std::vector<uint8_t> key(ECDH_PUBLIC_KEY_SIZE);
+    for (size_t i = 0; i < key.size(); ++i) {
+        key[i] = static_cast<uint8_t>(i + 1);
+    }
+    return key;
+}
+
+// A bare key stays byte for byte what older peers send
+TEST(HandshakeTest, BareKeyRoundTrip)
+{
+    const std::vector<uint8_t> key = make_public_key();
+    std::vector<uint8_t> frame = encode_key_exchange(key, std::nullopt);
+    EXPECT_EQ(frame, key);
+
+    auto decoded = decode_key_exchange(frame);
+    ASSERT_TRUE(decoded.has_value());
+    EXPECT_EQ(decoded->public_key, key);
+    EXPECT_FALSE(decoded->handshake.has_value());
+}
+
+TEST(HandshakeTest, CapabilitiesFollowKey)
+{
+    const std::vector<uint8_t> key = make_public_key();
+    fenris::Handshake handshake;
+    handshake.set_capabilities(fenris::CAPABILITY_PLAINTEXT_FILE_STREAM);
+
+    std::vector<uint8_t> frame = encode_key_exchange(key, handshake);
+    EXPECT_GT(frame.size(), key.size());
+
+    auto decoded = decode_key_exchange(frame);
+    ASSERT_TRUE(decoded.has_value());
+    EXPECT_EQ(decoded->public_key, key);
+    ASSERT_TRUE(decoded->handshake.has_value());
+    EXPECT_TRUE(has_capability(decoded->handshake->capabilities(),
+                               fenris::CAPABILITY_PLAINTEXT_FILE_STREAM));
+}
+
+TEST(HandshakeTest, MalformedTrailerIsRejected)
+{
+    std::vector<uint8_t> frame = make_public_key();
+    // A field header announcing more bytes than the frame holds
+    frame.push_back(0x0A);
+    frame.push_back(0x7F);
+
+    EXPECT_FALSE(decode_key_exchange(frame).has_value());
+}
+
+TEST(HandshakeTest, ResumptionFrameCarriesNoKey)
+{
+    fenris::Handshake handshake;
+    handshake.set_capabilities(fenris::CAPABILITY_SESSION_TICKET);
+    handshake.set_ticket("ticket");
+    handshake.set_resumption_nonce(std::string(16, 'n'));
+
+    std::vector<uint8_t> frame = encode_resumption(handshake);
+    ASSERT_FALSE(frame.empty());
+    EXPECT_EQ(frame[0], RESUMPTION_FRAME_MARKER);
+
+    auto decoded = decode_key_exchange(frame);
+    ASSERT_TRUE(decoded.has_value());
+    EXPECT_TRUE(decoded->resumption);
+    EXPECT_TRUE(decoded->public_key.empty());
+    ASSERT_TRUE(decoded->handshake.has_value());
+    EXPECT_EQ(decoded->handshake->ticket(), "ticket");
+
+    // The empty reply a server refuses a ticket with is just the marker
+    auto refusal = decode_key_exchange(encode_resumption(fenris::Handshake()));
+    ASSERT_TRUE(refusal.has_value());
+    EXPECT_TRUE(refusal->resumption);
+    EXPECT_TRUE(refusal->handshake->resumption_nonce().empty());
+
+    // Key exchange frames are never taken for resumptions
+    auto key_exchange =
+        decode_key_exchange(encode_key_exchange(make_public_key(), handshake));
+    ASSERT_TRUE(key_exchange.has_value());
+    EXPECT_FALSE(key_exchange->resumption);
+}
+
+TEST(HandshakeTest, HasCapability)
+{
+    EXPECT_FALSE(
+        has_capability(0, fenris::CAPABILITY_PLAINTEXT_FILE_STREAM));
+    EXPECT_TRUE(has_capability(fenris::CAPABILITY_PLAINTEXT_FILE_STREAM,
+                               fenris::CAPABILITY_PLAINTEXT_FILE_STREAM));
+}
+
+} // namespace tests
+} // namespace common
+} // namespace fenris
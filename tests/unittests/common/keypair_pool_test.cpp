@@ -0,0 +1,94 @@
+#include "common/keypair_pool.hpp"
+#include <chrono>
+#include <gtest/gtest.h>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace fenris {
+namespace common {
+namespace crypto {
+namespace tests {
+
+namespace {
+
+// Poll until the pool holds count pairs, the refill thread runs at idle
+// priority and may take a moment
+bool wait_for_pairs(const KeyPairPool &pool, size_t count)
+{
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (pool.available() < count) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return true;
+}
+
+} // namespace
+
+TEST(KeyPairPoolTest, FillsUpToCapacity)
+{
+    KeyPairPool pool(4);
+    EXPECT_EQ(pool.available(), 0);
+
+    pool.start();
+    ASSERT_TRUE(wait_for_pairs(pool, 4));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(pool.available(), 4);
+
+    // Taking a pair makes room for the next one
+    auto [private_key, public_key, result] = pool.take();
+    ASSERT_EQ(result, ECDHResult::SUCCESS);
+    EXPECT_TRUE(wait_for_pairs(pool, 4));
+}
+
+TEST(KeyPairPoolTest, PooledPairsAgreeOnSecrets)
+{
+    KeyPairPool pool(2);
+    pool.start();
+    ASSERT_TRUE(wait_for_pairs(pool, 2));
+
+    auto [first_private, first_public, first_result] = pool.take();
+    auto [second_private, second_public, second_result] = pool.take();
+    ASSERT_EQ(first_result, ECDHResult::SUCCESS);
+    ASSERT_EQ(second_result, ECDHResult::SUCCESS);
+    EXPECT_NE(first_public, second_public);
+
+    CryptoManager crypto_manager;
+    auto [first_secret, first_secret_result] =
+        crypto_manager.compute_ecdh_shared_secret(first_private,
+                                                  second_public);
+    auto [second_secret, second_secret_result] =
+        crypto_manager.compute_ecdh_shared_secret(second_private,
+                                                  first_public);
+    ASSERT_EQ(first_secret_result, ECDHResult::SUCCESS);
+    ASSERT_EQ(second_secret_result, ECDHResult::SUCCESS);
+    EXPECT_EQ(first_secret, second_secret);
+}
+
+TEST(KeyPairPoolTest, GeneratesInlineWhenEmpty)
+{
+    // Never started, and a pool that keeps nothing
+    KeyPairPool stopped(4);
+    KeyPairPool disabled(0);
+    disabled.start();
+
+    std::set<std::vector<uint8_t>> public_keys;
+    for (KeyPairPool *pool : {&stopped, &disabled}) {
+        for (int i = 0; i < 3; ++i) {
+            auto [private_key, public_key, result] = pool->take();
+            ASSERT_EQ(result, ECDHResult::SUCCESS);
+            public_keys.insert(public_key);
+        }
+        EXPECT_EQ(pool->available(), 0);
+    }
+    EXPECT_EQ(public_keys.size(), 6);
+}
+
+} // namespace tests
+} // namespace crypto
+} // namespace common
+} // namespace fenris
@@ -0,0 +1,92 @@
+#include "common/logging.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <spdlog/sinks/ostream_sink.h>
+#include <sstream>
+#include <string>
+
+namespace fs = std::filesystem;
+namespace fenris {
+namespace common {
+namespace tests {
+
+namespace {
+
+size_t count_lines(const std::string &text)
+{
+    return static_cast<size_t>(std::count(text.begin(), text.end(), '\n'));
+}
+
+} // namespace
+
+TEST(LoggingTest, FilteredLevelsAreNotFormatted)
+{
+    std::ostringstream output;
+    auto logger = std::make_shared<spdlog::logger>(
+        "filtered", std::make_shared<spdlog::sinks::ostream_sink_st>(output));
+    logger->set_level(spdlog::level::info);
+
+    int evaluated = 0;
+    auto argument = [&evaluated] { return ++evaluated; };
+    FENRIS_LOG_DEBUG(logger, "value {}", argument());
+    EXPECT_EQ(evaluated, 0);
+    EXPECT_TRUE(output.str().empty());
+
+    FENRIS_LOG(logger, spdlog::level::info, "value {}", argument());
+    EXPECT_EQ(evaluated, 1);
+    EXPECT_NE(output.str().find("value 1"), std::string::npos);
+}
+
+TEST(LoggingTest, SampledLinesKeepOneInRate)
+{
+    std::ostringstream output;
+    auto logger = std::make_shared<spdlog::logger>(
+        "sampled", std::make_shared<spdlog::sinks::ostream_sink_st>(output));
+    logger->set_level(spdlog::level::debug);
+
+    set_log_sample_rate(4);
+    for (int i = 0; i < 12; ++i) {
+        FENRIS_LOG_DEBUG_SAMPLED(logger, "request {}", i);
+    }
+    set_log_sample_rate(1);
+
+    EXPECT_EQ(count_lines(output.str()), 3u);
+    EXPECT_NE(output.str().find("request 0\n"), std::string::npos);
+    EXPECT_NE(output.str().find("request 4\n"), std::string::npos);
+}
+
+TEST(LoggingTest, AsyncLoggerWritesEverythingByShutdown)
+{
+    const fs::path path = fs::temp_directory_path() / "fenris_async_test.log";
+    fs::remove(path);
+
+    LoggingConfig config;
+    config.console_logging = false;
+    config.file_logging = true;
+    config.log_file_path = path.string();
+    config.max_file_size = 16 * 1024 * 1024;
+    config.async = true;
+    config.async_queue_size = 64;
+    ASSERT_TRUE(initialize_logging(config, "AsyncLoggingTest"));
+
+    // More lines than the queue holds, the default policy waits for room
+    Logger logger = get_logger("AsyncLoggingTest");
+    for (int i = 0; i < 1000; ++i) {
+        logger->info("line {}", i);
+    }
+    shutdown_logging();
+
+    std::ifstream file(path);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    EXPECT_EQ(count_lines(contents.str()), 1000u);
+    EXPECT_NE(contents.str().find("line 999"), std::string::npos);
+    fs::remove(path);
+}
+
+} // namespace tests
+} // namespace common
+} // namespace fenris
@@ -0,0 +1,92 @@
+#include "common/metrics.hpp"
+
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fenris {
+namespace common {
+namespace test {
+
+TEST(MetricsTest, CountersSumTheirShards)
+{
+    MetricsRegistry registry;
+    Counter &counter = registry.counter("requests_total", "Requests");
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&counter] {
+            for (int i = 0; i < 10000; ++i) {
+                counter.add();
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(counter.value(), 80000u);
+}
+
+TEST(MetricsTest, LookupsReturnTheSameMetric)
+{
+    MetricsRegistry registry;
+    Counter &read = registry.counter("ops_total", "Ops", {{"op", "read"}});
+    Counter &write = registry.counter("ops_total", "Ops", {{"op", "write"}});
+    EXPECT_NE(&read, &write);
+    EXPECT_EQ(&read, &registry.counter("ops_total", "Ops", {{"op", "read"}}));
+
+    // One name cannot be two kinds of metric
+    EXPECT_THROW(registry.gauge("ops_total", "Ops"), std::logic_error);
+}
+
+TEST(MetricsTest, HistogramBoundsAreInclusive)
+{
+    Histogram histogram({10, 100}, 1.0);
+    histogram.observe(uint64_t{5});
+    histogram.observe(uint64_t{10});
+    histogram.observe(uint64_t{50});
+    histogram.observe(uint64_t{1000});
+
+    const std::vector<uint64_t> expected = {2, 1, 1};
+    EXPECT_EQ(histogram.bucket_counts(), expected);
+    EXPECT_EQ(histogram.sum(), 1065u);
+}
+
+TEST(MetricsTest, RendersPrometheusText)
+{
+    MetricsRegistry registry;
+    registry.counter("fenris_hits_total", "Cache hits", {{"cache", "a\"b"}})
+        .add(3);
+    registry.gauge("fenris_open", "Open things").set(-2);
+    Histogram &latency =
+        registry.histogram("fenris_latency_seconds",
+                           "Latency",
+                           {},
+                           {1'000'000, 10'000'000},
+                           NANOSECONDS);
+    latency.observe(std::chrono::milliseconds(5));
+    latency.observe(std::chrono::seconds(1));
+
+    const std::string text = registry.render();
+    EXPECT_NE(text.find("# HELP fenris_hits_total Cache hits\n"
+                        "# TYPE fenris_hits_total counter\n"
+                        "fenris_hits_total{cache=\"a\\\"b\"} 3\n"),
+              std::string::npos)
+        << text;
+    EXPECT_NE(text.find("# TYPE fenris_open gauge\nfenris_open -2\n"),
+              std::string::npos)
+        << text;
+    EXPECT_NE(text.find("fenris_latency_seconds_bucket{le=\"0.001\"} 0\n"
+                        "fenris_latency_seconds_bucket{le=\"0.01\"} 1\n"
+                        "fenris_latency_seconds_bucket{le=\"+Inf\"} 2\n"
+                        "fenris_latency_seconds_sum 1.005\n"
+                        "fenris_latency_seconds_count 2\n"),
+              std::string::npos)
+        << text;
+}
+
+} // namespace test
+} // namespace common
+} // namespace fenris
@@ -0,0 +1,303 @@
+#include "common/network_utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <span>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fenris {
+namespace common {
+namespace tests {
+
+using namespace network;
+
+class NetworkUtilsTest : public ::testing::Test {
+  protected:
+    void SetUp() override
+    {
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    }
+
+    void TearDown() override
+    {
+        for (int &fd : sockets) {
+            if (fd != -1) {
+                close(fd);
+            }
+        }
+    }
+
+    void make_non_blocking(int fd)
+    {
+        int flags = fcntl(fd, F_GETFL);
+        ASSERT_NE(fcntl(fd, F_SETFL, flags | O_NONBLOCK), -1);
+    }
+
+    int sockets[2]{-1, -1};
+};
+
+TEST_F(NetworkUtilsTest, PrefixedRoundTripNonBlocking)
+{
+    make_non_blocking(sockets[0]);
+    make_non_blocking(sockets[1]);
+
+    std::vector<uint8_t> payload(1024 * 1024);
+    for (size_t i = 0; i < payload.size(); ++i) {
+        payload[i] = static_cast<uint8_t>(i);
+    }
+
+    // The payload exceeds the socket buffer, so the sender has to wait for
+    // the receiver to drain it
+    std::thread sender([&]() {
+        EXPECT_EQ(send_prefixed_data(sockets[0], payload, true),
+                  NetworkResult::SUCCESS);
+    });
+
+    std::vector<uint8_t> received;
+    EXPECT_EQ(receive_prefixed_data(sockets[1], received, true),
+              NetworkResult::SUCCESS);
+    sender.join();
+
+    EXPECT_EQ(received, payload);
+}
+
+TEST_F(NetworkUtilsTest, ReceiveWakesAsSoonAsDataArrives)
+{
+    make_non_blocking(sockets[1]);
+
+    const std::vector<uint8_t> payload = {1, 2, 3, 4};
+    std::thread sender([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        send_size(sockets[0], static_cast<uint32_t>(payload.size()));
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        send_data(sockets[0], payload, static_cast<uint32_t>(payload.size()));
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> received;
+    EXPECT_EQ(receive_prefixed_data(sockets[1], received, true),
+              NetworkResult::SUCCESS);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    sender.join();
+
+    EXPECT_EQ(received, payload);
+    EXPECT_LT(elapsed, std::chrono::milliseconds(80));
+}
+
+TEST_F(NetworkUtilsTest, ReceiveTimesOut)
+{
+    std::vector<uint8_t> received;
+
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(receive_prefixed_data(sockets[1], received, false, 50),
+              NetworkResult::TIMEOUT);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    EXPECT_GE(elapsed, std::chrono::milliseconds(50));
+    EXPECT_LT(elapsed, std::chrono::milliseconds(1000));
+}
+
+TEST_F(NetworkUtilsTest, DeadlineCoversWholeMessage)
+{
+    // A prefix announcing more bytes than will ever be sent
+    ASSERT_EQ(send_size(sockets[0], 16), NetworkResult::SUCCESS);
+
+    std::vector<uint8_t> received;
+    EXPECT_EQ(receive_prefixed_data(sockets[1], received, true, 30),
+              NetworkResult::TIMEOUT);
+}
+
+TEST_F(NetworkUtilsTest, ReceiveReportsDisconnect)
+{
+    make_non_blocking(sockets[1]);
+    close(sockets[0]);
+    sockets[0] = -1;
+
+    uint32_t size = 0;
+    EXPECT_EQ(receive_size(sockets[1], size, true, 1000),
+              NetworkResult::DISCONNECTED);
+}
+
+TEST_F(NetworkUtilsTest, SegmentsArriveAsOnePrefixedMessage)
+{
+    const std::vector<uint8_t> head = {1, 2, 3};
+    const std::vector<uint8_t> tail = {4, 5, 6, 7, 8};
+    const std::span<const uint8_t> segments[] = {head, tail};
+
+    ASSERT_EQ(send_prefixed_segments(sockets[0], segments),
+              NetworkResult::SUCCESS);
+
+    std::vector<uint8_t> received;
+    ASSERT_EQ(receive_prefixed_data(sockets[1], received),
+              NetworkResult::SUCCESS);
+    EXPECT_EQ(received, (std::vector<uint8_t>{1, 2, 3, 4, 5, 6, 7, 8}));
+}
+
+TEST_F(NetworkUtilsTest, PrefixAndDataLeaveInOneSend)
+{
+    // Every send on a datagram socket is a message of its own
+    int datagrams[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_DGRAM, 0, datagrams), 0);
+    const std::vector<uint8_t> data = {1, 2, 3, 4, 5};
+    EXPECT_EQ(send_prefixed_data(datagrams[0], data), NetworkResult::SUCCESS);
+
+    uint8_t received[64];
+    const ssize_t length = recv(datagrams[1], received, sizeof(received), 0);
+    close(datagrams[0]);
+    close(datagrams[1]);
+    ASSERT_EQ(length, 4 + static_cast<ssize_t>(data.size()));
+    EXPECT_TRUE(std::equal(data.begin(), data.end(), received + 4));
+}
+
+TEST_F(NetworkUtilsTest, ReceiveSegmentsSplitsHeaderAndBody)
+{
+    make_non_blocking(sockets[0]);
+    make_non_blocking(sockets[1]);
+
+    std::vector<uint8_t> payload(512 * 1024);
+    for (size_t i = 0; i < payload.size(); ++i) {
+        payload[i] = static_cast<uint8_t>(i * 7);
+    }
+
+    std::thread sender([&]() {
+        EXPECT_EQ(send_prefixed_data(sockets[0], payload, true),
+                  NetworkResult::SUCCESS);
+    });
+
+    std::vector<uint8_t> header(12);
+    std::vector<uint8_t> body;
+    EXPECT_EQ(receive_prefixed_segments(sockets[1], header, body, true),
+              NetworkResult::SUCCESS);
+    sender.join();
+
+    EXPECT_TRUE(std::equal(header.begin(), header.end(), payload.begin()));
+    EXPECT_TRUE(std::equal(body.begin(), body.end(), payload.begin() + 12));
+    EXPECT_EQ(body.size(), payload.size() - header.size());
+}
+
+TEST_F(NetworkUtilsTest, ReceiveSegmentsRejectsShortMessage)
+{
+    const std::vector<uint8_t> payload = {1, 2, 3};
+    ASSERT_EQ(send_prefixed_data(sockets[0], payload), NetworkResult::SUCCESS);
+    // Enough trailing bytes for the header read to complete
+    const std::vector<uint8_t> padding(16);
+    ASSERT_EQ(send_data(sockets[0], padding, 16), NetworkResult::SUCCESS);
+
+    std::vector<uint8_t> header(12);
+    std::vector<uint8_t> body;
+    EXPECT_EQ(receive_prefixed_segments(sockets[1], header, body),
+              NetworkResult::RECEIVE_ERROR);
+}
+
+TEST_F(NetworkUtilsTest, ReceiveRejectsMessageOverLimit)
+{
+    const std::vector<uint8_t> payload(128);
+    ASSERT_EQ(send_prefixed_data(sockets[0], payload), NetworkResult::SUCCESS);
+
+    std::vector<uint8_t> received;
+    EXPECT_EQ(receive_prefixed_data(sockets[1], received, false, 1000, 64),
+              NetworkResult::MESSAGE_TOO_LARGE);
+    EXPECT_TRUE(received.empty());
+}
+
+TEST_F(NetworkUtilsTest, AnnouncedSizeIsNotAllocatedUpFront)
+{
+    // A peer claiming 4 GB and hanging up after a few bytes must not cost
+    // the receiver more than what actually arrived
+    ASSERT_EQ(send_size(sockets[0], 0xFFFFFFF0u), NetworkResult::SUCCESS);
+    const std::vector<uint8_t> few = {1, 2, 3, 4};
+    ASSERT_EQ(send_data(sockets[0], few, 4), NetworkResult::SUCCESS);
+    close(sockets[0]);
+    sockets[0] = -1;
+
+    std::vector<uint8_t> received;
+    EXPECT_EQ(receive_prefixed_data(sockets[1], received),
+              NetworkResult::DISCONNECTED);
+    EXPECT_LE(received.capacity(), INITIAL_RECEIVE_BUFFER_SIZE);
+}
+
+TEST_F(NetworkUtilsTest, BufferGrowsByDoublingUpToSize)
+{
+    Buffer buffer;
+    grow_receive_buffer(buffer, 0, 200 * 1024);
+    EXPECT_EQ(buffer.size(), INITIAL_RECEIVE_BUFFER_SIZE);
+
+    std::fill_n(buffer.data(), buffer.size(), uint8_t{7});
+    grow_receive_buffer(buffer, buffer.size(), 200 * 1024);
+    EXPECT_EQ(buffer.size(), 2 * INITIAL_RECEIVE_BUFFER_SIZE);
+    EXPECT_EQ(buffer.data()[INITIAL_RECEIVE_BUFFER_SIZE - 1], 7);
+
+    grow_receive_buffer(buffer, buffer.size(), 200 * 1024);
+    EXPECT_EQ(buffer.size(), 200u * 1024);
+}
+
+TEST_F(NetworkUtilsTest, ReservedBufferIsAllocatedWhole)
+{
+    Buffer buffer;
+    grow_receive_buffer(buffer, 0, 200 * 1024, true);
+    EXPECT_EQ(buffer.size(), 200u * 1024);
+
+    // Already large enough, nothing is copied
+    const uint8_t *data = buffer.data();
+    grow_receive_buffer(buffer, 1024, 200 * 1024, true);
+    EXPECT_EQ(buffer.data(), data);
+}
+
+TEST_F(NetworkUtilsTest, SendPrefixedFileStreamsRegion)
+{
+    make_non_blocking(sockets[0]);
+
+    char path[] = "/tmp/fenris_sendfile_XXXXXX";
+    int file_fd = mkstemp(path);
+    ASSERT_NE(file_fd, -1);
+    unlink(path);
+
+    std::vector<uint8_t> content(512 * 1024);
+    for (size_t i = 0; i < content.size(); ++i) {
+        content[i] = static_cast<uint8_t>(i * 13);
+    }
+    ASSERT_EQ(write(file_fd, content.data(), content.size()),
+              static_cast<ssize_t>(content.size()));
+
+    // Larger than the socket buffer, so sendfile() has to wait for space
+    const uint64_t offset = 1000;
+    const uint32_t length = static_cast<uint32_t>(content.size() - 2000);
+    std::thread sender([&]() {
+        EXPECT_EQ(
+            send_prefixed_file(sockets[0], file_fd, offset, length, true),
+            NetworkResult::SUCCESS);
+    });
+
+    std::vector<uint8_t> received;
+    EXPECT_EQ(receive_prefixed_data(sockets[1], received),
+              NetworkResult::SUCCESS);
+    sender.join();
+    close(file_fd);
+
+    ASSERT_EQ(received.size(), length);
+    EXPECT_TRUE(std::equal(
+        received.begin(), received.end(), content.begin() + offset));
+}
+
+TEST_F(NetworkUtilsTest, SendPrefixedFileFailsPastEnd)
+{
+    char path[] = "/tmp/fenris_sendfile_XXXXXX";
+    int file_fd = mkstemp(path);
+    ASSERT_NE(file_fd, -1);
+    unlink(path);
+    ASSERT_EQ(write(file_fd, "short", 5), 5);
+
+    EXPECT_EQ(send_prefixed_file(sockets[0], file_fd, 0, 64),
+              NetworkResult::SEND_ERROR);
+    close(file_fd);
+}
+
+} // namespace tests
+} // namespace common
+} // namespace fenris
@@ -0,0 +1,80 @@
+#include "common/nonce_sequence.hpp"
+#include <gtest/gtest.h>
+#include <vector>
+
+namespace fenris {
+namespace common {
+namespace crypto {
+namespace tests {
+
+TEST(NonceSequenceTest, CountsUpBehindThePrefix)
+{
+    NonceSequence sequence(NonceDirection::CLIENT_TO_SERVER, 0x010203);
+
+    auto [first, first_result] = sequence.next();
+    ASSERT_EQ(first_result, EncryptionResult::SUCCESS);
+    EXPECT_EQ(first,
+              (std::vector<uint8_t>{1, 1, 2, 3, 0, 0, 0, 0, 0, 0, 0, 0}));
+
+    for (int i = 1; i < 256; ++i) {
+        sequence.next();
+    }
+    auto [later, later_result] = sequence.next();
+    ASSERT_EQ(later_result, EncryptionResult::SUCCESS);
+    EXPECT_EQ(later,
+              (std::vector<uint8_t>{1, 1, 2, 3, 0, 0, 0, 0, 0, 0, 1, 0}));
+    EXPECT_EQ(sequence.count(), 257);
+    EXPECT_EQ(sequence.epoch(), 0x010203);
+}
+
+TEST(NonceSequenceTest, DirectionsNeverShareNonces)
+{
+    NonceSequence requests(NonceDirection::CLIENT_TO_SERVER);
+    NonceSequence responses(NonceDirection::SERVER_TO_CLIENT);
+    for (int i = 0; i < 16; ++i) {
+        EXPECT_NE(requests.next().first, responses.next().first);
+    }
+}
+
+TEST(NonceSequenceTest, ReceiverRejectsReplays)
+{
+    NonceSequence sender(NonceDirection::SERVER_TO_CLIENT, 4);
+    NonceSequence receiver(NonceDirection::SERVER_TO_CLIENT, 4);
+
+    auto [first, first_result] = sender.next();
+    auto [second, second_result] = sender.next();
+    ASSERT_EQ(receiver.verify(first), EncryptionResult::SUCCESS);
+    receiver.accept(first);
+    EXPECT_EQ(receiver.verify(first), EncryptionResult::REPLAYED_NONCE);
+
+    // Gaps are allowed, going back is not
+    auto [third, third_result] = sender.next();
+    ASSERT_EQ(receiver.verify(third), EncryptionResult::SUCCESS);
+    receiver.accept(third);
+    EXPECT_EQ(receiver.verify(second), EncryptionResult::REPLAYED_NONCE);
+    EXPECT_EQ(receiver.count(), 3);
+
+    // Other directions and epochs never match
+    NonceSequence other_direction(NonceDirection::CLIENT_TO_SERVER, 4);
+    NonceSequence other_epoch(NonceDirection::SERVER_TO_CLIENT, 5);
+    for (int i = 0; i < 4; ++i) {
+        other_direction.next();
+        other_epoch.next();
+    }
+    EXPECT_EQ(receiver.verify(other_direction.next().first),
+              EncryptionResult::REPLAYED_NONCE);
+    EXPECT_EQ(receiver.verify(other_epoch.next().first),
+              EncryptionResult::REPLAYED_NONCE);
+
+    const std::vector<uint8_t> short_iv(8);
+    EXPECT_EQ(receiver.verify(short_iv), EncryptionResult::INVALID_IV_SIZE);
+
+    // Rejected nonces do not move the sequence
+    receiver.accept(second);
+    EXPECT_EQ(receiver.count(), 3);
+}
+
+} // namespace tests
+} // namespace crypto
+} // namespace common
+} // namespace fenris
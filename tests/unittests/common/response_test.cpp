@@ -156,6 +156,52 @@ TEST(ResponseTest, LargeData)
                      large_data.size()));
 }
 
+// Test serializing a response whose data is passed separately
+TEST(ResponseTest, SeparatePayload)
+{
+    fenris::Response response;
+    response.set_type(fenris::ResponseType::FILE_CONTENT);
+    response.set_success(true);
+
+    std::vector<uint8_t> payload(300 * 1024);
+    for (size_t i = 0; i < payload.size(); i++) {
+        payload[i] = static_cast<uint8_t>(i % 251);
+    }
+
+    Buffer serialized = serialize_response_to_buffer(response, payload);
+    ASSERT_FALSE(serialized.empty());
+
+    fenris::Response deserialized = deserialize_response(serialized);
+    EXPECT_EQ(deserialized.type(), fenris::ResponseType::FILE_CONTENT);
+    EXPECT_TRUE(deserialized.success());
+    ASSERT_EQ(deserialized.data().size(), payload.size());
+    EXPECT_EQ(0,
+              memcmp(deserialized.data().data(),
+                     payload.data(),
+                     payload.size()));
+
+    // Same bytes as setting the data field directly
+    response.set_data(std::string(payload.begin(), payload.end()));
+    EXPECT_EQ(serialized.to_vector(), serialize_response(response));
+
+    // The data field must not be given twice
+    EXPECT_TRUE(serialize_response_to_buffer(response, payload).empty());
+}
+
+TEST(ResponseTest, SeparatePayloadWithTailRoom)
+{
+    fenris::Response response;
+    response.set_type(fenris::ResponseType::FILE_CONTENT);
+    const std::vector<uint8_t> payload = {'f', 'i', 'l', 'e'};
+
+    Buffer serialized = serialize_response_to_buffer(response, payload, 16);
+    ASSERT_GT(serialized.size(), 16);
+
+    fenris::Response deserialized =
+        deserialize_response(serialized.slice(0, serialized.size() - 16));
+    EXPECT_EQ(deserialized.data(), "file");
+}
+
 // Test response_to_json functionality
 TEST(ResponseTest, ResponseToJson)
 {
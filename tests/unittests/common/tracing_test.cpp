@@ -0,0 +1,151 @@
+#include "common/tracing.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+
+namespace fs = std::filesystem;
+namespace fenris {
+namespace common {
+namespace tests {
+
+namespace {
+
+std::string read_all(const fs::path &path)
+{
+    std::ifstream file(path);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+size_t count(const std::string &text, const std::string &needle)
+{
+    size_t found = 0;
+    for (size_t at = text.find(needle); at != std::string::npos;
+         at = text.find(needle, at + needle.size())) {
+        ++found;
+    }
+    return found;
+}
+
+} // namespace
+
+class TracingTest : public ::testing::Test {
+  protected:
+    void SetUp() override
+    {
+        path = fs::temp_directory_path() / "fenris_tracing_test.json";
+        fs::remove(path);
+    }
+
+    void TearDown() override
+    {
+        fs::remove(path);
+    }
+
+    fs::path path;
+};
+
+TEST_F(TracingTest, IdleWithoutATracer)
+{
+    Tracer tracer;
+    RequestTrace trace = tracer.begin();
+    EXPECT_FALSE(trace.recording());
+
+    // Scopes without a recording trace stamp nothing
+    TraceContext context(&trace);
+    {
+        TraceScope scope(TraceStage::DISK);
+    }
+    EXPECT_TRUE(trace.spans().empty());
+}
+
+TEST_F(TracingTest, ScopesStampTheCurrentTrace)
+{
+    Tracer tracer;
+    ASSERT_TRUE(tracer.open(path.string(), 1, "test"));
+
+    RequestTrace trace = tracer.begin();
+    ASSERT_TRUE(trace.recording());
+    {
+        TraceContext context(&trace);
+        TraceScope handle(TraceStage::HANDLE);
+        {
+            TraceScope cache(TraceStage::CACHE);
+        }
+    }
+    // Nothing stamps once the context is gone
+    {
+        TraceScope orphan(TraceStage::SEND);
+    }
+
+    ASSERT_EQ(trace.spans().size(), 2u);
+    EXPECT_EQ(trace.spans()[0].stage, TraceStage::CACHE);
+    EXPECT_EQ(trace.spans()[1].stage, TraceStage::HANDLE);
+    EXPECT_LE(trace.spans()[1].start, trace.spans()[0].start);
+    EXPECT_GE(trace.spans()[1].end, trace.spans()[0].end);
+}
+
+TEST_F(TracingTest, SamplesOneInRate)
+{
+    Tracer tracer;
+    ASSERT_TRUE(tracer.open(path.string(), 4, "test"));
+
+    size_t sampled = 0;
+    for (int i = 0; i < 12; ++i) {
+        RequestTrace trace = tracer.begin();
+        tracer.adopt(trace, 0, "PING");
+        if (trace.id() != 0) {
+            ++sampled;
+        } else {
+            EXPECT_FALSE(trace.recording());
+        }
+    }
+    EXPECT_EQ(sampled, 3u);
+
+    // A request the peer traces is always traced, under the peer's ID
+    RequestTrace requested = tracer.begin();
+    tracer.adopt(requested, 0xabcdef, "PING");
+    EXPECT_EQ(requested.id(), 0xabcdefu);
+}
+
+TEST_F(TracingTest, WritesChromeTraceEvents)
+{
+    Tracer tracer;
+    ASSERT_TRUE(tracer.open(path.string(), 1, "fenris_test"));
+
+    RequestTrace trace = tracer.begin();
+    const auto start = trace.now();
+    trace.record(
+        TraceStage::RECEIVE, start, start + std::chrono::microseconds(5));
+    trace.record(TraceStage::SEND,
+                 start + std::chrono::microseconds(5),
+                 start + std::chrono::microseconds(12));
+    tracer.adopt(trace, 0x1234, "READ_FILE");
+    tracer.finish(trace);
+
+    // Unsampled traces are not written
+    RequestTrace discarded;
+    tracer.finish(discarded);
+    tracer.close();
+
+    const std::string text = read_all(path);
+    EXPECT_EQ(text.front(), '[');
+    EXPECT_EQ(text.substr(text.size() - 3), "\n]\n");
+    EXPECT_NE(text.find("\"args\":{\"name\":\"fenris_test\"}"),
+              std::string::npos);
+    EXPECT_EQ(count(text, "\"ph\":\"X\""), 3u);
+    EXPECT_EQ(count(text, "\"trace_id\":\"0000000000001234\""), 3u);
+    EXPECT_NE(text.find("\"name\":\"READ_FILE\",\"cat\":\"request\""),
+              std::string::npos);
+    EXPECT_NE(text.find("\"name\":\"receive\",\"cat\":\"stage\""),
+              std::string::npos);
+    EXPECT_NE(text.find("\"dur\":12.000"), std::string::npos) << text;
+}
+
+} // namespace tests
+} // namespace common
+} // namespace fenris
@@ -0,0 +1,147 @@
+#include "common/wire_compression.hpp"
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace fenris {
+namespace common {
+namespace compress {
+namespace tests {
+
+static std::vector<uint8_t> make_text(size_t size)
+{
+    static const std::string words[] = {
+        "server ", "client ", "chunk ", "stream ", "file ", "request "};
+    std::vector<uint8_t> text;
+    text.reserve(size);
+    std::mt19937 gen(7);
+    while (text.size() < size) {
+        const std::string &word = words[gen() % 6];
+        text.insert(text.end(), word.begin(), word.end());
+    }
+    text.resize(size);
+    return text;
+}
+
+static std::vector<uint8_t> make_random(size_t size)
+{
+    std::vector<uint8_t> data(size);
+    std::mt19937 gen(7);
+    std::uniform_int_distribution<int> dist(0, 255);
+    for (auto &byte : data) {
+        byte = static_cast<uint8_t>(dist(gen));
+    }
+    return data;
+}
+
+TEST(WireCompressionTest, EstimatesEntropy)
+{
+    EXPECT_DOUBLE_EQ(estimate_entropy({}, 4096), 0.0);
+    EXPECT_DOUBLE_EQ(estimate_entropy(std::vector<uint8_t>(10000, 'a'), 4096),
+                     0.0);
+    EXPECT_LT(estimate_entropy(make_text(100000), 4096), 4.0);
+    EXPECT_GT(estimate_entropy(make_random(100000), 4096), 7.5);
+
+    // Text behind a random header is still seen as text
+    std::vector<uint8_t> mixed = make_random(1024);
+    std::vector<uint8_t> text = make_text(100000);
+    mixed.insert(mixed.end(), text.begin(), text.end());
+    EXPECT_LT(estimate_entropy(mixed, 4096), 6.0);
+}
+
+TEST(WireCompressionTest, RoundTripsMessagesOfEveryKind)
+{
+    WireCompression sender;
+    WireCompression receiver;
+
+    const std::vector<std::vector<uint8_t>> messages = {
+        {},
+        {1, 2, 3},
+        make_text(64 * 1024),
+        make_random(64 * 1024),
+        make_text(64 * 1024),
+        make_text(300),
+    };
+
+    std::vector<size_t> frame_sizes;
+    for (const auto &message : messages) {
+        auto [frame, encode_result] = sender.encode(message);
+        ASSERT_EQ(encode_result, CompressionResult::SUCCESS);
+        frame_sizes.push_back(frame.size());
+
+        auto [decoded, decode_result] = receiver.decode(frame);
+        ASSERT_EQ(decode_result, CompressionResult::SUCCESS);
+        EXPECT_EQ(std::vector<uint8_t>(decoded.begin(), decoded.end()),
+                  message);
+    }
+
+    // Small and random messages cost the header byte only
+    EXPECT_EQ(frame_sizes[0], 1);
+    EXPECT_EQ(frame_sizes[1], 4);
+    EXPECT_EQ(frame_sizes[3], messages[3].size() + 1);
+    // Text shrinks, and a repeat refers back to the earlier message
+    EXPECT_LT(frame_sizes[2], messages[2].size() / 2);
+    EXPECT_LT(frame_sizes[4], frame_sizes[2]);
+}
+
+TEST(WireCompressionTest, RejectsBadFrames)
+{
+    WireCompressionConfig config;
+    config.max_message_size = 1024;
+    WireCompression sender;
+    WireCompression receiver(config);
+
+    EXPECT_EQ(receiver.decode(Buffer()).second,
+              CompressionResult::INVALID_DATA);
+    EXPECT_EQ(receiver.decode(Buffer::copy_of(std::vector<uint8_t>{7, 1}))
+                  .second,
+              CompressionResult::INVALID_DATA);
+
+    // A message expanding past the limit is refused
+    auto [frame, encode_result] = sender.encode(make_text(64 * 1024));
+    ASSERT_EQ(encode_result, CompressionResult::SUCCESS);
+    EXPECT_EQ(receiver.decode(frame).second,
+              CompressionResult::BUFFER_TOO_SMALL);
+}
+
+TEST(WireCompressionTest, PicksCodecsByMessageSize)
+{
+    const uint32_t both = negotiate_codecs(codec_mask(CodecId::LZ4),
+                                           WireCompressionConfig{}.codecs);
+    EXPECT_EQ(both, codec_mask(CodecId::DEFLATE) | codec_mask(CodecId::LZ4));
+    // Peers that predate negotiation and peers without LZ4 get deflate
+    EXPECT_EQ(negotiate_codecs(0, both), codec_mask(CodecId::DEFLATE));
+    EXPECT_EQ(negotiate_codecs(both, codec_mask(CodecId::DEFLATE)),
+              codec_mask(CodecId::DEFLATE));
+
+    WireCompression sender(WireCompressionConfig{}, both);
+    WireCompression receiver(WireCompressionConfig{}, both);
+    WireCompression deflate_only;
+
+    const std::vector<uint8_t> small = make_text(4096);
+    const std::vector<uint8_t> large = make_text(256 * 1024);
+    for (const auto *message : {&small, &large, &small}) {
+        auto [frame, encode_result] = sender.encode(*message);
+        ASSERT_EQ(encode_result, CompressionResult::SUCCESS);
+        EXPECT_EQ(frame.data()[0],
+                  static_cast<uint8_t>(message == &large ? CodecId::LZ4
+                                                         : CodecId::DEFLATE));
+
+        auto [decoded, decode_result] = receiver.decode(frame);
+        ASSERT_EQ(decode_result, CompressionResult::SUCCESS);
+        EXPECT_EQ(std::vector<uint8_t>(decoded.begin(), decoded.end()),
+                  *message);
+
+        // A codec that was not negotiated is refused
+        if (message == &large) {
+            EXPECT_EQ(deflate_only.decode(frame).second,
+                      CompressionResult::INVALID_DATA);
+        }
+    }
+}
+
+} // namespace tests
+} // namespace compress
+} // namespace common
+} // namespace fenris
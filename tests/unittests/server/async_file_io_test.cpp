@@ -0,0 +1,318 @@
+#include "common/file_operations.hpp"
+#include "common/logging.hpp"
+#include "server/async_file_io.hpp"
+
+#include <atomic>
+#include <filesystem>
+#include <future>
+#include <gtest/gtest.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace fenris {
+namespace server {
+namespace test {
+
+namespace fs = std::filesystem;
+
+using common::Buffer;
+using common::FileOperationResult;
+
+class AsyncFileIoTest : public ::testing::Test {
+  protected:
+    void SetUp() override
+    {
+        fs::remove_all(test_dir);
+        fs::create_directories(test_dir + "/sub");
+        common::LoggingConfig log_config;
+        log_config.level = common::LogLevel::DEBUG;
+        log_config.console_logging = true;
+        log_config.file_logging = false;
+
+        common::initialize_logging(log_config, "TestAsyncFileIo");
+    }
+
+    void TearDown() override
+    {
+        fs::remove_all(test_dir);
+    }
+
+    std::unique_ptr<AsyncFileIo> make_io(AsyncIoBackend backend)
+    {
+        AsyncIoConfig config;
+        config.backend = backend;
+        config.registered_buffers = 2;
+        config.registered_buffer_size = 4096;
+        auto io = std::make_unique<AsyncFileIo>(config, "TestAsyncFileIo");
+        io->start();
+        return io;
+    }
+
+    // Blocking wrappers, each waits for its callback
+    static std::pair<Buffer, FileOperationResult>
+    read_file(AsyncFileIo &io, const std::string &path)
+    {
+        std::promise<std::pair<Buffer, FileOperationResult>> done;
+        io.read_file(path, [&](Buffer content, FileOperationResult result) {
+            done.set_value({std::move(content), result});
+        });
+        return done.get_future().get();
+    }
+
+    static std::pair<Buffer, FileOperationResult>
+    read_chunk(AsyncFileIo &io,
+               const std::string &path,
+               uint64_t offset,
+               size_t length)
+    {
+        std::promise<std::pair<Buffer, FileOperationResult>> done;
+        io.read_chunk(path,
+                      offset,
+                      length,
+                      [&](Buffer block, FileOperationResult result) {
+                          done.set_value({std::move(block), result});
+                      });
+        return done.get_future().get();
+    }
+
+    static FileOperationResult
+    write_file(AsyncFileIo &io, const std::string &path, std::string data)
+    {
+        std::promise<FileOperationResult> done;
+        io.write_file(path, std::move(data), [&](FileOperationResult result) {
+            done.set_value(result);
+        });
+        return done.get_future().get();
+    }
+
+    static FileOperationResult
+    append_file(AsyncFileIo &io, const std::string &path, std::string data)
+    {
+        std::promise<FileOperationResult> done;
+        io.append_file(path, std::move(data), [&](FileOperationResult result) {
+            done.set_value(result);
+        });
+        return done.get_future().get();
+    }
+
+    static std::pair<fenris::FileInfo, FileOperationResult>
+    get_file_info(AsyncFileIo &io, const std::string &path)
+    {
+        std::promise<std::pair<fenris::FileInfo, FileOperationResult>> done;
+        io.get_file_info(
+            path, [&](fenris::FileInfo file_info, FileOperationResult result) {
+                done.set_value({std::move(file_info), result});
+            });
+        return done.get_future().get();
+    }
+
+    const std::string test_dir = "/tmp/fenris_async_file_io_test";
+};
+
+TEST_F(AsyncFileIoTest, BackendsAgree)
+{
+    for (AsyncIoBackend backend :
+         {AsyncIoBackend::IO_URING, AsyncIoBackend::BLOCKING}) {
+        SCOPED_TRACE(async_io_backend_to_string(backend));
+        auto io = make_io(backend);
+        const std::string path = test_dir + "/file.txt";
+
+        ASSERT_EQ(write_file(*io, path, "hello"), FileOperationResult::SUCCESS);
+        ASSERT_EQ(append_file(*io, path, ", world"),
+                  FileOperationResult::SUCCESS);
+
+        auto [content, read_result] = read_file(*io, path);
+        EXPECT_EQ(read_result, FileOperationResult::SUCCESS);
+        EXPECT_EQ(content.view(), "hello, world");
+
+        auto [block, chunk_result] = read_chunk(*io, path, 7, 100);
+        EXPECT_EQ(chunk_result, FileOperationResult::SUCCESS);
+        EXPECT_EQ(block.view(), "world");
+
+        auto [past_end, past_end_result] = read_chunk(*io, path, 50, 10);
+        EXPECT_EQ(past_end_result, FileOperationResult::SUCCESS);
+        EXPECT_TRUE(past_end.empty());
+
+        auto [file_info, info_result] = get_file_info(*io, path);
+        auto [expected, expected_result] = common::get_file_info(path);
+        ASSERT_EQ(info_result, FileOperationResult::SUCCESS);
+        EXPECT_EQ(file_info.name(), expected.name());
+        EXPECT_EQ(file_info.size(), expected.size());
+        EXPECT_EQ(file_info.is_directory(), expected.is_directory());
+        EXPECT_EQ(file_info.modified_time(), expected.modified_time());
+        EXPECT_EQ(file_info.permissions(), expected.permissions());
+
+        // Rewriting truncates
+        ASSERT_EQ(write_file(*io, path, "hi"), FileOperationResult::SUCCESS);
+        EXPECT_EQ(read_file(*io, path).first.view(), "hi");
+
+        EXPECT_EQ(read_file(*io, test_dir + "/missing.txt").second,
+                  FileOperationResult::FILE_NOT_FOUND);
+        EXPECT_EQ(read_file(*io, test_dir + "/sub").second,
+                  FileOperationResult::INVALID_PATH);
+        EXPECT_EQ(append_file(*io, test_dir + "/missing.txt", "x"),
+                  FileOperationResult::FILE_NOT_FOUND);
+        EXPECT_TRUE(get_file_info(*io, test_dir + "/sub").first.is_directory());
+
+        std::promise<size_t> listed;
+        io->list_directory(test_dir,
+                           [&](std::vector<fenris::FileInfo> entries,
+                               FileOperationResult result) {
+                               EXPECT_EQ(result, FileOperationResult::SUCCESS);
+                               listed.set_value(entries.size());
+                           });
+        EXPECT_EQ(listed.get_future().get(), 2);
+    }
+}
+
+TEST_F(AsyncFileIoTest, PathsResolveAgainstDirectory)
+{
+    common::write_file(test_dir + "/file.txt", "top level");
+    auto [handle, open_result] =
+        common::DirectoryHandle::open(test_dir + "/sub");
+    ASSERT_EQ(open_result, FileOperationResult::SUCCESS);
+    const AsyncFileIo::Directory directory =
+        std::make_shared<const common::DirectoryHandle>(std::move(handle));
+
+    for (AsyncIoBackend backend :
+         {AsyncIoBackend::IO_URING, AsyncIoBackend::BLOCKING}) {
+        SCOPED_TRACE(async_io_backend_to_string(backend));
+        auto io = make_io(backend);
+
+        std::promise<FileOperationResult> written;
+        io->write_file(directory,
+                       "file.txt",
+                       "0123456789",
+                       [&](FileOperationResult result) {
+                           written.set_value(result);
+                       });
+        ASSERT_EQ(written.get_future().get(), FileOperationResult::SUCCESS);
+        EXPECT_EQ(common::read_file(test_dir + "/sub/file.txt").first,
+                  "0123456789");
+        EXPECT_EQ(common::read_file(test_dir + "/file.txt").first,
+                  "top level");
+
+        // The prefetch rides along with the read and never changes it
+        std::promise<std::pair<Buffer, uint64_t>> read;
+        io->read_chunk(
+            directory,
+            "file.txt",
+            4,
+            3,
+            common::Prefetch{7, 4096},
+            [&](Buffer block, uint64_t size, FileOperationResult result) {
+                EXPECT_EQ(result, FileOperationResult::SUCCESS);
+                read.set_value({std::move(block), size});
+            });
+        auto [block, size] = read.get_future().get();
+        EXPECT_EQ(block.view(), "456");
+        EXPECT_EQ(size, 10u);
+
+        std::promise<FileOperationResult> missing;
+        io->get_file_info(
+            directory,
+            "missing.txt",
+            [&](fenris::FileInfo, FileOperationResult result) {
+                missing.set_value(result);
+            });
+        EXPECT_EQ(missing.get_future().get(),
+                  FileOperationResult::FILE_NOT_FOUND);
+    }
+}
+
+TEST_F(AsyncFileIoTest, ConcurrentClientsShareTheRing)
+{
+    auto io = make_io(AsyncIoBackend::IO_URING);
+
+    // Larger than a registered buffer, so both read paths are taken
+    std::string content(3 * 4096 + 100, '\0');
+    for (size_t i = 0; i < content.size(); ++i) {
+        content[i] = static_cast<char>(i % 251);
+    }
+    const std::string path = test_dir + "/shared.bin";
+    common::write_file(path, content);
+
+    constexpr int THREADS = 4;
+    constexpr int READS = 50;
+    std::atomic<int> correct{0};
+    std::atomic<int> pending{THREADS * READS};
+    std::promise<void> all_done;
+
+    // Blocks stay alive until the end, so the registered buffers run out
+    std::mutex blocks_mutex;
+    std::vector<Buffer> blocks;
+
+    std::vector<std::thread> clients;
+    for (int t = 0; t < THREADS; ++t) {
+        clients.emplace_back([&, t]() {
+            for (int i = 0; i < READS; ++i) {
+                const uint64_t offset = static_cast<uint64_t>(t * 977 + i * 13);
+                const size_t length = i % 2 == 0 ? 4096 : 8192;
+                io->read_chunk(
+                    path,
+                    offset,
+                    length,
+                    [&, offset, length](Buffer block,
+                                        FileOperationResult result) {
+                        if (result == FileOperationResult::SUCCESS &&
+                            block.view() == content.substr(offset, length)) {
+                            ++correct;
+                        }
+                        {
+                            std::lock_guard<std::mutex> lock(blocks_mutex);
+                            blocks.push_back(std::move(block));
+                        }
+                        if (--pending == 0) {
+                            all_done.set_value();
+                        }
+                    });
+            }
+        });
+    }
+    for (auto &client : clients) {
+        client.join();
+    }
+
+    all_done.get_future().get();
+    EXPECT_EQ(correct, THREADS * READS);
+}
+
+TEST_F(AsyncFileIoTest, RunsOnCallerWhenStopped)
+{
+    AsyncFileIo io(AsyncIoConfig{}, "TestAsyncFileIo");
+    const std::string path = test_dir + "/sync.txt";
+
+    bool written = false;
+    io.write_file(path, "inline", [&](FileOperationResult result) {
+        written = result == FileOperationResult::SUCCESS;
+    });
+    EXPECT_TRUE(written);
+    EXPECT_EQ(common::read_file(path).first, "inline");
+}
+
+TEST_F(AsyncFileIoTest, StopCompletesQueuedOperations)
+{
+    auto io = make_io(AsyncIoBackend::IO_URING);
+    common::write_file(test_dir + "/queued.txt", "queued");
+
+    std::atomic<int> completed{0};
+    for (int i = 0; i < 100; ++i) {
+        io->read_file(test_dir + "/queued.txt",
+                      [&](Buffer content, FileOperationResult result) {
+                          if (result == FileOperationResult::SUCCESS &&
+                              content.view() == "queued") {
+                              ++completed;
+                          }
+                      });
+    }
+    io->stop();
+    EXPECT_EQ(completed, 100);
+}
+
+} // namespace test
+} // namespace server
+} // namespace fenris
@@ -5,6 +5,7 @@
 #include <chrono>
 #include <filesystem>
 #include <gtest/gtest.h>
+#include <optional>
 #include <string>
 #include <thread>
 #include <vector>
@@ -216,6 +217,291 @@ TEST_F(CacheManagerTest, ConcurrentReads)
     EXPECT_EQ(cache_manager->get_cache_size(), 1);
 }
 
+TEST_F(CacheManagerTest, ByteBudgetEvictsLeastRecent)
+{
+    CacheConfig config;
+    config.max_bytes = 100;
+    config.shard_count = 1;
+    CacheManager cache(config, "TestCacheManager");
+
+    std::string a = create_test_file("a.bin", std::string(40, 'a'));
+    std::string b = create_test_file("b.bin", std::string(40, 'b'));
+    std::string c = create_test_file("c.bin", std::string(40, 'c'));
+
+    cache.read_file(a);
+    cache.read_file(b);
+    EXPECT_EQ(cache.get_cache_bytes(), 80);
+
+    // a is touched, so caching c has to push out b
+    cache.read_file(a);
+    cache.read_file(c);
+    EXPECT_EQ(cache.get_cache_size(), 2);
+    EXPECT_EQ(cache.get_cache_bytes(), 80);
+
+    common::write_file(a, "new a");
+    common::write_file(b, "new b");
+    EXPECT_EQ(cache.read_file(a), std::string(40, 'a'));
+    EXPECT_EQ(cache.read_file(b), "new b");
+}
+
+TEST_F(CacheManagerTest, OversizedFileIsServedButNotCached)
+{
+    CacheConfig config;
+    config.max_bytes = 64;
+    config.shard_count = 1;
+    CacheManager cache(config, "TestCacheManager");
+
+    std::string big = create_test_file("big.bin", std::string(65, 'x'));
+    EXPECT_EQ(cache.read_file(big), std::string(65, 'x'));
+    EXPECT_EQ(cache.get_cache_size(), 0);
+    EXPECT_EQ(cache.get_cache_bytes(), 0);
+
+    // Replacing a cached entry with an oversized one drops it
+    EXPECT_TRUE(cache.write_file(big, "small"));
+    EXPECT_EQ(cache.get_cache_bytes(), 5);
+    EXPECT_TRUE(cache.write_file(big, std::string(100, 'y')));
+    EXPECT_EQ(cache.get_cache_size(), 0);
+}
+
+TEST_F(CacheManagerTest, HitsShareContent)
+{
+    CacheManager cache(CacheConfig{}, "TestCacheManager");
+    std::string filepath = create_test_file("shared.txt", "shared content");
+
+    std::optional<CachedFile> first = cache.read_shared(filepath);
+    std::optional<CachedFile> second = cache.read_shared(filepath);
+    ASSERT_TRUE(first.has_value());
+    ASSERT_TRUE(second.has_value());
+    EXPECT_EQ(first->data(), second->data());
+    EXPECT_EQ(first->view(), "shared content");
+
+    // Readers keep their content alive past invalidation
+    cache.invalidate(filepath);
+    EXPECT_EQ(first->view(), "shared content");
+
+    EXPECT_FALSE(cache.read_shared(test_dir + "/missing.txt").has_value());
+}
+
+TEST_F(CacheManagerTest, MapsLargeFiles)
+{
+    CacheConfig config;
+    config.shard_count = 1;
+    config.map_threshold = 64;
+    CacheManager cache(config, "TestCacheManager");
+
+    const std::string content(4096, 'm');
+    std::string large = create_test_file("large.bin", content);
+    std::string small = create_test_file("small.txt", "small");
+
+    std::optional<CachedFile> mapped = cache.read_shared(large);
+    ASSERT_TRUE(mapped.has_value());
+    EXPECT_EQ(mapped->view(), content);
+    EXPECT_EQ(cache.read_file(small), "small");
+    EXPECT_EQ(cache.get_cache_size(), 2);
+    EXPECT_EQ(cache.get_cache_bytes(), content.size() + 5);
+
+    // Hits hand out the mapping itself
+    EXPECT_EQ(cache.read_shared(large)->data(), mapped->data());
+    EXPECT_EQ(cache.get_stats().hits, 1);
+}
+
+TEST_F(CacheManagerTest, RangesSliceCachedContent)
+{
+    CacheManager cache(CacheConfig{}, "TestCacheManager");
+    std::string filepath = create_test_file("ranges.txt", "0123456789");
+
+    // A miss reads just the range and caches nothing
+    std::optional<CachedFile> range = cache.read_range(filepath, 2, 3);
+    ASSERT_TRUE(range.has_value());
+    EXPECT_EQ(range->view(), "234");
+    EXPECT_EQ(cache.get_cache_size(), 0);
+    EXPECT_EQ(cache.get_stats().misses, 1);
+
+    // Once the file is cached, ranges view the shared content
+    std::optional<CachedFile> whole = cache.read_shared(filepath);
+    ASSERT_TRUE(whole.has_value());
+    range = cache.read_range(filepath, 7, 100);
+    ASSERT_TRUE(range.has_value());
+    EXPECT_EQ(range->view(), "789");
+    EXPECT_EQ(range->data(), whole->data() + 7);
+    EXPECT_TRUE(cache.read_range(filepath, 10, 1)->empty());
+    EXPECT_EQ(cache.get_stats().hits, 2);
+
+    // Lookups alone never touch the disk and report the whole size
+    uint64_t size = 0;
+    EXPECT_EQ(cache.cached_range(filepath, 1, 2, &size)->view(), "12");
+    EXPECT_EQ(size, 10u);
+    cache.invalidate(filepath);
+    EXPECT_FALSE(cache.cached_range(filepath, 1, 2).has_value());
+    EXPECT_EQ(cache.read_range(filepath, 0, 4)->view(), "0123");
+
+    EXPECT_FALSE(cache.read_range(test_dir + "/missing.txt", 0, 1));
+}
+
+TEST_F(CacheManagerTest, ShardsSplitBudget)
+{
+    CacheConfig config;
+    config.max_bytes = 1024;
+    config.shard_count = 3;
+    CacheManager cache(config, "TestCacheManager");
+    EXPECT_EQ(cache.get_shard_count(), 4);
+
+    std::vector<std::string> filepaths;
+    for (int i = 0; i < 64; i++) {
+        std::string filename = "shard" + std::to_string(i) + ".txt";
+        filepaths.push_back(
+            create_test_file(filename, std::string(16, 'a' + i % 26)));
+    }
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++) {
+        threads.emplace_back([&cache, &filepaths, t]() {
+            for (int round = 0; round < 50; round++) {
+                const auto &filepath = filepaths[(t * 7 + round) % 64];
+                cache.read_shared(filepath);
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_LE(cache.get_cache_bytes(), config.max_bytes);
+    EXPECT_EQ(cache.get_cache_bytes(), cache.get_cache_size() * 16);
+}
+
+TEST_F(CacheManagerTest, StatsCountHitsMissesAndEvictions)
+{
+    std::vector<std::string> filepaths;
+    for (int i = 0; i < 4; i++) {
+        std::string filename = "stats" + std::to_string(i) + ".txt";
+        filepaths.push_back(create_test_file(filename, "stats"));
+    }
+
+    for (const auto &filepath : filepaths) {
+        cache_manager->read_file(filepath);
+    }
+    cache_manager->read_file(filepaths[3]);
+    cache_manager->read_file(test_dir + "/missing.txt");
+
+    CacheStats stats = cache_manager->get_stats();
+    EXPECT_EQ(stats.hits, 1);
+    EXPECT_EQ(stats.misses, 5);
+    EXPECT_EQ(stats.evictions, 1);
+    EXPECT_EQ(stats.rejections, 0);
+
+    cache_manager->reset_stats();
+    stats = cache_manager->get_stats();
+    EXPECT_EQ(stats.hits + stats.misses + stats.evictions, 0);
+}
+
+TEST_F(CacheManagerTest, ScanDoesNotFlushHotFiles)
+{
+    std::vector<std::string> hot;
+    for (int i = 0; i < 3; i++) {
+        std::string filename = "hot" + std::to_string(i) + ".txt";
+        hot.push_back(create_test_file(filename, "hot"));
+    }
+    std::vector<std::string> scan;
+    for (int i = 0; i < 20; i++) {
+        std::string filename = "scan" + std::to_string(i) + ".txt";
+        scan.push_back(create_test_file(filename, "scan"));
+    }
+
+    auto hot_hits_after_scan = [&](EvictionPolicyType type) {
+        CacheConfig config;
+        config.max_entries = 4;
+        config.shard_count = 1;
+        config.eviction_policy = type;
+        CacheManager cache(config, "TestCacheManager");
+
+        for (int round = 0; round < 2; round++) {
+            for (const auto &filepath : hot) {
+                cache.read_shared(filepath);
+            }
+        }
+        for (const auto &filepath : scan) {
+            cache.read_shared(filepath);
+        }
+
+        cache.reset_stats();
+        for (const auto &filepath : hot) {
+            cache.read_shared(filepath);
+        }
+        return cache.get_stats().hits;
+    };
+
+    EXPECT_EQ(hot_hits_after_scan(EvictionPolicyType::LRU), 0);
+    EXPECT_EQ(hot_hits_after_scan(EvictionPolicyType::TINY_LFU), 3);
+    EXPECT_EQ(hot_hits_after_scan(EvictionPolicyType::ARC), 3);
+}
+
+TEST_F(CacheManagerTest, WatcherInvalidatesOutOfBandChanges)
+{
+    std::string filepath = create_test_file("watched.txt", "original");
+    ASSERT_TRUE(cache_manager->watch(test_dir));
+    EXPECT_EQ(cache_manager->read_file(filepath), "original");
+    ASSERT_EQ(cache_manager->get_cache_size(), 1);
+
+    // Another process rewrites the file behind the cache's back
+    common::write_file(filepath, "changed elsewhere");
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (cache_manager->get_cache_size() != 0 &&
+           std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(cache_manager->get_cache_size(), 0);
+    EXPECT_EQ(cache_manager->read_file(filepath), "changed elsewhere");
+
+    cache_manager->stop_watching();
+}
+
+TEST_F(CacheManagerTest, InvalidatePrefixDropsDirectory)
+{
+    fs::create_directory(test_dir + "/dir");
+    std::string inside = create_test_file("dir/inside.txt", "inside");
+    std::string sibling = create_test_file("dir2.txt", "sibling");
+
+    cache_manager->read_file(inside);
+    cache_manager->read_file(sibling);
+    ASSERT_EQ(cache_manager->get_cache_size(), 2);
+
+    cache_manager->invalidate_prefix(test_dir + "/dir");
+    EXPECT_EQ(cache_manager->get_cache_size(), 1);
+
+    // Only the sibling survives, it shares the name prefix but not the parent
+    common::write_file(sibling, "updated");
+    EXPECT_EQ(cache_manager->read_file(sibling), "sibling");
+}
+
+TEST_F(CacheManagerTest, ValidateOnHitDetectsChanges)
+{
+    CacheConfig config;
+    config.validate_on_hit = true;
+    CacheManager cache(config, "TestCacheManager");
+
+    std::string filepath = create_test_file("validated.txt", "version 1");
+    EXPECT_EQ(cache.read_file(filepath), "version 1");
+    EXPECT_EQ(cache.read_file(filepath), "version 1");
+    EXPECT_EQ(cache.get_stats().hits, 1);
+
+    // Same size, the modification time gives the change away
+    common::write_file(filepath, "version 2");
+    auto modified = fs::last_write_time(filepath) + std::chrono::seconds(1);
+    fs::last_write_time(filepath, modified);
+    EXPECT_EQ(cache.read_file(filepath), "version 2");
+    EXPECT_EQ(cache.get_stats().stale_hits, 1);
+
+    EXPECT_EQ(cache.read_file(filepath), "version 2");
+    EXPECT_EQ(cache.get_stats().hits, 2);
+
+    // A deleted file is not served from cache
+    common::delete_file(filepath);
+    EXPECT_FALSE(cache.read_shared(filepath).has_value());
+    EXPECT_EQ(cache.get_cache_size(), 0);
+}
+
 } // namespace test
 } // namespace server
 } // namespace fenris
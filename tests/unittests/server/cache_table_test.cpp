@@ -0,0 +1,105 @@
+#include "server/cache_table.hpp"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fenris {
+namespace server {
+namespace test {
+
+uint32_t insert_key(CacheTable &table, const std::string &key)
+{
+    return table.insert(key,
+                        CacheTable::hash_key(key),
+                        common::Buffer::wrap(std::string(key)));
+}
+
+uint32_t find_key(const CacheTable &table, const std::string &key)
+{
+    return table.find(key, CacheTable::hash_key(key));
+}
+
+TEST(CacheTableTest, InsertFindErase)
+{
+    CacheTable table;
+    EXPECT_EQ(find_key(table, "missing"), NO_SLOT);
+
+    const uint32_t slot = insert_key(table, "/a.txt");
+    EXPECT_EQ(table.size(), 1);
+    EXPECT_EQ(find_key(table, "/a.txt"), slot);
+    EXPECT_EQ(table.entry(slot).key, "/a.txt");
+    EXPECT_EQ(table.entry(slot).data.view(), "/a.txt");
+
+    table.erase(slot);
+    EXPECT_EQ(table.size(), 0);
+    EXPECT_EQ(find_key(table, "/a.txt"), NO_SLOT);
+
+    // Freed slots are handed out again
+    EXPECT_EQ(insert_key(table, "/b.txt"), slot);
+}
+
+TEST(CacheTableTest, SlotsSurviveGrowthAndDeletes)
+{
+    CacheTable table;
+    std::vector<uint32_t> slots;
+    for (int i = 0; i < 1000; i++) {
+        slots.push_back(insert_key(table, "/file" + std::to_string(i)));
+    }
+    EXPECT_EQ(table.size(), 1000);
+
+    // Deleting every other key shifts probe runs around the survivors
+    for (int i = 0; i < 1000; i += 2) {
+        table.erase(slots[i]);
+    }
+    EXPECT_EQ(table.size(), 500);
+
+    for (int i = 0; i < 1000; i++) {
+        const uint32_t slot = find_key(table, "/file" + std::to_string(i));
+        if (i % 2 == 0) {
+            EXPECT_EQ(slot, NO_SLOT);
+        } else {
+            EXPECT_EQ(slot, slots[i]);
+        }
+    }
+
+    table.clear();
+    EXPECT_EQ(table.size(), 0);
+    EXPECT_EQ(find_key(table, "/file1"), NO_SLOT);
+}
+
+TEST(CacheTableTest, SlotListLinksEntries)
+{
+    CacheTable table;
+    SlotList list(table, 1);
+    const uint32_t a = insert_key(table, "a");
+    const uint32_t b = insert_key(table, "b");
+    const uint32_t c = insert_key(table, "c");
+
+    list.push_front(a);
+    list.push_front(b);
+    list.push_front(c);
+    EXPECT_EQ(list.size(), 3);
+    EXPECT_EQ(list.front(), c);
+    EXPECT_EQ(list.back(), a);
+
+    list.move_to_front(a);
+    EXPECT_EQ(list.front(), a);
+    EXPECT_EQ(list.back(), b);
+
+    list.unlink(c);
+    EXPECT_FALSE(list.contains(c));
+    EXPECT_TRUE(list.contains(b));
+    EXPECT_EQ(table.entry(a).next, b);
+    EXPECT_EQ(table.entry(b).prev, a);
+
+    list.unlink(a);
+    list.unlink(b);
+    EXPECT_TRUE(list.empty());
+    EXPECT_EQ(list.back(), NO_SLOT);
+}
+
+} // namespace test
+} // namespace server
+} // namespace fenris
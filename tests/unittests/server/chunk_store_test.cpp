@@ -0,0 +1,273 @@
+#include "common/logging.hpp"
+#include "server/chunk_store.hpp"
+
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace fenris {
+namespace server {
+namespace test {
+
+namespace fs = std::filesystem;
+
+class ChunkStoreTest : public ::testing::Test {
+  protected:
+    void SetUp() override
+    {
+        fs::remove_all(test_dir);
+        common::LoggingConfig log_config;
+        log_config.level = common::LogLevel::DEBUG;
+        log_config.console_logging = true;
+        log_config.file_logging = false;
+
+        common::initialize_logging(log_config, "TestChunkStore");
+
+        config.min_chunk_size = 1024;
+        config.avg_chunk_size = 4096;
+        config.max_chunk_size = 16 * 1024;
+        config.min_file_size = 0;
+    }
+
+    void TearDown() override
+    {
+        fs::remove_all(test_dir);
+    }
+
+    std::unique_ptr<ChunkStore> open_store()
+    {
+        return std::make_unique<ChunkStore>(test_dir, config, "TestChunkStore");
+    }
+
+    static std::string random_bytes(size_t size, unsigned seed)
+    {
+        std::mt19937 rng(seed);
+        std::string data(size, '\0');
+        for (auto &c : data) {
+            c = static_cast<char>(rng());
+        }
+        return data;
+    }
+
+    static std::span<const uint8_t> bytes(const std::string &data)
+    {
+        return {reinterpret_cast<const uint8_t *>(data.data()), data.size()};
+    }
+
+    // Files below the chunks directory
+    size_t chunk_files() const
+    {
+        size_t count = 0;
+        for (const auto &entry :
+             fs::recursive_directory_iterator(test_dir + "/chunks")) {
+            count += entry.is_regular_file() ? 1 : 0;
+        }
+        return count;
+    }
+
+    const std::string test_dir = "/tmp/fenris_chunk_store_test";
+    ChunkStoreConfig config;
+};
+
+TEST_F(ChunkStoreTest, ChunksStayWithinBoundsAndCoverData)
+{
+    const std::string data = random_bytes(256 * 1024, 1);
+    auto lengths = chunk_lengths(bytes(data), config);
+
+    ASSERT_GT(lengths.size(), 1);
+    EXPECT_EQ(std::accumulate(lengths.begin(), lengths.end(), size_t{0}),
+              data.size());
+    for (size_t i = 0; i + 1 < lengths.size(); ++i) {
+        EXPECT_GE(lengths[i], config.min_chunk_size);
+        EXPECT_LE(lengths[i], config.max_chunk_size);
+    }
+}
+
+TEST_F(ChunkStoreTest, CutsRealignAfterAnInsert)
+{
+    const std::string data = random_bytes(256 * 1024, 2);
+    const std::string edited = "a few inserted bytes" + data;
+
+    auto cut = [&](const std::string &content) {
+        std::vector<std::string> chunks;
+        size_t offset = 0;
+        for (size_t length : chunk_lengths(bytes(content), config)) {
+            chunks.push_back(content.substr(offset, length));
+            offset += length;
+        }
+        return chunks;
+    };
+    auto before = cut(data);
+    auto after = cut(edited);
+
+    // Everything past the first chunk or two is cut the same way again
+    size_t shared = 0;
+    for (const auto &chunk : after) {
+        shared += std::find(before.begin(), before.end(), chunk) !=
+                          before.end()
+                      ? 1
+                      : 0;
+    }
+    EXPECT_GE(shared + 2, before.size());
+}
+
+TEST_F(ChunkStoreTest, IdenticalFilesShareChunks)
+{
+    auto store = open_store();
+    ASSERT_TRUE(store->is_open());
+
+    const std::string data = random_bytes(100 * 1024, 3);
+    ASSERT_EQ(store->put("/a.bin", bytes(data), 1),
+              common::FileOperationResult::SUCCESS);
+    const ChunkStoreStats one = store->get_stats();
+
+    ASSERT_EQ(store->put("/copies/b.bin", bytes(data), 2),
+              common::FileOperationResult::SUCCESS);
+    const ChunkStoreStats two = store->get_stats();
+
+    EXPECT_EQ(two.files, 2);
+    EXPECT_EQ(two.chunks, one.chunks);
+    EXPECT_EQ(two.stored_bytes, data.size());
+    EXPECT_EQ(two.logical_bytes, 2 * data.size());
+    EXPECT_EQ(chunk_files(), one.chunks);
+}
+
+TEST_F(ChunkStoreTest, ReadsContentAndRanges)
+{
+    auto store = open_store();
+    const std::string data = random_bytes(100 * 1024, 4);
+    ASSERT_EQ(store->put("/a.bin", bytes(data), 7),
+              common::FileOperationResult::SUCCESS);
+
+    auto manifest = store->find("/a.bin", data.size(), 7);
+    ASSERT_TRUE(manifest.has_value());
+    EXPECT_GT(manifest->chunks_size(), 1);
+
+    auto [content, result] = store->read(*manifest);
+    ASSERT_EQ(result, common::FileOperationResult::SUCCESS);
+    EXPECT_EQ(content.view(), data);
+
+    // Ranges inside one chunk, across chunks and past the end
+    for (auto [offset, length] : std::vector<std::pair<size_t, size_t>>{
+             {0, 10}, {3000, 20000}, {data.size() - 5, 100}}) {
+        auto [range, range_result] =
+            store->read_range(*manifest, offset, length);
+        ASSERT_EQ(range_result, common::FileOperationResult::SUCCESS);
+        EXPECT_EQ(range.view(), data.substr(offset, length));
+    }
+    auto [past_end, past_result] =
+        store->read_range(*manifest, data.size(), 10);
+    EXPECT_EQ(past_result, common::FileOperationResult::SUCCESS);
+    EXPECT_TRUE(past_end.empty());
+}
+
+TEST_F(ChunkStoreTest, FindRejectsChangedPlaceholder)
+{
+    auto store = open_store();
+    const std::string data = random_bytes(10 * 1024, 5);
+    ASSERT_EQ(store->put("/a.bin", bytes(data), 7),
+              common::FileOperationResult::SUCCESS);
+
+    EXPECT_TRUE(store->find("/a.bin", data.size(), 7).has_value());
+    EXPECT_FALSE(store->find("/a.bin", data.size(), 8).has_value());
+    EXPECT_FALSE(store->find("/a.bin", data.size() + 1, 7).has_value());
+    EXPECT_FALSE(store->find("/b.bin", data.size(), 7).has_value());
+}
+
+TEST_F(ChunkStoreTest, ReleasedChunksAreDeleted)
+{
+    auto store = open_store();
+    const std::string shared = random_bytes(64 * 1024, 6);
+    const std::string other = random_bytes(64 * 1024, 7);
+    ASSERT_EQ(store->put("/a.bin", bytes(shared), 1),
+              common::FileOperationResult::SUCCESS);
+    ASSERT_EQ(store->put("/b.bin", bytes(shared), 1),
+              common::FileOperationResult::SUCCESS);
+    const size_t shared_chunks = store->get_stats().chunks;
+
+    // Overwriting a releases nothing b still uses
+    ASSERT_EQ(store->put("/a.bin", bytes(other), 2),
+              common::FileOperationResult::SUCCESS);
+    auto manifest = store->find("/b.bin", shared.size(), 1);
+    ASSERT_TRUE(manifest.has_value());
+    EXPECT_EQ(store->read(*manifest).first.view(), shared);
+
+    EXPECT_TRUE(store->remove("/b.bin"));
+    EXPECT_FALSE(store->remove("/b.bin"));
+    EXPECT_EQ(store->get_stats().files, 1);
+    EXPECT_LT(store->get_stats().chunks, shared_chunks + 1);
+    EXPECT_EQ(store->get_stats().stored_bytes, other.size());
+    EXPECT_EQ(chunk_files(), store->get_stats().chunks);
+}
+
+TEST_F(ChunkStoreTest, RemovePrefixDropsOnlyFilesBelow)
+{
+    auto store = open_store();
+    const std::string data = random_bytes(8 * 1024, 8);
+    for (const char *path : {"/dir/a", "/dir/sub/b", "/dir2/c", "/dir"}) {
+        ASSERT_EQ(store->put(path, bytes(data), 1),
+                  common::FileOperationResult::SUCCESS);
+    }
+
+    store->remove_prefix("/dir");
+
+    EXPECT_FALSE(store->find("/dir/a", data.size(), 1).has_value());
+    EXPECT_FALSE(store->find("/dir/sub/b", data.size(), 1).has_value());
+    EXPECT_TRUE(store->find("/dir2/c", data.size(), 1).has_value());
+    EXPECT_TRUE(store->find("/dir", data.size(), 1).has_value());
+}
+
+TEST_F(ChunkStoreTest, ReopenRebuildsReferencesAndDropsOrphans)
+{
+    const std::string data = random_bytes(64 * 1024, 9);
+    size_t chunks = 0;
+    {
+        auto store = open_store();
+        ASSERT_EQ(store->put("/a.bin", bytes(data), 3),
+                  common::FileOperationResult::SUCCESS);
+        chunks = store->get_stats().chunks;
+    }
+    fs::create_directories(test_dir + "/chunks/00");
+    std::ofstream(test_dir + "/chunks/00/orphan") << "left by a crash";
+
+    auto store = open_store();
+    const ChunkStoreStats stats = store->get_stats();
+    EXPECT_EQ(stats.files, 1);
+    EXPECT_EQ(stats.chunks, chunks);
+    EXPECT_EQ(stats.logical_bytes, data.size());
+    EXPECT_EQ(chunk_files(), chunks);
+
+    auto manifest = store->find("/a.bin", data.size(), 3);
+    ASSERT_TRUE(manifest.has_value());
+    EXPECT_EQ(store->read(*manifest).first.view(), data);
+}
+
+TEST_F(ChunkStoreTest, CacheHoldsSharedChunksOnce)
+{
+    auto store = open_store();
+    const std::string data = random_bytes(32 * 1024, 10);
+    ASSERT_EQ(store->put("/a.bin", bytes(data), 1),
+              common::FileOperationResult::SUCCESS);
+    ASSERT_EQ(store->put("/b.bin", bytes(data), 1),
+              common::FileOperationResult::SUCCESS);
+
+    auto a = store->find("/a.bin", data.size(), 1);
+    auto b = store->find("/b.bin", data.size(), 1);
+    ASSERT_TRUE(a.has_value() && b.has_value());
+    store->read(*a);
+    const CacheStats cold = store->get_cache_stats();
+    store->read(*b);
+    const CacheStats warm = store->get_cache_stats();
+
+    // Reading the second path only hits chunks the first one loaded
+    EXPECT_EQ(cold.misses, static_cast<uint64_t>(a->chunks_size()));
+    EXPECT_EQ(warm.misses, cold.misses);
+    EXPECT_EQ(warm.hits - cold.hits, static_cast<uint64_t>(b->chunks_size()));
+}
+
+} // namespace test
+} // namespace server
+} // namespace fenris
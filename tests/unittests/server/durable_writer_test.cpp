@@ -0,0 +1,145 @@
+#include "common/file_operations.hpp"
+#include "common/logging.hpp"
+#include "server/durable_writer.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fenris {
+namespace server {
+namespace test {
+
+namespace fs = std::filesystem;
+
+using common::FileOperationResult;
+
+class DurableWriterTest : public ::testing::Test {
+  protected:
+    void SetUp() override
+    {
+        fs::remove_all(test_dir);
+        fs::create_directories(test_dir + "/sub");
+        common::LoggingConfig log_config;
+        log_config.level = common::LogLevel::DEBUG;
+        log_config.console_logging = true;
+        log_config.file_logging = false;
+
+        common::initialize_logging(log_config, "TestDurableWriter");
+    }
+
+    void TearDown() override
+    {
+        fs::remove_all(test_dir);
+    }
+
+    // Number of entries in a directory, temporary files included
+    static size_t count_entries(const std::string &directory)
+    {
+        size_t count = 0;
+        for ([[maybe_unused]] const auto &entry :
+             fs::directory_iterator(directory)) {
+            ++count;
+        }
+        return count;
+    }
+
+    const std::string test_dir = "/tmp/fenris_durable_writer_test";
+};
+
+TEST_F(DurableWriterTest, WritesReplaceFilesAtomically)
+{
+    DurableWriter writer(DurableWriteConfig{}, "TestDurableWriter");
+    const std::string path = test_dir + "/sub/file.txt";
+
+    ASSERT_EQ(writer.write_file(path, "first version"),
+              FileOperationResult::SUCCESS);
+    EXPECT_EQ(common::read_file(path).first, "first version");
+
+    // The replacement keeps the permissions and leaves no temporary behind
+    fs::permissions(path, fs::perms::owner_read | fs::perms::owner_write);
+    ASSERT_EQ(writer.write_file(path, "second"), FileOperationResult::SUCCESS);
+    EXPECT_EQ(common::read_file(path).first, "second");
+    EXPECT_EQ(fs::status(path).permissions(),
+              fs::perms::owner_read | fs::perms::owner_write);
+    EXPECT_EQ(count_entries(test_dir + "/sub"), 1);
+
+    ASSERT_EQ(writer.append_file(path, " and more"),
+              FileOperationResult::SUCCESS);
+    EXPECT_EQ(common::read_file(path).first, "second and more");
+
+    DurableWriteStats stats = writer.get_stats();
+    EXPECT_EQ(stats.writes, 3);
+    EXPECT_EQ(stats.batches, 3);
+    // Appends change no directory entry
+    EXPECT_EQ(stats.directory_syncs, 2);
+}
+
+TEST_F(DurableWriterTest, ErrorsMatchFileOperations)
+{
+    DurableWriter writer(DurableWriteConfig{}, "TestDurableWriter");
+
+    EXPECT_EQ(writer.append_file(test_dir + "/missing.txt", "x"),
+              FileOperationResult::FILE_NOT_FOUND);
+    EXPECT_EQ(writer.write_file(test_dir + "/sub", "x"),
+              FileOperationResult::INVALID_PATH);
+    EXPECT_EQ(writer.write_file(test_dir + "/missing/file.txt", "x"),
+              FileOperationResult::FILE_NOT_FOUND);
+
+    const std::string read_only = test_dir + "/read_only.txt";
+    common::write_file(read_only, "keep");
+    fs::permissions(read_only, fs::perms::owner_read);
+    EXPECT_EQ(writer.write_file(read_only, "x"),
+              FileOperationResult::PERMISSION_DENIED);
+    EXPECT_EQ(writer.append_file(read_only, "x"),
+              FileOperationResult::PERMISSION_DENIED);
+    EXPECT_EQ(common::read_file(read_only).first, "keep");
+
+    EXPECT_EQ(writer.get_stats().writes, 0);
+}
+
+TEST_F(DurableWriterTest, ConcurrentWritersShareBatches)
+{
+    DurableWriteConfig config;
+    config.commit_window = std::chrono::milliseconds(50);
+    config.max_batch = 4;
+    DurableWriter writer(config, "TestDurableWriter");
+
+    constexpr int WRITERS = 8;
+    std::vector<FileOperationResult> results(WRITERS);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < WRITERS; ++i) {
+        threads.emplace_back([&, i]() {
+            results[i] = writer.write_file(
+                test_dir + "/file" + std::to_string(i) + ".txt",
+                "content " + std::to_string(i));
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    for (int i = 0; i < WRITERS; ++i) {
+        EXPECT_EQ(results[i], FileOperationResult::SUCCESS);
+        EXPECT_EQ(common::read_file(test_dir + "/file" + std::to_string(i) +
+                                    ".txt")
+                      .first,
+                  "content " + std::to_string(i));
+    }
+
+    // Full batches are flushed early, and every batch syncs the directory
+    // once no matter how many files it renamed into it
+    DurableWriteStats stats = writer.get_stats();
+    EXPECT_EQ(stats.writes, WRITERS);
+    EXPECT_GE(stats.batches, 2);
+    EXPECT_LT(stats.batches, WRITERS);
+    EXPECT_EQ(stats.directory_syncs, stats.batches);
+    EXPECT_EQ(count_entries(test_dir), WRITERS + 1);
+}
+
+} // namespace test
+} // namespace server
+} // namespace fenris
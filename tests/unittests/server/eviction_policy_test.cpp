@@ -0,0 +1,192 @@
+#include "server/cache_table.hpp"
+#include "server/eviction_policy.hpp"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fenris {
+namespace server {
+namespace test {
+
+// Table with a policy on top, driven like a cache holding capacity keys
+class PolicyHarness {
+  public:
+    PolicyHarness(EvictionPolicyType type, size_t capacity)
+        : m_capacity(capacity),
+          m_policy(make_eviction_policy(type, m_table, capacity))
+    {
+    }
+
+    // Look a key up, caching it on a miss; returns true on a hit
+    bool access(const std::string &key)
+    {
+        const uint64_t hash = CacheTable::hash_key(key);
+        const uint32_t slot = m_table.find(key, hash);
+        if (slot != NO_SLOT) {
+            m_policy->record_hit(slot);
+            return true;
+        }
+
+        m_policy->record_miss(hash);
+        if (m_table.size() >= m_capacity) {
+            const uint32_t victim = m_policy->victim();
+            if (!m_policy->admit(hash, victim)) {
+                return false;
+            }
+            m_policy->remove(victim, true);
+            m_table.erase(victim);
+        }
+        m_policy->insert(m_table.insert(key, hash, CachedFile()));
+        return false;
+    }
+
+    // Key of the next victim, empty if there is none
+    std::string victim() const
+    {
+        const uint32_t slot = m_policy->victim();
+        return slot == NO_SLOT ? "" : m_table.entry(slot).key;
+    }
+
+    void evict()
+    {
+        const uint32_t slot = m_policy->victim();
+        m_policy->remove(slot, true);
+        m_table.erase(slot);
+    }
+
+    void invalidate(const std::string &key)
+    {
+        const uint32_t slot = m_table.find(key, CacheTable::hash_key(key));
+        m_policy->remove(slot, false);
+        m_table.erase(slot);
+    }
+
+    size_t replay(const std::vector<std::string> &trace)
+    {
+        size_t hits = 0;
+        for (const auto &key : trace) {
+            hits += access(key) ? 1 : 0;
+        }
+        return hits;
+    }
+
+  private:
+    CacheTable m_table;
+    size_t m_capacity;
+    std::unique_ptr<EvictionPolicy> m_policy;
+};
+
+// Hot keys read twice, a long one-pass scan, then the hot keys again
+std::vector<std::string> scan_trace()
+{
+    std::vector<std::string> trace;
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < 3; i++) {
+            trace.push_back("hot" + std::to_string(i));
+        }
+    }
+    for (int i = 0; i < 20; i++) {
+        trace.push_back("scan" + std::to_string(i));
+    }
+    for (int i = 0; i < 3; i++) {
+        trace.push_back("hot" + std::to_string(i));
+    }
+    return trace;
+}
+
+TEST(EvictionPolicyTest, LruEvictsLeastRecent)
+{
+    PolicyHarness lru(EvictionPolicyType::LRU, 8);
+    EXPECT_EQ(lru.victim(), "");
+
+    lru.access("a");
+    lru.access("b");
+    lru.access("c");
+    EXPECT_TRUE(lru.access("a"));
+    EXPECT_EQ(lru.victim(), "b");
+
+    lru.evict();
+    EXPECT_EQ(lru.victim(), "c");
+    lru.invalidate("c");
+    EXPECT_EQ(lru.victim(), "a");
+}
+
+TEST(EvictionPolicyTest, SketchCountsAndAges)
+{
+    const uint64_t hot = CacheTable::hash_key("hot");
+    FrequencySketch sketch(16);
+    EXPECT_EQ(sketch.estimate(hot), 0);
+
+    for (int i = 0; i < 12; i++) {
+        sketch.increment(hot);
+    }
+    EXPECT_GE(sketch.estimate(hot), 12);
+
+    // Counters saturate at 4 bits
+    for (int i = 0; i < 12; i++) {
+        sketch.increment(hot);
+    }
+    EXPECT_EQ(sketch.estimate(hot), 15);
+
+    // A full sample of other keys halves every counter
+    for (int i = 0; i < 2560; i++) {
+        sketch.increment(CacheTable::hash_key("other" + std::to_string(i)));
+    }
+    EXPECT_LT(sketch.estimate(hot), 15);
+}
+
+TEST(EvictionPolicyTest, TinyLfuAdmitsOnlyMoreFrequentKeys)
+{
+    PolicyHarness tiny_lfu(EvictionPolicyType::TINY_LFU, 1);
+    tiny_lfu.access("resident");
+    EXPECT_TRUE(tiny_lfu.access("resident"));
+
+    // Seen once and twice, the twice-read resident wins both times
+    EXPECT_FALSE(tiny_lfu.access("newcomer"));
+    EXPECT_EQ(tiny_lfu.victim(), "resident");
+    EXPECT_FALSE(tiny_lfu.access("newcomer"));
+    EXPECT_EQ(tiny_lfu.victim(), "resident");
+
+    // The third request outweighs the resident
+    EXPECT_FALSE(tiny_lfu.access("newcomer"));
+    EXPECT_EQ(tiny_lfu.victim(), "newcomer");
+}
+
+TEST(EvictionPolicyTest, ArcAdaptsToGhostHits)
+{
+    PolicyHarness arc(EvictionPolicyType::ARC, 3);
+    arc.access("a");
+    arc.access("b");
+    arc.access("c");
+
+    // A second use moves a to T2, keys seen once go first
+    EXPECT_TRUE(arc.access("a"));
+    ASSERT_EQ(arc.victim(), "b");
+    arc.evict();
+    EXPECT_EQ(arc.victim(), "c");
+
+    // b returns from the B1 ghost list, so T1 was too small and gets to keep
+    // its last key
+    EXPECT_FALSE(arc.access("b"));
+    EXPECT_EQ(arc.victim(), "a");
+}
+
+TEST(EvictionPolicyTest, ScanResistance)
+{
+    const auto trace = scan_trace();
+
+    PolicyHarness lru(EvictionPolicyType::LRU, 4);
+    EXPECT_EQ(lru.replay(trace), 3);
+
+    PolicyHarness tiny_lfu(EvictionPolicyType::TINY_LFU, 4);
+    EXPECT_EQ(tiny_lfu.replay(trace), 6);
+
+    PolicyHarness arc(EvictionPolicyType::ARC, 4);
+    EXPECT_EQ(arc.replay(trace), 6);
+}
+
+} // namespace test
+} // namespace server
+} // namespace fenris
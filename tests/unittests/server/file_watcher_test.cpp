@@ -0,0 +1,122 @@
+#include "common/file_operations.hpp"
+#include "common/logging.hpp"
+#include "server/file_watcher.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fenris {
+namespace server {
+namespace test {
+
+namespace fs = std::filesystem;
+
+class FileWatcherTest : public ::testing::Test {
+  protected:
+    void SetUp() override
+    {
+        fs::remove_all(test_dir);
+        fs::create_directories(test_dir + "/sub");
+        common::LoggingConfig log_config;
+        log_config.level = common::LogLevel::DEBUG;
+        log_config.console_logging = true;
+        log_config.file_logging = false;
+
+        common::initialize_logging(log_config, "TestFileWatcher");
+        watcher = std::make_unique<FileWatcher>(
+            test_dir,
+            [this](const std::string &path, bool is_directory) {
+                std::lock_guard<std::mutex> lock(mutex);
+                events.emplace_back(path, is_directory);
+                cv.notify_all();
+            },
+            "TestFileWatcher");
+    }
+
+    void TearDown() override
+    {
+        watcher.reset();
+        fs::remove_all(test_dir);
+    }
+
+    // Wait until the given path has been reported
+    bool wait_for(const std::string &path, bool is_directory)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return cv.wait_for(lock, std::chrono::seconds(2), [&]() {
+            for (const auto &event : events) {
+                if (event.first == path && event.second == is_directory) {
+                    return true;
+                }
+            }
+            return false;
+        });
+    }
+
+    const std::string test_dir = "/tmp/fenris_file_watcher_test";
+
+    std::unique_ptr<FileWatcher> watcher;
+    std::vector<std::pair<std::string, bool>> events;
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+TEST_F(FileWatcherTest, ReportsChangedFiles)
+{
+    common::write_file(test_dir + "/a.txt", "before");
+    ASSERT_TRUE(watcher->start());
+    EXPECT_EQ(watcher->get_watch_count(), 2);
+
+    common::write_file(test_dir + "/a.txt", "after");
+    EXPECT_TRUE(wait_for(test_dir + "/a.txt", false));
+
+    common::write_file(test_dir + "/sub/b.txt", "nested");
+    EXPECT_TRUE(wait_for(test_dir + "/sub/b.txt", false));
+
+    common::delete_file(test_dir + "/a.txt");
+    fs::rename(test_dir + "/sub/b.txt", test_dir + "/sub/c.txt");
+    EXPECT_TRUE(wait_for(test_dir + "/sub/c.txt", false));
+}
+
+TEST_F(FileWatcherTest, FollowsNewAndRenamedDirectories)
+{
+    ASSERT_TRUE(watcher->start());
+
+    fs::create_directory(test_dir + "/new");
+    EXPECT_TRUE(wait_for(test_dir + "/new", true));
+
+    // The new directory is watched as soon as it is reported
+    common::write_file(test_dir + "/new/file.txt", "data");
+    EXPECT_TRUE(wait_for(test_dir + "/new/file.txt", false));
+
+    fs::rename(test_dir + "/sub", test_dir + "/moved");
+    EXPECT_TRUE(wait_for(test_dir + "/sub", true));
+    EXPECT_TRUE(wait_for(test_dir + "/moved", true));
+
+    common::write_file(test_dir + "/moved/file.txt", "data");
+    EXPECT_TRUE(wait_for(test_dir + "/moved/file.txt", false));
+    EXPECT_EQ(watcher->get_watch_count(), 3);
+}
+
+TEST_F(FileWatcherTest, StartFailsForMissingRoot)
+{
+    FileWatcher missing(
+        test_dir + "/missing",
+        [](const std::string &, bool) {},
+        "TestFileWatcher");
+    EXPECT_FALSE(missing.start());
+    EXPECT_EQ(missing.get_watch_count(), 0);
+
+    // Stopping a watcher that never started is harmless
+    missing.stop();
+}
+
+} // namespace test
+} // namespace server
+} // namespace fenris
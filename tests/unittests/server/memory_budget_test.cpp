@@ -0,0 +1,96 @@
+#include "server/memory_budget.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <thread>
+#include <utility>
+
+namespace fenris {
+namespace server {
+namespace test {
+
+TEST(MemoryBudgetTest, LeasesAreGivenBack)
+{
+    MemoryBudget budget(1000);
+    {
+        auto lease = budget.try_acquire(600);
+        ASSERT_TRUE(lease.has_value());
+        EXPECT_EQ(lease->size(), 600u);
+        EXPECT_EQ(budget.in_use(), 600u);
+
+        MemoryBudget::Lease moved = std::move(*lease);
+        EXPECT_FALSE(*lease);
+        EXPECT_EQ(budget.in_use(), 600u);
+    }
+    EXPECT_EQ(budget.in_use(), 0u);
+    EXPECT_EQ(budget.get_stats().peak_bytes, 600u);
+}
+
+TEST(MemoryBudgetTest, TryAcquireRefusesWhatDoesNotFit)
+{
+    MemoryBudget budget(1000);
+    auto first = budget.try_acquire(700);
+    ASSERT_TRUE(first.has_value());
+
+    EXPECT_FALSE(budget.try_acquire(400).has_value());
+    EXPECT_EQ(budget.get_stats().waits, 1u);
+
+    first->release();
+    EXPECT_TRUE(budget.try_acquire(400).has_value());
+    EXPECT_EQ(budget.get_stats().leases, 2u);
+}
+
+TEST(MemoryBudgetTest, OversizedRequestGoesAlone)
+{
+    MemoryBudget budget(1000);
+    auto small = budget.try_acquire(10);
+    ASSERT_TRUE(small.has_value());
+    EXPECT_FALSE(budget.try_acquire(5000).has_value());
+
+    small->release();
+    auto large = budget.try_acquire(5000);
+    ASSERT_TRUE(large.has_value());
+    EXPECT_FALSE(budget.try_acquire(1).has_value());
+}
+
+TEST(MemoryBudgetTest, AcquireWaitsForRelease)
+{
+    MemoryBudget budget(1000);
+    auto held = budget.acquire(800);
+    ASSERT_TRUE(held.has_value());
+
+    std::atomic<bool> granted{false};
+    std::thread reader([&]() {
+        auto lease = budget.acquire(500);
+        EXPECT_TRUE(lease.has_value());
+        granted = true;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(granted);
+
+    held->release();
+    reader.join();
+    EXPECT_TRUE(granted);
+    EXPECT_EQ(budget.get_stats().waits, 1u);
+}
+
+TEST(MemoryBudgetTest, CloseWakesWaitingReaders)
+{
+    MemoryBudget budget(100);
+    auto held = budget.acquire(100);
+    ASSERT_TRUE(held.has_value());
+
+    std::thread reader([&]() { EXPECT_FALSE(budget.acquire(50).has_value()); });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    budget.close();
+    reader.join();
+
+    EXPECT_FALSE(budget.try_acquire(1).has_value());
+}
+
+} // namespace test
+} // namespace server
+} // namespace fenris
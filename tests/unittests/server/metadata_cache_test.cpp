@@ -0,0 +1,176 @@
+#include "common/file_operations.hpp"
+#include "common/logging.hpp"
+#include "server/metadata_cache.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+
+namespace fenris {
+namespace server {
+namespace test {
+
+namespace fs = std::filesystem;
+
+class MetadataCacheTest : public ::testing::Test {
+  protected:
+    void SetUp() override
+    {
+        fs::remove_all(test_dir);
+        fs::create_directories(test_dir + "/sub");
+        common::LoggingConfig log_config;
+        log_config.level = common::LogLevel::DEBUG;
+        log_config.console_logging = true;
+        log_config.file_logging = false;
+
+        common::initialize_logging(log_config, "TestMetadataCache");
+    }
+
+    void TearDown() override
+    {
+        fs::remove_all(test_dir);
+    }
+
+    static fenris::FileInfo make_info(uint64_t size)
+    {
+        fenris::FileInfo file_info;
+        file_info.set_size(size);
+        file_info.set_modified_time(1234);
+        return file_info;
+    }
+
+    static fenris::DirectoryListing make_listing(const std::string &name)
+    {
+        fenris::DirectoryListing listing;
+        listing.add_entries()->set_name(name);
+        return listing;
+    }
+
+    // Cache "/sub", "/sub/a.txt" and a listing page of "/" and "/sub"
+    static void fill(MetadataCache &cache)
+    {
+        const uint64_t generation = cache.generation();
+        cache.put_file_info("/sub", make_info(0), generation);
+        cache.put_file_info("/sub/a.txt", make_info(1), generation);
+        cache.put_listing("/", "0", make_listing("sub"), generation);
+        cache.put_listing("/sub", "0", make_listing("a.txt"), generation);
+    }
+
+    const std::string test_dir = "/tmp/fenris_metadata_cache_test";
+};
+
+TEST_F(MetadataCacheTest, EntriesExpireAfterTtl)
+{
+    MetadataCacheConfig config;
+    config.ttl = std::chrono::milliseconds(50);
+    MetadataCache cache(config, "TestMetadataCache");
+
+    EXPECT_FALSE(cache.get_file_info("/a.txt").has_value());
+    cache.put_file_info("/a.txt", make_info(42), cache.generation());
+    cache.put_listing("/", "0", make_listing("a.txt"), cache.generation());
+
+    auto bytes = cache.get_file_info("/a.txt");
+    ASSERT_TRUE(bytes.has_value());
+    fenris::FileInfo file_info;
+    ASSERT_TRUE(file_info.ParseFromString(*bytes));
+    EXPECT_EQ(file_info.size(), 42);
+
+    auto listing_bytes = cache.get_listing("/", "0");
+    ASSERT_TRUE(listing_bytes.has_value());
+    fenris::DirectoryListing listing;
+    ASSERT_TRUE(listing.ParseFromString(*listing_bytes));
+    ASSERT_EQ(listing.entries_size(), 1);
+    EXPECT_EQ(listing.entries(0).name(), "a.txt");
+    EXPECT_FALSE(cache.get_listing("/", "other page").has_value());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(80));
+    EXPECT_FALSE(cache.get_file_info("/a.txt").has_value());
+    EXPECT_FALSE(cache.get_listing("/", "0").has_value());
+    EXPECT_EQ(cache.get_entry_count(), 0);
+
+    MetadataCacheStats stats = cache.get_stats();
+    EXPECT_EQ(stats.hits, 2);
+    EXPECT_EQ(stats.misses, 4);
+    EXPECT_EQ(stats.expirations, 2);
+}
+
+TEST_F(MetadataCacheTest, InvalidationDropsOnlyAffectedEntries)
+{
+    MetadataCache cache(MetadataCacheConfig{}, "TestMetadataCache");
+
+    // A changed file leaves its parent's info and other listings alone
+    fill(cache);
+    cache.invalidate("/sub/a.txt");
+    EXPECT_FALSE(cache.get_file_info("/sub/a.txt").has_value());
+    EXPECT_FALSE(cache.get_listing("/sub", "0").has_value());
+    EXPECT_TRUE(cache.get_file_info("/sub").has_value());
+    EXPECT_TRUE(cache.get_listing("/", "0").has_value());
+
+    // A new or removed entry changes the parent directory as well
+    cache.clear();
+    fill(cache);
+    cache.invalidate_entry("/sub/b.txt");
+    EXPECT_TRUE(cache.get_file_info("/sub/a.txt").has_value());
+    EXPECT_FALSE(cache.get_listing("/sub", "0").has_value());
+    EXPECT_FALSE(cache.get_file_info("/sub").has_value());
+    EXPECT_TRUE(cache.get_listing("/", "0").has_value());
+
+    // A removed directory takes everything below it along
+    cache.clear();
+    fill(cache);
+    cache.put_file_info("/subdir.txt", make_info(2), cache.generation());
+    cache.invalidate_prefix("/sub");
+    EXPECT_FALSE(cache.get_file_info("/sub").has_value());
+    EXPECT_FALSE(cache.get_file_info("/sub/a.txt").has_value());
+    EXPECT_FALSE(cache.get_listing("/sub", "0").has_value());
+    EXPECT_FALSE(cache.get_listing("/", "0").has_value());
+    EXPECT_TRUE(cache.get_file_info("/subdir.txt").has_value());
+    EXPECT_EQ(cache.get_entry_count(), 1);
+}
+
+TEST_F(MetadataCacheTest, StaleFillsAreDropped)
+{
+    MetadataCacheConfig config;
+    config.max_entries = 2;
+    MetadataCache cache(config, "TestMetadataCache");
+
+    // Read before an invalidation, stored after it
+    const uint64_t generation = cache.generation();
+    cache.invalidate("/a.txt");
+    cache.put_file_info("/a.txt", make_info(1), generation);
+    EXPECT_FALSE(cache.get_file_info("/a.txt").has_value());
+
+    // Full caches keep what they have
+    fill(cache);
+    EXPECT_EQ(cache.get_entry_count(), 2);
+    EXPECT_TRUE(cache.get_file_info("/sub").has_value());
+    EXPECT_FALSE(cache.get_listing("/", "0").has_value());
+}
+
+TEST_F(MetadataCacheTest, WatcherInvalidatesExternalChanges)
+{
+    MetadataCache cache(MetadataCacheConfig{}, "TestMetadataCache");
+    ASSERT_TRUE(cache.watch(test_dir + "/"));
+    fill(cache);
+
+    common::write_file(test_dir + "/sub/a.txt", "changed");
+
+    bool invalidated = false;
+    for (int i = 0; i < 100 && !invalidated; ++i) {
+        invalidated = !cache.get_file_info("/sub/a.txt").has_value();
+        if (!invalidated) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    EXPECT_TRUE(invalidated);
+    EXPECT_FALSE(cache.get_listing("/sub", "0").has_value());
+    EXPECT_TRUE(cache.get_listing("/", "0").has_value());
+
+    cache.stop_watching();
+}
+
+} // namespace test
+} // namespace server
+} // namespace fenris
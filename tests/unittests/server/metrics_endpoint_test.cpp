@@ -0,0 +1,99 @@
+#include "server/metrics_endpoint.hpp"
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace fenris {
+namespace server {
+namespace test {
+
+class MetricsEndpointTest : public ::testing::Test {
+  protected:
+    void SetUp() override
+    {
+        common::LoggingConfig log_config;
+        log_config.level = common::LogLevel::WARN;
+        log_config.console_logging = true;
+        log_config.file_logging = false;
+        common::initialize_logging(log_config, "MetricsEndpointTest");
+    }
+
+    // Send a raw request and return everything the endpoint answered
+    static std::string fetch(uint16_t port, const std::string &request)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        if (connect(fd, reinterpret_cast<sockaddr *>(&address),
+                    sizeof(address)) != 0) {
+            close(fd);
+            return "";
+        }
+        send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+
+        std::string response;
+        char chunk[4096];
+        ssize_t received;
+        while ((received = recv(fd, chunk, sizeof(chunk), 0)) > 0) {
+            response.append(chunk, static_cast<size_t>(received));
+        }
+        close(fd);
+        return response;
+    }
+
+    common::MetricsRegistry m_registry;
+};
+
+TEST_F(MetricsEndpointTest, ServesTheRegistry)
+{
+    m_registry.counter("fenris_test_total", "Test counter").add(7);
+
+    MetricsEndpoint endpoint(
+        "127.0.0.1", "0", m_registry, "MetricsEndpointTest");
+    ASSERT_TRUE(endpoint.start());
+    ASSERT_NE(endpoint.port(), 0);
+
+    const std::string response =
+        fetch(endpoint.port(), "GET /metrics HTTP/1.1\r\nHost: x\r\n\r\n");
+    EXPECT_EQ(response.rfind("HTTP/1.1 200 OK\r\n", 0), 0u) << response;
+    EXPECT_NE(response.find("text/plain; version=0.0.4"), std::string::npos);
+    EXPECT_NE(response.find("\r\n\r\n# HELP fenris_test_total Test counter\n"),
+              std::string::npos)
+        << response;
+    EXPECT_NE(response.find("fenris_test_total 7\n"), std::string::npos);
+
+    endpoint.stop();
+    EXPECT_FALSE(endpoint.is_running());
+}
+
+TEST_F(MetricsEndpointTest, RefusesOtherRequests)
+{
+    MetricsEndpoint endpoint(
+        "127.0.0.1", "0", m_registry, "MetricsEndpointTest");
+    ASSERT_TRUE(endpoint.start());
+
+    EXPECT_EQ(fetch(endpoint.port(), "GET / HTTP/1.1\r\n\r\n")
+                  .rfind("HTTP/1.1 404", 0),
+              0u);
+    EXPECT_EQ(fetch(endpoint.port(), "POST /metrics HTTP/1.1\r\n\r\n")
+                  .rfind("HTTP/1.1 405", 0),
+              0u);
+    EXPECT_EQ(fetch(endpoint.port(), "nonsense\r\n\r\n")
+                  .rfind("HTTP/1.1 400", 0),
+              0u);
+
+    // Still answering after the refusals
+    EXPECT_EQ(fetch(endpoint.port(), "GET /metrics?x=1 HTTP/1.0\r\n\r\n")
+                  .rfind("HTTP/1.1 200", 0),
+              0u);
+}
+
+} // namespace test
+} // namespace server
+} // namespace fenris
@@ -0,0 +1,116 @@
+#include "server/rate_limiter.hpp"
+
+#include <chrono>
+#include <gtest/gtest.h>
+
+namespace fenris {
+namespace server {
+namespace test {
+
+using namespace std::chrono_literals;
+
+TEST(RateLimiterTest, BucketGoesIntoDebtAndRefills)
+{
+    const auto start = TokenBucket::Clock::now();
+    TokenBucket bucket(100, 100);
+
+    bucket.take(50, start);
+    EXPECT_EQ(bucket.ready_at(start), start);
+
+    // 100 tokens short at 100 per second
+    bucket.take(150, start);
+    EXPECT_EQ(bucket.ready_at(start), start + 1s);
+    EXPECT_EQ(bucket.ready_at(start + 2s), start + 2s);
+}
+
+TEST(RateLimiterTest, UnlimitedBucketNeverRunsDry)
+{
+    const auto start = TokenBucket::Clock::now();
+    TokenBucket bucket(0, 0);
+    bucket.take(1e12, start);
+    EXPECT_EQ(bucket.ready_at(start), start);
+}
+
+TEST(RateLimiterTest, TenantBucketsAreShared)
+{
+    RateLimit per_client;
+    RateLimit per_tenant;
+    per_tenant.ops_per_second = 10;
+    RateLimiter limiter(per_client, per_tenant);
+
+    auto first = limiter.open(1, "10.0.0.1");
+    auto second = limiter.open(2, "10.0.0.1");
+    auto other = limiter.open(3, "10.0.0.2");
+    EXPECT_EQ(first->tenant(), "10.0.0.1");
+
+    // The burst of the tenant is spent by its two connections together
+    const auto before = ClientQuota::Clock::now();
+    first->charge(10, 0);
+    second->charge(10, 0);
+    EXPECT_GE(first->ready_at(), before + 900ms);
+    EXPECT_GE(second->ready_at(), before + 900ms);
+    const auto other_ready = other->ready_at();
+    EXPECT_LE(other_ready, ClientQuota::Clock::now());
+}
+
+TEST(RateLimiterTest, ClientLimitsCountBytes)
+{
+    RateLimit per_client;
+    per_client.bytes_per_second = 1000;
+    per_client.burst_seconds = 0.5;
+    RateLimiter limiter(per_client, RateLimit{});
+
+    auto quota = limiter.open(1, "10.0.0.1");
+    quota->charge(1, 400);
+    const auto ready = quota->ready_at();
+    EXPECT_LE(ready, ClientQuota::Clock::now());
+
+    // 500 bytes of burst, a request of 1500 leaves a debt of 1.4 seconds
+    quota->charge(1, 1500);
+    EXPECT_GT(quota->ready_at(), ClientQuota::Clock::now() + 1s);
+}
+
+TEST(RateLimiterTest, ThrottlingIsCountedPerClient)
+{
+    RateLimiter limiter(RateLimit{10, 0}, RateLimit{});
+    auto first = limiter.open(1, "10.0.0.1");
+    auto second = limiter.open(2, "10.0.0.1");
+
+    first->record_throttle(5ms);
+    first->record_throttle(10ms);
+
+    auto stats = limiter.get_stats();
+    ASSERT_EQ(stats.size(), 2u);
+    EXPECT_EQ(stats[1].throttles, 2u);
+    EXPECT_EQ(stats[1].throttled, 15ms);
+    EXPECT_EQ(stats[2].throttles, 0u);
+
+    // Closed connections drop out
+    second.reset();
+    EXPECT_EQ(limiter.get_stats().size(), 1u);
+}
+
+TEST(RateLimiterTest, ThrottlingIsCountedPerTenant)
+{
+    RateLimiter limiter(RateLimit{10, 0}, RateLimit{});
+    auto first = limiter.open(1, "10.0.0.1");
+    auto second = limiter.open(2, "10.0.0.1");
+    auto other = limiter.open(3, "10.0.0.2");
+
+    first->record_throttle(5ms);
+    second->record_throttle(10ms);
+
+    auto stats = limiter.get_tenant_stats();
+    ASSERT_EQ(stats.size(), 2u);
+    EXPECT_EQ(stats["10.0.0.1"].throttles, 2u);
+    EXPECT_EQ(stats["10.0.0.1"].throttled, 15ms);
+    EXPECT_EQ(stats["10.0.0.2"].throttles, 0u);
+
+    // Tenants without a connection drop out
+    other.reset();
+    EXPECT_EQ(limiter.get_tenant_stats().size(), 1u);
+}
+
+} // namespace test
+} // namespace server
+} // namespace fenris
@@ -0,0 +1,130 @@
+#include "server/readahead.hpp"
+
+#include <chrono>
+#include <gtest/gtest.h>
+
+namespace fenris {
+namespace server {
+namespace test {
+
+using namespace std::chrono_literals;
+
+constexpr uint64_t MB = 1024 * 1024;
+
+TEST(ReadaheadTest, InOrderReadsArePrefetched)
+{
+    ReadaheadTracker tracker;
+    auto now = ReadaheadTracker::Clock::now();
+
+    EXPECT_EQ(tracker.on_read(1, "/a", 0, MB, now).length, 0u);
+    now += 10ms;
+    // 1 MB in 10 ms covers the 500 ms lead with 50 MB
+    common::Prefetch prefetch = tracker.on_read(1, "/a", MB, MB, now);
+    EXPECT_EQ(prefetch.offset, 2 * MB);
+    EXPECT_EQ(prefetch.length, 50 * MB);
+
+    // Most of the window is still ahead
+    now += 10ms;
+    EXPECT_EQ(tracker.on_read(1, "/a", 2 * MB, MB, now).length, 0u);
+
+    ReadaheadStats stats = tracker.get_stats();
+    EXPECT_EQ(stats.sequential_reads, 2u);
+    EXPECT_EQ(stats.random_reads, 0u);
+    EXPECT_EQ(stats.prefetches, 1u);
+    EXPECT_EQ(stats.prefetched_bytes, 50 * MB);
+}
+
+TEST(ReadaheadTest, PrefetchesAgainOnceHalfTheWindowIsRead)
+{
+    ReadaheadConfig config;
+    config.max_window = 4 * MB;
+    ReadaheadTracker tracker(config);
+    auto now = ReadaheadTracker::Clock::now();
+
+    tracker.on_read(1, "/a", 0, MB, now);
+    common::Prefetch first = tracker.on_read(1, "/a", MB, MB, now + 1ms);
+    EXPECT_EQ(first.offset, 2 * MB);
+    EXPECT_EQ(first.length, 4 * MB);
+
+    EXPECT_EQ(tracker.on_read(1, "/a", 2 * MB, MB, now + 2ms).length, 0u);
+    EXPECT_EQ(tracker.on_read(1, "/a", 3 * MB, MB, now + 3ms).length, 0u);
+    // Less than half of the window is left, the next part starts where the
+    // last one ended
+    common::Prefetch next = tracker.on_read(1, "/a", 4 * MB, MB, now + 4ms);
+    EXPECT_EQ(next.offset, 6 * MB);
+    EXPECT_EQ(next.length, 3 * MB);
+}
+
+TEST(ReadaheadTest, SlowReadersGetTheSmallestWindow)
+{
+    ReadaheadTracker tracker;
+    auto now = ReadaheadTracker::Clock::now();
+
+    tracker.on_read(1, "/a", 0, 64 * 1024, now);
+    common::Prefetch prefetch =
+        tracker.on_read(1, "/a", 64 * 1024, 64 * 1024, now + 10s);
+    EXPECT_EQ(prefetch.length, MB);
+}
+
+TEST(ReadaheadTest, OutOfOrderPipelinedReadsContinueTheStream)
+{
+    ReadaheadTracker tracker;
+    auto now = ReadaheadTracker::Clock::now();
+
+    tracker.on_read(1, "/a", 0, MB, now);
+    // The fourth block finished before the second and third
+    tracker.on_read(1, "/a", 3 * MB, MB, now + 1ms);
+    tracker.on_read(1, "/a", MB, MB, now + 2ms);
+    tracker.on_read(1, "/a", 2 * MB, MB, now + 3ms);
+    EXPECT_EQ(tracker.get_stats().sequential_reads, 3u);
+    EXPECT_EQ(tracker.get_stats().random_reads, 0u);
+}
+
+TEST(ReadaheadTest, RandomReadsStartOver)
+{
+    ReadaheadTracker tracker;
+    auto now = ReadaheadTracker::Clock::now();
+
+    tracker.on_read(1, "/a", 0, MB, now);
+    EXPECT_NE(tracker.on_read(1, "/a", MB, MB, now + 1ms).length, 0u);
+    EXPECT_EQ(tracker.on_read(1, "/a", 900 * MB, MB, now + 2ms).length, 0u);
+    EXPECT_EQ(tracker.on_read(1, "/a", 5 * MB, MB, now + 3ms).length, 0u);
+    EXPECT_EQ(tracker.get_stats().random_reads, 2u);
+
+    // Other files and other clients are separate streams
+    tracker.on_read(2, "/a", 6 * MB, MB, now + 4ms);
+    tracker.on_read(1, "/b", 6 * MB, MB, now + 5ms);
+    EXPECT_EQ(tracker.get_stats().random_reads, 2u);
+    EXPECT_EQ(tracker.get_stats().sequential_reads, 1u);
+}
+
+TEST(ReadaheadTest, ForgottenClientsStartOver)
+{
+    ReadaheadTracker tracker;
+    auto now = ReadaheadTracker::Clock::now();
+
+    tracker.on_read(1, "/a", 0, MB, now);
+    tracker.on_read(2, "/a", 0, MB, now);
+    tracker.forget(1);
+    EXPECT_EQ(tracker.on_read(1, "/a", MB, MB, now + 1ms).length, 0u);
+    EXPECT_NE(tracker.on_read(2, "/a", MB, MB, now + 1ms).length, 0u);
+}
+
+TEST(ReadaheadTest, LeastRecentlyReadStreamIsEvicted)
+{
+    ReadaheadConfig config;
+    config.max_streams = 2;
+    ReadaheadTracker tracker(config);
+    auto now = ReadaheadTracker::Clock::now();
+
+    tracker.on_read(1, "/a", 0, MB, now);
+    tracker.on_read(1, "/b", 0, MB, now + 1ms);
+    tracker.on_read(1, "/c", 0, MB, now + 2ms);
+
+    EXPECT_EQ(tracker.on_read(1, "/a", MB, MB, now + 3ms).length, 0u);
+    EXPECT_NE(tracker.on_read(1, "/c", MB, MB, now + 4ms).length, 0u);
+}
+
+} // namespace test
+} // namespace server
+} // namespace fenris
@@ -1,7 +1,10 @@
+#include "common/chunked_aead.hpp"
 #include "common/crypto_manager.hpp"
+#include "common/handshake.hpp"
 #include "common/network_utils.hpp"
 #include "common/request.hpp"
 #include "common/response.hpp"
+#include "common/session_resumption.hpp"
 #include "fenris.pb.h"
 #include "server/connection_manager.hpp"
 #include "server/server.hpp"
@@ -10,9 +13,13 @@
 #include <chrono>
 #include <cstring>
 #include <fcntl.h>
+#include <filesystem>
+#include <future>
+#include <fstream>
 #include <google/protobuf/util/message_differencer.h>
 #include <gtest/gtest.h>
 #include <netinet/in.h>
+#include <set>
 #include <sys/socket.h>
 #include <thread>
 #include <unistd.h>
@@ -40,6 +47,13 @@ class MockClientHandler : public ClientHandler {
     handle_request(uint32_t client_socket,
                    const fenris::Request &request) override
     {
+        std::chrono::milliseconds delay;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            delay = m_delay;
+        }
+        std::this_thread::sleep_for(delay);
+
         std::lock_guard<std::mutex> lock(m_mutex);
         m_handled_client_sockets.push_back(client_socket);
         m_received_requests.push_back(request);
@@ -54,7 +68,8 @@ class MockClientHandler : public ClientHandler {
             break;
         case fenris::RequestType::READ_FILE:
             response.set_type(fenris::ResponseType::FILE_CONTENT);
-            response.set_data("READ_FILE");
+            response.set_data(m_read_data.empty() ? "READ_FILE"
+                                                  : m_read_data);
             break;
         case fenris::RequestType::WRITE_FILE:
             response.set_type(fenris::ResponseType::SUCCESS);
@@ -94,6 +109,49 @@ class MockClientHandler : public ClientHandler {
         return {response, should_keep_connection};
     }
 
+    std::optional<std::string>
+    stream_path(uint32_t client_socket,
+                const fenris::Request &request) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (request.command() != fenris::RequestType::READ_FILE ||
+            m_stream_path.empty()) {
+            return std::nullopt;
+        }
+        return m_stream_path;
+    }
+
+    void client_disconnected(uint32_t client_socket) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_disconnected_client_sockets.push_back(client_socket);
+    }
+
+    std::vector<uint32_t> get_disconnected_client_sockets()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_disconnected_client_sockets;
+    }
+
+    void set_stream_path(const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stream_path = path;
+    }
+
+    void set_read_data(const std::string &data)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_read_data = data;
+    }
+
+    // Time every request takes to handle
+    void set_delay(std::chrono::milliseconds delay)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_delay = delay;
+    }
+
     std::vector<uint32_t> get_handled_client_ids()
     {
         std::lock_guard<std::mutex> lock(m_mutex);
@@ -118,7 +176,11 @@ class MockClientHandler : public ClientHandler {
     int m_request_count;
     std::mutex m_mutex;
     std::vector<uint32_t> m_handled_client_sockets;
+    std::vector<uint32_t> m_disconnected_client_sockets;
     std::vector<fenris::Request> m_received_requests;
+    std::string m_stream_path;
+    std::string m_read_data;
+    std::chrono::milliseconds m_delay{0};
 };
 
 int create_and_connect_client_socket(const char *server_ip, int server_port)
@@ -145,7 +207,11 @@ int create_and_connect_client_socket(const char *server_ip, int server_port)
     return client_socket;
 }
 
-bool perform_client_key_exchange(int sock, std::vector<uint8_t> &shared_key)
+bool perform_client_key_exchange(int sock,
+                                 std::vector<uint8_t> &shared_key,
+                                 uint32_t requested_capabilities = 0,
+                                 uint32_t *accepted_capabilities = nullptr,
+                                 fenris::Handshake *reply = nullptr)
 {
     crypto::CryptoManager crypto_manager;
 
@@ -157,22 +223,43 @@ bool perform_client_key_exchange(int sock, std::vector<uint8_t> &shared_key)
         return false;
     }
 
-    NetworkResult send_result = send_prefixed_data(sock, public_key);
+    std::optional<fenris::Handshake> handshake;
+    if (requested_capabilities != 0) {
+        handshake.emplace();
+        handshake->set_capabilities(requested_capabilities);
+    }
+
+    NetworkResult send_result =
+        send_prefixed_data(sock, encode_key_exchange(public_key, handshake));
     if (send_result != NetworkResult::SUCCESS) {
         std::cerr << "Failed to send client public key: "
                   << network_result_to_string(send_result) << std::endl;
         return false;
     }
 
-    std::vector<uint8_t> server_public_key;
-    NetworkResult receive_result =
-        receive_prefixed_data(sock, server_public_key);
+    std::vector<uint8_t> server_frame;
+    NetworkResult receive_result = receive_prefixed_data(sock, server_frame);
     if (receive_result != NetworkResult::SUCCESS) {
         std::cerr << "Failed to receive server public key: "
                   << network_result_to_string(receive_result) << std::endl;
         return false;
     }
 
+    auto key_exchange = decode_key_exchange(server_frame);
+    if (!key_exchange.has_value()) {
+        std::cerr << "Failed to decode server handshake" << std::endl;
+        return false;
+    }
+    const std::vector<uint8_t> &server_public_key = key_exchange->public_key;
+    if (accepted_capabilities != nullptr) {
+        *accepted_capabilities = key_exchange->handshake.has_value()
+                                     ? key_exchange->handshake->capabilities()
+                                     : 0;
+    }
+    if (reply != nullptr && key_exchange->handshake.has_value()) {
+        *reply = *key_exchange->handshake;
+    }
+
     auto [shared_secret, ss_result] =
         crypto_manager.compute_ecdh_shared_secret(private_key,
                                                   server_public_key);
@@ -200,11 +287,22 @@ bool send_request(const ClientInfo &client_info, const fenris::Request &request)
     crypto::CryptoManager m_crypto_manager;
 
     std::vector<uint8_t> serialized_request = serialize_request(request);
+    if (client_info.compression) {
+        auto [frame, compress_result] =
+            client_info.compression->encode(serialized_request);
+        if (compress_result != compress::CompressionResult::SUCCESS) {
+            std::cerr << "failed to compress request" << std::endl;
+            return false;
+        }
+        serialized_request.assign(frame.begin(), frame.end());
+    }
 
-    // Generate a random IV
-    auto [iv, iv_gen_result] = m_crypto_manager.generate_random_iv();
+    // Generate a random IV, or take the next one in sequence
+    auto [iv, iv_gen_result] = client_info.send_nonces
+                                   ? client_info.send_nonces->next()
+                                   : m_crypto_manager.generate_random_iv();
     if (iv_gen_result != crypto::EncryptionResult::SUCCESS) {
-        std::cerr << "failed to generate random IV" << std::endl;
+        std::cerr << "failed to generate IV" << std::endl;
         return false;
     }
 
@@ -239,7 +337,9 @@ bool send_request(const ClientInfo &client_info, const fenris::Request &request)
     return true;
 }
 
-std::optional<fenris::Response> receive_response(const ClientInfo &client_info)
+std::optional<fenris::Response>
+receive_response(const ClientInfo &client_info,
+                 std::vector<uint8_t> *iv_out = nullptr)
 {
     crypto::CryptoManager m_crypto_manager;
 
@@ -264,6 +364,19 @@ std::optional<fenris::Response> receive_response(const ClientInfo &client_info)
                                                 crypto::AES_GCM_IV_SIZE,
                                             encrypted_data.end());
 
+    if (client_info.receive_nonces) {
+        if (client_info.receive_nonces->verify(iv) !=
+            crypto::EncryptionResult::SUCCESS) {
+            std::cerr << "response IV out of sequence" << std::endl;
+            return std::nullopt;
+        }
+        client_info.receive_nonces->accept(iv);
+    }
+
+    if (iv_out != nullptr) {
+        *iv_out = iv;
+    }
+
     // Decrypt the response using the extracted IV
     auto [decrypted_data, decrypt_result] =
         m_crypto_manager.decrypt_data(encrypted_response,
@@ -274,6 +387,15 @@ std::optional<fenris::Response> receive_response(const ClientInfo &client_info)
         return std::nullopt;
     }
 
+    if (client_info.compression) {
+        auto [message, decompress_result] = client_info.compression->decode(
+            Buffer::wrap(std::move(decrypted_data)));
+        if (decompress_result != compress::CompressionResult::SUCCESS) {
+            return std::nullopt;
+        }
+        return deserialize_response(message);
+    }
+
     // Deserialize the response
     return deserialize_response(decrypted_data);
 }
@@ -356,6 +478,41 @@ class ServerConnectionManagerTest : public ::testing::Test {
         return client_info;
     }
 
+    // Drain while one client waits for a slow request and another is idle
+    void check_drain_answers_requests_in_flight()
+    {
+        m_mock_handler_ptr->set_delay(std::chrono::milliseconds(300));
+        m_connection_manager->start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        ClientInfo idle = connect_test_client();
+        ClientInfo busy = connect_test_client();
+        ASSERT_GE(idle.socket, 0);
+        ASSERT_GE(busy.socket, 0);
+
+        fenris::Request ping_request;
+        ping_request.set_command(fenris::RequestType::PING);
+        ASSERT_TRUE(send_request(busy, ping_request));
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        auto drained = std::async(std::launch::async, [this] {
+            return m_connection_manager->drain(std::chrono::seconds(5));
+        });
+
+        // The request in flight is answered, then both connections close
+        auto response_opt = receive_response(busy);
+        ASSERT_TRUE(response_opt.has_value());
+        EXPECT_EQ(response_opt->data(), "PING");
+
+        char byte;
+        EXPECT_EQ(recv(idle.socket, &byte, 1, 0), 0);
+        EXPECT_EQ(recv(busy.socket, &byte, 1, 0), 0);
+
+        EXPECT_TRUE(drained.get());
+        EXPECT_FALSE(m_connection_manager->is_running());
+        EXPECT_EQ(m_connection_manager->get_active_client_count(), 0);
+    }
+
     std::unique_ptr<ConnectionManager> m_connection_manager;
     MockClientHandler *m_mock_handler_ptr = nullptr;
     int m_port;
@@ -520,6 +677,15 @@ TEST_F(ServerConnectionManagerTest, ClientDisconnection)
     }
     ASSERT_TRUE(disconnected) << "Server did not detect client disconnection";
     ASSERT_EQ(m_connection_manager->get_active_client_count(), 0);
+
+    // The handler hears of it without a TERMINATE
+    EXPECT_EQ(m_mock_handler_ptr->get_disconnected_client_sockets(),
+              m_mock_handler_ptr->get_handled_client_ids());
+}
+
+TEST_F(ServerConnectionManagerTest, DrainAnswersRequestsInFlight)
+{
+    check_drain_answers_requests_in_flight();
 }
 
 TEST_F(ServerConnectionManagerTest, HandleDifferentRequestTypes)
@@ -581,6 +747,1022 @@ TEST_F(ServerConnectionManagerTest, HandleDifferentRequestTypes)
               << terminate_response_opt->DebugString() << std::endl;
 }
 
+TEST_F(ServerConnectionManagerTest, StreamsReadFileWhenNegotiated)
+{
+    const std::string path = "/tmp/fenris_stream_test.bin";
+    std::string content(300 * 1024, '\0');
+    for (size_t i = 0; i < content.size(); ++i) {
+        content[i] = static_cast<char>(i % 253);
+    }
+    {
+        std::ofstream file(path, std::ios::binary);
+        file.write(content.data(), content.size());
+    }
+
+    m_mock_handler_ptr->set_stream_path(path);
+    m_connection_manager->set_plaintext_file_streaming(true);
+    m_connection_manager->start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    int sock = create_and_connect_client_socket("127.0.0.1", m_port);
+    ASSERT_GE(sock, 0);
+    m_client_sockets.push_back(sock);
+
+    ClientInfo client;
+    client.socket = sock;
+    uint32_t accepted = 0;
+    ASSERT_TRUE(perform_client_key_exchange(
+        sock,
+        client.encryption_key,
+        fenris::CAPABILITY_PLAINTEXT_FILE_STREAM,
+        &accepted));
+    EXPECT_TRUE(
+        has_capability(accepted, fenris::CAPABILITY_PLAINTEXT_FILE_STREAM));
+
+    fenris::Request read_request;
+    read_request.set_command(fenris::RequestType::READ_FILE);
+    read_request.set_filename("stream.bin");
+    ASSERT_TRUE(send_request(client, read_request));
+
+    // The encrypted response only announces the plain frame behind it
+    auto response_opt = receive_response(client);
+    ASSERT_TRUE(response_opt.has_value());
+    EXPECT_TRUE(response_opt->success());
+    EXPECT_EQ(response_opt->type(), fenris::ResponseType::FILE_CONTENT);
+    EXPECT_TRUE(response_opt->data().empty());
+    ASSERT_EQ(response_opt->stream_length(), content.size());
+
+    std::vector<uint8_t> streamed;
+    ASSERT_EQ(receive_prefixed_data(sock, streamed), NetworkResult::SUCCESS);
+    EXPECT_EQ(std::string(streamed.begin(), streamed.end()), content);
+
+    // The handler never saw the request, other requests still reach it
+    EXPECT_EQ(m_mock_handler_ptr->get_request_count(), 0);
+
+    fenris::Request ping_request;
+    ping_request.set_command(fenris::RequestType::PING);
+    ASSERT_TRUE(send_request(client, ping_request));
+    response_opt = receive_response(client);
+    ASSERT_TRUE(response_opt.has_value());
+    EXPECT_EQ(response_opt->data(), "PING");
+
+    std::filesystem::remove(path);
+}
+
+// Receive and open the chunks of a sealed stream of length bytes
+std::optional<std::string> receive_sealed_stream(const ClientInfo &client_info,
+                                                 const std::vector<uint8_t> &iv,
+                                                 size_t length,
+                                                 size_t *chunk_count)
+{
+    auto [stream_key, key_result] =
+        crypto::derive_stream_key(client_info.encryption_key, iv);
+    if (key_result != crypto::ECDHResult::SUCCESS) {
+        return std::nullopt;
+    }
+    const crypto::ChunkedAead aead(std::move(stream_key));
+
+    std::string content;
+    for (*chunk_count = 0; content.size() < length; ++*chunk_count) {
+        std::vector<uint8_t> chunk;
+        if (receive_prefixed_data(client_info.socket, chunk) !=
+                NetworkResult::SUCCESS ||
+            chunk.size() <= crypto::AES_GCM_TAG_SIZE) {
+            return std::nullopt;
+        }
+        const size_t size = chunk.size() - crypto::AES_GCM_TAG_SIZE;
+        const bool last = content.size() + size >= length;
+        if (aead.open(*chunk_count, last, chunk) !=
+            crypto::EncryptionResult::SUCCESS) {
+            return std::nullopt;
+        }
+        content.append(chunk.begin(), chunk.begin() + size);
+    }
+    return content;
+}
+
+TEST_F(ServerConnectionManagerTest, StreamsSealedReadFileWhenNegotiated)
+{
+    const std::string path = "/tmp/fenris_sealed_stream_test.bin";
+    std::string content(5 * 64 * 1024 + 17, '\0');
+    for (size_t i = 0; i < content.size(); ++i) {
+        content[i] = static_cast<char>(i % 251);
+    }
+    {
+        std::ofstream file(path, std::ios::binary);
+        file.write(content.data(), content.size());
+    }
+
+    m_mock_handler_ptr->set_stream_path(path);
+    m_connection_manager->set_sealed_file_streaming(true, 64 * 1024);
+    m_connection_manager->start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    int sock = create_and_connect_client_socket("127.0.0.1", m_port);
+    ASSERT_GE(sock, 0);
+    m_client_sockets.push_back(sock);
+
+    ClientInfo client;
+    client.socket = sock;
+    uint32_t accepted = 0;
+    ASSERT_TRUE(
+        perform_client_key_exchange(sock,
+                                    client.encryption_key,
+                                    fenris::CAPABILITY_SEALED_FILE_STREAM,
+                                    &accepted));
+    EXPECT_TRUE(
+        has_capability(accepted, fenris::CAPABILITY_SEALED_FILE_STREAM));
+
+    fenris::Request read_request;
+    read_request.set_command(fenris::RequestType::READ_FILE);
+    read_request.set_filename("stream.bin");
+    ASSERT_TRUE(send_request(client, read_request));
+
+    std::vector<uint8_t> iv;
+    auto response_opt = receive_response(client, &iv);
+    ASSERT_TRUE(response_opt.has_value());
+    EXPECT_TRUE(response_opt->success());
+    EXPECT_TRUE(response_opt->stream_sealed());
+    EXPECT_TRUE(response_opt->data().empty());
+    ASSERT_EQ(response_opt->stream_length(), content.size());
+
+    // Five full chunks and the 17 bytes left over, in order
+    size_t chunk_count = 0;
+    auto streamed =
+        receive_sealed_stream(client, iv, content.size(), &chunk_count);
+    ASSERT_TRUE(streamed.has_value());
+    EXPECT_EQ(*streamed, content);
+    EXPECT_EQ(chunk_count, 6);
+    EXPECT_EQ(m_mock_handler_ptr->get_request_count(), 0);
+
+    fenris::Request ping_request;
+    ping_request.set_command(fenris::RequestType::PING);
+    ASSERT_TRUE(send_request(client, ping_request));
+    response_opt = receive_response(client);
+    ASSERT_TRUE(response_opt.has_value());
+    EXPECT_EQ(response_opt->data(), "PING");
+
+    std::filesystem::remove(path);
+}
+
+TEST_F(ServerConnectionManagerTest, StreamingNotOfferedByDefault)
+{
+    m_mock_handler_ptr->set_stream_path("/tmp/fenris_unused_stream.bin");
+    m_connection_manager->start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    int sock = create_and_connect_client_socket("127.0.0.1", m_port);
+    ASSERT_GE(sock, 0);
+    m_client_sockets.push_back(sock);
+
+    ClientInfo client;
+    client.socket = sock;
+    uint32_t accepted = 0xFF;
+    ASSERT_TRUE(perform_client_key_exchange(
+        sock,
+        client.encryption_key,
+        fenris::CAPABILITY_PLAINTEXT_FILE_STREAM,
+        &accepted));
+    EXPECT_EQ(accepted, 0);
+
+    fenris::Request read_request;
+    read_request.set_command(fenris::RequestType::READ_FILE);
+    ASSERT_TRUE(send_request(client, read_request));
+
+    auto response_opt = receive_response(client);
+    ASSERT_TRUE(response_opt.has_value());
+    EXPECT_EQ(response_opt->data(), "READ_FILE");
+    EXPECT_EQ(response_opt->stream_length(), 0);
+}
+
+// Large and repetitive, so it is compressed whenever compression is on
+std::string make_compressible_text()
+{
+    std::string text;
+    for (int i = 0; text.size() < 256 * 1024; ++i) {
+        text += "entry " + std::to_string(i % 97) + " of the test listing\n";
+    }
+    return text;
+}
+
+TEST_F(ServerConnectionManagerTest, CompressesMessagesWhenNegotiated)
+{
+    const std::string content = make_compressible_text();
+    m_mock_handler_ptr->set_read_data(content);
+    m_connection_manager->set_compression(true);
+    m_connection_manager->start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    int sock = create_and_connect_client_socket("127.0.0.1", m_port);
+    ASSERT_GE(sock, 0);
+    m_client_sockets.push_back(sock);
+
+    ClientInfo client;
+    client.socket = sock;
+    uint32_t accepted = 0;
+    ASSERT_TRUE(perform_client_key_exchange(sock,
+                                            client.encryption_key,
+                                            fenris::CAPABILITY_COMPRESSION,
+                                            &accepted));
+    ASSERT_TRUE(has_capability(accepted, fenris::CAPABILITY_COMPRESSION));
+    client.compression = std::make_shared<compress::WireCompression>();
+
+    // Large requests and replies and small ones share the stream
+    fenris::Request write_request;
+    write_request.set_command(fenris::RequestType::WRITE_FILE);
+    write_request.set_filename("big.txt");
+    write_request.set_data(content);
+    ASSERT_TRUE(send_request(client, write_request));
+    auto response_opt = receive_response(client);
+    ASSERT_TRUE(response_opt.has_value());
+    EXPECT_EQ(response_opt->data(), "WRITE_FILE");
+
+    fenris::Request read_request;
+    read_request.set_command(fenris::RequestType::READ_FILE);
+    read_request.set_filename("big.txt");
+    for (int i = 0; i < 2; ++i) {
+        ASSERT_TRUE(send_request(client, read_request));
+        response_opt = receive_response(client);
+        ASSERT_TRUE(response_opt.has_value());
+        ASSERT_TRUE(response_opt->success());
+        EXPECT_EQ(response_opt->data(), content);
+    }
+
+    auto requests = m_mock_handler_ptr->get_received_requests();
+    ASSERT_EQ(requests.size(), 3);
+    EXPECT_EQ(requests[0].data(), content);
+    EXPECT_EQ(requests[1].filename(), "big.txt");
+}
+
+TEST_F(ServerConnectionManagerTest, CompressionNotOfferedByDefault)
+{
+    m_connection_manager->start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    int sock = create_and_connect_client_socket("127.0.0.1", m_port);
+    ASSERT_GE(sock, 0);
+    m_client_sockets.push_back(sock);
+
+    ClientInfo client;
+    client.socket = sock;
+    uint32_t accepted = 0xFF;
+    ASSERT_TRUE(perform_client_key_exchange(sock,
+                                            client.encryption_key,
+                                            fenris::CAPABILITY_COMPRESSION,
+                                            &accepted));
+    EXPECT_EQ(accepted, 0);
+
+    // Frames carry no compression header
+    fenris::Request ping_request;
+    ping_request.set_command(fenris::RequestType::PING);
+    ASSERT_TRUE(send_request(client, ping_request));
+    auto response_opt = receive_response(client);
+    ASSERT_TRUE(response_opt.has_value());
+    EXPECT_EQ(response_opt->data(), "PING");
+}
+
+TEST_F(ServerConnectionManagerTest, GrantsReadLeasesWhenNegotiated)
+{
+    m_connection_manager->set_read_leases(true,
+                                          std::chrono::milliseconds(1500));
+    m_connection_manager->start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    fenris::Request read_request;
+    read_request.set_command(fenris::RequestType::READ_FILE);
+    read_request.set_filename("conf.txt");
+    fenris::Request ping_request;
+    ping_request.set_command(fenris::RequestType::PING);
+
+    for (bool leases : {true, false}) {
+        int sock = create_and_connect_client_socket("127.0.0.1", m_port);
+        ASSERT_GE(sock, 0);
+        m_client_sockets.push_back(sock);
+
+        ClientInfo client;
+        client.socket = sock;
+        uint32_t accepted = 0;
+        ASSERT_TRUE(perform_client_key_exchange(
+            sock,
+            client.encryption_key,
+            leases ? fenris::CAPABILITY_READ_LEASES
+                   : fenris::CAPABILITY_NONE,
+            &accepted));
+        EXPECT_EQ(has_capability(accepted, fenris::CAPABILITY_READ_LEASES),
+                  leases);
+
+        // Only file content is leased, and only to clients that asked
+        ASSERT_TRUE(send_request(client, read_request));
+        auto response_opt = receive_response(client);
+        ASSERT_TRUE(response_opt.has_value());
+        EXPECT_EQ(response_opt->data(), "READ_FILE");
+        EXPECT_EQ(response_opt->lease_ms(), leases ? 1500 : 0);
+
+        ASSERT_TRUE(send_request(client, ping_request));
+        response_opt = receive_response(client);
+        ASSERT_TRUE(response_opt.has_value());
+        EXPECT_EQ(response_opt->lease_ms(), 0);
+    }
+}
+
+TEST_F(ServerConnectionManagerTest, PipelinesRequestsWhenNegotiated)
+{
+    auto handler_ptr = std::make_unique<MockClientHandler>(true, 100);
+    m_mock_handler_ptr = handler_ptr.get();
+    m_connection_manager->set_client_handler(std::move(handler_ptr));
+    m_connection_manager->set_pipelining(true);
+    m_connection_manager->start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    int sock = create_and_connect_client_socket("127.0.0.1", m_port);
+    ASSERT_GE(sock, 0);
+    m_client_sockets.push_back(sock);
+
+    ClientInfo client;
+    client.socket = sock;
+    uint32_t accepted = 0;
+    ASSERT_TRUE(perform_client_key_exchange(sock,
+                                            client.encryption_key,
+                                            fenris::CAPABILITY_PIPELINING,
+                                            &accepted));
+    ASSERT_TRUE(has_capability(accepted, fenris::CAPABILITY_PIPELINING));
+
+    // More read-only requests than the server runs at once, then a write
+    // that has to wait for all of them
+    const uint64_t read_count = MAX_PIPELINED_REQUESTS + 4;
+    for (uint64_t id = 1; id <= read_count; ++id) {
+        fenris::Request request;
+        request.set_command(id % 2 == 0 ? fenris::RequestType::PING
+                                        : fenris::RequestType::READ_FILE);
+        request.set_request_id(id);
+        ASSERT_TRUE(send_request(client, request));
+    }
+    fenris::Request write_request;
+    write_request.set_command(fenris::RequestType::WRITE_FILE);
+    write_request.set_request_id(read_count + 1);
+    ASSERT_TRUE(send_request(client, write_request));
+
+    std::set<uint64_t> answered;
+    for (uint64_t i = 0; i < read_count; ++i) {
+        auto response_opt = receive_response(client);
+        ASSERT_TRUE(response_opt.has_value());
+        const uint64_t id = response_opt->request_id();
+        EXPECT_EQ(response_opt->data(), id % 2 == 0 ? "PING" : "READ_FILE");
+        answered.insert(id);
+    }
+    EXPECT_EQ(answered.size(), read_count);
+    EXPECT_EQ(*answered.begin(), 1);
+    EXPECT_EQ(*answered.rbegin(), read_count);
+
+    auto response_opt = receive_response(client);
+    ASSERT_TRUE(response_opt.has_value());
+    EXPECT_EQ(response_opt->request_id(), read_count + 1);
+    EXPECT_EQ(response_opt->data(), "WRITE_FILE");
+
+    auto requests = m_mock_handler_ptr->get_received_requests();
+    ASSERT_EQ(requests.size(), read_count + 1);
+    EXPECT_EQ(requests.back().command(), fenris::RequestType::WRITE_FILE);
+}
+
+// BATCH of one request of each given type, numbered from 1
+fenris::Request make_batch(const std::vector<fenris::RequestType> &commands,
+                           bool parallel)
+{
+    fenris::Request batch;
+    batch.set_command(fenris::RequestType::BATCH);
+    batch.mutable_batch()->set_parallel(parallel);
+    for (size_t i = 0; i < commands.size(); ++i) {
+        auto *request = batch.mutable_batch()->add_requests();
+        request->set_command(commands[i]);
+        request->set_request_id(i + 1);
+    }
+    return batch;
+}
+
+TEST_F(ServerConnectionManagerTest, RunsBatchInOneRoundTrip)
+{
+    m_connection_manager->start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    ClientInfo client = connect_test_client();
+    ASSERT_GE(client.socket, 0);
+
+    for (bool parallel : {false, true}) {
+        ASSERT_TRUE(send_request(client,
+                                 make_batch({fenris::RequestType::PING,
+                                             fenris::RequestType::LIST_DIR,
+                                             fenris::RequestType::READ_FILE},
+                                            parallel)));
+        auto response_opt = receive_response(client);
+        ASSERT_TRUE(response_opt.has_value());
+        EXPECT_EQ(response_opt->type(), fenris::ResponseType::BATCH_RESULTS);
+        EXPECT_TRUE(response_opt->success());
+        const auto &responses = response_opt->batch_results().responses();
+        ASSERT_EQ(responses.size(), 3);
+        EXPECT_EQ(responses[0].data(), "PING");
+        EXPECT_EQ(responses[1].data(), "LIST_DIR");
+        EXPECT_EQ(responses[2].data(), "READ_FILE");
+        EXPECT_EQ(responses[2].request_id(), 3);
+    }
+    EXPECT_EQ(m_mock_handler_ptr->get_request_count(), 6);
+
+    // Refused sub-requests fail on their own and never reach the handler
+    ASSERT_TRUE(send_request(client,
+                             make_batch({fenris::RequestType::TERMINATE,
+                                         fenris::RequestType::CHANGE_DIR,
+                                         fenris::RequestType::PING},
+                                        true)));
+    auto response_opt = receive_response(client);
+    ASSERT_TRUE(response_opt.has_value());
+    EXPECT_FALSE(response_opt->success());
+    const auto &responses = response_opt->batch_results().responses();
+    ASSERT_EQ(responses.size(), 3);
+    EXPECT_FALSE(responses[0].success());
+    EXPECT_FALSE(responses[1].success());
+    EXPECT_TRUE(responses[2].success());
+    EXPECT_EQ(m_mock_handler_ptr->get_request_count(), 7);
+
+    // The connection is still usable
+    fenris::Request ping_request;
+    ping_request.set_command(fenris::RequestType::PING);
+    ASSERT_TRUE(send_request(client, ping_request));
+    response_opt = receive_response(client);
+    ASSERT_TRUE(response_opt.has_value());
+    EXPECT_EQ(response_opt->data(), "PING");
+}
+
+// Nonces of the test client, which sends what the server receives
+void use_sequenced_nonces(ClientInfo &client, uint32_t epoch = 0)
+{
+    client.send_nonces = std::make_shared<crypto::NonceSequence>(
+        crypto::NonceDirection::CLIENT_TO_SERVER, epoch);
+    client.receive_nonces = std::make_shared<crypto::NonceSequence>(
+        crypto::NonceDirection::SERVER_TO_CLIENT, epoch);
+}
+
+// Send REKEY and switch the test client to the key it agreed on
+bool rekey_client(ClientInfo &client)
+{
+    crypto::CryptoManager crypto_manager;
+    auto [private_key, public_key, keygen_result] =
+        crypto_manager.generate_ecdh_keypair();
+    if (keygen_result != crypto::ECDHResult::SUCCESS) {
+        return false;
+    }
+
+    fenris::Request rekey_request;
+    rekey_request.set_command(fenris::RequestType::REKEY);
+    rekey_request.set_data(public_key.data(), public_key.size());
+    if (!send_request(client, rekey_request)) {
+        return false;
+    }
+    auto response_opt = receive_response(client);
+    if (!response_opt.has_value() ||
+        response_opt->type() != fenris::ResponseType::REKEYED) {
+        return false;
+    }
+
+    const std::vector<uint8_t> server_public_key(response_opt->data().begin(),
+                                                 response_opt->data().end());
+    auto [shared_secret, ss_result] =
+        crypto_manager.compute_ecdh_shared_secret(private_key,
+                                                  server_public_key);
+    if (ss_result != crypto::ECDHResult::SUCCESS) {
+        return false;
+    }
+    auto [derived_key, key_derive_result] =
+        crypto_manager.derive_key_from_shared_secret(shared_secret,
+                                                     crypto::AES_GCM_KEY_SIZE);
+    if (key_derive_result != crypto::ECDHResult::SUCCESS) {
+        return false;
+    }
+
+    client.encryption_key = derived_key;
+    use_sequenced_nonces(client, client.send_nonces->epoch() + 1);
+    return true;
+}
+
+TEST_F(ServerConnectionManagerTest, SequencedNoncesRejectReplays)
+{
+    m_connection_manager->start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    int sock = create_and_connect_client_socket("127.0.0.1", m_port);
+    ASSERT_GE(sock, 0);
+    m_client_sockets.push_back(sock);
+
+    ClientInfo client;
+    client.socket = sock;
+    uint32_t accepted = 0;
+    ASSERT_TRUE(perform_client_key_exchange(sock,
+                                            client.encryption_key,
+                                            fenris::CAPABILITY_SEQUENCED_NONCES,
+                                            &accepted));
+    ASSERT_TRUE(has_capability(accepted, fenris::CAPABILITY_SEQUENCED_NONCES));
+    use_sequenced_nonces(client);
+
+    // Responses count up from zero in their own direction
+    fenris::Request ping_request;
+    ping_request.set_command(fenris::RequestType::PING);
+    const crypto::NonceSequence before_ping = *client.send_nonces;
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_TRUE(send_request(client, ping_request));
+        auto response_opt = receive_response(client);
+        ASSERT_TRUE(response_opt.has_value());
+        EXPECT_EQ(response_opt->data(), "PING");
+    }
+    EXPECT_EQ(client.receive_nonces->count(), 3);
+
+    // Reusing a nonce the server already saw ends the connection
+    *client.send_nonces = before_ping;
+    ASSERT_TRUE(send_request(client, ping_request));
+    EXPECT_FALSE(receive_response(client).has_value());
+    EXPECT_EQ(m_mock_handler_ptr->get_request_count(), 3);
+}
+
+TEST_F(ServerConnectionManagerTest, RekeyReplacesSessionKey)
+{
+    m_connection_manager->start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    int sock = create_and_connect_client_socket("127.0.0.1", m_port);
+    ASSERT_GE(sock, 0);
+    m_client_sockets.push_back(sock);
+
+    ClientInfo client;
+    client.socket = sock;
+    ASSERT_TRUE(perform_client_key_exchange(
+        sock, client.encryption_key, fenris::CAPABILITY_SEQUENCED_NONCES));
+    use_sequenced_nonces(client);
+    const std::vector<uint8_t> first_key = client.encryption_key;
+
+    fenris::Request ping_request;
+    ping_request.set_command(fenris::RequestType::PING);
+    for (int i = 0; i < 2; ++i) {
+        ASSERT_TRUE(rekey_client(client));
+        ASSERT_TRUE(send_request(client, ping_request));
+        auto response_opt = receive_response(client);
+        ASSERT_TRUE(response_opt.has_value());
+        EXPECT_EQ(response_opt->data(), "PING");
+    }
+    EXPECT_NE(client.encryption_key, first_key);
+    EXPECT_EQ(client.send_nonces->epoch(), 2);
+
+    // REKEY never reaches the handler
+    EXPECT_EQ(m_mock_handler_ptr->get_request_count(), 2);
+
+    // Nonces of an old epoch are refused
+    use_sequenced_nonces(client, 1);
+    ASSERT_TRUE(send_request(client, ping_request));
+    EXPECT_FALSE(receive_response(client).has_value());
+}
+
+// Redeem a ticket in a resumption frame. Returns the resumed key, an empty
+// key if the server refused the ticket, or std::nullopt on errors.
+std::optional<std::vector<uint8_t>>
+resume_client_session(int sock,
+                      const std::vector<uint8_t> &ticket,
+                      const std::vector<uint8_t> &secret,
+                      fenris::Handshake *reply = nullptr)
+{
+    crypto::CryptoManager crypto_manager;
+    auto [client_nonce, nonce_result] =
+        crypto_manager.generate_random_bytes(crypto::RESUMPTION_NONCE_SIZE);
+    if (nonce_result != crypto::EncryptionResult::SUCCESS) {
+        return std::nullopt;
+    }
+
+    fenris::Handshake offer;
+    offer.set_capabilities(fenris::CAPABILITY_SESSION_TICKET);
+    offer.set_ticket(ticket.data(), ticket.size());
+    offer.set_resumption_nonce(client_nonce.data(), client_nonce.size());
+    if (send_prefixed_data(sock, encode_resumption(offer)) !=
+        NetworkResult::SUCCESS) {
+        return std::nullopt;
+    }
+
+    std::vector<uint8_t> server_frame;
+    if (receive_prefixed_data(sock, server_frame) != NetworkResult::SUCCESS) {
+        return std::nullopt;
+    }
+    auto decoded = decode_key_exchange(server_frame);
+    if (!decoded.has_value() || !decoded->resumption) {
+        return std::nullopt;
+    }
+    if (reply != nullptr) {
+        *reply = *decoded->handshake;
+    }
+
+    const std::string &server_nonce = decoded->handshake->resumption_nonce();
+    if (server_nonce.empty()) {
+        return std::vector<uint8_t>();
+    }
+    auto [key, key_result] = crypto::derive_resumed_key(
+        secret,
+        client_nonce,
+        {reinterpret_cast<const uint8_t *>(server_nonce.data()),
+         server_nonce.size()});
+    if (key_result != crypto::ECDHResult::SUCCESS) {
+        return std::nullopt;
+    }
+    return key;
+}
+
+// Answered PING over a freshly keyed connection
+bool ping_succeeds(const ClientInfo &client)
+{
+    fenris::Request ping_request;
+    ping_request.set_command(fenris::RequestType::PING);
+    if (!send_request(client, ping_request)) {
+        return false;
+    }
+    auto response_opt = receive_response(client);
+    return response_opt.has_value() && response_opt->data() == "PING";
+}
+
+TEST_F(ServerConnectionManagerTest, ResumesSessionFromTicket)
+{
+    m_connection_manager->set_session_tickets(true);
+    m_connection_manager->start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    int first_sock = create_and_connect_client_socket("127.0.0.1", m_port);
+    ASSERT_GE(first_sock, 0);
+    m_client_sockets.push_back(first_sock);
+
+    ClientInfo first;
+    first.socket = first_sock;
+    uint32_t accepted = 0;
+    fenris::Handshake reply;
+    ASSERT_TRUE(
+        perform_client_key_exchange(first_sock,
+                                    first.encryption_key,
+                                    fenris::CAPABILITY_SESSION_TICKET,
+                                    &accepted,
+                                    &reply));
+    EXPECT_TRUE(has_capability(accepted, fenris::CAPABILITY_SESSION_TICKET));
+    ASSERT_FALSE(reply.ticket().empty());
+    EXPECT_TRUE(ping_succeeds(first));
+
+    std::vector<uint8_t> ticket(reply.ticket().begin(), reply.ticket().end());
+    auto [secret, secret_result] =
+        crypto::derive_resumption_secret(first.encryption_key);
+    ASSERT_EQ(secret_result, crypto::ECDHResult::SUCCESS);
+
+    // The next connection is keyed from the ticket alone
+    int second_sock = create_and_connect_client_socket("127.0.0.1", m_port);
+    ASSERT_GE(second_sock, 0);
+    m_client_sockets.push_back(second_sock);
+
+    ClientInfo second;
+    second.socket = second_sock;
+    fenris::Handshake resumed;
+    auto key = resume_client_session(second_sock, ticket, secret, &resumed);
+    ASSERT_TRUE(key.has_value());
+    ASSERT_FALSE(key->empty());
+    EXPECT_NE(*key, first.encryption_key);
+    EXPECT_TRUE(has_capability(resumed.capabilities(),
+                               fenris::CAPABILITY_SESSION_TICKET));
+    EXPECT_FALSE(resumed.ticket().empty());
+    EXPECT_NE(resumed.ticket(), reply.ticket());
+    second.encryption_key = *key;
+    EXPECT_TRUE(ping_succeeds(second));
+    EXPECT_TRUE(ping_succeeds(first));
+}
+
+TEST_F(ServerConnectionManagerTest, RefusedTicketFallsBackToKeyExchange)
+{
+    m_connection_manager->set_session_tickets(true);
+    m_connection_manager->start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    int sock = create_and_connect_client_socket("127.0.0.1", m_port);
+    ASSERT_GE(sock, 0);
+    m_client_sockets.push_back(sock);
+
+    // A ticket this server never issued
+    const std::vector<uint8_t> ticket(64, 0x5A);
+    const std::vector<uint8_t> secret(crypto::AES_GCM_KEY_SIZE, 0x11);
+    fenris::Handshake refusal;
+    auto key = resume_client_session(sock, ticket, secret, &refusal);
+    ASSERT_TRUE(key.has_value());
+    EXPECT_TRUE(key->empty());
+    EXPECT_TRUE(refusal.ticket().empty());
+
+    ClientInfo client;
+    client.socket = sock;
+    ASSERT_TRUE(perform_client_key_exchange(sock, client.encryption_key));
+    EXPECT_TRUE(ping_succeeds(client));
+}
+
+class ServerConnectionManagerReactorTest : public ServerConnectionManagerTest {
+  protected:
+    void SetUp() override
+    {
+        ServerConnectionManagerTest::SetUp();
+        m_connection_manager->set_reactor_mode(true);
+        m_connection_manager->set_io_threads(2);
+        m_connection_manager->set_worker_threads(2);
+    }
+};
+
+TEST_F(ServerConnectionManagerReactorTest, PingAndTerminate)
+{
+    m_connection_manager->start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    ClientInfo client = connect_test_client();
+    ASSERT_GE(client.socket, 0);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ASSERT_EQ(m_connection_manager->get_active_client_count(), 1);
+
+    fenris::Request ping_request;
+    ping_request.set_command(fenris::RequestType::PING);
+    ASSERT_TRUE(send_request(client, ping_request));
+
+    auto response_opt = receive_response(client);
+    ASSERT_TRUE(response_opt.has_value());
+    ASSERT_TRUE(response_opt->success());
+    ASSERT_EQ(response_opt->data(), "PING");
+
+    fenris::Request terminate_request;
+    terminate_request.set_command(fenris::RequestType::TERMINATE);
+    ASSERT_TRUE(send_request(client, terminate_request));
+
+    auto terminate_response_opt = receive_response(client);
+    ASSERT_TRUE(terminate_response_opt.has_value());
+    ASSERT_EQ(terminate_response_opt->data(), "TERMINATE");
+
+    // The server closes the connection after TERMINATE
+    bool disconnected = false;
+    for (int i = 0; i < 20; i++) {
+        if (m_connection_manager->get_active_client_count() == 0) {
+            disconnected = true;
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    ASSERT_TRUE(disconnected);
+}
+
+TEST_F(ServerConnectionManagerReactorTest, DrainAnswersRequestsInFlight)
+{
+    check_drain_answers_requests_in_flight();
+}
+
+TEST_F(ServerConnectionManagerReactorTest, ManyConcurrentClients)
+{
+    m_connection_manager->start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    const int client_count = 16;
+    std::vector<ClientInfo> clients;
+    for (int i = 0; i < client_count; i++) {
+        clients.push_back(connect_test_client());
+        ASSERT_GE(clients.back().socket, 0);
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ASSERT_EQ(m_connection_manager->get_active_client_count(), client_count);
+
+    // Send every request before reading any response so they are all in
+    // flight in the reactor at the same time
+    fenris::Request read_request;
+    read_request.set_command(fenris::RequestType::READ_FILE);
+    read_request.set_filename("test.txt");
+    for (const auto &client : clients) {
+        ASSERT_TRUE(send_request(client, read_request));
+    }
+
+    for (const auto &client : clients) {
+        auto response_opt = receive_response(client);
+        ASSERT_TRUE(response_opt.has_value());
+        ASSERT_TRUE(response_opt->success());
+        ASSERT_EQ(response_opt->data(), "READ_FILE");
+    }
+
+    ASSERT_EQ(m_mock_handler_ptr->get_request_count(), client_count);
+}
+
+TEST_F(ServerConnectionManagerReactorTest, AcceptorsShareThePort)
+{
+    // Four SO_REUSEPORT sockets on one port, each feeding a loop of its own
+    m_connection_manager->set_acceptors(4);
+    m_connection_manager->set_io_threads(4);
+    m_connection_manager->start();
+    ASSERT_TRUE(m_connection_manager->is_running());
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    const int client_count = 16;
+    std::vector<ClientInfo> clients;
+    for (int i = 0; i < client_count; i++) {
+        clients.push_back(connect_test_client());
+        ASSERT_GE(clients.back().socket, 0);
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ASSERT_EQ(m_connection_manager->get_active_client_count(), client_count);
+    for (const auto &client : clients) {
+        EXPECT_TRUE(ping_succeeds(client));
+    }
+
+    // Every acceptor wakes up from accept() and stop() returns
+    m_connection_manager->stop();
+    EXPECT_FALSE(m_connection_manager->is_running());
+}
+
+TEST_F(ServerConnectionManagerReactorTest, CompressesMessagesWhenNegotiated)
+{
+    const std::string content = make_compressible_text();
+    m_mock_handler_ptr->set_read_data(content);
+    m_connection_manager->set_compression(true);
+    m_connection_manager->start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    int sock = create_and_connect_client_socket("127.0.0.1", m_port);
+    ASSERT_GE(sock, 0);
+    m_client_sockets.push_back(sock);
+
+    ClientInfo client;
+    client.socket = sock;
+    uint32_t accepted = 0;
+    ASSERT_TRUE(perform_client_key_exchange(sock,
+                                            client.encryption_key,
+                                            fenris::CAPABILITY_COMPRESSION,
+                                            &accepted));
+    ASSERT_TRUE(has_capability(accepted, fenris::CAPABILITY_COMPRESSION));
+    client.compression = std::make_shared<compress::WireCompression>();
+
+    fenris::Request read_request;
+    read_request.set_command(fenris::RequestType::READ_FILE);
+    read_request.set_filename("big.txt");
+    for (int i = 0; i < 2; ++i) {
+        ASSERT_TRUE(send_request(client, read_request));
+        auto response_opt = receive_response(client);
+        ASSERT_TRUE(response_opt.has_value());
+        EXPECT_EQ(response_opt->data(), content);
+    }
+}
+
+TEST_F(ServerConnectionManagerReactorTest, RunsBatchInOneRoundTrip)
+{
+    m_connection_manager->start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    ClientInfo client = connect_test_client();
+    ASSERT_GE(client.socket, 0);
+
+    ASSERT_TRUE(send_request(client,
+                             make_batch({fenris::RequestType::PING,
+                                         fenris::RequestType::WRITE_FILE},
+                                        true)));
+    auto response_opt = receive_response(client);
+    ASSERT_TRUE(response_opt.has_value());
+    EXPECT_EQ(response_opt->type(), fenris::ResponseType::BATCH_RESULTS);
+    EXPECT_TRUE(response_opt->success());
+    const auto &responses = response_opt->batch_results().responses();
+    ASSERT_EQ(responses.size(), 2);
+    EXPECT_EQ(responses[0].data(), "PING");
+    EXPECT_EQ(responses[1].data(), "WRITE_FILE");
+}
+
+TEST_F(ServerConnectionManagerReactorTest, PipeliningNotOffered)
+{
+    m_connection_manager->set_pipelining(true);
+    m_connection_manager->start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    int sock = create_and_connect_client_socket("127.0.0.1", m_port);
+    ASSERT_GE(sock, 0);
+    m_client_sockets.push_back(sock);
+
+    ClientInfo client;
+    client.socket = sock;
+    uint32_t accepted = 0xFF;
+    ASSERT_TRUE(perform_client_key_exchange(sock,
+                                            client.encryption_key,
+                                            fenris::CAPABILITY_PIPELINING,
+                                            &accepted));
+    EXPECT_FALSE(has_capability(accepted, fenris::CAPABILITY_PIPELINING));
+
+    // Request IDs are echoed all the same
+    fenris::Request ping_request;
+    ping_request.set_command(fenris::RequestType::PING);
+    ping_request.set_request_id(42);
+    ASSERT_TRUE(send_request(client, ping_request));
+    auto response_opt = receive_response(client);
+    ASSERT_TRUE(response_opt.has_value());
+    EXPECT_EQ(response_opt->request_id(), 42);
+}
+
+TEST_F(ServerConnectionManagerReactorTest, RekeyReplacesSessionKey)
+{
+    m_connection_manager->start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    int sock = create_and_connect_client_socket("127.0.0.1", m_port);
+    ASSERT_GE(sock, 0);
+    m_client_sockets.push_back(sock);
+
+    ClientInfo client;
+    client.socket = sock;
+    ASSERT_TRUE(perform_client_key_exchange(
+        sock, client.encryption_key, fenris::CAPABILITY_SEQUENCED_NONCES));
+    use_sequenced_nonces(client);
+
+    fenris::Request ping_request;
+    ping_request.set_command(fenris::RequestType::PING);
+    ASSERT_TRUE(send_request(client, ping_request));
+    ASSERT_TRUE(receive_response(client).has_value());
+
+    ASSERT_TRUE(rekey_client(client));
+    ASSERT_TRUE(send_request(client, ping_request));
+    auto response_opt = receive_response(client);
+    ASSERT_TRUE(response_opt.has_value());
+    EXPECT_EQ(response_opt->data(), "PING");
+    EXPECT_EQ(m_mock_handler_ptr->get_request_count(), 2);
+}
+
+TEST_F(ServerConnectionManagerReactorTest, ResumesSessionAfterRefusedTicket)
+{
+    m_connection_manager->set_session_tickets(true);
+    m_connection_manager->start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    int first_sock = create_and_connect_client_socket("127.0.0.1", m_port);
+    ASSERT_GE(first_sock, 0);
+    m_client_sockets.push_back(first_sock);
+
+    // Refused, then keyed by a full exchange on the same connection
+    const std::vector<uint8_t> stale_ticket(64, 0x5A);
+    const std::vector<uint8_t> stale_secret(crypto::AES_GCM_KEY_SIZE, 0x11);
+    auto refused =
+        resume_client_session(first_sock, stale_ticket, stale_secret);
+    ASSERT_TRUE(refused.has_value());
+    EXPECT_TRUE(refused->empty());
+
+    ClientInfo first;
+    first.socket = first_sock;
+    fenris::Handshake reply;
+    ASSERT_TRUE(
+        perform_client_key_exchange(first_sock,
+                                    first.encryption_key,
+                                    fenris::CAPABILITY_SESSION_TICKET,
+                                    nullptr,
+                                    &reply));
+    ASSERT_FALSE(reply.ticket().empty());
+    EXPECT_TRUE(ping_succeeds(first));
+
+    const std::vector<uint8_t> ticket(reply.ticket().begin(),
+                                      reply.ticket().end());
+    auto [secret, secret_result] =
+        crypto::derive_resumption_secret(first.encryption_key);
+    ASSERT_EQ(secret_result, crypto::ECDHResult::SUCCESS);
+
+    int second_sock = create_and_connect_client_socket("127.0.0.1", m_port);
+    ASSERT_GE(second_sock, 0);
+    m_client_sockets.push_back(second_sock);
+
+    ClientInfo second;
+    second.socket = second_sock;
+    auto key = resume_client_session(second_sock, ticket, secret);
+    ASSERT_TRUE(key.has_value());
+    ASSERT_FALSE(key->empty());
+    second.encryption_key = *key;
+    EXPECT_TRUE(ping_succeeds(second));
+}
+
+TEST_F(ServerConnectionManagerReactorTest, ClientDisconnection)
+{
+    m_connection_manager->start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    ClientInfo client = connect_test_client();
+    ASSERT_GE(client.socket, 0);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ASSERT_EQ(m_connection_manager->get_active_client_count(), 1);
+
+    close(client.socket);
+    m_client_sockets.erase(std::remove(m_client_sockets.begin(),
+                                       m_client_sockets.end(),
+                                       client.socket),
+                           m_client_sockets.end());
+
+    bool disconnected = false;
+    for (int i = 0; i < 20; i++) {
+        if (m_connection_manager->get_active_client_count() == 0) {
+            disconnected = true;
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    ASSERT_TRUE(disconnected) << "Reactor did not detect client disconnection";
+    EXPECT_EQ(m_mock_handler_ptr->get_disconnected_client_sockets().size(),
+              1u);
+}
+
 } // namespace tests
 } // namespace server
 } // namespace fenris
@@ -0,0 +1,938 @@
+#include "common/delta_sync.hpp"
+#include "common/file_operations.hpp"
+#include "common/logging.hpp"
+#include "common/request.hpp"
+#include "server/request_manager.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+namespace fenris {
+namespace server {
+namespace test {
+
+namespace fs = std::filesystem;
+
+class RequestManagerTest : public ::testing::Test {
+  protected:
+    void SetUp() override
+    {
+        fs::create_directory(test_dir);
+        common::LoggingConfig log_config;
+        log_config.level = common::LogLevel::DEBUG;
+        log_config.console_logging = true;
+        log_config.file_logging = false;
+
+        common::initialize_logging(log_config, "TestRequestManager");
+        request_manager =
+            std::make_unique<RequestManager>(test_dir, "TestRequestManager");
+    }
+
+    void TearDown() override
+    {
+        fs::remove_all(test_dir);
+    }
+
+    fenris::Response send(const fenris::Request &request)
+    {
+        return request_manager->handle_request(client_socket, request).first;
+    }
+
+    fenris::Response read_chunk(const std::string &filename,
+                                uint64_t offset,
+                                uint64_t length)
+    {
+        fenris::Request request;
+        request.set_command(fenris::RequestType::READ_CHUNK);
+        request.set_filename(filename);
+        request.mutable_chunk()->set_offset(offset);
+        request.mutable_chunk()->set_length(length);
+        return send(request);
+    }
+
+    fenris::Response write_chunk(const std::string &filename,
+                                 uint64_t offset,
+                                 const std::string &data,
+                                 bool final)
+    {
+        fenris::Request request;
+        request.set_command(fenris::RequestType::WRITE_CHUNK);
+        request.set_filename(filename);
+        request.set_data(data);
+        request.mutable_chunk()->set_offset(offset);
+        request.mutable_chunk()->set_length(data.size());
+        request.mutable_chunk()->set_final(final);
+        return send(request);
+    }
+
+    const std::string test_dir = "/tmp/fenris_request_manager_test";
+    const uint32_t client_socket = 7;
+
+    std::unique_ptr<RequestManager> request_manager;
+};
+
+TEST_F(RequestManagerTest, PathsStayBelowRoot)
+{
+    const fs::path root = fs::absolute(test_dir);
+
+    EXPECT_EQ(request_manager->resolve_path(client_socket, "/a/b.txt"),
+              root / "a/b.txt");
+    EXPECT_EQ(request_manager->resolve_path(client_socket, "../../etc/passwd"),
+              root / "etc/passwd");
+    EXPECT_EQ(request_manager->resolve_path(client_socket, "/a/../../b"),
+              root / "b");
+}
+
+TEST_F(RequestManagerTest, WorkingDirectoryIsPerClient)
+{
+    fs::create_directory(fs::path(test_dir) / "docs");
+
+    fenris::Request request;
+    request.set_command(fenris::RequestType::CHANGE_DIR);
+    request.set_filename("docs");
+    fenris::Response response = send(request);
+    ASSERT_TRUE(response.success());
+    EXPECT_EQ(response.data(), "Changed directory to: /docs");
+
+    EXPECT_EQ(request_manager->resolve_path(client_socket, "note.txt"),
+              fs::absolute(test_dir) / "docs/note.txt");
+    EXPECT_EQ(request_manager->resolve_path(client_socket + 1, "note.txt"),
+              fs::absolute(test_dir) / "note.txt");
+
+    // Changing into a missing directory keeps the old one
+    request.set_filename("missing");
+    response = send(request);
+    EXPECT_FALSE(response.success());
+    EXPECT_EQ(response.error_message(), "file not found");
+    EXPECT_EQ(request_manager->resolve_path(client_socket, "x"),
+              fs::absolute(test_dir) / "docs/x");
+}
+
+TEST_F(RequestManagerTest, DisconnectForgetsWorkingDirectory)
+{
+    fs::create_directory(fs::path(test_dir) / "docs");
+
+    fenris::Request request;
+    request.set_command(fenris::RequestType::CHANGE_DIR);
+    request.set_filename("docs");
+    ASSERT_TRUE(send(request).success());
+
+    // The working directory holds a descriptor open
+    auto open_descriptors = [] {
+        return std::distance(fs::directory_iterator("/proc/self/fd"),
+                             fs::directory_iterator());
+    };
+    const auto held = open_descriptors();
+
+    // A connection reusing the descriptor starts at the root
+    request_manager->client_disconnected(client_socket);
+    EXPECT_EQ(request_manager->resolve_path(client_socket, "note.txt"),
+              fs::absolute(test_dir) / "note.txt");
+    EXPECT_EQ(open_descriptors(), held - 1);
+}
+
+TEST_F(RequestManagerTest, WriteAndReadFile)
+{
+    fenris::Request request;
+    request.set_command(fenris::RequestType::WRITE_FILE);
+    request.set_filename("hello.txt");
+    request.set_data("Hello, server");
+    fenris::Response response = send(request);
+    ASSERT_TRUE(response.success());
+    EXPECT_EQ(response.type(), fenris::ResponseType::SUCCESS);
+
+    request.Clear();
+    request.set_command(fenris::RequestType::READ_FILE);
+    request.set_filename("/hello.txt");
+    response = send(request);
+    ASSERT_TRUE(response.success());
+    EXPECT_EQ(response.type(), fenris::ResponseType::FILE_CONTENT);
+    EXPECT_EQ(response.data(), "Hello, server");
+
+    request.set_filename("missing.txt");
+    response = send(request);
+    EXPECT_FALSE(response.success());
+    EXPECT_EQ(response.type(), fenris::ResponseType::ERROR);
+}
+
+TEST_F(RequestManagerTest, ConditionalReadSkipsUnchangedContent)
+{
+    fenris::Request request;
+    request.set_command(fenris::RequestType::WRITE_FILE);
+    request.set_filename("conf.txt");
+    request.set_data("v1");
+    ASSERT_TRUE(send(request).success());
+
+    // Every read reports the version it returned
+    request.Clear();
+    request.set_command(fenris::RequestType::READ_FILE);
+    request.set_filename("conf.txt");
+    fenris::Response response = send(request);
+    ASSERT_TRUE(response.success());
+    ASSERT_TRUE(response.has_file_info());
+    EXPECT_EQ(response.data(), "v1");
+    EXPECT_FALSE(response.not_modified());
+    const uint64_t modified_time = response.file_info().modified_time();
+    EXPECT_NE(modified_time, 0);
+
+    request.set_if_modified_since(modified_time);
+    response = send(request);
+    ASSERT_TRUE(response.success());
+    EXPECT_EQ(response.type(), fenris::ResponseType::FILE_CONTENT);
+    EXPECT_TRUE(response.not_modified());
+    EXPECT_TRUE(response.data().empty());
+    EXPECT_EQ(response.file_info().modified_time(), modified_time);
+
+    // A change moves the time on, and the content comes back in full
+    fs::last_write_time(fs::path(test_dir) / "conf.txt",
+                        fs::file_time_type(std::chrono::nanoseconds(
+                            modified_time + 1000)));
+    response = send(request);
+    ASSERT_TRUE(response.success());
+    EXPECT_FALSE(response.not_modified());
+    EXPECT_EQ(response.data(), "v1");
+    EXPECT_EQ(response.file_info().modified_time(), modified_time + 1000);
+}
+
+TEST_F(RequestManagerTest, PatchRebuildsFileFromDelta)
+{
+    std::string base(20000, '\0');
+    for (size_t i = 0; i < base.size(); ++i) {
+        base[i] = static_cast<char>(i * 7 + i / 251);
+    }
+    fenris::Request request;
+    request.set_command(fenris::RequestType::WRITE_FILE);
+    request.set_filename("data.bin");
+    request.set_data(base);
+    ASSERT_TRUE(send(request).success());
+    fs::permissions(fs::path(test_dir) / "data.bin", fs::perms(0640));
+
+    request.Clear();
+    request.set_command(fenris::RequestType::SIGNATURES);
+    request.set_filename("data.bin");
+    request.mutable_chunk()->set_length(2048);
+    fenris::Response response = send(request);
+    ASSERT_TRUE(response.success());
+    ASSERT_EQ(response.type(), fenris::ResponseType::FILE_SIGNATURES);
+    const fenris::FileSignatures signatures = response.signatures();
+    EXPECT_EQ(signatures.block_size(), 2048u);
+    EXPECT_EQ(signatures.file_size(), base.size());
+    EXPECT_EQ(signatures.blocks_size(), 10);
+
+    std::string target = base;
+    target.replace(5000, 10, "patched!!!");
+    target += "tail";
+    const auto *bytes = reinterpret_cast<const uint8_t *>(target.data());
+    const fenris::Delta delta =
+        common::delta::compute_delta(signatures, {bytes, target.size()});
+
+    request.Clear();
+    request.set_command(fenris::RequestType::PATCH_FILE);
+    request.set_filename("data.bin");
+    *request.mutable_delta() = delta;
+    response = send(request);
+    ASSERT_TRUE(response.success()) << response.error_message();
+    EXPECT_EQ(common::read_file(test_dir + "/data.bin").first, target);
+    EXPECT_EQ(fs::status(fs::path(test_dir) / "data.bin").permissions(),
+              fs::perms(0640));
+
+    // The signatures describe the old file, the patch must not apply twice
+    response = send(request);
+    EXPECT_FALSE(response.success());
+    EXPECT_EQ(common::read_file(test_dir + "/data.bin").first, target);
+
+    // Nothing is left behind by a rejected patch
+    size_t entries = 0;
+    for (const auto &entry : fs::directory_iterator(test_dir)) {
+        (void)entry;
+        ++entries;
+    }
+    EXPECT_EQ(entries, 1u);
+}
+
+TEST_F(RequestManagerTest, PatchResolvesAgainstWorkingDirectory)
+{
+    fs::create_directory(fs::path(test_dir) / "docs");
+    const std::string base(8192, 'b');
+    common::write_file(test_dir + "/docs/data.bin", base);
+    common::write_file(test_dir + "/data.bin", "top level");
+
+    fenris::Request request;
+    request.set_command(fenris::RequestType::CHANGE_DIR);
+    request.set_filename("docs");
+    ASSERT_TRUE(send(request).success());
+
+    request.Clear();
+    request.set_command(fenris::RequestType::SIGNATURES);
+    request.set_filename("data.bin");
+    fenris::Response response = send(request);
+    ASSERT_TRUE(response.success()) << response.error_message();
+    EXPECT_EQ(response.signatures().file_size(), base.size());
+
+    const std::string target = base + "more";
+    const auto *bytes = reinterpret_cast<const uint8_t *>(target.data());
+    request.Clear();
+    request.set_command(fenris::RequestType::PATCH_FILE);
+    request.set_filename("data.bin");
+    *request.mutable_delta() = common::delta::compute_delta(
+        response.signatures(), {bytes, target.size()});
+    response = send(request);
+    ASSERT_TRUE(response.success()) << response.error_message();
+    EXPECT_EQ(common::read_file(test_dir + "/docs/data.bin").first, target);
+    EXPECT_EQ(common::read_file(test_dir + "/data.bin").first, "top level");
+}
+
+TEST_F(RequestManagerTest, ListDirectoryUsesEntryNames)
+{
+    common::write_file(test_dir + "/b.txt", "b");
+    common::write_file(test_dir + "/a.txt", "a");
+
+    fenris::Request request;
+    request.set_command(fenris::RequestType::LIST_DIR);
+    fenris::Response response = send(request);
+    ASSERT_TRUE(response.success());
+    ASSERT_TRUE(response.has_directory_listing());
+    ASSERT_EQ(response.directory_listing().entries_size(), 2);
+    EXPECT_EQ(response.directory_listing().entries(0).name(), "a.txt");
+    EXPECT_EQ(response.directory_listing().entries(1).name(), "b.txt");
+}
+
+TEST_F(RequestManagerTest, ListDirectoryInPages)
+{
+    for (int i = 0; i < 10; ++i) {
+        common::write_file(test_dir + "/file" + std::to_string(i) + ".txt",
+                           "x");
+    }
+
+    fenris::Request request;
+    request.set_command(fenris::RequestType::LIST_DIR);
+    request.mutable_list()->set_page_size(4);
+    request.mutable_list()->set_names_only(true);
+
+    size_t entries = 0;
+    int pages = 0;
+    do {
+        fenris::Response response = send(request);
+        ASSERT_TRUE(response.success());
+        ASSERT_TRUE(response.has_directory_listing());
+        const auto &listing = response.directory_listing();
+        EXPECT_TRUE(listing.names_only());
+        EXPECT_LE(listing.entries_size(), 4);
+        entries += listing.entries_size();
+        request.mutable_list()->set_cursor(listing.next_cursor());
+        ASSERT_LT(++pages, 10);
+    } while (request.list().cursor() != 0);
+
+    EXPECT_EQ(entries, 10);
+    EXPECT_GE(pages, 3);
+}
+
+TEST_F(RequestManagerTest, ReadChunksUntilFinal)
+{
+    std::string content(2500, '\0');
+    for (size_t i = 0; i < content.size(); ++i) {
+        content[i] = static_cast<char>(i % 251);
+    }
+    common::write_file(test_dir + "/blob.bin", content);
+
+    std::string received;
+    uint64_t offset = 0;
+    bool final = false;
+    int chunks = 0;
+    while (!final) {
+        fenris::Response response = read_chunk("blob.bin", offset, 1000);
+        ASSERT_TRUE(response.success());
+        ASSERT_EQ(response.type(), fenris::ResponseType::FILE_CHUNK);
+        ASSERT_TRUE(response.has_chunk_info());
+        EXPECT_EQ(response.chunk_info().offset(), offset);
+        EXPECT_EQ(response.chunk_info().total_size(), content.size());
+        EXPECT_LE(response.data().size(), 1000);
+
+        received += response.data();
+        offset += response.chunk_info().length();
+        final = response.chunk_info().final();
+        ++chunks;
+    }
+
+    EXPECT_EQ(chunks, 3);
+    EXPECT_EQ(received, content);
+}
+
+TEST_F(RequestManagerTest, ChunkReadsHitContentCache)
+{
+    // Written before the watcher starts, which would report it late
+    common::write_file(test_dir + "/cached.txt", "0123456789");
+    request_manager->set_content_cache(true);
+
+    fenris::Request read;
+    read.set_command(fenris::RequestType::READ_FILE);
+    read.set_filename("cached.txt");
+    ASSERT_TRUE(send(read).success());
+    const uint64_t hits = request_manager->get_content_cache_stats().hits;
+
+    fenris::Response response = read_chunk("cached.txt", 4, 3);
+    ASSERT_TRUE(response.success());
+    EXPECT_EQ(response.data(), "456");
+    EXPECT_EQ(response.chunk_info().total_size(), 10u);
+    EXPECT_FALSE(response.chunk_info().final());
+    EXPECT_EQ(request_manager->get_content_cache_stats().hits, hits + 1);
+
+    // Offset writes drop the cached copy
+    fenris::Request write;
+    write.set_command(fenris::RequestType::WRITE_AT);
+    write.set_filename("cached.txt");
+    write.set_data("ab");
+    write.mutable_chunk()->set_offset(4);
+    ASSERT_TRUE(send(write).success());
+    EXPECT_EQ(read_chunk("cached.txt", 4, 3).data(), "ab6");
+}
+
+TEST_F(RequestManagerTest, InOrderChunkReadsArePrefetched)
+{
+    request_manager->set_readahead(true);
+    std::string content(8000, '\0');
+    for (size_t i = 0; i < content.size(); ++i) {
+        content[i] = static_cast<char>(i % 241);
+    }
+    common::write_file(test_dir + "/blob.bin", content);
+
+    std::string received;
+    for (uint64_t offset = 0; offset < content.size(); offset += 2000) {
+        fenris::Response response = read_chunk("blob.bin", offset, 2000);
+        ASSERT_TRUE(response.success());
+        received += response.data();
+    }
+    EXPECT_EQ(received, content);
+
+    // The first window covers the rest of the file
+    ReadaheadStats stats = request_manager->get_readahead_stats();
+    EXPECT_EQ(stats.sequential_reads, 3u);
+    EXPECT_EQ(stats.random_reads, 0u);
+    EXPECT_EQ(stats.prefetches, 1u);
+
+    // A connection reusing the descriptor does not continue the stream
+    request_manager->client_disconnected(client_socket);
+    EXPECT_TRUE(read_chunk("blob.bin", 8000, 2000).success());
+    EXPECT_EQ(request_manager->get_readahead_stats().sequential_reads, 3u);
+}
+
+TEST_F(RequestManagerTest, ReadChunkClampsLength)
+{
+    common::write_file(test_dir + "/small.txt", "tiny");
+
+    // An unset length falls back to the default block size
+    fenris::Response response = read_chunk("small.txt", 0, 0);
+    ASSERT_TRUE(response.success());
+    EXPECT_EQ(response.data(), "tiny");
+    EXPECT_TRUE(response.chunk_info().final());
+
+    // An empty file is a single final block
+    common::write_file(test_dir + "/empty.txt", "");
+    response = read_chunk("empty.txt", 0, 0);
+    ASSERT_TRUE(response.success());
+    EXPECT_TRUE(response.data().empty());
+    EXPECT_TRUE(response.chunk_info().final());
+
+    response = read_chunk("missing.txt", 0, 0);
+    EXPECT_FALSE(response.success());
+    EXPECT_EQ(response.type(), fenris::ResponseType::ERROR);
+}
+
+TEST_F(RequestManagerTest, WriteChunksBuildFile)
+{
+    ASSERT_TRUE(write_chunk("upload.bin", 0, "first-", false).success());
+    ASSERT_TRUE(write_chunk("upload.bin", 6, "second-", false).success());
+    fenris::Response response = write_chunk("upload.bin", 13, "last", true);
+    ASSERT_TRUE(response.success());
+    EXPECT_TRUE(response.chunk_info().final());
+    EXPECT_EQ(response.chunk_info().total_size(), 17);
+
+    auto [content, result] = common::read_file(test_dir + "/upload.bin");
+    EXPECT_EQ(result, common::FileOperationResult::SUCCESS);
+    EXPECT_EQ(content, "first-second-last");
+
+    // A later block without a first one has nothing to extend
+    response = write_chunk("orphan.bin", 6, "data", true);
+    EXPECT_FALSE(response.success());
+}
+
+TEST_F(RequestManagerTest, RangesReadAndPatchInPlace)
+{
+    common::write_file(test_dir + "/table.db", "aaaabbbbcccc");
+
+    fenris::Request request;
+    request.set_command(fenris::RequestType::WRITE_AT);
+    request.set_filename("table.db");
+    request.set_data("XX");
+    request.mutable_chunk()->set_offset(5);
+    fenris::Response response = send(request);
+    ASSERT_TRUE(response.success());
+    EXPECT_EQ(response.chunk_info().total_size(), 12);
+    EXPECT_EQ(common::read_file(test_dir + "/table.db").first, "aaaabXXbcccc");
+
+    request.Clear();
+    request.set_command(fenris::RequestType::READ_RANGE);
+    request.set_filename("table.db");
+    request.mutable_chunk()->set_offset(4);
+    request.mutable_chunk()->set_length(4);
+    response = send(request);
+    ASSERT_TRUE(response.success());
+    EXPECT_EQ(response.type(), fenris::ResponseType::FILE_CHUNK);
+    EXPECT_EQ(response.data(), "bXXb");
+    EXPECT_EQ(response.chunk_info().total_size(), 12);
+    EXPECT_FALSE(response.chunk_info().final());
+
+    // Offset writes never create files
+    request.Clear();
+    request.set_command(fenris::RequestType::WRITE_AT);
+    request.set_filename("missing.db");
+    request.set_data("data");
+    request.mutable_chunk()->set_offset(0);
+    EXPECT_FALSE(send(request).success());
+    EXPECT_FALSE(fs::exists(test_dir + "/missing.db"));
+}
+
+TEST_F(RequestManagerTest, DurableWritesReplaceFiles)
+{
+    request_manager->set_durable_writes(true);
+
+    fenris::Request request;
+    request.set_command(fenris::RequestType::WRITE_FILE);
+    request.set_filename("journal.log");
+    request.set_data("entry 1\n");
+    ASSERT_TRUE(send(request).success());
+
+    request.set_command(fenris::RequestType::APPEND_FILE);
+    request.set_data("entry 2\n");
+    ASSERT_TRUE(send(request).success());
+
+    EXPECT_EQ(common::read_file(test_dir + "/journal.log").first,
+              "entry 1\nentry 2\n");
+}
+
+TEST_F(RequestManagerTest, AsyncIoReadsAndWritesInWorkingDirectory)
+{
+    request_manager->set_async_io(true);
+    request_manager->set_readahead(true);
+    fs::create_directory(fs::path(test_dir) / "docs");
+    common::write_file(test_dir + "/log.txt", "top level");
+
+    fenris::Request request;
+    request.set_command(fenris::RequestType::CHANGE_DIR);
+    request.set_filename("docs");
+    ASSERT_TRUE(send(request).success());
+
+    request.Clear();
+    request.set_command(fenris::RequestType::WRITE_FILE);
+    request.set_filename("log.txt");
+    request.set_data("entry 1\n");
+    ASSERT_TRUE(send(request).success());
+    request.set_command(fenris::RequestType::APPEND_FILE);
+    request.set_data("entry 2\n");
+    ASSERT_TRUE(send(request).success());
+    EXPECT_EQ(common::read_file(test_dir + "/docs/log.txt").first,
+              "entry 1\nentry 2\n");
+    EXPECT_EQ(common::read_file(test_dir + "/log.txt").first, "top level");
+
+    request.Clear();
+    request.set_command(fenris::RequestType::READ_FILE);
+    request.set_filename("log.txt");
+    fenris::Response response = send(request);
+    ASSERT_TRUE(response.success()) << response.error_message();
+    EXPECT_EQ(response.data(), "entry 1\nentry 2\n");
+
+    std::string received;
+    for (uint64_t offset = 0; offset < 16; offset += 4) {
+        response = read_chunk("log.txt", offset, 4);
+        ASSERT_TRUE(response.success()) << response.error_message();
+        EXPECT_EQ(response.chunk_info().total_size(), 16u);
+        received += response.data();
+    }
+    EXPECT_EQ(received, "entry 1\nentry 2\n");
+    EXPECT_TRUE(response.chunk_info().final());
+    EXPECT_EQ(request_manager->get_readahead_stats().prefetches, 1u);
+
+    // Missing files fail the same way as without the ring
+    request.set_filename("missing.txt");
+    EXPECT_FALSE(send(request).success());
+    request.set_command(fenris::RequestType::APPEND_FILE);
+    request.set_data("x");
+    EXPECT_FALSE(send(request).success());
+}
+
+TEST_F(RequestManagerTest, MetadataCacheSeesOwnChanges)
+{
+    MetadataCacheConfig config;
+    config.ttl = std::chrono::hours(1);
+    request_manager->set_metadata_cache(true, config);
+
+    fenris::Request write;
+    write.set_command(fenris::RequestType::WRITE_FILE);
+    write.set_filename("a.txt");
+    write.set_data("12345");
+    ASSERT_TRUE(send(write).success());
+
+    fenris::Request info;
+    info.set_command(fenris::RequestType::INFO_FILE);
+    info.set_filename("a.txt");
+    fenris::Response response = send(info);
+    ASSERT_TRUE(response.success());
+    EXPECT_EQ(response.file_info().size(), 5);
+    EXPECT_EQ(response.file_info().name(), "a.txt");
+
+    // Cached under the same key, but named as asked
+    info.set_filename("/a.txt");
+    response = send(info);
+    ASSERT_TRUE(response.success());
+    EXPECT_EQ(response.file_info().size(), 5);
+    EXPECT_EQ(response.file_info().name(), "/a.txt");
+
+    fenris::Request list;
+    list.set_command(fenris::RequestType::LIST_DIR);
+    ASSERT_EQ(send(list).directory_listing().entries_size(), 1);
+
+    // Every change shows up in the very next reply
+    fenris::Request append;
+    append.set_command(fenris::RequestType::APPEND_FILE);
+    append.set_filename("a.txt");
+    append.set_data("678");
+    ASSERT_TRUE(send(append).success());
+    EXPECT_EQ(send(info).file_info().size(), 8);
+    EXPECT_EQ(send(list).directory_listing().entries(0).size(), 8);
+
+    fenris::Request mkdir;
+    mkdir.set_command(fenris::RequestType::CREATE_DIR);
+    mkdir.set_filename("sub");
+    ASSERT_TRUE(send(mkdir).success());
+    ASSERT_EQ(send(list).directory_listing().entries_size(), 2);
+
+    fenris::Request create;
+    create.set_command(fenris::RequestType::CREATE_FILE);
+    create.set_filename("sub/b.txt");
+    ASSERT_TRUE(send(create).success());
+    list.set_filename("sub");
+    ASSERT_EQ(send(list).directory_listing().entries_size(), 1);
+
+    fenris::Request remove;
+    remove.set_command(fenris::RequestType::DELETE_FILE);
+    remove.set_filename("sub/b.txt");
+    ASSERT_TRUE(send(remove).success());
+    EXPECT_EQ(send(list).directory_listing().entries_size(), 0);
+
+    remove.set_command(fenris::RequestType::DELETE_DIR);
+    remove.set_filename("sub");
+    ASSERT_TRUE(send(remove).success());
+    EXPECT_FALSE(send(list).success());
+    list.set_filename("");
+    EXPECT_EQ(send(list).directory_listing().entries_size(), 1);
+}
+
+TEST_F(RequestManagerTest, ContentCacheWarmsAndSeesOwnChanges)
+{
+    fs::create_directory(fs::path(test_dir) / "docs");
+    common::write_file(test_dir + "/docs/a.txt", "alpha");
+    common::write_file(test_dir + "/docs/b.txt", "beta");
+    common::write_file(test_dir + "/c.txt", "gamma");
+
+    // Without a cache there is nothing to warm
+    EXPECT_EQ(request_manager->warm_content_cache("/"), 0);
+
+    request_manager->set_content_cache(true);
+    EXPECT_EQ(request_manager->warm_content_cache("docs"), 2);
+
+    fenris::Request read;
+    read.set_command(fenris::RequestType::READ_FILE);
+    read.set_filename("docs/a.txt");
+    EXPECT_EQ(send(read).data(), "alpha");
+    EXPECT_EQ(request_manager->get_content_cache_stats().hits, 1);
+
+    fenris::Request write;
+    write.set_command(fenris::RequestType::WRITE_FILE);
+    write.set_filename("/docs/a.txt");
+    write.set_data("changed");
+    ASSERT_TRUE(send(write).success());
+    EXPECT_EQ(send(read).data(), "changed");
+
+    fenris::Request remove;
+    remove.set_command(fenris::RequestType::DELETE_TREE);
+    remove.set_filename("docs");
+    ASSERT_TRUE(send(remove).success());
+    EXPECT_FALSE(send(read).success());
+
+    // Files beyond the budget are left for the first read
+    CacheConfig small;
+    small.max_bytes = 4;
+    small.shard_count = 1;
+    request_manager->set_content_cache(true, small);
+    EXPECT_EQ(request_manager->warm_content_cache("/"), 0);
+}
+
+TEST_F(RequestManagerTest, FileContentIsSharedNotCopied)
+{
+    common::write_file(test_dir + "/shared.txt", "shared content");
+    request_manager->set_content_cache(true);
+
+    fenris::Request read;
+    read.set_command(fenris::RequestType::READ_FILE);
+    read.set_filename("shared.txt");
+
+    auto first = request_manager->file_content(client_socket, read);
+    ASSERT_TRUE(first.has_value());
+    EXPECT_TRUE(first->first.success());
+    EXPECT_TRUE(first->first.data().empty());
+    EXPECT_EQ(first->second.view(), "shared content");
+
+    // Served from the cache, so both readers see the same bytes
+    auto second = request_manager->file_content(client_socket, read);
+    ASSERT_TRUE(second.has_value());
+    EXPECT_EQ(second->second.data(), first->second.data());
+
+    read.set_filename("missing.txt");
+    auto missing = request_manager->file_content(client_socket, read);
+    ASSERT_TRUE(missing.has_value());
+    EXPECT_FALSE(missing->first.success());
+    EXPECT_TRUE(missing->second.empty());
+
+    fenris::Request ping;
+    ping.set_command(fenris::RequestType::PING);
+    EXPECT_FALSE(
+        request_manager->file_content(client_socket, ping).has_value());
+}
+
+TEST_F(RequestManagerTest, LargeFileContentSurvivesTruncation)
+{
+    const std::string path = test_dir + "/large.bin";
+    const std::string content(2 * common::MAP_THRESHOLD, 'x');
+    common::write_file(path, content);
+
+    fenris::Request read;
+    read.set_command(fenris::RequestType::READ_FILE);
+    read.set_filename("large.bin");
+    auto served = request_manager->file_content(client_socket, read);
+    ASSERT_TRUE(served.has_value());
+    ASSERT_TRUE(served->first.success());
+
+    // Another client rewrites the file while the response is being sent; a
+    // mapped buffer would fault here
+    ASSERT_EQ(truncate(path.c_str(), 0), 0);
+    EXPECT_EQ(served->second.view(), content);
+}
+
+TEST_F(RequestManagerTest, ChunkStoreSharesIdenticalFiles)
+{
+    const std::string store_dir = test_dir + "_chunks";
+    ChunkStoreConfig config;
+    config.min_chunk_size = 1024;
+    config.avg_chunk_size = 4096;
+    config.max_chunk_size = 16 * 1024;
+    config.min_file_size = 1024;
+    ASSERT_TRUE(request_manager->set_chunk_store(true, store_dir, config));
+
+    std::string content;
+    for (int i = 0; content.size() < 64 * 1024; ++i) {
+        content += "line " + std::to_string(i * 7919) + "\n";
+    }
+
+    fenris::Request write;
+    write.set_command(fenris::RequestType::WRITE_FILE);
+    write.set_data(content);
+    for (const char *name : {"a.txt", "b.txt"}) {
+        write.set_filename(name);
+        ASSERT_TRUE(send(write).success());
+    }
+
+    // The tree only holds placeholders of the right size
+    EXPECT_EQ(fs::file_size(test_dir + "/b.txt"), content.size());
+    fenris::Request info;
+    info.set_command(fenris::RequestType::INFO_FILE);
+    info.set_filename("b.txt");
+    EXPECT_EQ(send(info).file_info().size(), content.size());
+
+    fenris::Request read;
+    read.set_command(fenris::RequestType::READ_FILE);
+    read.set_filename("b.txt");
+    EXPECT_EQ(send(read).data(), content);
+    EXPECT_FALSE(
+        request_manager->stream_path(client_socket, read).has_value());
+    EXPECT_EQ(read_chunk("a.txt", 1000, 5000).data(),
+              content.substr(1000, 5000));
+
+    // Changing part of a file writes it back into the tree first
+    fenris::Request append;
+    append.set_command(fenris::RequestType::APPEND_FILE);
+    append.set_filename("a.txt");
+    append.set_data("tail");
+    ASSERT_TRUE(send(append).success());
+    auto [on_disk, result] = common::read_file(test_dir + "/a.txt");
+    EXPECT_EQ(on_disk, content + "tail");
+    read.set_filename("a.txt");
+    EXPECT_EQ(send(read).data(), content + "tail");
+
+    fenris::Request remove;
+    remove.set_command(fenris::RequestType::DELETE_FILE);
+    remove.set_filename("b.txt");
+    ASSERT_TRUE(send(remove).success());
+
+    // Nothing refers to the chunks any more
+    ASSERT_TRUE(request_manager->set_chunk_store(true, store_dir, config));
+    size_t chunks = 0;
+    for (const auto &entry :
+         fs::recursive_directory_iterator(store_dir + "/chunks")) {
+        chunks += entry.is_regular_file() ? 1 : 0;
+    }
+    EXPECT_EQ(chunks, 0);
+    fs::remove_all(store_dir);
+}
+
+TEST_F(RequestManagerTest, ColdFilesAreServedAndRestored)
+{
+    const std::string cold_dir = test_dir + "_cold";
+    TieringConfig config;
+    config.cold_after = std::chrono::seconds(0);
+    config.scan_interval = std::chrono::seconds(0);
+    config.min_file_size = 1024;
+    // Moved files stay cold until they are changed
+    config.promote_reads = 1000;
+    ASSERT_TRUE(request_manager->set_storage_tiering(true, cold_dir, config));
+
+    std::string content;
+    for (int i = 0; content.size() < 64 * 1024; ++i) {
+        content += "line " + std::to_string(i * 7919) + "\n";
+    }
+    fenris::Request write;
+    write.set_command(fenris::RequestType::WRITE_FILE);
+    write.set_data(content);
+    for (const char *name : {"a.txt", "b.txt"}) {
+        write.set_filename(name);
+        ASSERT_TRUE(send(write).success());
+    }
+    ASSERT_EQ(request_manager->demote_cold_files(), 2u);
+
+    fenris::Request read;
+    read.set_command(fenris::RequestType::READ_FILE);
+    read.set_filename("a.txt");
+    EXPECT_EQ(send(read).data(), content);
+    EXPECT_FALSE(
+        request_manager->stream_path(client_socket, read).has_value());
+    EXPECT_EQ(read_chunk("b.txt", 1000, 5000).data(),
+              content.substr(1000, 5000));
+    EXPECT_EQ(request_manager->get_tiering_stats().cold_reads, 2u);
+
+    // Copies get the content, not the placeholder
+    fenris::Request mkdir;
+    mkdir.set_command(fenris::RequestType::CREATE_DIR);
+    mkdir.set_filename("dir");
+    ASSERT_TRUE(send(mkdir).success());
+    ASSERT_TRUE(send(write).success());
+    write.set_filename("dir/c.txt");
+    ASSERT_TRUE(send(write).success());
+    ASSERT_EQ(request_manager->demote_cold_files(), 2u);
+    fenris::Request copy;
+    copy.set_command(fenris::RequestType::COPY_TREE);
+    copy.set_filename("dir");
+    copy.mutable_tree()->set_destination("copy");
+    ASSERT_TRUE(send(copy).success());
+    EXPECT_EQ(common::read_file(test_dir + "/copy/c.txt").first, content);
+
+    // Changing part of a file brings it back into the tree first
+    fenris::Request append;
+    append.set_command(fenris::RequestType::APPEND_FILE);
+    append.set_filename("a.txt");
+    append.set_data("tail");
+    ASSERT_TRUE(send(append).success());
+    EXPECT_EQ(common::read_file(test_dir + "/a.txt").first, content + "tail");
+    EXPECT_EQ(send(read).data(), content + "tail");
+
+    fenris::Request remove;
+    remove.set_command(fenris::RequestType::DELETE_FILE);
+    remove.set_filename("b.txt");
+    ASSERT_TRUE(send(remove).success());
+    EXPECT_EQ(request_manager->get_tiering_stats().cold_files, 1u);
+
+    request_manager->set_storage_tiering(false);
+    fs::remove_all(cold_dir);
+}
+
+TEST_F(RequestManagerTest, TreeRequestsWalkServerSide)
+{
+    for (const char *dir : {"/tree/a/b", "/tree/c"}) {
+        fs::create_directories(test_dir + dir);
+    }
+    for (const char *file :
+         {"/tree/x.log", "/tree/a/y.log", "/tree/a/b/z.txt", "/tree/c/w.log"}) {
+        std::ofstream(test_dir + file) << "12345";
+    }
+
+    fenris::Request du;
+    du.set_command(fenris::RequestType::DU);
+    du.set_filename("tree");
+    auto usage = send(du);
+    ASSERT_TRUE(usage.success());
+    EXPECT_EQ(usage.type(), fenris::ResponseType::TREE_RESULT);
+    EXPECT_EQ(usage.tree_summary().files(), 4);
+    EXPECT_EQ(usage.tree_summary().directories(), 3);
+    EXPECT_EQ(usage.tree_summary().bytes(), 20);
+
+    fenris::Request find;
+    find.set_command(fenris::RequestType::FIND);
+    find.set_filename("/tree");
+    find.mutable_tree()->set_pattern("*.log");
+    auto found = send(find);
+    ASSERT_TRUE(found.success());
+    std::vector<std::string> matches(found.tree_summary().matches().begin(),
+                                     found.tree_summary().matches().end());
+    std::sort(matches.begin(), matches.end());
+    EXPECT_EQ(matches,
+              (std::vector<std::string>{
+                  "/tree/a/y.log", "/tree/c/w.log", "/tree/x.log"}));
+
+    // Copies report progress through the sink while they run
+    fenris::Request copy;
+    copy.set_command(fenris::RequestType::COPY_TREE);
+    copy.set_filename("tree");
+    copy.mutable_tree()->set_destination("copy");
+    copy.mutable_tree()->set_progress_interval_ms(1);
+    auto [copied, keep] = request_manager->handle_request_with_progress(
+        client_socket, copy, [](const fenris::Response &report) {
+            EXPECT_EQ(report.type(), fenris::ResponseType::TREE_PROGRESS);
+            return true;
+        });
+    ASSERT_TRUE(copied.success());
+    EXPECT_EQ(copied.tree_summary().files(), 4);
+    EXPECT_TRUE(fs::exists(test_dir + "/copy/a/b/z.txt"));
+    EXPECT_FALSE(send(copy).success());
+
+    fenris::Request remove;
+    remove.set_command(fenris::RequestType::DELETE_TREE);
+    remove.set_filename("/");
+    EXPECT_FALSE(send(remove).success());
+    remove.set_filename("tree");
+    auto removed = send(remove);
+    ASSERT_TRUE(removed.success());
+    EXPECT_EQ(removed.tree_summary().files(), 4);
+    EXPECT_EQ(removed.tree_summary().directories(), 3);
+    EXPECT_FALSE(fs::exists(test_dir + "/tree"));
+    EXPECT_TRUE(fs::exists(test_dir + "/copy/c/w.log"));
+}
+
+TEST_F(RequestManagerTest, TerminateClosesConnection)
+{
+    fenris::Request request;
+    request.set_command(fenris::RequestType::TERMINATE);
+    auto [response, keep_connection] =
+        request_manager->handle_request(client_socket, request);
+    EXPECT_TRUE(response.success());
+    EXPECT_EQ(response.type(), fenris::ResponseType::TERMINATED);
+    EXPECT_FALSE(keep_connection);
+}
+
+} // namespace test
+} // namespace server
+} // namespace fenris
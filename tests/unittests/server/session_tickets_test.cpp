@@ -0,0 +1,63 @@
+#include "server/session_tickets.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <vector>
+
+namespace fenris {
+namespace server {
+namespace test {
+
+TEST(TicketKeeperTest, RedeemsItsOwnTickets)
+{
+    TicketKeeper keeper;
+    const std::vector<uint8_t> secret(32, 0x3C);
+
+    auto ticket = keeper.issue(secret);
+    ASSERT_TRUE(ticket.has_value());
+    auto redeemed = keeper.redeem(*ticket);
+    ASSERT_TRUE(redeemed.has_value());
+    EXPECT_EQ(*redeemed, secret);
+
+    // Tickets are sealed, the secret cannot be read off them
+    EXPECT_EQ(std::search(ticket->begin(),
+                          ticket->end(),
+                          secret.begin(),
+                          secret.end()),
+              ticket->end());
+    auto again = keeper.issue(secret);
+    ASSERT_TRUE(again.has_value());
+    EXPECT_NE(*again, *ticket);
+}
+
+TEST(TicketKeeperTest, RefusesForeignAndTamperedTickets)
+{
+    TicketKeeper keeper;
+    TicketKeeper other_keeper;
+    const std::vector<uint8_t> secret(32, 0x3C);
+
+    auto ticket = keeper.issue(secret);
+    ASSERT_TRUE(ticket.has_value());
+    EXPECT_FALSE(other_keeper.redeem(*ticket).has_value());
+
+    auto tampered = *ticket;
+    tampered.back() ^= 0x01;
+    EXPECT_FALSE(keeper.redeem(tampered).has_value());
+
+    const std::vector<uint8_t> truncated(ticket->begin(), ticket->begin() + 8);
+    EXPECT_FALSE(keeper.redeem(truncated).has_value());
+    EXPECT_FALSE(keeper.redeem({}).has_value());
+}
+
+TEST(TicketKeeperTest, RefusesExpiredTickets)
+{
+    TicketKeeper keeper(std::chrono::seconds(0));
+    auto ticket = keeper.issue(std::vector<uint8_t>(32, 0x3C));
+    ASSERT_TRUE(ticket.has_value());
+    EXPECT_FALSE(keeper.redeem(*ticket).has_value());
+}
+
+} // namespace test
+} // namespace server
+} // namespace fenris
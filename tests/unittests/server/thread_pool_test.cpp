@@ -0,0 +1,200 @@
+#include "common/logging.hpp"
+#include "server/thread_pool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <sched.h>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace fenris {
+namespace server {
+namespace test {
+
+class ThreadPoolTest : public ::testing::Test {
+  protected:
+    void SetUp() override
+    {
+        common::LoggingConfig log_config;
+        log_config.level = common::LogLevel::DEBUG;
+        log_config.console_logging = true;
+        log_config.file_logging = false;
+
+        common::initialize_logging(log_config, "TestThreadPool");
+    }
+};
+
+TEST_F(ThreadPoolTest, RunsSubmittedTasks)
+{
+    ThreadPool pool(4, "TestThreadPool");
+    ASSERT_EQ(pool.get_thread_count(), 4);
+
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 100; ++i) {
+        results.push_back(pool.submit([i]() { return i * i; }));
+    }
+
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_TRUE(results[i].valid());
+        EXPECT_EQ(results[i].get(), i * i);
+    }
+}
+
+TEST_F(ThreadPoolTest, HighPriorityBypassesQueuedWork)
+{
+    ThreadPool pool(1, "TestThreadPool");
+
+    // Keep the only worker busy while the queue fills up
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    auto blocker = pool.submit([released]() { released.wait(); });
+
+    std::mutex order_mutex;
+    std::vector<int> order;
+    auto record = [&](int id) {
+        std::lock_guard<std::mutex> lock(order_mutex);
+        order.push_back(id);
+    };
+
+    std::vector<std::future<void>> pending;
+    for (int i = 0; i < 5; ++i) {
+        pending.push_back(pool.submit([&record, i]() { record(i); }));
+    }
+    pending.push_back(
+        pool.submit([&record]() { record(100); }, TaskPriority::HIGH));
+
+    release.set_value();
+    blocker.get();
+    for (auto &future : pending) {
+        future.get();
+    }
+
+    ASSERT_EQ(order.size(), 6);
+    EXPECT_EQ(order.front(), 100);
+}
+
+TEST_F(ThreadPoolTest, FairLaneInterleavesFlowsByCost)
+{
+    ThreadPool pool(1, "TestThreadPool");
+
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    auto blocker = pool.submit([released]() { released.wait(); });
+
+    std::mutex order_mutex;
+    std::vector<int> order;
+    auto record = [&](int id) {
+        std::lock_guard<std::mutex> lock(order_mutex);
+        order.push_back(id);
+    };
+
+    // A bulk flow queues first, the small requests of another flow still
+    // run before its second transfer
+    std::vector<std::future<void>> pending;
+    for (int i = 0; i < 3; ++i) {
+        pending.push_back(pool.submit([&record, i]() { record(10 + i); },
+                                      TaskPriority::NORMAL,
+                                      FairShare{1, 1024 * 1024}));
+    }
+    for (int i = 0; i < 3; ++i) {
+        pending.push_back(pool.submit([&record, i]() { record(20 + i); },
+                                      TaskPriority::NORMAL,
+                                      FairShare{2, 4096}));
+    }
+
+    release.set_value();
+    blocker.get();
+    for (auto &future : pending) {
+        future.get();
+    }
+
+    const std::vector<int> expected = {10, 20, 21, 22, 11, 12};
+    EXPECT_EQ(order, expected);
+}
+
+TEST_F(ThreadPoolTest, IdleWorkersStealQueuedTasks)
+{
+    ThreadPool pool(4, "TestThreadPool");
+
+    std::mutex ids_mutex;
+    std::set<std::thread::id> ids;
+
+    // Tasks submitted from inside a worker land on that worker's own deque,
+    // so they can only run elsewhere if siblings steal them
+    auto spawner = pool.submit([&]() {
+        std::vector<std::future<void>> children;
+        for (int i = 0; i < 16; ++i) {
+            children.push_back(pool.submit([&]() {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                std::lock_guard<std::mutex> lock(ids_mutex);
+                ids.insert(std::this_thread::get_id());
+            }));
+        }
+        return children;
+    });
+
+    for (auto &child : spawner.get()) {
+        child.get();
+    }
+
+    EXPECT_GT(ids.size(), 1);
+}
+
+TEST_F(ThreadPoolTest, ShutdownDrainsQueuedTasks)
+{
+    std::atomic<int> completed{0};
+    {
+        ThreadPool pool(2, "TestThreadPool");
+        for (int i = 0; i < 50; ++i) {
+            pool.submit([&completed]() {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                ++completed;
+            });
+        }
+    }
+
+    EXPECT_EQ(completed.load(), 50);
+}
+
+TEST_F(ThreadPoolTest, SubmitAfterShutdownIsRejected)
+{
+    ThreadPool pool(2, "TestThreadPool");
+    pool.shutdown();
+
+    auto future = pool.submit([]() { return 1; });
+    EXPECT_FALSE(future.valid());
+    EXPECT_EQ(pool.get_pending_count(), 0);
+}
+
+TEST_F(ThreadPoolTest, PinnedWorkersRunOnTheirCore)
+{
+    const size_t cores = std::thread::hardware_concurrency();
+    ThreadPool pool(2, "TestThreadPool");
+    ASSERT_TRUE(pool.pin_to_cores(cores - 1));
+
+    // The first worker wraps around to core 0 when cores - 1 is the last one
+    std::set<int> seen;
+    std::mutex mutex;
+    std::vector<std::future<void>> results;
+    for (int i = 0; i < 20; ++i) {
+        results.push_back(pool.submit([&]() {
+            std::lock_guard<std::mutex> lock(mutex);
+            seen.insert(sched_getcpu());
+        }));
+    }
+    for (auto &result : results) {
+        result.get();
+    }
+
+    for (int core : seen) {
+        EXPECT_TRUE(core == static_cast<int>(cores - 1) || core == 0);
+    }
+}
+
+} // namespace test
+} // namespace server
+} // namespace fenris
@@ -0,0 +1,231 @@
+#include "common/file_operations.hpp"
+#include "common/logging.hpp"
+#include "server/tiering.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+namespace fenris {
+namespace server {
+namespace test {
+
+namespace fs = std::filesystem;
+
+class TieringTest : public ::testing::Test {
+  protected:
+    void SetUp() override
+    {
+        fs::remove_all(root_dir);
+        fs::remove_all(cold_dir);
+        fs::create_directories(root_dir + "/sub");
+        common::LoggingConfig log_config;
+        log_config.level = common::LogLevel::DEBUG;
+        log_config.console_logging = true;
+        log_config.file_logging = false;
+        common::initialize_logging(log_config, "TestTiering");
+
+        config.cold_after = std::chrono::seconds(0);
+        config.scan_interval = std::chrono::seconds(0);
+        config.min_file_size = 1024;
+    }
+
+    void TearDown() override
+    {
+        fs::remove_all(root_dir);
+        fs::remove_all(cold_dir);
+    }
+
+    std::unique_ptr<TieringEngine> open_engine()
+    {
+        return std::make_unique<TieringEngine>(
+            root_dir,
+            std::make_unique<DirectoryObjectStore>(cold_dir),
+            config,
+            "TestTiering");
+    }
+
+    // Write a file below the root and return its FileInfo
+    fenris::FileInfo write(const std::string &path, const std::string &data)
+    {
+        EXPECT_EQ(common::write_file(root_dir + path, data),
+                  common::FileOperationResult::SUCCESS);
+        return common::get_file_info(root_dir + path).first;
+    }
+
+    static std::string content(size_t size, char seed)
+    {
+        std::string data(size, '\0');
+        for (size_t i = 0; i < size; ++i) {
+            data[i] = static_cast<char>(seed + i % 61);
+        }
+        return data;
+    }
+
+    static std::span<const uint8_t> bytes(const std::string &data)
+    {
+        return {reinterpret_cast<const uint8_t *>(data.data()), data.size()};
+    }
+
+    static std::string text(const common::Buffer &buffer)
+    {
+        return std::string(buffer.view());
+    }
+
+    const std::string root_dir = "/tmp/fenris_tiering_test";
+    const std::string cold_dir = "/tmp/fenris_tiering_test_cold";
+    TieringConfig config;
+};
+
+TEST_F(TieringTest, DirectoryObjectStoreKeepsObjects)
+{
+    DirectoryObjectStore store(cold_dir);
+    ASSERT_TRUE(store.is_open());
+
+    EXPECT_EQ(store.put("data/a/b", bytes("hello world")),
+              common::FileOperationResult::SUCCESS);
+    EXPECT_EQ(store.put("data/c", bytes("second")),
+              common::FileOperationResult::SUCCESS);
+    EXPECT_EQ(store.put("index/a/b", bytes("record")),
+              common::FileOperationResult::SUCCESS);
+
+    auto [object, result] = store.get("data/a/b");
+    ASSERT_EQ(result, common::FileOperationResult::SUCCESS);
+    EXPECT_EQ(text(object), "hello world");
+    EXPECT_EQ(text(store.get_range("data/a/b", 6, 100).first), "world");
+
+    auto [keys, list_result] = store.list("data/");
+    ASSERT_EQ(list_result, common::FileOperationResult::SUCCESS);
+    std::sort(keys.begin(), keys.end());
+    EXPECT_EQ(keys, (std::vector<std::string>{"data/a/b", "data/c"}));
+    EXPECT_TRUE(store.list("nothing/").first.empty());
+
+    EXPECT_EQ(store.remove("data/a/b"), common::FileOperationResult::SUCCESS);
+    EXPECT_EQ(store.get("data/a/b").second,
+              common::FileOperationResult::FILE_NOT_FOUND);
+    EXPECT_FALSE(fs::exists(cold_dir + "/data/a"));
+
+    // Keys never leave the directory
+    EXPECT_EQ(store.put("../escape", bytes("x")),
+              common::FileOperationResult::INVALID_PATH);
+    EXPECT_EQ(store.put("data/../../escape", bytes("x")),
+              common::FileOperationResult::INVALID_PATH);
+    EXPECT_EQ(store.put(".incoming/x", bytes("x")),
+              common::FileOperationResult::INVALID_PATH);
+}
+
+TEST_F(TieringTest, IdleFilesMoveToColdTier)
+{
+    const std::string data = content(64 * 1024, 'a');
+    const fenris::FileInfo before = write("/sub/big.bin", data);
+    write("/small.txt", "too small to move");
+
+    auto engine = open_engine();
+    EXPECT_EQ(engine->demote_cold(), 1u);
+
+    // The placeholder looks like the file but takes no space
+    struct stat status {};
+    ASSERT_EQ(::stat((root_dir + "/sub/big.bin").c_str(), &status), 0);
+    EXPECT_EQ(static_cast<uint64_t>(status.st_size), data.size());
+    EXPECT_EQ(common::to_modified_time(status.st_mtim),
+              before.modified_time());
+    EXPECT_LT(static_cast<uint64_t>(status.st_blocks) * 512, data.size());
+
+    auto file = engine->find(
+        "/sub/big.bin", before.size(), before.modified_time());
+    ASSERT_TRUE(file.has_value());
+    auto [read, result] = engine->read(*file);
+    ASSERT_EQ(result, common::FileOperationResult::SUCCESS);
+    EXPECT_EQ(text(read), data);
+    EXPECT_EQ(text(engine->read_range(*file, 100, 10).first),
+              data.substr(100, 10));
+
+    TieringStats stats = engine->get_stats();
+    EXPECT_EQ(stats.cold_files, 1u);
+    EXPECT_EQ(stats.cold_bytes, data.size());
+    EXPECT_EQ(stats.demotions, 1u);
+    EXPECT_EQ(stats.cold_reads, 2u);
+
+    // A placeholder is not moved a second time
+    EXPECT_EQ(engine->demote_cold(), 0u);
+}
+
+TEST_F(TieringTest, ReadFilesMoveBack)
+{
+    const std::string data = content(16 * 1024, 'k');
+    const fenris::FileInfo before = write("/file.bin", data);
+
+    auto engine = open_engine();
+    ASSERT_EQ(engine->demote_cold(), 1u);
+    auto file =
+        engine->find("/file.bin", before.size(), before.modified_time());
+    ASSERT_TRUE(file.has_value());
+
+    engine->record_access("/file.bin");
+    EXPECT_EQ(text(engine->read_range(*file, 0, 4).first), data.substr(0, 4));
+    engine->flush();
+
+    auto [on_disk, result] = common::read_file(root_dir + "/file.bin");
+    EXPECT_EQ(on_disk, data);
+    EXPECT_EQ(common::get_file_info(root_dir + "/file.bin")
+                  .first.modified_time(),
+              before.modified_time());
+    EXPECT_FALSE(
+        engine->find("/file.bin", before.size(), before.modified_time()));
+    EXPECT_EQ(engine->get_stats().promotions, 1u);
+    EXPECT_FALSE(fs::exists(cold_dir + "/data/file.bin"));
+}
+
+TEST_F(TieringTest, HotBudgetMovesLeastReadFirst)
+{
+    config.cold_after = std::chrono::hours(1);
+    config.hot_bytes = 12 * 1024;
+    const fenris::FileInfo a = write("/a.bin", content(8 * 1024, 'a'));
+    const fenris::FileInfo b = write("/b.bin", content(8 * 1024, 'b'));
+    const fenris::FileInfo c = write("/c.bin", content(8 * 1024, 'c'));
+
+    auto engine = open_engine();
+    engine->record_access("/a.bin");
+    engine->record_access("/a.bin");
+    engine->record_access("/b.bin");
+
+    // Recently written, so only the budget moves files
+    EXPECT_EQ(engine->demote_cold(), 2u);
+    EXPECT_FALSE(engine->find("/a.bin", a.size(), a.modified_time()));
+    EXPECT_TRUE(engine->find("/b.bin", b.size(), b.modified_time()));
+    EXPECT_TRUE(engine->find("/c.bin", c.size(), c.modified_time()));
+}
+
+TEST_F(TieringTest, RecordsSurviveRestart)
+{
+    const std::string kept = content(4096, 'x');
+    const fenris::FileInfo kept_info = write("/kept.bin", kept);
+    write("/changed.bin", content(4096, 'y'));
+    {
+        auto engine = open_engine();
+        ASSERT_EQ(engine->demote_cold(), 2u);
+    }
+
+    // Rewritten while the server was down
+    write("/changed.bin", "new content");
+
+    auto engine = open_engine();
+    auto file = engine->find(
+        "/kept.bin", kept_info.size(), kept_info.modified_time());
+    ASSERT_TRUE(file.has_value());
+    EXPECT_EQ(text(engine->read(*file).first), kept);
+    EXPECT_EQ(engine->get_stats().cold_files, 1u);
+    EXPECT_FALSE(fs::exists(cold_dir + "/data/changed.bin"));
+
+    // Restoring right away is what requests changing the file do
+    EXPECT_EQ(engine->restore(*file), common::FileOperationResult::SUCCESS);
+    EXPECT_EQ(common::read_file(root_dir + "/kept.bin").first, kept);
+    EXPECT_EQ(engine->get_stats().cold_files, 0u);
+}
+
+} // namespace test
+} // namespace server
+} // namespace fenris
@@ -0,0 +1,262 @@
+#include "common/logging.hpp"
+#include "server/thread_pool.hpp"
+#include "server/tree_walker.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fenris {
+namespace server {
+namespace test {
+
+namespace fs = std::filesystem;
+
+class TreeWalkerTest : public ::testing::Test {
+  protected:
+    void SetUp() override
+    {
+        fs::remove_all(test_dir);
+        common::LoggingConfig log_config;
+        log_config.level = common::LogLevel::DEBUG;
+        log_config.console_logging = true;
+        log_config.file_logging = false;
+
+        common::initialize_logging(log_config, "TestTreeWalker");
+
+        // 3 levels of 4 directories, each holding 3 files of 10 bytes
+        make_tree(source, 3);
+        options.threads = 4;
+    }
+
+    void TearDown() override
+    {
+        fs::remove_all(test_dir);
+    }
+
+    void make_tree(const std::string &directory, int levels)
+    {
+        fs::create_directories(directory);
+        for (int i = 0; i < 3; ++i) {
+            std::ofstream(directory + "/file" + std::to_string(i) + ".txt")
+                << "0123456789";
+        }
+        if (levels == 0) {
+            return;
+        }
+        for (int i = 0; i < 4; ++i) {
+            make_tree(directory + "/dir" + std::to_string(i), levels - 1);
+        }
+    }
+
+    // Relative path of every entry below directory
+    static std::set<std::string> entries(const std::string &directory)
+    {
+        std::set<std::string> paths;
+        for (const auto &entry : fs::recursive_directory_iterator(directory)) {
+            paths.insert(fs::relative(entry.path(), directory).string());
+        }
+        return paths;
+    }
+
+    // 4 + 16 + 64 directories, and 3 files in each of them and the root
+    static constexpr uint64_t DIRECTORIES = 84;
+    static constexpr uint64_t FILES = 3 * (DIRECTORIES + 1);
+
+    const std::string test_dir = "/tmp/fenris_tree_walker_test";
+    const std::string source = test_dir + "/source";
+    TreeWalkOptions options;
+};
+
+TEST_F(TreeWalkerTest, VisitsEveryEntryOnce)
+{
+    TreeWalker walker(options);
+    std::mutex mutex;
+    std::vector<std::string> visited;
+    auto result = walker.walk(source, [&](const TreeEntry &entry) {
+        std::lock_guard<std::mutex> lock(mutex);
+        visited.push_back(entry.path);
+        return true;
+    });
+
+    ASSERT_EQ(result, common::FileOperationResult::SUCCESS);
+    EXPECT_EQ(walker.errors(), 0);
+    EXPECT_FALSE(walker.cancelled());
+    EXPECT_EQ(visited.size(), FILES + DIRECTORIES);
+    EXPECT_EQ(std::set<std::string>(visited.begin(), visited.end()),
+              entries(source));
+}
+
+TEST_F(TreeWalkerTest, WalksSharingAPoolUseOnlyItsThreads)
+{
+    ThreadPool pool(2, "TestTreeWalkerPool");
+    options.threads = 0;
+    options.pool = &pool;
+
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    std::atomic<uint64_t> visited{0};
+    auto visitor = [&](const TreeEntry &entry) {
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.insert(std::this_thread::get_id());
+        ++visited;
+        return true;
+    };
+
+    // More walks at once than the pool has threads
+    std::vector<std::thread> walks;
+    for (int i = 0; i < 4; ++i) {
+        walks.emplace_back([&]() {
+            TreeWalker walker(options);
+            EXPECT_EQ(walker.options().threads, 2u);
+            EXPECT_EQ(walker.walk(source, visitor),
+                      common::FileOperationResult::SUCCESS);
+        });
+    }
+    for (auto &walk : walks) {
+        walk.join();
+    }
+
+    EXPECT_EQ(visited, 4 * (FILES + DIRECTORIES));
+    EXPECT_LE(threads.size(), 2u);
+    EXPECT_EQ(threads.count(std::this_thread::get_id()), 0u);
+}
+
+TEST_F(TreeWalkerTest, SkipsDirectoriesTheVisitorRejects)
+{
+    TreeWalker walker(options);
+    std::atomic<uint64_t> visited{0};
+    std::atomic<uint64_t> below{0};
+    walker.walk(source, [&](const TreeEntry &entry) {
+        ++visited;
+        below += entry.path.starts_with("dir0/") ? 1 : 0;
+        return entry.path != "dir0";
+    });
+
+    // dir0 itself is visited, the 83 entries below it are not
+    EXPECT_EQ(below, 0);
+    EXPECT_EQ(visited, FILES + DIRECTORIES - 83);
+}
+
+TEST_F(TreeWalkerTest, RootMustBeDirectory)
+{
+    TreeWalker walker(options);
+    auto visitor = [](const TreeEntry &) { return true; };
+    EXPECT_EQ(walker.walk(source + "/file0.txt", visitor),
+              common::FileOperationResult::INVALID_PATH);
+    EXPECT_NE(walker.walk(test_dir + "/missing", visitor),
+              common::FileOperationResult::SUCCESS);
+}
+
+TEST_F(TreeWalkerTest, UsageSumsFilesAndBytes)
+{
+    TreeWalker walker(options);
+    TreeCounters counters;
+    ASSERT_EQ(tree_usage(walker, source, counters),
+              common::FileOperationResult::SUCCESS);
+    EXPECT_EQ(counters.files, FILES);
+    EXPECT_EQ(counters.directories, DIRECTORIES);
+    EXPECT_EQ(counters.bytes, 10 * FILES);
+    EXPECT_EQ(counters.errors, 0);
+}
+
+TEST_F(TreeWalkerTest, FindMatchesNamesUpToLimit)
+{
+    TreeWalker walker(options);
+    TreeCounters counters;
+    TreeMatches matches(1000);
+    ASSERT_EQ(find_in_tree(walker,
+                           source,
+                           "file1.*",
+                           "/src/",
+                           counters,
+                           matches),
+              common::FileOperationResult::SUCCESS);
+    auto found = matches.take();
+    EXPECT_EQ(found.size(), DIRECTORIES + 1);
+    EXPECT_FALSE(matches.truncated());
+    EXPECT_NE(std::find(found.begin(), found.end(), "/src/dir3/dir1/file1.txt"),
+              found.end());
+    EXPECT_TRUE(matches.take().empty());
+
+    TreeWalker limited(options);
+    TreeMatches few(5);
+    find_in_tree(limited, source, "*.txt", "/", counters, few);
+    EXPECT_EQ(few.take().size(), 5);
+    EXPECT_TRUE(few.truncated());
+}
+
+TEST_F(TreeWalkerTest, CopyReproducesTree)
+{
+    fs::create_symlink("file0.txt", source + "/link");
+    const std::string destination = test_dir + "/copy";
+
+    TreeWalker walker(options);
+    TreeCounters counters;
+    ASSERT_EQ(copy_tree(walker, source, destination, counters),
+              common::FileOperationResult::SUCCESS);
+    EXPECT_EQ(counters.files, FILES + 1);
+    EXPECT_EQ(counters.directories, DIRECTORIES);
+    EXPECT_EQ(counters.bytes, 10 * FILES);
+    EXPECT_EQ(counters.errors, 0);
+
+    EXPECT_EQ(entries(destination), entries(source));
+    EXPECT_TRUE(fs::is_symlink(destination + "/link"));
+    EXPECT_EQ(fs::read_symlink(destination + "/link"), "file0.txt");
+    std::ifstream copied(destination + "/dir2/dir0/dir3/file2.txt");
+    std::string content;
+    copied >> content;
+    EXPECT_EQ(content, "0123456789");
+
+    // The destination must be new and outside the source
+    TreeCounters again;
+    EXPECT_EQ(copy_tree(walker, source, destination, again),
+              common::FileOperationResult::DIRECTORY_ALREADY_EXISTS);
+    EXPECT_EQ(copy_tree(walker, source, source + "/dir0/inside", again),
+              common::FileOperationResult::INVALID_PATH);
+    EXPECT_FALSE(fs::exists(source + "/dir0/inside"));
+}
+
+TEST_F(TreeWalkerTest, DeleteRemovesEverything)
+{
+    TreeWalker walker(options);
+    TreeCounters counters;
+    ASSERT_EQ(delete_tree(walker, source, counters),
+              common::FileOperationResult::SUCCESS);
+    EXPECT_EQ(counters.files, FILES);
+    EXPECT_EQ(counters.directories, DIRECTORIES);
+    EXPECT_EQ(counters.errors, 0);
+    EXPECT_FALSE(fs::exists(source));
+}
+
+TEST_F(TreeWalkerTest, TickCancelsWalk)
+{
+    // A visitor slow enough for several ticks
+    options.tick_interval = std::chrono::milliseconds(1);
+    TreeWalker walker(options);
+    int ticks = 0;
+    std::atomic<int> visited{0};
+    walker.walk(
+        source,
+        [&](const TreeEntry &) {
+            ++visited;
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            return true;
+        },
+        [&]() { return ++ticks < 3; });
+
+    EXPECT_TRUE(walker.cancelled());
+    EXPECT_EQ(ticks, 3);
+    EXPECT_LT(visited, static_cast<int>(FILES + DIRECTORIES));
+}
+
+} // namespace test
+} // namespace server
+} // namespace fenris